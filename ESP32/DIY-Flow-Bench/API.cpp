@@ -22,19 +22,25 @@
 
 #include "API.h"
 #include <esp32/rom/crc.h> 
+#include <atomic>
 #include <ArduinoJson.h>
 #include <FS.h>
-#include <SPIFFS.h>
+#include "storage.h"
 
 #include "hardware.h"
 #include "sensors.h"
 #include "calculations.h"
+#include "logger.h"
 #include "messages.h"
 #include "calibration.h"
 #include "webserver.h"
 #include "datahandler.h"
+#include "publisher.h"
+#include "trace.h"
 #include "comms.h"
-#include <Preferences.h>
+#include "persistence.h"
+#include "blobstore.h"
+#include "recorder.h"
 
 extern struct BenchSettings settings;
 
@@ -83,11 +89,602 @@ String API::getConfigJSON() {
 
 
 /***********************************************************
- * PARSE API
+ * Command flags
+ ***/
+#define API_BOOT_LOOP 1           // Available while the boot loop is waiting for files / pins
+#define API_FUNCTION 2            // Function mode command (listed by '?' in function mode)
+
+
+// Shared by every command. Only the serial command task runs commands so one buffer is enough
+static char apiResponse[API_BLOB_LENGTH];
+
+
+
+
+/***********************************************************
+ * COMMAND HANDLERS
+ *
+ * Each handler writes its response to request.response (sent as '<response>\n'), or prints long
+ * output straight to request.output and sets the response to " ". An empty response is reported
+ * as 'Invalid Response'. Handlers only create the helper objects they use.
+ ***/
+
+static void apiBenchOff(ApiRequest &request) {
+  Hardware _hardware;
+  _hardware.benchOff();
+  snprintf(request.response, request.length, "0%s%s", API_DELIMITER, "Bench Off");
+}
+
+static void apiBenchOn(ApiRequest &request) {
+  Hardware _hardware;
+  _hardware.benchOn();
+  snprintf(request.response, request.length, "1%s%s", API_DELIMITER, "Bench On");
+}
+
+static void apiVcc3v3(ApiRequest &request) {
+  extern struct SensorData sensorVal;
+  snprintf(request.response, request.length, "3%s%f", API_DELIMITER, sensorVal.VCC_3V3_BUS);
+}
+
+static void apiVcc5v(ApiRequest &request) {
+  extern struct SensorData sensorVal;
+  snprintf(request.response, request.length, "5%s%f", API_DELIMITER, sensorVal.VCC_5V_BUS);
+}
+
+static void apiAdcVolts(ApiRequest &request) {
+  extern struct Configuration config;
+  Hardware _hardware;
+  snprintf(request.response, request.length, "A%s%f%s%f%s%f%s%f", 
+    API_DELIMITER, _hardware.getADCVolts(config.iMAF_ADC_CHAN), 
+    API_DELIMITER, _hardware.getADCVolts(config.iPREF_ADC_CHAN), 
+    API_DELIMITER, _hardware.getADCVolts(config.iPDIFF_ADC_CHAN), 
+    API_DELIMITER, _hardware.getADCVolts(config.iPITOT_ADC_CHAN)); 
+}
+
+static void apiAdcRaw(ApiRequest &request) {
+  extern struct Configuration config;
+  Hardware _hardware;
+  snprintf(request.response, request.length, "a%s%d%s%d%s%d%s%d", 
+    API_DELIMITER, _hardware.getADCRawData(config.iMAF_ADC_CHAN), 
+    API_DELIMITER, _hardware.getADCRawData(config.iPREF_ADC_CHAN), 
+    API_DELIMITER, _hardware.getADCRawData(config.iPDIFF_ADC_CHAN), 
+    API_DELIMITER, _hardware.getADCRawData(config.iPITOT_ADC_CHAN)); 
+}
+
+static void apiBaro(ApiRequest &request) {
+  extern struct SensorData sensorVal;
+  snprintf(request.response, request.length, "B%s%f", API_DELIMITER, sensorVal.BaroHPA);
+}
+
+static void apiMafCoefficients(ApiRequest &request) {
+  extern struct Configuration config;
+  snprintf(request.response, request.length, "C%s%.6f, %.6f, %.6f, %.6f, %.6f, %.6f", API_DELIMITER, config.mafCoeff0, config.mafCoeff1, config.mafCoeff2, config.mafCoeff3, config.mafCoeff4, config.mafCoeff5);
+}
+
+static void apiPDiff(ApiRequest &request) {
+  extern struct SensorData sensorVal;
+  Calculations _calculations;
+  snprintf(request.response, request.length, "D%s%f", API_DELIMITER, _calculations.convertPressure(sensorVal.PDiffKPA, INH2O));
+}
+
+static void apiEnum1(ApiRequest &request) {
+  extern struct SensorData sensorVal;
+  Calculations _calculations;
+  snprintf(request.response, request.length, "E%s%f%s%f%s%f%s%f%s%f", 
+    API_DELIMITER, sensorVal.FlowCFM, 
+    API_DELIMITER, _calculations.convertPressure(sensorVal.PRefKPA, KPA), 
+    API_DELIMITER, _calculations.convertTemperature(sensorVal.TempDegC, DEGC), 
+    API_DELIMITER, _calculations.convertRelativeHumidity(sensorVal.RelH, PERCENT), 
+    API_DELIMITER, sensorVal.BaroKPA);
+}
+
+static void apiEnum2(ApiRequest &request) {
+  extern struct SensorData sensorVal;
+  snprintf(request.response, request.length, "e%s%f%s%f", API_DELIMITER, sensorVal.PitotKPA, API_DELIMITER, sensorVal.Swirl); 
+}
+
+static void apiFlow(ApiRequest &request) {
+  extern struct SensorData sensorVal;
+  snprintf(request.response, request.length, "F%s%f", API_DELIMITER, sensorVal.FlowCFM);
+}
+
+static void apiMassFlow(ApiRequest &request) {
+  Sensors _sensors;
+  snprintf(request.response, request.length, "f%s%f", API_DELIMITER, _sensors.getMafFlow());
+}
+
+static void apiSSEStats(ApiRequest &request) {
+  extern Publisher _publisher;
+  JsonDocument jsondoc;
+  deserializeJson(jsondoc, _publisher.getClientStatsJSON());
+  serializeJsonPretty(jsondoc, request.output);
+  snprintf(request.response, request.length, "%s", " "); // send an empty string to prevent Invalid Response
+}
+
+static void apiHumidity(ApiRequest &request) {
+  extern struct SensorData sensorVal;
+  snprintf(request.response, request.length, "H%s%f", API_DELIMITER, sensorVal.RelH);
+}
+
+static void apiIPAddress(ApiRequest &request) {
+  extern struct DeviceStatus status;
+  snprintf(request.response, request.length, "I%s%s", API_DELIMITER, status.local_ip_address.c_str());
+}
+
+static void apiStatusJSON(ApiRequest &request) {
+  DataHandler _data;
+  JsonDocument jsondoc;
+  deserializeJson(jsondoc, _data.buildIndexSSEJsonData());
+  serializeJsonPretty(jsondoc, request.output);
+  snprintf(request.response, request.length, "%s", " ");
+}
+
+static void apiMimicJSON(ApiRequest &request) {
+  DataHandler _data;
+  JsonDocument jsondoc;
+  deserializeJson(jsondoc, _data.buildMimicSSEJsonData());
+  serializeJsonPretty(jsondoc, request.output);
+  snprintf(request.response, request.length, "%s", " ");
+}
+
+static void apiMafLookup(ApiRequest &request) {
+  extern struct SensorData sensorVal;
+  snprintf(request.response, request.length, "k%s MAF DATA Lookup value: %ld ", API_DELIMITER, sensorVal.MafLookup); 
+}
+
+static void apiLiftData(ApiRequest &request) {
+  Webserver _webserver;
+  request.output.print(_webserver.getLiftDataJSON());
+  snprintf(request.response, request.length, "%s", " ");
+}
+
+static void apiHostname(ApiRequest &request) {
+  extern struct BenchSettings settings;
+  snprintf(request.response, request.length, "N%s%s", API_DELIMITER, settings.hostname.c_str());
+}
+
+static void apiOrificeFlow(ApiRequest &request) {
+  extern struct DeviceStatus status;
+  snprintf(request.response, request.length, "O%s%f", API_DELIMITER, status.activeOrificeFlowRate);
+}
+
+static void apiOrifice(ApiRequest &request) {
+  extern struct DeviceStatus status;
+  snprintf(request.response, request.length, "o%s%s", API_DELIMITER, status.activeOrifice.c_str());
+}
+
+static void apiPitot(ApiRequest &request) {
+  extern struct SensorData sensorVal;
+  Calculations _calculations;
+  snprintf(request.response, request.length, "P%s%f", API_DELIMITER, _calculations.convertPressure(sensorVal.PitotKPA, INH2O));
+}
+
+static void apiPRef(ApiRequest &request) {
+  extern struct SensorData sensorVal;
+  Calculations _calculations;
+  snprintf(request.response, request.length, "R%s%f", API_DELIMITER, _calculations.convertPressure(sensorVal.PRefKPA, INH2O));
+}
+
+static void apiStatus(ApiRequest &request) {
+
+  extern struct DeviceStatus status;
+  Print &output = request.output;
+
+  output.printf("debug = %s\n",status.debug ? "true" : "false");
+  output.printf("spiffs_mem_size = %i\n", status.spiffs_mem_size);
+  output.printf("spiffs_mem_used = %i\n", status.spiffs_mem_used);
+  output.printf("pageSize = %i\n", status.pageSize);
+  output.printf("local_ip_address = %s\n", status.local_ip_address.c_str());
+  output.printf("hostname = %s\n", status.hostname.c_str());
+  output.printf("boardType = %s\n", status.boardType.c_str());
+  output.printf("benchType = %s\n", status.benchType.c_str());
+  output.printf("mafSensor = %s\n", status.mafSensor.c_str());
+  output.printf("mafLink = %s \n", status.mafLink.c_str());
+  output.printf("prefSensor = %s\n", status.prefSensor.c_str());
+  output.printf("pdiffSensor = %s\n", status.pdiffSensor.c_str());
+  output.printf("tempSensor = %s\n", status.tempSensor.c_str());
+  output.printf("relhSensor = %s\n", status.relhSensor.c_str());
+  output.printf("baroSensor = %s\n", status.baroSensor.c_str());
+  output.printf("pitotSensor = %s\n", status.pitotSensor.c_str());
+  output.printf("boot_time = %i\n", status.boot_time);
+  output.printf("liveStream = %s\n", status.liveStream ? "true" : "false");
+  output.printf("ssePollTimer = %ld\n", status.ssePollTimer);
+  output.printf("wsCLeanPollTimer = %ld\n", status.wsCLeanPollTimer);
+  output.printf("pollTimer = %i\n", status.pollTimer);
+  output.printf("serialData = %i\n", status.serialData);
+  output.printf("statusMessage = %s\n", status.statusMessage.c_str());
+  output.printf("apMode = %s\n",status.apMode ? "true" : "false");
+  output.printf("HWMBME = %f\n",status.HWMBME);
+  output.printf("HWMADC = %f\n",status.HWMADC);
+  output.printf("HWMSSE = %f\n",status.HWMSSE);
+  output.printf("activeOrifice =  %s\n", status.activeOrifice.c_str());
+  output.printf("activeOrificeFlowRate =  %f\n", status.activeOrificeFlowRate);
+  output.printf("activeOrificeTestPressure =  %f\n", status.activeOrificeTestPressure);
+  output.printf("shouldReboot  =  %s\n", status.shouldReboot ? "true" : "false");
+  output.printf("pinsLoaded  =  %s\n", status.pinsLoaded ? "true" : "false");
+  output.printf("mafLoaded  =  %s\n", status.mafLoaded ? "true" : "false");
+  output.printf("configLoaded  =  %s\n", status.configLoaded ? "true" : "false");
+  output.printf("GUIexists  =  %s\n", status.GUIexists ? "true" : "false");
+  output.printf("pinsFilename =  %s\n", status.pinsFilename.c_str());
+  output.printf("mafFilename =  %s\n", status.mafFilename.c_str());
+  output.printf("indexFilename =  %s\n", status.indexFilename.c_str());
+  output.printf("doBootLoop =  %s\n", status.doBootLoop ? "true" : "false");
+  output.printf("webserverIsRunning  =  %s\n", status.webserverIsRunning ? "true" : "false");
+  output.printf("mafDataTableRows  =  %i\n", status.mafDataTableRows);
+  output.printf("mafDataValMax  =  %u\n", status.mafDataValMax);
+  output.printf("mafDataKeyMax  =  %u\n", status.mafDataKeyMax);
+  output.printf("mafUnits =  %s\n", status.mafUnits);
+  output.printf("mafScaling  =  %f\n", status.mafScaling);
+  output.printf("mafDiameter  =  %i\n", status.mafDiameter);
+  output.printf("mafSensorType=  %s\n", status.mafSensorType.c_str());
+  output.printf("mafOutputType =  %s\n", status.mafOutputType);
+  snprintf(request.response, request.length, "%s", " ");
+
+}
+
+static void apiTemperatureF(ApiRequest &request) {
+  extern struct SensorData sensorVal;
+  Calculations _calculations;
+  snprintf(request.response, request.length, "t%s%f", API_DELIMITER, _calculations.convertTemperature(sensorVal.TempDegC, DEGF));
+}
+
+static void apiTemperatureC(ApiRequest &request) {
+  extern struct SensorData sensorVal;
+  snprintf(request.response, request.length, "T%s%f", API_DELIMITER, sensorVal.TempDegC);
+}
+
+static void apiUptimeMinutes(ApiRequest &request) {
+  extern struct DeviceStatus status;
+  snprintf(request.response, request.length, "u%s%lu", API_DELIMITER, (millis() - status.boot_time) / 60000);
+}
+
+static void apiUptime(ApiRequest &request) {
+  Hardware _hardware;
+  snprintf(request.response, request.length, "U%s%g", API_DELIMITER, _hardware.uptime());
+}
+
+static void apiVersion(ApiRequest &request) {
+  snprintf(request.response, request.length, "V%s%s.%s.%s", API_DELIMITER, MAJOR_VERSION, MINOR_VERSION, BUILD_NUMBER);
+}
+
+static void apiSSID(ApiRequest &request) {
+  extern struct BenchSettings settings;
+  extern struct DeviceStatus status;
+  snprintf(request.response, request.length, "W%s%s", API_DELIMITER, status.apMode ? settings.wifi_ap_ssid.c_str() : settings.wifi_ssid.c_str());
+}
+
+static void apiTaskStack(ApiRequest &request) {
+  extern TaskHandle_t sensorDataTask;
+  extern TaskHandle_t enviroDataTask;
+  Calculations _calculations;
+  snprintf(request.response, request.length, "X%sStack Free Memory EnviroTask=%s / SensorTask=%s ", API_DELIMITER, _calculations.byteDecode(uxTaskGetStackHighWaterMark(enviroDataTask)).c_str(), _calculations.byteDecode(uxTaskGetStackHighWaterMark(sensorDataTask)).c_str()); 
+}
+
+static void apiTaskMemory(ApiRequest &request) {
+  extern TaskHandle_t sensorDataTask;
+  extern TaskHandle_t enviroDataTask;
+  Calculations _calculations;
+  snprintf(request.response, request.length, "EnviroTask=%s  \nSensorTask=%s \nAPITask=%s", 
+    _calculations.byteDecode(uxTaskGetStackHighWaterMark(enviroDataTask)).c_str(), 
+    _calculations.byteDecode(uxTaskGetStackHighWaterMark(sensorDataTask)).c_str(), 
+    _calculations.byteDecode(uxTaskGetStackHighWaterMark(NULL)).c_str()); 
+}
+
+static void apiHelp(ApiRequest &request);
+
+static void apiFileList(ApiRequest &request) {
+
+  extern struct DeviceStatus status;
+  Calculations _calculations;
+  StorageIndexEntry entry;
+  Print &output = request.output;
+
+  status.spiffs_mem_size = Storage::totalBytes();
+  status.spiffs_mem_used = Storage::usedBytes();
+
+  output.printf("\nFile List\n================\n");
+  for (int i = 0; Storage::getEntry(i, entry); i++) {
+    output.printf("%s  %s\n", entry.path + 1, _calculations.byteDecode(entry.size).c_str());
+  }
+  output.printf("================\n");
+  output.printf("\nTotal space:      %s\n", _calculations.byteDecode(status.spiffs_mem_size).c_str());
+  output.printf("Total space used: %s\n", _calculations.byteDecode(status.spiffs_mem_used).c_str());
+  output.printf("================\n");
+  snprintf(request.response, request.length, "%s", " ");
+
+}
+
+// Toggle a settings flag and report the new state
+static void apiToggle(ApiRequest &request, bool &flag, const char *prefix, const char *name) {
+  flag = !flag;
+  snprintf(request.response, request.length, "%s%s%s Mode %s", prefix, API_DELIMITER, name, flag ? "On" : "Off"); 
+}
+
+static void apiDebugMode(ApiRequest &request) {
+  extern struct BenchSettings settings;
+  apiToggle(request, settings.debug_mode, "!", "Debug");
+}
+
+static void apiVerboseMode(ApiRequest &request) {
+  extern struct BenchSettings settings;
+  apiToggle(request, settings.verbose_print_mode, "!", "Verbose Print");
+}
+
+static void apiStatusPrintMode(ApiRequest &request) {
+  extern struct BenchSettings settings;
+  apiToggle(request, settings.status_print_mode, "!", "Status Print");
+}
+
+static void apiDeveloperMode(ApiRequest &request) {
+  extern struct BenchSettings settings;
+  apiToggle(request, settings.dev_mode, "#", "Developer");
+}
+
+static void apiFunctionMode(ApiRequest &request) {
+  extern struct BenchSettings settings;
+  apiToggle(request, settings.function_mode, "#", "Function");
+}
+
+static void apiLastError(ApiRequest &request) {
+  snprintf(request.response, request.length, "%s", "No error in buffer");
+}
+
+static void apiRestart(ApiRequest &request) {
+  request.output.printf("%s\n", "Restarting...");
+  Persistence::flush();
+  Logger::flush(LOG_FLUSH_TIMEOUT_MS);
+  ESP.restart();
+}
+
+static void apiRecoverWiFi(ApiRequest &request) {
+  Comms _comms;
+  request.output.printf("%s\n", "Attempting to recover WiFi Connection");
+  _comms.wifiReconnect();
+  snprintf(request.response, request.length, "$%s%s", API_DELIMITER, "WiFi reconnect done");
+}
+
+static void apiResetWiFi(ApiRequest &request) {
+  extern struct BenchSettings settings;
+  if (!settings.function_mode) return;
+  BlobStore::setField(BLOB_STORE_SETTINGS, "sWIFI_AP_SSID", "DIYFB");
+  BlobStore::setField(BLOB_STORE_SETTINGS, "sWIFI_AP_PSWD", "123456789");
+  Persistence::request(PERSIST_SETTINGS);
+  settings.function_mode = false;
+  snprintf(request.response, request.length, "%s", "Attempting to reset WiFi passwords");
+}
+
+static void apiResetPins(ApiRequest &request) {
+  extern struct BenchSettings settings;
+  Hardware _hardware;
+  if (!settings.function_mode) return;
+  _hardware.resetPins();
+  settings.function_mode = false;
+  snprintf(request.response, request.length, "#%s%s", API_DELIMITER, "Pins Reset"); 
+}
+
+static void apiABTest(ApiRequest &request) {
+  extern struct BenchSettings settings;
+  settings.AB_test = (settings.AB_test == 'A') ? 'B' : (settings.AB_test == 'B') ? 'C' : 'A';
+  snprintf(request.response, request.length, "#%sA/B test %c", API_DELIMITER, settings.AB_test); 
+}
+
+static void apiPing(ApiRequest &request) {
+  snprintf(request.response, request.length, "PING%s%s", API_DELIMITER, request.arguments);
+}
+
+static void apiBench(ApiRequest &request) {
+  Hardware _hardware;
+  if (strcasecmp(request.arguments, "ON") == 0) {
+    _hardware.benchOn();
+  } else if (strcasecmp(request.arguments, "OFF") == 0) {
+    _hardware.benchOff();
+  } else {
+    snprintf(request.response, request.length, "ERR%sARGUMENT", API_DELIMITER);
+    return;
+  }
+  snprintf(request.response, request.length, "BENCH%s%s", API_DELIMITER, request.arguments);
+}
+
+static void apiGet(ApiRequest &request) {
+
+  extern struct SensorData sensorVal;
+
+  static const struct {
+    const char *name;
+    double SensorData::*value;
+  } channel[] = {
+    {"FlowCFM", &SensorData::FlowCFM},
+    {"FlowKGH", &SensorData::FlowKGH},
+    {"FlowSCFM", &SensorData::FlowSCFM},
+    {"FlowADJ", &SensorData::FlowADJ},
+    {"FlowADJSCFM", &SensorData::FlowADJSCFM},
+    {"PRefKPA", &SensorData::PRefKPA},
+    {"PRefH2O", &SensorData::PRefH2O},
+    {"PDiffKPA", &SensorData::PDiffKPA},
+    {"PDiffH2O", &SensorData::PDiffH2O},
+    {"PitotKPA", &SensorData::PitotKPA},
+    {"PitotH2O", &SensorData::PitotH2O},
+    {"TempDegC", &SensorData::TempDegC},
+    {"BaroHPA", &SensorData::BaroHPA},
+    {"RelH", &SensorData::RelH},
+    {"Swirl", &SensorData::Swirl}
+  };
+
+  int length = snprintf(request.response, request.length, "GET");
+
+  for (char *name = strtok(request.arguments, ","); name != NULL && length < (int)request.length; name = strtok(NULL, ",")) {
+    int found = -1;
+    for (int i = 0; i < (int)(sizeof(channel) / sizeof(channel[0])); i++) {
+      if (strcasecmp(name, channel[i].name) == 0) found = i;
+    }
+    if (found < 0) {
+      length += snprintf(request.response + length, request.length - length, "%s?", API_DELIMITER);
+    } else {
+      length += snprintf(request.response + length, request.length - length, "%s%f", API_DELIMITER, sensorVal.*channel[found].value);
+    }
+  }
+
+}
+
+static void apiRecord(ApiRequest &request) {
+  extern Recorder _recorder;
+  if (strcasecmp(request.arguments, "START") == 0) {
+    _recorder.start();
+  } else if (strcasecmp(request.arguments, "STOP") == 0) {
+    _recorder.stop();
+  } else if (strcasecmp(request.arguments, "STATUS") != 0) {
+    snprintf(request.response, request.length, "ERR%sARGUMENT", API_DELIMITER);
+    return;
+  }
+  snprintf(request.response, request.length, "RECORD%s%s", API_DELIMITER, _recorder.getStatusJSON().c_str());
+}
+
+
+
+
+/***********************************************************
+ * COMMAND REGISTRY
+ *
+ * Order is the '?' listing order. Lives in flash, nothing is copied at run time.
+ * Commands with no single character are only available as framed requests (see API.h)
+ ***/
+static constexpr ApiCommand apiCommands[] = {
+  // command  name              handler               flags                          help
+  {'0',  "BENCH_OFF",       apiBenchOff,          0,                             "Bench Off"},
+  {'1',  "BENCH_ON",        apiBenchOn,           0,                             "Bench On"},
+  {'3',  "VCC_3V3",         apiVcc3v3,            0,                             "3.3V Voltage Value"},
+  {'5',  "VCC_5V",          apiVcc5v,             0,                             "5V Voltage Value"},
+  {'A',  "ADC_VOLTS",       apiAdcVolts,          0,                             "ADC Voltage Values Maf:pRef:pDiff:Pitot"},
+  {'a',  "ADC_RAW",         apiAdcRaw,            0,                             "ADC Raw Values Maf:pRef:pDiff:Pitot"},
+  {'B',  "BARO",            apiBaro,              0,                             "Barometric Pressure"},
+  {'C',  "MAF_COEFF",       apiMafCoefficients,   API_BOOT_LOOP,                 "MAF Coefficients"},
+  {'D',  "PDIFF",           apiPDiff,             0,                             "Differential Pressure value inH2O"},
+  {'E',  "ENUM1",           apiEnum1,             0,                             "Enum1 Flow:Ref:Temp:Humidity:Baro"},
+  {'e',  "ENUM2",           apiEnum2,             0,                             "Enum2 Pitot:Swirl"},
+  {'F',  "FLOW",            apiFlow,              0,                             "Flow Value in CFM"},
+  {'f',  "MASS_FLOW",       apiMassFlow,          0,                             "Flow Value in KG/H"},
+  {'G',  "SSE_STATS",       apiSSEStats,          0,                             "SSE Client Stats"},
+  {'H',  "HUMIDITY",        apiHumidity,          0,                             "Humidity Value (%)"},
+  {'I',  "IP",              apiIPAddress,         API_BOOT_LOOP,                 "IP Address"},
+  {'J',  "STATUS_JSON",     apiStatusJSON,        0,                             "JSON Status Data"},
+  {'j',  "MIMIC_JSON",      apiMimicJSON,         0,                             "JSON Mimic Data"},
+  {'k',  "MAF_LOOKUP",      apiMafLookup,         0,                             "MAF Data Lookup Value"},
+  {'l',  "LIFT_DATA",       apiLiftData,          0,                             "Valve Lift Data (JSON)"},
+  {'N',  "HOSTNAME",        apiHostname,          API_BOOT_LOOP,                 "Hostname"},
+  {'O',  "ORIFICE_FLOW",    apiOrificeFlow,       0,                             "Active Orifice Flow Rate"},
+  {'o',  "ORIFICE",         apiOrifice,           0,                             "Active Orifice"},
+  {'P',  "PITOT",           apiPitot,             0,                             "Pitot Value inH2O"},
+  {'R',  "PREF",            apiPRef,              0,                             "Reference Pressure Value inH2O"},
+  {'S',  "STATUS",          apiStatus,            API_BOOT_LOOP,                 "Status"},
+  {'T',  "TEMP_C",          apiTemperatureC,      0,                             "Temperature in Celcius"},
+  {'t',  "TEMP_F",          apiTemperatureF,      0,                             "Temperature in Fahrenheit"},
+  {'U',  "UPTIME",          apiUptime,            API_BOOT_LOOP,                 "Uptime in hhhh.mm"},
+  {'u',  "UPTIME_MIN",      apiUptimeMinutes,     API_BOOT_LOOP,                 "Uptime in minutes"},
+  {'V',  "VERSION",         apiVersion,           API_BOOT_LOOP,                 "Version"},
+  {'W',  "SSID",            apiSSID,              API_BOOT_LOOP,                 "WiFi SSID"},
+  {'X',  "TASK_STACK",      apiTaskStack,         API_BOOT_LOOP,                 "xTask memory usage"},
+  {'x',  "TASK_MEMORY",     apiTaskMemory,        API_BOOT_LOOP,                 "Task stack free memory"},
+  {'?',  "HELP",            apiHelp,              API_BOOT_LOOP,                 "Help"},
+  {'<',  "LAST_ERROR",      apiLastError,         API_BOOT_LOOP,                 "Last Error"},
+  {'/',  "FILES",           apiFileList,          API_BOOT_LOOP,                 "File List"},
+  {'~',  "RESTART",         apiRestart,           API_BOOT_LOOP,                 "Restart ESP"},
+  {'$',  "WIFI_RECOVER",    apiRecoverWiFi,       API_BOOT_LOOP,                 "Reset WiFi"},
+  {'!',  "DEBUG_MODE",      apiDebugMode,         API_BOOT_LOOP,                 "Debug Mode"},
+  {'+',  "VERBOSE_MODE",    apiVerboseMode,       API_BOOT_LOOP,                 "Verbose Mode"},
+  {'=',  "STATUS_MODE",     apiStatusPrintMode,   API_BOOT_LOOP,                 "Status Mode"},
+  {'#',  "DEV_MODE",        apiDeveloperMode,     API_BOOT_LOOP,                 "Developer Mode"},
+  {'^',  "FUNCTION_MODE",   apiFunctionMode,      API_BOOT_LOOP,                 "FUNCTION MODE"},
+  {'&',  "RESET_PINS",      apiResetPins,         API_BOOT_LOOP | API_FUNCTION,  "Reset Pins"},
+  {'%',  "RESET_WIFI",      apiResetWiFi,         API_BOOT_LOOP | API_FUNCTION,  "Reset WiFi AP SSID & Password"},
+  {'\\', "AB_TEST",         apiABTest,            API_BOOT_LOOP,                 NULL},
+  {0,    "PING",            apiPing,              API_BOOT_LOOP,                 "Echo arguments"},
+  {0,    "BENCH",           apiBench,             0,                             "Bench ON | OFF"},
+  {0,    "GET",             apiGet,               0,                             "Sensor values e.g. GET FlowCFM,PRefH2O"},
+  {0,    "RECORD",          apiRecord,            0,                             "Session recorder START | STOP | STATUS"}
+};
+
+#define API_COMMAND_COUNT (sizeof(apiCommands) / sizeof(apiCommands[0]))
+
+
+
+
+/***********************************************************
+ * @brief apiHelp
+ * @details List the commands available in the current mode from the registry
+ ***/
+static void apiHelp(ApiRequest &request) {
+
+  extern struct BenchSettings settings;
+  extern struct DeviceStatus status;
+
+  Print &output = request.output;
+  uint8_t mask = 0;
+  uint8_t match = 0;
+
+  if (status.doBootLoop) {
+    output.printf("\n  DIYFB BOOT LOOP Commands\n");
+    mask = match = API_BOOT_LOOP;
+  } else if (settings.function_mode) {
+    output.printf("\n  DIYFB Function Commands\n");
+    mask = match = API_FUNCTION;
+  } else {
+    output.printf("\n  DIYFB API Commands\n");
+    mask = API_FUNCTION;
+  }
+
+  output.printf("  ==============================\n");
+  output.printf("  API Response Format\n");
+  output.printf("  Command : Value : Checksum\n");
+  output.printf("  Framed: #<id> <command | name> [args][*crc32]\n");
+  output.printf("  ==============================\n");
+
+  for (size_t i = 0; i < API_COMMAND_COUNT; i++) {
+    const ApiCommand &command = apiCommands[i];
+    if (command.help == NULL || (command.flags & mask) != match) continue;
+    output.printf("  %c  %-15s: %s\n", command.command ? command.command : ' ', command.name, command.help);
+  }
+
+  output.printf("  ==============================\n");
+  snprintf(request.response, request.length, "%s", " ");
+
+}
+
+
+
+
+/***********************************************************
+ * @brief findCommand
+ * @returns registry entry for a single character command or framed command name (NULL if unknown)
+ ***/
+const ApiCommand * API::findCommand(char command) {
+
+  if (command == 0) return NULL;
+
+  for (size_t i = 0; i < API_COMMAND_COUNT; i++) {
+    if (apiCommands[i].command == command) return &apiCommands[i];
+  }
+
+  return NULL;
+
+}
+
+const ApiCommand * API::findCommand(const char *name) {
+
+  for (size_t i = 0; i < API_COMMAND_COUNT; i++) {
+    if (strcasecmp(apiCommands[i].name, name) == 0) return &apiCommands[i];
+  }
+
+  return NULL;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief runCommand
+ * @details Run a registry entry and send the response
  *
- * Handles Serial API responses
- * See apiHelpText below for breakdown of API data mnemonics
- * 
  * Response anatomy:
  * API Response format 'V:1.1.20080705:48853'
  * Response Code:  'V'
@@ -98,680 +695,334 @@ String API::getConfigJSON() {
  *
  * Note: checksum is optional  
  ***/
-void API::ParseMessage(char apiMessage) {
+void API::runCommand(const ApiCommand *command, char *arguments, Print &output) {
 
-  extern struct BenchSettings settings;
-  extern struct CalibrationData calVal;
-  extern struct SensorData sensorVal;
   extern struct DeviceStatus status;
-  extern struct Configuration config;
 
-  Calculations _calculations;
-  Sensors _sensors;
-  Messages _message;    
-  Hardware _hardware;
-  Webserver _webserver;
-  Calibration _calibration;
-  DataHandler _data;
-  Comms _comms;
-  Preferences _prefs;
-  
-  extern TaskHandle_t sensorDataTask;
-  extern TaskHandle_t enviroDataTask;
-  
-  // define char arrays for response strings
-  char apiResponse[API_RESPONSE_LENGTH];  //64
-  char apiResponseBlob[API_BLOB_LENGTH];  //1024
-  // char charDataJSON[API_JSON_LENGTH];     //1020
-  char fileListBlob[1024];
-  
+  TRACE_SCOPE(TRACE_API_PARSE);
+
+  ApiRequest request = {arguments, apiResponse, sizeof(apiResponse), output};
 
-  // Initialise arrays
   apiResponse[0] = 0;
-  apiResponseBlob[0] = 0;
-  // charDataJSON[0] = 0;
-  fileListBlob[0] = 0;
-  
-  String envTaskMem;
-  String sensTaskMem;
-  String loopTaskMem;
 
-  String jsonString;
-  long refValue;
-  
-  //API Response
-  char apiHelpText[] = R"(
-  DIYFB API Commands
-  ==============================
-  API Response Format
-  Command : Value : Checksum
-  ==============================
-  3 : 3.3V Voltage Value
-  5 : 5V Voltage Value
-  A : ADC Voltage Values Maf:pRef:pDiff:Pitot
-  a : ADC Raw Values Maf:pRef:pDiff:Pitot
-  B : Barometric Pressure
-  C : MAF Coefficients
-  D : Differential Pressure value inH2O
-  E : Enum1 Flow:Ref:Temp:Humidity:Baro
-  e : Enum2 Pitot:Swirl
-  F : Flow Value in CFM
-  f : Flow Value in KG/H
-  H : Humidity Value (%)
-  I : IP Address
-  J : JSON Status Data
-  j : JSON Mimic Data
-  N : Hostname
-  o : Active Orifice
-  P : Pitot Value inH2O
-  R : Reference Pressure Value inH2O
-  S : Status
-  T : Temperature in Celcius
-  t : Temperature in Fahrenheit
-  U : Uptime in hhhh.mm
-  V : Version
-  W : WiFi SSID
-  X : xTask memory usage   
-  x : Heap memory usage   
-  ? : Help
-  < : Last Error
-  / : SPIFFS File List
-  ~ : Restart ESP
-  $ : Reset WiFi
-  @ : Stream Status
-  ! : Debug Mode
-  + : Verbose Mode
-  = : Status Mode
-  ^ : FUNCTION MODE
-  ============================== 
-  )";
-
-  //API Response for boot loop
-  char apiFunctionHelpText[] = R"(
-  DIYFB Function Commands
-  ==============================
-  & : Reset Pins
-  % : Reset WiFi AP SSID & Password
-  ============================== 
-  )";
-
-
-  //API Response for boot loop
-  char bootHelpText[] = R"(
-  DIYFB BOOT LOOP Commands
-  ==============================
-  API Response Format
-  Command : Value : Checksum
-  ==============================
-  C : MAF Coefficients
-  I : IP Address
-  J : JSON Status Data
-  j : JSON Mimic Data
-  N : Hostname
-  S : Status
-  U : Uptime in hhhh.mm
-  V : Version
-  W : WiFi SSID
-  X : xTask memory usage   
-  x : Heap memory usage   
-  ? : Help
-  / : SPIFFS File List
-  ~ : Restart ESP
-  $ : Reset WiFi
-  % : Reset WiFi AP SSID & Password
-  & : Reset Pins
-  @ : Stream Status
-  ! : Debug Mode
-  + : Verbose Mode
-  = : Status Mode
-  < : Last Error
-  ============================== 
-  )";
-
-
-
-
-
-  switch (apiMessage)   {
-
-      // NOTE: Responses are alphabetised
-
-      case '0': // Bench Off
-          if (status.doBootLoop) break;
-          _hardware.benchOff();
-      break;
-      
-      case '1': // Bench On
-          if (status.doBootLoop) break;
-          _hardware.benchOn();
-      break;
-      
-      case '3': // Get 3v board supply voltage (mv) 'v.123.45\r\n'
-          if (status.doBootLoop) break;
-          snprintf(apiResponse, API_RESPONSE_LENGTH, "3%s%f", API_DELIMITER , sensorVal.VCC_5V_BUS);
-      break;
-      
-      case '5': // Get 5v board supply voltage (mv) 'v.123.45\r\n'
-          if (status.doBootLoop) break;
-          snprintf(apiResponse, API_RESPONSE_LENGTH, "5%s%f", API_DELIMITER , sensorVal.VCC_5V_BUS);
-      break;
-
-      case 'A': // Report ADC voltage values
-          if (status.doBootLoop) break;
-          snprintf(apiResponse, API_RESPONSE_LENGTH, "A%s%f%s%f%s%f%s%f", 
-          API_DELIMITER, _hardware.getADCVolts(config.iMAF_ADC_CHAN), 
-          API_DELIMITER, _hardware.getADCVolts(config.iPREF_ADC_CHAN), 
-          API_DELIMITER, _hardware.getADCVolts(config.iPDIFF_ADC_CHAN), 
-          API_DELIMITER, _hardware.getADCVolts(config.iPITOT_ADC_CHAN)); 
-     break;
-
-
-      case 'a': // Report Raw ADC values
-          if (status.doBootLoop) break;
-          snprintf(apiResponse, API_RESPONSE_LENGTH, "a%s%u%s%u%s%u%s%u", 
-          API_DELIMITER, _hardware.getADCRawData(config.iMAF_ADC_CHAN), 
-          API_DELIMITER, _hardware.getADCRawData(config.iPREF_ADC_CHAN), 
-          API_DELIMITER, _hardware.getADCRawData(config.iPDIFF_ADC_CHAN), 
-          API_DELIMITER, _hardware.getADCRawData(config.iPITOT_ADC_CHAN)); 
-     break;
-
-
-      case 'B': // Get measured Baro Pressure in hPa'B.123.45\r\n'
-          if (status.doBootLoop) break;
-          snprintf(apiResponse, API_RESPONSE_LENGTH, "B%s%f", API_DELIMITER , sensorVal.BaroHPA);
-      break;
-
-      // MAF Coefficients
-      case 'C': { // MAF Coefficients  'C\r\n'        
-
-          snprintf(apiResponse, API_RESPONSE_LENGTH, "C%s%s, %s, %s, %s, %s,%s", API_DELIMITER , String(config.mafCoeff0, 6), String(config.mafCoeff1, 6), String(config.mafCoeff2, 6), String(config.mafCoeff3, 6), String(config.mafCoeff4, 6), String(config.mafCoeff5, 6));
-      break; }
-
-      case 'D': // Differential Pressure value
-          if (status.doBootLoop) break;
-          snprintf(apiResponse, API_RESPONSE_LENGTH, "D%s%d", API_DELIMITER , _calculations.convertPressure(sensorVal.PDiffKPA, INH2O));
-      break;      
-
-      case 'E': // Enum1 - Flow:Ref:Temp:Humidity:Baro
-          if (status.doBootLoop) break;          
-          snprintf(apiResponse, API_RESPONSE_LENGTH, "E%s%f%s%f%s%f%s%f%s%f", 
-          API_DELIMITER, sensorVal.FlowCFM, 
-          API_DELIMITER, _calculations.convertPressure(sensorVal.PRefKPA, KPA), 
-          API_DELIMITER, _calculations.convertTemperature(sensorVal.TempDegC, DEGC), 
-          API_DELIMITER, _calculations.convertRelativeHumidity(sensorVal.RelH, PERCENT), 
-          API_DELIMITER, sensorVal.BaroKPA);
-      break;      
-
-      
-      case 'e': // Enum2 - Pitot:Swirl
-          if (status.doBootLoop) break;          
-          snprintf(apiResponse, API_RESPONSE_LENGTH, "e%s%f%s%f", 
-          API_DELIMITER, sensorVal.PitotKPA, 
-          API_DELIMITER, sensorVal.Swirl); 
-      break;      
-
-      
-      
-      case 'F': // Get measured Flow in CFM 'F123.45\r\n'       
-          if (status.doBootLoop) break;
-          snprintf(apiResponse, API_RESPONSE_LENGTH, "F%s%f", API_DELIMITER , sensorVal.FlowCFM);
-      break;
-
-      case 'f': // Get measured Mass Flow 'F123.45\r\n'       
-          if (status.doBootLoop) break;
-          // snprintf(apiResponse, API_RESPONSE_LENGTH, "f%s%f", API_DELIMITER , sensorVal.FlowKGH);
-          snprintf(apiResponse, API_RESPONSE_LENGTH, "f%s%f", API_DELIMITER , _sensors.getMafFlow());
-      break;
-
-      case 'H': // Get measured Humidity 'H.123.45\r\n'
-          if (status.doBootLoop) break;
-          snprintf(apiResponse, API_RESPONSE_LENGTH, "H%s%f", API_DELIMITER , sensorVal.RelH);
-      break;
-
-      case 'I': // IP Address
-          snprintf(apiResponse, API_RESPONSE_LENGTH, "I%s%s", API_DELIMITER, status.local_ip_address.c_str());
-      break;
-
-      case 'J':{ // JSON SSE Data
-          if (status.doBootLoop) break;
-          JsonDocument jsondoc;
-          jsonString = _data.buildIndexSSEJsonData();
-          deserializeJson(jsondoc, jsonString);
-          serializeJsonPretty(jsondoc, Serial);
-          // snprintf(apiResponseBlob, API_BLOB_LENGTH, "J%s%s", API_DELIMITER, String(jsonString).c_str());
-          snprintf(apiResponse, API_RESPONSE_LENGTH, "%s", " "); // send an empty string to prevent Invalid Response
-      break;}
-
-
-      case 'j':{ // JSON SSE Data (Mimic)
-          if (status.doBootLoop) break;
-          JsonDocument jsondoc;
-          jsonString = _data.buildMimicSSEJsonData();
-          deserializeJson(jsondoc, jsonString);
-          serializeJsonPretty(jsondoc, Serial);
-          // snprintf(apiResponseBlob, API_BLOB_LENGTH, "J%s%s", API_DELIMITER, String(jsonString).c_str());
-          snprintf(apiResponse, API_RESPONSE_LENGTH, "%s", " "); // send an empty string to prevent Invalid Response
-      break;}
-      
-      // DEPRECATED MAF Data now uses transfer function
-      case 'K': // MAF Data Key Value A
-          // if (status.doBootLoop) break;
-          // // refValue =  map(_sensors.getMafVolts(), 0, 5, 0, status.mafDataKeyMax); 
-          // refValue = (status.mafDataKeyMax / 5) * _sensors.getMafVolts();
-          // snprintf(apiResponse, API_RESPONSE_LENGTH, "K%s MAF DATA Key value: %d ", API_DELIMITER , refValue); 
-      break;
-
-      case 'k': // MAF Data lookup value
-          if (status.doBootLoop) break;
-          snprintf(apiResponse, API_RESPONSE_LENGTH, "k%s MAF DATA Lookup value: %d ", API_DELIMITER , sensorVal.MafLookup); 
-      break;
-
-      case 'l': // Valve lift Data
-          if (status.doBootLoop) break;
-          jsonString = _webserver.getLiftDataJSON();
-          // snprintf(apiResponseBlob, API_BLOB_LENGTH, "l%s%s", API_DELIMITER, String(jsonString).c_str()); // TODO: Fix this - not working
-      break;
-      
-      // TODO - MAF data now uses transfer function
-      case 'M': { // Get MAF.json 
-            // StaticJsonDocument<MAF_JSON_SIZE> mafJSON;
-            // if (SPIFFS.exists(status.mafFilename))  {
-            //   mafJSON = _data.loadJSONFile(status.mafFilename);
-            // }
-            // if (mafJSON.overflowed() == true) {
-            //   _message.serialPrintf("MAF Data file - JsonDocument::overflowed()");
-            // } else {
-            //   serializeJsonPretty(mafJSON, Serial);
-            // }
-            // snprintf(apiResponse, API_RESPONSE_LENGTH, "%s", " "); // send an empty string to prevent Invalid Response
-      break; }
-           
-      case 'N': // Hostname
-          snprintf(apiResponse, API_RESPONSE_LENGTH, "N%s%s", API_DELIMITER, settings.hostname);
-      break;
-      
-      case 'O': // Active orifice flow rate 'o\r\n'        
-          if (status.doBootLoop) break;
-          snprintf(apiResponse, API_RESPONSE_LENGTH, "O%s%f", API_DELIMITER , status.activeOrificeFlowRate);
-      break;      
-
-      case 'o': // Active orifice  'O\r\n'        
-          if (status.doBootLoop) break;
-          snprintf(apiResponse, API_RESPONSE_LENGTH, "o%s%s", API_DELIMITER , status.activeOrifice);
-      break;      
-
-      case 'P': // Get measured Pitot Pressure 'P.123.45\r\n'
-          if (status.doBootLoop) break;
-          snprintf(apiResponse, API_RESPONSE_LENGTH, "P%s%f", API_DELIMITER , _calculations.convertPressure(sensorVal.PitotKPA, INH2O));
-      break;
-
-      // DEPRECATED - No longer using MAF lookup table
-      case 'Q': // mafdata max value
-          // if (status.doBootLoop) break;
-          // snprintf(apiResponse, API_RESPONSE_LENGTH, "Q%s%u", API_DELIMITER , status.mafDataValMax);
-      break;      
-
-      // DEPRECATED - No longer using MAF lookup table
-      case 'q': // mafdata max key value
-          // if (status.doBootLoop) break;
-          // snprintf(apiResponse, API_RESPONSE_LENGTH, "q%s%u", API_DELIMITER , status.mafDataKeyMax);
-      break;      
-
-      case 'R': // Get measured Reference Pressure 'R.123.45\r\n'
-          if (status.doBootLoop) break;
-          snprintf(apiResponse, API_RESPONSE_LENGTH, "R%s%f", API_DELIMITER , _calculations.convertPressure(sensorVal.PRefKPA, INH2O));
-      break;
-      
-      case 'S': { // Status  'S.123.45\r\n'
-
-          _message.serialPrintf("debug = %d\n",status.debug ? "true" : "false");
-          _message.serialPrintf("spiffs_mem_size = %i\n", status.spiffs_mem_size);
-          _message.serialPrintf("spiffs_mem_used = %i\n", status.spiffs_mem_used);
-          _message.serialPrintf("pageSize = %i\n", status.pageSize);
-          _message.serialPrintf("local_ip_address = %s\n", status.local_ip_address);
-          _message.serialPrintf("hostname = %s\n", status.hostname);
-          _message.serialPrintf("boardType = %s\n", status.boardType);
-          _message.serialPrintf("benchType = %s\n", status.benchType);
-          _message.serialPrintf("mafSensor = %s\n", status.mafSensor);
-          _message.serialPrintf("mafLink = %s \n", status.mafLink);
-          _message.serialPrintf("prefSensor = %s\n", status.prefSensor);
-          _message.serialPrintf("pdiffSensor = %s\n", status.pdiffSensor);
-          _message.serialPrintf("tempSensor = %s\n", status.tempSensor);
-          _message.serialPrintf("relhSensor = %s\n", status.relhSensor);
-          _message.serialPrintf("baroSensor = %s\n", status.baroSensor);
-          _message.serialPrintf("pitotSensor = %s\n", status.pitotSensor);
-          _message.serialPrintf("boot_time = %i\n", status.boot_time);
-          _message.serialPrintf("liveStream = %s\n", status.liveStream ? "true" : "false");
-          _message.serialPrintf("ssePollTimer = %lu\n", status.ssePollTimer);
-          _message.serialPrintf("wsCLeanPollTimer = %lu\n", status.wsCLeanPollTimer);
-          _message.serialPrintf("pollTimer = %i\n", status.pollTimer);
-          _message.serialPrintf("serialData = %i\n", status.serialData);;
-          _message.serialPrintf("statusMessage = %s\n", status.statusMessage);
-          _message.serialPrintf("apMode = %s\n",status.apMode ? "true" : "false");
-          _message.serialPrintf("HWMBME = %d\n",status.HWMBME);
-          _message.serialPrintf("HWMADC = %d\n",status.HWMADC);
-          _message.serialPrintf("HWMSSE = %d\n",status.HWMSSE);
-          _message.serialPrintf("activeOrifice =  %s\n", status.activeOrifice);
-
-          _message.serialPrintf("activeOrificeFlowRate =  %d\n", status.activeOrifice);
-          _message.serialPrintf("activeOrificeTestPressure =  %d\n", status.activeOrifice);
-          _message.serialPrintf("shouldReboot  =  %s\n", status.activeOrifice ? "true" : "false");
-          _message.serialPrintf("pinsLoaded  =  %s\n", status.activeOrifice ? "true" : "false");
-          _message.serialPrintf("mafLoaded  =  %s\n", status.activeOrifice ? "true" : "false");
-          _message.serialPrintf("configLoaded  =  %s\n", status.activeOrifice ? "true" : "false");
-          _message.serialPrintf("GUIexists  =  %s\n", status.GUIexists ? "true" : "false");
-          _message.serialPrintf("pinsFilename =  %s\n", status.pinsFilename);
-          _message.serialPrintf("mafFilename =  %s\n", status.mafFilename);
-          _message.serialPrintf("indexFilename =  %s\n", status.indexFilename);
-          _message.serialPrintf("doBootLoop =  %s\n", status.doBootLoop ? "true" : "false");
-          _message.serialPrintf("webserverIsRunning  =  %s\n", status.webserverIsRunning ? "true" : "false");
-          _message.serialPrintf("mafDataTableRows  =  %i\n", status.mafDataTableRows);
-          _message.serialPrintf("mafDataValMax  =  %s\n", status.mafDataValMax ? "true" : "false");
-          _message.serialPrintf("mafDataKeyMax  =  %s\n", status.mafDataKeyMax ? "true" : "false");
-          _message.serialPrintf("mafUnits =  %s\n", status.mafUnits);
-          _message.serialPrintf("mafScaling  =  %d\n", status.mafScaling);
-          _message.serialPrintf("mafDiameter  =  %i\n", status.mafDiameter);
-          _message.serialPrintf("mafSensorType=  %s\n", status.mafSensorType);
-          _message.serialPrintf("mafOutputType =  %s\n", status.mafOutputType);
-          snprintf(apiResponse, API_RESPONSE_LENGTH, "%s", " "); // send an empty string to prevent Invalid Response
-      break;}
-      
-      case 't': // Get measured Temperature in Fahrenheit 'F.123.45\r\n'
-          if (status.doBootLoop) break;
-          double TdegF;
-          TdegF = _calculations.convertTemperature(sensorVal.TempDegC, DEGF);
-          snprintf(apiResponse, API_RESPONSE_LENGTH, "t%s%f", API_DELIMITER , TdegF);
-      break;      
-      
-      case 'T': // Get measured Temperature in Celcius 'T.123.45\r\n'
-          if (status.doBootLoop) break;
-          snprintf(apiResponse, API_RESPONSE_LENGTH, "T%s%f", API_DELIMITER , sensorVal.TempDegC);
-      break;
-      
-      case 'u': // Uptime in minutes     
-          snprintf(apiResponse, API_RESPONSE_LENGTH, "u%s%u", API_DELIMITER , (millis() - status.boot_time) / 60000);
-      break;
-
-      case 'U': // Uptime in hhhh.mm      
-          snprintf(apiResponse, API_RESPONSE_LENGTH, "U%s%g", API_DELIMITER , _hardware.uptime() );
-      break;
-
-      case 'V': // Get Version 'VMmYYMMDDXX\r\n'          
-          snprintf(apiResponse, API_RESPONSE_LENGTH, "V%s%s.%s.%s", API_DELIMITER , MAJOR_VERSION, MINOR_VERSION, BUILD_NUMBER);
-      break;
-
-
-
-      
-      case 'W': // WiFi SSID
-          if (status.apMode == true) {
-            snprintf(apiResponse, API_RESPONSE_LENGTH, "W%s%s", API_DELIMITER, settings.wifi_ap_ssid);
-          } else {
-            snprintf(apiResponse, API_RESPONSE_LENGTH, "W%s%s", API_DELIMITER, settings.wifi_ssid);
-          }
-      break;
-
-      case 'X': // Print xTask memory usage (Stack high water mark) to serial monitor 
-          snprintf(apiResponse, API_RESPONSE_LENGTH,"X%sStack Free Memory EnviroTask=%s / SensorTask=%s ", API_DELIMITER , _calculations.byteDecode(uxTaskGetStackHighWaterMark(enviroDataTask)), _calculations.byteDecode(uxTaskGetStackHighWaterMark(sensorDataTask))); 
-      break;
-      
-      case 'x': // Print Heap memory usage to serial monitor 
-          envTaskMem = _calculations.byteDecode(uxTaskGetStackHighWaterMark(enviroDataTask));
-          sensTaskMem = _calculations.byteDecode(uxTaskGetStackHighWaterMark(sensorDataTask));
-          loopTaskMem = _calculations.byteDecode(uxTaskGetStackHighWaterMark(NULL));
-
-          // snprintf(apiResponse, API_RESPONSE_LENGTH,"x%sFree Heap=%s / Max Allocated Heap=%s ", API_DELIMITER , _calculations.byteDecode(ESP.getFreeHeap()), _calculations.byteDecode(ESP.getMaxAllocHeap())); 
-          snprintf(apiResponse, API_RESPONSE_LENGTH, "EnviroTask=%s  \nSensorTask=%s \nLoopTask=%s", envTaskMem, sensTaskMem, loopTaskMem); 
-      break;
-
-      
-  //     case '@': // Status Print Mode (Stream status messages to serial)
-  //         if (status.doBootLoop) break;
-  //         if (settings.status_print_mode == true){
-  //           settings.status_print_mode = false;
-  //           snprintf(apiResponse, API_RESPONSE_LENGTH, "@%s%s", API_DELIMITER, "Status Data Disabled" ); 
-  //         } else {
-  //           settings.status_print_mode = true;
-  //           snprintf(apiResponse, API_RESPONSE_LENGTH, "@%s%s", API_DELIMITER, "Status Data Enabled~" ); 
-  //         }
-  //     break;
-      
-      
-
-      case '?': // Help      
-          if (status.doBootLoop) {
-            snprintf(apiResponseBlob, API_BLOB_LENGTH, "\n%s", bootHelpText);            
-          } else if (settings.function_mode == true) {
-            snprintf(apiResponseBlob, API_BLOB_LENGTH, "\n%s", apiFunctionHelpText);
-          } else {
-            snprintf(apiResponseBlob, API_BLOB_LENGTH, "\n%s", apiHelpText);
-          }
-      break;
-      
-      case '/': // SPIFFS File List
-        {
-          FILESYSTEM.begin();
-          File root = FILESYSTEM.open("/");
-          File file = root.openNextFile();
-          const char* spiffsFileName;
-          int spiffsFileSize;
-
-          status.spiffs_mem_size = SPIFFS.totalBytes();
-          status.spiffs_mem_used = SPIFFS.usedBytes();
-
-          strcat(fileListBlob, "Spiffs File List\n");
-          strcat(fileListBlob, "================\n");
-
-          while (file)  {
-            spiffsFileName = file.name();
-            spiffsFileSize = file.size(); 
-            strcat(fileListBlob, spiffsFileName);
-            strcat(fileListBlob, "  ");
-            strcat(fileListBlob, _calculations.byteDecode(spiffsFileSize).c_str());
-            strcat(fileListBlob, "\n");
-            file = root.openNextFile();
-          }
-
-          strcat(fileListBlob, "================\n");
-          strcat(fileListBlob, "\nTotal space:      ");
-          strcat(fileListBlob, _calculations.byteDecode(status.spiffs_mem_size).c_str());
-          strcat(fileListBlob, "\n");
-          strcat(fileListBlob, "Total space used: ");
-          strcat(fileListBlob, _calculations.byteDecode(status.spiffs_mem_used).c_str());
-          strcat(fileListBlob, "\n");
-          strcat(fileListBlob, "================\n");
-
-          snprintf(apiResponseBlob, API_BLOB_LENGTH, "\n%s" , fileListBlob);
-
-
-          // FILESYSTEM.end();
-        }
-      break;
+  if (command != NULL && (!status.doBootLoop || (command->flags & API_BOOT_LOOP))) {
+    command->handler(request);
+  }
 
-      case '!': // Debug Mode
-        if (settings.debug_mode == true){
-          settings.debug_mode = false;
-          snprintf(apiResponse, API_RESPONSE_LENGTH, "!%s%s", API_DELIMITER, "Debug Mode Off" ); 
-        } else {
-          settings.debug_mode = true;
-          snprintf(apiResponse, API_RESPONSE_LENGTH, "!%s%s", API_DELIMITER, "Debug Mode On" ); 
-        }
-      break;
-      
-      case '+': // Verbose Print Mode 
-        if (settings.verbose_print_mode == true){
-          settings.verbose_print_mode = false;
-          snprintf(apiResponse, API_RESPONSE_LENGTH, "!%s%s", API_DELIMITER, "Verbose Print Mode Off" ); 
-        } else {
-          settings.verbose_print_mode = true;
-          snprintf(apiResponse, API_RESPONSE_LENGTH, "!%s%s", API_DELIMITER, "Verbose Print Mode On" ); 
-        }
-      break;
-      
-      case '=': // Status Print Mode 
-        if (settings.status_print_mode == true){
-          settings.status_print_mode = false;
-          snprintf(apiResponse, API_RESPONSE_LENGTH, "!%s%s", API_DELIMITER, "Status Print Mode Off" ); 
-        } else {
-          settings.status_print_mode = true;
-          snprintf(apiResponse, API_RESPONSE_LENGTH, "!%s%s", API_DELIMITER, "Status Print Mode On" ); 
-        }
-      break;
-      
-      case '#': // Developer Mode (Enable additional developer tools)
-        if (settings.dev_mode == true) {
-          settings.dev_mode = false;
-          snprintf(apiResponse, API_RESPONSE_LENGTH, "#%s%s", API_DELIMITER, "Developer Mode Off" ); 
-        } else {
-          settings.dev_mode = true;
-          snprintf(apiResponse, API_RESPONSE_LENGTH, "#%s%s", API_DELIMITER, "Developer Mode On" ); 
-        }
-      break;
-      
-      case '^': // Function Mode (Enable additional tools)
-        if (settings.function_mode == true) {
-          settings.function_mode = false;
-          snprintf(apiResponse, API_RESPONSE_LENGTH, "#%s%s", API_DELIMITER, "Function Mode Off" ); 
-        } else {
-          settings.function_mode = true;
-          snprintf(apiResponse, API_RESPONSE_LENGTH, "#%s%s", API_DELIMITER, "Function Mode On" ); 
-        }
-      break;
-      
-      case '<': // Display last error
-        snprintf(apiResponseBlob, API_BLOB_LENGTH, "%s", "No error in buffer");
-      break;
-      
-      case '~': //ESP Restart
-        snprintf(apiResponse, API_RESPONSE_LENGTH, "%s", "Restarting...");
-        ESP.restart();
-      break;
-
-      case '$': // Recover WiFi
-          snprintf(apiResponse, API_RESPONSE_LENGTH, "%s", "Attempting to recover WiFi Connection");
-          // settings.api_enabled = false;
-          _comms.wifiReconnect();
-          // settings.api_enabled = true;
-      break;
-
-      case '%':{ // Reset WiFi passwords
-        if (settings.function_mode == true) {
-          snprintf(apiResponse, API_RESPONSE_LENGTH, "%s", "Attempting to reset WiFi passwords");
-          _prefs.begin("settings");
-          _prefs.putString("sWIFI_AP_SSID", static_cast<String>("DIYFB"));
-          _prefs.putString("sWIFI_AP_PSWD", static_cast<String>("123456789"));
-          _prefs.end();
-          settings.function_mode = false;
+  // We've got here without a valid API request so send 'Invalid Response' rather than garbage
+  const char *response = (*apiResponse != 0) ? apiResponse : "Invalid Response";
+
+  // Send API Response
+  #if defined API_CHECKSUM_IS_ENABLED
+    output.printf("%s%s%u\n", response, API_DELIMITER, calcCRC(response));
+  #else
+    output.printf("%s\n", response);
+  #endif
+
+}
+
+
+
+
+/***********************************************************
+ * PARSE API
+ *
+ * Handles single character Serial API commands
+ * See the command registry above for the list of commands
+ ***/
+void API::ParseMessage(char apiMessage, Print &output) {
+
+  char noArguments[1] = {0};
+
+  runCommand(findCommand(apiMessage), noArguments, output);
+
+}
+
+
+
+
+
+
+/***********************************************************
+ * @brief Framed response line
+ * @details Print sink for runCommand() in framed mode. Payload newlines are escaped so the response
+ * stays on one line. Trailing newlines are dropped
+ ***/
+class ApiFrame : public Print {
+
+  public:
+
+    char line[API_FRAME_LENGTH];
+    size_t length = 0;
+    int pendingNewlines = 0;
+    bool overflow = false;
+
+    using Print::write;
+
+    void append(const char *text) {
+      while (*text) put(*text++);
+    }
+
+    void put(char c) {
+      if (length < sizeof(line) - 12) {
+        line[length++] = c;
+      } else {
+        overflow = true;
+      }
+    }
+
+    size_t write(uint8_t c) override {
+      if (c == '\r') return 1;
+      if (c == '\n') {
+        pendingNewlines++;
+        return 1;
+      }
+      for (; pendingNewlines > 0; pendingNewlines--) append("\\n");
+      if (c == '\\') put('\\');
+      put(c);
+      return 1;
+    }
+};
+
+static TaskHandle_t apiTask = NULL;
+static ApiFrame apiFrame;
+static std::atomic<bool> apiWaitingForCycle(false);
+
+
+
+
+/***********************************************************
+ * @brief begin
+ * @details Start the serial command task and hook it to UART receive events
+ * @note Called once settings are loaded so the boot loop can also take commands
+ ***/
+void API::begin() {
+
+  Messages _message;
+
+  if (apiTask != NULL) return;
+
+  xTaskCreatePinnedToCore(TASKserialCommand, "SERIAL_API", API_TASK_MEM_STACK, NULL, 1, &apiTask, 1);
+
+  if (apiTask == NULL) {
+    _message.serialPrintf("Serial API task failed to start \n");
+    return;
+  }
+
+  Serial.onReceive(onSerialReceive);
+
+}
+
+
+
+
+/***********************************************************
+ * @brief onSerialReceive
+ * @details UART event callback - wake the command task
+ ***/
+void API::onSerialReceive() {
+
+  xTaskNotifyGive(apiTask);
+
+}
+
+
+
+
+/***********************************************************
+ * @brief sensorCycleDone
+ * @details Called by the sensor / enviro tasks when they hand the cycle back (runTask = SSE_TASK)
+ * @note Only notifies while a command is waiting, so the command task is not woken every cycle
+ ***/
+void API::sensorCycleDone() {
+
+  if (apiTask != NULL && apiWaitingForCycle.load()) xTaskNotifyGive(apiTask);
+
+}
+
+
+
+
+/***********************************************************
+ * @brief waitForSensorCycle
+ * @details Block the command task until the sensor / enviro task has finished its cycle
+ * @note A UART notification taken here is harmless, the receive loop reads everything available
+ ***/
+void API::waitForSensorCycle() {
+
+  extern int runTask;
+
+  apiWaitingForCycle.store(true);
+
+  while (runTask != SSE_TASK) ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(API_CYCLE_WAIT_MS));
+
+  apiWaitingForCycle.store(false);
+
+}
+
+
+
+
+/***********************************************************
+ * @brief TASKserialCommand
+ * @details Read everything received since the last wake up. Legacy single character commands are run
+ * as they arrive, a '#' starts a framed request which is run when its newline arrives
+ * @note A '#' followed by a line ending, or by nothing for API_FRAME_START_MS, is the legacy DEV_MODE
+ * command rather than the start of a frame
+ * @note Commands wait for the sensor task to finish its cycle, as they did when polled from loop()
+ ***/
+void API::TASKserialCommand(void *parameter) {
+
+  extern struct BenchSettings settings;
+  extern struct DeviceStatus status;
+
+  API _api;
+
+  char request[API_REQUEST_LENGTH];
+  size_t requestLength = 0;
+  bool inFrame = false;
+  bool requestOverflow = false;
+  bool hashPending = false;
+  uint32_t hashTime = 0;
+
+  for (;;) {
+
+    // Timeout covers bytes that arrived before the callback was attached, and ends a lone '#'
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(hashPending ? API_FRAME_START_MS : 1000));
+
+    if (hashPending && Serial.available() == 0 && millis() - hashTime >= API_FRAME_START_MS) {
+      hashPending = false;
+      waitForSensorCycle();
+      _api.ParseMessage('#');
+    }
+
+    while (Serial.available() > 0) {
+
+      char c = Serial.read();
+
+      if (!settings.api_enabled) continue;
+
+      status.serialData = c;
+
+      if (hashPending) {
+        hashPending = false;
+        if (c == '\r' || c == '\n') {
+          waitForSensorCycle();
+          _api.ParseMessage('#');
+          continue;
         }
-        break;
+        inFrame = true;
+        requestOverflow = false;
+        request[0] = '#';
+        requestLength = 1;
       }
 
-      case '&':{ // Reset Pins
-        if (settings.function_mode == true) {
-          _hardware.resetPins();
-          snprintf(apiResponse, API_RESPONSE_LENGTH, "#%s%s", API_DELIMITER, "Pins Reset" ); 
-          settings.function_mode = false;
+      if (!inFrame) {
+        if (c == '#') {
+          hashPending = true;
+          hashTime = millis();
+        } else if (c != '\r' && c != '\n') {
+          waitForSensorCycle();
+          _api.ParseMessage(c);
         }
-        break;
+        continue;
       }
 
+      if (c == '\r') continue;
 
-      case '\\': { //AB_test
-        if (settings.AB_test == 'A') {
-          settings.AB_test = 'B';
-          snprintf(apiResponse, API_RESPONSE_LENGTH, "#%s%s", API_DELIMITER, "A/B test B" ); 
-        } else if (settings.AB_test == 'B'){
-          settings.AB_test = 'C';
-          snprintf(apiResponse, API_RESPONSE_LENGTH, "#%s%s", API_DELIMITER, "A/B test C" ); 
-        } else if (settings.AB_test == 'C'){
-          settings.AB_test = 'A';
-          snprintf(apiResponse, API_RESPONSE_LENGTH, "#%s%s", API_DELIMITER, "A/B test A" ); 
+      if (c != '\n') {
+        if (requestLength < sizeof(request) - 1) {
+          request[requestLength++] = c;
+        } else {
+          requestOverflow = true;
         }
+        continue;
       }
 
-      case ' ': // <<<<(TEST [space] exclude from API listing)<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<< 
-           
-          // snprintf(apiResponse, API_RESPONSE_LENGTH, "Z%s%d", API_DELIMITER , status.mafScaling);
-          // snprintf(apiResponse, API_RESPONSE_LENGTH, "Z%s%d", API_DELIMITER , status.mafUnits);
-          // _hardware.stepperTest();
-
-          // BME680 Tests
-          // if (status.debug == true) {
-          //   // snprintf(apiResponse, API_RESPONSE_LENGTH, "Temp: %f Baro: %f RelH: %f \n" , sensorVal.TempDegC, sensorVal.BaroHPA, sensorVal.RelH);
-          //   snprintf(apiResponse, API_RESPONSE_LENGTH, "Temp: %f Baro: %f RelH: %f \n" , sensorVal.test, sensorVal.BaroHPA, sensorVal.RelH);
-          // } else {
-          //   snprintf(apiResponse, API_RESPONSE_LENGTH, "Temp: %f Baro: %f RelH: %f \n", _sensors.getTempValue(), _sensors.getBaroValue(), _sensors.getRelHValue() );
-          // }
-
-
-          // pin assignment tests
-          // _data.loadPinsData();
-          // _data.writeJSONFile();
-
-
-      break; // <<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
-
-
-      // TODO - Calibration API commands
-      // case '}': // Flow Offset Calibration  'O\r\n'        
-      //     if (status.doBootLoop) break;
-      //     // _calibration.setFlowOffset();
-      //     snprintf(apiResponse, API_RESPONSE_LENGTH, "C%s%f", API_DELIMITER , calVal.flow_offset);
-      //     // TODO: confirm Flow Offset Calibration success in response
-      // break;      
-
-      // case 'L': // Perform Leak Test Calibration 'L\r\n'
-      //     if (status.doBootLoop) break;
-      //     _calibration.setLeakOffset();
-      //     snprintf(apiResponse, API_RESPONSE_LENGTH, "L%s%F", API_DELIMITER , calVal.leak_cal_offset );
-      //     // TODO: confirm Leak Test Calibration success in response
-      // break;
-      
-      // case 'l': // Perform Leak Test 'l\r\n'      
-      //     if (status.doBootLoop) break;
-      //     // TODO: apiResponse = ("l") + API_DELIMITER + leakTest();
-      //     // TODO: confirm Leak Test success in response
-      // break;
-
-
-      // We've got here without a valid API request so lets get outta here before we send garbage to the serial comms
-      default:
-          // return;
-      break;
-
-      
+      request[requestLength] = 0;
+      inFrame = false;
+
+      waitForSensorCycle();
+      _api.processFrame(request, requestOverflow);
+    }
   }
-  
-  
-  
-  // Send API Response
-  #if defined API_CHECKSUM_IS_ENABLED
 
-      uint32_t crcValue = calcCRC(apiResponse);
+}
+
 
-      if (*apiResponseBlob != 0)   {
-        _message.blobPrintf("%s%s%s\n", apiResponseBlob, API_DELIMITER, (String)crcValue);              
-      } else if (*apiResponse != 0) {
-        _message.serialPrintf("%s%s%s\n", apiResponse, API_DELIMITER, (String)crcValue);      
-      } else {
-        //invalid response
-        _message.serialPrintf("%s%s%s\n", "Invalid Response", API_DELIMITER, (String)crcValue);
-      }
-  #else
-      if (*apiResponseBlob != 0) {
-        _message.blobPrintf("%s\n", apiResponseBlob);     
-        _message.serialPrintf("\n\n", "");    
-     
-      } else if (*apiResponse != 0) {
-        _message.serialPrintf("%s\n", apiResponse);    
-      
-      } else {
-        //invalid response
-        _message.serialPrintf("%s\n", "Invalid Response");
-      }
-  #endif
 
-}
 
+/***********************************************************
+ * @brief processFrame
+ * @details Check and run one framed request, then send its response line
+ * @param frame request line without the newline, starting with '#'
+ * @param overflow request was longer than API_REQUEST_LENGTH (answered with ERR:LENGTH)
+ ***/
+void API::processFrame(char *frame, bool overflow) {
+
+  const char *error = NULL;
+  bool useCRC = false;
+
+  // Optional CRC32 of everything before the '*'
+  char *star = strrchr(frame, '*');
+  if (star != NULL && !overflow) {
+    char *end;
+    uint32_t crc = strtoul(star + 1, &end, 16);
+    useCRC = true;
+    if (end != star + 9 || *end != 0 || crc != crc32_le(0, (const uint8_t *)frame, star - frame)) error = "ERR:CRC";
+    *star = 0;
+  }
+
+  char *id = frame + 1;
+  char *command = id + strcspn(id, " ");
+  if (*command != 0) *command++ = 0;
+  command += strspn(command, " ");
+  char *arguments = command + strcspn(command, " ");
+  if (*arguments != 0) *arguments++ = 0;
+  arguments += strspn(arguments, " ");
+
+  if (*id == 0 || strlen(id) > API_FRAME_ID_LENGTH) {
+    id[API_FRAME_ID_LENGTH] = 0;
+    if (error == NULL) error = "ERR:ID";
+  }
+
+  apiFrame.length = 0;
+  apiFrame.pendingNewlines = 0;
+  apiFrame.overflow = false;
+  apiFrame.append("#");
+  apiFrame.append(id);
+  apiFrame.append(" ");
+
+  size_t payloadStart = apiFrame.length;
+
+  if (overflow) {
+    apiFrame.append("ERR:LENGTH");
+  } else if (error != NULL) {
+    apiFrame.append(error);
+  } else if (*command == 0) {
+    apiFrame.append("ERR:COMMAND");
+  } else {
+    const ApiCommand *registered = (command[1] == 0 && *arguments == 0) ? findCommand(command[0]) : findCommand(command);
+    if (registered == NULL) {
+      apiFrame.append("ERR:UNKNOWN");
+    } else {
+      runCommand(registered, arguments, apiFrame);
+    }
+  }
+
+  if (apiFrame.overflow) {
+    apiFrame.length = payloadStart;
+    apiFrame.overflow = false;
+    apiFrame.append("ERR:OVERFLOW");
+  }
 
+  // Room for the CRC and newline is always kept free by ApiFrame::put()
+  if (useCRC) {
+    uint32_t crc = crc32_le(0, (const uint8_t *)apiFrame.line, apiFrame.length);
+    apiFrame.length += snprintf(apiFrame.line + apiFrame.length, sizeof(apiFrame.line) - apiFrame.length, "*%08X", crc);
+  }
+  apiFrame.line[apiFrame.length++] = '\n';
+
+  Logger::writeDirect((const uint8_t *)apiFrame.line, apiFrame.length);
 
+}
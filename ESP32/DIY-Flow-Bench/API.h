@@ -15,10 +15,45 @@
  * @license This project and all associated files are provided for use under the GNU GPL3 license:
  * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
  * 
+ * Serial commands are handled by their own task, woken by UART receive events. Two request forms are
+ * accepted on the same port:
+ *
+ *   F                          - legacy single character command, answered as before
+ *   #<id> <command> [args]     - framed request, one line, answered with one line '#<id> <response>'
+ *   #<id> <command> [args]*<crc32>
+ *                              - as above with a CRC32 (8 hex digits) of everything before the '*'.
+ *                                The response then carries a CRC32 of its own line in the same way
+ *
+ * Framed requests may be pipelined, responses are returned in order and carry the request id.
+ * A '#' on its own (followed by a line ending, or nothing) is still the legacy DEV_MODE command.
+ * Newlines within a framed response are escaped as \n.
+ *
+ * Commands are entries in a constant registry (API.cpp) giving the single character, the framed name,
+ * the handler, boot loop availability and the help text. '?' is generated from the registry.
+ *
  ***/
 #pragma once
 
 #include <Arduino.h>
+#include <Print.h>
+
+
+struct ApiRequest {
+	char *arguments;            // Framed request arguments (empty for single character commands)
+	char *response;             // Response buffer, sent as a single line after the handler returns
+	size_t length;              // Size of response buffer
+	Print &output;              // Sink for long responses printed directly by the handler
+};
+
+typedef void (*ApiHandler)(ApiRequest &request);
+
+struct ApiCommand {
+	char command;               // Single character command (0 = framed name only)
+	const char *name;           // Framed request name
+	ApiHandler handler;
+	uint8_t flags;              // API_BOOT_LOOP / API_FUNCTION
+	const char *help;           // Help text (NULL = not listed)
+};
 
 
 class API {
@@ -33,11 +68,22 @@ class API {
 		uint32_t calcCRC (const char* str);
 		String getConfigJSON();
 
+		static void TASKserialCommand(void *parameter);
+		static void onSerialReceive();
+		static void waitForSensorCycle();
+		void processFrame(char *frame, bool overflow);
+		void runCommand(const ApiCommand *command, char *arguments, Print &output);
+
+		static const ApiCommand * findCommand(char command);
+		static const ApiCommand * findCommand(const char *name);
+
 		bool streamMafData;
 	
 	public:
 		API();
-		void ParseMessage(char apiMessage);
+		static void begin();
+		static void sensorCycleDone();
+		void ParseMessage(char apiMessage, Print &output = Serial);
 		uint32_t CRC;	
 	
 };
@@ -51,7 +51,18 @@
 #include "sensors.h"
 #include "calculations.h"
 #include "webserver.h"
+#include "publisher.h"
+#include "metrics.h"
+#include "recorder.h"
+#include "persistence.h"
+#include "trace.h"
+#include "timeseries.h"
+#include "modbus.h"
+#include "benchstate.h"
+#include "steadystate.h"
+#include "history.h"
 #include "publichtml.h" 
+#include "logger.h"
 #include "messages.h"
 #include "API.h"
 #include "Wire.h"
@@ -83,6 +94,10 @@ Hardware _hardware;
 Messages _message;
 Sensors _sensors;
 Webserver _webserver;
+Publisher _publisher;
+Metrics _metrics;
+Recorder _recorder;
+Persistence _persistence;
 PublicHTML _public_html;
 
 // Initiate Variables
@@ -90,11 +105,6 @@ TaskHandle_t sensorDataTask = NULL;
 TaskHandle_t enviroDataTask = NULL;
 // portMUX_TYPE mmux = portMUX_INITIALIZER_UNLOCKED;
 
-// Custom sign function
-template <typename T> int sgn(T val) {
-    return (T(0) < val) - (val < T(0));
-}
-
 // char charDataJSON[256];
 String jsonString;
 
@@ -120,7 +130,6 @@ int adcTaskCount = 0;
   extern struct Configuration config;
   
   Sensors _sensors;
-  Hardware _hardware;
 
   int sensorINT;
 
@@ -129,187 +138,11 @@ int adcTaskCount = 0;
       // Can we run??
       if (runTask == ADC_TASK) {
 
-        // Set / reset scan timers
-        status.adcScanTime = (micros() - adcStartTime); // how long since we started the timer? 
-        adcStartTime = micros(); // start the timer
-        status.bmeScanCountAverage = (status.bmeScanAlpha * status.bmeScanCount) + (1.0 - status.bmeScanAlpha) * status.bmeScanCountAverage;  // calculate Exponential moving average
-        status.bmeScanCount = 1; // reset to 1 so first scan value in GUI is valid
-        status.adcScanCount += 1;
-        
-        // Get reference voltages
-        sensorVal.VCC_5V_BUS = _hardware.get5vSupplyVolts();
-        sensorVal.VCC_3V3_BUS = _hardware.get3v3SupplyVolts();
-
-        // Get MAF / Orifice / Venturi / Pitot flow data
-        switch (settings.bench_type){
-
-          case MAF_BENCH:
-            if (config.iMAF_SRC_TYP != SENSOR_DISABLED) {
-              sensorVal.FlowKGH = _sensors.getMafFlow();
-              sensorVal.FlowCFMraw = _calculations.convertFlow(sensorVal.FlowKGH);
-            }
-          break;
-
-          case ORIFICE_BENCH:
-            sensorVal.FlowCFMraw = _sensors.getDifferentialFlow();
-          break;
-
-          case VENTURI_BENCH:
-            //TODO
-          break;
-
-          case PITOT_BENCH:
-            //TODO
-          break;
-
-          default:
-            // Error bench type unknown
-            _message.debugPrintf("Unknown Bench Type\n");
-          break;
-
-        }
-
-        // Apply Flow calibration and leak offsets
-        sensorVal.FlowCFM = sensorVal.FlowCFMraw  - calVal.leak_cal_baseline - calVal.leak_cal_offset  - calVal.flow_offset;
-
-        // Apply Data filters...
-        switch (settings.data_filter_type) {
-
-          case MEDIAN:
-            // Rolling Median      
-            // sensorVal.AverageCFM += ( sensorVal.FlowCFM - sensorVal.AverageCFM ) * 0.1f; // rough running average.
-            // sensorVal.MedianCFM += copysign( sensorVal.AverageCFM * 0.01, sensorVal.FlowCFM - sensorVal.MedianCFM );
-
-            sensorVal.MedianCFM += ALPHA_MEDIAN * sgn(sensorVal.FlowCFM - sensorVal.MedianCFM);
-            sensorVal.FlowCFM = sensorVal.MedianCFM;
-          break;
-
-          case AVERAGE:{
-            // calculate Exponential moving average
-            sensorVal.AverageCFM = (ALPHA_AVERAGE * sensorVal.FlowCFM) + (1.0f - ALPHA_AVERAGE) * sensorVal.AverageCFM; 
-            sensorVal.FlowCFM = sensorVal.AverageCFM;
-          break;
-          }
-
-          case MODE:
-            //TODO - Mode
-            // return most common value over x number of cycles (requested by @black-top)
-
-            // Mean
-            sensorVal.MeanCFM += ALPHA_MEAN * (sensorVal.FlowCFM - sensorVal.MeanCFM);
-            sensorVal.FlowCFM = sensorVal.MeanCFM;
-          break;
-
-          case NONE:
-          default:
-            // No filter
-            sensorVal.FlowCFM = sensorVal.FlowCFM;
-          break;
-
-        }
-
-        // convert to standard flow
-        sensorVal.FlowSCFM = _calculations.convertToSCFM(sensorVal.FlowCFM, settings.standardReference);
-
-        // Get Flow differential values
-        switch (sensorVal.FDiffType) {
-
-          case USERTARGET:{
-
-              switch (sensorVal.flowtile) {
-                case MAFFLOW_TILE:
-                  sensorVal.FDiff = sensorVal.FlowKGH - calVal.user_offset;
-                  strcpy(sensorVal.FDiffTypeDesc, "User Target (kgh)");
-                break;
-
-                case ACFM_TILE:
-                  sensorVal.FDiff = sensorVal.FlowCFM - calVal.user_offset;
-                  strcpy(sensorVal.FDiffTypeDesc, "User Target (acfm)");
-                break;
-
-                case ADJCFM_TILE:
-                  sensorVal.FDiff = sensorVal.FlowADJ - calVal.user_offset;
-                  strcpy(sensorVal.FDiffTypeDesc, "User Target (ajd-cfm)");
-                break;
-
-                case SCFM_TILE:
-                  sensorVal.FDiff = sensorVal.FlowSCFM - calVal.user_offset;
-                  strcpy(sensorVal.FDiffTypeDesc, "User Target (scfm)");
-                break;
-
-              }
+        _sensors.acquire();
 
-            sensorVal.FDiff = sensorVal.FlowCFM - calVal.user_offset;
-            strcpy(sensorVal.FDiffTypeDesc, "User Target (cfm)");
-  
-            break;
-          }
-            
-          case BASELINE:
-            sensorVal.FDiff = sensorVal.FlowCFMraw - calVal.flow_offset - calVal.leak_cal_baseline;
-            strcpy(sensorVal.FDiffTypeDesc, "Baseline (cfm)");
-          break;
-          
-          case BASELINE_LEAK :
-            sensorVal.FDiff = sensorVal.FlowCFMraw - calVal.flow_offset - calVal.leak_cal_baseline - calVal.leak_cal_offset;
-            strcpy(sensorVal.FDiffTypeDesc, "Offset (cfm)");
-          break;
-                  
-          default:
-          break;
-        }
-          
-        // Get pRef sensor data
-        if (config.iPREF_SENS_TYP != SENSOR_DISABLED) {
-          sensorVal.PRefKPA = _sensors.getPRefValue();
-          sensorVal.PRefH2O = _calculations.convertPressure(sensorVal.PRefKPA, INH2O);
-          if (settings.std_adj_flow == 1) {
-            sensorVal.FlowADJ = _calculations.convertFlowDepression(sensorVal.PRefH2O, settings.adj_flow_depression, sensorVal.FlowSCFM);
-          } else {
-            sensorVal.FlowADJ = _calculations.convertFlowDepression(sensorVal.PRefH2O, settings.adj_flow_depression, sensorVal.FlowCFM);
-          }
-          sensorVal.FlowADJSCFM = _calculations.convertToSCFM(sensorVal.FlowADJ, settings.standardReference );
-        } else {
-          sensorVal.PRefKPA = 0.0f;
-          sensorVal.PRefH2O = 0.0f;         
-        }
-
-        // Get pDiff sensor data
-        if (config.iPDIFF_SENS_TYP != SENSOR_DISABLED) {
-          sensorVal.PDiffKPA = _sensors.getPDiffValue();
-          sensorVal.PDiffH2O = _calculations.convertPressure(sensorVal.PDiffKPA, INH2O) - calVal.pdiff_cal_offset;
-        } else {
-          sensorVal.PDiffKPA = 0.0f;
-          sensorVal.PDiffH2O = 0.0f;
-        }
-
-        // Get Pitot sensor data
-        if (config.iPITOT_SENS_TYP != SENSOR_DISABLED) {
-          sensorVal.PitotKPA = _sensors.getPitotValue() - calVal.pitot_cal_offset;
-          sensorVal.PitotH2O = _calculations.convertPressure(sensorVal.PitotKPA, INH2O) ;
-          sensorVal.PitotVelocity = _sensors.getPitotVelocity(sensorVal.PitotKPA);
-          sensorVal.PitotDelta = sensorVal.PitotH2O;
-        } else {
-          sensorVal.PitotKPA = 0.0f;
-          sensorVal.PitotH2O = 0.0f;
-          sensorVal.PitotVelocity = 0.0f;
-        }
-
-        if (config.bSWIRL_ENBLD) {
-          // TODO #227
-            // uint8_t Swirl = Encoder.read();
-
-            // if (Swirl == DIR_CW) {
-            //   sensorVal.Swirl = Encoder.speed();
-            // } else {
-            //   sensorVal.Swirl = Encoder.speed() * -1;
-            // }
-        } else {
-          sensorVal.Swirl = 0;
-        }
- 
       adcTaskCount += 1;
       runTask = SSE_TASK;
+      API::sensorCycleDone();
     }
     vTaskDelay( VTASK_DELAY_ADC );  // mSec delay to prevent Watch Dog Timer (WDT) triggering and yield if required
   }
@@ -336,6 +169,8 @@ void TASKgetEnviroData( void * parameter ){
     // Can we run ??
     if (runTask == BME_TASK) {  
 
+        TRACE_SCOPE(TRACE_BME_CYCLE);
+
         // Set / reset scan timers
         status.bmeScanTime = (micros() - bmeStartTime); // how long since we started the timer? 
         bmeStartTime = micros(); // start the timer
@@ -345,7 +180,7 @@ void TASKgetEnviroData( void * parameter ){
         
         // Get temp sensor data
         sensorVal.TempDegC = _sensors.getTempValue();        
-        sensorVal.TempDegF = _calculations.convertTemperature(_sensors.getTempValue(), DEGF);
+        sensorVal.TempDegF = Units::Quantity<Units::Celsius>(sensorVal.TempDegC).as<Units::Fahrenheit>().value();
 
         // Get baro sensor data
         sensorVal.BaroHPA = _sensors.getBaroValue();
@@ -356,6 +191,7 @@ void TASKgetEnviroData( void * parameter ){
         sensorVal.RelH = _sensors.getRelHValue();
 
       runTask = SSE_TASK;
+      API::sensorCycleDone();
     }
     vTaskDelay( VTASK_DELAY_BME ); // mSec delay to prevent Watch Dog Timer (WDT) triggering and yield if required
 	}
@@ -402,6 +238,18 @@ void setup(void) {
     _webserver.begin();
   #endif
 
+  // Start session log writer
+  _recorder.begin();
+
+  // Allocate trend history
+  TimeSeries::begin();
+
+  // Start deferred NVM writer
+  _persistence.begin();
+
+  // Start Modbus TCP / RTU server
+  Modbus::begin();
+
   xTaskCreatePinnedToCore(TASKgetSensorData, "GET_SENS_DATA", SENSOR_TASK_MEM_STACK, NULL, 2, &sensorDataTask, secondaryCore); 
   // xTaskCreate(TASKgetSensorData, "GET_SENS_DATA", SENSOR_TASK_MEM_STACK, NULL, 2, &sensorDataTask); 
 
@@ -433,19 +281,9 @@ void setup(void) {
  ***/
 void loop () {
 
+  TRACE_BEGIN(TRACE_LOOP);
   
-  // Process API comms
-  if (settings.api_enabled) {        
-    if (millis() > status.apiPollTimer && runTask == SSE_TASK) {
-
-        status.apiPollTimer = millis() + API_SCAN_DELAY_MS; 
-
-        if (Serial.available() > 0) {
-          status.serialData = Serial.read();
-          _api.ParseMessage(status.serialData);
-        }
-    }                            
-  }
+  // NOTE: API comms are handled by the serial command task (API::begin)
 
   
   // TODO: PID Vac source Analog VFD control [if PREF not within limits]
@@ -458,19 +296,8 @@ void loop () {
 
       status.ssePollTimer = millis() + SSE_UPDATE_RATE; // Only reset timer when task executes
       
-      // Build Server Side Events (SSE) data
-      switch (status.GUIpage) {
-        case INDEX_PAGE:{
-          jsonString = _data.buildIndexSSEJsonData();
-          break;
-        }
-        case MIMIC_PAGE:{
-          jsonString = _data.buildMimicSSEJsonData();
-          break;
-        }
-      }
-      // Push SSE data to client
-      _webserver.events->send(String(jsonString).c_str(),"JSON_DATA",millis()); 
+      // Build each subscribed Server Side Events (SSE) topic once and push to its subscribers
+      _publisher.publish();
 
       if (adcTaskCount > 2) {
         runTask = BME_TASK;
@@ -484,10 +311,14 @@ void loop () {
 
   if (status.shouldReboot) {
     _message.serialPrintf("Rebooting...");
+    Persistence::flush();
+    Logger::flush(LOG_FLUSH_TIMEOUT_MS);
     delay(100);
     ESP.restart();
   }
 
+  TRACE_END(TRACE_LOOP);
+
   vTaskDelay( 1 );  //mSec delay to prevent Watch Dog Timer (WDT) triggering for empty task
 
   // Measure scan time
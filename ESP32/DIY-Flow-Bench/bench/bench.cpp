@@ -0,0 +1,460 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file bench.cpp
+ *
+ * @brief Host benchmarks for the acquisition, MAF lookup, flow conversion, history, log, SSE, template and API paths
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * Google Benchmark over the firmware code built against the native HAL. Host timings are relative,
+ * use them to compare before and after a change, not as ESP32 figures. test/test_hot_paths checks
+ * the same paths give the right answer.
+ *
+ *   pio run -e native_bench && .pio/build/native_bench/program [--benchmark_filter=<regex>]
+ *
+ ***/
+#include <benchmark/benchmark.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+
+#include "constants.h"
+#include "system.h"
+#include "structs.h"
+
+#include "API.h"
+#include "calculations.h"
+#include "logger.h"
+#include "mafdata.h"
+#include "maftable.h"
+#include "publisher.h"
+#include "sensors.h"
+#include "storage.h"
+#include "timeseries.h"
+#include "webserver.h"
+
+
+extern struct BenchSettings settings;
+extern struct SensorData sensorVal;
+extern struct Configuration config;
+extern Sensors _sensors;
+extern Webserver _webserver;
+extern Publisher _publisher;
+extern API _api;
+
+static AsyncWebServer *server = NULL;
+
+
+// Discards handler output so only the parse and dispatch is timed
+class NullPrint : public Print {
+
+  public:
+
+    size_t write(uint8_t value) override { return 1; }
+    size_t write(const uint8_t *buffer, size_t size) override { return size; }
+
+};
+
+
+
+
+/***********************************************************
+ * @brief benchSetup
+ * @details Bench state as the sensor and enviro tasks leave it, web server and API started
+ ***/
+static bool benchSetup() {
+
+  char directory[] = "/tmp/diyfb_bench_XXXXXX";
+  if (mkdtemp(directory) == NULL || chdir(directory) != 0) return false;
+  if (mkdir("native_fs", 0755) != 0 || mkdir("native_fs/littlefs", 0755) != 0 || !Storage::begin()) return false;
+
+  HAL::serialCapture(true);
+  HAL::i2cAttach(config.iADC_I2C_ADDR);
+  HAL::i2cWriteRegister16(config.iADC_I2C_ADDR, 0x00, 16000);
+
+  settings.AB_test = 'B';
+  settings.data_filter_type = NONE;
+
+  sensorVal.TempDegC = 20.0;
+  sensorVal.BaroPA = 101325.0;
+  sensorVal.BaroKPA = 101.325;
+  sensorVal.RelH = 50.0;
+
+  _webserver.begin();
+  server = AsyncWebServer::find(80);
+  if (server == NULL) return false;
+
+  API::begin();
+
+  return true;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief BM_AcquisitionCycle
+ * @details One sensor task cycle: ADC read, conversions, filter, state, history and recorder
+ ***/
+static void BM_AcquisitionCycle(benchmark::State &state) {
+
+  for (auto _ : state) {
+    _sensors.acquire();
+    benchmark::DoNotOptimize(sensorVal.FlowCFM);
+  }
+
+}
+BENCHMARK(BM_AcquisitionCycle);
+
+
+
+
+/***********************************************************
+ * @brief BM_SSEFrameBuild
+ * @details Publish to a number of flow topic clients and deliver the queued messages
+ ***/
+static void BM_SSEFrameBuild(benchmark::State &state) {
+
+  AsyncEventSource *source = server->eventSource(_publisher.topicPath(SSE_TOPIC_FLOW));
+  std::vector<AsyncEventSourceClient *> clients;
+  for (int i = 0; i < state.range(0); i++) clients.push_back(source->connect());
+
+  double flow = 0.0;
+
+  for (auto _ : state) {
+    // New value each time so the frame is rebuilt rather than reused
+    sensorVal.FlowCFM = flow += 0.25;
+    _publisher.publish();
+    for (AsyncEventSourceClient *client : clients) {
+      client->deliver();
+      benchmark::DoNotOptimize(client->received());
+    }
+  }
+
+  for (AsyncEventSourceClient *client : clients) client->close();
+
+}
+BENCHMARK(BM_SSEFrameBuild)->Arg(1)->Arg(4);
+
+
+
+
+/***********************************************************
+ * @brief BM_TemplateRendering
+ * @details Render the settings page, the largest templated page
+ ***/
+static void BM_TemplateRendering(benchmark::State &state) {
+
+  size_t bytes = 0;
+
+  for (auto _ : state) {
+    AsyncWebServerRequest request(HTTP_GET, "/settings");
+    AsyncWebServerResponse *response = server->handle(&request);
+    String page = response->body();
+    bytes += page.length();
+  }
+
+  state.SetBytesProcessed(bytes);
+
+}
+BENCHMARK(BM_TemplateRendering);
+
+
+
+
+/***********************************************************
+ * @brief BM_APIParseLegacy
+ * @details Single character command straight into the parser
+ ***/
+static void BM_APIParseLegacy(benchmark::State &state) {
+
+  NullPrint output;
+
+  for (auto _ : state) {
+    _api.ParseMessage('V', output);
+  }
+
+}
+BENCHMARK(BM_APIParseLegacy);
+
+
+
+
+/***********************************************************
+ * @brief BM_APIFramedRoundTrip
+ * @details Framed request through the serial task, including the task wake up
+ ***/
+static void BM_APIFramedRoundTrip(benchmark::State &state) {
+
+  HAL::serialOutput();
+
+  for (auto _ : state) {
+    HAL::serialInput("#1 V\n");
+    std::string output;
+    while (output.find('\n') == std::string::npos) {
+      delayMicroseconds(20);
+      output += HAL::serialOutput();
+    }
+  }
+
+}
+BENCHMARK(BM_APIFramedRoundTrip)->UseRealTime();
+
+
+
+
+/***********************************************************
+ * @brief BM_MafTableLookup
+ * @details User MAF table lookup (binary search and cubic interpolation) across the sensor range
+ ***/
+static void BM_MafTableLookup(benchmark::State &state) {
+
+  File file = Storage::fs().open("/mafdata.json", FILE_WRITE);
+  file.print("{\"1231.5\":15,\"1475.8\":30,\"1831.0\":60,\"2307.4\":120,\"2921.2\":250,"
+             "\"3287.4\":370,\"3546.1\":480,\"3843.2\":640,\"4149.9\":850,\"4331.2\":1000}");
+  file.close();
+  Storage::indexFile("/mafdata.json");
+
+  if (MafTable::load("/mafdata.json") < 0) {
+    state.SkipWithError("MAF table failed to load");
+    return;
+  }
+
+  float milliVolts = 1000.0f;
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(MafTable::getFlow(milliVolts));
+    milliVolts = (milliVolts > 4500.0f) ? 1000.0f : milliVolts + 13.7f;
+  }
+
+  MafTable::clear();
+
+}
+BENCHMARK(BM_MafTableLookup);
+
+
+
+
+/***********************************************************
+ * @brief BM_MafPolynomial
+ * @details Built in sensor polynomial, the path used when there is no table
+ ***/
+static void BM_MafPolynomial(benchmark::State &state) {
+
+  MafData maf(config.iMAF_SENS_TYP);
+
+  float milliVolts = 1000.0f;
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(maf.calculateFlow(milliVolts));
+    milliVolts = (milliVolts > 4500.0f) ? 1000.0f : milliVolts + 13.7f;
+  }
+
+}
+BENCHMARK(BM_MafPolynomial);
+
+
+
+
+/***********************************************************
+ * @brief BM_TimeSeriesPush
+ * @details One history insert at 100 Hz, including the rollups closed as the clock moves on
+ ***/
+static void BM_TimeSeriesPush(benchmark::State &state) {
+
+  if (!TimeSeries::begin()) {
+    state.SkipWithError("Time series history not allocated");
+    return;
+  }
+
+  HAL::setClock(1000);
+
+  for (auto _ : state) {
+    HAL::advanceClock(10);
+    TimeSeries::push();
+  }
+
+  HAL::useRealClock();
+
+}
+BENCHMARK(BM_TimeSeriesPush);
+
+
+
+
+/***********************************************************
+ * @brief flowBlock
+ * @details A recorded block of mass flow samples, and the environment it was recorded in
+ ***/
+static std::vector<float> flowBlock(size_t count) {
+
+  std::vector<float> block(count);
+  for (size_t i = 0; i < count; i++) block[i] = 50.0f + 0.25f * (i % 800);
+  return block;
+
+}
+
+static EnvBlock flowEnv() {
+
+  EnvBlock env;
+  env.TempDegC = sensorVal.TempDegC;
+  env.BaroPA = sensorVal.BaroPA;
+  env.PRefKPA = sensorVal.PRefKPA;
+  env.RelH = sensorVal.RelH;
+  return env;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief BM_FlowConvertScalar
+ * @details kg/h -> CFM -> SCFM for a block, one scalar call per sample as before the batch kernels
+ ***/
+static void BM_FlowConvertScalar(benchmark::State &state) {
+
+  Calculations _calculations;
+  std::vector<float> massFlow = flowBlock(state.range(0));
+  std::vector<float> flowSCFM(massFlow.size());
+
+  for (auto _ : state) {
+    for (size_t i = 0; i < massFlow.size(); i++) {
+      flowSCFM[i] = _calculations.convertToSCFM(_calculations.convertFlow((double)massFlow[i]), ISO_5011);
+    }
+    benchmark::DoNotOptimize(flowSCFM.data());
+  }
+
+  state.SetItemsProcessed(state.iterations() * massFlow.size());
+
+}
+BENCHMARK(BM_FlowConvertScalar)->Arg(64)->Arg(4096);
+
+
+
+
+/***********************************************************
+ * @brief BM_FlowConvertBatch
+ * @details The same block through the batch kernels, converted in place
+ ***/
+static void BM_FlowConvertBatch(benchmark::State &state) {
+
+  Calculations _calculations;
+  EnvBlock env = flowEnv();
+  std::vector<float> massFlow = flowBlock(state.range(0));
+  std::vector<float> flowSCFM(massFlow.size());
+
+  for (auto _ : state) {
+    _calculations.convertFlow(massFlow.data(), flowSCFM.data(), massFlow.size(), env);
+    _calculations.convertToSCFM(flowSCFM.data(), flowSCFM.data(), flowSCFM.size(), env, ISO_5011);
+    benchmark::DoNotOptimize(flowSCFM.data());
+  }
+
+  state.SetItemsProcessed(state.iterations() * massFlow.size());
+
+}
+BENCHMARK(BM_FlowConvertBatch)->Arg(64)->Arg(4096);
+
+
+
+
+/***********************************************************
+ * @brief logMessage
+ * @details Queue a message for the drain task, or format and write it in the caller
+ ***/
+static size_t logMessage(bool deferred, const char *format, ...) {
+
+  va_list args;
+  va_start(args, format);
+  size_t result;
+  if (deferred) {
+    result = Logger::write(LOG_LEVEL_DEBUG, format, args);
+  } else {
+    char line[LOG_LINE_LENGTH];
+    vsnprintf(line, sizeof(line), format, args);
+    result = Serial.write(line);
+  }
+  va_end(args);
+  return result;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief BM_LogWrite
+ * @details Caller side cost of a queued debug message, drained between batches so none are dropped
+ ***/
+static void BM_LogWrite(benchmark::State &state) {
+
+  Logger::begin();
+
+  int queued = 0;
+  double flow = 150.0;
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(logMessage(true, "Flow %f cfm ref %d %s\n", flow += 0.25, queued, "kPa"));
+    if (++queued == LOG_RING_SIZE / 2) {
+      state.PauseTiming();
+      Logger::flush(LOG_FLUSH_TIMEOUT_MS);
+      queued = 0;
+      state.ResumeTiming();
+    }
+  }
+
+  Logger::flush(LOG_FLUSH_TIMEOUT_MS);
+  state.counters["dropped"] = Logger::dropped();
+
+}
+BENCHMARK(BM_LogWrite);
+
+
+
+
+/***********************************************************
+ * @brief BM_LogFormatInCaller
+ * @details The same message formatted and written by the caller, as before the log ring
+ ***/
+static void BM_LogFormatInCaller(benchmark::State &state) {
+
+  double flow = 150.0;
+  int count = 0;
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(logMessage(false, "Flow %f cfm ref %d %s\n", flow += 0.25, count++, "kPa"));
+  }
+
+}
+BENCHMARK(BM_LogFormatInCaller);
+
+
+
+
+int main(int argc, char **argv) {
+
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+  if (!benchSetup()) return 1;
+
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+
+  return 0;
+
+}
@@ -0,0 +1,231 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file benchstate.cpp
+ *
+ * @brief BenchState class - bench running state machine with hysteresis
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * Only the sensor task calls update(). Everything else reads the published state.
+ *
+ ***/
+#include "Arduino.h"
+#include <atomic>
+
+#include "system.h"
+#include "constants.h"
+#include "structs.h"
+
+#include "benchstate.h"
+#include "messages.h"
+
+
+static const char *benchStateName[BENCH_STATE_COUNT] = {"IDLE", "SPOOLING", "RUNNING", "STABLE", "STOPPING"};
+
+static std::atomic<uint8_t> currentState(BENCH_STATE_IDLE);
+static std::atomic<uint32_t> stateEntered(0);
+static std::atomic<uint32_t> transitionCount(0);
+
+// Sensor task only
+static float flowAverage = 0.0f;
+static uint32_t inBandSince = 0;
+static bool inBand = false;
+
+
+
+
+/***********************************************************
+ * @brief Class constructor
+ ***/
+BenchState::BenchState() {
+}
+
+
+
+
+/***********************************************************
+ * @brief setState
+ * @details Publish a new state and raise the transition messages
+ * @note Only called on a change of state, so the String assignment in Handler() is not per sample
+ ***/
+void BenchState::setState(uint8_t newState, uint32_t timeMs) {
+
+  extern struct Language language;
+
+  Messages _message;
+
+  uint8_t previousState = currentState.load(std::memory_order_relaxed);
+
+  stateEntered.store(timeMs, std::memory_order_relaxed);
+  currentState.store(newState, std::memory_order_release);
+  transitionCount.fetch_add(1, std::memory_order_relaxed);
+
+  inBand = false;
+
+  _message.debugPrintf("Bench state %s -> %s \n", stateName(previousState), stateName(newState));
+
+  // Start / stop messages pair up - recovering from a dropout or leaving the stable band is not a new run
+  if (newState == BENCH_STATE_RUNNING && previousState == BENCH_STATE_SPOOLING) _message.Handler(language.LANG_BENCH_RUNNING);
+  if (newState == BENCH_STATE_IDLE) _message.Handler(language.LANG_BENCH_STOPPED);
+
+}
+
+
+
+
+/***********************************************************
+ * @brief update
+ * @details Evaluate the state machine for the current acquisition cycle
+ * @param flowCFM Filtered flow
+ * @param pRefH2O Reference pressure (sign is ignored)
+ * @param timeMs Sample time (millis())
+ ***/
+void BenchState::update(double flowCFM, double pRefH2O, uint32_t timeMs) {
+
+  extern struct BenchSettings settings;
+  extern struct Configuration config;
+
+  bool usePRef = (config.iPREF_SENS_TYP != SENSOR_DISABLED);
+  double pRef = fabs(pRefH2O);
+  double stopFlow = settings.min_flow_rate * (BENCH_OFF_THRESHOLD_PCT / 100.0);
+  double stopPRef = settings.min_bench_pressure * (BENCH_OFF_THRESHOLD_PCT / 100.0);
+
+  bool aboveStart = (flowCFM > settings.min_flow_rate) && (!usePRef || pRef > settings.min_bench_pressure);
+  bool belowStop = (flowCFM < stopFlow) || (usePRef && pRef < stopPRef);
+
+  uint8_t benchState = currentState.load(std::memory_order_relaxed);
+  uint32_t elapsed = timeMs - stateEntered.load(std::memory_order_relaxed);
+
+  // Track the flow average for the stable band while there is flow to track
+  if (benchState == BENCH_STATE_IDLE) {
+    flowAverage = flowCFM;
+  } else {
+    flowAverage += BENCH_STABLE_ALPHA * (flowCFM - flowAverage);
+  }
+
+  float band = fabs(flowAverage) * (BENCH_STABLE_BAND_PCT / 100.0f);
+  float deviation = fabs(flowCFM - flowAverage);
+
+  switch (benchState) {
+
+    case BENCH_STATE_IDLE:
+      if (aboveStart) setState(BENCH_STATE_SPOOLING, timeMs);
+    break;
+
+    case BENCH_STATE_SPOOLING:
+      if (belowStop) {
+        setState(BENCH_STATE_IDLE, timeMs);
+      } else if (elapsed >= BENCH_SPOOL_TIME_MS) {
+        setState(BENCH_STATE_RUNNING, timeMs);
+      }
+    break;
+
+    case BENCH_STATE_RUNNING:
+      if (belowStop) {
+        setState(BENCH_STATE_STOPPING, timeMs);
+      } else if (deviation <= band) {
+        if (!inBand) {
+          inBand = true;
+          inBandSince = timeMs;
+        } else if (timeMs - inBandSince >= BENCH_STABLE_TIME_MS) {
+          setState(BENCH_STATE_STABLE, timeMs);
+        }
+      } else {
+        inBand = false;
+      }
+    break;
+
+    case BENCH_STATE_STABLE:
+      if (belowStop) {
+        setState(BENCH_STATE_STOPPING, timeMs);
+      } else if (deviation > band * 2.0f) {
+        setState(BENCH_STATE_RUNNING, timeMs);
+      }
+    break;
+
+    case BENCH_STATE_STOPPING:
+      if (aboveStart) {
+        setState(BENCH_STATE_RUNNING, timeMs);
+      } else if (elapsed >= BENCH_STOP_TIME_MS) {
+        setState(BENCH_STATE_IDLE, timeMs);
+      }
+    break;
+
+  }
+
+}
+
+
+
+
+/***********************************************************
+ * @brief state
+ * @returns Current BENCH_STATE_xxx
+ ***/
+uint8_t BenchState::state() {
+
+  return currentState.load(std::memory_order_acquire);
+
+}
+
+
+
+
+/***********************************************************
+ * @brief isRunning
+ * @returns true once the bench has spooled up, until it starts to stop
+ ***/
+bool BenchState::isRunning() {
+
+  uint8_t benchState = currentState.load(std::memory_order_acquire);
+
+  return (benchState == BENCH_STATE_RUNNING || benchState == BENCH_STATE_STABLE);
+
+}
+
+
+
+
+/***********************************************************
+ * @brief transitions
+ * @details Number of state changes since boot. Lets a poller spot a change without tracking the state
+ ***/
+uint32_t BenchState::transitions() {
+
+  return transitionCount.load(std::memory_order_relaxed);
+
+}
+
+
+
+
+/***********************************************************
+ * @brief stateTime
+ * @returns Time in the current state (ms)
+ ***/
+uint32_t BenchState::stateTime(uint32_t timeMs) {
+
+  return timeMs - stateEntered.load(std::memory_order_relaxed);
+
+}
+
+
+
+
+/***********************************************************
+ * @brief stateName
+ ***/
+const char * BenchState::stateName(uint8_t benchState) {
+
+  return (benchState < BENCH_STATE_COUNT) ? benchStateName[benchState] : "UNKNOWN";
+
+}
@@ -0,0 +1,57 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file benchstate.h
+ *
+ * @brief BenchState class header file
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * Bench running state, evaluated once per acquisition cycle by the sensor task.
+ *
+ *   IDLE      -> SPOOLING   flow (and pRef if fitted) above the start threshold
+ *   SPOOLING  -> RUNNING    held above the start threshold for BENCH_SPOOL_TIME_MS
+ *   RUNNING   -> STABLE     flow inside BENCH_STABLE_BAND_PCT of its average for BENCH_STABLE_TIME_MS
+ *   STABLE    -> RUNNING    flow outside twice the stable band
+ *   any       -> STOPPING   below the stop threshold (BENCH_OFF_THRESHOLD_PCT of the start threshold)
+ *   STOPPING  -> IDLE       held below the stop threshold for BENCH_STOP_TIME_MS
+ *
+ * The start threshold is settings.min_flow_rate / settings.min_bench_pressure. Messages are only
+ * raised on a transition, and state() / isRunning() are a single atomic load so any task can call them.
+ *
+ ***/
+#pragma once
+
+#include <Arduino.h>
+
+#include "system.h"
+#include "constants.h"
+
+
+class BenchState {
+
+	private:
+
+		static void setState(uint8_t newState, uint32_t timeMs);
+
+	public:
+
+		BenchState();
+
+		static void update(double flowCFM, double pRefH2O, uint32_t timeMs);
+
+		static uint8_t state();
+		static bool isRunning();
+		static uint32_t transitions();
+		static uint32_t stateTime(uint32_t timeMs);
+		static const char * stateName(uint8_t benchState);
+
+};
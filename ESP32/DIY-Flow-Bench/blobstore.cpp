@@ -0,0 +1,686 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file blobstore.cpp
+ *
+ * @brief BlobStore class - versioned, CRC protected struct persistence
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * Adding a field: add a row to the relevant table below using a new key name (15 chars max).
+ * Existing blobs load as before and the new field keeps its structs.h default until saved.
+ * Changing a field type: keep the key, the stored value is converted when loaded.
+ *
+ * Struct fields are written from async_tcp (form posts) and the serial task while the PERSIST task
+ * encodes them, so every read or write of a field through this class holds fieldMutex. String members
+ * would otherwise be freed part way through being copied. save() encodes under the lock and writes
+ * the snapshot to NVS after releasing it.
+ *
+ ***/
+#include "Arduino.h"
+#include <Preferences.h>
+#include <nvs.h>
+#include <esp32/rom/crc.h>
+
+#include "system.h"
+#include "constants.h"
+#include "structs.h"
+
+#include "blobstore.h"
+#include "messages.h"
+
+extern struct Configuration config;
+extern struct BenchSettings settings;
+extern struct CalibrationData calVal;
+extern struct Pins pins;
+
+
+static const BlobField configFields[] = {
+  { "bSD_ENABLED", BLOB_FIELD_BOOL, &config.bSD_ENABLED },
+  { "iMIN_PRESS_PCT", BLOB_FIELD_INT, &config.iMIN_PRESS_PCT },
+  { "dPIPE_RAD_FT", BLOB_FIELD_DOUBLE, &config.dPIPE_RAD_FT },
+  { "dVCC_3V3_TRIM", BLOB_FIELD_DOUBLE, &config.dVCC_3V3_TRIM },
+  { "dVCC_5V_TRIM", BLOB_FIELD_DOUBLE, &config.dVCC_5V_TRIM },
+  { "bFIXED_3_3V", BLOB_FIELD_BOOL, &config.bFIXED_3_3V },
+  { "bFIXED_5V", BLOB_FIELD_BOOL, &config.bFIXED_5V },
+  { "bBME_TYPE", BLOB_FIELD_INT, &config.iBME_TYP },
+  { "iBME_ADDR", BLOB_FIELD_INT, &config.iBME_ADDR },
+  { "iADC_TYPE", BLOB_FIELD_INT, &config.iADC_TYPE },
+  { "iADC_I2C_ADDR", BLOB_FIELD_INT, &config.iADC_I2C_ADDR },
+  { "iMAF_SENS_TYP", BLOB_FIELD_INT, &config.iMAF_SENS_TYP },
+  { "iMAF_SRC_TYP", BLOB_FIELD_INT, &config.iMAF_SRC_TYP },
+  { "dMAF_MV_TRIM", BLOB_FIELD_DOUBLE, &config.dMAF_MV_TRIM },
+  { "iPREF_SENS_TYP", BLOB_FIELD_INT, &config.iPREF_SENS_TYP },
+  { "iPREF_SRC_TYP", BLOB_FIELD_INT, &config.iPREF_SRC_TYP },
+  { "dPREF_MV_TRIM", BLOB_FIELD_DOUBLE, &config.dPREF_MV_TRIM },
+  { "iPDIFF_SENS_TYP", BLOB_FIELD_INT, &config.iPDIFF_SENS_TYP },
+  { "iPDIFF_SRC_TYP", BLOB_FIELD_INT, &config.iPDIFF_SRC_TYP },
+  { "dPDIFF_MV_TRIM", BLOB_FIELD_DOUBLE, &config.dPDIFF_MV_TRIM },
+  { "iPITOT_SENS_TYP", BLOB_FIELD_INT, &config.iPITOT_SENS_TYP },
+  { "iPITOT_SRC_TYP", BLOB_FIELD_INT, &config.iPITOT_SRC_TYP },
+  { "dPITOT_MV_TRIM", BLOB_FIELD_DOUBLE, &config.dPITOT_MV_TRIM },
+  { "iBARO_SENS_TYP", BLOB_FIELD_INT, &config.iBARO_SENS_TYP },
+  { "dBARO_MV_TRIM", BLOB_FIELD_DOUBLE, &config.dBARO_MV_TRIM },
+  { "dBARO_FINE_TUNE", BLOB_FIELD_DOUBLE, &config.dBARO_FINE_TUNE },
+  { "dSEALEVEL_PRESS", BLOB_FIELD_DOUBLE, &config.dSEALEVEL_PRESS },
+  { "iBARO_ADC_CHAN", BLOB_FIELD_INT, &config.iBARO_ADC_CHAN },
+  { "iTEMP_SENS_TYP", BLOB_FIELD_INT, &config.iTEMP_SENS_TYP },
+  { "dTEMP_MV_TRIM", BLOB_FIELD_DOUBLE, &config.dTEMP_MV_TRIM },
+  { "dTEMP_FINE_TUNE", BLOB_FIELD_DOUBLE, &config.dTEMP_FINE_TUNE },
+  { "iRELH_SENS_TYP", BLOB_FIELD_INT, &config.iRELH_SENS_TYP },
+  { "dRELH_MV_TRIM", BLOB_FIELD_DOUBLE, &config.dRELH_MV_TRIM },
+  { "dRELH_FINE_TUNE", BLOB_FIELD_DOUBLE, &config.dRELH_FINE_TUNE },
+  { "bSWIRL_ENBLD", BLOB_FIELD_BOOL, &config.bSWIRL_ENBLD }
+};
+
+
+static const BlobField settingsFields[] = {
+  { "sWIFI_SSID", BLOB_FIELD_STRING, &settings.wifi_ssid },
+  { "sWIFI_PSWD", BLOB_FIELD_STRING, &settings.wifi_pswd },
+  { "sWIFI_AP_SSID", BLOB_FIELD_STRING, &settings.wifi_ap_ssid },
+  { "sWIFI_AP_PSWD", BLOB_FIELD_STRING, &settings.wifi_ap_pswd },
+  { "sHOSTNAME", BLOB_FIELD_STRING, &settings.hostname },
+  { "iWIFI_TIMEOUT", BLOB_FIELD_ULONG, &settings.wifi_timeout },
+  { "iMAF_DIAMETER", BLOB_FIELD_INT, &settings.maf_housing_diameter },
+  { "iREFRESH_RATE", BLOB_FIELD_INT, &settings.refresh_rate },
+  { "iMIN_PRESSURE", BLOB_FIELD_DOUBLE, &settings.min_bench_pressure },
+  { "iMIN_FLOW_RATE", BLOB_FIELD_DOUBLE, &settings.min_flow_rate },
+  { "iDATA_FLTR_TYP", BLOB_FIELD_INT, &settings.data_filter_type },
+  { "iROUNDING_TYP", BLOB_FIELD_INT, &settings.rounding_type },
+  { "iFLOW_DECI_ACC", BLOB_FIELD_INT, &settings.flow_decimal_length },
+  { "iGEN_DECI_ACC", BLOB_FIELD_INT, &settings.gen_decimal_length },
+  { "iCYC_AV_BUFF", BLOB_FIELD_INT, &settings.cyc_av_buffer },
+  { "sAPI_DELIM", BLOB_FIELD_STRING, &settings.api_delim },
+  { "iSHOW_ALARMS", BLOB_FIELD_BOOL, &settings.show_alarms },
+  { "iADJ_FLOW_DEP", BLOB_FIELD_INT, &settings.adj_flow_depression },
+  { "iSTD_REF", BLOB_FIELD_INT, &settings.standardReference },
+  { "iSTD_ADJ_FLOW", BLOB_FIELD_INT, &settings.std_adj_flow },
+  { "iDATACAP_STD", BLOB_FIELD_INT, &settings.data_capture_datatype },
+  { "iDATAGRAPH_MAX", BLOB_FIELD_INT, &settings.dataGraphMax },
+  { "iTEMP_UNIT", BLOB_FIELD_INT, &settings.temp_unit },
+  { "dLIFT_INTERVAL", BLOB_FIELD_DOUBLE, &settings.valveLiftInterval },
+  { "dSTEADY_FLOW", BLOB_FIELD_DOUBLE, &settings.steady_flow_tolerance },
+  { "dSTEADY_PREF", BLOB_FIELD_DOUBLE, &settings.steady_pref_tolerance },
+  { "bOTA_UNVERIFIED", BLOB_FIELD_BOOL, &settings.ota_allow_unverified },
+  { "iBENCH_TYPE", BLOB_FIELD_INT, &settings.bench_type }
+};
+
+
+static const BlobField calibrationFields[] = {
+  { "FLOW_OFFSET", BLOB_FIELD_DOUBLE, &calVal.flow_offset },
+  { "USER_OFFSET", BLOB_FIELD_DOUBLE, &calVal.user_offset },
+  { "LEAK_BASE", BLOB_FIELD_DOUBLE, &calVal.leak_cal_baseline },
+  { "LEAK_BASE_REV", BLOB_FIELD_DOUBLE, &calVal.leak_cal_baseline_rev },
+  { "LEAK_OFFSET", BLOB_FIELD_DOUBLE, &calVal.leak_cal_offset },
+  { "LEAK_OFFSET_REV", BLOB_FIELD_DOUBLE, &calVal.leak_cal_offset_rev },
+  { "PDIFF_OFFSET", BLOB_FIELD_DOUBLE, &calVal.pdiff_cal_offset },
+  { "PITOT_OFFSET", BLOB_FIELD_DOUBLE, &calVal.pitot_cal_offset },
+  { "dCAL_FLW_RATE", BLOB_FIELD_DOUBLE, &calVal.cal_flow_rate },
+  { "dCAL_REF_PRESS", BLOB_FIELD_DOUBLE, &calVal.cal_ref_press },
+  { "dORIFICE1_FLOW", BLOB_FIELD_DOUBLE, &calVal.orificeOneFlow },
+  { "dORIFICE1_PRESS", BLOB_FIELD_DOUBLE, &calVal.orificeOneDepression },
+  { "dORIFICE2_FLOW", BLOB_FIELD_DOUBLE, &calVal.orificeTwoFlow },
+  { "dORIFICE2_PRESS", BLOB_FIELD_DOUBLE, &calVal.orificeTwoDepression },
+  { "dORIFICE3_FLOW", BLOB_FIELD_DOUBLE, &calVal.orificeThreeFlow },
+  { "dORIFICE3_PRESS", BLOB_FIELD_DOUBLE, &calVal.orificeThreeDepression },
+  { "dORIFICE4_FLOW", BLOB_FIELD_DOUBLE, &calVal.orificeFourFlow },
+  { "dORIFICE4_PRESS", BLOB_FIELD_DOUBLE, &calVal.orificeFourDepression },
+  { "dORIFICE5_FLOW", BLOB_FIELD_DOUBLE, &calVal.orificeFiveFlow },
+  { "dORIFICE5_PRESS", BLOB_FIELD_DOUBLE, &calVal.orificeFiveDepression },
+  { "dORIFICE6_FLOW", BLOB_FIELD_DOUBLE, &calVal.orificeSixFlow },
+  { "dORIFICE6_PRESS", BLOB_FIELD_DOUBLE, &calVal.orificeSixDepression }
+};
+
+
+static const BlobField pinsFields[] = {
+  { "VCC_5V", BLOB_FIELD_INT, &pins.VCC_5V },
+  { "VCC_3V3", BLOB_FIELD_INT, &pins.VCC_3V3 },
+  { "SPEED_SENS", BLOB_FIELD_INT, &pins.SPEED_SENS },
+  { "ORIFICE_BCD_1", BLOB_FIELD_INT, &pins.ORIFICE_BCD_1 },
+  { "ORIFICE_BCD_2", BLOB_FIELD_INT, &pins.ORIFICE_BCD_2 },
+  { "ORIFICE_BCD_3", BLOB_FIELD_INT, &pins.ORIFICE_BCD_3 },
+  { "MAF", BLOB_FIELD_INT, &pins.MAF },
+  { "PREF", BLOB_FIELD_INT, &pins.PREF },
+  { "PDIFF", BLOB_FIELD_INT, &pins.PDIFF },
+  { "PITOT", BLOB_FIELD_INT, &pins.PITOT },
+  { "TEMPERATURE", BLOB_FIELD_INT, &pins.TEMPERATURE },
+  { "HUMIDITY", BLOB_FIELD_INT, &pins.HUMIDITY },
+  { "REF_BARO", BLOB_FIELD_INT, &pins.REF_BARO },
+  { "SWIRL_ENCODER_A", BLOB_FIELD_INT, &pins.SWIRL_ENCODER_A },
+  { "SWIRL_ENCODER_B", BLOB_FIELD_INT, &pins.SWIRL_ENCODER_B },
+  { "SERIAL0_RX", BLOB_FIELD_INT, &pins.SERIAL0_RX },
+  { "SERIAL2_RX", BLOB_FIELD_INT, &pins.SERIAL2_RX },
+  { "SDA", BLOB_FIELD_INT, &pins.SDA },
+  { "SCL", BLOB_FIELD_INT, &pins.SCL },
+  { "SD_CS", BLOB_FIELD_INT, &pins.SD_CS },
+  { "SD_MISO", BLOB_FIELD_INT, &pins.SD_MISO },
+  { "SD_SCK", BLOB_FIELD_INT, &pins.SD_SCK },
+  { "SPARE_PIN_1", BLOB_FIELD_INT, &pins.SPARE_PIN_1 },
+  { "SPARE_PIN_2", BLOB_FIELD_INT, &pins.SPARE_PIN_2 },
+  { "VAC_SPEED", BLOB_FIELD_INT, &pins.VAC_SPEED },
+  { "VAC_BANK_1", BLOB_FIELD_INT, &pins.VAC_BANK_1 },
+  { "VAC_BANK_2", BLOB_FIELD_INT, &pins.VAC_BANK_2 },
+  { "VAC_BANK_3", BLOB_FIELD_INT, &pins.VAC_BANK_3 },
+  { "VAC_BLEED_VALVE", BLOB_FIELD_INT, &pins.VAC_BLEED_VALVE },
+  { "AVO_STEP", BLOB_FIELD_INT, &pins.AVO_STEP },
+  { "AVO_DIR", BLOB_FIELD_INT, &pins.AVO_DIR },
+  { "FLOW_VALVE_STEP", BLOB_FIELD_INT, &pins.FLOW_VALVE_STEP },
+  { "FLOW_VALVE_DIR", BLOB_FIELD_INT, &pins.FLOW_VALVE_DIR },
+  { "SD_MOSI", BLOB_FIELD_INT, &pins.SD_MOSI },
+  { "SERIAL0_TX", BLOB_FIELD_INT, &pins.SERIAL0_TX },
+  { "SERIAL2_TX", BLOB_FIELD_INT, &pins.SERIAL2_TX }
+};
+
+
+#define BLOB_FIELD_COUNT(table) (sizeof(table) / sizeof(BlobField))
+
+static SemaphoreHandle_t fieldMutex = NULL;
+static portMUX_TYPE fieldMutexMux = portMUX_INITIALIZER_UNLOCKED;
+
+static const BlobSchema blobSchema[BLOB_STORE_COUNT] = {
+  { "config", CONFIG_SCHEMA_VERSION, configFields, BLOB_FIELD_COUNT(configFields) },
+  { "settings", SETTINGS_SCHEMA_VERSION, settingsFields, BLOB_FIELD_COUNT(settingsFields) },
+  { "calibration", CALIBRATION_SCHEMA_VERSION, calibrationFields, BLOB_FIELD_COUNT(calibrationFields) },
+  { "pins", PINS_SCHEMA_VERSION, pinsFields, BLOB_FIELD_COUNT(pinsFields) }
+};
+
+
+
+
+/***********************************************************
+ * @brief Class constructor
+ ***/
+BlobStore::BlobStore() {
+}
+
+
+
+
+/***********************************************************
+ * @brief lockFields
+ * @details Take the mutex shared by everything that reads or writes the persisted struct fields
+ * @note Created on first use. Two tasks racing to create it both try, the loser deletes its copy
+ ***/
+static void lockFields() {
+
+  if (fieldMutex == NULL) {
+    SemaphoreHandle_t mutex = xSemaphoreCreateMutex();
+    portENTER_CRITICAL(&fieldMutexMux);
+    if (fieldMutex == NULL) {
+      fieldMutex = mutex;
+      mutex = NULL;
+    }
+    portEXIT_CRITICAL(&fieldMutexMux);
+    if (mutex != NULL) vSemaphoreDelete(mutex);
+  }
+
+  xSemaphoreTake(fieldMutex, portMAX_DELAY);
+
+}
+
+
+static void unlockFields() {
+
+  xSemaphoreGive(fieldMutex);
+
+}
+
+
+
+
+/***********************************************************
+ * @brief getSchema
+ ***/
+const BlobSchema * BlobStore::getSchema(uint8_t store) {
+
+  return (store < BLOB_STORE_COUNT) ? &blobSchema[store] : NULL;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief findField
+ * @details Look up a field by its NVS key name
+ ***/
+const BlobField * BlobStore::findField(const BlobSchema *schema, const char *key, size_t keyLength) {
+
+  for (int i = 0; i < schema->fieldCount; i++) {
+    if (strlen(schema->field[i].key) == keyLength && strncmp(schema->field[i].key, key, keyLength) == 0) {
+      return &schema->field[i];
+    }
+  }
+
+  return NULL;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief assignField
+ * @details Store a value into a struct field, converting from the stored type where needed
+ * @note text is used for string values, number for everything else
+ * @note Caller holds lockFields()
+ ***/
+static void assignField(const BlobField *field, double number, const String *text) {
+
+  if (text != NULL && field->type != BLOB_FIELD_STRING) number = text->toDouble();
+
+  switch (field->type) {
+
+    case BLOB_FIELD_INT:
+      *(int *)field->value = (int)number;
+    break;
+
+    case BLOB_FIELD_ULONG:
+      *(unsigned long *)field->value = (unsigned long)number;
+    break;
+
+    case BLOB_FIELD_DOUBLE:
+      *(double *)field->value = number;
+    break;
+
+    case BLOB_FIELD_BOOL:
+      *(bool *)field->value = (number != 0);
+    break;
+
+    case BLOB_FIELD_STRING:
+      *(String *)field->value = (text != NULL) ? *text : String(number);
+    break;
+  }
+
+}
+
+
+
+
+/***********************************************************
+ * @brief encode
+ * @details Serialise all fields of a schema into a blob
+ * @note Caller holds lockFields()
+ * @returns blob length or 0 if it does not fit
+ ***/
+size_t BlobStore::encode(const BlobSchema *schema, uint8_t *blob, size_t maxLength) {
+
+  size_t length = sizeof(BlobHeader);
+
+  for (int i = 0; i < schema->fieldCount; i++) {
+
+    const BlobField &field = schema->field[i];
+    uint8_t keyLength = strlen(field.key);
+    uint8_t valueLength = 0;
+    uint8_t value[8];
+    const uint8_t *valuePtr = value;
+
+    switch (field.type) {
+
+      case BLOB_FIELD_INT: {
+        int32_t intValue = *(int *)field.value;
+        memcpy(value, &intValue, 4);
+        valueLength = 4;
+      break; }
+
+      case BLOB_FIELD_ULONG: {
+        uint32_t ulongValue = *(unsigned long *)field.value;
+        memcpy(value, &ulongValue, 4);
+        valueLength = 4;
+      break; }
+
+      case BLOB_FIELD_DOUBLE:
+        memcpy(value, field.value, 8);
+        valueLength = 8;
+      break;
+
+      case BLOB_FIELD_BOOL:
+        value[0] = *(bool *)field.value ? 1 : 0;
+        valueLength = 1;
+      break;
+
+      case BLOB_FIELD_STRING: {
+        String *text = (String *)field.value;
+        valueLength = min(text->length(), (unsigned int)255);
+        valuePtr = (const uint8_t *)text->c_str();
+      break; }
+    }
+
+    if (length + 3 + keyLength + valueLength > maxLength) return 0;
+
+    blob[length++] = keyLength;
+    memcpy(blob + length, field.key, keyLength);
+    length += keyLength;
+    blob[length++] = field.type;
+    blob[length++] = valueLength;
+    memcpy(blob + length, valuePtr, valueLength);
+    length += valueLength;
+  }
+
+  BlobHeader header;
+  header.magic = BLOB_STORE_MAGIC;
+  header.schemaVersion = schema->version;
+  header.fieldCount = schema->fieldCount;
+  header.payloadLength = length - sizeof(BlobHeader);
+  header.crc = crc32_le(0, blob + sizeof(BlobHeader), header.payloadLength);
+  memcpy(blob, &header, sizeof(BlobHeader));
+
+  return length;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief decode
+ * @details Validate a blob and copy its records into the matching struct fields
+ * @note Records are matched by key so blobs written by older or newer schema versions still load
+ * @note Caller holds lockFields()
+ ***/
+bool BlobStore::decode(const BlobSchema *schema, const uint8_t *blob, size_t length) {
+
+  Messages _message;
+
+  BlobHeader header;
+
+  if (length < sizeof(BlobHeader)) return false;
+  memcpy(&header, blob, sizeof(BlobHeader));
+
+  if (header.magic != BLOB_STORE_MAGIC || header.payloadLength != length - sizeof(BlobHeader)) return false;
+  if (crc32_le(0, blob + sizeof(BlobHeader), header.payloadLength) != header.crc) return false;
+
+  if (header.schemaVersion != schema->version) {
+    _message.debugPrintf("Migrating %s schema v%u to v%u \n", schema->nameSpace, header.schemaVersion, schema->version);
+  }
+
+  size_t offset = sizeof(BlobHeader);
+
+  for (int i = 0; i < header.fieldCount; i++) {
+
+    if (offset + 1 > length) return false;
+    uint8_t keyLength = blob[offset++];
+    if (offset + keyLength + 2 > length) return false;
+    const char *key = (const char *)(blob + offset);
+    offset += keyLength;
+    uint8_t type = blob[offset++];
+    uint8_t valueLength = blob[offset++];
+    if (offset + valueLength > length) return false;
+    const uint8_t *value = blob + offset;
+    offset += valueLength;
+
+    const BlobField *field = findField(schema, key, keyLength);
+    if (field == NULL) continue;
+
+    switch (type) {
+
+      case BLOB_FIELD_INT: {
+        int32_t intValue;
+        if (valueLength != 4) break;
+        memcpy(&intValue, value, 4);
+        assignField(field, intValue, NULL);
+      break; }
+
+      case BLOB_FIELD_ULONG: {
+        uint32_t ulongValue;
+        if (valueLength != 4) break;
+        memcpy(&ulongValue, value, 4);
+        assignField(field, ulongValue, NULL);
+      break; }
+
+      case BLOB_FIELD_DOUBLE: {
+        double doubleValue;
+        if (valueLength != 8) break;
+        memcpy(&doubleValue, value, 8);
+        assignField(field, doubleValue, NULL);
+      break; }
+
+      case BLOB_FIELD_BOOL:
+        if (valueLength != 1) break;
+        assignField(field, value[0], NULL);
+      break;
+
+      case BLOB_FIELD_STRING: {
+        String text;
+        text.concat((const char *)value, valueLength);
+        assignField(field, 0, &text);
+      break; }
+    }
+  }
+
+  return true;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief migrateLegacyKeys
+ * @details Read the original one key per field layout into the struct
+ * @note Values are converted from whatever NVS type they were written with (form saves used the key prefix,
+ * initialisation used the field type, so the two do not always agree). A bool stored against a non bool field
+ * was never readable by the original loader so is skipped.
+ * @note Caller holds lockFields()
+ * @returns true if any legacy keys were found
+ ***/
+bool BlobStore::migrateLegacyKeys(const BlobSchema *schema) {
+
+  Preferences _prefs;
+
+  bool found = false;
+
+  if (!_prefs.begin(schema->nameSpace, true)) return false;
+
+  for (int i = 0; i < schema->fieldCount; i++) {
+
+    const BlobField *field = &schema->field[i];
+
+    switch (_prefs.getType(field->key)) {
+
+      case PT_I32:
+        assignField(field, _prefs.getInt(field->key), NULL);
+        found = true;
+      break;
+
+      case PT_U32:
+        assignField(field, _prefs.getUInt(field->key), NULL);
+        found = true;
+      break;
+
+      case PT_U8:
+        if (field->type == BLOB_FIELD_BOOL) assignField(field, _prefs.getUChar(field->key), NULL);
+        found = true;
+      break;
+
+      case PT_BLOB:
+        if (_prefs.getBytesLength(field->key) == sizeof(double)) assignField(field, _prefs.getDouble(field->key), NULL);
+        found = true;
+      break;
+
+      case PT_STR: {
+        String text = _prefs.getString(field->key);
+        assignField(field, 0, &text);
+        found = true;
+      break; }
+
+      default:
+      break;
+    }
+  }
+
+  _prefs.end();
+
+  return found;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief load
+ * @details Load a struct from its blob with a single NVS read
+ * @note On first boot after upgrading, the original per key layout is migrated into a blob and the old keys removed
+ * @note If there is no blob and no legacy data the structs.h defaults are saved
+ ***/
+bool BlobStore::load(uint8_t store) {
+
+  Messages _message;
+  Preferences _prefs;
+
+  const BlobSchema *schema = getSchema(store);
+  if (schema == NULL) return false;
+
+  uint8_t *blob = (uint8_t *)malloc(BLOB_STORE_MAX_SIZE);
+  if (blob == NULL) return false;
+
+  size_t length = 0;
+  if (_prefs.begin(schema->nameSpace, true)) {
+    length = _prefs.getBytes(BLOB_STORE_KEY, blob, BLOB_STORE_MAX_SIZE);
+    _prefs.end();
+  }
+
+  lockFields();
+  bool loaded = (length > 0) && decode(schema, blob, length);
+  unlockFields();
+  free(blob);
+
+  if (loaded) return true;
+
+  if (length > 0) {
+    _message.serialPrintf("!! %s data invalid - using defaults !!\n", schema->nameSpace);
+    save(store);
+    return false;
+  }
+
+  // No blob yet - migrate legacy keys (or store defaults)
+  lockFields();
+  bool migrated = migrateLegacyKeys(schema);
+  unlockFields();
+
+  if (!save(store)) return false;
+
+  if (migrated) {
+    _message.serialPrintf("Migrated %s to blob storage \n", schema->nameSpace);
+    _prefs.begin(schema->nameSpace);
+    for (int i = 0; i < schema->fieldCount; i++) {
+      _prefs.remove(schema->field[i].key);
+    }
+    _prefs.end();
+  }
+
+  return true;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief save
+ * @details Serialise a struct and write it with a single NVS write
+ * @note Fields are only locked while they are encoded, not for the NVS write
+ ***/
+bool BlobStore::save(uint8_t store) {
+
+  Messages _message;
+  Preferences _prefs;
+
+  const BlobSchema *schema = getSchema(store);
+  if (schema == NULL) return false;
+
+  uint8_t *blob = (uint8_t *)malloc(BLOB_STORE_MAX_SIZE);
+  if (blob == NULL) return false;
+
+  lockFields();
+  size_t length = encode(schema, blob, BLOB_STORE_MAX_SIZE);
+  unlockFields();
+  size_t written = 0;
+
+  if (length > 0) {
+    _prefs.begin(schema->nameSpace);
+    written = _prefs.putBytes(BLOB_STORE_KEY, blob, length);
+    _prefs.end();
+  }
+
+  free(blob);
+
+  if (written != length || length == 0) {
+    _message.serialPrintf("!! Failed to save %s !!\n", schema->nameSpace);
+    return false;
+  }
+
+  return true;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief setField
+ * @details Set a field from a form / API string value
+ * @note Does not save - call save() once all fields have been set
+ * @returns false if the key is not part of the schema
+ ***/
+bool BlobStore::setField(uint8_t store, const char *key, const String &value) {
+
+  const BlobSchema *schema = getSchema(store);
+  if (schema == NULL) return false;
+
+  const BlobField *field = findField(schema, key, strlen(key));
+  if (field == NULL) return false;
+
+  lockFields();
+  assignField(field, 0, &value);
+  unlockFields();
+
+  return true;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief erase
+ * @details Remove all stored data for a struct
+ ***/
+void BlobStore::erase(uint8_t store) {
+
+  Preferences _prefs;
+
+  const BlobSchema *schema = getSchema(store);
+  if (schema == NULL) return;
+
+  _prefs.begin(schema->nameSpace);
+  _prefs.clear();
+  _prefs.end();
+
+}
+
+
+
+
+/***********************************************************
+ * @brief freeEntries
+ * @details Free NVS entries across the partition (reported on the system status page)
+ ***/
+size_t BlobStore::freeEntries() {
+
+  nvs_stats_t stats;
+
+  if (nvs_get_stats(NULL, &stats) != ESP_OK) return 0;
+
+  return stats.free_entries;
+
+}
@@ -0,0 +1,102 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file blobstore.h
+ *
+ * @brief BlobStore class header file
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * Config, settings, calibration and pins are each stored as a single NVS blob (key BLOB_STORE_KEY)
+ * in their original namespace. Blob layout (little endian)
+ *
+ *   BlobHeader                                     - 16 bytes
+ *   Record [keyLength][key][type][valueLength][value] - repeated fieldCount times
+ *
+ * Records are matched to struct fields by their original NVS key name, so fields can be added,
+ * removed or change type between schema versions. Unknown records are skipped and fields with no
+ * record keep their structs.h default.
+ *
+ * If no blob exists the original one-key-per-field layout is migrated into a blob on first boot.
+ *
+ ***/
+#pragma once
+
+#include <Arduino.h>
+
+#include "system.h"
+#include "constants.h"
+
+#define BLOB_STORE_MAGIC 0x424E4642           // "BFNB"
+#define BLOB_STORE_KEY "BLOB"
+
+
+/***********************************************************
+ * Field value types
+ ***/
+#define BLOB_FIELD_INT 0
+#define BLOB_FIELD_ULONG 1
+#define BLOB_FIELD_DOUBLE 2
+#define BLOB_FIELD_BOOL 3
+#define BLOB_FIELD_STRING 4
+
+
+struct BlobHeader {
+	uint32_t magic;
+	uint16_t schemaVersion;
+	uint16_t fieldCount;
+	uint32_t payloadLength;
+	uint32_t crc;             // CRC32 of payload
+};
+
+
+struct BlobField {
+	const char *key;          // Original NVS key (15 chars max)
+	uint8_t type;
+	void *value;              // Struct member
+};
+
+
+struct BlobSchema {
+	const char *nameSpace;
+	uint16_t version;
+	const BlobField *field;
+	uint16_t fieldCount;
+};
+
+
+class BlobStore {
+
+	friend class DataHandler;
+	friend class Calibration;
+	friend class Hardware;
+	friend class Webserver;
+	friend class API;
+
+	private:
+
+		static const BlobSchema * getSchema(uint8_t store);
+		static const BlobField * findField(const BlobSchema *schema, const char *key, size_t keyLength);
+		static bool decode(const BlobSchema *schema, const uint8_t *blob, size_t length);
+		static size_t encode(const BlobSchema *schema, uint8_t *blob, size_t maxLength);
+		static bool migrateLegacyKeys(const BlobSchema *schema);
+
+	public:
+
+		BlobStore();
+
+		static bool load(uint8_t store);
+		static bool save(uint8_t store);
+		static bool setField(uint8_t store, const char *key, const String &value);
+		static void erase(uint8_t store);
+		static size_t freeEntries();
+
+};
@@ -20,6 +20,7 @@
 #include <Arduino.h>
 #include <vector>
 #include <math.h>
+#include <cmath>
 
 #include "constants.h"
 #include "structs.h"
@@ -27,6 +28,7 @@
 #include "calculations.h"
 #include "sensors.h"
 #include "hardware.h"
+#include "benchstate.h"
 #include "messages.h"
 
 
@@ -40,90 +42,116 @@ Calculations::Calculations() {
 
 
 /***********************************************************
- * @brief CONVERT PRESSURE
- * @param inputPressure Input value to be converted
- * @param unitsIn Input value units (default kPa)
- * @param unitsOut Desired output format (default INH2O)
- * ***/
-double Calculations::convertPressure(double inputPressure, int unitsOut, int unitsIn) {
+ * @brief Flow depression scale factor (sqrt of the pressure ratio)
+ * @note Shared by the scalar and batch versions of convertFlowDepression()
+ ***/
+template <typename T>
+static inline T depressionScale(T oldPressure, T newPressure) {
 
-  double inputPressureKpa;
-  double convertedPressure;
+  return (newPressure == oldPressure) ? T(1) : std::sqrt(std::fabs(newPressure) / std::fabs(oldPressure));
 
-  // First convert input pressure to kPa
-  switch (unitsIn)
-  {
-    case PASCALS:
-      inputPressureKpa = inputPressure * 0.001;
-      break;
+}
 
-    case HPA:
-      inputPressureKpa = inputPressure * 0.1;
-      break;
 
-    case BAR:
-      inputPressureKpa = inputPressure * 100;
-      break;
 
-    case PSIA:
-      inputPressureKpa = inputPressure * 6.89476;
-      break;
+/***********************************************************
+ * @brief Runtime unit factor tables
+ * @details Indexed by the unit codes in constants.h and built from the definitions in units.h. Codes that
+ * are not valid for a table keep the previous switch() defaults (kPa in / inH2O out for pressure, base
+ * unit otherwise), so a conversion is two multiplies and no branching on the unit.
+ ***/
+#define UNIT_CODE_COUNT 13 // DECI .. PASCALS
+#define MASS_FLOW_CODE_COUNT 4 // KG_H .. GM_M
+#define VOLUMETRIC_FLOW_CODE_COUNT 3 // CFM .. M3H
+
+static constexpr Units::Factor PRESSURE_DEFAULT = { Units::KiloPascal::toScale, Units::KiloPascal::toOffset, Units::InchWater::fromScale, Units::InchWater::fromOffset };
+
+static_assert(INH2O == 1 && KPA == 2 && PSIA == 3 && BAR == 8 && HPA == 9 && ATM == 11 && PASCALS == 12, "Pressure unit codes do not match pressureUnits[]");
+static_assert(DEGC == 4 && DEGF == 5 && RANKINE == 6 && KELVIN == 10, "Temperature unit codes do not match temperatureUnits[]");
+static_assert(KG_H == 1 && MG_S == 2 && GM_M == 3, "Mass flow unit codes do not match massFlowUnits[]");
+static_assert(CFM == 0 && LPM == 1 && M3H == 2, "Volumetric flow unit codes do not match volumetricFlowUnits[]");
+
+static constexpr Units::Factor pressureUnits[UNIT_CODE_COUNT] = {
+  PRESSURE_DEFAULT,                             // DECI
+  Units::factor<Units::InchWater>(),            // INH2O
+  Units::factor<Units::KiloPascal>(),           // KPA
+  Units::factor<Units::Psi>(),                  // PSIA
+  PRESSURE_DEFAULT,                             // DEGC
+  PRESSURE_DEFAULT,                             // DEGF
+  PRESSURE_DEFAULT,                             // RANKINE
+  PRESSURE_DEFAULT,                             // PERCENT
+  Units::factor<Units::Bar>(),                  // BAR
+  Units::factor<Units::HectoPascal>(),          // HPA
+  PRESSURE_DEFAULT,                             // KELVIN
+  Units::factor<Units::Atmosphere>(),           // ATM
+  Units::factor<Units::Pascal>()                // PASCALS
+};
+
+static constexpr Units::Factor temperatureUnits[UNIT_CODE_COUNT] = {
+  Units::factor<Units::Celsius>(),              // DECI
+  Units::factor<Units::Celsius>(),              // INH2O
+  Units::factor<Units::Celsius>(),              // KPA
+  Units::factor<Units::Celsius>(),              // PSIA
+  Units::factor<Units::Celsius>(),              // DEGC
+  Units::factor<Units::Fahrenheit>(),           // DEGF
+  Units::factor<Units::Rankine>(),              // RANKINE
+  Units::factor<Units::Celsius>(),              // PERCENT
+  Units::factor<Units::Celsius>(),              // BAR
+  Units::factor<Units::Celsius>(),              // HPA
+  Units::factor<Units::Kelvin>(),               // KELVIN
+  Units::factor<Units::Celsius>(),              // ATM
+  Units::factor<Units::Celsius>()               // PASCALS
+};
+
+static constexpr Units::Factor massFlowUnits[MASS_FLOW_CODE_COUNT] = {
+  Units::factor<Units::KgPerHour>(),            // (unused)
+  Units::factor<Units::KgPerHour>(),            // KG_H
+  Units::factor<Units::MgPerSecond>(),          // MG_S
+  Units::factor<Units::GramPerMinute>()         // GM_M
+};
+
+static constexpr Units::Factor volumetricFlowUnits[VOLUMETRIC_FLOW_CODE_COUNT] = {
+  Units::factor<Units::CubicFeetPerMinute>(),   // CFM
+  Units::factor<Units::LitrePerMinute>(),       // LPM
+  Units::factor<Units::CubicMetrePerHour>()     // M3H
+};
 
-    case INH2O:
-      inputPressureKpa = inputPressure * 0.24884;
-      break;
 
-    case ATM:
-      inputPressureKpa = inputPressure * 101.325;
-      break;
 
-    case KPA:
-    default:
-      inputPressureKpa = inputPressure;
-      break;
+/***********************************************************
+ * @brief Look up a runtime unit code, out of range codes use the fallback
+ ***/
+static inline const Units::Factor & unitFactor(const Units::Factor *table, int count, int code, const Units::Factor &fallback) {
 
-  }
+  return (code >= 0 && code < count) ? table[code] : fallback;
 
-  // Then convert kPa to required output and return result
-  switch (unitsOut)
-  {
-    case PASCALS:
-      convertedPressure = inputPressureKpa * 1000;
-      return convertedPressure;
-      break;
+}
 
-    case HPA:
-      convertedPressure = inputPressureKpa * 10;
-      return convertedPressure;
-      break;
 
-    case BAR:
-      convertedPressure = inputPressureKpa * 0.01;
-      return convertedPressure;
-      break;
 
-    case PSIA:
-      convertedPressure = inputPressureKpa * 0.145037738;
-      return convertedPressure;
-      break;
-      
-    case KPA:
-      return inputPressureKpa;
-      break;
+/***********************************************************
+ * @brief Convert through the base unit of a table
+ ***/
+static inline double convertUnits(double value, const Units::Factor &unitsIn, const Units::Factor &unitsOut) {
 
-    case ATM:
-      inputPressureKpa = inputPressure * 0.00986923;
-      break;
+  return (value * unitsIn.toScale + unitsIn.toOffset) * unitsOut.fromScale + unitsOut.fromOffset;
 
-    case INH2O:
-    default:
-      convertedPressure = inputPressureKpa * 4.01463;
-      return convertedPressure;
-      break;
+}
 
-  }
 
-  return 0.00001; // else return small non zero value which will get filtered out as zero
+
+/***********************************************************
+ * @brief CONVERT PRESSURE
+ * @param inputPressure Input value to be converted
+ * @param unitsIn Input value units (default kPa)
+ * @param unitsOut Desired output format (default INH2O)
+ * @note Where the units are fixed use Units::convert<Units::KiloPascal, Units::InchWater>() instead
+ * ***/
+double Calculations::convertPressure(double inputPressure, int unitsOut, int unitsIn) {
+
+  return convertUnits(inputPressure, 
+    unitFactor(pressureUnits, UNIT_CODE_COUNT, unitsIn, PRESSURE_DEFAULT), 
+    unitFactor(pressureUnits, UNIT_CODE_COUNT, unitsOut, PRESSURE_DEFAULT));
 
 }
 
@@ -138,61 +166,10 @@ double Calculations::convertPressure(double inputPressure, int unitsOut, int uni
  ***/
 double Calculations::convertTemperature(double refTemp, int unitsOut, int unitsIn) {
 
-  double refTempDegF;
-  double refTempRankine;
-
-  double inputTempDegC;
-  double convertedTemp;
+  return convertUnits(refTemp, 
+    unitFactor(temperatureUnits, UNIT_CODE_COUNT, unitsIn, temperatureUnits[DEGC]), 
+    unitFactor(temperatureUnits, UNIT_CODE_COUNT, unitsOut, temperatureUnits[DEGC]));
 
-
-    // First convert input Temperature to DegC
-  switch (unitsIn) {
-
-    case DEGF:
-      inputTempDegC = (refTemp - 32) * 0.5556;
-      break;
-
-    case RANKINE:
-      inputTempDegC = (refTemp - 491.67) * 0.5556;
-      break;
-
-    case KELVIN:
-      inputTempDegC = refTemp - 273.15;
-      break;
-
-    default: // DEGC
-      inputTempDegC = refTemp;
-      break;
-
-
-  }
-
-  // Then convert DegC to required value and return
-  switch (unitsOut) 	{
-
-    case DEGF:
-      convertedTemp = (inputTempDegC * 1.8) + 32;
-      return convertedTemp;
-      break;
-
-    case RANKINE:
-      convertedTemp = (inputTempDegC + 273.15 ) * 1.8;
-      return convertedTemp;
-      break;
-
-    case KELVIN:
-      convertedTemp = inputTempDegC + 273.15;
-      return convertedTemp;
-      break;
-
-    case DEGC:
-    default:
-      return inputTempDegC;
-      break;
-
-  }
-
-  return 0.00001; // else return small non zero value which will get filtered out as zero
 }
 
 
@@ -233,44 +210,9 @@ double Calculations::convertRelativeHumidity(double relativeHumidity, int units)
  ***/
 double Calculations::convertMassFlowUnits(double refFlow, int unitsIn, int unitsOut) {
 
-  double massFlowKGH = 0.0;
-  double convertedFlow = 0.0;
-
-  switch (unitsIn) {
-
-    case MG_S:
-      massFlowKGH = refFlow * 0.0036;
-      break;
-
-    case GM_M:
-      massFlowKGH = refFlow * 0.06;
-      break;
-
-    case KG_H:
-    default:
-      massFlowKGH = refFlow;
-      break;
-  }
-
-
-  switch (unitsOut) {
-
-    case MG_S:
-      convertedFlow = massFlowKGH * 277.778;
-      break;
-
-    case GM_M:
-      convertedFlow = massFlowKGH * 16.6667;
-      break;
-
-    case KG_H:
-    default:
-      convertedFlow = massFlowKGH;
-      break;
-  }
-
-
-  return convertedFlow;
+  return convertUnits(refFlow, 
+    unitFactor(massFlowUnits, MASS_FLOW_CODE_COUNT, unitsIn, massFlowUnits[KG_H]), 
+    unitFactor(massFlowUnits, MASS_FLOW_CODE_COUNT, unitsOut, massFlowUnits[KG_H]));
 
 }
 
@@ -289,45 +231,11 @@ double Calculations::convertMassFlowUnits(double refFlow, int unitsIn, int units
  * 1 LPM = 0.06 m³/h
  ***/
 double Calculations::convertVolumetricFlowUnits(double refFlow, int unitsIn, int unitsOut) {
-    
-    double flowM3H = 0.0;
-    double convertedFlow = 0.0;
-
-    // Convert input to M3H
-    switch (unitsIn) {
-     
-        case CFM:
-            flowM3H = refFlow * 1.699;
-            break;
-     
-        case LPM:
-            flowM3H = refFlow * 0.06;
-            break;
-     
-        case M3H:
-        default:
-            flowM3H = refFlow;
-            break;
-    }
 
-    // Convert M3H to output units
-    switch (unitsOut) {
-     
-        case CFM:
-            convertedFlow = flowM3H * 0.589;
-            break;
-     
-        case LPM:
-            convertedFlow = flowM3H * 16.667;
-            break;
-     
-        case M3H:
-        default:
-            convertedFlow = flowM3H;
-            break;
-    }
+  return convertUnits(refFlow, 
+    unitFactor(volumetricFlowUnits, VOLUMETRIC_FLOW_CODE_COUNT, unitsIn, volumetricFlowUnits[M3H]), 
+    unitFactor(volumetricFlowUnits, VOLUMETRIC_FLOW_CODE_COUNT, unitsOut, volumetricFlowUnits[M3H]));
 
-    return convertedFlow;
 }
 
 
@@ -345,32 +253,54 @@ double Calculations::convertVolumetricFlowUnits(double refFlow, int unitsIn, int
  ***/
 double Calculations::convertFlow(double massFlowKGH) {
 
+  // only return value if valid posotive value received
+  if ( massFlowKGH > 0 ) {
+    return massFlowKGH * flowScaleCFM(currentEnv());
+  } else {
+    return 0.0;
+  }
+
+}
+
+
+
+
+/***********************************************************
+ * @brief Snapshot of the live environment as an EnvBlock
+ ***/
+EnvBlock Calculations::currentEnv() {
+
   extern struct SensorData sensorVal;
 
-  double airDensity = 0.0f; // kg/m3
-  double waterVaporDensity = 0.0f; // kg/m3
-  double waterVaporPressure = 0.0f; // kg/m3
-  double dryAirPressure = 0.0f; // kg/m3
-  double flowM3H = 0.0f; // m3/hr
-  double flowCFM = 0.0f;
+  EnvBlock env;
 
-  // TODO validate reference pressure adjustment - do we add it or subtract it? Should be baro pressure less vac amount
-  double refPressurePascals = sensorVal.BaroPA - this->convertPressure(sensorVal.PRefKPA, PASCALS) ;
+  env.TempDegC = sensorVal.TempDegC;
+  env.BaroPA = sensorVal.BaroPA;
+  env.PRefKPA = sensorVal.PRefKPA;
+  env.RelH = sensorVal.RelH;
 
-  airDensity = calculateAirDensity(sensorVal.TempDegC, refPressurePascals, sensorVal.RelH);
+  return env;
 
-  // Multiply mass by density to get volume (m3/hr)
-  flowM3H = massFlowKGH / airDensity; 
+}
 
-  // Convert to CFM
-  flowCFM = flowM3H * 0.58857833F;
 
-  // only return value if valid posotive value received
-  if ( massFlowKGH > 0 ) {
-    return flowCFM;
-  } else {
-    return 0.0;
-  }
+
+
+/***********************************************************
+ * @brief Mass flow (kg/h) to volumetric flow (CFM) multiplier for an environment
+ * @note Shared by the scalar and batch versions of convertFlow()
+ ***/
+double Calculations::flowScaleCFM(const EnvBlock &env) {
+
+  double airDensity = 0.0; // kg/m3
+
+  // TODO validate reference pressure adjustment - do we add it or subtract it? Should be baro pressure less vac amount
+  double refPressurePascals = env.BaroPA - Units::convert<Units::KiloPascal, Units::Pascal>(env.PRefKPA);
+
+  airDensity = calculateAirDensity(env.TempDegC, refPressurePascals, env.RelH);
+
+  // Dividing mass by density gives volume (m3/hr), then convert to CFM
+  return 0.58857833F / airDensity;
 
 }
 
@@ -393,21 +323,8 @@ double Calculations::convertFlow(double massFlowKGH) {
 */
 double Calculations::convertFlowDepression(double oldPressure, double newPressure, double inputFlowCFM) {
 
-  Calculations _calculations;
-  Hardware _hardware;
-  double outputFlow;
-  double pressureRatio;
-  double scaleFactor;
-
-  if (_hardware.benchIsRunning()) {
-    if (newPressure == oldPressure) {
-      return inputFlowCFM;
-    } else {
-      pressureRatio = (abs(newPressure) / abs(oldPressure));
-    }
-    scaleFactor = sqrt(pressureRatio);
-    outputFlow =  inputFlowCFM * scaleFactor;
-    return outputFlow;
+  if (BenchState::isRunning()) {
+    return inputFlowCFM * depressionScale(oldPressure, newPressure);
   } else {
     return 0.0;
   }
@@ -505,9 +422,19 @@ double Calculations::calculateAirDensity(double TempC, double refPressurePascals
 
 double Calculations::convertToSCFM(double flowCFM, int standard) {
   
-  extern struct SensorData sensorVal; 
+  return flowCFM * scfmScale(currentEnv(), standard);
+  
+}
+
+
+
+
+/***********************************************************
+ * @brief Actual to standard flow multiplier for an environment
+ * @note Shared by the scalar and batch versions of convertToSCFM()
+ ***/
+double Calculations::scfmScale(const EnvBlock &env, int standard) {
 
-  double SCFM;
   double tStd;
   double pStd;
   double rhStd;
@@ -558,19 +485,100 @@ double Calculations::convertToSCFM(double flowCFM, int standard) {
   // SCFM = sensorVal.FlowCFM * (sensorVal.PRefKPA / pStd) * (tStd / sensorVal.TempDegC) * (1 / (1 - ( sensorVal.RelH / 100)));
 
   // From https://neutrium.net/general-engineering/conversion-of-standard-volumetric-flow-rates-of-gas/
-  airDensityAct = calculateAirDensity(sensorVal.TempDegC, sensorVal.BaroPA , sensorVal.RelH);
-  airDensityStd = calculateAirDensity(tStd, convertPressure(pStd,PASCALS) , rhStd);
+  airDensityAct = calculateAirDensity(env.TempDegC, env.BaroPA , env.RelH);
+  airDensityStd = calculateAirDensity(tStd, Units::convert<Units::KiloPascal, Units::Pascal>(pStd) , rhStd);
 
-  // SCFM = sensorVal.FlowCFM * (airDensityAct / airDensityStd);
-  SCFM = flowCFM * (airDensityAct / airDensityStd);
-
-  return SCFM;
+  return airDensityAct / airDensityStd;
   
 }
 
 
 
 
+/***********************************************************
+ * @brief BATCH CONVERT FLOW
+ * @details Mass flow (kg/h) to volumetric flow (CFM) for a block of samples sharing one environment
+ * @param massFlowKGH Input block
+ * @param flowCFM Output block (may be the same array as the input)
+ * @note Density is worked out once per block, the loop is a clamp and multiply in single precision 
+ * so it maps onto the ESP32 FPU and vectorises on the host
+ ***/
+void Calculations::convertFlow(const float *massFlowKGH, float *flowCFM, size_t count, const EnvBlock &env) {
+
+  const float scale = flowScaleCFM(env);
+
+  // Density is always positive so clamping the input matches the scalar 'massFlowKGH > 0' check
+  for (size_t i = 0; i < count; i++) {
+    float flow = massFlowKGH[i];
+    flowCFM[i] = ((flow > 0.0f) ? flow : 0.0f) * scale;
+  }
+
+}
+
+
+
+
+/***********************************************************
+ * @brief BATCH CONVERT TO SCFM
+ * @param flowCFM Input block
+ * @param flowSCFM Output block (may be the same array as the input)
+ ***/
+void Calculations::convertToSCFM(const float *flowCFM, float *flowSCFM, size_t count, const EnvBlock &env, int standard) {
+
+  const float scale = scfmScale(env, standard);
+
+  for (size_t i = 0; i < count; i++) {
+    flowSCFM[i] = flowCFM[i] * scale;
+  }
+
+}
+
+
+
+
+/***********************************************************
+ * @brief BATCH CONVERT FLOW DEPRESSION
+ * @param oldPressure Block of recorded reference pressures
+ * @param newPressure Reference pressure to convert to
+ * @param inputFlowCFM Input block
+ * @param outputFlowCFM Output block (may be the same array as the input)
+ * @note Unlike the scalar version there is no bench running check, samples with no reference 
+ * pressure return zero instead
+ ***/
+void Calculations::convertFlowDepression(const float *oldPressure, double newPressure, const float *inputFlowCFM, float *outputFlowCFM, size_t count) {
+
+  const float pressure = newPressure;
+
+  for (size_t i = 0; i < count; i++) {
+    float flow = inputFlowCFM[i] * depressionScale(oldPressure[i], pressure);
+    outputFlowCFM[i] = (oldPressure[i] != 0.0f) ? flow : 0.0f;
+  }
+
+}
+
+
+
+
+/***********************************************************
+ * @brief BATCH CONVERT PRESSURE
+ * @note Units are resolved once per block, the loop is a single multiply add
+ ***/
+void Calculations::convertPressure(const float *inputPressure, float *outputPressure, size_t count, int unitsOut, int unitsIn) {
+
+  const Units::Factor &factorIn = unitFactor(pressureUnits, UNIT_CODE_COUNT, unitsIn, PRESSURE_DEFAULT);
+  const Units::Factor &factorOut = unitFactor(pressureUnits, UNIT_CODE_COUNT, unitsOut, PRESSURE_DEFAULT);
+  const float scale = factorIn.toScale * factorOut.fromScale;
+  const float offset = factorIn.toOffset * factorOut.fromScale + factorOut.fromOffset;
+
+  for (size_t i = 0; i < count; i++) {
+    outputPressure[i] = inputPressure[i] * scale + offset;
+  }
+
+}
+
+
+
+
 
 
 
@@ -18,6 +18,19 @@
  ***/
 #pragma once
 #include "constants.h"
+#include "units.h"
+
+
+/***********************************************************
+ * @brief Environment shared by a block of samples (batch conversions)
+ ***/
+struct EnvBlock {
+	double TempDegC;
+	double BaroPA;
+	double PRefKPA;
+	double RelH;
+};
+
 
 class Calculations {
 
@@ -27,6 +40,10 @@ class Calculations {
 	private:
 		double MOLECULAR_WEIGHT_DRY_AIR;
 		bool streamMafData = false;
+
+		EnvBlock currentEnv();
+		double flowScaleCFM(const EnvBlock &env);
+		double scfmScale(const EnvBlock &env, int standard);
 		
 	public:
 		Calculations();
@@ -46,6 +63,13 @@ class Calculations {
 		double calculateAirDensity(double TempC, double baroKPA, double RelHumidity);
 		double convertToSCFM(double flow, int standard);
         double calculateMafFlow(double mafVolts);
+
+		// Batch conversions - same maths as the scalar versions, one environment per block
+		void convertFlow(const float *massFlowKGH, float *flowCFM, size_t count, const EnvBlock &env);
+		void convertToSCFM(const float *flowCFM, float *flowSCFM, size_t count, const EnvBlock &env, int standard);
+		void convertFlowDepression(const float *oldPressure, double newPressure, const float *inputFlowCFM, float *outputFlowCFM, size_t count);
+		void convertPressure(const float *inputPressure, float *outputPressure, size_t count, int unitsOut, int unitsIn = KPA);
+
 		double startupBaroPressure;
 
 		String byteDecode(size_t bytes);
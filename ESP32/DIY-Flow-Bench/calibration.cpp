@@ -17,9 +17,7 @@
  * 
  ***/
 
-#include <SPIFFS.h>
 #include <ArduinoJson.h>
-#include <Preferences.h>
 
 #include "constants.h"
 #include "structs.h"
@@ -30,6 +28,9 @@
 #include "calculations.h"
 #include "messages.h"
 #include "webserver.h"
+#include "blobstore.h"
+#include "persistence.h"
+#include "history.h"
 
 
 Calibration::Calibration () {
@@ -58,33 +59,43 @@ bool Calibration::setFlowOffset() {
   Calculations _calculations;
   Messages _message;
 
-  double flowVal = 0.0f;
+  int channel = HISTORY_FLOW_CFM;
 
   // Get flow type based on currently visible tile
   switch (sensorVal.flowtile) {
     case MAFFLOW_TILE:
-      flowVal = sensorVal.FlowCFM;
+      channel = HISTORY_FLOW_CFM;
       // TODO ADD SYSTEM Warning !!!
     break;
 
     case ACFM_TILE:
-      flowVal = sensorVal.FlowCFM;
+      channel = HISTORY_FLOW_CFM;
     break;
 
     case ADJCFM_TILE:
-      flowVal = sensorVal.FlowADJ;
+      channel = HISTORY_FLOW_ADJ;
     break;
 
     case SCFM_TILE:
-      flowVal = sensorVal.FlowSCFM;
+      channel = HISTORY_FLOW_SCFM;
     break;
 
   }
+
+  // Average over the last HISTORY_CAL_WINDOW_MS rather than a single reading
+  WindowStats flowWindow = SampleHistory::last(channel, HISTORY_CAL_WINDOW_MS);
+
+  if (!flowWindow.complete || flowWindow.benchStopped) {
+    _message.debugPrintf("Calibration::setFlowOffset rejected - bench not running for %lu ms (%lu samples) \n", (unsigned long)HISTORY_CAL_WINDOW_MS, (unsigned long)flowWindow.count);
+    return false;
+  }
+
+  double flowVal = flowWindow.mean;
  
   // update config var
   calVal.flow_offset = flowVal - calVal.cal_flow_rate;
   
-  _message.debugPrintf("Calibration::setFlowOffset %d \n", calVal.flow_offset);
+  _message.debugPrintf("Calibration::setFlowOffset %f (%lu samples, sd %f) \n", calVal.flow_offset, (unsigned long)flowWindow.count, flowWindow.stdDev);
 
   saveCalibrationData();    
 
@@ -103,8 +114,6 @@ bool Calibration::setFlowOffset() {
 double Calibration::getFlowOffset() {
 
   extern struct CalibrationData calVal;
-  
-  loadCalibrationData();
 
   return calVal.flow_offset;
 
@@ -128,9 +137,6 @@ bool Calibration::setLeakOffset() {
   extern struct Language language;
   extern struct SensorData sensorVal;
 
-  // load current calibration data
-  this->loadCalibrationData();
-
   _message.debugPrintf("Calibration::setLeakTest \n");
 
   //TODO - Reverse flow calibration. Need to understand reverse flow characetitics of sensor
@@ -146,7 +152,14 @@ bool Calibration::setLeakOffset() {
     // _message.Handler(language.LANG_LEAK_CAL_VAL + calVal.leak_cal_offset);
   // }
 
-    calVal.leak_cal_offset = sensorVal.FlowCFM;
+    WindowStats leakWindow = SampleHistory::last(HISTORY_FLOW_CFM, HISTORY_CAL_WINDOW_MS);
+
+    if (!leakWindow.complete || leakWindow.benchStopped) {
+      _message.debugPrintf("Calibration::setLeakTest rejected - bench not running for %lu ms (%lu samples) \n", (unsigned long)HISTORY_CAL_WINDOW_MS, (unsigned long)leakWindow.count);
+      return false;
+    }
+
+    calVal.leak_cal_offset = leakWindow.mean;
     // _message.Handler(language.LANG_LEAK_CAL_VAL + calVal.leak_cal_offset);
 
   saveCalibrationData();    
@@ -164,7 +177,6 @@ bool Calibration::setLeakOffset() {
 double Calibration::getLeakOffset() {
 
   extern struct CalibrationData calVal;
-  loadCalibrationData();
   
   return calVal.leak_cal_offset;
 
@@ -180,8 +192,6 @@ double Calibration::getLeakOffsetReverse() {
 
   extern struct CalibrationData calVal;
   
-  loadCalibrationData();
-  
   return calVal.leak_cal_offset_rev;
 
 }
@@ -214,12 +224,14 @@ bool Calibration::setPdiffCalOffset() {
  
   if (calVal.pdiff_cal_offset == 0) {
     // update config var
-    calVal.pdiff_cal_offset = sensorVal.PDiffH2O;
-    _message.debugPrintf("Calibration::setPdiffOffset %d \n", calVal.pdiff_cal_offset);
+    WindowStats pDiffWindow = SampleHistory::last(HISTORY_PDIFF_H2O, HISTORY_CAL_WINDOW_MS);
+    if (!pDiffWindow.complete) return false;
+    calVal.pdiff_cal_offset = pDiffWindow.mean;
+    _message.debugPrintf("Calibration::setPdiffOffset %f \n", calVal.pdiff_cal_offset);
   } else {
     // update config var
     calVal.pdiff_cal_offset = 0.0;
-    _message.debugPrintf("Calibration::resetPdiffOffset %d \n", 0.0);
+    _message.debugPrintf("Calibration::resetPdiffOffset %f \n", 0.0);
   }
 
  
@@ -243,8 +255,6 @@ bool Calibration::setPdiffCalOffset() {
 double Calibration::getPdiffCalOffset() {
 
   extern struct CalibrationData calVal;
-  
-  loadCalibrationData();
 
   return calVal.pdiff_cal_offset;
 
@@ -273,12 +283,14 @@ bool Calibration::setPitotCalOffset() {
 
   if (calVal.pitot_cal_offset == 0) {
     // update config var
-    calVal.pitot_cal_offset = sensorVal.PitotKPA;
-    _message.debugPrintf("Calibration::setPitotDeltaOffset %d kPa\n", calVal.pitot_cal_offset);
+    WindowStats pitotWindow = SampleHistory::last(HISTORY_PITOT_KPA, HISTORY_CAL_WINDOW_MS);
+    if (!pitotWindow.complete) return false;
+    calVal.pitot_cal_offset = pitotWindow.mean;
+    _message.debugPrintf("Calibration::setPitotDeltaOffset %f kPa\n", calVal.pitot_cal_offset);
   } else {
     // update config var
     calVal.pitot_cal_offset = 0.0;
-    _message.debugPrintf("Calibration::resetPitotDeltaOffset %d \n", 0.0);
+    _message.debugPrintf("Calibration::resetPitotDeltaOffset %f \n", 0.0);
   }
 
   saveCalibrationData();    
@@ -298,8 +310,6 @@ bool Calibration::setPitotCalOffset() {
 double Calibration::getPitotCalOffset() {
 
   extern struct CalibrationData calVal;
-  
-  loadCalibrationData();
 
   return calVal.pdiff_cal_offset;
 
@@ -310,121 +320,35 @@ double Calibration::getPitotCalOffset() {
 
 
 
-/***********************************************************
-* @brief initialiseLiftData
-* @note - Initialise settings in NVM if they do not exist
-* @note Key must be 15 chars or shorter.
-***/ 
-void Calibration::initialiseCalibrationData () {
-
-  Messages _message;
-  Preferences _prefs;
-
-  _message.serialPrintf("Loading Bench Settings \n");    
-  
-  _prefs.begin("calibration");
-
-  if (!_prefs.isKey("FLOW_OFFSET")) _prefs.putDouble("FLOW_OFFSET", 0.0);
-  if (!_prefs.isKey("USER_OFFSET")) _prefs.putDouble("USER_OFFSET", 0.0);
-  if (!_prefs.isKey("LEAK_BASE")) _prefs.putDouble("LEAK_BASE", 0.0);
-  if (!_prefs.isKey("LEAK_BASE_REV")) _prefs.putDouble("LEAK_BASE_REV", 0.0);
-  if (!_prefs.isKey("LEAK_OFFSET")) _prefs.putDouble("LEAK_OFFSET", 0.0);
-  if (!_prefs.isKey("LEAK_OFFSET_REV")) _prefs.putDouble("LEAK_OFFSET_REV", 0.0);
-  if (!_prefs.isKey("PDIFF_OFFSET")) _prefs.putDouble("PDIFF_OFFSET", 0.0);
-  if (!_prefs.isKey("PITOT_OFFSET")) _prefs.putDouble("PITOT_OFFSET", 0.0);
-
-  if (!_prefs.isKey("dCAL_FLW_RATE")) _prefs.putDouble("dCAL_FLW_RATE", 14.4F);
-  if (!_prefs.isKey("dCAL_REF_PRESS")) _prefs.putDouble("dCAL_REF_PRESS", 10.0F);
-  if (!_prefs.isKey("dORIFICE1_FLOW")) _prefs.putDouble("dORIFICE1_FLOW", 0.0F);
-  if (!_prefs.isKey("dORIFICE1_PRESS")) _prefs.putDouble("dORIFICE1_PRESS", 0.0F);
-  if (!_prefs.isKey("dORIFICE2_FLOW")) _prefs.putDouble("dORIFICE2_FLOW", 0.0F);
-  if (!_prefs.isKey("dORIFICE2_PRESS")) _prefs.putDouble("dORIFICE2_PRESS", 0.0F);
-  if (!_prefs.isKey("dORIFICE3_FLOW")) _prefs.putDouble("dORIFICE3_FLOW", 0.0F);
-  if (!_prefs.isKey("dORIFICE3_PRESS")) _prefs.putDouble("dORIFICE3_PRESS", 0.0F);
-  if (!_prefs.isKey("dORIFICE4_FLOW")) _prefs.putDouble("dORIFICE4_FLOW", 0.0F);
-  if (!_prefs.isKey("dORIFICE4_PRESS")) _prefs.putDouble("dORIFICE4_PRESS", 0.0F);
-  if (!_prefs.isKey("dORIFICE5_FLOW")) _prefs.putDouble("dORIFICE5_FLOW", 0.0F);
-  if (!_prefs.isKey("dORIFICE5_PRESS")) _prefs.putDouble("dORIFICE5_PRESS", 0.0F);
-  if (!_prefs.isKey("dORIFICE6_FLOW")) _prefs.putDouble("dORIFICE6_FLOW", 0.0F);
-  if (!_prefs.isKey("dORIFICE6_PRESS")) _prefs.putDouble("dORIFICE6_PRESS", 0.0F);
-
-  _prefs.end();
-}
-
-
-
-
-
 /***********************************************************
 * @brief loadCalibration 
 * @details load calibration data from NVM into struct
+* @note Stored as a single blob - see blobstore.cpp for the key / field map
 ***/
 void Calibration::loadCalibrationData() {
   
   Messages _message;
-  Preferences _prefs;
-
-  extern struct CalibrationData calVal;
-  extern struct Language language;
 
   _message.serialPrintf("Loading Calibration Data \n");    
   
-  _prefs.begin("calibration");
-
-  calVal.flow_offset = _prefs.getDouble("FLOW_OFFSET", 0.0);
-  calVal.user_offset = _prefs.getDouble("USER_OFFSET", 0.0);
-  calVal.leak_cal_baseline = _prefs.getDouble("LEAK_BASE", 0.0);
-  calVal.leak_cal_baseline_rev = _prefs.getDouble("LEAK_BASE_REV", 0.0);
-  calVal.leak_cal_offset = _prefs.getDouble("LEAK_OFFSET", 0.0);
-  calVal.leak_cal_offset_rev = _prefs.getDouble("LEAK_OFFSET_REV", 0.0);
-  calVal.pdiff_cal_offset = _prefs.getDouble("PDIFF_OFFSET", 0.0);
-  calVal.pitot_cal_offset = _prefs.getDouble("PITOT_OFFSET", 0.0);
-
-  calVal.cal_flow_rate = _prefs.getDouble("dCAL_FLW_RATE", 14.4F );
-  calVal.cal_ref_press = _prefs.getDouble("dCAL_REF_PRESS", 10.0F );
-  calVal.orificeOneFlow = _prefs.getDouble("dORIFICE1_FLOW", 0.0F );
-  calVal.orificeOneDepression = _prefs.getDouble("dORIFICE1_PRESS", 0.0F );
-  calVal.orificeTwoFlow = _prefs.getDouble("dORIFICE2_FLOW", 0.0F );
-  calVal.orificeTwoDepression = _prefs.getDouble("dORIFICE2_PRESS", 0.0F );
-  calVal.orificeThreeFlow = _prefs.getDouble("dORIFICE3_FLOW", 0.0F );
-  calVal.orificeThreeDepression = _prefs.getDouble("dORIFICE3_PRESS", 0.0F );
-  calVal.orificeFourFlow = _prefs.getDouble("dORIFICE4_FLOW", 0.0F );
-  calVal.orificeFourDepression = _prefs.getDouble("dORIFICE4_PRESS", 0.0F );
-  calVal.orificeFiveFlow = _prefs.getDouble("dORIFICE5_FLOW", 0.0F );
-  calVal.orificeFiveDepression = _prefs.getDouble("dORIFICE5_PRESS", 0.0F );
-  calVal.orificeSixFlow = _prefs.getDouble("dORIFICE6_FLOW", 0.0F );
-  calVal.orificeSixDepression = _prefs.getDouble("dORIFICE6_PRESS",  0.0F);
-
-  _prefs.end();
+  BlobStore::load(BLOB_STORE_CALIBRATION);
+
 }
 
 
 
 /***********************************************************
 * @brief saveCalibration 
-* @details write calibration data to NVM
+* @details Queue calibration data to be written to NVM
+* @note calVal is the live copy, the getters no longer reload it from NVM
 ***/
 void Calibration::saveCalibrationData() {
   
-  Preferences _prefs;
   Messages _message;
-  DataHandler _data;
 
-  extern struct CalibrationData calVal;
   extern struct Language language;
 
-  _prefs.begin("calibration");
-
-  _prefs.putDouble("FLOW_OFFSET", calVal.flow_offset);
-  _prefs.putDouble("USER_OFFSET", calVal.user_offset);
-  _prefs.putDouble("LEAK_BASE", calVal.leak_cal_baseline);
-  _prefs.putDouble("LEAK_BASE_REV", calVal.leak_cal_baseline_rev);
-  _prefs.putDouble("LEAK_OFFSET", calVal.leak_cal_offset);
-  _prefs.putDouble("LEAK_OFFSET_REV", calVal.leak_cal_offset_rev);
-  _prefs.putDouble("PDIFF_OFFSET", calVal.pdiff_cal_offset);
-  _prefs.putDouble("PITOT_OFFSET", calVal.pitot_cal_offset);
-    
-  _prefs.end();
+  Persistence::request(PERSIST_CALIBRATION);
 
   _message.Handler(language.LANG_SAVING_CALIBRATION);
 
@@ -97,7 +97,7 @@ void Comms::initaliseWifi() {
     } else { // AP mode is Fallback
       _message.serialPrintf("Failed to connect to Wifi \n");
       _message.serialPrintf("Wifi Status message: ");
-      _message.serialPrintf(String(wifiStatusCode).c_str());
+      _message.serialPrintf("%s", String(wifiStatusCode).c_str());
       _message.serialPrintf("\n");
     }
 
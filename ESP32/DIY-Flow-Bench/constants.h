@@ -177,6 +177,115 @@ enum VolumetricUnits {
 #define MIMIC_PAGE 7
 
 
+/***********************************************************
+ * Server Side Event (SSE) topics
+ ***/
+#define SSE_TOPIC_FLOW 0
+#define SSE_TOPIC_MIMIC 1
+#define SSE_TOPIC_STATUS 2
+#define SSE_TOPIC_ALARMS 3
+#define SSE_TOPIC_LOG 4
+#define SSE_TOPIC_COUNT 5
+
+
+/***********************************************************
+ * Log levels (Messages::xxxPrintf)
+ ***/
+#define LOG_LEVEL_SERIAL 0
+#define LOG_LEVEL_DEBUG 1
+#define LOG_LEVEL_VERBOSE 2
+#define LOG_LEVEL_STATUS 3
+#define LOG_LEVEL_COUNT 4
+
+
+/***********************************************************
+ * Bench state (BenchState::state())
+ ***/
+#define BENCH_STATE_IDLE 0
+#define BENCH_STATE_SPOOLING 1
+#define BENCH_STATE_RUNNING 2
+#define BENCH_STATE_STABLE 3
+#define BENCH_STATE_STOPPING 4
+#define BENCH_STATE_COUNT 5
+
+
+/***********************************************************
+ * Sample history channels (SampleHistory)
+ ***/
+#define HISTORY_FLOW_CFM 0
+#define HISTORY_FLOW_SCFM 1
+#define HISTORY_FLOW_ADJ 2
+#define HISTORY_FLOW_ADJ_SCFM 3
+#define HISTORY_FLOW_KGH 4
+#define HISTORY_PREF_H2O 5
+#define HISTORY_PDIFF_H2O 6
+#define HISTORY_PITOT_KPA 7
+#define HISTORY_CHANNEL_COUNT 8
+
+
+/***********************************************************
+ * Modbus status register bits
+ ***/
+#define MODBUS_STATUS_BENCH_ON 0
+#define MODBUS_STATUS_AP_MODE 1
+#define MODBUS_STATUS_BOOT_LOOP 2
+#define MODBUS_STATUS_RECORDING 3
+
+
+/***********************************************************
+ * OTA image encoding
+ ***/
+#define OTA_RAW 0
+#define OTA_GZIP 1
+#define OTA_ZLIB 2
+
+
+/***********************************************************
+ * Lift profile port
+ ***/
+#define LIFT_PORT_INTAKE 0
+#define LIFT_PORT_EXHAUST 1
+
+
+/***********************************************************
+ * Blob store
+ ***/
+#define BLOB_STORE_CONFIG 0
+#define BLOB_STORE_SETTINGS 1
+#define BLOB_STORE_CALIBRATION 2
+#define BLOB_STORE_PINS 3
+#define BLOB_STORE_COUNT 4
+
+
+/***********************************************************
+ * Persistence records (0 - 3 match the blob store ids)
+ ***/
+#define PERSIST_CONFIG 0
+#define PERSIST_SETTINGS 1
+#define PERSIST_CALIBRATION 2
+#define PERSIST_PINS 3
+#define PERSIST_LIFT_RUN 4                // + run number
+#define PERSIST_RECORD_COUNT (PERSIST_LIFT_RUN + LIFT_PROFILE_MAX_RUNS)
+
+
+/***********************************************************
+ * Session recorder state
+ ***/
+#define RECORDER_IDLE 0
+#define RECORDER_RUNNING 1
+#define RECORDER_STOPPING 2
+
+
+/***********************************************************
+ * Time series tiers
+ ***/
+#define TIMESERIES_RAW 0
+#define TIMESERIES_1S 1
+#define TIMESERIES_10S 2
+#define TIMESERIES_1M 3
+#define TIMESERIES_TIER_COUNT 4
+
+
 /***********************************************************
  * International Standards
  ***/
@@ -27,9 +27,7 @@
 #include <rom/rtc.h>
 #include <FS.h>
 #include <SPI.h>
-#include <SD.h>
 #include <Update.h>
-#include <SPIFFS.h>
 #include <Preferences.h>
 
 #include <ArduinoJson.h>
@@ -44,6 +42,8 @@
 #include "structs.h"
 #include "constants.h"
 #include "hardware.h"
+#include "benchstate.h"
+#include "logger.h"
 #include "messages.h"
 #include "calculations.h"
 #include "comms.h"
@@ -51,6 +51,12 @@
 #include "calibration.h"
 #include "API.h"
 #include "mafdata.h"
+#include "blobstore.h"
+#include "persistence.h"
+#include "storage.h"
+#include "jsonstream.h"
+#include "maftable.h"
+#include "sdcard.h"
 
 
 void DataHandler::begin() {
@@ -81,13 +87,10 @@ void DataHandler::begin() {
     _message.serialPrintf("https://github.com/DeeEmm/DIY-Flow-Bench/wiki\n");                                         
 
     // Load configuration / settings / calibration / liftdata / pins data from NVM
-    this->initialiseConfig();
-    this->loadConfig();
+    uint32_t nvmLoadStartTime = micros();
 
-    this->initialiseSettings();
+    this->loadConfig();
     this->loadSettings();
-    
-    _hardware.initialisePins();
     _hardware.loadPinsData();
 
     int pinError = _hardware.setPinMode();
@@ -102,28 +105,26 @@ void DataHandler::begin() {
     this->initialiseLiftData();
     this->loadLiftData();
     
-    _calibration.initialiseCalibrationData();
     _calibration.loadCalibrationData();
 
-    // Initialise SPIFFS Filesystem
+    status.nvmLoadTime = micros() - nvmLoadStartTime;
+    _message.serialPrintf("NVM load time: %u us \n", status.nvmLoadTime);
+
+    // Initialise Filesystem (LittleFS, migrates SPIFFS on first boot)
     _message.serialPrintf("Initialising File System \n"); 
-    if (SPIFFS.begin()) {
-    } else {
-        _message.serialPrintf("...Failed\n");
-        #if defined FORMAT_FILESYSTEM_IF_FAILED
-            SPIFFS.format();
-            _message.serialPrintf("!! File System Formatted !!\n");
-            _message.serialPrintf("!! DIYFB Restarting !!\n");            
-            delay(2000);
-            ESP.restart();
-        #endif
-    }
+    Storage::begin();
+
+    // Load user MAF data table if present (overrides polynomial coefficients)
+    this->loadMAFData();
 
     // _hardware.save_ADC_Reg(); // ADC WiFi kludge
 
     // Initialise WiFi
     _comms.initaliseWifi();
 
+    // Start serial API command task (also serves the boot loop)
+    API::begin();
+
     // BootLoop method traps program pointer within loop until files are uploaded
     if (status.doBootLoop == true) bootLoop();
 
@@ -132,70 +133,15 @@ void DataHandler::begin() {
     Wire.begin (pins.SDA, pins.SCL); 
     Wire.setClock(100000);
 
-    // TODO Initialise SD card
-    if (config.bSD_ENABLED) {
-
-    // test code from https://github.com/espressif/arduino-esp32/blob/master/libraries/SD/examples/SD_Test/SD_Test.ino
-
-    // _message.serialPrintf("=== SDCARD File system info === \n");
-
-    // int sck = SD_SCK;
-    // int miso = SD_MISO;
-    // int mosi = SD_MOSI;
-    // int cs = SD_CS;
-
-    // SPIClass spi = SPIClass(VSPI);
-
-    //     SPI.begin(sck, miso, mosi, cs);
-    //     if (!SD.begin(cs, spi, 2000000U)) {
-    //     Serial.println("Card Mount Failed");
-
-    //     } else {
-
-    //     uint8_t cardType = SD.cardType();
-
-    //     if (cardType == CARD_NONE) {
-    //         Serial.println("No SD card attached");
-    //     }
-
-    //     Serial.print("SD Card Type: ");
-    //     if (cardType == CARD_MMC) {
-    //         Serial.println("MMC");
-    //     } else if (cardType == CARD_SD) {
-    //         Serial.println("SDSC");
-    //     } else if (cardType == CARD_SDHC) {
-    //         Serial.println("SDHC");
-    //     } else {
-    //         Serial.println("UNKNOWN");
-    //     }
-
-    //     uint64_t cardSize = SD.cardSize() / (1024 * 1024);
-    //     Serial.printf("SD Card Size: %lluMB\n", cardSize);
-
-    //     listDir(SD, "/", 0);
-    //     createDir(SD, "/mydir");
-    //     listDir(SD, "/", 0);
-    //     removeDir(SD, "/mydir");
-    //     listDir(SD, "/", 2);
-    //     writeFile(SD, "/hello.txt", "Hello ");
-    //     appendFile(SD, "/hello.txt", "World!\n");
-    //     readFile(SD, "/hello.txt");
-    //     deleteFile(SD, "/foo.txt");
-    //     renameFile(SD, "/hello.txt", "/foo.txt");
-    //     readFile(SD, "/foo.txt");
-    //     testFileIO(SD, "/test.txt");
-    //     Serial.printf("Total space: %lluMB\n", SD.totalBytes() / (1024 * 1024));
-    //     Serial.printf("Used space: %lluMB\n", SD.usedBytes() / (1024 * 1024));
-    //     }
-
-    }
+    // Initialise SD card (session recorder uses it in place of the data partition when mounted)
+    if (config.bSD_ENABLED) SDCard::begin();
 
     
     // Display Filesystem Stats
-    status.spiffs_mem_size = SPIFFS.totalBytes();
-    status.spiffs_mem_used = SPIFFS.usedBytes();
+    status.spiffs_mem_size = Storage::totalBytes();
+    status.spiffs_mem_used = Storage::usedBytes();
 
-    _message.serialPrintf("=== SPIFFS File system info === \n");
+    _message.serialPrintf("=== %s File system info === \n", Storage::type());
     _message.serialPrintf("Total space:      %s \n", _calculations.byteDecode(status.spiffs_mem_size));
     _message.serialPrintf("Total space used: %s \n", _calculations.byteDecode(status.spiffs_mem_used));
 
@@ -247,9 +193,10 @@ void DataHandler::writeJSONFile(String data, String filename, int dataSize){
   DeserializationError error = deserializeJson(jsonData, data);
   if (!error)  {
     _message.debugPrintf("Writing JSON file... \n");
-    File outputFile = SPIFFS.open(filename, FILE_WRITE);
+    File outputFile = Storage::fs().open(filename, FILE_WRITE);
     serializeJsonPretty(jsonData, outputFile);
     outputFile.close();
+    Storage::indexFile(filename.c_str());
   }  else  {
     _message.statusPrintf("Webserver::writeJSONFile ERROR \n");
   }
@@ -260,42 +207,59 @@ void DataHandler::writeJSONFile(String data, String filename, int dataSize){
 
 
 
+/***********************************************************
+ * @brief loadMAFData
+ * @details Load the user MAF data table (MAF_DATA_FILE) if one has been uploaded
+ * @note Sensors::getMafFlow() uses the table in place of the polynomial coefficients while it is loaded
+ ***/
+void DataHandler::loadMAFData() {
+
+  extern struct DeviceStatus status;
+
+  if (Storage::exists(MAF_DATA_FILE) && MafTable::load(MAF_DATA_FILE) > 0) {
+    status.mafLoaded = true;
+    status.mafFilename = MAF_DATA_FILE;
+    status.mafDataTableRows = MafTable::rows();
+    status.mafDataKeyMax = MafTable::maxMilliVolts();
+    status.mafDataValMax = MafTable::getFlow(status.mafDataKeyMax);
+    strlcpy(status.mafUnits, "KG_H", sizeof(status.mafUnits));
+  } else {
+    MafTable::clear();
+    status.mafLoaded = false;
+    status.mafDataTableRows = 0;
+    status.mafDataKeyMax = 0;
+    status.mafDataValMax = 0;
+  }
+
+}
+
+
+
+
+
+
 /***********************************************************
  * @brief loadJSONFile
  * @details Loads JSON data from file
+ * @param filter optional ArduinoJson filter document - only the keys it names are kept
+ * @note Files larger than JSON_FILE_SIZE need a filter. Use JsonStream::forEach() for tables
  ***/
-JsonDocument DataHandler::loadJSONFile(String filename) {
+JsonDocument DataHandler::loadJSONFile(String filename, JsonDocument *filter) {
 
   Messages _message;
 
-//   extern struct Language language;
-
-  // Allocate the memory pool on the stack.
-  // Use arduinojson.org/assistant to compute the capacity.
   JsonDocument jsonData;
 
-  if (SPIFFS.exists(filename))  {
-    File jsonFile = SPIFFS.open(filename, FILE_READ);
-
-    if (!jsonFile)    {
-    //   _message.Handler(language.LANG_ERROR_LOADING_FILE);
-      _message.statusPrintf("Failed to open file for reading \n");
-    }    else    {
-      size_t size = jsonFile.size();
-      if (size > JSON_FILE_SIZE)    {
-          _message.statusPrintf("File too large \n");
-      }
+  if (Storage::exists(filename.c_str()))  {
 
-      DeserializationError error = deserializeJson(jsonData, jsonFile);
-      if (error)      {
-        _message.statusPrintf("loadJSONFile->deserializeJson() failed: %s \n", error.f_str());
-      }
-
-      jsonFile.close();
-      return jsonData;
+    DeserializationError error = JsonStream::load(filename.c_str(), jsonData, filter);
 
+    if (error == DeserializationError::NoMemory && filter == NULL)  {
+      _message.statusPrintf("File too large \n");
+    } else if (error)  {
+      _message.statusPrintf("loadJSONFile->deserializeJson() failed: %s \n", error.f_str());
     }
-    jsonFile.close();
+
   }  else  {
     _message.statusPrintf("File missing \n");
   }
@@ -325,7 +289,11 @@ void DataHandler::beginSerial(void) {
 	// 	Serial.begin(SERIAL0_BAUD, SERIAL_8N1 , pins.SERIAL0_RX, pins.SERIAL0_TX); 
 	// #endif
 	
+    Serial.setRxBufferSize(API_SERIAL_RX_BUFFER);
     Serial.begin(SERIAL0_BAUD);
+
+    // Messages are queued from here on and written by the log drain task
+    Logger::begin();
     _message.serialPrintf("Serial started \n"); 
 
 }
@@ -334,163 +302,102 @@ void DataHandler::beginSerial(void) {
 
 
 /***********************************************************
-* @brief initaliseConfiguration
-* @details initialise configiration settings in NVM
+* @brief loadConfiguration
+* @details read configuration from ESP32 NVM and loads into global struct
 * @note Replaces pre-compile macros in original config.h file
-* @note Preferences Key can not exceed 15 chars long
-* @note Datatype prefix allows for reduced save method
-* @note b = bool, i = int, d = double, s = string
+* @note Stored as a single blob - see blobstore.cpp for the key / field map
 ***/ 
-void DataHandler::initialiseConfig () {
+void DataHandler::loadConfig () {
 
-  extern struct Configuration config;
+  extern struct DeviceStatus status; 
 
   Messages _message;
-  Preferences _prefs;
-
-  _prefs.begin("config");
 
-  // Check if last key exists in NVM
-  if (_prefs.isKey("bSWIRL_ENBLD")) {
-    // key already exists
-    _prefs.end();
-    return;
-  }
+  _message.serialPrintf("Loading Configuration \n");    
+  
+  BlobStore::load(BLOB_STORE_CONFIG);
 
-  _message.serialPrintf("Initialising Configuration \n");    
+  status.nvmConfig = BlobStore::freeEntries();
+  _message.debugPrintf("Config NVM Free Entries: %u \n", status.nvmConfig); 
 
-  // _prefs.clear(); // completely remove namepace
-  // _prefs.remove("iADC_I2C_ADDR"); // remove individual key
+}
 
-  if (!_prefs.isKey("bSD_ENABLED")) _prefs.putBool("bSD_ENABLED", false);
-  if (!_prefs.isKey("iMIN_PRESS_PCT")) _prefs.putInt("iMIN_PRESS_PCT", 80);
-  if (!_prefs.isKey("dPIPE_RAD_FT")) _prefs.putDouble("dPIPE_RAD_FT", 0.328084);
 
-  if (!_prefs.isKey("dVCC_3V3_TRIM")) _prefs.putDouble("dVCC_3V3_TRIM", 0.0);
-  if (!_prefs.isKey("dVCC_5V_TRIM")) _prefs.putDouble("dVCC_5V_TRIM", 0.0);
 
-  if (!_prefs.isKey("bFIXED_3_3V")) _prefs.putBool("bFIXED_3_3V", true);
-  if (!_prefs.isKey("bFIXED_5V")) _prefs.putBool("bFIXED_5V", true);
 
-  if (!_prefs.isKey("bBME_TYPE")) _prefs.putBool("bBME_TYPE", true);
-  if (!_prefs.isKey("iBME_ADDR")) _prefs.putInt("iBME_ADDR", 118);
-  if (!_prefs.isKey("iBME_SCN_MS")) _prefs.putInt("iBME_SCN_MS", 1000);
 
-  if (!_prefs.isKey("iADC_TYPE")) _prefs.putInt("iADC_TYPE", ADS1115);
-  if (!_prefs.isKey("iADC_I2C_ADDR")) _prefs.putInt("iADC_I2C_ADDR", 72);
 
-  if (!_prefs.isKey("iMAF_SENS_TYP")) _prefs.putInt("iMAF_SENS_TYP", SENSOR_DISABLED);
-  if (!_prefs.isKey("iMAF_SRC_TYP")) _prefs.putInt("iMAF_SRC_TYP", ADS_ADC);
-  if (!_prefs.isKey("dMAF_MV_TRIM")) _prefs.putDouble("dMAF_MV_TRIM", 0.0);
 
-  if (!_prefs.isKey("iPREF_SENS_TYP")) _prefs.putInt("iPREF_SENS_TYP", MPXV7007);
-  if (!_prefs.isKey("iPREF_SRC_TYP")) _prefs.putInt("iPREF_SRC_TYP", ADS_ADC);
-  if (!_prefs.isKey("dPREF_MV_TRIM")) _prefs.putDouble("dPREF_MV_TRIM", 0.0);
 
-  if (!_prefs.isKey("iPDIFF_SENS_TYP")) _prefs.putInt("iPDIFF_SENS_TYP", MPXV7007);
-  if (!_prefs.isKey("iPDIFF_SRC_TYP")) _prefs.putInt("iPDIFF_SRC_TYP", ADS_ADC);
-  if (!_prefs.isKey("dPDIFF_MV_TRIM")) _prefs.putDouble("dPDIFF_MV_TRIM", 0.0);
 
-  if (!_prefs.isKey("iPITOT_SENS_TYP")) _prefs.putInt("iPITOT_SENS_TYP", MPXV7007);
-  if (!_prefs.isKey("iPITOT_SRC_TYP")) _prefs.putInt("iPITOT_SRC_TYP", ADS_ADC);
-  if (!_prefs.isKey("dPITOT_MV_TRIM")) _prefs.putDouble("dPITOT_MV_TRIM", 0.0);
 
-  if (!_prefs.isKey("iBARO_SENS_TYP")) _prefs.putInt("iBARO_SENS_TYP", BOSCH_BME280);
-  if (!_prefs.isKey("dBARO_MV_TRIM")) _prefs.putDouble("dBARO_MV_TRIM", 0.0);
-  if (!_prefs.isKey("dBARO_FINE_TUNE")) _prefs.putDouble("dBARO_FINE_TUNE", 0.0);
-  if (!_prefs.isKey("dSEALEVEL_PRESS")) _prefs.putDouble("dSEALEVEL_PRESS", 0.0);
-  if (!_prefs.isKey("iBARO_ADC_CHAN")) _prefs.putInt("iBARO_ADC_CHAN", 4);
+/***********************************************************
+* @brief loadSettings
+* @details read settings from NVM and loads into global struct
+* @note Stored as a single blob - see blobstore.cpp for the key / field map
+***/ 
+void DataHandler::loadSettings () {
 
-  if (!_prefs.isKey("iTEMP_SENS_TYP")) _prefs.putInt("iTEMP_SENS_TYP", BOSCH_BME280);
-  if (!_prefs.isKey("dTEMP_MV_TRIM")) _prefs.putDouble("dTEMP_MV_TRIM", 0.0);
-  if (!_prefs.isKey("dTEMP_FINE_TUNE")) _prefs.putDouble("dTEMP_FINE_TUNE", 0.0);
+  extern struct DeviceStatus status;
 
-  if (!_prefs.isKey("iRELH_SENS_TYP")) _prefs.putInt("iRELH_SENS_TYP", BOSCH_BME280);
-  if (!_prefs.isKey("dRELH_MV_TRIM")) _prefs.putDouble("dRELH_MV_TRIM", 0.0);
-  if (!_prefs.isKey("dRELH_FINE_TUNE")) _prefs.putDouble("dRELH_FINE_TUNE", 0.0);
-  if (!_prefs.isKey("bSWIRL_ENBLD")) _prefs.putBool("bSWIRL_ENBLD", false);
+  Messages _message;
 
-  // Add additional / new keys to bottom of list and update the key check
+  _message.serialPrintf("Loading Settings \n");    
+  
+  BlobStore::load(BLOB_STORE_SETTINGS);
 
-  _prefs.end();
+  status.nvmSettings = BlobStore::freeEntries();
+  _message.debugPrintf("Settings NVM Free Entries: %u \n", status.nvmSettings); 
 
 }
 
 
 
 
+
+
 /***********************************************************
-* @brief loadConfiguration
-* @details read settings from ESP32 NVM and loads into global struct
-* @note Replaces pre-compile macros in original config.h file
-* @note Preferences Kay can not exceed 15 chars long
-* @note Datatype prefix allows for reduced save method
-* @note b = bool, i = int, d = double, s = string
+* @brief initialiseLiftData
+* @details Migrate the original 12 point lift data (LIFTDATA1..12) into the run 1 blob
+* @note Old keys are removed once the blob has been written
 ***/ 
-void DataHandler::loadConfig () {
-
-  extern struct Configuration config;
-  extern struct DeviceStatus status; 
+void DataHandler::initialiseLiftData () {
 
   Messages _message;
   Preferences _prefs;
 
-  _message.serialPrintf("Loading Configuration \n");    
+  _message.serialPrintf("Initialising Lift Data \n");    
   
-  _prefs.begin("config");
-
-  config.bSD_ENABLED = _prefs.getBool("bSD_ENABLED", false);
-  config.iMIN_PRESS_PCT = _prefs.getInt("iMIN_PRESS_PCT", 80);
-  config.dPIPE_RAD_FT = _prefs.getDouble("dPIPE_RAD_FT", 0.328084);
-
-  config.dVCC_3V3_TRIM = _prefs.getDouble("dVCC_3V3_TRIM", 0.0);
-  config.dVCC_5V_TRIM = _prefs.getDouble("dVCC_5V_TRIM", 0.0);
-
-  config.bFIXED_3_3V = _prefs.getBool("bFIXED_3_3V", true);
-  config.bFIXED_5V = _prefs.getBool("bFIXED_5V", true);
-
-  config.iBME_TYP = _prefs.getInt("bBME_TYPE", BOSCH_BME280);
-  config.iBME_ADDR = _prefs.getInt("iBME_ADDR", 118);
-
-  config.iADC_TYPE = _prefs.getInt("iADC_TYPE", ADS1115);
-  config.iADC_I2C_ADDR = _prefs.getInt("iADC_I2C_ADDR", 72);
-
-  config.iMAF_SENS_TYP = _prefs.getInt("iMAF_SENS_TYP", SENSOR_DISABLED);
-  config.iMAF_SRC_TYP = _prefs.getInt("iMAF_SRC_TYP", ADS_ADC);
-  config.dMAF_MV_TRIM = _prefs.getDouble("dMAF_MV_TRIM", 0.0);
+  _prefs.begin("liftData");
 
-  config.iPREF_SENS_TYP = _prefs.getInt("iPREF_SENS_TYP", MPXV7007);
-  config.iPREF_SRC_TYP = _prefs.getInt("iPREF_SRC_TYP", ADS_ADC);
-  config.dPREF_MV_TRIM = _prefs.getDouble("dPREF_MV_TRIM", 0.0);
+  if (!_prefs.isKey("RUN0") && _prefs.isKey("LIFTDATA1")) {
 
-  config.iPDIFF_SENS_TYP = _prefs.getInt("iPDIFF_SENS_TYP", MPXV7007);
-  config.iPDIFF_SRC_TYP = _prefs.getInt("iPDIFF_SRC_TYP", ADS_ADC);
-  config.dPDIFF_MV_TRIM = _prefs.getDouble("dPDIFF_MV_TRIM", 0.0);
- 
-  config.iPITOT_SENS_TYP = _prefs.getInt("iPITOT_SENS_TYP", MPXV7007);
-  config.iPITOT_SRC_TYP = _prefs.getInt("iPITOT_SRC_TYP", ADS_ADC);
-  config.dPITOT_MV_TRIM = _prefs.getDouble("dPITOT_MV_TRIM", 0.0);
+    _message.serialPrintf("Migrating Lift Data \n");    
 
-  config.iBARO_SENS_TYP = _prefs.getInt("iBARO_SENS_TYP", BOSCH_BME280);
-  config.dBARO_MV_TRIM = _prefs.getDouble("dBARO_MV_TRIM", 1.0);
-  config.dBARO_FINE_TUNE = _prefs.getDouble("dBARO_FINE_TUNE", 1.0);
-  config.dSEALEVEL_PRESS = _prefs.getDouble("dSEALEVEL_PRESS", 1016.90);
-  config.iBARO_ADC_CHAN = _prefs.getInt("iBARO_ADC_CHAN", 4);
+    LiftProfile profile;
+    uint8_t blob[LIFT_PROFILE_BLOB_SIZE];
+    char key[16];
 
-  config.iTEMP_SENS_TYP = _prefs.getInt("iTEMP_SENS_TYP", BOSCH_BME280);
-  config.dTEMP_MV_TRIM = _prefs.getDouble("dTEMP_MV_TRIM", 0.0);
-  config.dTEMP_FINE_TUNE = _prefs.getDouble("dTEMP_FINE_TUNE", 0.0);
+    strlcpy(profile.name, "Run 1", sizeof(profile.name));
+    profile.pointCount = 12;
 
-  config.iRELH_SENS_TYP = _prefs.getInt("iRELH_SENS_TYP", BOSCH_BME280);
-  config.dRELH_MV_TRIM = _prefs.getDouble("dRELH_MV_TRIM", 0.0);
-  config.dRELH_FINE_TUNE = _prefs.getDouble("dRELH_FINE_TUNE", 0.0);
-  config.bSWIRL_ENBLD = _prefs.getBool("bSWIRL_ENBLD", false);
+    for (int point = 0; point < 12; point++) {
+      snprintf(key, sizeof(key), "LIFTDATA%d", point + 1);
+      profile.flow[point] = _prefs.getDouble(key, 0.0);
+    }
 
-  status.nvmConfig = _prefs.freeEntries();
-  _message.debugPrintf("Config NVM Free Entries: %u \n", status.nvmConfig); 
+    size_t blobLength = serialiseLiftProfile(profile, blob, sizeof(blob));
 
+    if (blobLength > 0 && _prefs.putBytes("RUN0", blob, blobLength) == blobLength) {
+      for (int point = 0; point < 12; point++) {
+        snprintf(key, sizeof(key), "LIFTDATA%d", point + 1);
+        _prefs.remove(key);
+      }
+    }
+  }
 
   _prefs.end();
+
 }
 
 
@@ -498,79 +405,75 @@ void DataHandler::loadConfig () {
 
 
 
+/***********************************************************
+* @brief loadLiftData
+* @details Read each stored run blob into valveData
+* @note Runs without a (valid) blob get default values
+***/ 
+void DataHandler::loadLiftData () {
 
+  extern struct ValveLiftData valveData;
 
+  Messages _message;
+  Preferences _prefs;
 
+  uint8_t blob[LIFT_PROFILE_BLOB_SIZE];
+  char key[8];
 
-/***********************************************************
-* @brief initialiseSettings
-* @note Initialise settings in NVM if they do not exist
-* @note Key must be 15 chars or shorter.
-* @note Datatype prefix allows for reduced save method
-* @note b = bool, i = int, d = double, s = string***/ 
-void DataHandler::initialiseSettings () {
+  _message.serialPrintf("Loading Lift Data \n");     
 
-  extern struct BenchSettings settings;
+  _prefs.begin("liftData", true);
 
-  DataHandler _data;
-  Messages _message;
-  Preferences _prefs;
+  for (int run = 0; run < LIFT_PROFILE_MAX_RUNS; run++) {
 
-  _message.serialPrintf("Initialising Bench Settings \n");    
-  
-  _prefs.begin("settings");
+    snprintf(key, sizeof(key), "RUN%d", run);
+    size_t blobLength = _prefs.getBytes(key, blob, sizeof(blob));
 
-    // Check if last key exists in NVM
-  if (_prefs.isKey("dORIFICE6_PRESS")) {
-    // key already exists
-    _prefs.end();
-    return;
+    if (blobLength == 0 || !deserialiseLiftProfile(blob, blobLength, valveData.run[run])) {
+      valveData.run[run] = LiftProfile();
+      snprintf(valveData.run[run].name, LIFT_PROFILE_NAME_LENGTH, "Run %d", run + 1);
+    }
   }
 
-  // _prefs.remove("iDATA_FLTR_TYP"); // remove individual key
-  // _prefs.remove("iTEMP_UNIT"); // remove individual key
+  valveData.activeRun = _prefs.getUChar("ACTIVE_RUN", 0);
+  if (valveData.activeRun >= LIFT_PROFILE_MAX_RUNS) valveData.activeRun = 0;
 
-  if (!_prefs.isKey("sWIFI_SSID")) _prefs.putString("sWIFI_SSID", "WIFI-SSID");
-  if (!_prefs.isKey("sWIFI_PSWD")) _prefs.putString("sWIFI_PSWD", static_cast<String>("PASSWORD"));
-  if (!_prefs.isKey("sWIFI_AP_SSID")) _prefs.putString("sWIFI_AP_SSID", static_cast<String>("DIYFB"));
-  if (!_prefs.isKey("sWIFI_AP_PSWD")) _prefs.putString("sWIFI_AP_PSWD", static_cast<String>("123456789"));
-  if (!_prefs.isKey("sHOSTNAME")) _prefs.putString("sHOSTNAME", static_cast<String>("diyfb"));
+  _prefs.end();
 
-  if (!_prefs.isKey("iWIFI_TIMEOUT")) _prefs.putInt("iWIFI_TIMEOUT", 4000);
-  if (!_prefs.isKey("iMAF_DIAMETER")) _prefs.putInt("iMAF_DIAMETER", 0);
-  if (!_prefs.isKey("iREFRESH_RATE")) _prefs.putInt("iREFRESH_RATE", 500);
-  if (!_prefs.isKey("iMIN_PRESSURE")) _prefs.putDouble("iMIN_PRESSURE", 1);
-  if (!_prefs.isKey("iMIN_FLOW_RATE")) _prefs.putInt("iMIN_FLOW_RATE", 1);
+}
 
-  if (!_prefs.isKey("iDATA_FLTR_TYP")) _prefs.putInt("iDATA_FLTR_TYP", NONE);
-  if (!_prefs.isKey("iROUNDING_TYP")) _prefs.putInt("iROUNDING_TYP", NONE);
 
-  if (!_prefs.isKey("iFLOW_DECI_ACC")) _prefs.putInt("iFLOW_DECI_ACC", 1);
-  if (!_prefs.isKey("iGEN_DECI_ACC")) _prefs.putInt("iGEN_DECI_ACC", 2);
-  if (!_prefs.isKey("iCYC_AV_BUFF")) _prefs.putInt("iCYC_AV_BUFF", 5);
 
-  if (!_prefs.isKey("sAPI_DELIM")) _prefs.putString("sAPI_DELIM", ":");
-  if (!_prefs.isKey("iSHOW_ALARMS")) _prefs.putInt("iSHOW_ALARMS", true);
-  if (!_prefs.isKey("iADJ_FLOW_DEP")) _prefs.putInt("iADJ_FLOW_DEP", 28);
-  if (!_prefs.isKey("iSTD_REF")) _prefs.putInt("iSTD_REF", 1);
-  if (!_prefs.isKey("iSTD_ADJ_FLOW")) _prefs.putInt("iSTD_ADJ_FLOW", 1);
-  if (!_prefs.isKey("iDATACAP_STD")) _prefs.putInt("iDATACAP_STD", 1);
-  if (!_prefs.isKey("iDATAGRAPH_MAX")) _prefs.putInt("iDATAGRAPH_MAX", 0);
-  if (!_prefs.isKey("iTEMP_UNIT")) _prefs.putInt("iTEMP_UNIT", CELCIUS);
 
-  if (!_prefs.isKey("dLIFT_INTERVAL")) _prefs.putDouble("dLIFT_INTERVAL", 1.5F);
-  if (!_prefs.isKey("iBENCH_TYPE")) _prefs.putInt("iBENCH_TYPE", MAF_BENCH);
 
-  // Add additional / new keys to bottom of list and update the key check
 
-  _prefs.end();
+/***********************************************************
+* @brief saveLiftProfile
+* @details Write a single run as one blob (one NVS write per capture)
+***/ 
+void DataHandler::saveLiftProfile (int run) {
 
-}
+  extern struct ValveLiftData valveData;
 
+  Messages _message;
+  Preferences _prefs;
 
+  uint8_t blob[LIFT_PROFILE_BLOB_SIZE];
+  char key[8];
 
+  if (run < 0 || run >= LIFT_PROFILE_MAX_RUNS) return;
 
+  size_t blobLength = serialiseLiftProfile(valveData.run[run], blob, sizeof(blob));
+  snprintf(key, sizeof(key), "RUN%d", run);
 
+  _prefs.begin("liftData");
+  if (blobLength == 0 || _prefs.putBytes(key, blob, blobLength) != blobLength) {
+    _message.debugPrintf("Lift profile save failed: %s \n", key);
+  }
+  if (_prefs.getUChar("ACTIVE_RUN", 0) != valveData.activeRun) _prefs.putUChar("ACTIVE_RUN", valveData.activeRun);
+  _prefs.end();
+
+}
 
 
 
@@ -578,54 +481,18 @@ void DataHandler::initialiseSettings () {
 
 
 /***********************************************************
-* @brief loadSettings
-* @details read settings from NVM and loads into global struct
-* @note Datatype prefix allows for reduced save method
-* @note b = bool, i = int, d = double, s = string
+* @brief clearLiftProfile
+* @details Zero the flow values of a run (or all runs if run < 0) and queue them to be written
 ***/ 
-void DataHandler::loadSettings () {
+void DataHandler::clearLiftProfile (int run) {
 
-  extern struct BenchSettings settings; 
-  extern struct DeviceStatus status;
-
-  // DataHandler _data;
-  Messages _message;
-  Preferences _prefs;
-
-  _message.serialPrintf("Loading Settings \n");    
-  
-  _prefs.begin("settings");
-
-  settings.wifi_ssid = _prefs.getString("sWIFI_SSID");
-  settings.wifi_pswd = _prefs.getString("sWIFI_PSWD");
-  settings.wifi_ap_ssid = _prefs.getString("sWIFI_AP_SSID");
-  settings.wifi_ap_pswd =_prefs.getString("sWIFI_AP_PSWD");
-  settings.hostname = _prefs.getString("sHOSTNAME", "diyfb" );
-  settings.wifi_timeout = _prefs.getInt("iWIFI_TIMEOUT", 4000 );
-  settings.maf_housing_diameter = _prefs.getInt("iMAF_DIAMETER", 0 );
-  settings.refresh_rate = _prefs.getInt("iREFRESH_RATE", 500 );
-  settings.min_bench_pressure  = _prefs.getDouble("iMIN_PRESSURE", 1 );
-  settings.min_flow_rate = _prefs.getInt("iMIN_FLOW_RATE", 1 );
-  settings.data_filter_type = _prefs.getInt("iDATA_FLTR_TYP", NONE );
-  settings.rounding_type = _prefs.getInt("iROUNDING_TYP", NONE );
-  settings.flow_decimal_length = _prefs.getInt("iFLOW_DECI_ACC", 1 );
-  settings.gen_decimal_length = _prefs.getInt("iGEN_DECI_ACC", 2 );
-  settings.cyc_av_buffer  = _prefs.getInt("iCYC_AV_BUFF", 5 );
-  settings.show_alarms = _prefs.getInt("iSHOW_ALARMS",  true  );
-  settings.adj_flow_depression = _prefs.getInt("iADJ_FLOW_DEP",  28  );
-  settings.standardReference = _prefs.getInt("iSTD_REF", 1  );
-  settings.std_adj_flow = _prefs.getInt("iSTD_ADJ_FLOW",  1 );
-  settings.dataGraphMax = _prefs.getInt("iDATAGRAPH_MAX", 0 );
-  settings.data_capture_datatype = _prefs.getInt("iDATACAP_STD", 0 );
-  settings.temp_unit = _prefs.getInt("iTEMP_UNIT", CELCIUS );
-  settings.valveLiftInterval = _prefs.getDouble("dLIFT_INTERVAL", 1.5F  );
-  settings.bench_type = _prefs.getInt("iBENCH_TYPE", MAF_BENCH );
-
-
-  status.nvmSettings = _prefs.freeEntries();
-  _message.debugPrintf("Settings NVM Free Entries: %u \n", status.nvmSettings); 
+  extern struct ValveLiftData valveData;
 
-  _prefs.end();
+  for (int i = 0; i < LIFT_PROFILE_MAX_RUNS; i++) {
+    if (run >= 0 && i != run) continue;
+    memset(valveData.run[i].flow, 0, sizeof(valveData.run[i].flow));
+    Persistence::request(PERSIST_LIFT_RUN + i);
+  }
 
 }
 
@@ -635,33 +502,26 @@ void DataHandler::loadSettings () {
 
 
 /***********************************************************
-* @brief initialiseLiftData
-* @note - Initialise settings in NVM if they do not exist
-* @note Key must be 15 chars or shorter.
+* @brief serialiseLiftProfile
+* @details Pack a run into its blob
+* @note Layout: version, port, pointCount, reserved, name[LIFT_PROFILE_NAME_LENGTH], float flow[pointCount]
+* @returns blob length or 0 if the buffer is too small
 ***/ 
-void DataHandler::initialiseLiftData () {
+size_t DataHandler::serialiseLiftProfile (const LiftProfile &profile, uint8_t *buffer, size_t length) {
 
-  Messages _message;
-  Preferences _prefs;
+  uint8_t pointCount = min(profile.pointCount, (uint8_t)LIFT_PROFILE_MAX_POINTS);
+  size_t blobLength = LIFT_PROFILE_BLOB_HEADER + pointCount * sizeof(float);
 
-  _message.serialPrintf("Initialising Lift Data \n");    
-  
-  _prefs.begin("liftData");
+  if (length < blobLength) return 0;
 
-  if (!_prefs.isKey("LIFTDATA1")) _prefs.putDouble("LIFTDATA1", 0.0);
-  if (!_prefs.isKey("LIFTDATA2")) _prefs.putDouble("LIFTDATA2", 0.0);
-  if (!_prefs.isKey("LIFTDATA3")) _prefs.putDouble("LIFTDATA3", 0.0);
-  if (!_prefs.isKey("LIFTDATA4")) _prefs.putDouble("LIFTDATA4", 0.0);
-  if (!_prefs.isKey("LIFTDATA5")) _prefs.putDouble("LIFTDATA5", 0.0);
-  if (!_prefs.isKey("LIFTDATA6")) _prefs.putDouble("LIFTDATA6", 0.0);
-  if (!_prefs.isKey("LIFTDATA7")) _prefs.putDouble("LIFTDATA7", 0.0);
-  if (!_prefs.isKey("LIFTDATA8")) _prefs.putDouble("LIFTDATA8", 0.0);
-  if (!_prefs.isKey("LIFTDATA9")) _prefs.putDouble("LIFTDATA9", 0.0);
-  if (!_prefs.isKey("LIFTDATA10")) _prefs.putDouble("LIFTDATA10", 0.0);
-  if (!_prefs.isKey("LIFTDATA11")) _prefs.putDouble("LIFTDATA11", 0.0);
-  if (!_prefs.isKey("LIFTDATA12")) _prefs.putDouble("LIFTDATA12", 0.0);
+  buffer[0] = LIFT_PROFILE_BLOB_VERSION;
+  buffer[1] = profile.port;
+  buffer[2] = pointCount;
+  buffer[3] = 0;
+  memcpy(buffer + 4, profile.name, LIFT_PROFILE_NAME_LENGTH);
+  memcpy(buffer + LIFT_PROFILE_BLOB_HEADER, profile.flow, pointCount * sizeof(float));
 
-  _prefs.end();
+  return blobLength;
 
 }
 
@@ -671,35 +531,27 @@ void DataHandler::initialiseLiftData () {
 
 
 /***********************************************************
-* @brief loadLiftDataFile
-* @details read lift data from liftdata.json file
+* @brief deserialiseLiftProfile
+* @details Unpack a run blob
+* @returns false if the blob version or length is not valid
 ***/ 
-void DataHandler::loadLiftData () {
+bool DataHandler::deserialiseLiftProfile (const uint8_t *buffer, size_t length, LiftProfile &profile) {
 
-  extern struct ValveLiftData valveData;
+  if (length < LIFT_PROFILE_BLOB_HEADER || buffer[0] != LIFT_PROFILE_BLOB_VERSION) return false;
 
-  DataHandler _data;
-  Messages _message;
-  Preferences _prefs;
-
-  _message.serialPrintf("Loading Lift Data \n");     
+  uint8_t pointCount = buffer[2];
 
-  _prefs.begin("liftData");
+  if (pointCount == 0 || pointCount > LIFT_PROFILE_MAX_POINTS) return false;
+  if (length != LIFT_PROFILE_BLOB_HEADER + pointCount * sizeof(float)) return false;
 
-  valveData.LiftData1 = _prefs.getDouble("LIFTDATA1", 0.0);
-  valveData.LiftData2 = _prefs.getDouble("LIFTDATA2", 0.0);
-  valveData.LiftData3 = _prefs.getDouble("LIFTDATA3", 0.0);
-  valveData.LiftData4 = _prefs.getDouble("LIFTDATA4", 0.0);
-  valveData.LiftData5 = _prefs.getDouble("LIFTDATA5", 0.0);
-  valveData.LiftData6 = _prefs.getDouble("LIFTDATA6", 0.0);
-  valveData.LiftData7 = _prefs.getDouble("LIFTDATA7", 0.0);
-  valveData.LiftData8 = _prefs.getDouble("LIFTDATA8", 0.0);
-  valveData.LiftData9 = _prefs.getDouble("LIFTDATA9", 0.0);
-  valveData.LiftData10 = _prefs.getDouble("LIFTDATA10", 0.0);
-  valveData.LiftData11 = _prefs.getDouble("LIFTDATA11", 0.0);
-  valveData.LiftData12 = _prefs.getDouble("LIFTDATA12", 0.0);
+  profile = LiftProfile();
+  profile.port = buffer[1];
+  profile.pointCount = pointCount;
+  memcpy(profile.name, buffer + 4, LIFT_PROFILE_NAME_LENGTH);
+  profile.name[LIFT_PROFILE_NAME_LENGTH - 1] = 0;
+  memcpy(profile.flow, buffer + LIFT_PROFILE_BLOB_HEADER, pointCount * sizeof(float));
 
-  _prefs.end();
+  return true;
 
 }
 
@@ -719,14 +571,14 @@ void DataHandler::loadLiftData () {
 
 /***********************************************************
  * @brief getFileListJSON
- * @details Get SPIFFS File List in JSON format
+ * @details Get File List in JSON format
+ * @note Served from the in-RAM file index
  ***/
 String DataHandler::getFileListJSON()
 {
 
   String jsonString;
-  String fileName;
-  size_t fileSize;
+  StorageIndexEntry entry;
 
   JsonDocument dataJson;
 
@@ -734,17 +586,10 @@ String DataHandler::getFileListJSON()
   Calculations _calculations;
 
   _message.statusPrintf("Filesystem contents: \n");
-  FILESYSTEM.begin();
-  File root = FILESYSTEM.open("/");
-  File file = root.openNextFile();
-  while (file)  {
-    fileName = file.name();
-    fileSize = file.size();
-    dataJson[fileName] = String(fileSize);
-    _message.statusPrintf("%s : %s \n", fileName, _calculations.byteDecode(fileSize));
-    file = root.openNextFile();
+  for (int i = 0; Storage::getEntry(i, entry); i++) {
+    dataJson[entry.path + 1] = String(entry.size);
+    _message.statusPrintf("%s : %s \n", entry.path + 1, _calculations.byteDecode(entry.size).c_str());
   }
-  // FILESYSTEM.end();
 
   serializeJson(dataJson, jsonString);
   return jsonString;
@@ -926,12 +771,6 @@ String DataHandler::buildIndexSSEJsonData()
   // sensorVal.FDiffType = 2;
 
 
-  if (1!=1) {  // TODO if message handler is active display the active message
-    dataJson["STATUS_MESSAGE"] = status.statusMessage;
-  } else { // else lets just show the uptime
-    dataJson["STATUS_MESSAGE"] = "Uptime: " + String(_hardware.uptime()) + " (hh.mm)";      
-  }
-
   // Active Orifice
   dataJson["ACTIVE_ORIFICE"] = status.activeOrifice;
   // Orifice Max Flow
@@ -955,6 +794,72 @@ String DataHandler::buildIndexSSEJsonData()
 
 
 
+/***********************************************************
+ * @brief buildStatusSSEJsonData
+ * @details Package up status pane data into JSON string to send via SSE
+ ***/
+String DataHandler::buildStatusSSEJsonData() {
+
+  extern struct DeviceStatus status;
+
+  Hardware _hardware;
+
+  String jsonString;
+
+  JsonDocument dataJson;
+
+  if (1!=1) {  // TODO if message handler is active display the active message
+    dataJson["STATUS_MESSAGE"] = status.statusMessage;
+  } else { // else lets just show the uptime
+    dataJson["STATUS_MESSAGE"] = "Uptime: " + String(_hardware.uptime()) + " (hh.mm)";      
+  }
+
+  dataJson["BENCH_STATE"] = BenchState::stateName(BenchState::state());
+
+  serializeJson(dataJson, jsonString);
+
+  return jsonString;
+}
+
+
+
+
+
+
+
+
+/***********************************************************
+ * @brief buildAlarmSSEJsonData
+ * @details Package up active alarm into JSON string to send via SSE
+ * @note An empty ALARM value clears the alarm in the browser
+ ***/
+String DataHandler::buildAlarmSSEJsonData() {
+
+  extern struct DeviceStatus status;
+  extern struct BenchSettings settings;
+
+  String jsonString;
+
+  JsonDocument dataJson;
+
+  if (settings.show_alarms) {
+    dataJson["ALARM"] = status.alarmMessage;
+  } else {
+    dataJson["ALARM"] = "";
+  }
+
+  serializeJson(dataJson, jsonString);
+
+  return jsonString;
+}
+
+
+
+
+
+
+
+
 /***********************************************************
  * @brief buildMimicSSEJsonData
  * @details Package up mimic page data into JSON string to send via SSE
@@ -1131,7 +1036,6 @@ void DataHandler::bootLoop()
     Calculations _calculations;
     Messages _message;
     Webserver _webserver;
-    API _api;
     DataHandler _data;
 
     bool shouldReboot = false;
@@ -1204,15 +1108,7 @@ void DataHandler::bootLoop()
     do {
     // capture program pointer in loop and wait for files to be uploaded and errors to be cleared
 
-        // Process API comms
-        if (settings.api_enabled) {        
-            if (millis() > status.apiPollTimer) {
-                if (Serial.available() > 0) {
-                    status.serialData = Serial.read();
-                    _api.ParseMessage(status.serialData);
-                }
-            }                            
-        }
+        // NOTE: API comms are handled by the serial command task (started before the boot loop)
 
         if (status.ioError) {
           if (_hardware.setPinMode() == -1) {
@@ -23,8 +23,9 @@
 #include <ArduinoJson.h>
 // #include <AsyncTCP.h>
 #include <ESPAsyncWebServer.h>
-#include <SPIFFS.h>
+#include "storage.h"
 #include "constants.h"
+#include "structs.h"
 
 class DataHandler {
 
@@ -62,19 +63,23 @@ class DataHandler {
 		void writeJSONFile(String data, String filename, int dataSize);
 		void createLiftDataFile();
 		void createCalibrationFile ();
-		JsonDocument loadJSONFile(String filename); 
+		JsonDocument loadJSONFile(String filename, JsonDocument *filter = NULL);
 		void beginSerial(void);
 		void loadMAFData();
 		void loadMAFCoefficients();
-		void initialiseConfig();
 		void loadConfig();
-		void initialiseSettings ();
 		void initialiseLiftData ();
 		void loadSettings ();
 		void loadLiftData ();
+		void saveLiftProfile (int run);
+		void clearLiftProfile (int run);
+		size_t serialiseLiftProfile (const LiftProfile &profile, uint8_t *buffer, size_t length);
+		bool deserialiseLiftProfile (const uint8_t *buffer, size_t length, LiftProfile &profile);
 		static void clearLiftDataFile(AsyncWebServerRequest *request);
 		String buildIndexSSEJsonData();
 		String buildMimicSSEJsonData();
+		String buildStatusSSEJsonData();
+		String buildAlarmSSEJsonData();
 		static void fileUpload(AsyncWebServerRequest *request, String filename, size_t index, uint8_t *data, size_t len, bool final);
 		void bootLoop();
 		String getRemote(const char* serverName);
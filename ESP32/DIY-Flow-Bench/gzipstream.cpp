@@ -0,0 +1,371 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file gzipstream.cpp
+ *
+ * @brief GzipStream class - streaming gzip (RFC 1952 / RFC 1951 fixed Huffman) encoder
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * The whole stream is one fixed Huffman block followed by an empty final block. Matches never extend
+ * past the end of the data given to a write() call, so each call is fully encoded when it returns.
+ *
+ ***/
+#include "Arduino.h"
+#include <esp32/rom/crc.h>
+
+#include "system.h"
+
+#include "gzipstream.h"
+
+
+#define GZIP_HASH_SIZE (1 << GZIP_HASH_BITS)
+#define GZIP_MIN_MATCH 3
+#define GZIP_MAX_MATCH 258
+
+static const uint16_t lengthBase[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t lengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16_t distanceBase[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const uint8_t distanceExtra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+
+static inline uint32_t hashBytes(const uint8_t *data) {
+
+  uint32_t key = (data[0] << 16) | (data[1] << 8) | data[2];
+
+  return (uint32_t)(key * 2654435761UL) >> (32 - GZIP_HASH_BITS);
+
+}
+
+
+
+
+/***********************************************************
+ * @brief Class destructor
+ ***/
+GzipStream::~GzipStream() {
+
+  end();
+
+}
+
+
+
+
+/***********************************************************
+ * @brief begin
+ * @details Allocate the history window and hash table
+ * @returns false if out of memory
+ ***/
+bool GzipStream::begin() {
+
+  end();
+
+  window = (uint8_t *)malloc(GZIP_WINDOW_SIZE * 2);
+  head = (int16_t *)malloc(GZIP_HASH_SIZE * sizeof(int16_t));
+  chain = (int16_t *)malloc(GZIP_WINDOW_SIZE * 2 * sizeof(int16_t));
+
+  if (window == NULL || head == NULL || chain == NULL) {
+    end();
+    return false;
+  }
+
+  for (int i = 0; i < GZIP_HASH_SIZE; i++) head[i] = -1;
+  windowEnd = 0;
+  crc = 0;
+  inputSize = 0;
+  bitBuffer = 0;
+  bitCount = 0;
+
+  return true;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief end
+ * @details Release the encoder buffers
+ ***/
+void GzipStream::end() {
+
+  free(window);
+  free(head);
+  free(chain);
+  window = NULL;
+  head = NULL;
+  chain = NULL;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief putBits
+ * @details Append bits LSB first, emitting whole bytes to the output
+ ***/
+void GzipStream::putBits(uint32_t value, int count) {
+
+  bitBuffer |= value << bitCount;
+  bitCount += count;
+
+  while (bitCount >= 8) {
+    *cursor++ = bitBuffer & 0xFF;
+    bitBuffer >>= 8;
+    bitCount -= 8;
+  }
+
+}
+
+
+
+
+/***********************************************************
+ * @brief putCode
+ * @details Huffman codes are packed MSB first so are bit reversed before writing
+ ***/
+void GzipStream::putCode(uint32_t code, int length) {
+
+  uint32_t reversed = 0;
+
+  for (int i = 0; i < length; i++) {
+    reversed = (reversed << 1) | (code & 1);
+    code >>= 1;
+  }
+
+  putBits(reversed, length);
+
+}
+
+
+
+
+/***********************************************************
+ * @brief putLiteral
+ * @details Fixed Huffman literal / length symbol (RFC 1951 3.2.6)
+ ***/
+void GzipStream::putLiteral(int symbol) {
+
+  if (symbol < 144) {
+    putCode(0x30 + symbol, 8);
+  } else if (symbol < 256) {
+    putCode(0x190 + symbol - 144, 9);
+  } else if (symbol < 280) {
+    putCode(symbol - 256, 7);
+  } else {
+    putCode(0xC0 + symbol - 280, 8);
+  }
+
+}
+
+
+
+
+/***********************************************************
+ * @brief putMatch
+ * @details Length symbol and extra bits, then fixed 5 bit distance code and extra bits
+ ***/
+void GzipStream::putMatch(int length, int distance) {
+
+  int index = 28;
+  while (lengthBase[index] > length) index--;
+
+  putLiteral(257 + index);
+  if (lengthExtra[index] > 0) putBits(length - lengthBase[index], lengthExtra[index]);
+
+  index = 29;
+  while (distanceBase[index] > distance) index--;
+
+  putCode(index, 5);
+  if (distanceExtra[index] > 0) putBits(distance - distanceBase[index], distanceExtra[index]);
+
+}
+
+
+
+
+/***********************************************************
+ * @brief slideWindow
+ * @details Keep the most recent GZIP_WINDOW_SIZE bytes and rebase the hash table
+ ***/
+void GzipStream::slideWindow() {
+
+  size_t delta = windowEnd - GZIP_WINDOW_SIZE;
+
+  memmove(window, window + delta, GZIP_WINDOW_SIZE);
+  windowEnd = GZIP_WINDOW_SIZE;
+
+  for (int i = 0; i < GZIP_HASH_SIZE; i++) {
+    head[i] = (head[i] >= (int)delta) ? head[i] - delta : -1;
+  }
+
+  memmove(chain, chain + delta, GZIP_WINDOW_SIZE * sizeof(int16_t));
+  for (int i = 0; i < GZIP_WINDOW_SIZE; i++) {
+    chain[i] = (chain[i] >= (int)delta) ? chain[i] - delta : -1;
+  }
+
+}
+
+
+
+
+/***********************************************************
+ * @brief insertHash
+ * @details Add a position to the head of its hash chain
+ ***/
+void GzipStream::insertHash(size_t position) {
+
+  uint32_t hash = hashBytes(window + position);
+
+  chain[position] = head[hash];
+  head[hash] = position;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief findMatch
+ * @details Walk up to GZIP_MAX_PROBES earlier positions with the same hash for the longest match
+ * @returns match length (0 if none)
+ ***/
+int GzipStream::findMatch(size_t position, size_t last, int &distance) {
+
+  int bestLength = 0;
+  int limit = min(last - position, (size_t)GZIP_MAX_MATCH);
+  int candidate = head[hashBytes(window + position)];
+
+  for (int probe = 0; probe < GZIP_MAX_PROBES && candidate >= 0 && position - candidate <= GZIP_WINDOW_SIZE; probe++) {
+
+    if (window[candidate + bestLength] == window[position + bestLength]) {
+      int length = 0;
+      while (length < limit && window[candidate + length] == window[position + length]) length++;
+      if (length > bestLength) {
+        bestLength = length;
+        distance = position - candidate;
+        if (length == limit) break;
+      }
+    }
+
+    candidate = chain[candidate];
+  }
+
+  return bestLength;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief start
+ * @details Write the gzip header and open the fixed Huffman block
+ * @returns bytes written to output (at most GZIP_MAX_OUTPUT(0))
+ ***/
+size_t GzipStream::start(uint8_t *output) {
+
+  static const uint8_t header[10] = {0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 255};
+
+  memcpy(output, header, sizeof(header));
+  cursor = output + sizeof(header);
+
+  putBits(0, 1);    // BFINAL
+  putBits(1, 2);    // BTYPE fixed Huffman
+
+  return cursor - output;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief write
+ * @details Compress a block of data
+ * @returns bytes written to output (at most GZIP_MAX_OUTPUT(length))
+ ***/
+size_t GzipStream::write(const uint8_t *data, size_t length, uint8_t *output) {
+
+  cursor = output;
+
+  crc = crc32_le(crc, data, length);
+  inputSize += length;
+
+  while (length > 0) {
+
+    size_t piece = min(length, (size_t)GZIP_WINDOW_SIZE);
+
+    if (windowEnd + piece > GZIP_WINDOW_SIZE * 2) slideWindow();
+
+    memcpy(window + windowEnd, data, piece);
+
+    size_t position = windowEnd;
+    size_t last = windowEnd + piece;
+
+    while (position < last) {
+
+      int matchLength = 0;
+      int distance = 0;
+
+      if (last - position >= GZIP_MIN_MATCH) {
+        matchLength = findMatch(position, last, distance);
+        insertHash(position);
+      }
+
+      if (matchLength >= GZIP_MIN_MATCH) {
+        putMatch(matchLength, distance);
+        for (int i = 1; i < matchLength && position + i + GZIP_MIN_MATCH <= last; i++) {
+          insertHash(position + i);
+        }
+        position += matchLength;
+      } else {
+        putLiteral(window[position]);
+        position++;
+      }
+    }
+
+    windowEnd = last;
+    data += piece;
+    length -= piece;
+  }
+
+  return cursor - output;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief finish
+ * @details Close the block, add an empty final block and the gzip trailer
+ * @returns bytes written to output (at most GZIP_MAX_OUTPUT(0))
+ ***/
+size_t GzipStream::finish(uint8_t *output) {
+
+  cursor = output;
+
+  putLiteral(256);  // end of block
+  putBits(1, 1);    // BFINAL
+  putBits(1, 2);    // BTYPE fixed Huffman
+  putLiteral(256);
+
+  if (bitCount > 0) putBits(0, 8 - bitCount);
+
+  for (int i = 0; i < 4; i++) *cursor++ = (crc >> (8 * i)) & 0xFF;
+  for (int i = 0; i < 4; i++) *cursor++ = (inputSize >> (8 * i)) & 0xFF;
+
+  return cursor - output;
+
+}
@@ -0,0 +1,75 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file gzipstream.h
+ *
+ * @brief GzipStream class header file
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * Small streaming gzip encoder for HTTP responses. miniz (tdefl) needs 160-300KB of state which the
+ * ESP32 does not have to spare with WiFi running, so this uses hash chained LZ77 over a
+ * GZIP_WINDOW_SIZE history and the fixed deflate Huffman codes, in about 28KB. Generated CSV / JSON
+ * still compresses several fold.
+ *
+ * Usage:
+ *   gzip.begin();
+ *   length = gzip.start(output);                        // gzip header
+ *   length = gzip.write(data, dataLength, output);      // output must hold GZIP_MAX_OUTPUT(dataLength)
+ *   length = gzip.finish(output);                       // output must hold GZIP_MAX_OUTPUT(0)
+ *   gzip.end();
+ *
+ ***/
+#pragma once
+
+#include <Arduino.h>
+
+#include "system.h"
+
+#define GZIP_MAX_OUTPUT(length) ((length) + ((length) >> 3) + 16)
+
+
+class GzipStream {
+
+	private:
+
+		uint8_t *window = NULL;
+		int16_t *head = NULL;
+		int16_t *chain = NULL;
+		size_t windowEnd = 0;
+
+		uint32_t crc = 0;
+		uint32_t inputSize = 0;
+
+		uint32_t bitBuffer = 0;
+		int bitCount = 0;
+		uint8_t *cursor = NULL;
+
+		void putBits(uint32_t value, int count);
+		void putCode(uint32_t code, int length);
+		void putLiteral(int symbol);
+		void putMatch(int length, int distance);
+		void insertHash(size_t position);
+		int findMatch(size_t position, size_t last, int &distance);
+		void slideWindow();
+
+	public:
+
+		~GzipStream();
+
+		bool begin();
+		void end();
+
+		size_t start(uint8_t *output);
+		size_t write(const uint8_t *data, size_t length, uint8_t *output);
+		size_t finish(uint8_t *output);
+
+};
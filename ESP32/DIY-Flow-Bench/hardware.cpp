@@ -21,7 +21,6 @@
 
 #include <ArduinoJson.h>
 #include <Wire.h>
-#include "Preferences.h"
 
 #include "system.h"
 #include "constants.h"
@@ -32,6 +31,10 @@
 #include "sensors.h"
 #include "calculations.h"
 #include "messages.h"
+#include "metrics.h"
+#include "trace.h"
+#include "benchstate.h"
+#include "blobstore.h"
 #include "system.h"
 
 extern struct Configuration config;
@@ -137,87 +140,16 @@ void Hardware::begin () {
 /***********************************************************
 * @brief resetPins
 * @details reset pins settings in NVM
+* @note Pins struct defaults (all unassigned) are stored on the next load
 ***/ 
 void Hardware::resetPins () {
 
-  Messages _message;
-  Preferences _prefs;
-
-  _prefs.begin("pins");
-  _prefs.clear();
-  _prefs.end();
-
-  initialisePins();
-
-}
-
-
-
-
-
-
-
-/***********************************************************
-* @brief initalisePins
-* @details initialise pins settings in NVM
-* @note Preferences Key can not exceed 15 chars long
-* @note Default pins schema is for official WEMOS D1 R32 style board
-***/ 
-void Hardware::initialisePins () {
-
-  Messages _message;
-  Preferences _prefs;
-  Pins pins;
-
-  _prefs.begin("pins");
+  extern struct Pins pins;
 
-  if (_prefs.isKey("SERIAL2_TX")) { // we've already initialised _prefs
-    _prefs.end();
-    return;
-  }
+  BlobStore::erase(BLOB_STORE_PINS);
 
-  _message.serialPrintf("Initialising Pins \n");    
-
-  if (!_prefs.isKey("VCC_5V")) _prefs.putInt("VCC_5V", pins.VCC_5V);
-  if (!_prefs.isKey("VCC_3V3")) _prefs.putInt("VCC_3V3", pins.VCC_3V3);
-  if (!_prefs.isKey("SPEED_SENS")) _prefs.putInt("SPEED_SENS", pins.SPEED_SENS);
-  if (!_prefs.isKey("ORIFICE_BCD_1")) _prefs.putInt("ORIFICE_BCD_1", pins.ORIFICE_BCD_1);
-  if (!_prefs.isKey("ORIFICE_BCD_2")) _prefs.putInt("ORIFICE_BCD_2", pins.ORIFICE_BCD_2);
-  if (!_prefs.isKey("ORIFICE_BCD_3")) _prefs.putInt("ORIFICE_BCD_3", pins.ORIFICE_BCD_3);
-  if (!_prefs.isKey("MAF")) _prefs.putInt("MAF", pins.MAF);
-  if (!_prefs.isKey("PREF")) _prefs.putInt("PREF", pins.PREF);
-  if (!_prefs.isKey("PDIFF")) _prefs.putInt("PDIFF", pins.PDIFF);
-  if (!_prefs.isKey("PITOT")) _prefs.putInt("PITOT", pins.PITOT);
-  if (!_prefs.isKey("TEMPERATURE")) _prefs.putInt("TEMPERATURE", pins.TEMPERATURE);
-  if (!_prefs.isKey("HUMIDITY")) _prefs.putInt("HUMIDITY", pins.HUMIDITY);
-  if (!_prefs.isKey("REF_BARO")) _prefs.putInt("REF_BARO", pins.REF_BARO);
-  if (!_prefs.isKey("SWIRL_ENCODER_A")) _prefs.putInt("SWIRL_ENCODER_A", pins.SWIRL_ENCODER_A);
-  if (!_prefs.isKey("SWIRL_ENCODER_B")) _prefs.putInt("SWIRL_ENCODER_B", pins.SWIRL_ENCODER_B);
-  if (!_prefs.isKey("SERIAL0_RX")) _prefs.putInt("SERIAL0_RX", pins.SERIAL0_RX);
-  if (!_prefs.isKey("SERIAL2_RX")) _prefs.putInt("SERIAL2_RX", pins.SERIAL2_RX);
-  if (!_prefs.isKey("SDA")) _prefs.putInt("SDA", pins.SDA);
-  if (!_prefs.isKey("SCL")) _prefs.putInt("SCL", pins.SCL);
-  if (!_prefs.isKey("SD_CS")) _prefs.putInt("SD_CS", pins.SD_CS);
-  if (!_prefs.isKey("SD_MISO")) _prefs.putInt("SD_MISO", pins.SD_MISO);
-  if (!_prefs.isKey("SD_SCK")) _prefs.putInt("SD_SCK", pins.SD_SCK);
-  if (!_prefs.isKey("SPARE_PIN_1")) _prefs.putInt("SPARE_PIN_1", pins.SPARE_PIN_1);
-  if (!_prefs.isKey("SPARE_PIN_2")) _prefs.putInt("SPARE_PIN_2", pins.SPARE_PIN_2);
-
-  // Store output pin values in struct
-  if (!_prefs.isKey("VAC_SPEED")) _prefs.putInt("VAC_SPEED", pins.VAC_SPEED); 
-  if (!_prefs.isKey("VAC_BANK_1")) _prefs.putInt("VAC_BANK_1", pins.VAC_BANK_1);
-  if (!_prefs.isKey("VAC_BANK_2")) _prefs.putInt("VAC_BANK_2", pins.VAC_BANK_2);
-  if (!_prefs.isKey("VAC_BANK_3")) _prefs.putInt("VAC_BANK_3", pins.VAC_BANK_3);
-  if (!_prefs.isKey("VAC_BLEED_VALVE")) _prefs.putInt("VAC_BLEED_VALVE", pins.VAC_BLEED_VALVE);
-  if (!_prefs.isKey("AVO_STEP")) _prefs.putInt("AVO_STEP", pins.AVO_STEP);
-  if (!_prefs.isKey("AVO_DIR")) _prefs.putInt("AVO_DIR", pins.AVO_DIR);
-  if (!_prefs.isKey("FLOW_VALVE_STEP")) _prefs.putInt("FLOW_VALVE_STEP", pins.FLOW_VALVE_STEP);
-  if (!_prefs.isKey("FLOW_VALVE_DIR")) _prefs.putInt("FLOW_VALVE_DIR", pins.FLOW_VALVE_DIR);
-  if (!_prefs.isKey("SD_MOSI")) _prefs.putInt("SD_MOSI", pins.SD_MOSI);
-  if (!_prefs.isKey("SERIAL0_TX")) _prefs.putInt("SERIAL0_TX", pins.SERIAL0_TX);
-  if (!_prefs.isKey("SERIAL2_TX")) _prefs.putInt("SERIAL2_TX", pins.SERIAL2_TX);
-  
-  _prefs.end();
+  pins = Pins();
+  loadPinsData();
 
 }
 
@@ -234,65 +166,20 @@ void Hardware::initialisePins () {
 /***********************************************************
 * @name loadPinsData
 * @brief Read pins data from NVM
+* @note Stored as a single blob - see blobstore.cpp for the key / field map
 ***/
 void Hardware::loadPinsData () {
 
-  DataHandler _data;
   Messages _message;
-  Hardware _hardware;
-  Preferences _prefs;
 
   extern struct DeviceStatus status;
-  extern struct Pins pins;
 
   _message.serialPrintf("Loading Pins Data \n");     
 
-  _prefs.begin("pins");
-
-  // Load pin values into struct
-  pins.VCC_3V3 = _prefs.getInt("VCC_3V3");
-  pins.VCC_5V = _prefs.getInt("VCC_5V");
-  pins.SPEED_SENS = _prefs.getInt("SPEED_SENS");
-  pins.ORIFICE_BCD_1 = _prefs.getInt("ORIFICE_BCD_1");
-  pins.ORIFICE_BCD_2 = _prefs.getInt("ORIFICE_BCD_2");
-  pins.ORIFICE_BCD_3 = _prefs.getInt("ORIFICE_BCD_3");
-  pins.MAF = _prefs.getInt("MAF");
-  pins.PREF = _prefs.getInt("PREF");
-  pins.PDIFF = _prefs.getInt("PDIFF");
-  pins.PITOT = _prefs.getInt("PITOT");
-  pins.TEMPERATURE = _prefs.getInt("TEMPERATURE");
-  pins.HUMIDITY = _prefs.getInt("HUMIDITY");
-  pins.REF_BARO = _prefs.getInt("REF_BARO");
-  pins.SWIRL_ENCODER_A = _prefs.getInt("SWIRL_ENCODER_A");
-  pins.SWIRL_ENCODER_B = _prefs.getInt("SWIRL_ENCODER_B");
-  pins.SERIAL0_RX = _prefs.getInt("SERIAL0_RX");
-  pins.SERIAL2_RX = _prefs.getInt("SERIAL2_RX");
-  pins.SDA = _prefs.getInt("SDA");
-  pins.SCL = _prefs.getInt("SCL");
-  pins.SD_CS = _prefs.getInt("SD_CS");
-  pins.SD_MISO = _prefs.getInt("SD_MISO");
-  pins.SD_SCK = _prefs.getInt("SD_SCK");
-  pins.SPARE_PIN_1 = _prefs.getInt("SPARE_PIN_1");
-  pins.SPARE_PIN_2 = _prefs.getInt("SPARE_PIN_2");
-
-  // Store output pin values in struct
-  pins.VAC_SPEED = _prefs.getInt("VAC_SPEED");
-  pins.VAC_BANK_1 = _prefs.getInt("VAC_BANK_1");
-  pins.VAC_BANK_2 = _prefs.getInt("VAC_BANK_2");
-  pins.VAC_BANK_3 = _prefs.getInt("VAC_BANK_3");
-  pins.VAC_BLEED_VALVE = _prefs.getInt("VAC_BLEED_VALVE");
-  pins.AVO_STEP = _prefs.getInt("AVO_STEP");
-  pins.AVO_DIR = _prefs.getInt("AVO_DIR");
-  pins.FLOW_VALVE_STEP = _prefs.getInt("FLOW_VALVE_STEP");
-  pins.FLOW_VALVE_DIR = _prefs.getInt("FLOW_VALVE_DIR");
-  pins.SD_MOSI = _prefs.getInt("SD_MOSI");
-  pins.SERIAL0_TX = _prefs.getInt("SERIAL0_TX");
-  pins.SERIAL2_TX = _prefs.getInt("SERIAL2_TX");
-
-  status.nvmPins = _prefs.freeEntries();
-  _message.debugPrintf("Pins NVM Free Entries: %u \n", status.nvmPins); 
+  BlobStore::load(BLOB_STORE_PINS);
 
-  _prefs.end();
+  status.nvmPins = BlobStore::freeEntries();
+  _message.debugPrintf("Pins NVM Free Entries: %u \n", status.nvmPins); 
 
   status.pinsLoaded = true;
 
@@ -581,6 +468,7 @@ int32_t Hardware::getADCRawData(int channel) {
 
   // extern struct Configuration config;
   extern struct SensorData sensorVal;
+  extern Metrics _metrics;
 
   int32_t rawADCval = 0;
 
@@ -590,7 +478,11 @@ int32_t Hardware::getADCRawData(int channel) {
       return 0;
     }
 
+      TRACE_BEGIN(TRACE_I2C_READ);
+      uint32_t i2cStartTime = micros();
       rawADCval = ADS.readADC(channel);
+      _metrics.observeI2C(micros() - i2cStartTime);
+      TRACE_END(TRACE_I2C_READ);
 
   }
 
@@ -705,40 +597,12 @@ double Hardware::get3v3SupplyVolts() {
  * @brief BENCH IS RUNNING
  * @return bool:bench is running
  * @note used by calibration function in API.cpp
+ * @note State is evaluated once per acquisition cycle by BenchState::update(), this is just a read
  ***/
 bool Hardware::benchIsRunning() {
-    
-  Messages _message;
-  Calculations _calculations;
-  Sensors _sensors;
-  
-  extern struct BenchSettings settings;
-  extern struct Language language;
-  extern struct SensorData sensorVal;
-  extern struct Configuration config;
 
-  double refPressureH2O;
-  double mafFlowRateCFM; 
-  bool pressureTest = true;
- 
-  refPressureH2O = _calculations.convertPressure(sensorVal.PRefKPA, INH2O);
-  mafFlowRateCFM = sensorVal.FlowCFM;
-
-  // convert negative value into positive
-  refPressureH2O = fabs(refPressureH2O); 
-
-  // Check if min flow and pRef are acheived...
-  if ((config.iPREF_SENS_TYP > 1) && (mafFlowRateCFM > settings.min_flow_rate) && (mafFlowRateCFM > settings.min_flow_rate) )  {
-    // ...pRef is enabled so we check both pRef and flow
-	  _message.Handler(language.LANG_BENCH_RUNNING); // REVIEW do we need to inform user that bench is running via GUI??? 
-	  return true;
-  } else if (( config.iPREF_SENS_TYP < 1) && (mafFlowRateCFM > settings.min_flow_rate)) {
-    // ...pRef is disabled so we only check flow
-	  _message.Handler(language.LANG_BENCH_RUNNING); 
-	  return true;
-  } else {
-	  return false;
-  }
+  return BenchState::isRunning();
+
 }
 
 
@@ -757,17 +621,20 @@ void Hardware::checkRefPressure() {
   extern struct Language language;
   extern struct Configuration config;
   extern struct CalibrationData calVal;
+  extern struct DeviceStatus status;
 
   
-  double refPressure = _calculations.convertPressure(sensorVal.PRefKPA, INH2O);
+  Units::Quantity<Units::InchWater> refPressure = Units::Quantity<Units::KiloPascal>(sensorVal.PRefKPA).as<Units::InchWater>();
+  Units::Quantity<Units::InchWater> minPressure = Units::Quantity<Units::InchWater>(calVal.cal_ref_press) * (config.iMIN_PRESS_PCT / 100);
     
   // REVIEW  - Ref pressure check
   // Check that pressure does not fall below limit set by iMIN_PRESS_PCT when bench is running
   // note alarm commented out in alarm function as 'nag' can get quite annoying
   // Is this a redundant check? Maybe a different alert would be more appropriate
-  if ((refPressure < (calVal.cal_ref_press * (config.iMIN_PRESS_PCT / 100))) && (Hardware::benchIsRunning()))
+  if ((refPressure < minPressure) && (Hardware::benchIsRunning()))
   {
     _message.Handler(language.LANG_REF_PRESS_LOW);
+    status.alarmMessage = language.LANG_REF_PRESS_LOW;
   }
 }
 
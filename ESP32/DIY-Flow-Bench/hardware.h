@@ -40,7 +40,6 @@ class Hardware {
 		void getI2CList();
 		void getI2CDeviceList();
 		void loadPinsData ();
-		void initialisePins ();
 		int setPinMode ();
 		void resetPins ();
 		
@@ -0,0 +1,279 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file history.cpp
+ *
+ * @brief SampleHistory class - full rate sample ring with windowed statistics
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * Only the sensor task writes. Readers walk back from the newest sample, taking the spinlock for one
+ * entry at a time, and stop at the first sample older than the window or once the writer has lapped
+ * them.
+ *
+ ***/
+#include "Arduino.h"
+#include <ArduinoJson.h>
+
+#include "system.h"
+#include "constants.h"
+#include "structs.h"
+
+#include "history.h"
+#include "benchstate.h"
+
+
+#define HISTORY_FLAG_RUNNING 1
+
+struct HistorySample {
+  uint32_t timestamp;
+  uint8_t flags;
+  float value[HISTORY_CHANNEL_COUNT];
+};
+
+static_assert((HISTORY_SAMPLES & (HISTORY_SAMPLES - 1)) == 0, "HISTORY_SAMPLES must be a power of 2");
+
+static const char *historyChannelName[HISTORY_CHANNEL_COUNT] = {"FLOW_CFM", "FLOW_SCFM", "FLOW_ADJ", "FLOW_ADJ_SCFM", "FLOW_KGH", "PREF_H2O", "PDIFF_H2O", "PITOT_KPA"};
+
+static portMUX_TYPE historyMux = portMUX_INITIALIZER_UNLOCKED;
+static HistorySample historyRing[HISTORY_SAMPLES];
+static volatile uint32_t historyCount = 0;
+
+
+
+
+/***********************************************************
+ * @brief readValue
+ * @details Copy one channel of one sample
+ * @returns false if the sample has been overwritten
+ ***/
+static bool readValue(uint32_t sequence, int channel, uint32_t &timestamp, uint8_t &flags, float &value) {
+
+  bool found = false;
+
+  portENTER_CRITICAL(&historyMux);
+  if (sequence < historyCount && historyCount - sequence <= HISTORY_SAMPLES) {
+    const HistorySample &sample = historyRing[sequence & (HISTORY_SAMPLES - 1)];
+    timestamp = sample.timestamp;
+    flags = sample.flags;
+    value = sample.value[channel];
+    found = true;
+  }
+  portEXIT_CRITICAL(&historyMux);
+
+  return found;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief Class constructor
+ ***/
+SampleHistory::SampleHistory() {
+}
+
+
+
+
+/***********************************************************
+ * @brief push
+ * @details Copy the processed sensor values into the ring
+ * @note Called once per acquisition cycle from the sensor task, after BenchState::update()
+ ***/
+void SampleHistory::push(uint32_t timeMs) {
+
+  extern struct SensorData sensorVal;
+
+  HistorySample sample;
+
+  sample.timestamp = timeMs;
+  sample.flags = BenchState::isRunning() ? HISTORY_FLAG_RUNNING : 0;
+  sample.value[HISTORY_FLOW_CFM] = sensorVal.FlowCFM;
+  sample.value[HISTORY_FLOW_SCFM] = sensorVal.FlowSCFM;
+  sample.value[HISTORY_FLOW_ADJ] = sensorVal.FlowADJ;
+  sample.value[HISTORY_FLOW_ADJ_SCFM] = sensorVal.FlowADJSCFM;
+  sample.value[HISTORY_FLOW_KGH] = sensorVal.FlowKGH;
+  sample.value[HISTORY_PREF_H2O] = sensorVal.PRefH2O;
+  sample.value[HISTORY_PDIFF_H2O] = sensorVal.PDiffH2O;
+  sample.value[HISTORY_PITOT_KPA] = sensorVal.PitotKPA;
+
+  portENTER_CRITICAL(&historyMux);
+  historyRing[historyCount & (HISTORY_SAMPLES - 1)] = sample;
+  historyCount++;
+  portEXIT_CRITICAL(&historyMux);
+
+}
+
+
+
+
+/***********************************************************
+ * @brief window
+ * @details Mean / standard deviation of the samples with fromTime <= timestamp <= fromTime + windowMs
+ * @note ended is only set once a sample at or after the end of the window exists and the history
+ * reaches back past fromTime. complete also needs HISTORY_MIN_SAMPLES samples inside the window
+ ***/
+WindowStats SampleHistory::window(int channel, uint32_t fromTime, uint32_t windowMs) {
+
+  WindowStats stats;
+
+  if (channel < 0 || channel >= HISTORY_CHANNEL_COUNT) return stats;
+
+  uint32_t sequence = historyCount;
+  uint32_t firstTime = 0;
+  uint32_t lastTime = 0;
+  bool reachedEnd = false;
+  bool reachedStart = false;
+  double mean = 0.0;
+  double m2 = 0.0;
+
+  while (sequence > 0) {
+
+    uint32_t timestamp;
+    uint8_t flags;
+    float value;
+
+    sequence--;
+    if (!readValue(sequence, channel, timestamp, flags, value)) break;
+
+    int32_t offset = (int32_t)(timestamp - fromTime);
+
+    if (offset < 0) {
+      reachedStart = true;
+      break;
+    }
+
+    if ((uint32_t)offset >= windowMs) reachedEnd = true;
+    if ((uint32_t)offset > windowMs) continue;
+
+    // Welford running update
+    stats.count++;
+    double delta = value - mean;
+    mean += delta / stats.count;
+    m2 += delta * (value - mean);
+
+    if (stats.count == 1) lastTime = timestamp;
+    firstTime = timestamp;
+
+    if (!(flags & HISTORY_FLAG_RUNNING)) stats.benchStopped = true;
+
+  }
+
+  stats.mean = mean;
+  stats.stdDev = (stats.count > 1) ? sqrt(m2 / (stats.count - 1)) : 0.0;
+  stats.spanMs = lastTime - firstTime;
+  stats.ended = reachedStart && reachedEnd;
+  stats.complete = stats.ended && stats.count >= HISTORY_MIN_SAMPLES;
+
+  return stats;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief last
+ * @details Statistics for the windowMs milliseconds up to the newest sample
+ ***/
+WindowStats SampleHistory::last(int channel, uint32_t windowMs) {
+
+  uint32_t timestamp;
+  uint8_t flags;
+  float value;
+
+  uint32_t count = historyCount;
+
+  if (count == 0 || !readValue(count - 1, HISTORY_FLOW_CFM, timestamp, flags, value)) return WindowStats();
+
+  return window(channel, timestamp - windowMs, windowMs);
+
+}
+
+
+
+
+/***********************************************************
+ * @brief channel
+ * @returns HISTORY_xxx channel for a name (e.g. "FLOW_CFM") or -1
+ ***/
+int SampleHistory::channel(const char *name) {
+
+  for (int i = 0; i < HISTORY_CHANNEL_COUNT; i++) {
+    if (strcmp(name, historyChannelName[i]) == 0) return i;
+  }
+
+  return -1;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief captureChannel
+ * @returns History channel for a lift data capture datatype (settings.data_capture_datatype)
+ ***/
+int SampleHistory::captureChannel(int datatype) {
+
+  switch (datatype) {
+
+    case STD_ACFM:
+      return HISTORY_FLOW_SCFM;
+
+    case ADJ_ACFM:
+      return HISTORY_FLOW_ADJ;
+
+    case ADJ_STD_ACFM:
+      return HISTORY_FLOW_ADJ_SCFM;
+
+    case RAW_MASS:
+      return HISTORY_FLOW_KGH;
+
+    case ACFM:
+    default:
+      return HISTORY_FLOW_CFM;
+
+  }
+
+}
+
+
+
+
+/***********************************************************
+ * @brief getStatsJSON
+ * @details Window statistics for /api/history/stats
+ ***/
+String SampleHistory::getStatsJSON(const WindowStats &stats, int channel, uint32_t fromTime, uint32_t windowMs) {
+
+  String jsonString;
+  JsonDocument dataJson;
+
+  dataJson["CHANNEL"] = (channel >= 0 && channel < HISTORY_CHANNEL_COUNT) ? historyChannelName[channel] : "";
+  dataJson["FROM"] = fromTime;
+  dataJson["MS"] = windowMs;
+  dataJson["MEAN"] = stats.mean;
+  dataJson["SD"] = stats.stdDev;
+  dataJson["COUNT"] = stats.count;
+  dataJson["SPAN_MS"] = stats.spanMs;
+  dataJson["MIN_COUNT"] = HISTORY_MIN_SAMPLES;
+  dataJson["ENDED"] = stats.ended;
+  dataJson["COMPLETE"] = stats.complete;
+  dataJson["BENCH_STOPPED"] = stats.benchStopped;
+
+  serializeJson(dataJson, jsonString);
+
+  return jsonString;
+
+}
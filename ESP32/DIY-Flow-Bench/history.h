@@ -0,0 +1,69 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file history.h
+ *
+ * @brief SampleHistory class header file
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * Full rate history of the processed acquisition values (HISTORY_SAMPLES), so capture and calibration
+ * can average a window instead of taking one instantaneous reading.
+ *
+ *   last(channel, ms)           - statistics of the last ms milliseconds
+ *   window(channel, from, ms)   - statistics of from .. from + ms. Pass millis() as from for "the next ms
+ *                                 milliseconds" and query again once ended is set
+ *
+ * A window is only complete if it holds HISTORY_MIN_SAMPLES samples. At the ~2 Hz sensor rate a short
+ * window can end with one or two samples in it, which is no better than an instantaneous reading.
+ *
+ * Each sample also records whether the bench was running (BenchState::isRunning()) so a caller can
+ * reject a window the bench stopped in.
+ *
+ ***/
+#pragma once
+
+#include <Arduino.h>
+
+#include "system.h"
+#include "constants.h"
+
+
+/***********************************************************
+ * @brief Statistics for a window of one channel
+ ***/
+struct WindowStats {
+	float mean = 0.0f;
+	float stdDev = 0.0f;
+	uint32_t count = 0;
+	uint32_t spanMs = 0;          // first to last sample in the window
+	bool ended = false;           // history covers the whole window
+	bool complete = false;        // ended and holds at least HISTORY_MIN_SAMPLES samples
+	bool benchStopped = false;    // bench was not running for at least one sample
+};
+
+
+class SampleHistory {
+
+	public:
+
+		SampleHistory();
+
+		static void push(uint32_t timeMs);
+
+		static WindowStats last(int channel, uint32_t windowMs);
+		static WindowStats window(int channel, uint32_t fromTime, uint32_t windowMs);
+
+		static int channel(const char *name);
+		static int captureChannel(int datatype);
+		static String getStatsJSON(const WindowStats &stats, int channel, uint32_t fromTime, uint32_t windowMs);
+
+};
@@ -35,10 +35,13 @@ var closeCalibrationModalButton = document.getElementsByClassName("closeCalibrat
 
 var bSWIRL_ENBLD;
 var iPDIFF_SENS_TYP;
+var activeAlarm = '';
 
 // Set up Server Side Events (SSE)
 if (!!window.EventSource) {
-  var source = new EventSource('/events');
+  var source = new EventSource('/events/flow');
+  var statusSource = new EventSource('/events/status');
+  var alarmSource = new EventSource('/events/alarms');
 
   source.addEventListener('JSON_DATA', function(e) {
     var myObj = JSON.parse(e.data);
@@ -140,6 +143,28 @@ if (!!window.EventSource) {
   }, false);
 
 
+  // Status pane messages
+  statusSource.addEventListener('JSON_DATA', function(e) {
+    var myObj = JSON.parse(e.data);
+
+    // Active alarms take priority over status messages
+    if (updateSSE === true && activeAlarm === '') {
+      document.getElementById('STATUS_MESSAGE').innerHTML = myObj["STATUS_MESSAGE"];
+    }
+
+  }, false);
+
+
+  // Alarms (pushed only when the alarm state changes)
+  alarmSource.addEventListener('JSON_DATA', function(e) {
+    var myObj = JSON.parse(e.data);
+
+    activeAlarm = myObj["ALARM"];
+    if (activeAlarm !== '') {
+      document.getElementById('STATUS_MESSAGE').innerHTML = activeAlarm;
+    }
+
+  }, false);
 
 }
 
@@ -14,7 +14,7 @@ window.addEventListener('load', onLoad);
 
 // Set up Server Side Events (SSE)
 if (!!window.EventSource) {
-    var source = new EventSource('/events');
+    var source = new EventSource('/events/mimic');
   
     source.addEventListener('JSON_DATA', function(e) {
       var myObj = JSON.parse(e.data);
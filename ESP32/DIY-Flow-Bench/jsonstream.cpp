@@ -0,0 +1,370 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file jsonstream.cpp
+ *
+ * @brief JsonStream class - bounded memory JSON file parsing
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * forEach() does its own tokenising to find where each member value starts and ends, then hands just
+ * that text to deserializeJson(). Letting ArduinoJson read values straight off the stream does not
+ * work for bare numbers as the parser has to consume the following delimiter to find the end.
+ *
+ ***/
+#include "Arduino.h"
+#include <FS.h>
+#include <ArduinoJson.h>
+
+#include "system.h"
+#include "constants.h"
+#include "structs.h"
+
+#include "jsonstream.h"
+#include "storage.h"
+#include "messages.h"
+
+
+
+
+/***********************************************************
+ * @brief JsonFileReader::fill
+ * @details Refill the read buffer from the file
+ * @returns false at end of file
+ ***/
+bool JsonFileReader::fill() {
+
+  if (position < length) return true;
+
+  length = file.read(buffer, sizeof(buffer));
+  position = 0;
+
+  return length > 0;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief JsonFileReader::read / peek
+ * @returns next byte or -1 at end of file
+ ***/
+int JsonFileReader::read() {
+
+  if (!fill()) return -1;
+  return buffer[position++];
+
+}
+
+int JsonFileReader::peek() {
+
+  if (!fill()) return -1;
+  return buffer[position];
+
+}
+
+
+
+
+/***********************************************************
+ * @brief JsonFileReader::readBytes
+ ***/
+size_t JsonFileReader::readBytes(char *output, size_t count) {
+
+  size_t copied = 0;
+
+  while (copied < count && fill()) {
+    size_t chunk = min(count - copied, length - position);
+    memcpy(output + copied, buffer + position, chunk);
+    position += chunk;
+    copied += chunk;
+  }
+
+  return copied;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief skipWhitespace
+ * @returns next non whitespace character (not consumed) or -1 at end of file
+ ***/
+int JsonStream::skipWhitespace(JsonFileReader &reader) {
+
+  int c = reader.peek();
+
+  while (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+    reader.read();
+    c = reader.peek();
+  }
+
+  return c;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief readString
+ * @details Read a quoted string (member key). Escapes are reduced to the escaped character
+ * @returns false if malformed or longer than the output buffer
+ ***/
+bool JsonStream::readString(JsonFileReader &reader, char *output, size_t length) {
+
+  size_t count = 0;
+  bool fits = true;
+
+  if (skipWhitespace(reader) != '"') return false;
+  reader.read();
+
+  for (;;) {
+    int c = reader.read();
+    if (c < 0) return false;
+    if (c == '"') break;
+    if (c == '\\') {
+      c = reader.read();
+      if (c < 0) return false;
+    }
+    if (count < length - 1) {
+      output[count++] = c;
+    } else {
+      fits = false;
+    }
+  }
+
+  output[count] = '\0';
+
+  return fits;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief readValue
+ * @details Copy the text of the next value (scalar, string, object or array) into output
+ * @param output NULL to skip the value
+ * @returns length of the value or -1 if malformed / too long
+ ***/
+int JsonStream::readValue(JsonFileReader &reader, char *output, size_t length) {
+
+  size_t count = 0;
+  int depth = 0;
+  bool inString = false;
+  bool escaped = false;
+
+  if (skipWhitespace(reader) < 0) return -1;
+
+  for (;;) {
+
+    int c = reader.peek();
+    if (c < 0) break;
+
+    // Scalars end at the next delimiter, which is left for the caller
+    if (!inString && depth == 0 && count > 0 && (c == ',' || c == '}' || c == ']' || c == ' ' || c == '\t' || c == '\r' || c == '\n')) break;
+
+    reader.read();
+
+    if (output != NULL) {
+      if (count >= length - 1) return -1;
+      output[count] = c;
+    }
+    count++;
+
+    if (inString) {
+      if (escaped) {
+        escaped = false;
+      } else if (c == '\\') {
+        escaped = true;
+      } else if (c == '"') {
+        inString = false;
+      }
+    } else if (c == '"') {
+      inString = true;
+    } else if (c == '{' || c == '[') {
+      depth++;
+    } else if (c == '}' || c == ']') {
+      depth--;
+      if (depth < 0) return -1;
+    }
+
+    if (!inString && depth == 0 && (c == '}' || c == ']' || c == '"')) break;
+  }
+
+  if (inString || depth != 0 || count == 0) return -1;
+
+  if (output != NULL) output[count] = '\0';
+
+  return count;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief findMember
+ * @details Position the reader at the value of a top level member
+ ***/
+bool JsonStream::findMember(JsonFileReader &reader, const char *key) {
+
+  char memberKey[JSON_STREAM_KEY_LENGTH];
+
+  if (skipWhitespace(reader) != '{') return false;
+  reader.read();
+
+  if (skipWhitespace(reader) == '}') return false;
+
+  for (;;) {
+
+    bool fits = readString(reader, memberKey, sizeof(memberKey));
+
+    if (skipWhitespace(reader) != ':') return false;
+    reader.read();
+
+    if (fits && strcmp(memberKey, key) == 0) return true;
+
+    if (readValue(reader, NULL, 0) < 0) return false;
+
+    if (skipWhitespace(reader) != ',') return false;
+    reader.read();
+  }
+
+}
+
+
+
+
+/***********************************************************
+ * @brief load
+ * @details Parse a file into a document, optionally through a filter
+ * @note Without a filter files larger than JSON_FILE_SIZE are refused (NoMemory)
+ * @returns EmptyInput if the file cannot be opened
+ ***/
+DeserializationError JsonStream::load(const char *path, JsonDocument &doc, JsonDocument *filter) {
+
+  if (!Storage::exists(path)) return DeserializationError::EmptyInput;
+
+  File file = Storage::fs().open(path, FILE_READ);
+  if (!file) return DeserializationError::EmptyInput;
+
+  if (filter == NULL && file.size() > JSON_FILE_SIZE) {
+    file.close();
+    return DeserializationError::NoMemory;
+  }
+
+  JsonFileReader reader(file);
+  DeserializationError error;
+
+  if (filter != NULL) {
+    error = deserializeJson(doc, reader, DeserializationOption::Filter(*filter));
+  } else {
+    error = deserializeJson(doc, reader);
+  }
+
+  file.close();
+
+  return error;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief forEach
+ * @details Call back for each member of an object (or element of an array) without loading the file
+ * @param key top level member holding the object / array, or NULL to walk the root
+ * @param filter optional filter applied to each member value
+ * @returns number of members passed to the callback or -1 on error
+ ***/
+int JsonStream::forEach(const char *path, const char *key, JsonStreamCallback callback, void *context, JsonDocument *filter) {
+
+  Messages _message;
+
+  char memberKey[JSON_STREAM_KEY_LENGTH];
+  char value[JSON_STREAM_VALUE_LENGTH];
+  JsonDocument element;
+  int count = 0;
+  int result = -1;
+
+  if (!Storage::exists(path)) return -1;
+
+  File file = Storage::fs().open(path, FILE_READ);
+  if (!file) return -1;
+
+  JsonFileReader reader(file);
+
+  if (key != NULL && !findMember(reader, key)) {
+    _message.debugPrintf("JsonStream::forEach - %s not found in %s \n", key, path);
+    file.close();
+    return -1;
+  }
+
+  int open = skipWhitespace(reader);
+  bool isObject = (open == '{');
+  int close = isObject ? '}' : ']';
+
+  if (open == '{' || open == '[') {
+
+    reader.read();
+
+    if (skipWhitespace(reader) == close) {
+      result = 0;
+    }
+
+    while (result < 0) {
+
+      if (isObject) {
+        if (!readString(reader, memberKey, sizeof(memberKey))) break;
+        if (skipWhitespace(reader) != ':') break;
+        reader.read();
+      }
+
+      int length = readValue(reader, value, sizeof(value));
+      if (length < 0) break;
+
+      DeserializationError error;
+      if (filter != NULL) {
+        error = deserializeJson(element, value, length, DeserializationOption::Filter(*filter));
+      } else {
+        error = deserializeJson(element, value, length);
+      }
+      if (error) break;
+
+      count++;
+      if (!callback(isObject ? memberKey : NULL, element.as<JsonVariantConst>(), context)) {
+        result = count;
+        break;
+      }
+
+      int delimiter = skipWhitespace(reader);
+      reader.read();
+      if (delimiter == close) {
+        result = count;
+      } else if (delimiter != ',') {
+        break;
+      }
+    }
+  }
+
+  file.close();
+
+  if (result < 0) _message.debugPrintf("JsonStream::forEach - parse error in %s after %d members \n", path, count);
+
+  return result;
+
+}
@@ -0,0 +1,82 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file jsonstream.h
+ *
+ * @brief JsonStream class header file
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * Bounded memory JSON file reading. load() parses a whole file through a filter document so only the
+ * wanted keys are allocated. forEach() walks the members of an object (or elements of an array) one at
+ * a time and hands each to a callback, so memory use depends on the largest member, not the file.
+ *
+ ***/
+#pragma once
+
+#include <Arduino.h>
+#include <FS.h>
+#include <ArduinoJson.h>
+
+#include "system.h"
+
+
+/***********************************************************
+ * @brief JsonStream callback
+ * @param key member key, or NULL for array elements
+ * @param value parsed member value (only valid during the call)
+ * @returns false to stop iterating
+ ***/
+typedef bool (*JsonStreamCallback)(const char *key, JsonVariantConst value, void *context);
+
+
+/***********************************************************
+ * @brief Buffered file reader
+ * @details Implements the ArduinoJson custom reader interface (read / readBytes)
+ ***/
+class JsonFileReader {
+
+	private:
+
+		fs::File &file;
+		uint8_t buffer[JSON_STREAM_BUFFER_SIZE];
+		size_t length = 0;
+		size_t position = 0;
+
+		bool fill();
+
+	public:
+
+		JsonFileReader(fs::File &source) : file(source) {}
+
+		int read();
+		int peek();
+		size_t readBytes(char *output, size_t count);
+
+};
+
+
+class JsonStream {
+
+	private:
+
+		static int skipWhitespace(JsonFileReader &reader);
+		static bool readString(JsonFileReader &reader, char *output, size_t length);
+		static int readValue(JsonFileReader &reader, char *output, size_t length);
+		static bool skipValue(JsonFileReader &reader);
+		static bool findMember(JsonFileReader &reader, const char *key);
+
+	public:
+
+		static DeserializationError load(const char *path, JsonDocument &doc, JsonDocument *filter = NULL);
+		static int forEach(const char *path, const char *key, JsonStreamCallback callback, void *context = NULL, JsonDocument *filter = NULL);
+
+};
@@ -0,0 +1,653 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file logger.cpp
+ *
+ * @brief Logger class - deferred formatting log ring and UART drain task
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * Bounded multi producer / single consumer ring. Each slot carries a sequence number: a producer claims
+ * the slot whose sequence equals the head with a compare and swap on the head, fills it, then publishes
+ * it by storing sequence + 1. The drain task consumes in order and hands the slot back by storing
+ * sequence + LOG_RING_SIZE. Producers never wait on each other or on the UART.
+ *
+ ***/
+#include "Arduino.h"
+#include <atomic>
+#include <ArduinoJson.h>
+
+#include "system.h"
+#include "constants.h"
+
+#include "logger.h"
+
+
+#define LOG_ARGUMENT_BYTES (LOG_RECORD_SIZE - 16)
+
+// Argument classes (how a conversion is stored and replayed)
+#define LOG_ARG_NONE 0
+#define LOG_ARG_INT 1
+#define LOG_ARG_LONG 2
+#define LOG_ARG_LLONG 3
+#define LOG_ARG_SIZE 4
+#define LOG_ARG_DOUBLE 5
+#define LOG_ARG_POINTER 6
+#define LOG_ARG_STRING 7
+#define LOG_ARG_COUNT 8             // %n - argument consumed, nothing printed
+#define LOG_ARG_LDOUBLE 9           // %Lf etc. - long double
+
+
+/***********************************************************
+ * @brief Log record - LOG_RECORD_SIZE bytes
+ ***/
+struct LogRecord {
+  std::atomic<uint32_t> sequence;
+  uint32_t timestamp;             // millis()
+  const char *format;
+  uint8_t level;
+  uint8_t core;
+  uint8_t truncated;              // arguments did not fit
+  uint8_t length;                 // bytes used in data
+  uint8_t data[LOG_ARGUMENT_BYTES];
+};
+
+
+/***********************************************************
+ * @brief Parsed conversion specification
+ ***/
+struct LogSpec {
+  const char *start;              // '%'
+  const char *end;                // one past the conversion character
+  bool starWidth;
+  bool starPrecision;
+  int precision;                  // literal precision, -1 if none
+  uint8_t argument;               // LOG_ARG_xxx
+};
+
+
+/***********************************************************
+ * @brief Last lines drained, for the /events/log topic
+ ***/
+struct LogTailLine {
+  uint32_t sequence;
+  uint32_t timestamp;
+  uint8_t level;
+  uint8_t core;
+  char text[LOG_TAIL_LENGTH];
+};
+
+
+static_assert((LOG_RING_SIZE & (LOG_RING_SIZE - 1)) == 0, "LOG_RING_SIZE must be a power of 2");
+static_assert(LOG_ARGUMENT_BYTES > 0 && LOG_ARGUMENT_BYTES <= 255, "LOG_RECORD_SIZE out of range");
+
+static LogRecord logRing[LOG_RING_SIZE];
+static std::atomic<uint32_t> ringHead(0);     // next slot to claim (producers)
+static std::atomic<uint32_t> ringTail(0);     // next slot to drain (drain task)
+static std::atomic<uint32_t> ringWritten(0);  // records fully written to the UART
+static std::atomic<uint32_t> droppedCount(0);
+static volatile bool ringReady = false;
+static TaskHandle_t drainTask = NULL;
+
+static LogTailLine tailLine[LOG_TAIL_LINES];
+static uint32_t tailCount = 0;
+static SemaphoreHandle_t tailMutex = NULL;
+static SemaphoreHandle_t consoleMutex = NULL;   // one writer on the UART at a time
+
+
+
+
+/***********************************************************
+ * @brief parseSpec
+ * @details Parse the conversion specification starting at '%'
+ * @returns false at the end of the format string or on an unsupported conversion
+ ***/
+static bool parseSpec(const char *p, LogSpec &spec) {
+
+  spec.start = p++;
+  spec.starWidth = false;
+  spec.starPrecision = false;
+  spec.precision = -1;
+
+  while (*p == '-' || *p == '+' || *p == ' ' || *p == '#' || *p == '0') p++;
+
+  if (*p == '*') {
+    spec.starWidth = true;
+    p++;
+  } else {
+    while (isdigit(*p)) p++;
+  }
+
+  if (*p == '.') {
+    p++;
+    if (*p == '*') {
+      spec.starPrecision = true;
+      p++;
+    } else {
+      spec.precision = atoi(p);
+      while (isdigit(*p)) p++;
+    }
+  }
+
+  uint8_t integer = LOG_ARG_INT;
+  bool longDouble = false;
+
+  switch (*p) {
+    case 'h':
+      while (*p == 'h') p++;
+      break;
+    case 'l':
+      integer = (p[1] == 'l') ? LOG_ARG_LLONG : LOG_ARG_LONG;
+      p += (p[1] == 'l') ? 2 : 1;
+      break;
+    case 'j':
+      integer = LOG_ARG_LLONG;
+      p++;
+      break;
+    case 'z':
+    case 't':
+      integer = LOG_ARG_SIZE;
+      p++;
+      break;
+    case 'L':
+      longDouble = true;
+      p++;
+      break;
+  }
+
+  switch (*p) {
+    case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+      spec.argument = integer;
+      break;
+    case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+      spec.argument = longDouble ? LOG_ARG_LDOUBLE : LOG_ARG_DOUBLE;
+      break;
+    case 'p':
+      spec.argument = LOG_ARG_POINTER;
+      break;
+    case 's':
+      spec.argument = LOG_ARG_STRING;
+      break;
+    case 'n':
+      spec.argument = LOG_ARG_COUNT;
+      break;
+    case '%':
+      spec.argument = LOG_ARG_NONE;
+      break;
+    default:
+      return false;
+  }
+
+  spec.end = p + 1;
+
+  return true;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief Class constructor
+ ***/
+Logger::Logger() {
+}
+
+
+
+
+/***********************************************************
+ * @brief begin
+ * @details Prepare the ring and start the drain task
+ * @note Called once the UART is open. Messages before this are written directly
+ ***/
+void Logger::begin() {
+
+  if (drainTask != NULL) return;
+
+  for (uint32_t i = 0; i < LOG_RING_SIZE; i++) {
+    logRing[i].sequence.store(i, std::memory_order_relaxed);
+  }
+
+  tailMutex = xSemaphoreCreateMutex();
+  consoleMutex = xSemaphoreCreateMutex();
+
+  xTaskCreatePinnedToCore(TASKdrainLog, "LOG_DRAIN", LOG_TASK_MEM_STACK, NULL, 1, &drainTask, 1);
+
+  ringReady = (drainTask != NULL);
+
+  if (!ringReady) Serial.print("Log drain task failed to start \n");
+
+}
+
+
+
+
+/***********************************************************
+ * @brief capture
+ * @details Copy the arguments for a format string into a record
+ * @returns bytes used
+ * @note Strings are copied up to their precision (if any) and the end of the record
+ ***/
+size_t Logger::capture(const char *format, va_list args, uint8_t *data, size_t maxLen, bool &truncated) {
+
+  size_t length = 0;
+  LogSpec spec;
+
+  truncated = false;
+
+  #define LOG_CAPTURE(type) do { \
+      type value = va_arg(args, type); \
+      if (length + sizeof(value) > maxLen) { truncated = true; return length; } \
+      memcpy(data + length, &value, sizeof(value)); \
+      length += sizeof(value); \
+    } while (0)
+
+  for (const char *p = strchr(format, '%'); p != NULL; p = strchr(p, '%')) {
+
+    if (!parseSpec(p, spec)) {
+      truncated = (p[1] != 0);
+      return length;
+    }
+    p = spec.end;
+
+    if (spec.starWidth) LOG_CAPTURE(int);
+    int precision = spec.precision;
+    if (spec.starPrecision) {
+      precision = va_arg(args, int);
+      if (length + sizeof(precision) > maxLen) { truncated = true; return length; }
+      memcpy(data + length, &precision, sizeof(precision));
+      length += sizeof(precision);
+    }
+
+    switch (spec.argument) {
+
+      case LOG_ARG_INT: LOG_CAPTURE(int); break;
+      case LOG_ARG_LONG: LOG_CAPTURE(long); break;
+      case LOG_ARG_LLONG: LOG_CAPTURE(long long); break;
+      case LOG_ARG_SIZE: LOG_CAPTURE(size_t); break;
+      case LOG_ARG_DOUBLE: LOG_CAPTURE(double); break;
+      case LOG_ARG_LDOUBLE: LOG_CAPTURE(long double); break;
+      case LOG_ARG_POINTER: LOG_CAPTURE(void *); break;
+      case LOG_ARG_COUNT: va_arg(args, void *); break;
+
+      case LOG_ARG_STRING: {
+        const char *text = va_arg(args, const char *);
+        if (text == NULL) text = "(null)";
+        size_t textLength = (precision >= 0) ? strnlen(text, precision) : strlen(text);
+        if (length >= maxLen) { truncated = true; return length; }
+        if (length + textLength + 1 > maxLen) {
+          textLength = maxLen - length - 1;
+          truncated = true;
+        }
+        memcpy(data + length, text, textLength);
+        data[length + textLength] = 0;
+        length += textLength + 1;
+        if (truncated) return length;
+        break;
+      }
+    }
+  }
+
+  #undef LOG_CAPTURE
+
+  return length;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief render
+ * @details Format a record into a line, one conversion at a time
+ * @returns line length
+ ***/
+size_t Logger::render(const char *format, const uint8_t *data, size_t dataLen, bool truncated, char *line, size_t maxLen) {
+
+  size_t length = 0;
+  size_t used = 0;
+  const char *p = format;
+  LogSpec spec;
+  char conversion[32];
+
+  #define LOG_APPEND(...) do { \
+      int written = snprintf(line + length, maxLen - length, __VA_ARGS__); \
+      if (written > 0) length = min(length + written, maxLen - 1); \
+    } while (0)
+
+  #define LOG_REPLAY(type) do { \
+      type value; \
+      if (used + sizeof(value) > dataLen) goto incomplete; \
+      memcpy(&value, data + used, sizeof(value)); \
+      used += sizeof(value); \
+      LOG_APPEND(conversion, value); \
+    } while (0)
+
+  while (*p != 0 && length < maxLen - 1) {
+
+    const char *next = strchr(p, '%');
+    size_t literal = (next == NULL) ? strlen(p) : next - p;
+    literal = min(literal, maxLen - 1 - length);
+    memcpy(line + length, p, literal);
+    length += literal;
+
+    if (next == NULL || !parseSpec(next, spec)) break;
+    p = spec.end;
+
+    // Rebuild the conversion with any '*' width / precision replaced by the stored value
+    size_t c = 0;
+    for (const char *s = spec.start; s < spec.end && c < sizeof(conversion) - 12; s++) {
+      if (*s == '*') {
+        int value;
+        if (used + sizeof(value) > dataLen) goto incomplete;
+        memcpy(&value, data + used, sizeof(value));
+        used += sizeof(value);
+        if (value < 0 && s[-1] == '.') {
+          c--;                    // negative precision is treated as omitted
+          continue;
+        }
+        c += snprintf(conversion + c, sizeof(conversion) - c, "%d", value);
+      } else {
+        conversion[c++] = *s;
+      }
+    }
+    conversion[c] = 0;
+
+    switch (spec.argument) {
+
+      case LOG_ARG_NONE: LOG_APPEND("%%"); break;
+      case LOG_ARG_INT: LOG_REPLAY(int); break;
+      case LOG_ARG_LONG: LOG_REPLAY(long); break;
+      case LOG_ARG_LLONG: LOG_REPLAY(long long); break;
+      case LOG_ARG_SIZE: LOG_REPLAY(size_t); break;
+      case LOG_ARG_DOUBLE: LOG_REPLAY(double); break;
+      case LOG_ARG_LDOUBLE: LOG_REPLAY(long double); break;
+      case LOG_ARG_POINTER: LOG_REPLAY(void *); break;
+      case LOG_ARG_COUNT: break;
+
+      case LOG_ARG_STRING: {
+        if (used >= dataLen) goto incomplete;
+        const char *text = (const char *)data + used;
+        used += strnlen(text, dataLen - used) + 1;
+        LOG_APPEND(conversion, text);
+        break;
+      }
+    }
+  }
+
+  if (!truncated) {
+    line[length] = 0;
+    return length;
+  }
+
+  incomplete:
+
+  // Arguments ran out - mark the cut and keep the line ending
+  LOG_APPEND("...");
+  if (strlen(format) > 0 && format[strlen(format) - 1] == '\n') LOG_APPEND("\n");
+  line[length] = 0;
+
+  #undef LOG_APPEND
+  #undef LOG_REPLAY
+
+  return length;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief write
+ * @details Queue a message for the drain task
+ * @returns false if the ring was full and the message was dropped
+ * @note Never blocks once begin() has run. Safe to call from any task on either core
+ * @note Before begin() the message is formatted and written directly, as early boot has no drain task
+ ***/
+bool Logger::write(uint8_t level, const char *format, va_list args) {
+
+  if (!ringReady) {
+    char line[LOG_LINE_LENGTH];
+    vsnprintf(line, sizeof(line), format, args);
+    Serial.write(line);
+    return true;
+  }
+
+  uint32_t position = ringHead.load(std::memory_order_relaxed);
+  LogRecord *record;
+
+  for (;;) {
+    record = &logRing[position & (LOG_RING_SIZE - 1)];
+    int32_t difference = (int32_t)(record->sequence.load(std::memory_order_acquire) - position);
+    if (difference == 0) {
+      if (ringHead.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+    } else if (difference < 0) {
+      droppedCount.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    } else {
+      position = ringHead.load(std::memory_order_relaxed);
+    }
+  }
+
+  bool truncated;
+
+  record->timestamp = millis();
+  record->format = format;
+  record->level = level;
+  record->core = xPortGetCoreID();
+  record->length = capture(format, args, record->data, sizeof(record->data), truncated);
+  record->truncated = truncated;
+
+  record->sequence.store(position + 1, std::memory_order_release);
+
+  // Only wake the drain task when the ring was empty, a burst is drained in one pass
+  if (position == ringTail.load(std::memory_order_relaxed)) xTaskNotifyGive(drainTask);
+
+  return true;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief flush
+ * @details Wait for queued messages to reach the UART (e.g. before a restart)
+ * @returns false on timeout
+ ***/
+bool Logger::flush(uint32_t timeoutMs) {
+
+  if (!ringReady) return true;
+
+  uint32_t target = ringHead.load(std::memory_order_acquire);
+  uint32_t startTime = millis();
+
+  xTaskNotifyGive(drainTask);
+
+  while ((int32_t)(ringWritten.load(std::memory_order_acquire) - target) < 0) {
+    if (millis() - startTime > timeoutMs) return false;
+    vTaskDelay(1);
+  }
+
+  Serial.flush();
+
+  return true;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief writeDirect
+ * @details Synchronous console output (API replies, blobs) in order with the log
+ * @returns bytes written
+ * @note Drains messages queued before the call first, then holds the UART for the whole buffer so
+ * a log line cannot land in the middle of it. Not for use from the drain task
+ ***/
+size_t Logger::writeDirect(const uint8_t *buffer, size_t length) {
+
+  if (!ringReady) return Serial.write(buffer, length);
+
+  flush(LOG_FLUSH_TIMEOUT_MS);
+
+  return consoleWrite(buffer, length);
+
+}
+
+
+
+
+/***********************************************************
+ * @brief consoleWrite
+ * @details Write to the UART under the console mutex
+ ***/
+size_t Logger::consoleWrite(const uint8_t *buffer, size_t length) {
+
+  if (xSemaphoreTake(consoleMutex, pdMS_TO_TICKS(LOG_FLUSH_TIMEOUT_MS)) != pdTRUE) return 0;
+
+  size_t written = Serial.write(buffer, length);
+
+  xSemaphoreGive(consoleMutex);
+
+  return written;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief dropped
+ * @returns messages dropped because the ring was full
+ ***/
+uint32_t Logger::dropped() {
+
+  return droppedCount.load(std::memory_order_relaxed);
+
+}
+
+
+
+
+/***********************************************************
+ * @brief addTail
+ * @details Keep a drained line for /events/log (without its line ending)
+ ***/
+void Logger::addTail(uint32_t sequence, uint32_t timestamp, uint8_t level, uint8_t core, const char *line) {
+
+  if (xSemaphoreTake(tailMutex, pdMS_TO_TICKS(10)) != pdTRUE) return;
+
+  LogTailLine &entry = tailLine[tailCount % LOG_TAIL_LINES];
+  size_t length = min(strcspn(line, "\r\n"), sizeof(entry.text) - 1);
+
+  entry.sequence = sequence;
+  entry.timestamp = timestamp;
+  entry.level = level;
+  entry.core = core;
+  memcpy(entry.text, line, length);
+  entry.text[length] = 0;
+  tailCount++;
+
+  xSemaphoreGive(tailMutex);
+
+}
+
+
+
+
+/***********************************************************
+ * @brief TASKdrainLog
+ * @details Format queued records and write them to the UART
+ * @note Woken by the first message into an empty ring, polls every LOG_DRAIN_INTERVAL_MS otherwise
+ ***/
+void Logger::TASKdrainLog(void *parameter) {
+
+  static char line[LOG_LINE_LENGTH];
+  uint32_t reportedDrops = 0;
+
+  for (;;) {
+
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(LOG_DRAIN_INTERVAL_MS));
+
+    uint32_t position = ringTail.load(std::memory_order_relaxed);
+
+    for (;;) {
+
+      LogRecord &record = logRing[position & (LOG_RING_SIZE - 1)];
+      if (record.sequence.load(std::memory_order_acquire) != position + 1) break;
+
+      uint32_t timestamp = record.timestamp;
+      uint8_t level = record.level;
+      uint8_t core = record.core;
+      size_t length = render(record.format, record.data, record.length, record.truncated, line, sizeof(line));
+
+      // Hand the slot back before the (slow) UART write
+      record.sequence.store(position + LOG_RING_SIZE, std::memory_order_release);
+      ringTail.store(++position, std::memory_order_relaxed);
+
+      consoleWrite((const uint8_t *)line, length);
+      addTail(position, timestamp, level, core, line);
+      ringWritten.store(position, std::memory_order_release);
+    }
+
+    uint32_t drops = droppedCount.load(std::memory_order_relaxed);
+    if (drops != reportedDrops) {
+      int length = snprintf(line, sizeof(line), "!! %u log messages dropped !!\n", drops - reportedDrops);
+      consoleWrite((const uint8_t *)line, length);
+      reportedDrops = drops;
+    }
+  }
+
+}
+
+
+
+
+/***********************************************************
+ * @brief getTailJSON
+ * @details Last LOG_TAIL_LINES lines for the /events/log topic
+ * @note Clients use SEQ to skip lines they have already shown
+ ***/
+String Logger::getTailJSON() {
+
+  static const char *levelName[LOG_LEVEL_COUNT] = {"INFO", "DEBUG", "VERBOSE", "STATUS"};
+
+  String jsonString;
+  JsonDocument dataJson;
+
+  dataJson["DROPPED"] = dropped();
+
+  JsonArray lines = dataJson["LINES"].to<JsonArray>();
+
+  if (tailMutex != NULL && xSemaphoreTake(tailMutex, pdMS_TO_TICKS(50)) == pdTRUE) {
+
+    uint32_t first = (tailCount > LOG_TAIL_LINES) ? tailCount - LOG_TAIL_LINES : 0;
+
+    for (uint32_t i = first; i < tailCount; i++) {
+      const LogTailLine &entry = tailLine[i % LOG_TAIL_LINES];
+      JsonObject line = lines.add<JsonObject>();
+      line["SEQ"] = entry.sequence;
+      line["TIME"] = entry.timestamp;
+      line["LEVEL"] = (entry.level < LOG_LEVEL_COUNT) ? levelName[entry.level] : "";
+      line["CORE"] = entry.core;
+      line["TEXT"] = entry.text;
+    }
+
+    xSemaphoreGive(tailMutex);
+  }
+
+  serializeJson(dataJson, jsonString);
+
+  return jsonString;
+
+}
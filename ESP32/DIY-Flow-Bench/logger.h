@@ -0,0 +1,61 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file logger.h
+ *
+ * @brief Logger class header file
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * Deferred log pipeline behind the Messages::xxxPrintf() methods. The caller does not format
+ * anything, it claims a slot in a multi producer ring and copies in the format pointer and the raw
+ * arguments (strings are copied, so stack buffers are safe to pass). A low priority drain task formats
+ * each record and writes it to the UART, and keeps the last LOG_TAIL_LINES lines for /events/log.
+ *
+ * The format string must be a literal (or otherwise outlive the record). If the ring is full the
+ * message is dropped and counted rather than blocking the caller.
+ *
+ * Synchronous console output (API replies, blobs) goes through writeDirect(), which drains the ring
+ * first and shares the UART lock with the drain task, so the two never interleave.
+ *
+ ***/
+#pragma once
+
+#include <Arduino.h>
+#include <stdarg.h>
+
+#include "system.h"
+#include "constants.h"
+
+
+class Logger {
+
+	private:
+
+		static void TASKdrainLog(void *parameter);
+		static size_t capture(const char *format, va_list args, uint8_t *data, size_t maxLen, bool &truncated);
+		static size_t render(const char *format, const uint8_t *data, size_t dataLen, bool truncated, char *line, size_t maxLen);
+		static void addTail(uint32_t sequence, uint32_t timestamp, uint8_t level, uint8_t core, const char *line);
+		static size_t consoleWrite(const uint8_t *buffer, size_t length);
+
+	public:
+
+		Logger();
+
+		static void begin();
+		static bool write(uint8_t level, const char *format, va_list args);
+		static bool flush(uint32_t timeoutMs);
+		static size_t writeDirect(const uint8_t *buffer, size_t length);
+
+		static uint32_t dropped();
+		static String getTailJSON();
+
+};
@@ -0,0 +1,348 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file maftable.cpp
+ *
+ * @brief MafTable class - user MAF data table lookup
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * The table is swapped in under a spinlock so a file upload can replace it while the sensor task is
+ * running. getFlow() holds the same lock for the duration of one lookup (a handful of compares and a
+ * cubic), so the arrays it is reading cannot be freed underneath it.
+ *
+ ***/
+#include "Arduino.h"
+
+#include "system.h"
+#include "constants.h"
+#include "structs.h"
+
+#include "maftable.h"
+#include "jsonstream.h"
+#include "messages.h"
+
+
+struct MafTableLoad {
+  uint16_t *milliVolts;
+  float *flow;
+  int rows;
+  int units;
+  bool error;
+};
+
+static portMUX_TYPE tableMux = portMUX_INITIALIZER_UNLOCKED;
+static uint16_t *tableMilliVolts = NULL;
+static float *tableFlow = NULL;
+static float *tableTangent = NULL;
+static int tableRows = 0;
+
+
+
+
+/***********************************************************
+ * @brief addPoint
+ * @details JsonStream callback - count (first pass) or store (second pass) one table row
+ * @note Members with a non numeric key other than "units" are ignored
+ ***/
+bool MafTable::addPoint(const char *key, JsonVariantConst value, void *context) {
+
+  MafTableLoad *load = (MafTableLoad *)context;
+
+  if (key == NULL) return false;
+
+  if (strcmp(key, "units") == 0) {
+    const char *units = value.as<const char *>();
+    if (units != NULL && strcmp(units, "MG_S") == 0) load->units = MG_S;
+    return true;
+  }
+
+  char *end;
+  double milliVolts = strtod(key, &end);
+  if (end == key) return true;
+
+  if (milliVolts < 0.0 || milliVolts > 65535.0 || !value.is<float>() || load->rows >= MAF_TABLE_MAX_ROWS) {
+    load->error = true;
+    return false;
+  }
+
+  if (load->milliVolts != NULL) {
+    load->milliVolts[load->rows] = (uint16_t)(milliVolts + 0.5);
+    load->flow[load->rows] = value.as<float>();
+  }
+
+  load->rows++;
+
+  return true;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief sortPoints
+ * @details Insertion sort by millivolts. Generated files are already in order so this is one pass
+ ***/
+void MafTable::sortPoints(uint16_t *milliVolts, float *flow, int rows) {
+
+  for (int i = 1; i < rows; i++) {
+    uint16_t key = milliVolts[i];
+    float value = flow[i];
+    int j = i - 1;
+    while (j >= 0 && milliVolts[j] > key) {
+      milliVolts[j + 1] = milliVolts[j];
+      flow[j + 1] = flow[j];
+      j--;
+    }
+    milliVolts[j + 1] = key;
+    flow[j + 1] = value;
+  }
+
+}
+
+
+
+
+/***********************************************************
+ * @brief calculateTangents
+ * @details Fritsch-Carlson tangents for monotone cubic Hermite interpolation
+ ***/
+void MafTable::calculateTangents(const uint16_t *milliVolts, const float *flow, float *tangent, int rows) {
+
+  if (rows < 2) {
+    if (rows == 1) tangent[0] = 0.0f;
+    return;
+  }
+
+  // Secant slopes are stored in tangent[] temporarily
+  float previousSlope = 0.0f;
+
+  for (int i = 0; i < rows - 1; i++) {
+    float slope = (flow[i + 1] - flow[i]) / (float)(milliVolts[i + 1] - milliVolts[i]);
+    if (i == 0) {
+      tangent[0] = slope;
+    } else if (previousSlope * slope <= 0.0f) {
+      tangent[i] = 0.0f;
+    } else {
+      tangent[i] = (previousSlope + slope) / 2.0f;
+    }
+    previousSlope = slope;
+  }
+  tangent[rows - 1] = previousSlope;
+
+  // Limit tangents so each segment stays monotone
+  for (int i = 0; i < rows - 1; i++) {
+    float slope = (flow[i + 1] - flow[i]) / (float)(milliVolts[i + 1] - milliVolts[i]);
+    if (slope == 0.0f) {
+      tangent[i] = 0.0f;
+      tangent[i + 1] = 0.0f;
+      continue;
+    }
+    float alpha = tangent[i] / slope;
+    float beta = tangent[i + 1] / slope;
+    float magnitude = alpha * alpha + beta * beta;
+    if (magnitude > 9.0f) {
+      float tau = 3.0f / sqrtf(magnitude);
+      tangent[i] = tau * alpha * slope;
+      tangent[i + 1] = tau * beta * slope;
+    }
+  }
+
+}
+
+
+
+
+/***********************************************************
+ * @brief load
+ * @details Stream a MAF data file into a new table and swap it in
+ * @returns number of rows or -1 if the file is missing or invalid (the current table is kept)
+ ***/
+int MafTable::load(const char *path) {
+
+  Messages _message;
+
+  MafTableLoad load = {NULL, NULL, 0, KG_H, false};
+
+  // First pass counts rows so the arrays are allocated once at their final size
+  if (JsonStream::forEach(path, NULL, addPoint, &load) < 0 || load.error || load.rows < 2) {
+    _message.serialPrintf("MAF data file %s invalid (%d rows) \n", path, load.rows);
+    return -1;
+  }
+
+  int rows = load.rows;
+  uint16_t *milliVolts = (uint16_t *)malloc(rows * sizeof(uint16_t));
+  float *flow = (float *)malloc(rows * sizeof(float));
+  float *tangent = (float *)malloc(rows * sizeof(float));
+
+  load.milliVolts = milliVolts;
+  load.flow = flow;
+  load.rows = 0;
+
+  if (milliVolts == NULL || flow == NULL || tangent == NULL || JsonStream::forEach(path, NULL, addPoint, &load) < 0 || load.rows != rows) {
+    _message.serialPrintf("MAF data file %s failed to load \n", path);
+    free(milliVolts);
+    free(flow);
+    free(tangent);
+    return -1;
+  }
+
+  sortPoints(milliVolts, flow, rows);
+
+  // Drop duplicate voltages (last one wins) so every segment has a non zero width
+  int unique = 0;
+  for (int i = 0; i < rows; i++) {
+    if (unique > 0 && milliVolts[unique - 1] == milliVolts[i]) unique--;
+    milliVolts[unique] = milliVolts[i];
+    flow[unique] = (load.units == MG_S) ? flow[i] * 0.0036f : flow[i];
+    unique++;
+  }
+
+  calculateTangents(milliVolts, flow, tangent, unique);
+
+  portENTER_CRITICAL(&tableMux);
+  uint16_t *oldMilliVolts = tableMilliVolts;
+  float *oldFlow = tableFlow;
+  float *oldTangent = tableTangent;
+  tableMilliVolts = milliVolts;
+  tableFlow = flow;
+  tableTangent = tangent;
+  tableRows = unique;
+  portEXIT_CRITICAL(&tableMux);
+
+  free(oldMilliVolts);
+  free(oldFlow);
+  free(oldTangent);
+
+  _message.serialPrintf("MAF data loaded: %d rows (%s) \n", unique, load.units == MG_S ? "mg/s" : "kg/h");
+
+  return unique;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief clear
+ * @details Drop the table (sensor falls back to the polynomial coefficients)
+ ***/
+void MafTable::clear() {
+
+  portENTER_CRITICAL(&tableMux);
+  uint16_t *oldMilliVolts = tableMilliVolts;
+  float *oldFlow = tableFlow;
+  float *oldTangent = tableTangent;
+  tableMilliVolts = NULL;
+  tableFlow = NULL;
+  tableTangent = NULL;
+  tableRows = 0;
+  portEXIT_CRITICAL(&tableMux);
+
+  free(oldMilliVolts);
+  free(oldFlow);
+  free(oldTangent);
+
+}
+
+
+
+
+/***********************************************************
+ * @brief isLoaded / rows
+ ***/
+bool MafTable::isLoaded() {
+
+  return tableRows > 0;
+
+}
+
+int MafTable::rows() {
+
+  return tableRows;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief maxMilliVolts
+ * @returns highest voltage in the table (0 if no table)
+ ***/
+uint16_t MafTable::maxMilliVolts() {
+
+  uint16_t milliVolts = 0;
+
+  portENTER_CRITICAL(&tableMux);
+  if (tableRows > 0) milliVolts = tableMilliVolts[tableRows - 1];
+  portEXIT_CRITICAL(&tableMux);
+
+  return milliVolts;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief getFlow
+ * @details Look up mass flow for a MAF signal voltage
+ * @param milliVolts VCC corrected MAF signal
+ * @returns flow in kg/h (0 if no table). Outside the table the end tangent is extended, floored at 0
+ ***/
+float MafTable::getFlow(float milliVolts) {
+
+  float flow = 0.0f;
+
+  portENTER_CRITICAL(&tableMux);
+
+  int rows = tableRows;
+
+  if (rows > 0 && milliVolts <= tableMilliVolts[0]) {
+
+    flow = tableFlow[0] + tableTangent[0] * (milliVolts - tableMilliVolts[0]);
+
+  } else if (rows > 0 && milliVolts >= tableMilliVolts[rows - 1]) {
+
+    flow = tableFlow[rows - 1] + tableTangent[rows - 1] * (milliVolts - tableMilliVolts[rows - 1]);
+
+  } else if (rows > 0) {
+
+    // Find the segment [low, low + 1] containing milliVolts
+    int low = 0;
+    int high = rows - 1;
+    while (high - low > 1) {
+      int mid = (low + high) >> 1;
+      if (tableMilliVolts[mid] <= milliVolts) {
+        low = mid;
+      } else {
+        high = mid;
+      }
+    }
+
+    float width = (float)(tableMilliVolts[high] - tableMilliVolts[low]);
+    float t = (milliVolts - tableMilliVolts[low]) / width;
+    float t2 = t * t;
+    float t3 = t2 * t;
+
+    flow = (2.0f * t3 - 3.0f * t2 + 1.0f) * tableFlow[low]
+         + (t3 - 2.0f * t2 + t) * width * tableTangent[low]
+         + (-2.0f * t3 + 3.0f * t2) * tableFlow[high]
+         + (t3 - t2) * width * tableTangent[high];
+  }
+
+  portEXIT_CRITICAL(&tableMux);
+
+  return flow > 0.0f ? flow : 0.0f;
+
+}
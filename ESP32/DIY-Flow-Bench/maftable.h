@@ -0,0 +1,54 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file maftable.h
+ *
+ * @brief MafTable class header file
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * User MAF transfer table (mafData.json). The file is a flat object of "millivolts": flow pairs as
+ * produced by tools/mafTransferFunctionGenerator.py, with an optional "units" member of "KG_H"
+ * (default) or "MG_S". It is loaded once into packed arrays sorted by millivolts, with flow held in
+ * kg/h, and looked up by binary search with monotone cubic (Fritsch-Carlson) interpolation so the
+ * curve never overshoots between points.
+ *
+ ***/
+#pragma once
+
+#include <Arduino.h>
+
+#include "system.h"
+#include "constants.h"
+#include "jsonstream.h"
+
+
+class MafTable {
+
+	friend class DataHandler;
+	friend class Sensors;
+
+	private:
+
+		static bool addPoint(const char *key, JsonVariantConst value, void *context);
+		static void sortPoints(uint16_t *milliVolts, float *flow, int rows);
+		static void calculateTangents(const uint16_t *milliVolts, const float *flow, float *tangent, int rows);
+
+	public:
+
+		static int load(const char *path);
+		static void clear();
+		static bool isLoaded();
+		static int rows();
+		static uint16_t maxMilliVolts();
+		static float getFlow(float milliVolts);
+
+};
@@ -47,6 +47,7 @@
 #include "structs.h"
 
 #include <Wire.h>
+#include "logger.h"
 #include "messages.h"
 
 
@@ -77,7 +78,7 @@ void Messages::Handler(const String langPhrase) {
 	
 	// If we have debug enabled send the message to the serial port
 	#if defined DEBUG && defined SERIAL0_ENABLED
-		this->serialPrintf("%s  \n", langPhrase); 
+		this->serialPrintf("%s  \n", langPhrase.c_str()); 
 	#endif
 }
 
@@ -86,7 +87,9 @@ void Messages::Handler(const String langPhrase) {
 /***********************************************************
 * @brief serialPrintf
 * @note Always prints to serial port
-* @note Encapsulates vsnprintf method and uses standard c++ xxprintf formatting
+* @note Uses standard c++ xxprintf formatting. Formatting and the UART write are deferred to the
+* log drain task (see logger.h) so callers on the acquisition path are not held up
+* @note format must be a string literal
 *
 * Based on...
 * https://forum.arduino.cc/t/esp32-where-can-i-find-the-reference-for-serial-printf-the-print-with-the-f-as-a-suffix/1007598/8
@@ -98,16 +101,15 @@ void Messages::Handler(const String langPhrase) {
 * Example using d2str to convert float to char (double to string)
 * _message.serialPrintf("kg/h = %c", dtostrf((flowRateRAW / 1000), 7, 2, _message.floatBuffer)); 
 */
-size_t Messages::serialPrintf(const std::string format, ...) {
+size_t Messages::serialPrintf(const char *format, ...) {
 	
 	#ifdef SERIAL0_ENABLED
 	
-		char buf[API_RESPONSE_LENGTH];
 		va_list ap;
 		va_start(ap, format);
-		vsnprintf(buf, sizeof(buf), format.c_str(), ap);
+		bool queued = Logger::write(LOG_LEVEL_SERIAL, format, ap);
 		va_end(ap);
-		return(Serial.write(buf));
+		return(queued ? strlen(format) : 0);
 	#else	
 		return 0;
 	#endif
@@ -119,6 +121,7 @@ size_t Messages::serialPrintf(const std::string format, ...) {
 /***********************************************************
 * @brief blobPrintf
 * @note Prints blob to serial port
+* @note Written synchronously, after any log messages queued before it
 * @note Follows same formatting as serialPrintf
 */
 size_t Messages::blobPrintf(std::string format, ...) {
@@ -130,7 +133,7 @@ size_t Messages::blobPrintf(std::string format, ...) {
 		va_start(ap, format);
 		vsnprintf(buf, sizeof(buf), format.c_str(), ap);
 		va_end(ap);
-		return(Serial.write(buf));
+		return(Logger::writeDirect((const uint8_t *)buf, strlen(buf)));
 	#else	
 		return 0;
 	#endif
@@ -143,19 +146,18 @@ size_t Messages::blobPrintf(std::string format, ...) {
 * @note Prints to serial port if debug_mode enabled
 * @note Follows same formatting as serialPrintf
 */
-size_t Messages::debugPrintf(const std::string format, ...) {
+size_t Messages::debugPrintf(const char *format, ...) {
 
 	#ifdef SERIAL0_ENABLED
 	
 		extern struct BenchSettings settings;
 	
 		if (settings.debug_mode) {
-			char buf[API_STATUS_LENGTH];
 			va_list ap;
 			va_start(ap, format);
-			vsnprintf(buf, sizeof(buf), format.c_str(), ap);
+			bool queued = Logger::write(LOG_LEVEL_DEBUG, format, ap);
 			va_end(ap);
-			return(Serial.write(buf));
+			return(queued ? strlen(format) : 0);
 		} else {
 			return 0;
 		}
@@ -171,19 +173,18 @@ size_t Messages::debugPrintf(const std::string format, ...) {
 * @note Prints to serial port if verbose_print_mode enabled
 * @note Follows same formatting as serialPrintf
 */
-size_t Messages::verbosePrintf(const std::string format, ...) {
+size_t Messages::verbosePrintf(const char *format, ...) {
 
 	#ifdef SERIAL0_ENABLED
 	
 		extern struct BenchSettings settings;
 	
 		if (settings.verbose_print_mode) {
-			char buf[API_STATUS_LENGTH];
 			va_list ap;
 			va_start(ap, format);
-			vsnprintf(buf, sizeof(buf), format.c_str(), ap);
+			bool queued = Logger::write(LOG_LEVEL_VERBOSE, format, ap);
 			va_end(ap);
-			return(Serial.write(buf));
+			return(queued ? strlen(format) : 0);
 		} else {
 			return 0;
 		}
@@ -199,19 +200,18 @@ size_t Messages::verbosePrintf(const std::string format, ...) {
 * @note Prints to serial port if status_print_mode enabled
 * @note Follows same formatting as serialPrintf
 */
-size_t Messages::statusPrintf(const std::string format, ...) {
+size_t Messages::statusPrintf(const char *format, ...) {
 
 	#ifdef SERIAL0_ENABLED
 	
 		extern struct BenchSettings settings;
 	
 		if (settings.status_print_mode) {
-			char buf[API_STATUS_LENGTH];
 			va_list ap;
 			va_start(ap, format);
-			vsnprintf(buf, sizeof(buf), format.c_str(), ap);
+			bool queued = Logger::write(LOG_LEVEL_STATUS, format, ap);
 			va_end(ap);
-			return(Serial.write(buf));
+			return(queued ? strlen(format) : 0);
 		} else {
 			return 0;
 		}
@@ -33,11 +33,11 @@ class Messages {
 		
 		void Handler(const String langPhrase);
 		size_t serialPrintTestf(char *buf, char *format, ...);
-		size_t serialPrintf(const std::string format, ...);
+		size_t serialPrintf(const char *format, ...);
 		size_t blobPrintf(std::string format, ...);
-		size_t debugPrintf(const std::string format, ...);
-		size_t verbosePrintf(const std::string format, ...);
-		size_t statusPrintf(const std::string format, ...);
+		size_t debugPrintf(const char *format, ...);
+		size_t verbosePrintf(const char *format, ...);
+		size_t statusPrintf(const char *format, ...);
 		
 		// void * ICACHE_FLASH_ATTR Messages::serialPrintf(const char *s, ...);
 		
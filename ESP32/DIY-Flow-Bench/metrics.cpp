@@ -0,0 +1,329 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file metrics.cpp
+ *
+ * @brief Metrics class - Prometheus text exposition of firmware internals
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * Served at /metrics (text/plain; version=0.0.4). All counters and the exposition buffer are preallocated.
+ * Each scrape copies the buffer into its own response, as the next scrape rebuilds it while the last one
+ * may still be sending.
+ *
+ ***/
+#include "Arduino.h"
+#include <WiFi.h>
+#include <stdarg.h>
+
+#include "system.h"
+#include "constants.h"
+#include "structs.h"
+
+#include "metrics.h"
+
+
+// Histogram bucket upper bounds in microseconds and their 'le' labels in seconds
+static const uint32_t bucketMicros[METRICS_BUCKET_COUNT] = {100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000};
+static const char *bucketLabel[METRICS_BUCKET_COUNT] = {"0.0001", "0.00025", "0.0005", "0.001", "0.0025", "0.005", "0.01", "0.025", "0.05", "0.1"};
+
+// Observations are made from the sensor task, loop and async_tcp
+static portMUX_TYPE metricsMux = portMUX_INITIALIZER_UNLOCKED;
+
+
+
+
+/***********************************************************
+ * @brief Class constructor
+ ***/
+Metrics::Metrics() {
+
+  i2cErrors = 0;
+  untrackedRequests = 0;
+  unmatchedRequests = 0;
+  coalescedWrites = 0;
+  expositionLength = 0;
+  exposition[0] = 0;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief observe
+ * @details Add a single latency sample to a histogram
+ ***/
+void Metrics::observe(MetricHistogram &histogram, uint32_t micros) {
+
+  int bucket = 0;
+
+  while (bucket < METRICS_BUCKET_COUNT && micros > bucketMicros[bucket]) bucket++;
+
+  portENTER_CRITICAL(&metricsMux);
+  histogram.bucket[bucket]++;
+  histogram.count++;
+  histogram.sumMicros += micros;
+  portEXIT_CRITICAL(&metricsMux);
+
+}
+
+
+
+
+/***********************************************************
+ * @brief Observation helpers
+ ***/
+void Metrics::observeAcquisitionCycle(uint32_t micros) {
+  observe(acquisitionCycle, micros);
+}
+
+void Metrics::observeI2C(uint32_t micros, bool error) {
+  observe(i2cTransaction, micros);
+  if (error) i2cErrors++;
+}
+
+void Metrics::observeSSEBuild(uint32_t micros) {
+  observe(sseBuild, micros);
+}
+
+void Metrics::observeSSESend(uint32_t micros) {
+  observe(sseSend, micros);
+}
+
+void Metrics::observeFlashWrite(uint32_t micros) {
+  observe(flashWrite, micros);
+}
+
+void Metrics::countCoalescedWrite() {
+  portENTER_CRITICAL(&metricsMux);
+  coalescedWrites++;
+  portEXIT_CRITICAL(&metricsMux);
+}
+
+
+
+
+/***********************************************************
+ * @brief observeRequest
+ * @details Record handler latency against the request path
+ * @note Only pass paths of registered handlers (see countUnmatchedRequest). Paths are tracked in a fixed
+ * table, once full further paths are only counted as untracked
+ ***/
+void Metrics::observeRequest(const char *path, uint32_t micros) {
+
+  portENTER_CRITICAL(&metricsMux);
+
+  for (int i = 0; i < METRICS_MAX_ENDPOINTS; i++) {
+
+    if (endpoint[i].path[0] == 0) {
+      strlcpy(endpoint[i].path, path, sizeof(endpoint[i].path));
+    }
+
+    if (strncmp(endpoint[i].path, path, sizeof(endpoint[i].path) - 1) == 0) {
+      endpoint[i].count++;
+      endpoint[i].sumMicros += micros;
+      if (micros > endpoint[i].maxMicros) endpoint[i].maxMicros = micros;
+      portEXIT_CRITICAL(&metricsMux);
+      return;
+    }
+  }
+
+  untrackedRequests++;
+
+  portEXIT_CRITICAL(&metricsMux);
+
+}
+
+
+
+
+/***********************************************************
+ * @brief countUnmatchedRequest
+ * @details Count a request no handler was registered for (404). These are not given an endpoint slot,
+ * so probes for arbitrary paths cannot fill the table
+ ***/
+void Metrics::countUnmatchedRequest() {
+  portENTER_CRITICAL(&metricsMux);
+  unmatchedRequests++;
+  portEXIT_CRITICAL(&metricsMux);
+}
+
+
+
+
+/***********************************************************
+ * @brief escapeLabel
+ * @details Escape a label value for the text format (backslash, double quote and line feed)
+ ***/
+static const char * escapeLabel(const char *value, char *escaped, size_t size) {
+
+  size_t length = 0;
+
+  for (; *value && length + 2 < size; value++) {
+    switch (*value) {
+      case '\\': escaped[length++] = '\\'; escaped[length++] = '\\'; break;
+      case '"': escaped[length++] = '\\'; escaped[length++] = '"'; break;
+      case '\n': escaped[length++] = '\\'; escaped[length++] = 'n'; break;
+      default: escaped[length++] = *value; break;
+    }
+  }
+
+  escaped[length] = 0;
+
+  return escaped;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief append
+ * @details printf into the exposition buffer. Output is truncated once the buffer is full
+ ***/
+void Metrics::append(const char *format, ...) {
+
+  if (expositionLength >= METRICS_BUFFER_SIZE - 1) return;
+
+  va_list ap;
+  va_start(ap, format);
+  int written = vsnprintf(exposition + expositionLength, METRICS_BUFFER_SIZE - expositionLength, format, ap);
+  va_end(ap);
+
+  if (written > 0) {
+    expositionLength = min(expositionLength + (size_t)written, (size_t)(METRICS_BUFFER_SIZE - 1));
+  }
+
+}
+
+
+
+
+/***********************************************************
+ * @brief appendHistogram
+ * @details Write a histogram in Prometheus text format (seconds)
+ ***/
+void Metrics::appendHistogram(const char *name, const char *help, MetricHistogram &histogram) {
+
+  MetricHistogram snapshot;
+  uint32_t cumulative = 0;
+
+  portENTER_CRITICAL(&metricsMux);
+  snapshot = histogram;
+  portEXIT_CRITICAL(&metricsMux);
+
+  append("# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+
+  for (int i = 0; i < METRICS_BUCKET_COUNT; i++) {
+    cumulative += snapshot.bucket[i];
+    append("%s_bucket{le=\"%s\"} %u\n", name, bucketLabel[i], cumulative);
+  }
+
+  append("%s_bucket{le=\"+Inf\"} %u\n", name, snapshot.count);
+  append("%s_sum %.6f\n", name, snapshot.sumMicros / 1000000.0);
+  append("%s_count %u\n", name, snapshot.count);
+
+}
+
+
+
+
+/***********************************************************
+ * @brief appendGauge
+ ***/
+void Metrics::appendGauge(const char *name, const char *help, double value) {
+
+  append("# HELP %s %s\n# TYPE %s gauge\n%s %.0f\n", name, help, name, name, value);
+
+}
+
+
+
+
+/***********************************************************
+ * @brief buildExposition
+ * @details Render all metrics into the preallocated exposition buffer
+ * @returns pointer to the null terminated exposition text
+ ***/
+const char * Metrics::buildExposition() {
+
+  extern struct DeviceStatus status;
+  extern TaskHandle_t sensorDataTask;
+  extern TaskHandle_t enviroDataTask;
+  extern TaskHandle_t loopTaskHandle;
+
+  expositionLength = 0;
+  exposition[0] = 0;
+
+  appendHistogram("diyfb_acquisition_cycle_seconds", "Sensor task acquisition cycle time", acquisitionCycle);
+  appendHistogram("diyfb_i2c_transaction_seconds", "ADC I2C transaction latency", i2cTransaction);
+  appendHistogram("diyfb_sse_build_seconds", "SSE frame build time", sseBuild);
+  appendHistogram("diyfb_sse_send_seconds", "SSE frame fan-out time", sseSend);
+  appendHistogram("diyfb_flash_write_seconds", "NVM / flash filesystem write time (acquisition stalled)", flashWrite);
+
+  append("# HELP diyfb_i2c_errors_total ADC I2C transactions that failed\n# TYPE diyfb_i2c_errors_total counter\ndiyfb_i2c_errors_total %u\n", i2cErrors);
+  append("# HELP diyfb_flash_writes_coalesced_total NVM write requests merged into a pending write\n# TYPE diyfb_flash_writes_coalesced_total counter\ndiyfb_flash_writes_coalesced_total %u\n", coalescedWrites);
+
+  appendGauge("diyfb_heap_free_bytes", "Free heap", ESP.getFreeHeap());
+  appendGauge("diyfb_heap_min_free_bytes", "Lowest free heap since boot", ESP.getMinFreeHeap());
+  appendGauge("diyfb_heap_largest_free_block_bytes", "Largest allocatable heap block", ESP.getMaxAllocHeap());
+  appendGauge("diyfb_loop_scan_microseconds", "Main loop scan time", status.loopScanTime);
+  appendGauge("diyfb_boot_nvm_load_microseconds", "NVM data load time at boot", status.nvmLoadTime);
+  appendGauge("diyfb_boot_first_sse_milliseconds", "Boot to first SSE frame delivered", status.firstSSETime);
+
+  append("# HELP diyfb_task_stack_hwm_bytes Task stack high water mark\n# TYPE diyfb_task_stack_hwm_bytes gauge\n");
+  if (sensorDataTask != NULL) append("diyfb_task_stack_hwm_bytes{task=\"sensor\"} %u\n", uxTaskGetStackHighWaterMark(sensorDataTask));
+  if (enviroDataTask != NULL) append("diyfb_task_stack_hwm_bytes{task=\"enviro\"} %u\n", uxTaskGetStackHighWaterMark(enviroDataTask));
+  if (loopTaskHandle != NULL) append("diyfb_task_stack_hwm_bytes{task=\"loop\"} %u\n", uxTaskGetStackHighWaterMark(loopTaskHandle));
+
+  appendGauge("diyfb_wifi_rssi_dbm", "WiFi signal strength (0 in AP mode)", (WiFi.status() == WL_CONNECTED) ? WiFi.RSSI() : 0);
+
+  append("# HELP diyfb_uptime_seconds Time since boot\n# TYPE diyfb_uptime_seconds counter\ndiyfb_uptime_seconds %lu\n", millis() / 1000);
+
+  // Per endpoint request latency (summary without quantiles)
+  append("# HELP diyfb_http_request_duration_seconds HTTP handler latency by path\n# TYPE diyfb_http_request_duration_seconds summary\n");
+  char label[sizeof(MetricEndpoint().path) * 2];
+  for (int i = 0; i < METRICS_MAX_ENDPOINTS; i++) {
+    MetricEndpoint snapshot;
+    portENTER_CRITICAL(&metricsMux);
+    snapshot = endpoint[i];
+    portEXIT_CRITICAL(&metricsMux);
+    if (snapshot.path[0] == 0) break;
+    escapeLabel(snapshot.path, label, sizeof(label));
+    append("diyfb_http_request_duration_seconds_sum{path=\"%s\"} %.6f\n", label, snapshot.sumMicros / 1000000.0);
+    append("diyfb_http_request_duration_seconds_count{path=\"%s\"} %u\n", label, snapshot.count);
+  }
+
+  append("# HELP diyfb_http_request_max_seconds Slowest HTTP handler by path\n# TYPE diyfb_http_request_max_seconds gauge\n");
+  for (int i = 0; i < METRICS_MAX_ENDPOINTS && endpoint[i].path[0] != 0; i++) {
+    append("diyfb_http_request_max_seconds{path=\"%s\"} %.6f\n", escapeLabel(endpoint[i].path, label, sizeof(label)), endpoint[i].maxMicros / 1000000.0);
+  }
+
+  append("# HELP diyfb_http_untracked_requests_total Requests to paths beyond the endpoint table\n# TYPE diyfb_http_untracked_requests_total counter\ndiyfb_http_untracked_requests_total %u\n", untrackedRequests);
+  append("# HELP diyfb_http_unmatched_requests_total Requests that matched no handler (404)\n# TYPE diyfb_http_unmatched_requests_total counter\ndiyfb_http_unmatched_requests_total %u\n", unmatchedRequests);
+
+  return exposition;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief expositionSize
+ * @details Length of the last rendered exposition
+ ***/
+size_t Metrics::expositionSize() {
+
+  return expositionLength;
+
+}
@@ -0,0 +1,93 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file metrics.h
+ *
+ * @brief Metrics class header file
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ ***/
+#pragma once
+
+#include <Arduino.h>
+
+#include "system.h"
+
+#define METRICS_BUCKET_COUNT 10
+
+
+/***********************************************************
+ * @brief Latency histogram (microseconds)
+ * @note Bucket counts are stored non-cumulative and summed at exposition time
+ ***/
+struct MetricHistogram {
+	uint32_t bucket[METRICS_BUCKET_COUNT + 1] = {0};   // last bucket is +Inf
+	uint32_t count = 0;
+	uint64_t sumMicros = 0;
+};
+
+
+/***********************************************************
+ * @brief Per endpoint request latency
+ ***/
+struct MetricEndpoint {
+	char path[32] = "";
+	uint32_t count = 0;
+	uint64_t sumMicros = 0;
+	uint32_t maxMicros = 0;
+};
+
+
+class Metrics {
+
+	friend class Webserver;
+	friend class Publisher;
+	friend class Hardware;
+
+	private:
+
+		MetricHistogram acquisitionCycle;
+		MetricHistogram i2cTransaction;
+		MetricHistogram sseBuild;
+		MetricHistogram sseSend;
+		MetricHistogram flashWrite;
+		MetricEndpoint endpoint[METRICS_MAX_ENDPOINTS];
+		uint32_t i2cErrors;
+		uint32_t untrackedRequests;
+		uint32_t unmatchedRequests;
+		uint32_t coalescedWrites;
+
+		char exposition[METRICS_BUFFER_SIZE];
+		size_t expositionLength;
+
+		void observe(MetricHistogram &histogram, uint32_t micros);
+		void append(const char *format, ...);
+		void appendHistogram(const char *name, const char *help, MetricHistogram &histogram);
+		void appendGauge(const char *name, const char *help, double value);
+
+	public:
+
+		Metrics();
+
+		void observeAcquisitionCycle(uint32_t micros);
+		void observeI2C(uint32_t micros, bool error = false);
+		void observeSSEBuild(uint32_t micros);
+		void observeSSESend(uint32_t micros);
+		void observeRequest(const char *path, uint32_t micros);
+		void countUnmatchedRequest();
+		void observeFlashWrite(uint32_t micros);
+		void countCoalescedWrite();
+
+		const char * buildExposition();
+		size_t expositionSize();
+
+};
@@ -0,0 +1,428 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file modbus.cpp
+ *
+ * @brief Modbus class - read only Modbus TCP / RTU register server
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * The register image has one writer (the sensor task) and is read from the async_tcp task and the RTU
+ * task, so it is guarded by a sequence count rather than a lock. The writer makes the count odd while
+ * it updates the image and even again when done. A reader copies the image and retries if the count
+ * was odd or changed during the copy.
+ *
+ ***/
+#include "Arduino.h"
+#include <atomic>
+#include <AsyncTCP.h>
+
+#include "system.h"
+#include "constants.h"
+#include "structs.h"
+
+#include "messages.h"
+#include "modbus.h"
+#include "recorder.h"
+
+
+#define MODBUS_IMAGE_SIZE (MODBUS_REGISTER_COUNT * 2)
+#define MODBUS_MBAP_LENGTH 7
+#define MODBUS_MAX_PDU 253
+#define MODBUS_MAX_READ_REGISTERS 125
+#define MODBUS_MAX_READ_BITS 2000
+
+// Function codes
+#define MODBUS_READ_DISCRETE_INPUTS 0x02
+#define MODBUS_READ_HOLDING_REGISTERS 0x03
+#define MODBUS_READ_INPUT_REGISTERS 0x04
+
+// Exception codes
+#define MODBUS_ILLEGAL_FUNCTION 0x01
+#define MODBUS_ILLEGAL_ADDRESS 0x02
+#define MODBUS_ILLEGAL_VALUE 0x03
+
+
+/***********************************************************
+ * @brief TCP client receive state
+ ***/
+struct ModbusTCPClient {
+  uint8_t buffer[MODBUS_MBAP_LENGTH + MODBUS_MAX_PDU];
+  size_t length = 0;
+};
+
+
+// Float registers in map order (register = index * 2)
+static const double SensorData::*floatRegister[] = {
+  &SensorData::FlowCFM,
+  &SensorData::FlowSCFM,
+  &SensorData::FlowADJ,
+  &SensorData::FlowADJSCFM,
+  &SensorData::FlowKGH,
+  &SensorData::PRefKPA,
+  &SensorData::PRefH2O,
+  &SensorData::PDiffKPA,
+  &SensorData::PDiffH2O,
+  &SensorData::PitotKPA,
+  &SensorData::PitotH2O,
+  &SensorData::TempDegC,
+  &SensorData::RelH,
+  &SensorData::BaroHPA,
+  &SensorData::Swirl,
+  &SensorData::MafVolts
+};
+
+#define MODBUS_FLOAT_COUNT (sizeof(floatRegister) / sizeof(floatRegister[0]))
+#define MODBUS_REG_STATUS (MODBUS_FLOAT_COUNT * 2)
+#define MODBUS_REG_SAMPLE (MODBUS_REG_STATUS + 1)
+#define MODBUS_REG_UPTIME (MODBUS_REG_STATUS + 2)
+
+static_assert(MODBUS_REG_UPTIME + 2 == MODBUS_REGISTER_COUNT, "MODBUS_REGISTER_COUNT does not match the register map");
+
+static uint8_t registerImage[MODBUS_IMAGE_SIZE];
+static std::atomic<uint32_t> imageSequence(0);
+static uint16_t sampleCount = 0;
+
+static AsyncServer *tcpServer = NULL;
+static std::atomic<int> tcpClients(0);
+static TaskHandle_t rtuTask = NULL;
+
+
+
+
+static inline void putWord(uint8_t *data, uint16_t value) {
+
+  data[0] = value >> 8;
+  data[1] = value & 0xFF;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief Class constructor
+ ***/
+Modbus::Modbus() {
+}
+
+
+
+
+/***********************************************************
+ * @brief begin
+ * @details Start the TCP listener and / or the RTU task
+ ***/
+void Modbus::begin() {
+
+  extern struct Pins pins;
+
+  Messages _message;
+
+  #ifdef MODBUS_TCP_ENABLED
+    if (tcpServer == NULL) {
+
+      tcpServer = new AsyncServer(MODBUS_TCP_PORT);
+
+      // Callbacks run in the async_tcp task
+      tcpServer->onClient([](void *arg, AsyncClient *client) {
+
+        if (tcpClients.load() >= MODBUS_TCP_MAX_CLIENTS) {
+          client->close(true);
+          delete client;
+          return;
+        }
+
+        ModbusTCPClient *state = new ModbusTCPClient();
+        tcpClients++;
+
+        client->setNoDelay(true);
+
+        client->onData([](void *arg, AsyncClient *client, void *data, size_t length) {
+
+          ModbusTCPClient *state = (ModbusTCPClient *)arg;
+          const uint8_t *bytes = (const uint8_t *)data;
+          uint8_t response[MODBUS_MBAP_LENGTH + MODBUS_MAX_PDU];
+
+          while (length > 0) {
+
+            // Requests can arrive split or back to back, gather the header up to the length field then the rest of the ADU
+            size_t need = 6;
+            if (state->length >= 6) need = 6 + ((state->buffer[4] << 8) | state->buffer[5]);
+            if ((state->length >= 6 && (need < MODBUS_MBAP_LENGTH + 1 || need > sizeof(state->buffer))) || (state->length >= 4 && (state->buffer[2] | state->buffer[3]) != 0)) {
+              client->close(true);  // not Modbus - drop the connection
+              return;
+            }
+
+            size_t piece = min(length, need - state->length);
+            memcpy(state->buffer + state->length, bytes, piece);
+            state->length += piece;
+            bytes += piece;
+            length -= piece;
+
+            if (state->length <= 6 || state->length < need) continue;
+
+            size_t pduLength = processPDU(state->buffer + MODBUS_MBAP_LENGTH, need - MODBUS_MBAP_LENGTH, response + MODBUS_MBAP_LENGTH);
+            memcpy(response, state->buffer, 4);           // transaction id, protocol id
+            putWord(response + 4, pduLength + 1);
+            response[6] = state->buffer[6];                // unit id
+            client->write((const char *)response, MODBUS_MBAP_LENGTH + pduLength);
+            state->length = 0;
+          }
+
+        }, state);
+
+        client->onDisconnect([](void *arg, AsyncClient *client) {
+          delete (ModbusTCPClient *)arg;
+          tcpClients--;
+          delete client;
+        }, state);
+
+      }, NULL);
+
+      tcpServer->begin();
+      _message.serialPrintf("Modbus TCP server on port %d \n", MODBUS_TCP_PORT);
+    }
+  #endif
+
+  #ifdef MODBUS_RTU_ENABLED
+    if (rtuTask == NULL) {
+
+      if (pins.SERIAL2_RX < 0 || pins.SERIAL2_TX < 0) {
+        _message.serialPrintf("Modbus RTU disabled - SERIAL2 pins not set \n");
+        return;
+      }
+
+      xTaskCreatePinnedToCore(TASKserveRTU, "MODBUS_RTU", MODBUS_TASK_MEM_STACK, NULL, 1, &rtuTask, 1);
+
+      if (rtuTask == NULL) {
+        _message.serialPrintf("Modbus RTU task failed to start \n");
+        return;
+      }
+
+      Serial2.begin(MODBUS_RTU_BAUD, SERIAL_8N1, pins.SERIAL2_RX, pins.SERIAL2_TX);
+      Serial2.setRxTimeout(MODBUS_RTU_RX_TIMEOUT);
+      Serial2.onReceive(onRTUReceive, true);
+      _message.serialPrintf("Modbus RTU server on Serial2, unit %d \n", MODBUS_UNIT_ID);
+    }
+  #endif
+
+}
+
+
+
+
+/***********************************************************
+ * @brief publish
+ * @details Encode the current sensor values into the register image
+ * @note Called by the sensor task after each acquisition cycle
+ ***/
+void Modbus::publish() {
+
+  extern struct SensorData sensorVal;
+  extern struct DeviceStatus status;
+  extern struct Pins pins;
+  extern Recorder _recorder;
+
+  uint8_t image[MODBUS_IMAGE_SIZE];
+  uint16_t statusBits = 0;
+
+  for (size_t i = 0; i < MODBUS_FLOAT_COUNT; i++) {
+    float value = sensorVal.*floatRegister[i];
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    putWord(image + i * 4, bits >> 16);
+    putWord(image + i * 4 + 2, bits & 0xFFFF);
+  }
+
+  if (pins.VAC_BANK_1 >= 0 && digitalRead(pins.VAC_BANK_1) == HIGH) statusBits |= (1 << MODBUS_STATUS_BENCH_ON);
+  if (status.apMode) statusBits |= (1 << MODBUS_STATUS_AP_MODE);
+  if (status.doBootLoop) statusBits |= (1 << MODBUS_STATUS_BOOT_LOOP);
+  if (_recorder.isRecording()) statusBits |= (1 << MODBUS_STATUS_RECORDING);
+
+  uint32_t uptime = millis() / 1000;
+
+  putWord(image + MODBUS_REG_STATUS * 2, statusBits);
+  putWord(image + MODBUS_REG_SAMPLE * 2, ++sampleCount);
+  putWord(image + MODBUS_REG_UPTIME * 2, uptime >> 16);
+  putWord(image + MODBUS_REG_UPTIME * 2 + 2, uptime & 0xFFFF);
+
+  imageSequence.fetch_add(1, std::memory_order_relaxed);    // odd - update in progress
+  std::atomic_thread_fence(std::memory_order_release);
+  memcpy(registerImage, image, sizeof(registerImage));
+  imageSequence.fetch_add(1, std::memory_order_release);    // even - image consistent
+
+}
+
+
+
+
+/***********************************************************
+ * @brief readImage
+ * @details Copy a consistent register image
+ ***/
+void Modbus::readImage(uint8_t *image) {
+
+  uint32_t before;
+  uint32_t after;
+
+  do {
+    before = imageSequence.load(std::memory_order_acquire);
+    memcpy(image, registerImage, MODBUS_IMAGE_SIZE);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    after = imageSequence.load(std::memory_order_relaxed);
+  } while ((before & 1) || before != after);
+
+}
+
+
+
+
+/***********************************************************
+ * @brief processPDU
+ * @details Answer one request PDU (function code + data)
+ * @returns response PDU length (normal or exception response)
+ ***/
+size_t Modbus::processPDU(const uint8_t *request, size_t length, uint8_t *response) {
+
+  uint8_t image[MODBUS_IMAGE_SIZE];
+  uint8_t function = request[0];
+  uint8_t exception = 0;
+
+  response[0] = function;
+
+  if (length < 5) {
+    exception = (function == MODBUS_READ_DISCRETE_INPUTS || function == MODBUS_READ_HOLDING_REGISTERS || function == MODBUS_READ_INPUT_REGISTERS) ? MODBUS_ILLEGAL_VALUE : MODBUS_ILLEGAL_FUNCTION;
+  } else {
+
+    uint16_t address = (request[1] << 8) | request[2];
+    uint16_t count = (request[3] << 8) | request[4];
+
+    switch (function) {
+
+      case MODBUS_READ_HOLDING_REGISTERS:
+      case MODBUS_READ_INPUT_REGISTERS:
+        if (count == 0 || count > MODBUS_MAX_READ_REGISTERS) {
+          exception = MODBUS_ILLEGAL_VALUE;
+        } else if (address + count > MODBUS_REGISTER_COUNT) {
+          exception = MODBUS_ILLEGAL_ADDRESS;
+        } else {
+          readImage(image);
+          response[1] = count * 2;
+          memcpy(response + 2, image + address * 2, count * 2);
+          return 2 + count * 2;
+        }
+        break;
+
+      case MODBUS_READ_DISCRETE_INPUTS:
+        if (count == 0 || count > MODBUS_MAX_READ_BITS) {
+          exception = MODBUS_ILLEGAL_VALUE;
+        } else if (address + count > 16) {
+          exception = MODBUS_ILLEGAL_ADDRESS;
+        } else {
+          readImage(image);
+          uint16_t bits = ((image[MODBUS_REG_STATUS * 2] << 8) | image[MODBUS_REG_STATUS * 2 + 1]) >> address;
+          bits &= (1UL << count) - 1;
+          response[1] = (count + 7) / 8;
+          response[2] = bits & 0xFF;
+          response[3] = bits >> 8;
+          return 2 + response[1];
+        }
+        break;
+
+      default:
+        exception = MODBUS_ILLEGAL_FUNCTION;
+        break;
+    }
+  }
+
+  response[0] = function | 0x80;
+  response[1] = exception;
+
+  return 2;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief crc16
+ * @details Modbus RTU CRC (poly 0xA001 reflected, init 0xFFFF). Sent low byte first
+ ***/
+uint16_t Modbus::crc16(const uint8_t *data, size_t length) {
+
+  uint16_t crc = 0xFFFF;
+
+  for (size_t i = 0; i < length; i++) {
+    crc ^= data[i];
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+    }
+  }
+
+  return crc;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief onRTUReceive
+ * @details UART event callback - fires on the inter frame gap (RX timeout)
+ ***/
+void Modbus::onRTUReceive() {
+
+  if (rtuTask != NULL) xTaskNotifyGive(rtuTask);
+
+}
+
+
+
+
+/***********************************************************
+ * @brief TASKserveRTU
+ * @details Answer RTU requests addressed to MODBUS_UNIT_ID. Broadcasts (unit 0) get no response
+ * @note Frames with a bad CRC are silently ignored as the spec requires
+ ***/
+void Modbus::TASKserveRTU(void *parameter) {
+
+  uint8_t frame[MODBUS_MAX_PDU + 3];
+  uint8_t response[MODBUS_MAX_PDU + 3];
+
+  for (;;) {
+
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    size_t length = 0;
+    while (Serial2.available() > 0) {
+      int c = Serial2.read();
+      if (length < sizeof(frame)) frame[length++] = c;
+    }
+
+    if (length < 4 || (frame[0] != MODBUS_UNIT_ID && frame[0] != 0)) continue;
+
+    uint16_t crc = frame[length - 2] | (frame[length - 1] << 8);
+    if (crc != crc16(frame, length - 2)) continue;
+
+    size_t pduLength = processPDU(frame + 1, length - 3, response + 1);
+
+    if (frame[0] == 0) continue;
+
+    response[0] = MODBUS_UNIT_ID;
+    crc = crc16(response, pduLength + 1);
+    response[pduLength + 1] = crc & 0xFF;
+    response[pduLength + 2] = crc >> 8;
+    Serial2.write(response, pduLength + 3);
+  }
+
+}
@@ -0,0 +1,75 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file modbus.h
+ *
+ * @brief Modbus class header file
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * Read only Modbus server for PLC / SCADA polling. Modbus TCP on MODBUS_TCP_PORT (MODBUS_TCP_ENABLED)
+ * and Modbus RTU on Serial2 using the SERIAL2_RX / SERIAL2_TX pins (MODBUS_RTU_ENABLED).
+ *
+ * The sensor task encodes each sample into a register image in wire order, so a read is a copy of
+ * the requested range. Holding registers (FC03) and input registers (FC04) return the same image.
+ *
+ *   Register  Type        Value
+ *   0         float32     FlowCFM
+ *   2         float32     FlowSCFM
+ *   4         float32     FlowADJ
+ *   6         float32     FlowADJSCFM
+ *   8         float32     FlowKGH
+ *   10        float32     PRefKPA
+ *   12        float32     PRefH2O
+ *   14        float32     PDiffKPA
+ *   16        float32     PDiffH2O
+ *   18        float32     PitotKPA
+ *   20        float32     PitotH2O
+ *   22        float32     TempDegC
+ *   24        float32     RelH
+ *   26        float32     BaroHPA
+ *   28        float32     Swirl
+ *   30        float32     MafVolts
+ *   32        uint16      Status bits (MODBUS_STATUS_xxx, also readable as discrete inputs with FC02)
+ *   33        uint16      Sample counter (increments with every published sample)
+ *   34        uint32      Uptime (seconds)
+ *
+ * 32 bit values are big endian, high word first (ABCD).
+ *
+ ***/
+#pragma once
+
+#include <Arduino.h>
+
+#include "system.h"
+#include "constants.h"
+
+#define MODBUS_REGISTER_COUNT 36
+
+
+class Modbus {
+
+	private:
+
+		static void TASKserveRTU(void *parameter);
+		static void onRTUReceive();
+		static void readImage(uint8_t *image);
+
+	public:
+
+		Modbus();
+
+		static void begin();
+		static void publish();
+		static size_t processPDU(const uint8_t *request, size_t length, uint8_t *response);
+		static uint16_t crc16(const uint8_t *data, size_t length);
+
+};
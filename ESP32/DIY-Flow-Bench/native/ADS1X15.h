@@ -0,0 +1,57 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file ADS1X15.h
+ *
+ * @brief Host (native) ADS1115 ADC
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * ADS1115 driver over the fake I2C bus. The fake device's registers are byte wide, so the 16 bit config
+ * register (0x01) would overlap the conversion register (0x00) and is not written. readADC() returns the
+ * conversion register for every channel, a test sets the reading with
+ * HAL::i2cWriteRegister16(address, 0x00, counts).
+ *
+ ***/
+#pragma once
+
+#include "Arduino.h"
+#include "Wire.h"
+
+
+#define ADS1X15_REG_CONVERSION 0x00
+
+
+class ADS_1115 {
+
+	private:
+
+		uint8_t address;
+		uint8_t gain = 0;
+
+	public:
+
+		explicit ADS_1115(uint8_t address) : address(address) {}
+
+		bool begin() { return isConnected(); }
+		bool isConnected() { Wire.beginTransmission(address); return Wire.endTransmission() == 0; }
+		void setGain(uint8_t value) { gain = value; }
+		uint8_t getGain() { return gain; }
+
+		int16_t readADC(uint8_t channel) {
+			Wire.beginTransmission(address);
+			Wire.write(ADS1X15_REG_CONVERSION);
+			if (Wire.endTransmission() != 0 || Wire.requestFrom(address, (size_t)2) != 2) return 0;
+			uint16_t counts = Wire.read() << 8;
+			return (int16_t)(counts | Wire.read());
+		}
+
+};
@@ -0,0 +1,180 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file Arduino.h
+ *
+ * @brief Host (native) Arduino core
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * Clock, GPIO, Serial, String and ESP for the native build. Like the ESP32 core it pulls in the FreeRTOS
+ * and esp_timer headers. See hal.h for the controls.
+ *
+ ***/
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <functional>
+
+#include "WString.h"
+#include "Print.h"
+#include "pgmspace.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "hal.h"
+
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 0x1
+#define LOW 0x0
+
+#define PI 3.1415926535897932384626433832795
+#define HALF_PI 1.5707963267948966192313216916398
+#define TWO_PI 6.283185307179586476925286766559
+#define DEG_TO_RAD 0.017453292519943295769236907684886
+#define RAD_TO_DEG 57.295779513082320876798154814105
+
+// Declared only, the native build has no hardware timers
+typedef struct hw_timer_s hw_timer_t;
+
+#define IRAM_ATTR
+#define F(text) (text)
+
+using std::min;
+using std::max;
+
+template <typename T, typename L, typename H> T constrain(T value, L low, H high) {
+	return (value < low) ? low : ((value > high) ? high : value);
+}
+
+inline long map(long value, long inMin, long inMax, long outMin, long outMax) {
+	return (value - inMin) * (outMax - outMin) / (inMax - inMin) + outMin;
+}
+
+// glibc gained strlcpy in 2.38, macOS has always had it
+#if defined(__GLIBC__) && (__GLIBC__ < 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ < 38))
+inline size_t strlcpy(char *destination, const char *source, size_t size) {
+	size_t length = strlen(source);
+	if (size) {
+		size_t copy = (length >= size) ? size - 1 : length;
+		memcpy(destination, source, copy);
+		destination[copy] = 0;
+	}
+	return length;
+}
+#endif
+
+
+/***********************************************************
+ * Clock
+ ***/
+unsigned long millis();
+unsigned long micros();
+void delay(uint32_t timeMs);
+void delayMicroseconds(uint32_t timeUs);
+
+
+/***********************************************************
+ * Random - esp_random() is std::random_device backed
+ ***/
+uint32_t esp_random();
+
+
+/***********************************************************
+ * GPIO - pin levels and analog readings are set with HAL::setPin() / HAL::setAnalog()
+ ***/
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define PULLUP 0x04
+#define INPUT_PULLUP 0x05
+#define PULLDOWN 0x08
+#define INPUT_PULLDOWN 0x09
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+uint16_t analogRead(uint8_t pin);
+
+
+/***********************************************************
+ * Serial - Serial writes to stdout (or the capture buffer), Serial2 is always captured. Both read input
+ * queued with HAL::serialInput() and run the onReceive() callback when it arrives
+ ***/
+#define SERIAL_8N1 0x800001c
+
+typedef std::function<void(void)> OnReceiveCb;
+
+class HardwareSerial : public Print {
+
+	private:
+
+		int uart;
+
+	public:
+
+		explicit HardwareSerial(int number) : uart(number) {}
+
+		void begin(unsigned long baud, uint32_t config = SERIAL_8N1, int8_t rxPin = -1, int8_t txPin = -1) {}
+		void end() {}
+		operator bool() const { return true; }
+
+		void onReceive(OnReceiveCb function, bool onlyOnTimeout = false);
+		bool setRxTimeout(uint8_t symbols) { return true; }
+		size_t setRxBufferSize(size_t size) { return size; }
+
+		int available();
+		int read();
+		int peek();
+
+		using Print::write;
+		size_t write(uint8_t value) override;
+		size_t write(const uint8_t *buffer, size_t size) override;
+		void flush() override;
+
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial2;
+
+
+/***********************************************************
+ * ESP - heap figures are nominal ESP32 values
+ ***/
+class EspClass {
+
+	public:
+
+		uint32_t getHeapSize() { return 320 * 1024; }
+		uint32_t getFreeHeap() { return 200 * 1024; }
+		uint32_t getMinFreeHeap() { return 180 * 1024; }
+		uint32_t getMaxAllocHeap() { return 110 * 1024; }
+		uint32_t getFreeSketchSpace() { return 1920 * 1024; }
+		uint32_t getPsramSize() { return 0; }
+		uint32_t getFreePsram() { return 0; }
+		const char * getChipModel() { return "native"; }
+		uint32_t getCpuFreqMHz() { return 240; }
+		uint32_t getCycleCount() { return micros() * getCpuFreqMHz(); }
+		void restart();
+
+};
+
+extern EspClass ESP;
@@ -0,0 +1,96 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file AsyncTCP.h
+ *
+ * @brief Host (native) AsyncTCP
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * In-process TCP. There are no sockets, a test connects to a listening AsyncServer with connect() and
+ * plays the peer through the returned client: receive() delivers bytes to the onData() handler and
+ * sent() takes what the server wrote. Handlers run in the calling thread.
+ *
+ * As with AsyncTCP the disconnect handler may delete the client, so a client must not be used once it
+ * has been closed. exists() tells whether a client the test holds has been deleted by the server.
+ *
+ ***/
+#pragma once
+
+#include <string>
+
+#include "Arduino.h"
+#include "IPAddress.h"
+
+
+class AsyncClient;
+
+typedef std::function<void(void *, AsyncClient *)> AcConnectHandler;
+typedef std::function<void(void *, AsyncClient *, void *data, size_t length)> AcDataHandler;
+
+
+class AsyncClient {
+
+	private:
+
+		AcDataHandler dataHandler;
+		void *dataArg = NULL;
+		AcConnectHandler disconnectHandler;
+		void *disconnectArg = NULL;
+		std::string transmitted;
+		bool open = true;
+
+	public:
+
+		AsyncClient();
+		~AsyncClient();
+
+		void onData(AcDataHandler handler, void *arg = NULL) { dataHandler = handler; dataArg = arg; }
+		void onDisconnect(AcConnectHandler handler, void *arg = NULL) { disconnectHandler = handler; disconnectArg = arg; }
+
+		size_t write(const char *data, size_t size) { if (!open) return 0; transmitted.append(data, size); return size; }
+		size_t write(const char *data) { return write(data, strlen(data)); }
+		size_t space() { return 5744; }
+		void setNoDelay(bool noDelay) {}
+		bool connected() { return open; }
+		IPAddress remoteIP() { return IPAddress(127, 0, 0, 1); }
+		void close(bool now = false);
+
+		// Host side - act as the peer
+		void receive(const void *data, size_t length);
+		std::string sent() { std::string data; data.swap(transmitted); return data; }
+		static bool exists(const AsyncClient *client);
+
+};
+
+
+class AsyncServer {
+
+	private:
+
+		uint16_t port;
+		AcConnectHandler clientHandler;
+		void *clientArg = NULL;
+		bool listening = false;
+
+	public:
+
+		explicit AsyncServer(uint16_t port) : port(port) {}
+		~AsyncServer() { end(); }
+
+		void onClient(AcConnectHandler handler, void *arg) { clientHandler = handler; clientArg = arg; }
+		void begin();
+		void end();
+
+		// Host side - open a connection to the server listening on port (NULL if none)
+		static AsyncClient * connect(uint16_t port);
+
+};
@@ -0,0 +1,371 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file ESPAsyncWebServer.h
+ *
+ * @brief Host (native) ESPAsyncWebServer
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * In-process web server with the ESPAsyncWebServer 3.x API used by the firmware. There is no HTTP, a
+ * test builds an AsyncWebServerRequest (method, url, parameters, headers, optional upload) and passes
+ * it to AsyncWebServer::handle(), which applies rewrites and middleware and runs the matching handler
+ * in the calling thread. The response is then read back with AsyncWebServerResponse::body(), which
+ * expands template placeholders (TEMPLATE_PLACEHOLDER) or drains a chunked filler as the library would.
+ *
+ * Event sources hold their subscribers as AsyncEventSourceClients. connect() (or a GET of the source's
+ * url) opens a subscriber, write() queues shared messages up to SSE_MAX_QUEUED_MESSAGES and deliver()
+ * plays the network taking them off the queue.
+ *
+ ***/
+#pragma once
+
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "Arduino.h"
+#include "FS.h"
+#include "AsyncTCP.h"
+
+
+#ifndef TEMPLATE_PLACEHOLDER
+#define TEMPLATE_PLACEHOLDER '%'
+#endif
+
+#define TEMPLATE_PARAM_NAME_LENGTH 32
+#define SSE_MAX_QUEUED_MESSAGES 32
+#define RESPONSE_TRY_AGAIN 0xFFFFFFFF
+
+namespace asyncsrv {
+	static constexpr const char *empty = "";
+	static constexpr const char *T_text_html = "text/html";
+	static constexpr const char *T_text_plain = "text/plain";
+	static constexpr const char *T_application_json = "application/json";
+	static constexpr const char *T_Content_Encoding = "Content-Encoding";
+	static constexpr const char *T_gzip = "gzip";
+}
+
+typedef enum {
+	HTTP_GET = 0b00000001,
+	HTTP_POST = 0b00000010,
+	HTTP_DELETE = 0b00000100,
+	HTTP_PUT = 0b00001000,
+	HTTP_PATCH = 0b00010000,
+	HTTP_HEAD = 0b00100000,
+	HTTP_OPTIONS = 0b01000000,
+	HTTP_ANY = 0b01111111
+} WebRequestMethod;
+
+typedef uint8_t WebRequestMethodComposite;
+
+class AsyncWebServer;
+class AsyncWebServerRequest;
+class AsyncWebServerResponse;
+class AsyncEventSource;
+class AsyncEventSourceClient;
+
+// Web sockets are named by the firmware but not used
+class AsyncWebSocket;
+class AsyncWebSocketClient;
+
+typedef enum {
+	WS_EVT_CONNECT,
+	WS_EVT_DISCONNECT,
+	WS_EVT_PING,
+	WS_EVT_PONG,
+	WS_EVT_ERROR,
+	WS_EVT_DATA
+} AwsEventType;
+
+typedef std::function<void(AsyncWebServerRequest *request)> ArRequestHandlerFunction;
+typedef std::function<void(AsyncWebServerRequest *request, const String &filename, size_t index, uint8_t *data, size_t length, bool final)> ArUploadHandlerFunction;
+typedef std::function<void(AsyncWebServerRequest *request, uint8_t *data, size_t length, size_t index, size_t total)> ArBodyHandlerFunction;
+typedef std::function<void(void)> ArDisconnectHandler;
+typedef std::function<void(void)> ArMiddlewareNext;
+typedef std::function<void(AsyncWebServerRequest *request, ArMiddlewareNext next)> ArMiddlewareCallback;
+typedef std::function<size_t(uint8_t *buffer, size_t maxLength, size_t index)> AwsResponseFiller;
+typedef std::function<String(const String &var)> AwsTemplateProcessor;
+typedef std::function<void(AsyncEventSourceClient *client)> ArEventHandlerFunction;
+typedef std::shared_ptr<String> AsyncEvent_SharedData_t;
+
+
+class AsyncWebParameter {
+
+	private:
+
+		String paramName;
+		String paramValue;
+		bool form;
+
+	public:
+
+		AsyncWebParameter(const String &name, const String &value, bool post = false) : paramName(name), paramValue(value), form(post) {}
+
+		const String & name() const { return paramName; }
+		const String & value() const { return paramValue; }
+		size_t size() const { return paramValue.length(); }
+		bool isPost() const { return form; }
+		bool isFile() const { return false; }
+
+};
+
+
+class AsyncWebHeader {
+
+	private:
+
+		String headerName;
+		String headerValue;
+
+	public:
+
+		AsyncWebHeader(const String &name, const String &value) : headerName(name), headerValue(value) {}
+
+		const String & name() const { return headerName; }
+		const String & value() const { return headerValue; }
+		String toString() const { return headerName + ": " + headerValue + "\r\n"; }
+
+};
+
+
+class AsyncWebServerResponse {
+
+	private:
+
+		int responseCode;
+		String type;
+		std::vector<AsyncWebHeader> headers;
+		String content;
+		AwsResponseFiller filler;
+		AwsTemplateProcessor processor;
+
+	public:
+
+		AsyncWebServerResponse(int code, const String &contentType, const String &text = String(), AwsTemplateProcessor callback = nullptr);
+		AsyncWebServerResponse(int code, const String &contentType, AwsResponseFiller source, AwsTemplateProcessor callback = nullptr);
+
+		bool addHeader(const char *name, const char *value, bool replace = true);
+		bool addHeader(const String &name, const String &value, bool replace = true) { return addHeader(name.c_str(), value.c_str(), replace); }
+		void setCode(int code) { responseCode = code; }
+
+		// Host side
+		int code() const { return responseCode; }
+		const String & contentType() const { return type; }
+		const AsyncWebHeader * getHeader(const char *name) const;
+		String body(size_t chunkSize = 0);   // chunked fillers are drained chunkSize bytes at a time (0 = one TCP segment)
+
+};
+
+
+class AsyncWebServerRequest {
+
+	private:
+
+		WebRequestMethodComposite requestMethod;
+		String requestUrl;
+		std::vector<AsyncWebParameter> parameters;
+		std::vector<AsyncWebHeader> headers;
+		AsyncWebServerResponse *requestResponse = NULL;
+		ArDisconnectHandler disconnectHandler;
+		String uploadName;
+		std::string uploadData;
+		bool hasUpload = false;
+
+		friend class AsyncWebServer;
+
+	public:
+
+		File _tempFile;
+		void *_tempObject = NULL;
+
+		AsyncWebServerRequest(WebRequestMethodComposite method, const String &url) : requestMethod(method), requestUrl(url) {}
+		~AsyncWebServerRequest();
+
+		WebRequestMethodComposite method() const { return requestMethod; }
+		const String & url() const { return requestUrl; }
+
+		size_t params() const { return parameters.size(); }
+		bool hasParam(const char *name, bool post = false, bool file = false) const { return getParam(name, post, file) != NULL; }
+		bool hasParam(const String &name, bool post = false, bool file = false) const { return hasParam(name.c_str(), post, file); }
+		const AsyncWebParameter * getParam(const char *name, bool post = false, bool file = false) const;
+		const AsyncWebParameter * getParam(const String &name, bool post = false, bool file = false) const { return getParam(name.c_str(), post, file); }
+		const AsyncWebParameter * getParam(size_t number) const { return (number < parameters.size()) ? &parameters[number] : NULL; }
+		bool hasArg(const char *name) const { return getParam(name) != NULL || getParam(name, true) != NULL; }
+		const String & arg(const char *name) const;
+
+		bool hasHeader(const char *name) const { return getHeader(name) != NULL; }
+		const AsyncWebHeader * getHeader(const char *name) const;
+
+		void onDisconnect(ArDisconnectHandler handler) { disconnectHandler = handler; }
+
+		void redirect(const char *url, int code = 302);
+		void send(AsyncWebServerResponse *response);
+		void send(int code, const char *contentType = asyncsrv::empty, const char *content = asyncsrv::empty, AwsTemplateProcessor callback = nullptr) { send(beginResponse(code, contentType, content, callback)); }
+		void send(int code, const char *contentType, const String &content, AwsTemplateProcessor callback = nullptr) { send(beginResponse(code, contentType, content, callback)); }
+		void send(int code, const String &contentType, const String &content = String(), AwsTemplateProcessor callback = nullptr) { send(beginResponse(code, contentType, content, callback)); }
+		void send(int code, const char *contentType, const uint8_t *content, size_t length, AwsTemplateProcessor callback = nullptr) { send(beginResponse(code, contentType, content, length, callback)); }
+		void send(FS &fs, const String &path, const String &contentType = String(), bool download = false, AwsTemplateProcessor callback = nullptr);
+
+		AsyncWebServerResponse * beginResponse(int code, const char *contentType = asyncsrv::empty, const char *content = asyncsrv::empty, AwsTemplateProcessor callback = nullptr) { return new AsyncWebServerResponse(code, contentType, String(content), callback); }
+		AsyncWebServerResponse * beginResponse(int code, const char *contentType, const String &content, AwsTemplateProcessor callback = nullptr) { return new AsyncWebServerResponse(code, contentType, content, callback); }
+		AsyncWebServerResponse * beginResponse(int code, const String &contentType, const String &content = String(), AwsTemplateProcessor callback = nullptr) { return new AsyncWebServerResponse(code, contentType, content, callback); }
+		AsyncWebServerResponse * beginResponse(int code, const char *contentType, const uint8_t *content, size_t length, AwsTemplateProcessor callback = nullptr) { return new AsyncWebServerResponse(code, contentType, String((const char *)content, length), callback); }
+		AsyncWebServerResponse * beginChunkedResponse(const char *contentType, AwsResponseFiller callback, AwsTemplateProcessor templateCallback = nullptr) { return new AsyncWebServerResponse(200, contentType, callback, templateCallback); }
+
+		// Host side - build the request and read the response
+		void addParam(const String &name, const String &value, bool post = false) { parameters.push_back(AsyncWebParameter(name, value, post)); }
+		void addHeader(const String &name, const String &value) { headers.push_back(AsyncWebHeader(name, value)); }
+		void setUpload(const String &filename, const uint8_t *data, size_t length) { uploadName = filename; uploadData.assign((const char *)data, length); hasUpload = true; }
+		AsyncWebServerResponse * response() { return requestResponse; }
+		void disconnect() { if (disconnectHandler) disconnectHandler(); disconnectHandler = nullptr; }
+
+};
+
+
+class AsyncWebHandler {
+
+	public:
+
+		virtual ~AsyncWebHandler() {}
+		virtual bool canHandle(AsyncWebServerRequest *request) const { return false; }
+		virtual void handleRequest(AsyncWebServerRequest *request) {}
+		virtual void handleUpload(AsyncWebServerRequest *request, const String &filename, size_t index, uint8_t *data, size_t length, bool final) {}
+		virtual bool isRequestHandlerTrivial() const { return true; }
+
+};
+
+
+class AsyncCallbackWebHandler : public AsyncWebHandler {
+
+	private:
+
+		String uri;
+		WebRequestMethodComposite methods;
+		ArRequestHandlerFunction onRequest;
+		ArUploadHandlerFunction onUpload;
+
+	public:
+
+		AsyncCallbackWebHandler(const char *path, WebRequestMethodComposite method, ArRequestHandlerFunction request, ArUploadHandlerFunction upload) : uri(path), methods(method), onRequest(request), onUpload(upload) {}
+
+		bool canHandle(AsyncWebServerRequest *request) const override;
+		void handleRequest(AsyncWebServerRequest *request) override { if (onRequest) onRequest(request); else request->send(500); }
+		void handleUpload(AsyncWebServerRequest *request, const String &filename, size_t index, uint8_t *data, size_t length, bool final) override { if (onUpload) onUpload(request, filename, index, data, length, final); }
+		bool hasUploadHandler() const { return (bool)onUpload; }
+
+};
+
+
+class AsyncEventSourceClient {
+
+	private:
+
+		AsyncEventSource *source;
+		AsyncClient tcpClient;
+		mutable std::mutex queueMutex;
+		std::deque<AsyncEvent_SharedData_t> queue;
+		bool open = true;
+		std::string stream;
+
+	public:
+
+		explicit AsyncEventSourceClient(AsyncEventSource *server) : source(server) {}
+
+		AsyncClient * client() { return &tcpClient; }
+		bool connected() const { return open; }
+		void close();
+
+		bool write(AsyncEvent_SharedData_t message);
+		bool send(const char *message, const char *event = NULL, uint32_t id = 0, uint32_t reconnect = 0);
+		size_t packetsWaiting() const { std::lock_guard<std::mutex> lock(queueMutex); return queue.size(); }
+
+		// Host side - the network takes up to count messages off the queue (returns the number taken),
+		// received() returns what has been delivered since it was last called
+		size_t deliver(size_t count = (size_t)-1);
+		std::string received() { std::lock_guard<std::mutex> lock(queueMutex); std::string text; text.swap(stream); return text; }
+
+};
+
+
+class AsyncEventSource : public AsyncWebHandler {
+
+	private:
+
+		String path;
+		mutable std::mutex clientMutex;
+		std::list<AsyncEventSourceClient *> clients;
+		ArEventHandlerFunction connectHandler;
+		ArEventHandlerFunction disconnectHandler;
+
+		friend class AsyncEventSourceClient;
+		void closed(AsyncEventSourceClient *client);
+
+	public:
+
+		explicit AsyncEventSource(const char *url) : path(url) {}
+		~AsyncEventSource();
+
+		const char * url() const { return path.c_str(); }
+		void onConnect(ArEventHandlerFunction handler) { connectHandler = handler; }
+		void onDisconnect(ArEventHandlerFunction handler) { disconnectHandler = handler; }
+		void close();
+		void send(const char *message, const char *event = NULL, uint32_t id = 0, uint32_t reconnect = 0);
+		size_t count() const;
+		size_t avgPacketsWaiting() const;
+
+		bool canHandle(AsyncWebServerRequest *request) const override { return request->method() == HTTP_GET && request->url() == path; }
+		void handleRequest(AsyncWebServerRequest *request) override { connect(); request->send(200, "text/event-stream"); }
+
+		// Host side - open a subscriber (runs the connect handler, which may close it again)
+		AsyncEventSourceClient * connect();
+
+};
+
+
+class AsyncWebServer {
+
+	private:
+
+		uint16_t port;
+		std::list<AsyncWebHandler *> handlers;
+		std::vector<std::pair<String, String> > rewrites;
+		std::vector<ArMiddlewareCallback> middleware;
+		ArRequestHandlerFunction notFoundHandler;
+		ArUploadHandlerFunction uploadHandler;
+
+		void dispatch(AsyncWebServerRequest *request);
+
+	public:
+
+		explicit AsyncWebServer(uint16_t port) : port(port) {}
+		~AsyncWebServer();
+
+		void begin();
+		void end();
+		void reset();
+
+		AsyncCallbackWebHandler & on(const char *uri, WebRequestMethodComposite method, ArRequestHandlerFunction onRequest, ArUploadHandlerFunction onUpload = nullptr, ArBodyHandlerFunction onBody = nullptr);
+		AsyncCallbackWebHandler & on(const char *uri, ArRequestHandlerFunction onRequest) { return on(uri, HTTP_ANY, onRequest); }
+		AsyncWebHandler & addHandler(AsyncWebHandler *handler) { handlers.push_back(handler); return *handler; }
+		void rewrite(const char *from, const char *to) { rewrites.push_back(std::make_pair(String(from), String(to))); }
+		void addMiddleware(ArMiddlewareCallback callback) { middleware.push_back(callback); }
+		void onNotFound(ArRequestHandlerFunction handler) { notFoundHandler = handler; }
+		void onFileUpload(ArUploadHandlerFunction handler) { uploadHandler = handler; }
+
+		// Host side - run a request through the server, returns its response (NULL if none was sent)
+		AsyncWebServerResponse * handle(AsyncWebServerRequest *request);
+		AsyncEventSource * eventSource(const char *url);
+		static AsyncWebServer * find(uint16_t port);
+
+};
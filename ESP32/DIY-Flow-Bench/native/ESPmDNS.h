@@ -0,0 +1,34 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file ESPmDNS.h
+ *
+ * @brief Host (native) mDNS responder
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ ***/
+#pragma once
+
+#include "Arduino.h"
+
+
+class MDNSResponder {
+
+	public:
+
+		bool begin(const char *hostName) { return hostName != NULL && hostName[0] != 0; }
+		void end() {}
+		bool addService(const char *service, const char *protocol, uint16_t port) { return true; }
+
+};
+
+extern MDNSResponder MDNS;
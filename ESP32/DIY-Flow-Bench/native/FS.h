@@ -0,0 +1,138 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file FS.h
+ *
+ * @brief Host (native) file system
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * fs::FS maps firmware paths onto a host directory. fs::File wraps a stdio stream or, for a directory,
+ * a listing walked with openNextFile(). Paths returned by path() are firmware paths ("/index.html").
+ *
+ ***/
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "Arduino.h"
+
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+
+namespace fs {
+
+	enum SeekMode {
+		SeekSet = 0,
+		SeekCur = 1,
+		SeekEnd = 2
+	};
+
+
+	struct FileImpl;
+
+
+	class File : public Print {
+
+		private:
+
+			std::shared_ptr<FileImpl> impl;
+
+		public:
+
+			File() {}
+			explicit File(std::shared_ptr<FileImpl> file) : impl(file) {}
+
+			operator bool() const;
+
+			using Print::write;
+			size_t write(uint8_t value) override { return write(&value, 1); }
+			size_t write(const uint8_t *buffer, size_t size) override;
+
+			int available();
+			int read();
+			int peek();
+			size_t read(uint8_t *buffer, size_t size);
+			size_t readBytes(char *buffer, size_t length) { return read((uint8_t *)buffer, length); }
+			void flush() override;
+			bool seek(uint32_t position, SeekMode mode = SeekSet);
+			size_t position() const;
+			size_t size() const;
+			void close();
+
+			const char * path() const;
+			const char * name() const;
+			bool isDirectory() const;
+			File openNextFile(const char *mode = FILE_READ);
+			void rewindDirectory();
+
+	};
+
+
+	class FS {
+
+		protected:
+
+			String root;
+
+			String hostPath(const char *path) const;
+
+		public:
+
+			explicit FS(const char *directory) : root(directory) {}
+
+			File open(const char *path, const char *mode = FILE_READ, const bool create = false);
+			File open(const String &path, const char *mode = FILE_READ, const bool create = false) { return open(path.c_str(), mode, create); }
+			bool exists(const char *path);
+			bool exists(const String &path) { return exists(path.c_str()); }
+			bool remove(const char *path);
+			bool remove(const String &path) { return remove(path.c_str()); }
+			bool rename(const char *pathFrom, const char *pathTo);
+			bool mkdir(const char *path);
+			bool rmdir(const char *path);
+
+	};
+
+}
+
+using fs::FS;
+using fs::File;
+using fs::SeekMode;
+using fs::SeekSet;
+using fs::SeekCur;
+using fs::SeekEnd;
+
+
+/***********************************************************
+ * Mountable flash file system (LittleFS / SPIFFS) on a host directory
+ ***/
+class HostFlashFS : public fs::FS {
+
+	private:
+
+		const char *directory;
+		bool mounted = false;
+
+	public:
+
+		explicit HostFlashFS(const char *name) : fs::FS(""), directory(name) {}
+
+		bool begin(bool formatOnFail = false, const char *basePath = NULL, uint8_t maxOpenFiles = 10, const char *partitionLabel = NULL);
+		void end() { mounted = false; root = ""; }
+		bool format();
+		size_t totalBytes() { return 1408 * 1024; }
+		size_t usedBytes();
+
+};
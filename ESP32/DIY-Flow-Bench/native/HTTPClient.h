@@ -0,0 +1,38 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file HTTPClient.h
+ *
+ * @brief Host (native) HTTP client
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * There is no network, GET() fails with HTTPC_ERROR_CONNECTION_REFUSED.
+ *
+ ***/
+#pragma once
+
+#include "Arduino.h"
+
+
+#define HTTPC_ERROR_CONNECTION_REFUSED (-1)
+
+
+class HTTPClient {
+
+	public:
+
+		bool begin(const String &url) { return true; }
+		int GET() { return HTTPC_ERROR_CONNECTION_REFUSED; }
+		String getString() { return String(); }
+		void end() {}
+
+};
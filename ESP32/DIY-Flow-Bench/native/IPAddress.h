@@ -0,0 +1,46 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file IPAddress.h
+ *
+ * @brief Host (native) IPv4 address
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ ***/
+#pragma once
+
+#include "Arduino.h"
+
+
+class IPAddress {
+
+	private:
+
+		uint8_t octet[4];
+
+	public:
+
+		IPAddress() : octet{0, 0, 0, 0} {}
+		IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : octet{a, b, c, d} {}
+		IPAddress(const uint8_t address[4]) : octet{address[0], address[1], address[2], address[3]} {}
+
+		uint8_t operator [] (int index) const { return octet[index]; }
+		bool operator == (const IPAddress &other) const { return memcmp(octet, other.octet, sizeof(octet)) == 0; }
+		bool operator != (const IPAddress &other) const { return !(*this == other); }
+
+		String toString() const {
+			char text[16];
+			snprintf(text, sizeof(text), "%u.%u.%u.%u", octet[0], octet[1], octet[2], octet[3]);
+			return String(text);
+		}
+
+};
@@ -0,0 +1,92 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file Preferences.h
+ *
+ * @brief Host (native) NVS preferences
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * In-memory NVS. Keys keep the type they were written with (getType()), and opening a namespace that
+ * does not exist read only fails, as on the ESP32.
+ *
+ ***/
+#pragma once
+
+#include "Arduino.h"
+
+
+typedef enum {
+	PT_I8, PT_U8, PT_I16, PT_U16, PT_I32, PT_U32, PT_I64, PT_U64, PT_STR, PT_BLOB, PT_INVALID
+} PreferenceType;
+
+
+class Preferences {
+
+	private:
+
+		String nameSpace;
+		bool started = false;
+		bool readOnly = false;
+
+		size_t put(const char *key, PreferenceType type, const void *value, size_t length);
+		size_t get(const char *key, PreferenceType type, void *value, size_t length);
+
+		template <typename T> size_t putValue(const char *key, PreferenceType type, T value) { return put(key, type, &value, sizeof(value)); }
+		template <typename T> T getValue(const char *key, PreferenceType type, T defaultValue) { T value; return (get(key, type, &value, sizeof(value)) == sizeof(value)) ? value : defaultValue; }
+
+	public:
+
+		bool begin(const char *name, bool readOnly = false, const char *partitionLabel = NULL);
+		void end() { started = false; }
+
+		bool clear();
+		bool remove(const char *key);
+		bool isKey(const char *key);
+		PreferenceType getType(const char *key);
+		size_t freeEntries();
+
+		size_t putChar(const char *key, int8_t value) { return putValue(key, PT_I8, value); }
+		size_t putUChar(const char *key, uint8_t value) { return putValue(key, PT_U8, value); }
+		size_t putShort(const char *key, int16_t value) { return putValue(key, PT_I16, value); }
+		size_t putUShort(const char *key, uint16_t value) { return putValue(key, PT_U16, value); }
+		size_t putInt(const char *key, int32_t value) { return putValue(key, PT_I32, value); }
+		size_t putUInt(const char *key, uint32_t value) { return putValue(key, PT_U32, value); }
+		size_t putLong(const char *key, int32_t value) { return putValue(key, PT_I32, value); }
+		size_t putULong(const char *key, uint32_t value) { return putValue(key, PT_U32, value); }
+		size_t putLong64(const char *key, int64_t value) { return putValue(key, PT_I64, value); }
+		size_t putULong64(const char *key, uint64_t value) { return putValue(key, PT_U64, value); }
+		size_t putFloat(const char *key, float value) { return putValue(key, PT_BLOB, value); }
+		size_t putDouble(const char *key, double value) { return putValue(key, PT_BLOB, value); }
+		size_t putBool(const char *key, bool value) { return putUChar(key, value ? 1 : 0); }
+		size_t putString(const char *key, const char *value) { return put(key, PT_STR, value, strlen(value) + 1) ? strlen(value) : 0; }
+		size_t putString(const char *key, const String &value) { return putString(key, value.c_str()); }
+		size_t putBytes(const char *key, const void *value, size_t length) { return put(key, PT_BLOB, value, length); }
+
+		int8_t getChar(const char *key, int8_t defaultValue = 0) { return getValue(key, PT_I8, defaultValue); }
+		uint8_t getUChar(const char *key, uint8_t defaultValue = 0) { return getValue(key, PT_U8, defaultValue); }
+		int16_t getShort(const char *key, int16_t defaultValue = 0) { return getValue(key, PT_I16, defaultValue); }
+		uint16_t getUShort(const char *key, uint16_t defaultValue = 0) { return getValue(key, PT_U16, defaultValue); }
+		int32_t getInt(const char *key, int32_t defaultValue = 0) { return getValue(key, PT_I32, defaultValue); }
+		uint32_t getUInt(const char *key, uint32_t defaultValue = 0) { return getValue(key, PT_U32, defaultValue); }
+		int32_t getLong(const char *key, int32_t defaultValue = 0) { return getValue(key, PT_I32, defaultValue); }
+		uint32_t getULong(const char *key, uint32_t defaultValue = 0) { return getValue(key, PT_U32, defaultValue); }
+		int64_t getLong64(const char *key, int64_t defaultValue = 0) { return getValue(key, PT_I64, defaultValue); }
+		uint64_t getULong64(const char *key, uint64_t defaultValue = 0) { return getValue(key, PT_U64, defaultValue); }
+		float getFloat(const char *key, float defaultValue = NAN) { return getValue(key, PT_BLOB, defaultValue); }
+		double getDouble(const char *key, double defaultValue = NAN) { return getValue(key, PT_BLOB, defaultValue); }
+		bool getBool(const char *key, bool defaultValue = false) { return getUChar(key, defaultValue ? 1 : 0) == 1; }
+		String getString(const char *key, const String defaultValue = String());
+		size_t getString(const char *key, char *value, size_t maxLength);
+		size_t getBytesLength(const char *key);
+		size_t getBytes(const char *key, void *buffer, size_t maxLength);
+
+};
@@ -0,0 +1,74 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file Print.h
+ *
+ * @brief Host (native) Print
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * Base class for character output, as in the ESP32 core. Subclasses supply write(), the print family
+ * and printf() format through it.
+ *
+ ***/
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "WString.h"
+
+
+class Print {
+
+	public:
+
+		virtual ~Print() {}
+
+		virtual size_t write(uint8_t value) = 0;
+		virtual size_t write(const uint8_t *buffer, size_t size) {
+			size_t count = 0;
+			while (size-- && write(*buffer++)) count++;
+			return count;
+		}
+		size_t write(const char *text) { return text ? write((const uint8_t *)text, strlen(text)) : 0; }
+		size_t write(const char *buffer, size_t size) { return write((const uint8_t *)buffer, size); }
+
+		size_t print(const char *text) { return write(text); }
+		size_t print(const String &text) { return write((const uint8_t *)text.c_str(), text.length()); }
+		size_t print(char value) { return write((uint8_t)value); }
+		template <typename T> size_t print(T value) { return print(String(value)); }
+		size_t println() { return write("\r\n"); }
+		template <typename T> size_t println(T value) { size_t count = print(value); return count + println(); }
+
+		size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3))) {
+			char buffer[256];
+			va_list args;
+			va_start(args, format);
+			int length = vsnprintf(buffer, sizeof(buffer), format, args);
+			va_end(args);
+			if (length < 0) return 0;
+			if ((size_t)length < sizeof(buffer)) return write((const uint8_t *)buffer, length);
+			char *heap = new char[length + 1];
+			va_start(args, format);
+			vsnprintf(heap, length + 1, format, args);
+			va_end(args);
+			size_t count = write((const uint8_t *)heap, length);
+			delete[] heap;
+			return count;
+		}
+
+		virtual void flush() {}
+
+};
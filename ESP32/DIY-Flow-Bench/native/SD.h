@@ -0,0 +1,57 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file SD.h
+ *
+ * @brief Host (native) SD card
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * The card is a host directory named by the mount point passed to begin() (the native build sets
+ * SD_MOUNT_POINT to native_fs/sd, so ::truncate() on the mount point path reaches the same files). The
+ * card is present when the directory exists.
+ *
+ ***/
+#pragma once
+
+#include "FS.h"
+#include "SPI.h"
+
+
+typedef enum {
+	CARD_NONE,
+	CARD_MMC,
+	CARD_SD,
+	CARD_SDHC,
+	CARD_UNKNOWN
+} sdcard_type_t;
+
+
+class SDFS : public fs::FS {
+
+	private:
+
+		bool mounted = false;
+
+	public:
+
+		SDFS() : fs::FS("") {}
+
+		bool begin(uint8_t ssPin = 5, SPIClass &spi = SPI, uint32_t frequency = 4000000, const char *mountpoint = "/sd", uint8_t maxFiles = 5, bool formatIfEmpty = false);
+		void end() { mounted = false; root = ""; }
+		sdcard_type_t cardType() { return mounted ? CARD_SDHC : CARD_NONE; }
+		uint64_t cardSize() { return mounted ? 8ULL * 1024 * 1024 * 1024 : 0; }
+		uint64_t totalBytes() { return mounted ? 7ULL * 1024 * 1024 * 1024 : 0; }
+		uint64_t usedBytes();
+
+};
+
+extern SDFS SD;
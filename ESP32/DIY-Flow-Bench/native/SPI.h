@@ -0,0 +1,46 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file SPI.h
+ *
+ * @brief Host (native) SPI
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * SPI buses exist only to be handed to SD.begin().
+ *
+ ***/
+#pragma once
+
+#include "Arduino.h"
+
+
+#define FSPI 1
+#define HSPI 2
+#define VSPI 3
+
+
+class SPIClass {
+
+	private:
+
+		uint8_t bus;
+
+	public:
+
+		explicit SPIClass(uint8_t spiBus = HSPI) : bus(spiBus) {}
+
+		void begin(int8_t sck = -1, int8_t miso = -1, int8_t mosi = -1, int8_t ss = -1) {}
+		void end() {}
+
+};
+
+extern SPIClass SPI;
@@ -0,0 +1,86 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file TinyBME280.h
+ *
+ * @brief Host (native) BME280
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * Tiny_BME280 over the fake I2C bus. The fake device reports chip id 0x60 at 0xD0 and holds its
+ * readings already compensated, as the fixed point values the library returns (big endian int32):
+ *
+ *   0xF7  pressure      Pa
+ *   0xFB  temperature   0.01 degC
+ *   0xE8  humidity      0.001 %RH
+ *
+ ***/
+#pragma once
+
+#include "Arduino.h"
+#include "Wire.h"
+
+
+#define BME280_CHIP_ID_REG 0xD0
+#define BME280_CHIP_ID 0x60
+#define BME280_PRESSURE_REG 0xF7
+#define BME280_TEMPERATURE_REG 0xFB
+#define BME280_HUMIDITY_REG 0xE8
+
+
+namespace tiny {
+
+	enum Mode {
+		SLEEP = 0b00,
+		FORCED = 0b01,
+		NORMAL = 0b11
+	};
+
+
+	class BME280 {
+
+		private:
+
+			uint8_t address = 0x77;
+
+			int32_t readRegister32(uint8_t reg) {
+				Wire.beginTransmission(address);
+				Wire.write(reg);
+				if (Wire.endTransmission() != 0 || Wire.requestFrom(address, (size_t)4) != 4) return 0;
+				uint32_t value = 0;
+				for (int i = 0; i < 4; i++) value = (value << 8) | (uint8_t)Wire.read();
+				return (int32_t)value;
+			}
+
+		public:
+
+			bool beginI2C(uint8_t i2cAddress = 0x77) {
+				address = i2cAddress;
+				Wire.beginTransmission(address);
+				Wire.write(BME280_CHIP_ID_REG);
+				if (Wire.endTransmission() != 0 || Wire.requestFrom(address, (size_t)1) != 1) return false;
+				return Wire.read() == BME280_CHIP_ID;
+			}
+
+			void setMode(uint8_t mode) {}
+			void setStandbyTime(uint8_t timeSetting) {}
+			void setFilter(uint8_t filterSetting) {}
+			void setTempOverSample(uint8_t overSampleAmount) {}
+			void setPressureOverSample(uint8_t overSampleAmount) {}
+			void setHumidityOverSample(uint8_t overSampleAmount) {}
+
+			int32_t readFixedTempC() { return readRegister32(BME280_TEMPERATURE_REG); }
+			uint32_t readFixedPressure() { return (uint32_t)readRegister32(BME280_PRESSURE_REG); }
+			uint32_t readFixedHumidity() { return (uint32_t)readRegister32(BME280_HUMIDITY_REG); }
+
+	};
+
+}
@@ -0,0 +1,66 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file Update.h
+ *
+ * @brief Host (native) OTA update
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * Collects the written image in memory instead of flashing it. image() returns it once end() has
+ * succeeded.
+ *
+ ***/
+#pragma once
+
+#include <string>
+
+#include "Arduino.h"
+
+
+#define UPDATE_SIZE_UNKNOWN 0xFFFFFFFF
+
+#define UPDATE_ERROR_OK 0
+#define UPDATE_ERROR_WRITE 1
+#define UPDATE_ERROR_SPACE 4
+#define UPDATE_ERROR_SIZE 5
+#define UPDATE_ERROR_ABORT 8
+
+
+class UpdateClass {
+
+	private:
+
+		std::string buffer;
+		std::string written;
+		size_t imageSize = 0;
+		uint8_t error = UPDATE_ERROR_OK;
+		bool running = false;
+
+	public:
+
+		bool begin(size_t size = UPDATE_SIZE_UNKNOWN);
+		size_t write(uint8_t *data, size_t length);
+		bool end(bool evenIfRemaining = false);
+		void abort();
+
+		bool isRunning() const { return running; }
+		bool hasError() const { return error != UPDATE_ERROR_OK; }
+		uint8_t getError() const { return error; }
+		const char * errorString() const;
+		void clearError() { error = UPDATE_ERROR_OK; }
+
+		// Host side
+		const std::string & image() const { return written; }
+
+};
+
+extern UpdateClass Update;
@@ -0,0 +1,115 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file WString.h
+ *
+ * @brief Host (native) Arduino String
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * The subset of the Arduino String API used by the firmware, on top of std::string. concat() and
+ * assignment from a null pointer behave as on the ESP32 core, which ArduinoJson relies on.
+ *
+ ***/
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+
+class String {
+
+	private:
+
+		std::string text;
+
+		template <typename T> static std::string format(const char *spec, T value) {
+			char buffer[40];
+			snprintf(buffer, sizeof(buffer), spec, value);
+			return buffer;
+		}
+
+	public:
+
+		String() {}
+		String(const char *value) : text(value ? value : "") {}
+		String(const std::string &value) : text(value) {}
+		String(const char *value, unsigned int length) : text(value ? std::string(value, length) : std::string()) {}
+		explicit String(char value) : text(1, value) {}
+		explicit String(unsigned char value, unsigned char base = 10) : text(format(base == 16 ? "%x" : "%u", (unsigned)value)) {}
+		explicit String(int value, unsigned char base = 10) : text(format(base == 16 ? "%x" : "%d", value)) {}
+		explicit String(unsigned int value, unsigned char base = 10) : text(format(base == 16 ? "%x" : "%u", value)) {}
+		explicit String(long value, unsigned char base = 10) : text(format(base == 16 ? "%lx" : "%ld", value)) {}
+		explicit String(unsigned long value, unsigned char base = 10) : text(format(base == 16 ? "%lx" : "%lu", value)) {}
+		explicit String(long long value) : text(format("%lld", value)) {}
+		explicit String(unsigned long long value) : text(format("%llu", value)) {}
+		explicit String(float value, unsigned int decimals = 2) { char buffer[64]; snprintf(buffer, sizeof(buffer), "%.*f", (int)decimals, (double)value); text = buffer; }
+		explicit String(double value, unsigned int decimals = 2) { char buffer[64]; snprintf(buffer, sizeof(buffer), "%.*f", (int)decimals, value); text = buffer; }
+
+		String & operator = (const char *value) { text = value ? value : ""; return *this; }
+
+		const char * c_str() const { return text.c_str(); }
+		unsigned int length() const { return text.length(); }
+		bool isEmpty() const { return text.empty(); }
+		bool reserve(unsigned int size) { text.reserve(size); return true; }
+
+		bool concat(const String &value) { text += value.text; return true; }
+		bool concat(const char *value) { if (value) text += value; return true; }
+		bool concat(const char *value, unsigned int length) { if (value) text.append(value, length); return true; }
+		bool concat(char value) { text += value; return true; }
+		template <typename T> bool concat(T value) { text += String(value).text; return true; }
+
+		template <typename T> String & operator += (const T &value) { concat(value); return *this; }
+
+		char charAt(unsigned int index) const { return index < text.length() ? text[index] : 0; }
+		void setCharAt(unsigned int index, char value) { if (index < text.length()) text[index] = value; }
+		char operator [] (unsigned int index) const { return charAt(index); }
+		char & operator [] (unsigned int index) { return text[index]; }
+
+		bool equals(const String &value) const { return text == value.text; }
+		bool equalsIgnoreCase(const String &value) const { return strcasecmp(c_str(), value.c_str()) == 0; }
+		bool startsWith(const String &value) const { return text.compare(0, value.text.length(), value.text) == 0; }
+		bool endsWith(const String &value) const { return text.length() >= value.text.length() && text.compare(text.length() - value.text.length(), value.text.length(), value.text) == 0; }
+
+		int indexOf(char value, unsigned int from = 0) const { size_t found = text.find(value, from); return found == std::string::npos ? -1 : (int)found; }
+		int indexOf(const String &value, unsigned int from = 0) const { size_t found = text.find(value.text, from); return found == std::string::npos ? -1 : (int)found; }
+		int lastIndexOf(char value) const { size_t found = text.rfind(value); return found == std::string::npos ? -1 : (int)found; }
+		String substring(unsigned int from) const { return from < text.length() ? String(text.substr(from)) : String(); }
+		String substring(unsigned int from, unsigned int to) const { if (from > to) { unsigned int swap = from; from = to; to = swap; } return from < text.length() ? String(text.substr(from, to - from)) : String(); }
+
+		void replace(const String &find, const String &with) {
+			if (find.text.empty()) return;
+			for (size_t at = text.find(find.text); at != std::string::npos; at = text.find(find.text, at + with.text.length())) text.replace(at, find.text.length(), with.text);
+		}
+		void remove(unsigned int index, unsigned int count = (unsigned int)-1) { if (index < text.length()) text.erase(index, count); }
+		void trim() { size_t first = text.find_first_not_of(" \t\r\n"); size_t last = text.find_last_not_of(" \t\r\n"); text = (first == std::string::npos) ? "" : text.substr(first, last - first + 1); }
+		void toLowerCase() { for (size_t i = 0; i < text.length(); i++) text[i] = tolower(text[i]); }
+		void toUpperCase() { for (size_t i = 0; i < text.length(); i++) text[i] = toupper(text[i]); }
+
+		long toInt() const { return strtol(c_str(), NULL, 10); }
+		float toFloat() const { return strtof(c_str(), NULL); }
+		double toDouble() const { return strtod(c_str(), NULL); }
+
+		friend bool operator == (const String &a, const String &b) { return a.text == b.text; }
+		friend bool operator == (const String &a, const char *b) { return a.text == (b ? b : ""); }
+		friend bool operator != (const String &a, const String &b) { return a.text != b.text; }
+		friend bool operator != (const String &a, const char *b) { return !(a == b); }
+		friend bool operator < (const String &a, const String &b) { return a.text < b.text; }
+
+		friend String operator + (const String &a, const String &b) { String result(a); result.concat(b); return result; }
+		friend String operator + (const String &a, const char *b) { String result(a); result.concat(b); return result; }
+		friend String operator + (const char *a, const String &b) { String result(a); result.concat(b); return result; }
+		template <typename T> friend String operator + (const String &a, T b) { String result(a); result.concat(b); return result; }
+
+};
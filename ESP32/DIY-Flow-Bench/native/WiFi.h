@@ -0,0 +1,70 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file WiFi.h
+ *
+ * @brief Host (native) WiFi
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * The host is always on the network. Station mode connects at once on the loopback address, access
+ * point mode reports the ESP32 default soft AP address.
+ *
+ ***/
+#pragma once
+
+#include "Arduino.h"
+#include "IPAddress.h"
+#include "esp_wifi.h"
+
+
+typedef enum {
+	WL_NO_SHIELD = 255,
+	WL_IDLE_STATUS = 0,
+	WL_NO_SSID_AVAIL = 1,
+	WL_SCAN_COMPLETED = 2,
+	WL_CONNECTED = 3,
+	WL_CONNECT_FAILED = 4,
+	WL_CONNECTION_LOST = 5,
+	WL_DISCONNECTED = 6
+} wl_status_t;
+
+
+class WiFiClass {
+
+	private:
+
+		wifi_mode_t wifiMode = WIFI_MODE_NULL;
+		wl_status_t wifiStatus = WL_DISCONNECTED;
+
+	public:
+
+		bool mode(wifi_mode_t mode) { wifiMode = mode; return true; }
+		wifi_mode_t getMode() { return wifiMode; }
+		void persistent(bool persistent) {}
+		bool setAutoReconnect(bool autoReconnect) { return true; }
+		bool config(IPAddress localIP, IPAddress gateway, IPAddress subnet) { return true; }
+
+		wl_status_t begin(const char *ssid, const char *passphrase = NULL) { wifiStatus = WL_CONNECTED; return wifiStatus; }
+		uint8_t waitForConnectResult(unsigned long timeoutLength = 60000) { return wifiStatus; }
+		bool disconnect(bool wifiOff = false, bool eraseAp = false) { wifiStatus = WL_DISCONNECTED; return true; }
+		bool reconnect() { wifiStatus = WL_CONNECTED; return true; }
+		wl_status_t status() { return wifiStatus; }
+
+		bool softAP(const char *ssid, const char *passphrase = NULL) { return true; }
+		IPAddress softAPIP() { return IPAddress(192, 168, 4, 1); }
+		IPAddress localIP() { return (wifiStatus == WL_CONNECTED) ? IPAddress(127, 0, 0, 1) : IPAddress(); }
+		String macAddress() { return String("02:00:00:00:00:01"); }
+		int8_t RSSI() { return (wifiStatus == WL_CONNECTED) ? -50 : 0; }
+
+};
+
+extern WiFiClass WiFi;
@@ -0,0 +1,58 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file Wire.h
+ *
+ * @brief Host (native) I2C bus
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * Each attached address is a 256 byte register file. The first byte of a write sets the register
+ * pointer, following bytes are stored from there. Reads return bytes from the register pointer. A
+ * transmission to an address that is not attached is NACKed (endTransmission() returns 2).
+ *
+ ***/
+#pragma once
+
+#include "Arduino.h"
+
+
+class TwoWire {
+
+	private:
+
+		uint8_t txAddress = 0;
+		uint8_t txBuffer[128];
+		size_t txLength = 0;
+		uint8_t rxBuffer[128];
+		size_t rxLength = 0;
+		size_t rxPosition = 0;
+
+	public:
+
+		bool begin(int sda = -1, int scl = -1, uint32_t frequency = 0) { return true; }
+		bool end() { return true; }
+		bool setClock(uint32_t frequency) { return true; }
+		void setTimeOut(uint16_t timeoutMs) {}
+
+		void beginTransmission(uint8_t address);
+		uint8_t endTransmission(bool sendStop = true);
+		size_t write(uint8_t value);
+		size_t write(const uint8_t *data, size_t length);
+
+		uint8_t requestFrom(uint8_t address, size_t quantity, bool sendStop = true);
+		int available() { return rxLength - rxPosition; }
+		int read() { return (rxPosition < rxLength) ? rxBuffer[rxPosition++] : -1; }
+		int peek() { return (rxPosition < rxLength) ? rxBuffer[rxPosition] : -1; }
+
+};
+
+extern TwoWire Wire;
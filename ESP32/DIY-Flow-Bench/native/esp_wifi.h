@@ -0,0 +1,50 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file esp_wifi.h
+ *
+ * @brief Host (native) ESP-IDF WiFi
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ ***/
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+
+typedef enum {
+	WIFI_MODE_NULL = 0,
+	WIFI_MODE_STA,
+	WIFI_MODE_AP,
+	WIFI_MODE_APSTA
+} wifi_mode_t;
+
+#define WIFI_OFF WIFI_MODE_NULL
+#define WIFI_STA WIFI_MODE_STA
+#define WIFI_AP WIFI_MODE_AP
+#define WIFI_AP_STA WIFI_MODE_APSTA
+
+typedef enum {
+	WIFI_IF_STA = 0,
+	WIFI_IF_AP
+} wifi_interface_t;
+
+typedef enum {
+	WIFI_PS_NONE = 0,
+	WIFI_PS_MIN_MODEM,
+	WIFI_PS_MAX_MODEM
+} wifi_ps_type_t;
+
+inline esp_err_t esp_wifi_set_mac(wifi_interface_t interface, const uint8_t mac[6]) { return ESP_OK; }
+inline esp_err_t esp_wifi_set_ps(wifi_ps_type_t type) { return ESP_OK; }
@@ -0,0 +1,298 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file fs.cpp
+ *
+ * @brief Host (native) flash and SD file systems on host directories
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ ***/
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "FS.h"
+#include "LittleFS.h"
+#include "SPIFFS.h"
+#include "SD.h"
+
+
+HostFlashFS LittleFS("littlefs");
+HostFlashFS SPIFFS("spiffs");
+SPIClass SPI(VSPI);
+SDFS SD;
+
+static String filesystemRoot = "native_fs";
+
+void HAL::setFilesystemRoot(const char *path) {
+  filesystemRoot = path;
+}
+
+
+struct fs::FileImpl {
+  FILE *stream = NULL;
+  String path;                    // firmware path
+  String hostPath;
+  bool directory = false;
+  std::vector<String> entries;    // directory listing (names)
+  size_t nextEntry = 0;
+  const fs::FS *owner = NULL;
+  ~FileImpl() { if (stream) fclose(stream); }
+};
+
+
+
+
+/***********************************************************
+ * File
+ ***/
+fs::File::operator bool() const {
+  return impl && (impl->stream || impl->directory);
+}
+
+size_t fs::File::write(const uint8_t *buffer, size_t size) {
+  return (impl && impl->stream) ? fwrite(buffer, 1, size, impl->stream) : 0;
+}
+
+int fs::File::available() {
+  if (!impl || !impl->stream) return 0;
+  return size() - position();
+}
+
+int fs::File::read() {
+  return (impl && impl->stream) ? fgetc(impl->stream) : -1;
+}
+
+int fs::File::peek() {
+  if (!impl || !impl->stream) return -1;
+  int value = fgetc(impl->stream);
+  if (value != EOF) ungetc(value, impl->stream);
+  return value;
+}
+
+size_t fs::File::read(uint8_t *buffer, size_t size) {
+  return (impl && impl->stream) ? fread(buffer, 1, size, impl->stream) : 0;
+}
+
+void fs::File::flush() {
+  if (impl && impl->stream) fflush(impl->stream);
+}
+
+bool fs::File::seek(uint32_t position, SeekMode mode) {
+  static const int whence[] = {SEEK_SET, SEEK_CUR, SEEK_END};
+  return impl && impl->stream && fseek(impl->stream, position, whence[mode]) == 0;
+}
+
+size_t fs::File::position() const {
+  if (!impl || !impl->stream) return 0;
+  long position = ftell(impl->stream);
+  return (position < 0) ? 0 : position;
+}
+
+size_t fs::File::size() const {
+  if (!impl || !impl->stream) return 0;
+  fflush(impl->stream);
+  struct stat info;
+  return (fstat(fileno(impl->stream), &info) == 0) ? info.st_size : 0;
+}
+
+void fs::File::close() {
+  impl.reset();
+}
+
+const char * fs::File::path() const {
+  return impl ? impl->path.c_str() : NULL;
+}
+
+const char * fs::File::name() const {
+  if (!impl) return NULL;
+  const char *slash = strrchr(impl->path.c_str(), '/');
+  return slash ? slash + 1 : impl->path.c_str();
+}
+
+bool fs::File::isDirectory() const {
+  return impl && impl->directory;
+}
+
+fs::File fs::File::openNextFile(const char *mode) {
+
+  if (!impl || !impl->directory || impl->nextEntry >= impl->entries.size()) return File();
+
+  String path = impl->path;
+  if (!path.endsWith("/")) path += "/";
+  path += impl->entries[impl->nextEntry++];
+
+  return const_cast<fs::FS *>(impl->owner)->open(path.c_str(), mode);
+
+}
+
+void fs::File::rewindDirectory() {
+  if (impl) impl->nextEntry = 0;
+}
+
+
+
+
+/***********************************************************
+ * FS
+ ***/
+String fs::FS::hostPath(const char *path) const {
+  String full = root;
+  if (path[0] != '/') full += "/";
+  full += path;
+  return full;
+}
+
+fs::File fs::FS::open(const char *path, const char *mode, const bool create) {
+
+  if (root.isEmpty() || path == NULL) return File();
+
+  std::shared_ptr<FileImpl> file = std::make_shared<FileImpl>();
+  file->path = path;
+  file->hostPath = hostPath(path);
+  file->owner = this;
+
+  struct stat info;
+  bool found = stat(file->hostPath.c_str(), &info) == 0;
+
+  if (found && S_ISDIR(info.st_mode)) {
+    DIR *directory = opendir(file->hostPath.c_str());
+    if (directory == NULL) return File();
+    for (struct dirent *entry = readdir(directory); entry != NULL; entry = readdir(directory)) {
+      if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) file->entries.push_back(entry->d_name);
+    }
+    closedir(directory);
+    file->directory = true;
+    return File(file);
+  }
+
+  if (!found && strcmp(mode, FILE_READ) == 0) return File();
+
+  // Binary mode, "r" becomes "rb" etc.
+  char hostMode[4] = {mode[0], 'b', 0, 0};
+  if (mode[0] != 0 && mode[1] == '+') hostMode[2] = '+';
+
+  file->stream = fopen(file->hostPath.c_str(), hostMode);
+
+  return file->stream ? File(file) : File();
+
+}
+
+bool fs::FS::exists(const char *path) {
+  struct stat info;
+  return !root.isEmpty() && stat(hostPath(path).c_str(), &info) == 0;
+}
+
+bool fs::FS::remove(const char *path) {
+  return !root.isEmpty() && ::remove(hostPath(path).c_str()) == 0;
+}
+
+bool fs::FS::rename(const char *pathFrom, const char *pathTo) {
+  return !root.isEmpty() && ::rename(hostPath(pathFrom).c_str(), hostPath(pathTo).c_str()) == 0;
+}
+
+bool fs::FS::mkdir(const char *path) {
+  return !root.isEmpty() && ::mkdir(hostPath(path).c_str(), 0755) == 0;
+}
+
+bool fs::FS::rmdir(const char *path) {
+  return !root.isEmpty() && ::rmdir(hostPath(path).c_str()) == 0;
+}
+
+
+
+
+/***********************************************************
+ * HostFlashFS - a missing directory is an unformatted partition
+ ***/
+bool HostFlashFS::begin(bool formatOnFail, const char *basePath, uint8_t maxOpenFiles, const char *partitionLabel) {
+
+  String path = filesystemRoot + "/" + directory;
+  struct stat info;
+
+  if (stat(path.c_str(), &info) != 0 || !S_ISDIR(info.st_mode)) {
+    if (!formatOnFail) return false;
+    ::mkdir(filesystemRoot.c_str(), 0755);
+    if (::mkdir(path.c_str(), 0755) != 0) return false;
+  }
+
+  root = path;
+  mounted = true;
+
+  return true;
+
+}
+
+bool HostFlashFS::format() {
+
+  String path = filesystemRoot + "/" + directory;
+  DIR *listing = opendir(path.c_str());
+
+  if (listing == NULL) return false;
+
+  for (struct dirent *entry = readdir(listing); entry != NULL; entry = readdir(listing)) {
+    if (entry->d_type == DT_REG) ::remove((path + "/" + entry->d_name).c_str());
+  }
+  closedir(listing);
+
+  return true;
+
+}
+
+// Bytes in the files under a host directory, including sub directories
+static uint64_t directoryBytes(const String &path) {
+
+  uint64_t used = 0;
+  DIR *listing = opendir(path.c_str());
+
+  if (listing == NULL) return 0;
+
+  for (struct dirent *entry = readdir(listing); entry != NULL; entry = readdir(listing)) {
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+    struct stat info;
+    String entryPath = path + "/" + entry->d_name;
+    if (stat(entryPath.c_str(), &info) != 0) continue;
+    if (S_ISREG(info.st_mode)) used += info.st_size;
+    if (S_ISDIR(info.st_mode)) used += directoryBytes(entryPath);
+  }
+  closedir(listing);
+
+  return used;
+
+}
+
+size_t HostFlashFS::usedBytes() {
+  return mounted ? directoryBytes(root) : 0;
+}
+
+
+
+
+/***********************************************************
+ * SD card
+ ***/
+bool SDFS::begin(uint8_t ssPin, SPIClass &spi, uint32_t frequency, const char *mountpoint, uint8_t maxFiles, bool formatIfEmpty) {
+
+  struct stat info;
+
+  if (mountpoint == NULL || stat(mountpoint, &info) != 0 || !S_ISDIR(info.st_mode)) return false;
+
+  root = mountpoint;
+  mounted = true;
+
+  return true;
+
+}
+
+uint64_t SDFS::usedBytes() {
+  return mounted ? directoryBytes(root) : 0;
+}
@@ -0,0 +1,80 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file globals.cpp
+ *
+ * @brief Host (native) firmware globals
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * The sketch (DIY-Flow-Bench.ino) is not part of the native build, its setup() / loop() and tasks
+ * being the target's to run. This file owns the structs, module instances and variables the sketch
+ * owns on target so the modules link, tests and benchmarks then drive the modules directly.
+ *
+ ***/
+#include <Arduino.h>
+#include <Preferences.h>
+
+#include "datahandler.h"
+#include "constants.h"
+#include "system.h"
+#include "structs.h"
+
+#include "hardware.h"
+#include "sensors.h"
+#include "calculations.h"
+#include "webserver.h"
+#include "publisher.h"
+#include "metrics.h"
+#include "recorder.h"
+#include "persistence.h"
+#include "publichtml.h"
+#include "messages.h"
+#include "API.h"
+
+
+// Initiate Structs
+BenchSettings settings;
+DeviceStatus status;
+SensorData sensorVal;
+ValveLiftData valveData;
+Language language;
+CalibrationData calVal;
+Configuration config;
+Pins pins;
+
+// Initiate Classes
+Preferences _prefs;
+DataHandler _data;
+API _api;
+Calculations _calculations;
+Hardware _hardware;
+Messages _message;
+Sensors _sensors;
+Webserver _webserver;
+Publisher _publisher;
+Metrics _metrics;
+Recorder _recorder;
+Persistence _persistence;
+PublicHTML _public_html;
+
+// Initiate Variables
+TaskHandle_t sensorDataTask = NULL;
+TaskHandle_t enviroDataTask = NULL;
+
+String jsonString;
+
+int adcStartTime = micros();
+int bmeStartTime = micros();
+int loopStartTime = micros();
+
+int runTask = SSE_TASK;
+int adcTaskCount = 0;
@@ -0,0 +1,716 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file hal.cpp
+ *
+ * @brief Host (native) clock, GPIO, serial, tasks, queues, I2C, NVS and CRC
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ ***/
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Arduino.h"
+#include "Wire.h"
+#include "Preferences.h"
+#include "nvs.h"
+#include "esp32/rom/crc.h"
+#include "esp_timer.h"
+#include "freertos/queue.h"
+
+
+HardwareSerial Serial(0);
+HardwareSerial Serial2(2);
+EspClass ESP;
+TwoWire Wire;
+
+
+/***********************************************************
+ * Clock
+ ***/
+static const std::chrono::steady_clock::time_point clockStart = std::chrono::steady_clock::now();
+static std::atomic<bool> manualClock(false);
+static std::atomic<uint64_t> manualTimeUs(0);
+
+static uint64_t clockUs() {
+
+  if (manualClock.load()) return manualTimeUs.load();
+
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - clockStart).count();
+
+}
+
+unsigned long millis() {
+  return (uint32_t)(clockUs() / 1000);
+}
+
+unsigned long micros() {
+  return (uint32_t)clockUs();
+}
+
+void delay(uint32_t timeMs) {
+  delayMicroseconds(timeMs * 1000);
+}
+
+void delayMicroseconds(uint32_t timeUs) {
+  if (manualClock.load()) {
+    manualTimeUs.fetch_add(timeUs);
+  } else {
+    std::this_thread::sleep_for(std::chrono::microseconds(timeUs));
+  }
+}
+
+int64_t esp_timer_get_time() {
+  return (int64_t)clockUs();
+}
+
+void HAL::setClock(uint32_t timeMs) {
+  manualTimeUs.store((uint64_t)timeMs * 1000);
+  manualClock.store(true);
+}
+
+void HAL::advanceClock(uint32_t timeMs) {
+  manualTimeUs.fetch_add((uint64_t)timeMs * 1000);
+}
+
+void HAL::useRealClock() {
+  manualClock.store(false);
+}
+
+
+
+
+/***********************************************************
+ * Random
+ ***/
+uint32_t esp_random() {
+
+  static std::random_device source;
+  static std::mutex sourceMutex;
+
+  std::lock_guard<std::mutex> lock(sourceMutex);
+
+  return source();
+
+}
+
+
+
+
+/***********************************************************
+ * GPIO
+ ***/
+#define HOST_GPIO_PINS 64
+
+static std::atomic<uint8_t> pinLevels[HOST_GPIO_PINS];
+static std::atomic<uint16_t> analogValues[HOST_GPIO_PINS];
+
+void HAL::setPin(uint8_t pin, uint8_t level) {
+  if (pin < HOST_GPIO_PINS) pinLevels[pin].store(level ? HIGH : LOW);
+}
+
+uint8_t HAL::pinLevel(uint8_t pin) {
+  return (pin < HOST_GPIO_PINS) ? pinLevels[pin].load() : LOW;
+}
+
+void HAL::setAnalog(uint8_t pin, uint16_t value) {
+  if (pin < HOST_GPIO_PINS) analogValues[pin].store(value);
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+  if (mode == INPUT_PULLUP) HAL::setPin(pin, HIGH);
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+  HAL::setPin(pin, value);
+}
+
+int digitalRead(uint8_t pin) {
+  return HAL::pinLevel(pin);
+}
+
+uint16_t analogRead(uint8_t pin) {
+  return (pin < HOST_GPIO_PINS) ? analogValues[pin].load() : 0;
+}
+
+
+
+
+/***********************************************************
+ * Serial
+ ***/
+struct SerialPort {
+  std::deque<uint8_t> rx;
+  std::string tx;
+  bool capture;
+  OnReceiveCb onReceive;
+};
+
+static std::mutex serialMutex;
+static SerialPort serialPort[3] = {{{}, "", false, NULL}, {{}, "", true, NULL}, {{}, "", true, NULL}};
+
+static void serialReceive(int uart, const uint8_t *data, size_t length) {
+  OnReceiveCb callback;
+  {
+    std::lock_guard<std::mutex> lock(serialMutex);
+    serialPort[uart].rx.insert(serialPort[uart].rx.end(), data, data + length);
+    callback = serialPort[uart].onReceive;
+  }
+  if (callback) callback();
+}
+
+void HAL::serialInput(const char *data) {
+  serialReceive(0, (const uint8_t *)data, strlen(data));
+}
+
+void HAL::serial2Input(const uint8_t *data, size_t length) {
+  serialReceive(2, data, length);
+}
+
+void HAL::serialCapture(bool enable) {
+  std::lock_guard<std::mutex> lock(serialMutex);
+  serialPort[0].capture = enable;
+}
+
+std::string HAL::serialOutput() {
+  std::lock_guard<std::mutex> lock(serialMutex);
+  std::string output;
+  output.swap(serialPort[0].tx);
+  return output;
+}
+
+std::string HAL::serial2Output() {
+  std::lock_guard<std::mutex> lock(serialMutex);
+  std::string output;
+  output.swap(serialPort[2].tx);
+  return output;
+}
+
+void HardwareSerial::onReceive(OnReceiveCb function, bool onlyOnTimeout) {
+  std::lock_guard<std::mutex> lock(serialMutex);
+  serialPort[uart].onReceive = function;
+}
+
+int HardwareSerial::available() {
+  std::lock_guard<std::mutex> lock(serialMutex);
+  return serialPort[uart].rx.size();
+}
+
+int HardwareSerial::read() {
+  std::lock_guard<std::mutex> lock(serialMutex);
+  std::deque<uint8_t> &rx = serialPort[uart].rx;
+  if (rx.empty()) return -1;
+  int value = rx.front();
+  rx.pop_front();
+  return value;
+}
+
+int HardwareSerial::peek() {
+  std::lock_guard<std::mutex> lock(serialMutex);
+  std::deque<uint8_t> &rx = serialPort[uart].rx;
+  return rx.empty() ? -1 : rx.front();
+}
+
+size_t HardwareSerial::write(uint8_t value) {
+  return write(&value, 1);
+}
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size) {
+  std::lock_guard<std::mutex> lock(serialMutex);
+  if (serialPort[uart].capture) {
+    serialPort[uart].tx.append((const char *)buffer, size);
+    return size;
+  }
+  return fwrite(buffer, 1, size, stdout);
+}
+
+void HardwareSerial::flush() {
+  fflush(stdout);
+}
+
+void EspClass::restart() {
+  fflush(stdout);
+  exit(0);
+}
+
+
+
+
+/***********************************************************
+ * FreeRTOS tasks - one host thread per task
+ ***/
+struct HostTask {
+  std::mutex mutex;
+  std::condition_variable notified;
+  uint32_t notifyCount = 0;
+  BaseType_t core = 1;
+};
+
+struct HostSemaphore {
+  std::mutex mutex;
+  std::condition_variable given;
+  UBaseType_t count;
+  UBaseType_t maxCount;
+};
+
+struct HostQueue {
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::deque<std::vector<uint8_t> > items;
+  UBaseType_t length;
+  UBaseType_t itemSize;
+};
+
+// Thrown by vTaskDelete(NULL) to unwind the task thread
+struct HostTaskExit {};
+
+// The Arduino loop runs on core 1
+static HostTask loopTask;
+static thread_local HostTask *currentTask = &loopTask;
+
+TaskHandle_t loopTaskHandle = &loopTask;
+
+BaseType_t xPortGetCoreID() {
+  return currentTask->core;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name, uint32_t stackSize, void *parameter, UBaseType_t priority, TaskHandle_t *handle, BaseType_t core) {
+
+  HostTask *task = new HostTask();
+  task->core = (core == tskNO_AFFINITY) ? 0 : core;
+  if (handle) *handle = task;
+
+  std::thread([function, parameter, task]() {
+    currentTask = task;
+    try {
+      function(parameter);
+    } catch (const HostTaskExit &) {
+    }
+  }).detach();
+
+  return pdPASS;
+
+}
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stackSize, void *parameter, UBaseType_t priority, TaskHandle_t *handle) {
+  return xTaskCreatePinnedToCore(function, name, stackSize, parameter, priority, handle, tskNO_AFFINITY);
+}
+
+void vTaskDelete(TaskHandle_t task) {
+  if (task == NULL || task == currentTask) throw HostTaskExit();
+}
+
+void vTaskDelay(TickType_t ticks) {
+  delay(ticks);
+}
+
+TickType_t xTaskGetTickCount() {
+  return millis();
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) {
+  return 0;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+  if (task == NULL) return pdFAIL;
+  {
+    std::lock_guard<std::mutex> lock(task->mutex);
+    task->notifyCount++;
+  }
+  task->notified.notify_one();
+  return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticks) {
+
+  HostTask *task = currentTask;
+  std::unique_lock<std::mutex> lock(task->mutex);
+
+  if (ticks == portMAX_DELAY) {
+    task->notified.wait(lock, [task]() { return task->notifyCount > 0; });
+  } else {
+    task->notified.wait_for(lock, std::chrono::milliseconds(ticks), [task]() { return task->notifyCount > 0; });
+  }
+
+  uint32_t count = task->notifyCount;
+  if (count) task->notifyCount = clearOnExit ? 0 : count - 1;
+
+  return count;
+
+}
+
+// Waits on a condition variable, for ever or up to ticks (ms)
+template <typename Lock, typename Predicate> static bool waitTicks(std::condition_variable &condition, Lock &lock, TickType_t ticks, Predicate ready) {
+  if (ticks == portMAX_DELAY) {
+    condition.wait(lock, ready);
+    return true;
+  }
+  return condition.wait_for(lock, std::chrono::milliseconds(ticks), ready);
+}
+
+static SemaphoreHandle_t createSemaphore(UBaseType_t maxCount, UBaseType_t initialCount) {
+  HostSemaphore *semaphore = new HostSemaphore();
+  semaphore->count = initialCount;
+  semaphore->maxCount = maxCount;
+  return semaphore;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex() {
+  return createSemaphore(1, 1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary() {
+  return createSemaphore(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t maxCount, UBaseType_t initialCount) {
+  return createSemaphore(maxCount, initialCount);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks) {
+  std::unique_lock<std::mutex> lock(semaphore->mutex);
+  if (!waitTicks(semaphore->given, lock, ticks, [semaphore]() { return semaphore->count > 0; })) return pdFALSE;
+  semaphore->count--;
+  return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+  {
+    std::lock_guard<std::mutex> lock(semaphore->mutex);
+    if (semaphore->count >= semaphore->maxCount) return pdFALSE;
+    semaphore->count++;
+  }
+  semaphore->given.notify_one();
+  return pdTRUE;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t semaphore) {
+  delete semaphore;
+}
+
+
+
+
+/***********************************************************
+ * FreeRTOS queues - items are copied in and out
+ ***/
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize) {
+  HostQueue *queue = new HostQueue();
+  queue->length = length;
+  queue->itemSize = itemSize;
+  return queue;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks) {
+  {
+    std::unique_lock<std::mutex> lock(queue->mutex);
+    if (!waitTicks(queue->changed, lock, ticks, [queue]() { return queue->items.size() < queue->length; })) return errQUEUE_FULL;
+    const uint8_t *bytes = (const uint8_t *)item;
+    queue->items.push_back(std::vector<uint8_t>(bytes, bytes + queue->itemSize));
+  }
+  queue->changed.notify_all();
+  return pdPASS;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks) {
+  {
+    std::unique_lock<std::mutex> lock(queue->mutex);
+    if (!waitTicks(queue->changed, lock, ticks, [queue]() { return !queue->items.empty(); })) return pdFALSE;
+    memcpy(item, queue->items.front().data(), queue->itemSize);
+    queue->items.pop_front();
+  }
+  queue->changed.notify_all();
+  return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+  std::lock_guard<std::mutex> lock(queue->mutex);
+  return queue->items.size();
+}
+
+void vQueueDelete(QueueHandle_t queue) {
+  delete queue;
+}
+
+
+
+
+/***********************************************************
+ * I2C - register file devices
+ ***/
+struct I2CDevice {
+  uint8_t reg[256];
+  uint8_t pointer;
+};
+
+static std::mutex i2cMutex;
+static std::map<uint8_t, I2CDevice> i2cDevices;
+
+void HAL::i2cAttach(uint8_t address) {
+  std::lock_guard<std::mutex> lock(i2cMutex);
+  I2CDevice device = {};
+  i2cDevices.insert(std::make_pair(address, device));
+}
+
+void HAL::i2cDetach(uint8_t address) {
+  std::lock_guard<std::mutex> lock(i2cMutex);
+  i2cDevices.erase(address);
+}
+
+void HAL::i2cWriteRegister(uint8_t address, uint8_t reg, const uint8_t *data, size_t length) {
+  std::lock_guard<std::mutex> lock(i2cMutex);
+  I2CDevice &device = i2cDevices[address];
+  for (size_t i = 0; i < length; i++) device.reg[(uint8_t)(reg + i)] = data[i];
+}
+
+void HAL::i2cWriteRegister16(uint8_t address, uint8_t reg, uint16_t value) {
+  uint8_t data[2] = {(uint8_t)(value >> 8), (uint8_t)(value & 0xFF)};
+  i2cWriteRegister(address, reg, data, 2);
+}
+
+size_t HAL::i2cReadRegister(uint8_t address, uint8_t reg, uint8_t *data, size_t length) {
+  std::lock_guard<std::mutex> lock(i2cMutex);
+  std::map<uint8_t, I2CDevice>::iterator device = i2cDevices.find(address);
+  if (device == i2cDevices.end()) return 0;
+  for (size_t i = 0; i < length; i++) data[i] = device->second.reg[(uint8_t)(reg + i)];
+  return length;
+}
+
+void TwoWire::beginTransmission(uint8_t address) {
+  txAddress = address;
+  txLength = 0;
+}
+
+size_t TwoWire::write(uint8_t value) {
+  if (txLength >= sizeof(txBuffer)) return 0;
+  txBuffer[txLength++] = value;
+  return 1;
+}
+
+size_t TwoWire::write(const uint8_t *data, size_t length) {
+  size_t written = 0;
+  while (written < length && write(data[written])) written++;
+  return written;
+}
+
+uint8_t TwoWire::endTransmission(bool sendStop) {
+
+  std::lock_guard<std::mutex> lock(i2cMutex);
+  std::map<uint8_t, I2CDevice>::iterator device = i2cDevices.find(txAddress);
+
+  if (device == i2cDevices.end()) return 2;
+
+  if (txLength > 0) {
+    device->second.pointer = txBuffer[0];
+    for (size_t i = 1; i < txLength; i++) device->second.reg[device->second.pointer++] = txBuffer[i];
+  }
+
+  return 0;
+
+}
+
+uint8_t TwoWire::requestFrom(uint8_t address, size_t quantity, bool sendStop) {
+
+  std::lock_guard<std::mutex> lock(i2cMutex);
+  std::map<uint8_t, I2CDevice>::iterator device = i2cDevices.find(address);
+
+  rxLength = 0;
+  rxPosition = 0;
+
+  if (device == i2cDevices.end()) return 0;
+
+  for (; rxLength < quantity && rxLength < sizeof(rxBuffer); rxLength++) rxBuffer[rxLength] = device->second.reg[device->second.pointer++];
+
+  return rxLength;
+
+}
+
+
+
+
+/***********************************************************
+ * NVS
+ ***/
+#define HOST_NVS_ENTRIES 630
+
+struct NvsEntry {
+  PreferenceType type;
+  std::vector<uint8_t> data;
+};
+
+static std::mutex nvsMutex;
+static std::map<std::string, std::map<std::string, NvsEntry> > nvsStore;
+
+// Entries are 32 bytes, a value takes one entry plus one per 32 bytes of string / blob data
+static size_t nvsEntryCount(const NvsEntry &entry) {
+  return (entry.type == PT_STR || entry.type == PT_BLOB) ? 1 + (entry.data.size() + 31) / 32 : 1;
+}
+
+static size_t nvsUsedEntries() {
+  size_t used = 0;
+  for (std::map<std::string, std::map<std::string, NvsEntry> >::iterator space = nvsStore.begin(); space != nvsStore.end(); ++space) {
+    used++;
+    for (std::map<std::string, NvsEntry>::iterator key = space->second.begin(); key != space->second.end(); ++key) used += nvsEntryCount(key->second);
+  }
+  return used;
+}
+
+void HAL::nvsClear() {
+  std::lock_guard<std::mutex> lock(nvsMutex);
+  nvsStore.clear();
+}
+
+esp_err_t nvs_get_stats(const char *partitionName, nvs_stats_t *stats) {
+  std::lock_guard<std::mutex> lock(nvsMutex);
+  stats->total_entries = HOST_NVS_ENTRIES;
+  stats->used_entries = nvsUsedEntries();
+  stats->free_entries = stats->total_entries - stats->used_entries;
+  stats->namespace_count = nvsStore.size();
+  return ESP_OK;
+}
+
+bool Preferences::begin(const char *name, bool readOnly, const char *partitionLabel) {
+
+  std::lock_guard<std::mutex> lock(nvsMutex);
+
+  if (started || name == NULL || strlen(name) > 15) return false;
+  if (readOnly && nvsStore.find(name) == nvsStore.end()) return false;
+
+  nvsStore[name];
+  nameSpace = name;
+  this->readOnly = readOnly;
+  started = true;
+
+  return true;
+
+}
+
+bool Preferences::clear() {
+  std::lock_guard<std::mutex> lock(nvsMutex);
+  if (!started || readOnly) return false;
+  nvsStore[nameSpace.c_str()].clear();
+  return true;
+}
+
+bool Preferences::remove(const char *key) {
+  std::lock_guard<std::mutex> lock(nvsMutex);
+  if (!started || readOnly) return false;
+  return nvsStore[nameSpace.c_str()].erase(key) > 0;
+}
+
+bool Preferences::isKey(const char *key) {
+  return getType(key) != PT_INVALID;
+}
+
+PreferenceType Preferences::getType(const char *key) {
+  std::lock_guard<std::mutex> lock(nvsMutex);
+  if (!started) return PT_INVALID;
+  std::map<std::string, NvsEntry> &space = nvsStore[nameSpace.c_str()];
+  std::map<std::string, NvsEntry>::iterator entry = space.find(key);
+  return (entry == space.end()) ? PT_INVALID : entry->second.type;
+}
+
+size_t Preferences::freeEntries() {
+  nvs_stats_t stats;
+  nvs_get_stats(NULL, &stats);
+  return stats.free_entries;
+}
+
+size_t Preferences::put(const char *key, PreferenceType type, const void *value, size_t length) {
+
+  std::lock_guard<std::mutex> lock(nvsMutex);
+
+  if (!started || readOnly || key == NULL || strlen(key) > 15) return 0;
+
+  NvsEntry entry;
+  entry.type = type;
+  entry.data.assign((const uint8_t *)value, (const uint8_t *)value + length);
+
+  std::map<std::string, NvsEntry> &space = nvsStore[nameSpace.c_str()];
+  std::map<std::string, NvsEntry>::iterator existing = space.find(key);
+  size_t freed = (existing == space.end()) ? 0 : nvsEntryCount(existing->second);
+
+  if (nvsUsedEntries() - freed + nvsEntryCount(entry) > HOST_NVS_ENTRIES) return 0;
+
+  space[key] = entry;
+
+  return length;
+
+}
+
+size_t Preferences::get(const char *key, PreferenceType type, void *value, size_t length) {
+
+  std::lock_guard<std::mutex> lock(nvsMutex);
+
+  if (!started) return 0;
+
+  std::map<std::string, NvsEntry> &space = nvsStore[nameSpace.c_str()];
+  std::map<std::string, NvsEntry>::iterator entry = space.find(key);
+
+  if (entry == space.end() || entry->second.type != type || entry->second.data.size() > length) return 0;
+
+  if (!entry->second.data.empty()) memcpy(value, &entry->second.data[0], entry->second.data.size());
+
+  return entry->second.data.size();
+
+}
+
+String Preferences::getString(const char *key, const String defaultValue) {
+  size_t length = getBytesLength(key);
+  if (getType(key) != PT_STR || length == 0) return defaultValue;
+  std::vector<char> text(length);
+  return get(key, PT_STR, &text[0], length) ? String(&text[0]) : defaultValue;
+}
+
+size_t Preferences::getString(const char *key, char *value, size_t maxLength) {
+  return get(key, PT_STR, value, maxLength);
+}
+
+size_t Preferences::getBytesLength(const char *key) {
+  std::lock_guard<std::mutex> lock(nvsMutex);
+  if (!started) return 0;
+  std::map<std::string, NvsEntry> &space = nvsStore[nameSpace.c_str()];
+  std::map<std::string, NvsEntry>::iterator entry = space.find(key);
+  return (entry == space.end()) ? 0 : entry->second.data.size();
+}
+
+size_t Preferences::getBytes(const char *key, void *buffer, size_t maxLength) {
+  return get(key, PT_BLOB, buffer, maxLength);
+}
+
+
+
+
+/***********************************************************
+ * ROM CRC32 (reflected, polynomial 0xEDB88320)
+ ***/
+uint32_t crc32_le(uint32_t crc, const uint8_t *buffer, uint32_t length) {
+
+  crc = ~crc;
+
+  while (length--) {
+    crc ^= *buffer++;
+    for (int bit = 0; bit < 8; bit++) crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+  }
+
+  return ~crc;
+
+}
@@ -0,0 +1,80 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file hal.h
+ *
+ * @brief Host (native) hardware abstraction controls
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * The native build ([env:native] in platformio.ini) compiles the firmware sources against the headers in
+ * this directory instead of the ESP32 Arduino core. They stand in for the parts of the core the firmware
+ * touches, with just enough behaviour to run on a Linux / macOS host:
+ *
+ *   Arduino.h / WString.h / Print.h - clock, GPIO, Serial (stdout / injected input), String, ESP
+ *   freertos/                  - tasks run as host threads, notifications, semaphores, queues, portMUX
+ *   Wire.h                     - I2C bus of fake register devices. The ADC (ADS1X15.h) and BME280
+ *                                (TinyBME280.h) are register devices, so the ADC is faked by writing its
+ *                                conversion register
+ *   Preferences.h / nvs.h      - in-memory NVS with the ESP32 key types
+ *   FS.h / LittleFS.h / SPIFFS.h / SD.h - file systems mapped onto host directories
+ *   WiFi.h / ESPmDNS.h / AsyncTCP.h - always connected, TCP peers are played in-process
+ *   ESPAsyncWebServer.h        - requests are run through the server in-process, see the header
+ *   Update.h / mbedtls/        - OTA image kept in memory, SHA-256
+ *   esp32/rom/crc.h            - ROM CRC32
+ *
+ * globals.cpp owns what the sketch owns on target, as the sketch is not part of the native build.
+ *
+ * The functions below drive the fakes (set the clock, feed serial input, load device registers).
+ *
+ ***/
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+
+namespace HAL {
+
+	// Clock. Real time by default, manual once setClock() is called (delay() then advances the clock)
+	void setClock(uint32_t timeMs);
+	void advanceClock(uint32_t timeMs);
+	void useRealClock();
+
+	// GPIO. Pins read back what was last written or set, analog readings are raw 12 bit counts
+	void setPin(uint8_t pin, uint8_t level);
+	uint8_t pinLevel(uint8_t pin);
+	void setAnalog(uint8_t pin, uint16_t value);
+
+	// Serial input, returned by Serial.read() / Serial2.read()
+	void serialInput(const char *data);
+	void serial2Input(const uint8_t *data, size_t length);
+
+	// Serial output. Capture keeps Serial output off stdout until taken with serialOutput()
+	void serialCapture(bool enable);
+	std::string serialOutput();
+	std::string serial2Output();
+
+	// I2C register devices. Registers are 8 bit addressed, multi byte values are stored big endian
+	void i2cAttach(uint8_t address);
+	void i2cDetach(uint8_t address);
+	void i2cWriteRegister(uint8_t address, uint8_t reg, const uint8_t *data, size_t length);
+	void i2cWriteRegister16(uint8_t address, uint8_t reg, uint16_t value);
+	size_t i2cReadRegister(uint8_t address, uint8_t reg, uint8_t *data, size_t length);
+
+	// NVS
+	void nvsClear();
+
+	// File systems live in <root>/littlefs and <root>/spiffs (default root ./native_fs)
+	void setFilesystemRoot(const char *path);
+
+}
@@ -0,0 +1,37 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file sha256.h
+ *
+ * @brief Host (native) mbedTLS SHA-256
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * FIPS 180-4 SHA-256 with the mbedTLS context API. SHA-224 (is224) is not supported.
+ *
+ ***/
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+typedef struct mbedtls_sha256_context {
+	uint32_t total[2];
+	uint32_t state[8];
+	unsigned char buffer[64];
+} mbedtls_sha256_context;
+
+void mbedtls_sha256_init(mbedtls_sha256_context *context);
+void mbedtls_sha256_free(mbedtls_sha256_context *context);
+int mbedtls_sha256_starts(mbedtls_sha256_context *context, int is224);
+int mbedtls_sha256_update(mbedtls_sha256_context *context, const unsigned char *input, size_t length);
+int mbedtls_sha256_finish(mbedtls_sha256_context *context, unsigned char output[32]);
@@ -0,0 +1,480 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file network.cpp
+ *
+ * @brief Host (native) WiFi, TCP, web server and event sources
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ ***/
+#include <map>
+#include <set>
+
+#include "WiFi.h"
+#include "ESPmDNS.h"
+#include "AsyncTCP.h"
+#include "ESPAsyncWebServer.h"
+
+
+WiFiClass WiFi;
+MDNSResponder MDNS;
+
+
+/***********************************************************
+ * AsyncTCP - listening servers by port, live clients so connect() can tell if the handler kept one
+ ***/
+static std::mutex tcpMutex;
+static std::map<uint16_t, AsyncServer *> tcpServers;
+static std::set<const AsyncClient *> tcpClients;
+
+AsyncClient::AsyncClient() {
+  std::lock_guard<std::mutex> lock(tcpMutex);
+  tcpClients.insert(this);
+}
+
+AsyncClient::~AsyncClient() {
+  std::lock_guard<std::mutex> lock(tcpMutex);
+  tcpClients.erase(this);
+}
+
+bool AsyncClient::exists(const AsyncClient *client) {
+  std::lock_guard<std::mutex> lock(tcpMutex);
+  return tcpClients.count(client) > 0;
+}
+
+void AsyncServer::begin() {
+  std::lock_guard<std::mutex> lock(tcpMutex);
+  tcpServers[port] = this;
+  listening = true;
+}
+
+void AsyncServer::end() {
+  std::lock_guard<std::mutex> lock(tcpMutex);
+  if (listening && tcpServers[port] == this) tcpServers.erase(port);
+  listening = false;
+}
+
+AsyncClient * AsyncServer::connect(uint16_t port) {
+
+  AsyncServer *server = NULL;
+  {
+    std::lock_guard<std::mutex> lock(tcpMutex);
+    std::map<uint16_t, AsyncServer *>::iterator entry = tcpServers.find(port);
+    if (entry != tcpServers.end()) server = entry->second;
+  }
+
+  if (server == NULL || !server->clientHandler) return NULL;
+
+  AsyncClient *client = new AsyncClient();
+  server->clientHandler(server->clientArg, client);
+
+  // The handler may refuse the connection by closing (and deleting) the client
+  return (AsyncClient::exists(client) && client->connected()) ? client : NULL;
+
+}
+
+void AsyncClient::receive(const void *data, size_t length) {
+  if (open && dataHandler) dataHandler(dataArg, this, (void *)data, length);
+}
+
+void AsyncClient::close(bool now) {
+  if (!open) return;
+  open = false;
+  // May delete this, so it is the last thing done
+  if (disconnectHandler) disconnectHandler(disconnectArg, this);
+}
+
+
+
+
+/***********************************************************
+ * Response - template expansion follows AsyncAbstractResponse::_fillBufferAndProcessTemplates
+ ***/
+#define HOST_TCP_SEGMENT 1460
+
+AsyncWebServerResponse::AsyncWebServerResponse(int code, const String &contentType, const String &text, AwsTemplateProcessor callback) : responseCode(code), type(contentType), content(text), processor(callback) {
+}
+
+AsyncWebServerResponse::AsyncWebServerResponse(int code, const String &contentType, AwsResponseFiller source, AwsTemplateProcessor callback) : responseCode(code), type(contentType), filler(source), processor(callback) {
+}
+
+bool AsyncWebServerResponse::addHeader(const char *name, const char *value, bool replace) {
+  for (size_t i = 0; i < headers.size(); i++) {
+    if (!headers[i].name().equalsIgnoreCase(name)) continue;
+    if (!replace) return false;
+    headers[i] = AsyncWebHeader(name, value);
+    return true;
+  }
+  headers.push_back(AsyncWebHeader(name, value));
+  return true;
+}
+
+const AsyncWebHeader * AsyncWebServerResponse::getHeader(const char *name) const {
+  for (size_t i = 0; i < headers.size(); i++) {
+    if (headers[i].name().equalsIgnoreCase(name)) return &headers[i];
+  }
+  return NULL;
+}
+
+String AsyncWebServerResponse::body(size_t chunkSize) {
+
+  std::string raw(content.c_str(), content.length());
+
+  if (filler) {
+    uint8_t buffer[HOST_TCP_SEGMENT];
+    size_t maxLen = (chunkSize == 0 || chunkSize > sizeof(buffer)) ? sizeof(buffer) : chunkSize;
+    size_t index = raw.size();
+    for (;;) {
+      size_t length = filler(buffer, maxLen, index);
+      if (length == RESPONSE_TRY_AGAIN) continue;
+      if (length == 0) break;
+      raw.append((const char *)buffer, length);
+      index += length;
+    }
+    filler = nullptr;
+  }
+
+  if (processor) {
+    std::string expanded;
+    size_t position = 0;
+    while (position < raw.size()) {
+      size_t start = raw.find(TEMPLATE_PLACEHOLDER, position);
+      if (start == std::string::npos) {
+        expanded.append(raw, position, std::string::npos);
+        break;
+      }
+      expanded.append(raw, position, start - position);
+      // A doubled placeholder is a literal placeholder character
+      if (start + 1 < raw.size() && raw[start + 1] == TEMPLATE_PLACEHOLDER) {
+        expanded += TEMPLATE_PLACEHOLDER;
+        position = start + 2;
+        continue;
+      }
+      size_t end = raw.find(TEMPLATE_PLACEHOLDER, start + 1);
+      if (end == std::string::npos || end - start - 1 > TEMPLATE_PARAM_NAME_LENGTH) {
+        expanded += TEMPLATE_PLACEHOLDER;
+        position = start + 1;
+        continue;
+      }
+      String value = processor(String(raw.substr(start + 1, end - start - 1).c_str()));
+      expanded.append(value.c_str(), value.length());
+      position = end + 1;
+    }
+    raw.swap(expanded);
+    processor = nullptr;
+  }
+
+  content = String(raw.c_str(), raw.size());
+
+  return content;
+
+}
+
+
+
+
+/***********************************************************
+ * Request
+ ***/
+AsyncWebServerRequest::~AsyncWebServerRequest() {
+  delete requestResponse;
+}
+
+const AsyncWebParameter * AsyncWebServerRequest::getParam(const char *name, bool post, bool file) const {
+  for (size_t i = 0; i < parameters.size(); i++) {
+    if (parameters[i].name() == name && parameters[i].isPost() == post && parameters[i].isFile() == file) return &parameters[i];
+  }
+  return NULL;
+}
+
+const String & AsyncWebServerRequest::arg(const char *name) const {
+  static const String empty;
+  const AsyncWebParameter *param = getParam(name);
+  if (param == NULL) param = getParam(name, true);
+  return param ? param->value() : empty;
+}
+
+const AsyncWebHeader * AsyncWebServerRequest::getHeader(const char *name) const {
+  for (size_t i = 0; i < headers.size(); i++) {
+    if (headers[i].name().equalsIgnoreCase(name)) return &headers[i];
+  }
+  return NULL;
+}
+
+void AsyncWebServerRequest::redirect(const char *url, int code) {
+  AsyncWebServerResponse *response = beginResponse(code);
+  response->addHeader("Location", url);
+  send(response);
+}
+
+void AsyncWebServerRequest::send(AsyncWebServerResponse *response) {
+  // Only the first response is sent
+  if (requestResponse) {
+    delete response;
+    return;
+  }
+  requestResponse = response;
+}
+
+void AsyncWebServerRequest::send(FS &fs, const String &path, const String &contentType, bool download, AwsTemplateProcessor callback) {
+
+  File file = fs.open(path, FILE_READ);
+
+  if (!file || file.isDirectory()) {
+    send(404);
+    return;
+  }
+
+  std::string data(file.size(), 0);
+  if (!data.empty()) data.resize(file.read((uint8_t *)&data[0], data.size()));
+
+  AsyncWebServerResponse *response = beginResponse(200, contentType.length() ? contentType : String(asyncsrv::T_text_plain), String(data.c_str(), data.size()), callback);
+  if (download) response->addHeader("Content-Disposition", (String("attachment; filename=") + file.name()).c_str());
+  send(response);
+
+}
+
+
+
+
+/***********************************************************
+ * Server
+ ***/
+static std::map<uint16_t, AsyncWebServer *> webServers;
+
+AsyncWebServer::~AsyncWebServer() {
+  end();
+  reset();
+}
+
+void AsyncWebServer::reset() {
+  for (std::list<AsyncWebHandler *>::iterator handler = handlers.begin(); handler != handlers.end(); ++handler) {
+    // Event sources are owned by the firmware
+    if (dynamic_cast<AsyncCallbackWebHandler *>(*handler)) delete *handler;
+  }
+  handlers.clear();
+  rewrites.clear();
+  middleware.clear();
+  notFoundHandler = nullptr;
+  uploadHandler = nullptr;
+}
+
+void AsyncWebServer::begin() {
+  std::lock_guard<std::mutex> lock(tcpMutex);
+  webServers[port] = this;
+}
+
+void AsyncWebServer::end() {
+  std::lock_guard<std::mutex> lock(tcpMutex);
+  std::map<uint16_t, AsyncWebServer *>::iterator entry = webServers.find(port);
+  if (entry != webServers.end() && entry->second == this) webServers.erase(entry);
+}
+
+AsyncWebServer * AsyncWebServer::find(uint16_t port) {
+  std::lock_guard<std::mutex> lock(tcpMutex);
+  std::map<uint16_t, AsyncWebServer *>::iterator entry = webServers.find(port);
+  return (entry == webServers.end()) ? NULL : entry->second;
+}
+
+AsyncCallbackWebHandler & AsyncWebServer::on(const char *uri, WebRequestMethodComposite method, ArRequestHandlerFunction onRequest, ArUploadHandlerFunction onUpload, ArBodyHandlerFunction onBody) {
+  AsyncCallbackWebHandler *handler = new AsyncCallbackWebHandler(uri, method, onRequest, onUpload);
+  handlers.push_back(handler);
+  return *handler;
+}
+
+bool AsyncCallbackWebHandler::canHandle(AsyncWebServerRequest *request) const {
+
+  if (!(methods & request->method())) return false;
+
+  const String &url = request->url();
+
+  // "/path/*" matches anything under /path, "/path" matches /path and /path/...
+  if (uri.endsWith("*")) return url.startsWith(uri.substring(0, uri.length() - 1));
+
+  return url == uri || (url.startsWith(uri + "/"));
+
+}
+
+void AsyncWebServer::dispatch(AsyncWebServerRequest *request) {
+
+  AsyncWebHandler *handler = NULL;
+
+  for (std::list<AsyncWebHandler *>::iterator entry = handlers.begin(); entry != handlers.end(); ++entry) {
+    if ((*entry)->canHandle(request)) {
+      handler = *entry;
+      break;
+    }
+  }
+
+  if (request->hasUpload) {
+    AsyncCallbackWebHandler *callback = dynamic_cast<AsyncCallbackWebHandler *>(handler);
+    bool own = callback && callback->hasUploadHandler();
+    size_t total = request->uploadData.size();
+    size_t index = 0;
+    do {
+      size_t length = std::min((size_t)HOST_TCP_SEGMENT, total - index);
+      uint8_t *data = (uint8_t *)&request->uploadData[0] + index;
+      bool final = (index + length == total);
+      if (own) {
+        callback->handleUpload(request, request->uploadName, index, data, length, final);
+      } else if (uploadHandler) {
+        uploadHandler(request, request->uploadName, index, data, length, final);
+      }
+      index += length;
+    } while (index < total);
+  }
+
+  if (handler) {
+    handler->handleRequest(request);
+  } else if (notFoundHandler) {
+    notFoundHandler(request);
+  } else {
+    request->send(404);
+  }
+
+}
+
+AsyncEventSource * AsyncWebServer::eventSource(const char *url) {
+  for (std::list<AsyncWebHandler *>::iterator handler = handlers.begin(); handler != handlers.end(); ++handler) {
+    AsyncEventSource *source = dynamic_cast<AsyncEventSource *>(*handler);
+    if (source && strcmp(source->url(), url) == 0) return source;
+  }
+  return NULL;
+}
+
+AsyncWebServerResponse * AsyncWebServer::handle(AsyncWebServerRequest *request) {
+
+  for (size_t i = 0; i < rewrites.size(); i++) {
+    if (request->requestUrl == rewrites[i].first) request->requestUrl = rewrites[i].second;
+  }
+
+  // Middleware runs in order, each one passing on by calling next()
+  std::function<void(size_t)> run = [this, request, &run](size_t position) {
+    if (position == middleware.size()) {
+      dispatch(request);
+    } else {
+      middleware[position](request, [&run, position]() { run(position + 1); });
+    }
+  };
+  run(0);
+
+  return request->requestResponse;
+
+}
+
+
+
+
+/***********************************************************
+ * Event sources
+ ***/
+bool AsyncEventSourceClient::write(AsyncEvent_SharedData_t message) {
+  std::lock_guard<std::mutex> lock(queueMutex);
+  if (!open || queue.size() >= SSE_MAX_QUEUED_MESSAGES) return false;
+  queue.push_back(message);
+  return true;
+}
+
+bool AsyncEventSourceClient::send(const char *message, const char *event, uint32_t id, uint32_t reconnect) {
+
+  String frame;
+
+  if (reconnect) frame += String("retry: ") + String(reconnect) + "\r\n";
+  if (id) frame += String("id: ") + String(id) + "\r\n";
+  if (event) frame += String("event: ") + event + "\r\n";
+  if (message) frame += String("data: ") + message + "\r\n";
+  frame += "\r\n";
+
+  return write(std::make_shared<String>(frame));
+
+}
+
+size_t AsyncEventSourceClient::deliver(size_t count) {
+  std::lock_guard<std::mutex> lock(queueMutex);
+  size_t taken = 0;
+  while (taken < count && !queue.empty()) {
+    stream.append(queue.front()->c_str(), queue.front()->length());
+    queue.pop_front();
+    taken++;
+  }
+  return taken;
+}
+
+void AsyncEventSourceClient::close() {
+  {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    if (!open) return;
+    open = false;
+    queue.clear();
+  }
+  source->closed(this);
+}
+
+AsyncEventSource::~AsyncEventSource() {
+  for (std::list<AsyncEventSourceClient *>::iterator client = clients.begin(); client != clients.end(); ++client) delete *client;
+}
+
+AsyncEventSourceClient * AsyncEventSource::connect() {
+  AsyncEventSourceClient *client = new AsyncEventSourceClient(this);
+  {
+    std::lock_guard<std::mutex> lock(clientMutex);
+    clients.push_back(client);
+  }
+  if (connectHandler) connectHandler(client);
+  return client;
+}
+
+void AsyncEventSource::closed(AsyncEventSourceClient *client) {
+  // Closed clients stay listed (and allocated) until the source goes, as the firmware may still hold them
+  if (disconnectHandler) disconnectHandler(client);
+}
+
+void AsyncEventSource::close() {
+  std::list<AsyncEventSourceClient *> open;
+  {
+    std::lock_guard<std::mutex> lock(clientMutex);
+    open = clients;
+  }
+  for (std::list<AsyncEventSourceClient *>::iterator client = open.begin(); client != open.end(); ++client) (*client)->close();
+}
+
+void AsyncEventSource::send(const char *message, const char *event, uint32_t id, uint32_t reconnect) {
+  std::list<AsyncEventSourceClient *> open;
+  {
+    std::lock_guard<std::mutex> lock(clientMutex);
+    open = clients;
+  }
+  for (std::list<AsyncEventSourceClient *>::iterator client = open.begin(); client != open.end(); ++client) {
+    if ((*client)->connected()) (*client)->send(message, event, id, reconnect);
+  }
+}
+
+size_t AsyncEventSource::count() const {
+  std::lock_guard<std::mutex> lock(clientMutex);
+  size_t open = 0;
+  for (std::list<AsyncEventSourceClient *>::const_iterator client = clients.begin(); client != clients.end(); ++client) {
+    if ((*client)->connected()) open++;
+  }
+  return open;
+}
+
+size_t AsyncEventSource::avgPacketsWaiting() const {
+  std::lock_guard<std::mutex> lock(clientMutex);
+  size_t waiting = 0;
+  size_t open = 0;
+  for (std::list<AsyncEventSourceClient *>::const_iterator client = clients.begin(); client != clients.end(); ++client) {
+    if (!(*client)->connected()) continue;
+    waiting += (*client)->packetsWaiting();
+    open++;
+  }
+  return open ? (waiting + open - 1) / open : 0;
+}
@@ -0,0 +1,33 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file nvs.h
+ *
+ * @brief Host (native) NVS statistics
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ ***/
+#pragma once
+
+#include <stddef.h>
+
+#include "esp_err.h"
+
+
+typedef struct {
+	size_t used_entries;
+	size_t free_entries;
+	size_t total_entries;
+	size_t namespace_count;
+} nvs_stats_t;
+
+esp_err_t nvs_get_stats(const char *partitionName, nvs_stats_t *stats);
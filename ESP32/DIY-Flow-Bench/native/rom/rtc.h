@@ -0,0 +1,43 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file rtc.h
+ *
+ * @brief Host (native) ROM reset reason
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * The host always reports a power on reset.
+ *
+ ***/
+#pragma once
+
+
+typedef enum {
+	NO_MEAN = 0,
+	POWERON_RESET = 1,
+	SW_RESET = 3,
+	OWDT_RESET = 4,
+	DEEPSLEEP_RESET = 5,
+	SDIO_RESET = 6,
+	TG0WDT_SYS_RESET = 7,
+	TG1WDT_SYS_RESET = 8,
+	RTCWDT_SYS_RESET = 9,
+	INTRUSION_RESET = 10,
+	TGWDT_CPU_RESET = 11,
+	SW_CPU_RESET = 12,
+	RTCWDT_CPU_RESET = 13,
+	EXT_CPU_RESET = 14,
+	RTCWDT_BROWN_OUT_RESET = 15,
+	RTCWDT_RTC_RESET = 16
+} RESET_REASON;
+
+inline RESET_REASON rtc_get_reset_reason(int cpu) { return POWERON_RESET; }
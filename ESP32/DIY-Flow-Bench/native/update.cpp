@@ -0,0 +1,207 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file update.cpp
+ *
+ * @brief Host (native) OTA update and SHA-256
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ ***/
+#include "Update.h"
+#include "mbedtls/sha256.h"
+
+
+UpdateClass Update;
+
+
+/***********************************************************
+ * Update - the image is kept in memory
+ ***/
+bool UpdateClass::begin(size_t size) {
+
+  if (running) return false;
+
+  if (size != UPDATE_SIZE_UNKNOWN && size > ESP.getFreeSketchSpace()) {
+    error = UPDATE_ERROR_SPACE;
+    return false;
+  }
+
+  buffer.clear();
+  written.clear();
+  imageSize = size;
+  error = UPDATE_ERROR_OK;
+  running = true;
+
+  return true;
+
+}
+
+size_t UpdateClass::write(uint8_t *data, size_t length) {
+
+  if (!running || hasError()) return 0;
+
+  if (imageSize != UPDATE_SIZE_UNKNOWN && buffer.size() + length > imageSize) {
+    error = UPDATE_ERROR_SPACE;
+    return 0;
+  }
+
+  buffer.append((const char *)data, length);
+
+  return length;
+
+}
+
+bool UpdateClass::end(bool evenIfRemaining) {
+
+  if (!running || hasError()) return false;
+
+  running = false;
+
+  if (buffer.empty() || (!evenIfRemaining && imageSize != UPDATE_SIZE_UNKNOWN && buffer.size() != imageSize)) {
+    error = UPDATE_ERROR_SIZE;
+    return false;
+  }
+
+  written.swap(buffer);
+  buffer.clear();
+
+  return true;
+
+}
+
+void UpdateClass::abort() {
+  buffer.clear();
+  running = false;
+  error = UPDATE_ERROR_ABORT;
+}
+
+const char * UpdateClass::errorString() const {
+  switch (error) {
+    case UPDATE_ERROR_OK: return "No Error";
+    case UPDATE_ERROR_WRITE: return "Flash Write Failed";
+    case UPDATE_ERROR_SPACE: return "Not Enough Space";
+    case UPDATE_ERROR_SIZE: return "Bad Size Given";
+    case UPDATE_ERROR_ABORT: return "Update Aborted";
+    default: return "UNKNOWN";
+  }
+}
+
+
+
+
+/***********************************************************
+ * SHA-256 (FIPS 180-4)
+ ***/
+static const uint32_t sha256K[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline uint32_t rotateRight(uint32_t value, int bits) {
+  return (value >> bits) | (value << (32 - bits));
+}
+
+static void sha256Block(mbedtls_sha256_context *context, const unsigned char *block) {
+
+  uint32_t w[64];
+
+  for (int i = 0; i < 16; i++) w[i] = ((uint32_t)block[i * 4] << 24) | ((uint32_t)block[i * 4 + 1] << 16) | ((uint32_t)block[i * 4 + 2] << 8) | block[i * 4 + 3];
+
+  for (int i = 16; i < 64; i++) {
+    uint32_t s0 = rotateRight(w[i - 15], 7) ^ rotateRight(w[i - 15], 18) ^ (w[i - 15] >> 3);
+    uint32_t s1 = rotateRight(w[i - 2], 17) ^ rotateRight(w[i - 2], 19) ^ (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  uint32_t a = context->state[0], b = context->state[1], c = context->state[2], d = context->state[3];
+  uint32_t e = context->state[4], f = context->state[5], g = context->state[6], h = context->state[7];
+
+  for (int i = 0; i < 64; i++) {
+    uint32_t t1 = h + (rotateRight(e, 6) ^ rotateRight(e, 11) ^ rotateRight(e, 25)) + ((e & f) ^ (~e & g)) + sha256K[i] + w[i];
+    uint32_t t2 = (rotateRight(a, 2) ^ rotateRight(a, 13) ^ rotateRight(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+    h = g; g = f; f = e; e = d + t1;
+    d = c; c = b; b = a; a = t1 + t2;
+  }
+
+  context->state[0] += a; context->state[1] += b; context->state[2] += c; context->state[3] += d;
+  context->state[4] += e; context->state[5] += f; context->state[6] += g; context->state[7] += h;
+
+}
+
+void mbedtls_sha256_init(mbedtls_sha256_context *context) {
+  memset(context, 0, sizeof(*context));
+}
+
+void mbedtls_sha256_free(mbedtls_sha256_context *context) {
+  if (context) memset(context, 0, sizeof(*context));
+}
+
+int mbedtls_sha256_starts(mbedtls_sha256_context *context, int is224) {
+
+  static const uint32_t initial[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+
+  if (is224) return -1;
+
+  context->total[0] = 0;
+  context->total[1] = 0;
+  memcpy(context->state, initial, sizeof(initial));
+
+  return 0;
+
+}
+
+int mbedtls_sha256_update(mbedtls_sha256_context *context, const unsigned char *input, size_t length) {
+
+  while (length > 0) {
+    size_t used = context->total[0] & 0x3F;
+    size_t fill = std::min(length, (size_t)64 - used);
+    memcpy(context->buffer + used, input, fill);
+    context->total[0] += fill;
+    if (context->total[0] < fill) context->total[1]++;
+    if (used + fill == 64) sha256Block(context, context->buffer);
+    input += fill;
+    length -= fill;
+  }
+
+  return 0;
+
+}
+
+int mbedtls_sha256_finish(mbedtls_sha256_context *context, unsigned char output[32]) {
+
+  uint64_t bits = (((uint64_t)context->total[1] << 32) | context->total[0]) << 3;
+  unsigned char padding[72] = {0x80};
+  size_t used = context->total[0] & 0x3F;
+  size_t padLength = (used < 56) ? 56 - used : 120 - used;
+  unsigned char length[8];
+
+  for (int i = 0; i < 8; i++) length[i] = (unsigned char)(bits >> (56 - i * 8));
+
+  mbedtls_sha256_update(context, padding, padLength);
+  mbedtls_sha256_update(context, length, 8);
+
+  for (int i = 0; i < 8; i++) {
+    output[i * 4] = (unsigned char)(context->state[i] >> 24);
+    output[i * 4 + 1] = (unsigned char)(context->state[i] >> 16);
+    output[i * 4 + 2] = (unsigned char)(context->state[i] >> 8);
+    output[i * 4 + 3] = (unsigned char)context->state[i];
+  }
+
+  return 0;
+
+}
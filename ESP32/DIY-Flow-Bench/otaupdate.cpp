@@ -0,0 +1,625 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file otaupdate.cpp
+ *
+ * @brief OTAUpdate class - streaming firmware update with inflate and SHA-256 verification
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * Accepts raw (.bin), gzip (.bin.gz) or zlib (.bin.z) firmware images as produced by tools/user_actions_post.py
+ * Compressed images are inflated on the fly using miniz (tinfl) into a 32KB circular dictionary.
+ * Inflated data is hashed and staged into two flash sector sized buffers. Full buffers are handed to
+ * a writer task so that flash erase / write time does not stall the async_tcp task receiving the upload.
+ *
+ ***/
+#include "Arduino.h"
+#include <Update.h>
+#include "mbedtls/sha256.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+#include "system.h"
+#include "constants.h"
+#include "structs.h"
+
+#define MINIZ_NO_STDIO
+#define MINIZ_NO_TIME
+#define MINIZ_NO_DEFLATE_APIS
+#define MINIZ_NO_ARCHIVE_APIS
+#define MINIZ_NO_ARCHIVE_WRITING_APIS
+#define MINIZ_NO_ZLIB_COMPATIBLE_NAME
+#include "miniz.h"
+
+#include "messages.h"
+#include "otaupdate.h"
+
+
+// gzip header flags (RFC 1952)
+#define GZIP_FHCRC 0x02
+#define GZIP_FEXTRA 0x04
+#define GZIP_FNAME 0x08
+#define GZIP_FCOMMENT 0x10
+
+// gzip header parse states
+#define GZIP_FIXED 0
+#define GZIP_XLEN 1
+#define GZIP_EXTRA 2
+#define GZIP_NAME 3
+#define GZIP_COMMENT 4
+#define GZIP_HCRC 5
+#define GZIP_DONE 6
+
+
+struct OTABlock {
+  uint8_t index;
+  uint16_t length;
+};
+
+
+// Update state persists across upload chunks
+static tinfl_decompressor *otaInflator = NULL;
+static uint8_t *otaDict = NULL;
+static size_t otaDictOffset = 0;
+static uint8_t *otaBuffer[2] = {NULL, NULL};
+static uint8_t otaActiveBuffer = 0;
+static size_t otaBufferFill = 0;
+static QueueHandle_t otaBlockQueue = NULL;
+static SemaphoreHandle_t otaFreeBuffers = NULL;
+static SemaphoreHandle_t otaWriterDone = NULL;
+static mbedtls_sha256_context otaSHA;
+static String otaExpectedSHA;
+static String otaError;
+static int otaEncoding = OTA_RAW;
+static bool otaStarted = false;
+static bool otaEncodingKnown = false;
+static bool otaInflateDone = false;
+static volatile bool otaWriteError = false;
+static size_t otaImageSize = 0;
+static uint8_t otaGzipState = GZIP_FIXED;
+static uint8_t otaGzipFlags = 0;
+static size_t otaGzipCount = 0;
+static size_t otaGzipExtraLen = 0;
+static uint32_t otaSession = 0;
+
+
+
+
+/***********************************************************
+ * @brief TASK: Write staged firmware blocks to flash
+ * @details Receives full staging buffers from the upload handler and writes them to the OTA partition
+ * @note A zero length block ends the task
+ ***/
+static void TASKwriteFirmware(void * parameter) {
+
+  OTABlock block;
+
+  for (;;) {
+
+    xQueueReceive(otaBlockQueue, &block, portMAX_DELAY);
+
+    if (block.length == 0) break;
+
+    if (!otaWriteError && Update.write(otaBuffer[block.index], block.length) != block.length) {
+      otaWriteError = true;
+    }
+
+    xSemaphoreGive(otaFreeBuffers);
+  }
+
+  xSemaphoreGive(otaWriterDone);
+  vTaskDelete(NULL);
+
+}
+
+
+
+
+/***********************************************************
+ * @brief Class constructor
+ ***/
+OTAUpdate::OTAUpdate() {
+}
+
+
+
+
+/***********************************************************
+ * @brief begin
+ * @details Allocate buffers, start the writer task and open the OTA partition
+ * @param expectedSHA256 hex digest of the uncompressed image (from the release manifest)
+ * @note An image without a digest is refused unless settings.ota_allow_unverified is set
+ ***/
+bool OTAUpdate::begin(String expectedSHA256) {
+
+  extern struct BenchSettings settings;
+
+  Messages _message;
+
+  // A previous upload that never completed (client dropped) still holds resources
+  if (otaStarted) this->abort();
+
+  otaSession++;
+  otaError = "";
+  otaExpectedSHA = expectedSHA256;
+  otaExpectedSHA.trim();
+  otaExpectedSHA.toLowerCase();
+
+  if (otaExpectedSHA.length() == 0 && !settings.ota_allow_unverified) {
+    otaError = "No SHA-256 supplied for image";
+    return false;
+  }
+
+  if (otaExpectedSHA.length() > 0 && otaExpectedSHA.length() != 64) {
+    otaError = "Invalid SHA-256";
+    return false;
+  }
+
+  otaEncoding = OTA_RAW;
+  otaEncodingKnown = false;
+  otaInflateDone = false;
+  otaWriteError = false;
+  otaImageSize = 0;
+  otaDictOffset = 0;
+  otaBufferFill = 0;
+  otaActiveBuffer = 0;
+  otaGzipState = GZIP_FIXED;
+  otaGzipFlags = 0;
+  otaGzipCount = 0;
+  otaGzipExtraLen = 0;
+
+  otaBuffer[0] = (uint8_t *)malloc(OTA_BUFFER_SIZE);
+  otaBuffer[1] = (uint8_t *)malloc(OTA_BUFFER_SIZE);
+  otaBlockQueue = xQueueCreate(2, sizeof(OTABlock));
+  otaFreeBuffers = xSemaphoreCreateCounting(2, 2);
+  otaWriterDone = xSemaphoreCreateBinary();
+
+  if (otaBuffer[0] == NULL || otaBuffer[1] == NULL || otaBlockQueue == NULL || otaFreeBuffers == NULL || otaWriterDone == NULL) {
+    otaError = "Not enough memory for update buffers";
+    this->releaseBuffers();
+    return false;
+  }
+
+  if (!Update.begin((ESP.getFreeSketchSpace() - 0x1000) & 0xFFFFF000)) {
+    otaError = "Not enough room for firmware";
+    this->releaseBuffers();
+    return false;
+  }
+
+  // Writer task runs on the core opposite async_tcp
+  if (xTaskCreatePinnedToCore(TASKwriteFirmware, "OTA_WRITE", OTA_TASK_MEM_STACK, NULL, 1, NULL, 0) != pdPASS) {
+    otaError = "Could not start writer task";
+    Update.abort();
+    this->releaseBuffers();
+    return false;
+  }
+
+  // Take ownership of the first staging buffer
+  xSemaphoreTake(otaFreeBuffers, portMAX_DELAY);
+
+  mbedtls_sha256_init(&otaSHA);
+  mbedtls_sha256_starts(&otaSHA, 0);
+
+  otaStarted = true;
+
+  if (otaExpectedSHA.length() == 0) _message.debugPrintf("Update has no SHA-256 - image will not be verified (unverified updates enabled)\n");
+
+  return true;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief parseGzipHeader
+ * @details Consume the gzip member header (RFC 1952) which may be split across upload chunks
+ * @returns true once the header has been fully consumed. data / len are advanced past the header bytes
+ ***/
+bool OTAUpdate::parseGzipHeader(const uint8_t *&data, size_t &len) {
+
+  for (;;) {
+
+    // Skip optional header fields that are not flagged
+    if (otaGzipState == GZIP_XLEN && !(otaGzipFlags & GZIP_FEXTRA)) otaGzipState = GZIP_NAME;
+    if (otaGzipState == GZIP_NAME && !(otaGzipFlags & GZIP_FNAME)) otaGzipState = GZIP_COMMENT;
+    if (otaGzipState == GZIP_COMMENT && !(otaGzipFlags & GZIP_FCOMMENT)) otaGzipState = GZIP_HCRC;
+    if (otaGzipState == GZIP_HCRC && !(otaGzipFlags & GZIP_FHCRC)) otaGzipState = GZIP_DONE;
+
+    if (otaGzipState == GZIP_DONE || len == 0) break;
+
+    uint8_t byte = *data++;
+    len--;
+
+    switch (otaGzipState) {
+
+      case GZIP_FIXED:
+        // ID1 ID2 CM FLG MTIME(4) XFL OS
+        if (otaGzipCount == 2 && byte != 8) otaError = "Unsupported gzip compression method";
+        if (otaGzipCount == 3) otaGzipFlags = byte;
+        if (++otaGzipCount == 10) {
+          otaGzipCount = 0;
+          otaGzipState = GZIP_XLEN;
+        }
+      break;
+
+      case GZIP_XLEN:
+        otaGzipExtraLen |= ((size_t)byte << (8 * otaGzipCount));
+        if (++otaGzipCount == 2) {
+          otaGzipCount = 0;
+          otaGzipState = (otaGzipExtraLen > 0) ? GZIP_EXTRA : GZIP_NAME;
+        }
+      break;
+
+      case GZIP_EXTRA:
+        if (++otaGzipCount == otaGzipExtraLen) {
+          otaGzipCount = 0;
+          otaGzipState = GZIP_NAME;
+        }
+      break;
+
+      case GZIP_NAME:
+        if (byte == 0) otaGzipState = GZIP_COMMENT;
+      break;
+
+      case GZIP_COMMENT:
+        if (byte == 0) otaGzipState = GZIP_HCRC;
+      break;
+
+      case GZIP_HCRC:
+        if (++otaGzipCount == 2) otaGzipState = GZIP_DONE;
+      break;
+    }
+  }
+
+  return (otaGzipState == GZIP_DONE);
+
+}
+
+
+
+
+/***********************************************************
+ * @brief queueBuffer
+ * @details Hand the active staging buffer to the writer task and wait for the other buffer to become free
+ ***/
+void OTAUpdate::queueBuffer() {
+
+  OTABlock block;
+
+  if (otaBufferFill == 0) return;
+
+  block.index = otaActiveBuffer;
+  block.length = otaBufferFill;
+  xQueueSend(otaBlockQueue, &block, portMAX_DELAY);
+
+  // Blocks only while the writer is still flashing the other buffer
+  xSemaphoreTake(otaFreeBuffers, portMAX_DELAY);
+
+  otaActiveBuffer ^= 1;
+  otaBufferFill = 0;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief stageOutput
+ * @details Hash image data and copy it into the staging buffers
+ ***/
+void OTAUpdate::stageOutput(const uint8_t *data, size_t len) {
+
+  mbedtls_sha256_update(&otaSHA, data, len);
+  otaImageSize += len;
+
+  while (len > 0) {
+
+    size_t chunk = min(len, (size_t)(OTA_BUFFER_SIZE - otaBufferFill));
+
+    memcpy(otaBuffer[otaActiveBuffer] + otaBufferFill, data, chunk);
+    otaBufferFill += chunk;
+    data += chunk;
+    len -= chunk;
+
+    if (otaBufferFill == OTA_BUFFER_SIZE) this->queueBuffer();
+  }
+
+}
+
+
+
+
+/***********************************************************
+ * @brief inflateChunk
+ * @details Inflate compressed upload data into the circular dictionary and stage the output
+ * @note Trailing bytes after the end of the deflate stream (gzip CRC32 / ISIZE) are ignored - the SHA-256 covers integrity
+ ***/
+void OTAUpdate::inflateChunk(const uint8_t *data, size_t len, bool final) {
+
+  mz_uint32 flags = (otaEncoding == OTA_ZLIB) ? TINFL_FLAG_PARSE_ZLIB_HEADER : 0;
+
+  if (!final) flags |= TINFL_FLAG_HAS_MORE_INPUT;
+
+  while (!otaInflateDone && otaError.length() == 0) {
+
+    size_t inBytes = len;
+    size_t outBytes = TINFL_LZ_DICT_SIZE - otaDictOffset;
+
+    tinfl_status inflateStatus = tinfl_decompress(otaInflator, data, &inBytes, otaDict, otaDict + otaDictOffset, &outBytes, flags);
+
+    data += inBytes;
+    len -= inBytes;
+
+    if (outBytes > 0) {
+      this->stageOutput(otaDict + otaDictOffset, outBytes);
+      otaDictOffset = (otaDictOffset + outBytes) & (TINFL_LZ_DICT_SIZE - 1);
+    }
+
+    if (inflateStatus == TINFL_STATUS_DONE) {
+      otaInflateDone = true;
+    } else if (inflateStatus == TINFL_STATUS_FAILED_CANNOT_MAKE_PROGRESS) {
+      // Final chunk ended inside the deflate stream
+      otaError = "Compressed image is truncated";
+    } else if (inflateStatus < TINFL_STATUS_DONE) {
+      otaError = "Corrupt compressed image";
+    } else if (inflateStatus == TINFL_STATUS_NEEDS_MORE_INPUT) {
+      break;
+    }
+    // TINFL_STATUS_HAS_MORE_OUTPUT - dictionary wrapped, go round again
+  }
+
+}
+
+
+
+
+/***********************************************************
+ * @brief write
+ * @details Process one upload chunk. Encoding is detected from the first bytes of the image
+ * @note ESP32 app images start with 0xE9, gzip with 0x1F 0x8B, zlib with a valid CMF/FLG pair
+ ***/
+bool OTAUpdate::write(const uint8_t *data, size_t len, bool final) {
+
+  if (!otaStarted || otaError.length() > 0) return false;
+
+  // Detect encoding on first chunk
+  if (!otaEncodingKnown && len >= 2) {
+
+    otaEncodingKnown = true;
+
+    if (data[0] == 0x1F && data[1] == 0x8B) {
+      otaEncoding = OTA_GZIP;
+    } else if ((data[0] & 0x0F) == 8 && ((data[0] << 8) | data[1]) % 31 == 0) {
+      otaEncoding = OTA_ZLIB;
+    } else {
+      otaEncoding = OTA_RAW;
+    }
+
+    if (otaEncoding != OTA_RAW) {
+      otaInflator = tinfl_decompressor_alloc();
+      otaDict = (uint8_t *)malloc(TINFL_LZ_DICT_SIZE);
+      if (otaInflator == NULL || otaDict == NULL) {
+        otaError = "Not enough memory to inflate image";
+        return false;
+      }
+    }
+  }
+
+  switch (otaEncoding) {
+
+    case OTA_GZIP:
+      if (this->parseGzipHeader(data, len)) this->inflateChunk(data, len, final);
+    break;
+
+    case OTA_ZLIB:
+      this->inflateChunk(data, len, final);
+    break;
+
+    default:
+      this->stageOutput(data, len);
+    break;
+  }
+
+  if (final && otaEncoding != OTA_RAW && !otaInflateDone && otaError.length() == 0) {
+    otaError = "Compressed image is truncated";
+  }
+
+  if (otaWriteError && otaError.length() == 0) otaError = "Flash write failed";
+
+  return (otaError.length() == 0);
+
+}
+
+
+
+
+/***********************************************************
+ * @brief end
+ * @details Flush staged data, verify SHA-256 and finalise the OTA partition
+ * @returns true if the image was written and verified
+ ***/
+bool OTAUpdate::end() {
+
+  Messages _message;
+  uint8_t digest[32];
+  char digestHex[65];
+
+  if (!otaStarted) return false;
+
+  // Flush remaining data and stop the writer task
+  if (otaError.length() == 0) this->queueBuffer();
+  OTABlock block = {0, 0};
+  xQueueSend(otaBlockQueue, &block, portMAX_DELAY);
+  xSemaphoreTake(otaWriterDone, portMAX_DELAY);
+
+  if (otaWriteError && otaError.length() == 0) otaError = "Flash write failed";
+
+  mbedtls_sha256_finish(&otaSHA, digest);
+  mbedtls_sha256_free(&otaSHA);
+
+  for (int i = 0; i < 32; i++) {
+    snprintf(digestHex + (i * 2), 3, "%02x", digest[i]);
+  }
+
+  _message.debugPrintf("Update SHA-256: %s\n", digestHex);
+
+  if (otaError.length() == 0 && otaExpectedSHA.length() > 0 && !otaExpectedSHA.equals(digestHex)) {
+    otaError = "SHA-256 mismatch";
+  }
+
+  if (otaError.length() == 0) {
+    if (!Update.end(true)) otaError = Update.errorString();
+  } else {
+    Update.abort();
+  }
+
+  otaStarted = false;
+  this->releaseBuffers();
+
+  if (otaError.length() > 0) {
+    _message.debugPrintf("Update Failed: %s\n", otaError.c_str());
+    return false;
+  }
+
+  _message.debugPrintf("Update Success: %uB\n", otaImageSize);
+  return true;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief abort
+ * @details Abandon an update in progress
+ ***/
+void OTAUpdate::abort() {
+
+  if (otaStarted) {
+    OTABlock block = {0, 0};
+    xQueueSend(otaBlockQueue, &block, portMAX_DELAY);
+    xSemaphoreTake(otaWriterDone, portMAX_DELAY);
+    mbedtls_sha256_free(&otaSHA);
+    Update.abort();
+    otaStarted = false;
+  }
+
+  this->releaseBuffers();
+
+}
+
+
+
+
+/***********************************************************
+ * @brief abortSession
+ * @details Abandon the update started as session (e.g. the uploading client disconnected)
+ * @note Does nothing if that update has already ended or another one has started since
+ ***/
+void OTAUpdate::abortSession(uint32_t session) {
+
+  Messages _message;
+
+  if (!otaStarted || session != otaSession) return;
+
+  _message.debugPrintf("Update Aborted: client disconnected after %uB\n", otaImageSize);
+
+  otaError = "Upload interrupted";
+  this->abort();
+
+}
+
+
+
+
+/***********************************************************
+ * @brief session
+ * @returns identifier of the update last started with begin()
+ ***/
+uint32_t OTAUpdate::session() {
+
+  return otaSession;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief releaseBuffers
+ * @details Free inflate and staging memory
+ ***/
+void OTAUpdate::releaseBuffers() {
+
+  if (otaInflator != NULL) {
+    tinfl_decompressor_free(otaInflator);
+    otaInflator = NULL;
+  }
+
+  free(otaDict);
+  otaDict = NULL;
+  free(otaBuffer[0]);
+  otaBuffer[0] = NULL;
+  free(otaBuffer[1]);
+  otaBuffer[1] = NULL;
+
+  if (otaBlockQueue != NULL) {
+    vQueueDelete(otaBlockQueue);
+    otaBlockQueue = NULL;
+  }
+  if (otaFreeBuffers != NULL) {
+    vSemaphoreDelete(otaFreeBuffers);
+    otaFreeBuffers = NULL;
+  }
+  if (otaWriterDone != NULL) {
+    vSemaphoreDelete(otaWriterDone);
+    otaWriterDone = NULL;
+  }
+
+}
+
+
+
+
+/***********************************************************
+ * @brief hasError
+ ***/
+bool OTAUpdate::hasError() {
+
+  return (otaError.length() > 0);
+
+}
+
+
+
+
+/***********************************************************
+ * @brief getError
+ ***/
+String OTAUpdate::getError() {
+
+  return otaError;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief imageSize
+ * @details Number of (uncompressed) image bytes received so far
+ ***/
+size_t OTAUpdate::imageSize() {
+
+  return otaImageSize;
+
+}
@@ -0,0 +1,51 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file otaupdate.h
+ *
+ * @brief OTAUpdate class header file
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ ***/
+#pragma once
+
+#include <Arduino.h>
+
+
+class OTAUpdate {
+
+	friend class Webserver;
+	friend class Messages;
+
+	private:
+
+		bool parseGzipHeader(const uint8_t *&data, size_t &len);
+		void inflateChunk(const uint8_t *data, size_t len, bool final);
+		void stageOutput(const uint8_t *data, size_t len);
+		void queueBuffer();
+		void releaseBuffers();
+
+	public:
+
+		OTAUpdate();
+
+		bool begin(String expectedSHA256);
+		bool write(const uint8_t *data, size_t len, bool final);
+		bool end();
+		void abort();
+		void abortSession(uint32_t session);
+		uint32_t session();
+		bool hasError();
+		String getError();
+		size_t imageSize();
+
+};
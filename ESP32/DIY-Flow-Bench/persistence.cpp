@@ -0,0 +1,220 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file persistence.cpp
+ *
+ * @brief Persistence class - deferred, coalescing NVM writes
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * Flash writes disable the cache on both cores, so anything not running from IRAM (including the
+ * sensor task and its I2C driver) is held off until the write completes. Writing from request handlers
+ * meant every form save or calibration click landed in the middle of an acquisition cycle. Dragging a
+ * value, or a burst of lift point captures, now costs a single write once things settle.
+ *
+ ***/
+#include "Arduino.h"
+
+#include "system.h"
+#include "constants.h"
+#include "structs.h"
+
+#include "persistence.h"
+#include "blobstore.h"
+#include "datahandler.h"
+#include "messages.h"
+#include "metrics.h"
+
+
+static portMUX_TYPE persistMux = portMUX_INITIALIZER_UNLOCKED;
+static SemaphoreHandle_t writeMutex = NULL;
+static TaskHandle_t persistTask = NULL;
+
+static volatile uint32_t pendingRecords = 0;
+static uint32_t firstRequest[PERSIST_RECORD_COUNT];
+static uint32_t lastRequest[PERSIST_RECORD_COUNT];
+
+
+
+
+/***********************************************************
+ * @brief Class constructor
+ ***/
+Persistence::Persistence() {
+}
+
+
+
+
+/***********************************************************
+ * @brief begin
+ * @details Create the flush task. Requests made before this are written on the first pass
+ ***/
+void Persistence::begin() {
+
+  Messages _message;
+
+  if (persistTask != NULL) return;
+
+  writeMutex = xSemaphoreCreateMutex();
+
+  xTaskCreatePinnedToCore(TASKflushRecords, "PERSIST", PERSIST_TASK_MEM_STACK, NULL, 1, &persistTask, 1);
+
+  if (persistTask == NULL) _message.serialPrintf("Persistence task failed to start \n");
+
+}
+
+
+
+
+/***********************************************************
+ * @brief request
+ * @details Mark a record as needing to be written
+ * @note A record that is already pending is coalesced - its debounce timer restarts but the
+ * PERSIST_MAX_DEFER_MS deadline from the first request still applies
+ ***/
+void Persistence::request(uint8_t record) {
+
+  extern Metrics _metrics;
+
+  if (record >= PERSIST_RECORD_COUNT) return;
+
+  uint32_t now = millis();
+  bool coalesced;
+
+  portENTER_CRITICAL(&persistMux);
+  coalesced = pendingRecords & (1UL << record);
+  if (!coalesced) firstRequest[record] = now;
+  lastRequest[record] = now;
+  pendingRecords |= (1UL << record);
+  portEXIT_CRITICAL(&persistMux);
+
+  if (coalesced) _metrics.countCoalescedWrite();
+
+  if (persistTask != NULL) xTaskNotifyGive(persistTask);
+
+}
+
+
+
+
+/***********************************************************
+ * @brief isPending
+ ***/
+bool Persistence::isPending() {
+
+  return pendingRecords != 0;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief takeDueRecords
+ * @details Remove and return the records that are due to be written
+ * @param all take every pending record regardless of its timers
+ * @returns bit mask of records
+ ***/
+uint32_t Persistence::takeDueRecords(uint32_t now, bool all) {
+
+  uint32_t due = 0;
+
+  portENTER_CRITICAL(&persistMux);
+
+  for (int record = 0; record < PERSIST_RECORD_COUNT; record++) {
+    if (!(pendingRecords & (1UL << record))) continue;
+    if (all || now - lastRequest[record] >= PERSIST_DEBOUNCE_MS || now - firstRequest[record] >= PERSIST_MAX_DEFER_MS) {
+      due |= (1UL << record);
+    }
+  }
+
+  pendingRecords &= ~due;
+
+  portEXIT_CRITICAL(&persistMux);
+
+  return due;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief writeRecord
+ * @details Serialise the live struct for a record and write it to NVM
+ * @note The write time is recorded as acquisition stall time
+ ***/
+void Persistence::writeRecord(uint8_t record) {
+
+  extern Metrics _metrics;
+
+  DataHandler _data;
+
+  uint32_t writeStartTime = micros();
+
+  if (record < BLOB_STORE_COUNT) {
+    BlobStore::save(record);
+  } else {
+    _data.saveLiftProfile(record - PERSIST_LIFT_RUN);
+  }
+
+  _metrics.observeFlashWrite(micros() - writeStartTime);
+
+}
+
+
+
+
+/***********************************************************
+ * @brief flush
+ * @details Write all pending records now
+ * @note Call before a restart. Waits for any write already in progress
+ ***/
+void Persistence::flush() {
+
+  if (writeMutex != NULL) xSemaphoreTake(writeMutex, portMAX_DELAY);
+
+  uint32_t due = takeDueRecords(millis(), true);
+
+  for (int record = 0; record < PERSIST_RECORD_COUNT; record++) {
+    if (due & (1UL << record)) writeRecord(record);
+  }
+
+  if (writeMutex != NULL) xSemaphoreGive(writeMutex);
+
+}
+
+
+
+
+/***********************************************************
+ * @brief TASKflushRecords
+ * @details Sleep until a request arrives, then write records as their debounce timers expire
+ ***/
+void Persistence::TASKflushRecords(void *parameter) {
+
+  for (;;) {
+
+    ulTaskNotifyTake(pdTRUE, isPending() ? pdMS_TO_TICKS(PERSIST_DEBOUNCE_MS) : portMAX_DELAY);
+
+    xSemaphoreTake(writeMutex, portMAX_DELAY);
+
+    uint32_t due = takeDueRecords(millis(), false);
+
+    for (int record = 0; record < PERSIST_RECORD_COUNT; record++) {
+      if (due & (1UL << record)) writeRecord(record);
+    }
+
+    xSemaphoreGive(writeMutex);
+  }
+
+}
@@ -0,0 +1,51 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file persistence.h
+ *
+ * @brief Persistence class header file
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * Write-behind for NVM records. The global structs are the live copy; handlers update them and call
+ * Persistence::request(record). Requests for a record that is already pending are coalesced and the
+ * record is written by a low priority task once it has been left alone for PERSIST_DEBOUNCE_MS.
+ *
+ ***/
+#pragma once
+
+#include <Arduino.h>
+
+#include "system.h"
+#include "constants.h"
+
+
+class Persistence {
+
+	friend class Webserver;
+
+	private:
+
+		static void TASKflushRecords(void *parameter);
+		static uint32_t takeDueRecords(uint32_t now, bool all);
+		static void writeRecord(uint8_t record);
+
+	public:
+
+		Persistence();
+
+		void begin();
+
+		static void request(uint8_t record);
+		static void flush();
+		static bool isPending();
+
+};
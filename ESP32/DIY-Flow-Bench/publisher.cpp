@@ -0,0 +1,406 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file publisher.cpp
+ *
+ * @brief Publisher class - topic based Server Side Events (SSE)
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ ***/
+#include "Arduino.h"
+
+#include "system.h"
+#include "constants.h"
+#include "structs.h"
+
+#include <ESPAsyncWebServer.h>
+#include <ArduinoJson.h>
+#include "datahandler.h"
+#include "logger.h"
+#include "messages.h"
+#include "metrics.h"
+#include "publisher.h"
+#include "trace.h"
+
+
+/***********************************************************
+ * @brief Class constructor
+ ***/
+Publisher::Publisher() {
+
+  for (int topic = 0; topic < SSE_TOPIC_COUNT; topic++) {
+    topicSource[topic] = NULL;
+  }
+
+  clientMutex = NULL;
+  rejectedClients = 0;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief topicPath
+ * @details Returns the URL that clients open to subscribe to a topic
+ ***/
+const char * Publisher::topicPath(int topic) {
+
+  switch (topic) {
+    case SSE_TOPIC_FLOW: return "/events/flow";
+    case SSE_TOPIC_MIMIC: return "/events/mimic";
+    case SSE_TOPIC_STATUS: return "/events/status";
+    case SSE_TOPIC_ALARMS: return "/events/alarms";
+    case SSE_TOPIC_LOG: return "/events/log";
+    default: return "/events";
+  }
+
+}
+
+
+
+
+/***********************************************************
+ * @brief isOnChangeTopic
+ * @details Status, alarm and log topics are only pushed when their content changes
+ * @note Flow and mimic topics are streamed every tick
+ ***/
+bool Publisher::isOnChangeTopic(int topic) {
+
+  return (topic == SSE_TOPIC_STATUS || topic == SSE_TOPIC_ALARMS || topic == SSE_TOPIC_LOG);
+
+}
+
+
+
+
+/***********************************************************
+ * @brief begin
+ * @details Create one event source per topic and attach them to the server
+ * @note A client subscribes to a topic by opening an EventSource on the topic path.
+ * @note Each browser page only opens the topics it displays, so index and mimic clients are served at the same time
+ ***/
+void Publisher::begin(AsyncWebServer *server) {
+
+  Messages _message;
+
+  clientMutex = xSemaphoreCreateMutex();
+
+  for (int topic = 0; topic < SSE_TOPIC_COUNT; topic++) {
+
+    topicSource[topic] = new AsyncEventSource(topicPath(topic));
+
+    // Connect / disconnect callbacks run in the async_tcp task
+    topicSource[topic]->onConnect([this, topic](AsyncEventSourceClient *client) {
+      addClient(client, topic);
+    });
+
+    topicSource[topic]->onDisconnect([this](AsyncEventSourceClient *client) {
+      removeClient(client);
+    });
+
+    server->addHandler(topicSource[topic]);
+  }
+
+  _message.serialPrintf("SSE Topics Initialised \n");
+
+}
+
+
+
+
+/***********************************************************
+ * @brief addClient
+ * @details Start tracking a new subscriber
+ * @note New subscribers are flagged as pending so they receive the current state of on-change topics
+ ***/
+void Publisher::addClient(AsyncEventSourceClient *client, int topic) {
+
+  xSemaphoreTake(clientMutex, portMAX_DELAY);
+
+  for (int i = 0; i < SSE_MAX_CLIENTS; i++) {
+    if (clientSlot[i].client == NULL) {
+      clientSlot[i] = SSEClientSlot();
+      clientSlot[i].client = client;
+      clientSlot[i].topic = topic;
+      clientSlot[i].pending = true;
+      xSemaphoreGive(clientMutex);
+      return;
+    }
+  }
+
+  xSemaphoreGive(clientMutex);
+
+  // No free slot - we cannot police this client so we do not serve it
+  rejectedClients++;
+  client->close();
+
+}
+
+
+
+
+/***********************************************************
+ * @brief removeClient
+ * @details Stop tracking a subscriber that has disconnected
+ ***/
+void Publisher::removeClient(AsyncEventSourceClient *client) {
+
+  xSemaphoreTake(clientMutex, portMAX_DELAY);
+
+  for (int i = 0; i < SSE_MAX_CLIENTS; i++) {
+    if (clientSlot[i].client == client) {
+      clientSlot[i].client = NULL;
+      clientSlot[i].topic = -1;
+    }
+  }
+
+  xSemaphoreGive(clientMutex);
+
+}
+
+
+
+
+/***********************************************************
+ * @brief subscriberCount
+ * @details Number of clients connected to a single topic
+ ***/
+size_t Publisher::subscriberCount(int topic) {
+
+  if (topic < 0 || topic >= SSE_TOPIC_COUNT || topicSource[topic] == NULL) return 0;
+
+  return topicSource[topic]->count();
+
+}
+
+
+
+
+/***********************************************************
+ * @brief subscriberCount
+ * @details Total number of clients connected across all topics
+ ***/
+size_t Publisher::subscriberCount() {
+
+  size_t total = 0;
+
+  for (int topic = 0; topic < SSE_TOPIC_COUNT; topic++) {
+    total += subscriberCount(topic);
+  }
+
+  return total;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief buildFrame
+ * @details Build the JSON payload for a topic
+ ***/
+String Publisher::buildFrame(int topic) {
+
+  DataHandler _data;
+
+  switch (topic) {
+
+    case SSE_TOPIC_FLOW:
+      return _data.buildIndexSSEJsonData();
+
+    case SSE_TOPIC_MIMIC:
+      return _data.buildMimicSSEJsonData();
+
+    case SSE_TOPIC_STATUS:
+      return _data.buildStatusSSEJsonData();
+
+    case SSE_TOPIC_ALARMS:
+      return _data.buildAlarmSSEJsonData();
+
+    case SSE_TOPIC_LOG:
+      return Logger::getTailJSON();
+
+    default:
+      return String();
+  }
+
+}
+
+
+
+
+/***********************************************************
+ * @brief buildMessage
+ * @details Wrap a topic frame as a complete SSE message
+ * @note The message is built once per topic and shared by reference between the client queues
+ * @note Frames are single line JSON so one data field is enough
+ ***/
+AsyncEvent_SharedData_t Publisher::buildMessage(const String &frame) {
+
+  char header[48];
+  snprintf(header, sizeof(header), "id: %lu\nevent: JSON_DATA\ndata: ", (unsigned long)millis());
+
+  AsyncEvent_SharedData_t message = std::make_shared<String>();
+  message->reserve(strlen(header) + frame.length() + 2);
+  message->concat(header);
+  message->concat(frame);
+  message->concat("\n\n");
+
+  return message;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief sendToClient
+ * @details Queue the latest topic message for a single client, applying backpressure
+ * @note Backpressure and rate adaptation follow the client's real queue (packetsWaiting()). A client with
+ * SSE_CLIENT_MAX_QUEUED messages waiting has the frame dropped. Only the latest state matters so the
+ * next frame it does get supersedes any that were dropped.
+ * @note Each drop doubles the client rate divider (slower updates), each clean send steps it back down
+ ***/
+void Publisher::sendToClient(SSEClientSlot &slot, const AsyncEvent_SharedData_t &message, bool changed) {
+
+  extern struct DeviceStatus status;
+
+  size_t framesWaiting = min(slot.client->packetsWaiting(), (size_t)SSE_CLIENT_MAX_QUEUED);
+
+  // The waiting messages are the newest ones we queued
+  slot.queuedBytes = 0;
+  for (size_t i = SSE_CLIENT_MAX_QUEUED - framesWaiting; i < SSE_CLIENT_MAX_QUEUED; i++) {
+    slot.queuedBytes += slot.queuedLength[i];
+  }
+  if (slot.queuedBytes > slot.maxQueuedBytes) slot.maxQueuedBytes = slot.queuedBytes;
+
+  // On-change topics only need a frame when something changed or the client missed the last one
+  if (isOnChangeTopic(slot.topic) && !changed && !slot.pending) return;
+
+  // Rate adaptation - lagging clients are only served every n ticks
+  if (++slot.tickCount < slot.rateDivider) {
+    slot.pending = true;
+    return;
+  }
+  slot.tickCount = 0;
+
+  // Backpressure - drop (coalesce) the frame rather than grow the client queue
+  if (framesWaiting >= SSE_CLIENT_MAX_QUEUED) {
+    slot.framesDropped++;
+    slot.pending = true;
+    if (slot.rateDivider < SSE_CLIENT_MAX_RATE_DIVIDER) slot.rateDivider *= 2;
+    return;
+  }
+
+  if (slot.client->write(message)) {
+    memmove(slot.queuedLength, slot.queuedLength + 1, sizeof(slot.queuedLength) - sizeof(slot.queuedLength[0]));
+    slot.queuedLength[SSE_CLIENT_MAX_QUEUED - 1] = message->length();
+    slot.framesSent++;
+    slot.pending = false;
+    if (status.firstSSETime == 0) {
+      Messages _message;
+      status.firstSSETime = millis();
+      _message.debugPrintf("Boot to first SSE frame: %u ms \n", status.firstSSETime);
+    }
+    if (framesWaiting == 0 && slot.rateDivider > 1) slot.rateDivider--;
+  } else {
+    slot.framesDropped++;
+    slot.pending = true;
+  }
+
+}
+
+
+
+
+/***********************************************************
+ * @brief publish
+ * @details Build each subscribed topic frame once and push it to the subscribers of that topic
+ * @note Every subscriber of a topic is handed the same message, it is not copied per client
+ * @note Topics without subscribers are not built at all
+ * @note If a client is connecting or disconnecting we skip this tick rather than block the loop
+ ***/
+void Publisher::publish() {
+
+  extern Metrics _metrics;
+
+  if (clientMutex == NULL || xSemaphoreTake(clientMutex, 0) != pdTRUE) return;
+
+  TRACE_SCOPE(TRACE_SSE_PUBLISH);
+
+  for (int topic = 0; topic < SSE_TOPIC_COUNT; topic++) {
+
+    if (subscriberCount(topic) == 0) continue;
+
+    uint32_t buildStartTime = micros();
+    String frame = buildFrame(topic);
+    bool changed = (frame != topicFrame[topic]);
+    if (changed) topicFrame[topic] = frame;
+
+    // On-change topics keep the last message for clients that missed it
+    if (changed || !isOnChangeTopic(topic) || !topicMessage[topic]) topicMessage[topic] = buildMessage(topicFrame[topic]);
+    _metrics.observeSSEBuild(micros() - buildStartTime);
+
+    uint32_t sendStartTime = micros();
+    for (int i = 0; i < SSE_MAX_CLIENTS; i++) {
+      if (clientSlot[i].client != NULL && clientSlot[i].topic == topic) {
+        sendToClient(clientSlot[i], topicMessage[topic], changed);
+      }
+    }
+    _metrics.observeSSESend(micros() - sendStartTime);
+  }
+
+  xSemaphoreGive(clientMutex);
+
+}
+
+
+
+
+/***********************************************************
+ * @brief getClientStatsJSON
+ * @details Per client SSE delivery statistics
+ ***/
+String Publisher::getClientStatsJSON() {
+
+  String jsonString;
+  JsonDocument dataJson;
+
+  dataJson["SSE_CLIENTS"] = subscriberCount();
+  dataJson["SSE_REJECTED"] = rejectedClients;
+
+  JsonArray clients = dataJson["CLIENTS"].to<JsonArray>();
+
+  if (clientMutex != NULL && xSemaphoreTake(clientMutex, pdMS_TO_TICKS(50)) == pdTRUE) {
+
+    for (int i = 0; i < SSE_MAX_CLIENTS; i++) {
+
+      if (clientSlot[i].client == NULL) continue;
+
+      JsonObject client = clients.add<JsonObject>();
+      client["TOPIC"] = topicPath(clientSlot[i].topic);
+      client["IP"] = clientSlot[i].client->client()->remoteIP().toString();
+      client["SENT"] = clientSlot[i].framesSent;
+      client["DROPPED"] = clientSlot[i].framesDropped;
+      client["QUEUED_BYTES"] = clientSlot[i].queuedBytes;
+      client["MAX_QUEUED_BYTES"] = clientSlot[i].maxQueuedBytes;
+      client["UPDATE_RATE"] = SSE_UPDATE_RATE * clientSlot[i].rateDivider;
+    }
+
+    xSemaphoreGive(clientMutex);
+  }
+
+  serializeJson(dataJson, jsonString);
+
+  return jsonString;
+}
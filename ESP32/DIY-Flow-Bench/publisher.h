@@ -0,0 +1,80 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file publisher.h
+ *
+ * @brief Publisher class header file
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ ***/
+#pragma once
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include "freertos/semphr.h"
+
+#include "system.h"
+#include "constants.h"
+
+
+/***********************************************************
+ * @brief Per client SSE delivery state
+ ***/
+struct SSEClientSlot {
+	AsyncEventSourceClient *client = NULL;
+	int topic = -1;
+	bool pending = false;           // client has missed the latest on-change frame
+	uint8_t rateDivider = 1;        // client is served every n ticks
+	uint8_t tickCount = 0;
+	uint32_t framesSent = 0;
+	uint32_t framesDropped = 0;
+	size_t queuedLength[SSE_CLIENT_MAX_QUEUED] = {};   // lengths of the last messages queued, newest last
+	size_t queuedBytes = 0;         // bytes waiting in the client queue
+	size_t maxQueuedBytes = 0;
+};
+
+
+class Publisher {
+
+	friend class Webserver;
+	friend class DataHandler;
+	friend class AsyncWebServer;
+	friend class AsyncEventSource;
+
+	private:
+
+		AsyncEventSource *topicSource[SSE_TOPIC_COUNT];
+		String topicFrame[SSE_TOPIC_COUNT];
+		AsyncEvent_SharedData_t topicMessage[SSE_TOPIC_COUNT];
+		SSEClientSlot clientSlot[SSE_MAX_CLIENTS];
+		SemaphoreHandle_t clientMutex;
+		uint32_t rejectedClients;
+
+		String buildFrame(int topic);
+		AsyncEvent_SharedData_t buildMessage(const String &frame);
+		bool isOnChangeTopic(int topic);
+		void addClient(AsyncEventSourceClient *client, int topic);
+		void removeClient(AsyncEventSourceClient *client);
+		void sendToClient(SSEClientSlot &slot, const AsyncEvent_SharedData_t &message, bool changed);
+
+	public:
+
+		Publisher();
+
+		void begin(AsyncWebServer *server);
+		void publish();
+		size_t subscriberCount(int topic);
+		size_t subscriberCount();
+		const char * topicPath(int topic);
+		String getClientStatsJSON();
+
+};
@@ -0,0 +1,730 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file recorder.cpp
+ *
+ * @brief Recorder class - session recorder, streams acquisition samples to an append-only binary log
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * The sensor task pushes each sample into a single producer / single consumer RAM ring. It never waits,
+ * if the ring is full the sample is counted as dropped. The writer task drains the ring one chunk at a
+ * time and flushes each chunk to the filesystem before the index entry is written.
+ *
+ * A chunk that has not filled within RECORDER_PARTIAL_FLUSH_MS is written anyway with the samples it
+ * has, and rewritten in place (same offset, sequence and index slot) as it grows. A power loss therefore
+ * costs at most the last few seconds of samples, or the chunk being rewritten, which the reader
+ * discards by its CRC.
+ *
+ ***/
+#include "Arduino.h"
+#include <atomic>
+#include <memory>
+#include <esp32/rom/crc.h>
+#include <FS.h>
+#include <ArduinoJson.h>
+
+#include "system.h"
+#include "constants.h"
+#include "structs.h"
+
+#include "messages.h"
+#include "metrics.h"
+#include "recorder.h"
+#include "storage.h"
+#include "sdcard.h"
+#include "gzipstream.h"
+
+
+static RecorderSample *sampleRing = NULL;
+static uint8_t *chunkBuffer = NULL;
+static std::atomic<uint32_t> ringHead(0);   // written by the sensor task
+static std::atomic<uint32_t> ringTail(0);   // written by the writer task
+
+static volatile int recorderState = RECORDER_IDLE;
+static TaskHandle_t recorderTask = NULL;
+
+static File logFile;
+static File indexFile;
+static char logPath[32] = "";
+static char indexPath[32] = "";
+static bool logOnSD = false;
+
+// Session export
+#define EXPORT_CSV 0
+#define EXPORT_NDJSON 1
+
+#define EXPORT_HEADER 0
+#define EXPORT_SAMPLES 1
+#define EXPORT_FINISH 2
+#define EXPORT_DONE 3
+
+#define EXPORT_CHANNEL_COUNT 8
+
+// Order matches the float members of RecorderSample following the timestamp
+static const char *exportChannelName[EXPORT_CHANNEL_COUNT] = {"FlowCFM", "FlowKGH", "PRefKPA", "PDiffKPA", "PitotKPA", "TempDegC", "BaroHPA", "RelH"};
+
+struct RecorderExport {
+  File log;
+  uint8_t *chunk = NULL;
+  uint8_t *output = NULL;
+  size_t outputLength = 0;
+  GzipStream gzip;
+  bool compress = false;
+  int format = EXPORT_CSV;
+  uint8_t channels = 0xFF;
+  uint32_t fromTime = 0;
+  uint32_t toTime = UINT32_MAX;
+  uint32_t sequence = 0;
+  uint32_t crcSeed = 0;
+  uint16_t sampleIndex = 0;
+  uint16_t sampleCount = 0;
+  int stage = EXPORT_HEADER;
+
+  ~RecorderExport() {
+    free(chunk);
+    free(output);
+    if (log) log.close();
+  }
+};
+
+static uint32_t sessionNumber = 0;
+static uint32_t sessionId = 0;               // seeds the chunk CRCs of this recording
+static uint32_t chunkSequence = 0;           // sequence of the open chunk
+static uint32_t chunkFill = 0;               // samples already in the open chunk
+static uint32_t chunkFlushTime = 0;          // millis() the open chunk was last written
+static uint32_t samplesRecorded = 0;
+static volatile uint32_t samplesDropped = 0;
+static uint32_t writeErrors = 0;
+
+
+
+
+/***********************************************************
+ * @brief Class constructor
+ ***/
+Recorder::Recorder() {
+}
+
+
+
+
+/***********************************************************
+ * @brief begin
+ * @details Create the writer task. Buffers are allocated on the first start()
+ ***/
+void Recorder::begin() {
+
+  Messages _message;
+
+  if (recorderTask != NULL) return;
+
+  xTaskCreatePinnedToCore(TASKwriteSessionLog, "SESSION_LOG", RECORDER_TASK_MEM_STACK, NULL, 1, &recorderTask, 1);
+
+  if (recorderTask == NULL) _message.serialPrintf("Session recorder task failed to start \n");
+
+}
+
+
+
+
+/***********************************************************
+ * @brief samplesQueued
+ * @details Samples waiting in the ring
+ ***/
+uint32_t Recorder::samplesQueued() {
+
+  return ringHead.load(std::memory_order_acquire) - ringTail.load(std::memory_order_relaxed);
+
+}
+
+
+
+
+/***********************************************************
+ * @brief push
+ * @details Copy the current sensor values into the ring (called from the sensor task)
+ * @note Never blocks. Samples are dropped and counted when the ring is full
+ ***/
+void Recorder::push() {
+
+  extern struct SensorData sensorVal;
+
+  if (recorderState != RECORDER_RUNNING) return;
+
+  uint32_t head = ringHead.load(std::memory_order_relaxed);
+  uint32_t queued = head - ringTail.load(std::memory_order_acquire);
+
+  if (queued >= RECORDER_RING_SAMPLES) {
+    samplesDropped++;
+    return;
+  }
+
+  RecorderSample &sample = sampleRing[head & (RECORDER_RING_SAMPLES - 1)];
+  sample.timestamp = millis();
+  sample.FlowCFM = sensorVal.FlowCFM;
+  sample.FlowKGH = sensorVal.FlowKGH;
+  sample.PRefKPA = sensorVal.PRefKPA;
+  sample.PDiffKPA = sensorVal.PDiffKPA;
+  sample.PitotKPA = sensorVal.PitotKPA;
+  sample.TempDegC = sensorVal.TempDegC;
+  sample.BaroHPA = sensorVal.BaroHPA;
+  sample.RelH = sensorVal.RelH;
+
+  ringHead.store(head + 1, std::memory_order_release);
+
+  if (queued + 1 == RECORDER_CHUNK_SAMPLES) xTaskNotifyGive(recorderTask);
+
+}
+
+
+
+
+/***********************************************************
+ * @brief start
+ * @details Open the next free session log and start recording
+ * @returns false if already recording, out of memory or the log could not be created
+ ***/
+bool Recorder::start() {
+
+  Messages _message;
+
+  if (recorderState != RECORDER_IDLE || recorderTask == NULL) return false;
+
+  // Buffers are kept once allocated so the sensor task can never see them freed
+  if (sampleRing == NULL) sampleRing = (RecorderSample *)malloc(RECORDER_RING_SAMPLES * sizeof(RecorderSample));
+  if (chunkBuffer == NULL) chunkBuffer = (uint8_t *)malloc(RECORDER_CHUNK_SIZE);
+  if (sampleRing == NULL || chunkBuffer == NULL) {
+    _message.debugPrintf("Recorder::start - not enough memory \n");
+    return false;
+  }
+
+  logOnSD = SDCard::isMounted();
+  fs::FS &logFS = logOnSD ? SDCard::fs() : Storage::fs();
+
+  // The number must be free on both media, openLog() would otherwise find the flash session first
+  for (sessionNumber = 1; sessionNumber <= RECORDER_MAX_SESSIONS; sessionNumber++) {
+    snprintf(logPath, sizeof(logPath), "/session_%03u.dfbl", sessionNumber);
+    if (!Storage::exists(logPath) && !(logOnSD && logFS.exists(logPath))) break;
+  }
+  if (sessionNumber > RECORDER_MAX_SESSIONS) {
+    _message.debugPrintf("Recorder::start - no free session slot \n");
+    return false;
+  }
+  snprintf(indexPath, sizeof(indexPath), "/session_%03u.idx", sessionNumber);
+
+  logFile = logFS.open(logPath, FILE_WRITE);
+  indexFile = logFS.open(indexPath, FILE_WRITE);
+  if (!logFile || !indexFile) {
+    _message.debugPrintf("Recorder::start - cannot create %s \n", logPath);
+    if (logFile) logFile.close();
+    if (indexFile) indexFile.close();
+    return false;
+  }
+
+  if (logOnSD) SDCard::preallocate(logFile, RECORDER_SD_PREALLOCATE);
+
+  // Preallocated space can hold chunks of a deleted session with the same number
+  sessionId = esp_random();
+
+  RecorderFileHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic = RECORDER_MAGIC;
+  header.version = RECORDER_VERSION;
+  header.sampleSize = sizeof(RecorderSample);
+  header.chunkSize = RECORDER_CHUNK_SIZE;
+  header.chunkSamples = RECORDER_CHUNK_SAMPLES;
+  header.startTimestamp = millis();
+  header.session = sessionNumber;
+  header.sessionId = sessionId;
+  memset(chunkBuffer, 0, RECORDER_FILE_HEADER_SIZE);
+  memcpy(chunkBuffer, &header, sizeof(header));
+  logFile.write(chunkBuffer, RECORDER_FILE_HEADER_SIZE);
+  logFile.flush();
+
+  if (!logOnSD) {
+    Storage::indexFile(logPath);
+    Storage::indexFile(indexPath);
+  }
+
+  chunkSequence = 0;
+  chunkFill = 0;
+  chunkFlushTime = millis();
+  samplesRecorded = 0;
+  samplesDropped = 0;
+  writeErrors = 0;
+  ringTail.store(0);
+  ringHead.store(0);
+
+  recorderState = RECORDER_RUNNING;
+
+  _message.debugPrintf("Session recording started: %s%s \n", logOnSD ? SD_MOUNT_POINT : "", logPath);
+
+  return true;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief stop
+ * @details Ask the writer task to flush the remaining samples and close the log
+ ***/
+void Recorder::stop() {
+
+  if (recorderState != RECORDER_RUNNING) return;
+
+  recorderState = RECORDER_STOPPING;
+  xTaskNotifyGive(recorderTask);
+
+}
+
+
+
+
+/***********************************************************
+ * @brief isRecording
+ ***/
+bool Recorder::isRecording() {
+
+  return recorderState != RECORDER_IDLE;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief writeChunk
+ * @details Move samples from the ring into the open chunk and write the chunk to the log as one block
+ * @note A chunk that is not yet full stays open, the next call adds to it and rewrites it in place
+ * @note The log is flushed before the index entry so the index never points past valid data
+ ***/
+bool Recorder::writeChunk(uint32_t sampleCount) {
+
+  extern Metrics _metrics;
+
+  uint32_t tail = ringTail.load(std::memory_order_relaxed);
+  RecorderChunkHeader *header = (RecorderChunkHeader *)chunkBuffer;
+  RecorderSample *samples = (RecorderSample *)(chunkBuffer + sizeof(RecorderChunkHeader));
+
+  sampleCount = min(sampleCount, (uint32_t)(RECORDER_CHUNK_SAMPLES - chunkFill));
+
+  for (uint32_t i = 0; i < sampleCount; i++) {
+    samples[chunkFill + i] = sampleRing[(tail + i) & (RECORDER_RING_SAMPLES - 1)];
+  }
+
+  // Release ring space before the (slow) flash write
+  ringTail.store(tail + sampleCount, std::memory_order_release);
+
+  uint32_t fill = chunkFill + sampleCount;
+  size_t used = sizeof(RecorderChunkHeader) + fill * sizeof(RecorderSample);
+  memset(chunkBuffer + used, 0, RECORDER_CHUNK_SIZE - used);
+
+  header->magic = RECORDER_CHUNK_MAGIC;
+  header->sequence = chunkSequence;
+  header->firstTimestamp = samples[0].timestamp;
+  header->lastTimestamp = samples[fill - 1].timestamp;
+  header->sampleCount = fill;
+  header->reserved = 0;
+  header->crc = 0;
+  header->crc = crc32_le(sessionId, chunkBuffer, RECORDER_CHUNK_SIZE);
+
+  RecorderIndexEntry entry;
+  entry.offset = RECORDER_FILE_HEADER_SIZE + chunkSequence * RECORDER_CHUNK_SIZE;
+  entry.sequence = chunkSequence;
+  entry.firstTimestamp = header->firstTimestamp;
+  entry.lastTimestamp = header->lastTimestamp;
+  entry.crc = header->crc;
+
+  uint32_t writeStartTime = micros();
+
+  logFile.seek(entry.offset);
+  if (logFile.write(chunkBuffer, RECORDER_CHUNK_SIZE) != RECORDER_CHUNK_SIZE) {
+    writeErrors++;
+    return false;
+  }
+  logFile.flush();
+
+  indexFile.seek(chunkSequence * sizeof(entry));
+  indexFile.write((const uint8_t *)&entry, sizeof(entry));
+  indexFile.flush();
+
+  _metrics.observeFlashWrite(micros() - writeStartTime);
+
+  chunkFlushTime = millis();
+  samplesRecorded += sampleCount;
+
+  if (fill == RECORDER_CHUNK_SAMPLES) {
+    chunkSequence++;
+    chunkFill = 0;
+  } else {
+    chunkFill = fill;
+  }
+
+  return true;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief TASK: Session log writer
+ * @details Woken by the sensor task each time a full chunk is queued, or by stop()
+ * @note Samples that have waited RECORDER_PARTIAL_FLUSH_MS are written as a partial chunk
+ ***/
+void Recorder::TASKwriteSessionLog(void *parameter) {
+
+  extern struct Language language;
+
+  Messages _message;
+
+  for( ;; ) {
+
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(RECORDER_FLUSH_TIMEOUT_MS));
+
+    if (recorderState == RECORDER_IDLE) continue;
+
+    bool partialDue = (samplesQueued() > 0 && millis() - chunkFlushTime >= RECORDER_PARTIAL_FLUSH_MS);
+
+    while (chunkFill + samplesQueued() >= RECORDER_CHUNK_SAMPLES || partialDue) {
+      partialDue = false;
+      if (!writeChunk(samplesQueued())) {
+        // Filesystem full or failed - keep what we have
+        _message.debugPrintf("Session log write failed: %s \n", logPath);
+        _message.Handler(language.LANG_SESSION_LOG_FAILED);
+        recorderState = RECORDER_STOPPING;
+        break;
+      }
+    }
+
+    if (recorderState == RECORDER_STOPPING) {
+
+      uint32_t remaining = samplesQueued();
+      if (remaining > 0 && writeErrors == 0) writeChunk(remaining);
+
+      uint32_t logLength = RECORDER_FILE_HEADER_SIZE + (chunkSequence + (chunkFill > 0 ? 1 : 0)) * RECORDER_CHUNK_SIZE;
+      logFile.close();
+      indexFile.close();
+      if (logOnSD) {
+        SDCard::truncate(logPath, logLength);
+      } else {
+        Storage::indexFile(logPath);
+        Storage::indexFile(indexPath);
+      }
+      recorderState = RECORDER_IDLE;
+
+      _message.debugPrintf("Session recording stopped: %s (%u samples, %u dropped) \n", logPath, samplesRecorded, samplesDropped);
+    }
+  }
+
+}
+
+
+
+
+/***********************************************************
+ * @brief openLog
+ * @details Open a session log from the data partition, or the SD card if it is not there
+ ***/
+File Recorder::openLog(const char *path) {
+
+  if (Storage::exists(path)) return Storage::fs().open(path, FILE_READ);
+  if (SDCard::isMounted()) return SDCard::fs().open(path, FILE_READ);
+
+  return File();
+
+}
+
+
+
+
+/***********************************************************
+ * @brief verifyLog
+ * @details Walk a session log and check each chunk
+ * @note Chunks of an earlier session left in preallocated space fail the CRC (version 3)
+ * @returns number of valid chunks before the first bad or torn chunk, -1 if the log is unreadable
+ ***/
+int Recorder::verifyLog(const char *path) {
+
+  File file = openLog(path);
+  if (!file) return -1;
+
+  RecorderFileHeader fileHeader;
+  if (file.read((uint8_t *)&fileHeader, sizeof(fileHeader)) != sizeof(fileHeader) || fileHeader.magic != RECORDER_MAGIC || fileHeader.chunkSize != RECORDER_CHUNK_SIZE) {
+    file.close();
+    return -1;
+  }
+
+  // Version 1 logs have an unpadded header, version 3 seeds the chunk CRCs
+  file.seek(fileHeader.version < 2 ? sizeof(fileHeader) : RECORDER_FILE_HEADER_SIZE);
+  uint32_t crcSeed = (fileHeader.version < 3) ? 0 : fileHeader.sessionId;
+
+  uint8_t *buffer = (uint8_t *)malloc(RECORDER_CHUNK_SIZE);
+  if (buffer == NULL) {
+    file.close();
+    return -1;
+  }
+
+  int validChunks = 0;
+  RecorderChunkHeader *header = (RecorderChunkHeader *)buffer;
+
+  while (file.read(buffer, RECORDER_CHUNK_SIZE) == RECORDER_CHUNK_SIZE) {
+
+    uint32_t crc = header->crc;
+    header->crc = 0;
+
+    if (header->magic != RECORDER_CHUNK_MAGIC || header->sequence != (uint32_t)validChunks || crc32_le(crcSeed, buffer, RECORDER_CHUNK_SIZE) != crc) break;
+
+    validChunks++;
+  }
+
+  free(buffer);
+  file.close();
+
+  return validChunks;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief nextExportSample
+ * @details Step to the next sample, reading and checking chunks as needed
+ * @returns NULL at the end of the log or at the first bad / torn chunk
+ ***/
+static const RecorderSample * nextExportSample(RecorderExport &exportState) {
+
+  RecorderChunkHeader *header = (RecorderChunkHeader *)exportState.chunk;
+
+  while (exportState.sampleIndex >= exportState.sampleCount) {
+
+    if (exportState.log.read(exportState.chunk, RECORDER_CHUNK_SIZE) != RECORDER_CHUNK_SIZE) return NULL;
+
+    uint32_t crc = header->crc;
+    header->crc = 0;
+    if (header->magic != RECORDER_CHUNK_MAGIC || header->sequence != exportState.sequence || crc32_le(exportState.crcSeed, exportState.chunk, RECORDER_CHUNK_SIZE) != crc) return NULL;
+
+    exportState.sequence++;
+
+    if (header->firstTimestamp > exportState.toTime) return NULL;
+    if (header->lastTimestamp < exportState.fromTime) continue;
+
+    exportState.sampleIndex = 0;
+    exportState.sampleCount = min((uint32_t)header->sampleCount, (uint32_t)RECORDER_CHUNK_SAMPLES);
+  }
+
+  const RecorderSample *samples = (const RecorderSample *)(exportState.chunk + sizeof(RecorderChunkHeader));
+
+  return &samples[exportState.sampleIndex++];
+
+}
+
+
+
+
+/***********************************************************
+ * @brief fillExportChunk
+ * @details Format (and optionally compress) samples until the response buffer can be filled
+ * @note Output is staged in exportState.output so a compressed line never has to be split
+ ***/
+static size_t fillExportChunk(RecorderExport &exportState, uint8_t *buffer, size_t maxLen) {
+
+  char line[EXPORT_LINE_LENGTH];
+
+  while (exportState.outputLength < maxLen && exportState.stage != EXPORT_DONE) {
+
+    // Leave room for a worst case line
+    if (exportState.outputLength + GZIP_MAX_OUTPUT(EXPORT_LINE_LENGTH) > EXPORT_BUFFER_SIZE) break;
+
+    uint8_t *output = exportState.output + exportState.outputLength;
+    int lineLength = 0;
+
+    switch (exportState.stage) {
+
+      case EXPORT_HEADER:
+        if (exportState.compress) exportState.outputLength += exportState.gzip.start(output);
+        if (exportState.format == EXPORT_CSV) {
+          lineLength = snprintf(line, sizeof(line), "timestamp");
+          for (int channel = 0; channel < EXPORT_CHANNEL_COUNT; channel++) {
+            if (exportState.channels & (1 << channel)) lineLength += snprintf(line + lineLength, sizeof(line) - lineLength, ",%s", exportChannelName[channel]);
+          }
+          lineLength += snprintf(line + lineLength, sizeof(line) - lineLength, "\n");
+        }
+        exportState.stage = EXPORT_SAMPLES;
+      break;
+
+      case EXPORT_SAMPLES: {
+        const RecorderSample *sample = nextExportSample(exportState);
+        if (sample == NULL || sample->timestamp > exportState.toTime) {
+          exportState.stage = EXPORT_FINISH;
+          continue;
+        }
+        if (sample->timestamp < exportState.fromTime) continue;
+
+        const float *value = &sample->FlowCFM;
+        bool csv = (exportState.format == EXPORT_CSV);
+
+        // Channels that would overflow the line are dropped rather than overrunning it
+        int lineLimit = sizeof(line) - 3;
+        lineLength = snprintf(line, sizeof(line), csv ? "%u" : "{\"timestamp\":%u", sample->timestamp);
+        for (int channel = 0; channel < EXPORT_CHANNEL_COUNT && lineLength < lineLimit; channel++) {
+          if (!(exportState.channels & (1 << channel))) continue;
+          if (csv) {
+            lineLength += snprintf(line + lineLength, sizeof(line) - lineLength, ",%.3f", value[channel]);
+          } else {
+            lineLength += snprintf(line + lineLength, sizeof(line) - lineLength, ",\"%s\":%.3f", exportChannelName[channel], value[channel]);
+          }
+        }
+        lineLength = min(lineLength, lineLimit);
+        lineLength += snprintf(line + lineLength, sizeof(line) - lineLength, csv ? "\n" : "}\n");
+      break; }
+
+      case EXPORT_FINISH:
+        if (exportState.compress) {
+          exportState.outputLength += exportState.gzip.finish(output);
+          exportState.gzip.end();
+        }
+        exportState.log.close();
+        exportState.stage = EXPORT_DONE;
+      break;
+    }
+
+    if (lineLength <= 0) continue;
+
+    output = exportState.output + exportState.outputLength;
+    if (exportState.compress) {
+      exportState.outputLength += exportState.gzip.write((const uint8_t *)line, lineLength, output);
+    } else {
+      memcpy(output, line, lineLength);
+      exportState.outputLength += lineLength;
+    }
+  }
+
+  size_t length = min(exportState.outputLength, maxLen);
+
+  memcpy(buffer, exportState.output, length);
+  memmove(exportState.output, exportState.output + length, exportState.outputLength - length);
+  exportState.outputLength -= length;
+
+  return length;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief exportSession
+ * @details Stream a session log as CSV or NDJSON, gzip compressed if the client accepts it
+ * @note Parameters: file, format=csv|ndjson, channels=FlowCFM,PRefKPA,... from / to (ms since session
+ * start), gzip=0 to disable compression. Memory use is fixed regardless of session length
+ ***/
+AsyncWebServerResponse * Recorder::exportSession(AsyncWebServerRequest *request) {
+
+  if (!request->hasParam("file")) return request->beginResponse(400, "text/plain", "Missing file parameter");
+
+  String filename = request->getParam("file")->value();
+
+  std::shared_ptr<RecorderExport> exportState(new (std::nothrow) RecorderExport());
+  if (!exportState) return request->beginResponse(503, "text/plain", "Not enough memory for export");
+
+  exportState->log = openLog(filename.c_str());
+
+  RecorderFileHeader fileHeader;
+  if (!exportState->log || exportState->log.read((uint8_t *)&fileHeader, sizeof(fileHeader)) != sizeof(fileHeader) || fileHeader.magic != RECORDER_MAGIC || fileHeader.chunkSize != RECORDER_CHUNK_SIZE || fileHeader.sampleSize != sizeof(RecorderSample)) {
+    return request->beginResponse(404, "text/plain", "Session log not found or invalid");
+  }
+
+  if (request->hasParam("format") && request->getParam("format")->value() == "ndjson") exportState->format = EXPORT_NDJSON;
+
+  if (request->hasParam("channels")) {
+    String channels = "," + request->getParam("channels")->value() + ",";
+    exportState->channels = 0;
+    for (int channel = 0; channel < EXPORT_CHANNEL_COUNT; channel++) {
+      if (channels.indexOf("," + String(exportChannelName[channel]) + ",") >= 0) exportState->channels |= (1 << channel);
+    }
+  }
+
+  if (request->hasParam("from")) exportState->fromTime = fileHeader.startTimestamp + request->getParam("from")->value().toInt();
+  if (request->hasParam("to")) exportState->toTime = fileHeader.startTimestamp + request->getParam("to")->value().toInt();
+
+  const AsyncWebHeader *acceptEncoding = request->getHeader("Accept-Encoding");
+  exportState->compress = (acceptEncoding != NULL && acceptEncoding->value().indexOf("gzip") >= 0);
+  if (request->hasParam("gzip")) exportState->compress = (request->getParam("gzip")->value() != "0");
+
+  exportState->chunk = (uint8_t *)malloc(RECORDER_CHUNK_SIZE);
+  exportState->output = (uint8_t *)malloc(EXPORT_BUFFER_SIZE);
+  if (exportState->chunk == NULL || exportState->output == NULL || (exportState->compress && !exportState->gzip.begin())) {
+    return request->beginResponse(503, "text/plain", "Not enough memory for export");
+  }
+
+  // Use the sidecar index to skip straight to the first chunk in range
+  uint32_t dataOffset = (fileHeader.version < 2) ? sizeof(fileHeader) : RECORDER_FILE_HEADER_SIZE;
+  exportState->crcSeed = (fileHeader.version < 3) ? 0 : fileHeader.sessionId;
+  String indexPath = filename.substring(0, filename.lastIndexOf('.')) + ".idx";
+  File index = (exportState->fromTime > fileHeader.startTimestamp) ? openLog(indexPath.c_str()) : File();
+  if (index) {
+    RecorderIndexEntry entry;
+    while (index.read((uint8_t *)&entry, sizeof(entry)) == sizeof(entry)) {
+      if (entry.lastTimestamp >= exportState->fromTime) {
+        dataOffset = entry.offset;
+        exportState->sequence = entry.sequence;
+        break;
+      }
+    }
+    index.close();
+  }
+  exportState->log.seek(dataOffset);
+
+  bool csv = (exportState->format == EXPORT_CSV);
+  String attachment = "attachment; filename=\"" + filename.substring(filename.lastIndexOf('/') + 1, filename.lastIndexOf('.')) + (csv ? ".csv\"" : ".ndjson\"");
+
+  AsyncWebServerResponse *response = request->beginChunkedResponse(csv ? "text/csv" : "application/x-ndjson", [exportState](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+    return fillExportChunk(*exportState, buffer, maxLen);
+  });
+  response->addHeader("Content-Disposition", attachment);
+  if (exportState->compress) response->addHeader("Content-Encoding", "gzip");
+
+  return response;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief getStatusJSON
+ * @details Recorder state for the web UI / API
+ ***/
+String Recorder::getStatusJSON() {
+
+  String jsonString;
+  JsonDocument dataJson;
+
+  dataJson["RECORDING"] = isRecording();
+  dataJson["FILE"] = logPath;
+  dataJson["MEDIA"] = logOnSD ? "SD" : "FLASH";
+  dataJson["SESSION"] = sessionNumber;
+  dataJson["CHUNKS"] = chunkSequence + (chunkFill > 0 ? 1 : 0);
+  dataJson["SAMPLES"] = samplesRecorded;
+  dataJson["QUEUED"] = samplesQueued();
+  dataJson["DROPPED"] = samplesDropped;
+  dataJson["WRITE_ERRORS"] = writeErrors;
+
+  serializeJson(dataJson, jsonString);
+
+  return jsonString;
+
+}
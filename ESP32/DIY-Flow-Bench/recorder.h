@@ -0,0 +1,128 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file recorder.h
+ *
+ * @brief Recorder class header file
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * Session log layout (little endian, see tools/sessionLogDecode.py)
+ *
+ *   RecorderFileHeader [padding]                         - RECORDER_FILE_HEADER_SIZE bytes
+ *   Chunk 0 [RecorderChunkHeader][samples][padding]      - RECORDER_CHUNK_SIZE bytes
+ *   Chunk 1 ...
+ *
+ * Each chunk is written in a single block and carries its own sequence, timestamps and CRC32.
+ * A sidecar .idx file holds one RecorderIndexEntry per chunk. The last chunk may be partial (sampleCount
+ * below chunkSamples), it and its index entry are rewritten in place as it fills. The log is self
+ * describing, so the index can be rebuilt by scanning chunks if it is lost.
+ *
+ * The header is padded to one SD sector (version 2) so every chunk write is whole, aligned sectors.
+ * From version 3 each chunk CRC is seeded with the random sessionId of its file header, so a chunk left
+ * in preallocated space by an earlier session (even one with the same number) fails its CRC.
+ * Sessions are written to the SD card when one is mounted, otherwise to the data partition.
+ *
+ ***/
+#pragma once
+
+#include <Arduino.h>
+#include <FS.h>
+#include <ESPAsyncWebServer.h>
+
+#include "system.h"
+
+#define RECORDER_MAGIC 0x4C424644           // "DFBL"
+#define RECORDER_CHUNK_MAGIC 0x4B4E4843     // "CHNK"
+#define RECORDER_VERSION 3
+#define RECORDER_FILE_HEADER_SIZE 512
+
+
+/***********************************************************
+ * @brief Recorded acquisition sample - 36 bytes
+ ***/
+struct RecorderSample {
+	uint32_t timestamp;       // millis()
+	float FlowCFM;
+	float FlowKGH;
+	float PRefKPA;
+	float PDiffKPA;
+	float PitotKPA;
+	float TempDegC;
+	float BaroHPA;
+	float RelH;
+};
+
+
+struct RecorderFileHeader {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t sampleSize;
+	uint16_t chunkSize;
+	uint16_t chunkSamples;
+	uint32_t startTimestamp;
+	uint32_t session;
+	uint32_t sessionId;       // random per recording, seeds the chunk CRCs (version 3)
+	uint8_t reserved[8];
+};
+
+
+struct RecorderChunkHeader {
+	uint32_t magic;
+	uint32_t sequence;
+	uint32_t firstTimestamp;
+	uint32_t lastTimestamp;
+	uint16_t sampleCount;
+	uint16_t reserved;
+	uint32_t crc;             // CRC32 of header (crc = 0) and samples, seeded with the sessionId
+};
+
+
+struct RecorderIndexEntry {
+	uint32_t offset;
+	uint32_t sequence;
+	uint32_t firstTimestamp;
+	uint32_t lastTimestamp;
+	uint32_t crc;
+};
+
+
+#define RECORDER_CHUNK_SAMPLES ((RECORDER_CHUNK_SIZE - sizeof(RecorderChunkHeader)) / sizeof(RecorderSample))
+
+
+class Recorder {
+
+	friend class Webserver;
+	friend class API;
+
+	private:
+
+		static void TASKwriteSessionLog(void *parameter);
+		static bool writeChunk(uint32_t sampleCount);
+		static uint32_t samplesQueued();
+		static fs::File openLog(const char *path);
+
+	public:
+
+		Recorder();
+
+		void begin();
+		bool start();
+		void stop();
+		bool isRecording();
+
+		static void push();
+
+		String getStatusJSON();
+		int verifyLog(const char *path);
+		AsyncWebServerResponse * exportSession(AsyncWebServerRequest *request);
+
+};
@@ -0,0 +1,163 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file sdcard.cpp
+ *
+ * @brief SDCard class - SD card mount and file helpers
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * Log files are pre-allocated by seeking past the end, which makes FATFS link the whole cluster chain
+ * up front. Appends then only write data sectors rather than updating the FAT and directory entry as
+ * the file grows. The file is truncated back to its real length when it is closed.
+ *
+ ***/
+#include "Arduino.h"
+#include <FS.h>
+#include <SD.h>
+#include <SPI.h>
+#include <unistd.h>
+
+#include "system.h"
+#include "constants.h"
+#include "structs.h"
+
+#include "sdcard.h"
+#include "messages.h"
+
+
+static SPIClass sdSPI(HSPI);
+static bool mounted = false;
+
+
+
+
+/***********************************************************
+ * @brief Class constructor
+ ***/
+SDCard::SDCard() {
+}
+
+
+
+
+/***********************************************************
+ * @brief begin
+ * @details Start the SD SPI bus and mount the card
+ * @returns false if SD is disabled, the pins are not set or no card is present
+ ***/
+bool SDCard::begin() {
+
+  extern struct Configuration config;
+  extern struct Pins pins;
+
+  Messages _message;
+
+  if (mounted) return true;
+  if (!config.bSD_ENABLED) return false;
+
+  if (pins.SD_CS < 0 || pins.SD_SCK < 0 || pins.SD_MISO < 0 || pins.SD_MOSI < 0) {
+    _message.serialPrintf("!! SD card pins not set !!\n");
+    return false;
+  }
+
+  sdSPI.begin(pins.SD_SCK, pins.SD_MISO, pins.SD_MOSI, pins.SD_CS);
+
+  if (!SD.begin(pins.SD_CS, sdSPI, SD_SPI_FREQUENCY, SD_MOUNT_POINT, SD_MAX_OPEN_FILES) || SD.cardType() == CARD_NONE) {
+    _message.serialPrintf("!! SD card mount failed !!\n");
+    sdSPI.end();
+    return false;
+  }
+
+  mounted = true;
+
+  _message.serialPrintf("=== SD card info === \n");
+  _message.serialPrintf("Card size:        %llu MB \n", SD.cardSize() / (1024 * 1024));
+  _message.serialPrintf("Total space used: %llu MB \n", SD.usedBytes() / (1024 * 1024));
+
+  return true;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief isMounted / fs
+ ***/
+bool SDCard::isMounted() {
+
+  return mounted;
+
+}
+
+fs::FS & SDCard::fs() {
+
+  return SD;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief totalBytes / usedBytes
+ ***/
+uint64_t SDCard::totalBytes() {
+
+  return mounted ? SD.totalBytes() : 0;
+
+}
+
+uint64_t SDCard::usedBytes() {
+
+  return mounted ? SD.usedBytes() : 0;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief preallocate
+ * @details Reserve clusters for a newly created file and return to the start
+ * @note The file reports the pre-allocated length until truncate() is called
+ ***/
+bool SDCard::preallocate(fs::File &file, uint32_t length) {
+
+  uint8_t zero = 0;
+
+  if (!file || length == 0) return false;
+
+  bool reserved = file.seek(length - 1) && file.write(&zero, 1) == 1;
+  file.flush();
+  file.seek(0);
+
+  return reserved;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief truncate
+ * @details Cut a closed file back to its used length
+ ***/
+bool SDCard::truncate(const char *path, uint32_t length) {
+
+  char fullPath[64];
+
+  snprintf(fullPath, sizeof(fullPath), "%s%s", SD_MOUNT_POINT, path);
+
+  return ::truncate(fullPath, length) == 0;
+
+}
@@ -0,0 +1,45 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file sdcard.h
+ *
+ * @brief SDCard class header file
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * Optional SD card (config.bSD_ENABLED) on its own SPI bus using the SD_* pins. Used as the session
+ * recorder backend when mounted so long sessions are not limited by the internal data partition.
+ *
+ ***/
+#pragma once
+
+#include <Arduino.h>
+#include <FS.h>
+
+#include "system.h"
+
+
+class SDCard {
+
+	public:
+
+		SDCard();
+
+		static bool begin();
+		static bool isMounted();
+		static fs::FS & fs();
+		static uint64_t totalBytes();
+		static uint64_t usedBytes();
+
+		static bool preallocate(fs::File &file, uint32_t length);
+		static bool truncate(const char *path, uint32_t length);
+
+};
@@ -29,7 +29,16 @@
 #include "sensors.h"
 #include "messages.h"
 #include "driver/pcnt.h"
-#include "mafData.h"
+#include "mafdata.h"
+#include "maftable.h"
+#include "metrics.h"
+#include "trace.h"
+#include "benchstate.h"
+#include "steadystate.h"
+#include "history.h"
+#include "recorder.h"
+#include "timeseries.h"
+#include "modbus.h"
 
 #define TINY_BME280_I2C
 #include "TinyBME280.h" 
@@ -38,6 +47,11 @@ tiny::BME280 _BME280Sensor;
 
 // #include "DeeEmm_BME680.h" // TODO #233
 
+// Custom sign function
+template <typename T> int sgn(T val) {
+    return (T(0) < val) - (val < T(0));
+}
+
 
 
 /***********************************************************
@@ -82,7 +96,7 @@ void Sensors::begin () {
 	MafData _maf(config.iMAF_SENS_TYP);
 
 	status.mafDiameter = _maf.getDiameter();
-	status.mafSensor = _maf.getCurrentType();
+	status.mafSensor = String(_maf.getCurrentType());
 	status.mafSensorType = _maf.getType(); 
 	status.mafLink = _maf.getMafLink();
 	status.mafStatus = _maf.getStatus();
@@ -416,8 +430,11 @@ double Sensors::getMafFlow(int units) {
 	
 	mafMilliVolts = mafVolts * 1000;
 
+	if (status.mafLoaded) {
+		// User MAF data table (mafData.json)
+		flowRateKGH = MafTable::getFlow(mafVolts * 1000.0);
 	// 6th degree polynomial calculation
-	if (settings.AB_test == 'A') { // TEST A/B 
+	} else if (settings.AB_test == 'A') { // TEST A/B 
 		// flowRateKGH = config.mafCoeff0 + (config.mafCoeff1 * mafMilliVolts) + (config.mafCoeff2 * pow(mafMilliVolts, 2)) + (config.mafCoeff3 * pow(mafMilliVolts, 3)) + (config.mafCoeff4 * pow(mafMilliVolts, 4)) + (config.mafCoeff5 * pow(mafMilliVolts, 5)) + (config.mafCoeff6 * pow(mafMilliVolts, 6));
 		flowRateKGH = config.mafCoeff6 * pow(mafMilliVolts, 6) + config.mafCoeff5 * pow(mafMilliVolts, 5) + config.mafCoeff4 * pow(mafMilliVolts, 4) + config.mafCoeff3 * pow(mafMilliVolts, 3) + config.mafCoeff2 * pow(mafMilliVolts, 2) + config.mafCoeff1 * mafMilliVolts + config.mafCoeff0;
 	} else if (settings.AB_test == 'B') {
@@ -676,10 +693,10 @@ double Sensors::getPRefValue() {
 	returnVal = fabs(returnVal);
 	
 	// Convert to INH2O
-	double pRefComp = _calculations.convertPressure(returnVal, INH2O);
+	Units::Quantity<Units::InchWater> pRefComp = Units::Quantity<Units::KiloPascal>(returnVal).as<Units::InchWater>();
 
 	// Lets make sure we have a valid value to return
-	if (pRefComp > settings.min_bench_pressure) {
+	if (pRefComp > Units::Quantity<Units::InchWater>(settings.min_bench_pressure)) {
 		return returnVal;
 	} else { 
 		return 0.0001; // return small non zero value to prevent divide by zero errors (will be truncated to zero in display)
@@ -799,10 +816,10 @@ double Sensors::getPDiffValue() {
 	returnVal = fabs(returnVal);
 	
 	// Convert to INH2O
-	double pDiffComp = _calculations.convertPressure(returnVal, INH2O);
+	Units::Quantity<Units::InchWater> pDiffComp = Units::Quantity<Units::KiloPascal>(returnVal).as<Units::InchWater>();
 
 	// Lets make sure we have a valid value to return - check it is above minimum threshold
-	if (pDiffComp > settings.min_bench_pressure) { 
+	if (pDiffComp > Units::Quantity<Units::InchWater>(settings.min_bench_pressure)) { 
 		return returnVal;
 	} else { 
 		return 0.0001; // return small non zero value to prevent divide by zero errors (will be truncated to zero in display)
@@ -932,11 +949,11 @@ double Sensors::getPitotValue() {
 	returnVal = fabs(returnVal);
 	
 	// Convert to INH2O
-	double pitotComp = _calculations.convertPressure(returnVal, INH2O);
+	Units::Quantity<Units::InchWater> pitotComp = Units::Quantity<Units::KiloPascal>(returnVal).as<Units::InchWater>();
 
 	// Lets make sure we have a valid value to return - check it is above minimum threshold
-	if (pitotComp > settings.min_bench_pressure) { 
-		return pitotComp;
+	if (pitotComp > Units::Quantity<Units::InchWater>(settings.min_bench_pressure)) { 
+		return pitotComp.value();
 	} else { 
 		return 0.0001; // return small non zero value to prevent divide by zero errors (will be truncated to zero in display)
 	}	
@@ -980,10 +997,10 @@ double Sensors::getPitotVelocity(double pitotPressure = 0.0) {
 
 	// Lets make sure we have a valid value to return - check it is above minimum threshold 
 	// Convert to INH2O
-	double pitotComp = _calculations.convertPressure(sensorVal.PitotKPA, INH2O);
+	Units::Quantity<Units::InchWater> pitotComp = Units::Quantity<Units::KiloPascal>(sensorVal.PitotKPA).as<Units::InchWater>();
 
-	if (pitotComp > settings.min_bench_pressure) { 
-		return pitotComp;
+	if (pitotComp > Units::Quantity<Units::InchWater>(settings.min_bench_pressure)) { 
+		return pitotComp.value();
 	} else { 
 		return 0.0001; // return small non zero value to prevent divide by zero errors (will be truncated to zero in display)
 	}	
@@ -1205,3 +1222,236 @@ double Sensors::getRelHValue() {
 	return relativeHumidity;
 	
 }
+
+
+
+
+
+/***********************************************************
+ * @name acquire
+ * @brief One acquisition cycle of the sensor task
+ * @details Reads the bench sensors, applies calibration, filtering and unit conversion to sensorVal,
+ * then feeds the cycle to the state tracker, sample windows, recorder, trend history and Modbus
+ * @note Called by TASKgetSensorData when it is the ADC task's turn
+ ***/
+void Sensors::acquire() {
+
+	extern struct DeviceStatus status;
+	extern struct SensorData sensorVal;
+	extern struct CalibrationData calVal;
+	extern struct BenchSettings settings;
+	extern struct Configuration config;
+	extern int adcStartTime;
+	extern Metrics _metrics;
+
+	Hardware _hardware;
+	Calculations _calculations;
+	Messages _message;
+
+	TRACE_SCOPE(TRACE_ADC_CYCLE);
+	uint32_t cycleStartTime = micros();
+
+	// Set / reset scan timers
+	status.adcScanTime = (micros() - adcStartTime); // how long since we started the timer? 
+	adcStartTime = micros(); // start the timer
+	status.bmeScanCountAverage = (status.bmeScanAlpha * status.bmeScanCount) + (1.0 - status.bmeScanAlpha) * status.bmeScanCountAverage;  // calculate Exponential moving average
+	status.bmeScanCount = 1; // reset to 1 so first scan value in GUI is valid
+	status.adcScanCount += 1;
+
+	// Get reference voltages
+	sensorVal.VCC_5V_BUS = _hardware.get5vSupplyVolts();
+	sensorVal.VCC_3V3_BUS = _hardware.get3v3SupplyVolts();
+
+	// Get MAF / Orifice / Venturi / Pitot flow data
+	switch (settings.bench_type){
+
+		case MAF_BENCH:
+			if (config.iMAF_SRC_TYP != SENSOR_DISABLED) {
+				sensorVal.FlowKGH = getMafFlow();
+				sensorVal.FlowCFMraw = _calculations.convertFlow(sensorVal.FlowKGH);
+			}
+		break;
+
+		case ORIFICE_BENCH:
+			sensorVal.FlowCFMraw = getDifferentialFlow();
+		break;
+
+		case VENTURI_BENCH:
+			//TODO
+		break;
+
+		case PITOT_BENCH:
+			//TODO
+		break;
+
+		default:
+			// Error bench type unknown
+			_message.debugPrintf("Unknown Bench Type\n");
+		break;
+
+	}
+
+	// Apply Flow calibration and leak offsets
+	sensorVal.FlowCFM = sensorVal.FlowCFMraw  - calVal.leak_cal_baseline - calVal.leak_cal_offset  - calVal.flow_offset;
+
+	// Apply Data filters...
+	switch (settings.data_filter_type) {
+
+		case MEDIAN:
+			// Rolling Median      
+			// sensorVal.AverageCFM += ( sensorVal.FlowCFM - sensorVal.AverageCFM ) * 0.1f; // rough running average.
+			// sensorVal.MedianCFM += copysign( sensorVal.AverageCFM * 0.01, sensorVal.FlowCFM - sensorVal.MedianCFM );
+
+			sensorVal.MedianCFM += ALPHA_MEDIAN * sgn(sensorVal.FlowCFM - sensorVal.MedianCFM);
+			sensorVal.FlowCFM = sensorVal.MedianCFM;
+		break;
+
+		case AVERAGE:{
+			// calculate Exponential moving average
+			sensorVal.AverageCFM = (ALPHA_AVERAGE * sensorVal.FlowCFM) + (1.0f - ALPHA_AVERAGE) * sensorVal.AverageCFM; 
+			sensorVal.FlowCFM = sensorVal.AverageCFM;
+		break;
+		}
+
+		case MODE:
+			//TODO - Mode
+			// return most common value over x number of cycles (requested by @black-top)
+
+			// Mean
+			sensorVal.MeanCFM += ALPHA_MEAN * (sensorVal.FlowCFM - sensorVal.MeanCFM);
+			sensorVal.FlowCFM = sensorVal.MeanCFM;
+		break;
+
+		case NONE:
+		default:
+			// No filter
+			sensorVal.FlowCFM = sensorVal.FlowCFM;
+		break;
+
+	}
+
+	// convert to standard flow
+	sensorVal.FlowSCFM = _calculations.convertToSCFM(sensorVal.FlowCFM, settings.standardReference);
+
+	// Get Flow differential values
+	switch (sensorVal.FDiffType) {
+
+		case USERTARGET:{
+
+				switch (sensorVal.flowtile) {
+					case MAFFLOW_TILE:
+						sensorVal.FDiff = sensorVal.FlowKGH - calVal.user_offset;
+						strcpy(sensorVal.FDiffTypeDesc, "User Target (kgh)");
+					break;
+
+					case ACFM_TILE:
+						sensorVal.FDiff = sensorVal.FlowCFM - calVal.user_offset;
+						strcpy(sensorVal.FDiffTypeDesc, "User Target (acfm)");
+					break;
+
+					case ADJCFM_TILE:
+						sensorVal.FDiff = sensorVal.FlowADJ - calVal.user_offset;
+						strcpy(sensorVal.FDiffTypeDesc, "User Target (ajd-cfm)");
+					break;
+
+					case SCFM_TILE:
+						sensorVal.FDiff = sensorVal.FlowSCFM - calVal.user_offset;
+						strcpy(sensorVal.FDiffTypeDesc, "User Target (scfm)");
+					break;
+
+				}
+
+			sensorVal.FDiff = sensorVal.FlowCFM - calVal.user_offset;
+			strcpy(sensorVal.FDiffTypeDesc, "User Target (cfm)");
+
+			break;
+		}
+
+		case BASELINE:
+			sensorVal.FDiff = sensorVal.FlowCFMraw - calVal.flow_offset - calVal.leak_cal_baseline;
+			strcpy(sensorVal.FDiffTypeDesc, "Baseline (cfm)");
+		break;
+
+		case BASELINE_LEAK :
+			sensorVal.FDiff = sensorVal.FlowCFMraw - calVal.flow_offset - calVal.leak_cal_baseline - calVal.leak_cal_offset;
+			strcpy(sensorVal.FDiffTypeDesc, "Offset (cfm)");
+		break;
+
+		default:
+		break;
+	}
+
+	// Get pRef sensor data
+	if (config.iPREF_SENS_TYP != SENSOR_DISABLED) {
+		sensorVal.PRefKPA = getPRefValue();
+		sensorVal.PRefH2O = Units::Quantity<Units::KiloPascal>(sensorVal.PRefKPA).as<Units::InchWater>().value();
+	} else {
+		sensorVal.PRefKPA = 0.0f;
+		sensorVal.PRefH2O = 0.0f;         
+	}
+
+	// Update bench state once per cycle (read by convertFlowDepression and friends)
+	BenchState::update(sensorVal.FlowCFM, sensorVal.PRefH2O, millis());
+
+	// Adjusted flow
+	if (config.iPREF_SENS_TYP != SENSOR_DISABLED) {
+		if (settings.std_adj_flow == 1) {
+			sensorVal.FlowADJ = _calculations.convertFlowDepression(sensorVal.PRefH2O, settings.adj_flow_depression, sensorVal.FlowSCFM);
+		} else {
+			sensorVal.FlowADJ = _calculations.convertFlowDepression(sensorVal.PRefH2O, settings.adj_flow_depression, sensorVal.FlowCFM);
+		}
+		sensorVal.FlowADJSCFM = _calculations.convertToSCFM(sensorVal.FlowADJ, settings.standardReference );
+	}
+
+	// Get pDiff sensor data
+	if (config.iPDIFF_SENS_TYP != SENSOR_DISABLED) {
+		sensorVal.PDiffKPA = getPDiffValue();
+		sensorVal.PDiffH2O = (Units::Quantity<Units::KiloPascal>(sensorVal.PDiffKPA).as<Units::InchWater>() - Units::Quantity<Units::InchWater>(calVal.pdiff_cal_offset)).value();
+	} else {
+		sensorVal.PDiffKPA = 0.0f;
+		sensorVal.PDiffH2O = 0.0f;
+	}
+
+	// Get Pitot sensor data
+	if (config.iPITOT_SENS_TYP != SENSOR_DISABLED) {
+		sensorVal.PitotKPA = getPitotValue() - calVal.pitot_cal_offset;
+		sensorVal.PitotH2O = Units::Quantity<Units::KiloPascal>(sensorVal.PitotKPA).as<Units::InchWater>().value();
+		sensorVal.PitotVelocity = getPitotVelocity(sensorVal.PitotKPA);
+		sensorVal.PitotDelta = sensorVal.PitotH2O;
+	} else {
+		sensorVal.PitotKPA = 0.0f;
+		sensorVal.PitotH2O = 0.0f;
+		sensorVal.PitotVelocity = 0.0f;
+	}
+
+	if (config.bSWIRL_ENBLD) {
+		// TODO #227
+			// uint8_t Swirl = Encoder.read();
+
+			// if (Swirl == DIR_CW) {
+			//   sensorVal.Swirl = Encoder.speed();
+			// } else {
+			//   sensorVal.Swirl = Encoder.speed() * -1;
+			// }
+	} else {
+		sensorVal.Swirl = 0;
+	}
+
+	// Steady state window (lift point auto capture)
+	SteadyState::push(millis());
+
+	// Full rate sample history (windowed capture / calibration)
+	SampleHistory::push(millis());
+
+	// Stream sample to session log (if recording)
+	Recorder::push();
+
+	// Add sample to trend history
+	TimeSeries::push();
+
+	// Update Modbus register image
+	Modbus::publish();
+
+	_metrics.observeAcquisitionCycle(micros() - cycleStartTime);
+
+}
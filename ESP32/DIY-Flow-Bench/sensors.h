@@ -53,6 +53,7 @@ class Sensors {
 		void mafFreqCountISR();
 		void mafSetupISR(uint8_t irq_pin, void (*ISR_callback)(void), int value);
 		String getSensorType(int sensorType);
+		void acquire();
 
 	
 		double startupBaroPressure;
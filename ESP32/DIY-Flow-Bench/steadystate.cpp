@@ -0,0 +1,576 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file steadystate.cpp
+ *
+ * @brief SteadyState class - sliding window steady state detector and lift point auto capture
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * Only the sensor task touches the window. Each push is O(1): the sample entering the window and the
+ * one leaving it update the mean, M2 (sum of squared deviations) and the position weighted sum used
+ * for the slope. The sums are rebuilt from the window once per lap so rounding can not accumulate.
+ * Results are published under a spinlock for the web / API tasks.
+ *
+ ***/
+#include "Arduino.h"
+#include <ArduinoJson.h>
+
+#include "system.h"
+#include "constants.h"
+#include "structs.h"
+
+#include "steadystate.h"
+#include "benchstate.h"
+#include "persistence.h"
+#include "messages.h"
+
+
+struct SteadyChannel {
+  float window[STEADY_WINDOW_SAMPLES];
+  double mean;
+  double m2;                  // sum of squared deviations from the mean
+  double sumTV;               // sum of (sample time x value), time in seconds from windowBase
+};
+
+static_assert((STEADY_WINDOW_SAMPLES & (STEADY_WINDOW_SAMPLES - 1)) == 0, "STEADY_WINDOW_SAMPLES must be a power of 2");
+
+// Sensor task only
+static SteadyChannel flowChannel;
+static SteadyChannel pRefChannel;
+static uint32_t windowTime[STEADY_WINDOW_SAMPLES];
+static uint32_t windowHead = 0;           // next slot
+static uint32_t windowCount = 0;
+static uint32_t windowBase = 0;           // time origin (millis()) of the slope sums
+static double sumT = 0.0;                 // sum of sample times (s)
+static double sumTT = 0.0;                // sum of squared sample times
+static bool windowSlid = false;           // a sample has left the window, it spans STEADY_WINDOW_MS
+
+// Published results and auto capture state
+static portMUX_TYPE steadyMux = portMUX_INITIALIZER_UNLOCKED;
+static SteadyStats publishedFlow;
+static SteadyStats publishedPRef;
+static bool publishedSteady = false;
+static bool publishedFull = false;
+static uint32_t publishedCount = 0;
+static float publishedRate = 0.0f;        // measured samples per second
+static int armedRun = 0;
+static int armedPoint = 0;                // 0 = not armed
+static uint32_t armedTime = 0;            // settle timer start
+static bool waitingForChange = false;     // captured, wait for the valve to move
+static SteadyCapture lastCapture;
+
+
+
+
+/***********************************************************
+ * @brief windowSeconds
+ * @details Sample time relative to the slope sums origin
+ ***/
+static inline double windowSeconds(uint32_t timeMs) {
+
+  return (timeMs - windowBase) / 1000.0;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief addSample
+ * @details Running Welford update plus the time weighted sum for the slope
+ * @param count Samples in the window before this one
+ ***/
+static void addSample(SteadyChannel &channel, float value, double time, uint32_t slot, uint32_t count) {
+
+  double delta = value - channel.mean;
+
+  channel.mean += delta / (count + 1);
+  channel.m2 += delta * (value - channel.mean);
+  channel.sumTV += time * value;
+
+  channel.window[slot] = value;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief removeSample
+ * @details Reverse Welford update for the sample leaving the window
+ * @param count Samples in the window including this one
+ ***/
+static void removeSample(SteadyChannel &channel, double time, uint32_t slot, uint32_t count) {
+
+  double value = channel.window[slot];
+
+  if (count <= 1) {
+    channel.mean = 0.0;
+    channel.m2 = 0.0;
+    channel.sumTV = 0.0;
+    return;
+  }
+
+  double mean = (channel.mean * count - value) / (count - 1);
+
+  channel.m2 -= (value - channel.mean) * (value - mean);
+  channel.mean = mean;
+  channel.sumTV -= time * value;
+
+  if (channel.m2 < 0.0) channel.m2 = 0.0;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief rebuild
+ * @details Recalculate the sums from the window, with the time origin moved to the oldest sample
+ ***/
+static void rebuild(SteadyChannel &channel) {
+
+  uint32_t oldest = (windowHead - windowCount) & (STEADY_WINDOW_SAMPLES - 1);
+  double sum = 0.0;
+  double sumTV = 0.0;
+  double m2 = 0.0;
+
+  for (uint32_t i = 0; i < windowCount; i++) {
+    uint32_t slot = (oldest + i) & (STEADY_WINDOW_SAMPLES - 1);
+    sum += channel.window[slot];
+    sumTV += windowSeconds(windowTime[slot]) * channel.window[slot];
+  }
+
+  double mean = (windowCount > 0) ? sum / windowCount : 0.0;
+
+  for (uint32_t i = 0; i < windowCount; i++) {
+    double deviation = channel.window[(oldest + i) & (STEADY_WINDOW_SAMPLES - 1)] - mean;
+    m2 += deviation * deviation;
+  }
+
+  channel.mean = mean;
+  channel.m2 = m2;
+  channel.sumTV = sumTV;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief rebuildWindow
+ * @details Rebuild both channels and the time sums (once per ring lap, so rounding cannot drift)
+ ***/
+static void rebuildWindow() {
+
+  uint32_t oldest = (windowHead - windowCount) & (STEADY_WINDOW_SAMPLES - 1);
+
+  windowBase = windowTime[oldest];
+  sumT = 0.0;
+  sumTT = 0.0;
+
+  for (uint32_t i = 0; i < windowCount; i++) {
+    double time = windowSeconds(windowTime[(oldest + i) & (STEADY_WINDOW_SAMPLES - 1)]);
+    sumT += time;
+    sumTT += time * time;
+  }
+
+  rebuild(flowChannel);
+  rebuild(pRefChannel);
+
+}
+
+
+
+
+/***********************************************************
+ * @brief channelStats
+ * @param count Samples in the window
+ * @param spanMs Time between the oldest and newest sample
+ * @param full Window spans STEADY_WINDOW_MS with at least STEADY_MIN_SAMPLES samples
+ * @param tolerancePct Allowed deviation and drift (% of the mean)
+ ***/
+static SteadyStats channelStats(const SteadyChannel &channel, uint32_t count, uint32_t spanMs, bool full, double tolerancePct) {
+
+  SteadyStats stats;
+
+  if (count < 2) return stats;
+
+  double n = count;
+  double variance = channel.m2 / (n - 1.0);
+  double stdDev = sqrt(variance);
+
+  // Least squares slope against sample time, so uneven sample spacing does not skew it
+  double tMean = sumT / n;
+  double stt = sumTT - n * tMean * tMean;
+  double slope = (stt > 0.0) ? (channel.sumTV - n * tMean * channel.mean) / stt : 0.0;
+  double drift = fabs(slope * spanMs / 1000.0);          // change across the window
+  double tolerance = fabs(channel.mean) * (tolerancePct / 100.0);
+
+  stats.mean = channel.mean;
+  stats.stdDev = stdDev;
+  stats.slope = slope;
+  stats.ci95 = STEADY_CI_Z * stdDev / sqrt(n);
+  stats.steady = full && (stdDev <= tolerance) && (drift <= tolerance);
+
+  return stats;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief Class constructor
+ ***/
+SteadyState::SteadyState() {
+}
+
+
+
+
+/***********************************************************
+ * @brief flowValue
+ * @returns Current flow in the lift data capture datatype (settings.data_capture_datatype)
+ ***/
+double SteadyState::flowValue() {
+
+  extern struct SensorData sensorVal;
+  extern struct BenchSettings settings;
+
+  switch (settings.data_capture_datatype) {
+
+    case ACFM:
+      return sensorVal.FlowCFM;
+
+    case STD_ACFM:
+      return sensorVal.FlowSCFM;
+
+    case ADJ_ACFM:
+      return sensorVal.FlowADJ;
+
+    case ADJ_STD_ACFM:
+      return sensorVal.FlowADJSCFM;
+
+    case RAW_MASS:
+      return sensorVal.FlowKGH;
+
+  }
+
+  return 0.0;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief push
+ * @details Add the current sample to the window, update the published stats and run auto capture
+ * @note Called once per acquisition cycle from the sensor task, after BenchState::update()
+ ***/
+void SteadyState::push(uint32_t timeMs) {
+
+  extern struct SensorData sensorVal;
+  extern struct BenchSettings settings;
+  extern struct Configuration config;
+
+  // Samples older than the window leave it, as does the oldest when the ring is full
+  while (windowCount > 0) {
+    uint32_t oldest = (windowHead - windowCount) & (STEADY_WINDOW_SAMPLES - 1);
+    bool aged = (timeMs - windowTime[oldest] > STEADY_WINDOW_MS);
+    if (!aged && windowCount < STEADY_WINDOW_SAMPLES) break;
+    double time = windowSeconds(windowTime[oldest]);
+    removeSample(flowChannel, time, oldest, windowCount);
+    removeSample(pRefChannel, time, oldest, windowCount);
+    sumT -= time;
+    sumTT -= time * time;
+    windowCount--;
+    windowSlid = true;
+  }
+
+  // Starting again from empty (bench stood idle), the window has to span STEADY_WINDOW_MS again
+  if (windowCount == 0) {
+    windowBase = timeMs;
+    sumT = 0.0;
+    sumTT = 0.0;
+    windowSlid = false;
+  }
+
+  uint32_t slot = windowHead;
+  double time = windowSeconds(timeMs);
+
+  addSample(flowChannel, flowValue(), time, slot, windowCount);
+  addSample(pRefChannel, fabs(sensorVal.PRefH2O), time, slot, windowCount);
+  sumT += time;
+  sumTT += time * time;
+  windowTime[slot] = timeMs;
+
+  windowHead = (windowHead + 1) & (STEADY_WINDOW_SAMPLES - 1);
+  windowCount++;
+
+  if (windowHead == 0) rebuildWindow();
+
+  uint32_t oldest = (windowHead - windowCount) & (STEADY_WINDOW_SAMPLES - 1);
+  uint32_t spanMs = timeMs - windowTime[oldest];
+  bool full = windowSlid && (windowCount >= STEADY_MIN_SAMPLES);
+  float rate = (spanMs > 0) ? (windowCount - 1) * 1000.0f / spanMs : 0.0f;
+
+  SteadyStats flow = channelStats(flowChannel, windowCount, spanMs, full, settings.steady_flow_tolerance);
+  SteadyStats pRef = channelStats(pRefChannel, windowCount, spanMs, full, settings.steady_pref_tolerance);
+
+  // No pRef sensor, nothing to wait for
+  if (config.iPREF_SENS_TYP == SENSOR_DISABLED) pRef.steady = true;
+
+  bool steady = flow.steady && pRef.steady && BenchState::isRunning();
+  bool doCapture = false;
+
+  portENTER_CRITICAL(&steadyMux);
+  publishedFlow = flow;
+  publishedPRef = pRef;
+  publishedSteady = steady;
+  publishedFull = full;
+  publishedCount = windowCount;
+  publishedRate = rate;
+  if (armedPoint > 0) {
+    if (waitingForChange) {
+      // settle timer starts once the readings move away from the last captured point
+      if (!steady) {
+        waitingForChange = false;
+        armedTime = timeMs;
+      }
+    } else if (steady) {
+      doCapture = true;
+    }
+  }
+  portEXIT_CRITICAL(&steadyMux);
+
+  if (doCapture) capture(timeMs);
+
+}
+
+
+
+
+/***********************************************************
+ * @brief capture
+ * @details Store the window mean in the armed lift point and arm the next point
+ ***/
+void SteadyState::capture(uint32_t timeMs) {
+
+  extern struct ValveLiftData valveData;
+
+  Messages _message;
+
+  SteadyCapture result;
+  bool finished = false;
+
+  portENTER_CRITICAL(&steadyMux);
+  result.timestamp = timeMs;
+  result.settleTime = timeMs - armedTime;
+  result.run = armedRun;
+  result.point = armedPoint;
+  result.flow = publishedFlow.mean;
+  result.flowCI95 = publishedFlow.ci95;
+  result.pRef = publishedPRef.mean;
+  result.pRefCI95 = publishedPRef.ci95;
+  lastCapture = result;
+  if (armedPoint < valveData.run[armedRun].pointCount) {
+    armedPoint++;
+    waitingForChange = true;
+  } else {
+    armedPoint = 0;
+    finished = true;
+  }
+  portEXIT_CRITICAL(&steadyMux);
+
+  valveData.run[result.run].flow[result.point - 1] = result.flow;
+
+  Persistence::request(PERSIST_LIFT_RUN + result.run);
+
+  _message.debugPrintf("Lift point %d captured: %.2f +/- %.2f (settled in %lu ms) \n", result.point, (double)result.flow, (double)result.flowCI95, (unsigned long)result.settleTime);
+  if (finished) _message.debugPrintf("Auto capture complete \n");
+
+}
+
+
+
+
+/***********************************************************
+ * @brief arm
+ * @details Start auto capture at a lift point of a run
+ * @param point Lift point (1 based)
+ * @returns false if the run / point is out of range
+ ***/
+bool SteadyState::arm(int run, int point) {
+
+  extern struct ValveLiftData valveData;
+
+  if (run < 0 || run >= LIFT_PROFILE_MAX_RUNS || point < 1 || point > valveData.run[run].pointCount) return false;
+
+  valveData.activeRun = run;
+
+  portENTER_CRITICAL(&steadyMux);
+  armedRun = run;
+  armedPoint = point;
+  armedTime = millis();
+  waitingForChange = false;
+  portEXIT_CRITICAL(&steadyMux);
+
+  return true;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief disarm
+ ***/
+void SteadyState::disarm() {
+
+  portENTER_CRITICAL(&steadyMux);
+  armedPoint = 0;
+  portEXIT_CRITICAL(&steadyMux);
+
+}
+
+
+
+
+/***********************************************************
+ * @brief isSteady
+ * @returns true if flow and pRef are steady and the bench is running
+ ***/
+bool SteadyState::isSteady() {
+
+  portENTER_CRITICAL(&steadyMux);
+  bool steady = publishedSteady;
+  portEXIT_CRITICAL(&steadyMux);
+
+  return steady;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief windowFull
+ ***/
+bool SteadyState::windowFull() {
+
+  portENTER_CRITICAL(&steadyMux);
+  bool full = publishedFull;
+  portEXIT_CRITICAL(&steadyMux);
+
+  return full;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief flowStats
+ ***/
+SteadyStats SteadyState::flowStats() {
+
+  portENTER_CRITICAL(&steadyMux);
+  SteadyStats stats = publishedFlow;
+  portEXIT_CRITICAL(&steadyMux);
+
+  return stats;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief pRefStats
+ ***/
+SteadyStats SteadyState::pRefStats() {
+
+  portENTER_CRITICAL(&steadyMux);
+  SteadyStats stats = publishedPRef;
+  portEXIT_CRITICAL(&steadyMux);
+
+  return stats;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief getStatusJSON
+ * @details Detector and auto capture state for /api/steadystate
+ ***/
+String SteadyState::getStatusJSON() {
+
+  String jsonString;
+  JsonDocument dataJson;
+
+  portENTER_CRITICAL(&steadyMux);
+  SteadyStats flow = publishedFlow;
+  SteadyStats pRef = publishedPRef;
+  bool steady = publishedSteady;
+  bool full = publishedFull;
+  uint32_t count = publishedCount;
+  float rate = publishedRate;
+  int run = armedRun;
+  int point = armedPoint;
+  SteadyCapture last = lastCapture;
+  portEXIT_CRITICAL(&steadyMux);
+
+  dataJson["STEADY"] = steady;
+  dataJson["WINDOW_FULL"] = full;
+  dataJson["WINDOW_MS"] = STEADY_WINDOW_MS;
+  dataJson["WINDOW_SAMPLES"] = count;
+  dataJson["SAMPLE_RATE"] = rate;
+
+  JsonObject flowJson = dataJson["FLOW"].to<JsonObject>();
+  flowJson["MEAN"] = flow.mean;
+  flowJson["SD"] = flow.stdDev;
+  flowJson["SLOPE"] = flow.slope;
+  flowJson["CI95"] = flow.ci95;
+  flowJson["STEADY"] = flow.steady;
+
+  JsonObject pRefJson = dataJson["PREF"].to<JsonObject>();
+  pRefJson["MEAN"] = pRef.mean;
+  pRefJson["SD"] = pRef.stdDev;
+  pRefJson["SLOPE"] = pRef.slope;
+  pRefJson["CI95"] = pRef.ci95;
+  pRefJson["STEADY"] = pRef.steady;
+
+  dataJson["ARMED"] = (point > 0);
+  dataJson["RUN"] = run;
+  dataJson["POINT"] = point;
+
+  if (last.run >= 0) {
+    JsonObject lastJson = dataJson["LAST_CAPTURE"].to<JsonObject>();
+    lastJson["RUN"] = last.run;
+    lastJson["POINT"] = last.point;
+    lastJson["FLOW"] = last.flow;
+    lastJson["FLOW_CI95"] = last.flowCI95;
+    lastJson["PREF"] = last.pRef;
+    lastJson["PREF_CI95"] = last.pRefCI95;
+    lastJson["SETTLE_MS"] = last.settleTime;
+    lastJson["AGE_MS"] = millis() - last.timestamp;
+  }
+
+  serializeJson(dataJson, jsonString);
+
+  return jsonString;
+
+}
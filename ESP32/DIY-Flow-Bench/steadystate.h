@@ -0,0 +1,91 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file steadystate.h
+ *
+ * @brief SteadyState class header file
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * Online steady state detector for lift point capture. The sensor task pushes every sample and the
+ * detector keeps a sliding time window (STEADY_WINDOW_MS) of the capture flow and pRef, with a sliding
+ * Welford mean / variance and a least squares slope against sample time for each. The window is sized
+ * in time rather than samples, so settle time does not depend on the sensor rate (the measured rate is
+ * reported by /api/steadystate).
+ *
+ * A channel is steady once the window has filled (STEADY_WINDOW_MS and STEADY_MIN_SAMPLES) and both its
+ * standard deviation and its drift across the window (slope x window time) are inside the tolerance set
+ * in settings (% of the window mean). Flow and pRef must both be
+ * steady and the bench must be running.
+ *
+ * When auto capture is armed the window mean is written to the armed lift point as soon as the
+ * readings settle, then the next point is armed. The next capture waits until the readings have left
+ * steady state (valve moved) and settled again.
+ *
+ ***/
+#pragma once
+
+#include <Arduino.h>
+
+#include "system.h"
+#include "constants.h"
+
+
+/***********************************************************
+ * @brief Window statistics for one channel
+ ***/
+struct SteadyStats {
+	float mean = 0.0f;
+	float stdDev = 0.0f;
+	float slope = 0.0f;           // units per second
+	float ci95 = 0.0f;            // half width of the 95% confidence interval of the mean
+	bool steady = false;
+};
+
+
+/***********************************************************
+ * @brief Result of the last auto capture
+ ***/
+struct SteadyCapture {
+	uint32_t timestamp = 0;       // millis()
+	uint32_t settleTime = 0;      // ms from arming / valve move to capture
+	int run = -1;
+	int point = 0;                // 1 based
+	float flow = 0.0f;
+	float flowCI95 = 0.0f;
+	float pRef = 0.0f;
+	float pRefCI95 = 0.0f;
+};
+
+
+class SteadyState {
+
+	private:
+
+		static void capture(uint32_t timeMs);
+
+	public:
+
+		SteadyState();
+
+		static void push(uint32_t timeMs);
+		static bool isSteady();
+		static bool windowFull();
+		static SteadyStats flowStats();
+		static SteadyStats pRefStats();
+		static double flowValue();
+
+		static bool arm(int run, int point);
+		static void disarm();
+
+		static String getStatusJSON();
+
+};
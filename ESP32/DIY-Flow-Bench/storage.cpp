@@ -0,0 +1,392 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file storage.cpp
+ *
+ * @brief Storage class - LittleFS data partition with in-RAM directory index
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * SPIFFS migration: both filesystems use the same 'spiffs' partition, so the existing files are read
+ * into RAM, the partition is reformatted as LittleFS and the files written back. If the files will
+ * not fit in free heap the partition is left as SPIFFS and used as before. Upload a LittleFS image or
+ * delete some files (e.g. old session logs) to complete the migration on a later boot.
+ *
+ ***/
+#include "Arduino.h"
+#include <FS.h>
+#include <LittleFS.h>
+#include <SPIFFS.h>
+
+#include "system.h"
+#include "constants.h"
+#include "structs.h"
+
+#include "storage.h"
+#include "messages.h"
+
+
+static bool usingLittleFS = true;
+
+static portMUX_TYPE indexMux = portMUX_INITIALIZER_UNLOCKED;
+static StorageIndexEntry fileIndex[STORAGE_MAX_FILES];
+static int indexCount = 0;
+
+
+
+
+/***********************************************************
+ * @brief Class constructor
+ ***/
+Storage::Storage() {
+}
+
+
+
+
+/***********************************************************
+ * @brief begin
+ * @details Mount the data partition (migrating SPIFFS if required) and build the file index
+ * @returns false if no filesystem could be mounted
+ ***/
+bool Storage::begin() {
+
+  Messages _message;
+
+  bool mounted = false;
+
+  usingLittleFS = true;
+
+  if (LittleFS.begin(false)) {
+    mounted = true;
+  } else if (migrateFromSPIFFS()) {
+    mounted = true;
+  } else if (SPIFFS.begin(false)) {
+    usingLittleFS = false;
+    mounted = true;
+    _message.serialPrintf("!! Data partition left as SPIFFS !!\n");
+  } else {
+    _message.serialPrintf("...Failed\n");
+    #if defined FORMAT_FILESYSTEM_IF_FAILED
+      mounted = LittleFS.begin(true);
+      if (mounted) _message.serialPrintf("!! File System Formatted !!\n");
+    #endif
+  }
+
+  if (mounted) rebuildIndex();
+
+  return mounted;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief migrateFromSPIFFS
+ * @details Copy a SPIFFS partition into a freshly formatted LittleFS partition
+ * @returns true if the partition is now LittleFS
+ ***/
+bool Storage::migrateFromSPIFFS() {
+
+  struct MigrationFile {
+    char path[STORAGE_PATH_LENGTH];
+    size_t size;
+    uint8_t *data;
+  };
+
+  Messages _message;
+
+  if (!SPIFFS.begin(false)) return false;
+
+  _message.serialPrintf("Migrating SPIFFS to LittleFS \n");
+
+  MigrationFile *files = (MigrationFile *)calloc(STORAGE_MAX_FILES, sizeof(MigrationFile));
+  int fileCount = 0;
+  size_t totalSize = 0;
+  bool fits = (files != NULL);
+
+  File root = SPIFFS.open("/");
+  File file = fits ? root.openNextFile() : File();
+
+  while (file) {
+
+    size_t size = file.size();
+
+    if (fileCount >= STORAGE_MAX_FILES || strlen(file.path()) >= STORAGE_PATH_LENGTH || size + STORAGE_MIGRATION_HEAP_RESERVE > ESP.getMaxAllocHeap()) {
+      fits = false;
+      break;
+    }
+
+    MigrationFile &copy = files[fileCount];
+    copy.data = (uint8_t *)malloc(size > 0 ? size : 1);
+    if (copy.data == NULL || file.read(copy.data, size) != size) {
+      free(copy.data);
+      fits = false;
+      break;
+    }
+
+    strlcpy(copy.path, file.path(), sizeof(copy.path));
+    copy.size = size;
+    totalSize += size;
+    fileCount++;
+
+    file = root.openNextFile();
+  }
+
+  file.close();
+  root.close();
+  SPIFFS.end();
+
+  // Partition is only reformatted once every file is safely in RAM
+  if (fits && LittleFS.begin(true)) {
+
+    for (int i = 0; i < fileCount; i++) {
+      File output = LittleFS.open(files[i].path, FILE_WRITE);
+      if (!output || output.write(files[i].data, files[i].size) != files[i].size) {
+        _message.serialPrintf("!! Migration failed: %s !!\n", files[i].path);
+      }
+      output.close();
+    }
+
+    _message.serialPrintf("Migrated %d files (%u bytes) \n", fileCount, totalSize);
+
+  } else {
+
+    _message.serialPrintf("Not enough memory to migrate SPIFFS (%u bytes) \n", totalSize);
+    fits = false;
+  }
+
+  for (int i = 0; i < fileCount; i++) free(files[i].data);
+  free(files);
+
+  return fits;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief fs
+ * @details Active filesystem for open / read / write and AsyncWebServer file responses
+ ***/
+fs::FS & Storage::fs() {
+
+  if (usingLittleFS) return LittleFS;
+  return SPIFFS;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief type
+ ***/
+const char * Storage::type() {
+
+  return usingLittleFS ? "LittleFS" : "SPIFFS";
+
+}
+
+
+
+
+/***********************************************************
+ * @brief totalBytes / usedBytes
+ ***/
+size_t Storage::totalBytes() {
+
+  return usingLittleFS ? LittleFS.totalBytes() : SPIFFS.totalBytes();
+
+}
+
+size_t Storage::usedBytes() {
+
+  return usingLittleFS ? LittleFS.usedBytes() : SPIFFS.usedBytes();
+
+}
+
+
+
+
+/***********************************************************
+ * @brief findEntry
+ * @note Caller must hold indexMux
+ * @returns index position or -1
+ ***/
+int Storage::findEntry(const char *path) {
+
+  for (int i = 0; i < indexCount; i++) {
+    if (strcmp(fileIndex[i].path, path) == 0) return i;
+  }
+
+  return -1;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief scanDirectory
+ * @details Add the files in a directory (and its subdirectories) to the index
+ ***/
+void Storage::scanDirectory(fs::File &dir) {
+
+  File file = dir.openNextFile();
+
+  while (file) {
+
+    if (file.isDirectory()) {
+      scanDirectory(file);
+    } else if (indexCount < STORAGE_MAX_FILES) {
+      strlcpy(fileIndex[indexCount].path, file.path(), STORAGE_PATH_LENGTH);
+      fileIndex[indexCount].size = file.size();
+      indexCount++;
+    }
+
+    file = dir.openNextFile();
+  }
+
+}
+
+
+
+
+/***********************************************************
+ * @brief rebuildIndex
+ * @details Walk the filesystem and replace the file index
+ * @note Only needed at boot or if files were changed without going through Storage
+ ***/
+void Storage::rebuildIndex() {
+
+  Messages _message;
+
+  File root = fs().open("/");
+
+  portENTER_CRITICAL(&indexMux);
+  indexCount = 0;
+  portEXIT_CRITICAL(&indexMux);
+
+  // Only begin() and this function write whole entries, single writer so the scan itself is not locked
+  if (root) scanDirectory(root);
+  root.close();
+
+  if (indexCount >= STORAGE_MAX_FILES) _message.serialPrintf("!! File index full (%d files) !!\n", STORAGE_MAX_FILES);
+
+}
+
+
+
+
+/***********************************************************
+ * @brief indexFile
+ * @details Add or update a file in the index after it has been written and closed
+ * @note Removes the entry if the file no longer exists
+ ***/
+void Storage::indexFile(const char *path) {
+
+  File file = fs().open(path, FILE_READ);
+  bool found = file && !file.isDirectory();
+  uint32_t size = found ? file.size() : 0;
+  if (file) file.close();
+
+  portENTER_CRITICAL(&indexMux);
+
+  int entry = findEntry(path);
+
+  if (found && entry < 0 && indexCount < STORAGE_MAX_FILES && strlen(path) < STORAGE_PATH_LENGTH) {
+    entry = indexCount++;
+    strlcpy(fileIndex[entry].path, path, STORAGE_PATH_LENGTH);
+  }
+
+  if (found && entry >= 0) {
+    fileIndex[entry].size = size;
+  } else if (!found && entry >= 0) {
+    memmove(&fileIndex[entry], &fileIndex[entry + 1], (indexCount - entry - 1) * sizeof(StorageIndexEntry));
+    indexCount--;
+  }
+
+  portEXIT_CRITICAL(&indexMux);
+
+}
+
+
+
+
+/***********************************************************
+ * @brief exists
+ * @details Index lookup - does not touch the filesystem
+ ***/
+bool Storage::exists(const char *path) {
+
+  portENTER_CRITICAL(&indexMux);
+  bool found = findEntry(path) >= 0;
+  portEXIT_CRITICAL(&indexMux);
+
+  return found;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief remove
+ * @details Delete a file and drop it from the index
+ ***/
+bool Storage::remove(const char *path) {
+
+  if (!exists(path)) return false;
+
+  bool removed = fs().remove(path);
+
+  indexFile(path);
+
+  return removed;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief fileCount
+ ***/
+int Storage::fileCount() {
+
+  return indexCount;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief getEntry
+ * @details Copy an index entry (entries may move if a file is removed meanwhile)
+ ***/
+bool Storage::getEntry(int index, StorageIndexEntry &entry) {
+
+  bool valid = false;
+
+  portENTER_CRITICAL(&indexMux);
+  if (index >= 0 && index < indexCount) {
+    entry = fileIndex[index];
+    valid = true;
+  }
+  portEXIT_CRITICAL(&indexMux);
+
+  return valid;
+
+}
@@ -0,0 +1,68 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file storage.h
+ *
+ * @brief Storage class header file
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * Data partition access. The partition is LittleFS; a partition still holding SPIFFS from an older
+ * release is migrated on first boot. The file list is kept in RAM so listing and exists() checks do
+ * not walk the filesystem. Anything that creates, resizes or deletes a file must go through
+ * Storage::remove() or call Storage::indexFile() once the file is closed.
+ *
+ ***/
+#pragma once
+
+#include <Arduino.h>
+#include <FS.h>
+
+#include "system.h"
+
+
+struct StorageIndexEntry {
+	char path[STORAGE_PATH_LENGTH];
+	uint32_t size;
+};
+
+
+class Storage {
+
+	friend class DataHandler;
+	friend class Webserver;
+	friend class API;
+
+	private:
+
+		static bool migrateFromSPIFFS();
+		static void scanDirectory(fs::File &dir);
+		static int findEntry(const char *path);
+
+	public:
+
+		Storage();
+
+		static bool begin();
+		static fs::FS & fs();
+		static const char * type();
+		static size_t totalBytes();
+		static size_t usedBytes();
+
+		static bool exists(const char *path);
+		static bool remove(const char *path);
+		static void indexFile(const char *path);
+		static void rebuildIndex();
+
+		static int fileCount();
+		static bool getEntry(int index, StorageIndexEntry &entry);
+
+};
@@ -74,6 +74,9 @@ struct BenchSettings {
   int temp_unit = CELCIUS;                        // Defalt display unit of temperature
   bool ap_mode = false;                           // Default WiFi connection mode is accesspoint mode
   double valveLiftInterval = 1.5;                 // Distance between valve lift data points (can be metric or imperial)
+  double steady_flow_tolerance = 0.5;             // Flow steady within this % for lift point auto capture
+  double steady_pref_tolerance = 1.0;             // pRef steady within this % for lift point auto capture
+  bool ota_allow_unverified = false;              // Accept firmware updates that have no SHA-256 digest
 };
 
 
@@ -232,6 +235,7 @@ struct DeviceStatus {
   int pollTimer = 0;
   int serialData = 0;
   String statusMessage = BOOT_MESSAGE;
+  String alarmMessage = "";
   bool apMode = false;
   double HWMBME = 0.0;
   double HWMADC = 0.0;
@@ -263,6 +267,8 @@ struct DeviceStatus {
   size_t nvmPins = 0;
   size_t nvmConfig = 0;
   size_t nvmSettings = 0;
+  uint32_t nvmLoadTime = 0;
+  uint32_t firstSSETime = 0;
   int loopScanTime = 0;
   int bmeScanTime = 0;
   int adcScanTime = 0;
@@ -340,20 +346,18 @@ struct SensorData {
 
 /***********************************************************
  * Valve Lift data
+ * One profile per run (e.g. 'Stock intake', 'Ported exhaust'). Each run is persisted as its own blob
  ***/
+struct LiftProfile {
+  char name[LIFT_PROFILE_NAME_LENGTH] = "";
+  uint8_t port = LIFT_PORT_INTAKE;                // LIFT_PORT_INTAKE / LIFT_PORT_EXHAUST
+  uint8_t pointCount = LIFT_PROFILE_DEFAULT_POINTS;
+  float flow[LIFT_PROFILE_MAX_POINTS] = {0.0f};   // Flow at (point + 1) * valveLiftInterval
+};
+
 struct ValveLiftData {
-  double_t LiftData1 = 0.0;
-  double_t LiftData2 = 0.0;
-  double_t LiftData3 = 0.0;
-  double_t LiftData4 = 0.0;
-  double_t LiftData5 = 0.0;
-  double_t LiftData6 = 0.0;
-  double_t LiftData7 = 0.0;
-  double_t LiftData8 = 0.0;
-  double_t LiftData9 = 0.0;
-  double_t LiftData10 = 0.0;
-  double_t LiftData11 = 0.0;
-  double_t LiftData12 = 0.0;
+  uint8_t activeRun = 0;
+  LiftProfile run[LIFT_PROFILE_MAX_RUNS];
 };
 
 
@@ -529,6 +533,7 @@ struct Language {
     char LANG_ORIFICE_CHANGE[50] = "Orifice Plate Changed";
     char LANG_UPLOAD_FAILED_NO_SPACE[50] = "Upload rejected, not enough space";
     char LANG_FILE_UPLOADED[50] = "File uploaded";
+    char LANG_SESSION_LOG_FAILED[50] = "Session log write failed";
     char LANG_NO_BOARD_LOADED[50] = "No board loaded";  
     char LANG_GUI_PITOT[50] = "Pitot";  
     char LANG_GUI_PREF[50] = "Depression";  
@@ -579,6 +584,9 @@ struct Language {
     char LANG_GUI_MIN_PRESSURE[50] = "Min Pressure (in/H2O)";
     char LANG_GUI_MAF_MIN_VOLTS[50] = "MAF Min volts";
     char LANG_GUI_CYCLIC_AVERAGE_BUFFER[50] = "Cyclical Average Buffer";
+    char LANG_GUI_STEADY_FLOW_TOL[50] = "Steady Flow Tolerance (%)";
+    char LANG_GUI_STEADY_PREF_TOL[50] = "Steady pRef Tolerance (%)";
+    char LANG_GUI_OTA_UNVERIFIED[50] = "Allow Updates Without SHA-256";
     char LANG_GUI_CONVERSION_SETTINGS[50] = "Conversion Settings";
     char LANG_GUI_ADJ_FLOW_DEP[50] = "Adj Flow pRef (in/H2O)";
     char LANG_GUI_STANDARD_REF_CONDITIONS[50] = "Ref Standard (SCFM)";
@@ -30,6 +30,9 @@ using namespace std;
 #define SUBNET {192,168,1,1}                                    // Subnet (For static IP)
 #define GATEWAY {255,255,0,0}                                   // Default gateway (For static IP)
 #define WEBSERVER_ENABLED                                       // Disable to run headless
+#define TRACE_ENABLED                                           // Cycle counter trace recorder (/api/trace)
+#define MODBUS_TCP_ENABLED                                      // Read only Modbus TCP server (see modbus.h)
+// #define MODBUS_RTU_ENABLED                                   // Read only Modbus RTU server on Serial2 (uses SERIAL2 pins)
 
 
 /***********************************************************
@@ -38,7 +41,6 @@ using namespace std;
  ***/
 #define BOOT_MESSAGE "May the flow be with you..."
 #define PAGE_TITLE "DIY Flow Bench"
-#define FILESYSTEM SPIFFS
 #define PRINT_BUFFER_LENGTH 128
 #define iSHOW_ALARMS true
 #define MIN_iREFRESH_RATE 250
@@ -51,7 +53,12 @@ using namespace std;
 
 #define API_STATUS_LENGTH 128
 // #define API_JSON_LENGTH 1024
-#define API_SCAN_DELAY_MS 250
+#define API_SERIAL_RX_BUFFER 1024         // UART receive buffer (room for pipelined framed requests)
+#define API_REQUEST_LENGTH 256            // Longest framed request line
+#define API_FRAME_LENGTH 3072             // Longest framed response line (after escaping, fits the HELP listing)
+#define API_FRAME_ID_LENGTH 10            // Longest framed request id
+#define API_CYCLE_WAIT_MS 50              // Re-check interval while a command waits for the sensor cycle
+#define API_FRAME_START_MS 20             // A '#' followed by nothing for this long is the legacy DEV_MODE command
 #define API_DELIMITER ":"
 #define API_SERIAL_BAUD 115200
 
@@ -59,6 +66,12 @@ using namespace std;
 #define SENSOR_TASK_MEM_STACK 4200 
 #define ENVIRO_TASK_MEM_STACK 2200 
 #define LOOP_TASK_STACK_SIZE 12288
+#define OTA_TASK_MEM_STACK 3072
+#define RECORDER_TASK_MEM_STACK 4096
+#define PERSIST_TASK_MEM_STACK 3072
+#define LOG_TASK_MEM_STACK 3072
+#define MODBUS_TASK_MEM_STACK 3072
+#define API_TASK_MEM_STACK 6144           // Command handlers only build the objects they use (see API.cpp registry)
 
 // MAF Data Filters
 #define ALPHA_MEDIAN 0.75f
@@ -75,13 +88,141 @@ using namespace std;
 // Poll timers
 #define SSE_UPDATE_RATE 400
 
+// SSE client backpressure
+#define SSE_MAX_CLIENTS 8                 // Maximum tracked SSE subscribers (all topics)
+#define SSE_CLIENT_MAX_QUEUED 2           // Frames allowed in a client queue before frames are dropped
+#define SSE_CLIENT_MAX_RATE_DIVIDER 8     // Slowest client update rate = SSE_UPDATE_RATE * divider
+
+
+// Metrics
+#define METRICS_BUFFER_SIZE 10240         // Preallocated /metrics exposition buffer
+#define METRICS_MAX_ENDPOINTS 16          // Tracked HTTP endpoints for request latency
+
+
+// Trace recorder
+#define TRACE_RING_SIZE 512               // Records per core (power of 2, 8 bytes per record)
+#define TRACE_ANCHOR_INTERVAL 64          // Records between cycle count / timer anchors (power of 2)
+
+
+// Session recorder
+#define RECORDER_RING_SAMPLES 256         // RAM ring between sensor task and log writer (power of 2, 36 bytes per sample)
+#define RECORDER_CHUNK_SIZE 4096          // Log chunk written per flash write (flash sector)
+#define RECORDER_FLUSH_TIMEOUT_MS 1000    // Writer wake up interval if not notified
+#define RECORDER_PARTIAL_FLUSH_MS 3000    // Longest a sample waits in RAM before a partial chunk is written
+#define RECORDER_MAX_SESSIONS 999         // session_001.dfbl ... session_999.dfbl
+#define RECORDER_SD_PREALLOCATE 16777216  // Clusters reserved for a session log on SD (file grows past this if needed)
+#define EXPORT_BUFFER_SIZE 4096           // Session export staging buffer (per download)
+#define EXPORT_LINE_LENGTH 256            // Longest CSV / NDJSON line
+
+
+// Trend history (/api/timeseries)
+#define TIMESERIES_RAW_SAMPLES 256        // Full rate samples (power of 2, 36 bytes per sample)
+#define TIMESERIES_1S_BUCKETS 60          // 1 minute of 1 second rollups (104 bytes per bucket)
+#define TIMESERIES_10S_BUCKETS 60         // 10 minutes of 10 second rollups
+#define TIMESERIES_1M_BUCKETS 60          // 1 hour of 1 minute rollups
+#define TIMESERIES_LINE_LENGTH 384        // Longest JSON row (timestamp + 8 channels x min / max / mean)
+
+
+// Log pipeline (Messages::xxxPrintf)
+#define LOG_RING_SIZE 64                  // Queued messages (power of 2, LOG_RECORD_SIZE bytes each)
+#define LOG_RECORD_SIZE 128               // Format pointer, header and up to 112 bytes of arguments
+#define LOG_LINE_LENGTH 256               // Longest formatted line
+#define LOG_DRAIN_INTERVAL_MS 20          // Drain task wake up interval if not notified
+#define LOG_FLUSH_TIMEOUT_MS 500          // Longest wait for queued messages before a restart
+#define LOG_TAIL_LINES 16                 // Lines kept for /events/log
+#define LOG_TAIL_LENGTH 128               // Longest line kept for /events/log
+
+
+// Bench state (hysteresis on settings.min_flow_rate / settings.min_bench_pressure)
+#define BENCH_OFF_THRESHOLD_PCT 80        // Drop below this % of the start threshold to stop
+#define BENCH_SPOOL_TIME_MS 250           // Time above the start threshold before the bench is running
+#define BENCH_STOP_TIME_MS 500            // Time below the stop threshold before the bench is idle
+#define BENCH_STABLE_ALPHA 0.1f           // Flow average used for the stable band
+#define BENCH_STABLE_BAND_PCT 2           // Flow within this % of its average counts as stable
+#define BENCH_STABLE_TIME_MS 1000         // Time inside the band before the bench is stable
+
+
+// Steady state detector (lift point auto capture)
+#define STEADY_WINDOW_MS 3000             // Sliding window length, about 6 samples at the 2 Hz sensor rate
+#define STEADY_MIN_SAMPLES 5              // Fewest samples in the window before it can be steady
+#define STEADY_WINDOW_SAMPLES 64          // Most samples held (power of 2, 12 bytes per sample)
+#define STEADY_CI_Z 1.96f                 // 95% confidence interval
+
+
+// Sample history (windowed capture / calibration)
+#define HISTORY_SAMPLES 256               // Full rate samples (power of 2, 40 bytes per sample)
+#define HISTORY_CAL_WINDOW_MS 3000        // Averaging window for flow / leak / pDiff / pitot calibration (~7 samples at 2 Hz)
+#define HISTORY_LIFT_WINDOW_MS 2000       // Averaging window for a manual lift point capture (~5 samples at 2 Hz)
+#define HISTORY_MIN_SAMPLES 4             // Fewest samples a window must hold to be complete
+
+
+// Modbus server
+#define MODBUS_TCP_PORT 502
+#define MODBUS_TCP_MAX_CLIENTS 4
+#define MODBUS_UNIT_ID 1                  // RTU slave address (TCP answers any unit id)
+#define MODBUS_RTU_BAUD 19200
+#define MODBUS_RTU_RX_TIMEOUT 4           // Inter frame gap in UART symbols (spec is 3.5 characters)
+
+
+// Gzip encoder (session export)
+#define GZIP_WINDOW_SIZE 4096             // LZ77 history (6 bytes RAM per byte of window + hash table)
+#define GZIP_HASH_BITS 11
+#define GZIP_MAX_PROBES 16                // Hash chain positions tried per match
+
+
+// SD card
+#define SD_SPI_FREQUENCY 20000000         // SD SPI clock (library default is 4MHz)
+#ifndef SD_MOUNT_POINT
+#define SD_MOUNT_POINT "/sd"              // VFS path (the native build mounts a host directory)
+#endif
+#define SD_MAX_OPEN_FILES 4
+
+
+// Storage
+#define STORAGE_MAX_FILES 64                  // In-RAM file index size
+#define STORAGE_PATH_LENGTH 48
+#define STORAGE_MIGRATION_HEAP_RESERVE 32768  // Heap left free while copying SPIFFS files to LittleFS
+
+
+// OTA update
+#define OTA_BUFFER_SIZE 4096      // Flash sector sized staging buffers (x2)
+
 
 // JSON memory allocation
 #define DATA_JSON_SIZE 768
 #define LANGUAGE_JSON_SIZE 8192 // TODO Need to test language override (mem size could be an issue)
 #define CAL_DATA_JSON_SIZE 348
 #define LIFT_DATA_JSON_SIZE 384
-#define JSON_FILE_SIZE 6000 // 2800
+
+// Lift profiles
+#define LIFT_PROFILE_MAX_RUNS 4           // Stored runs (one NVS blob each)
+#define LIFT_PROFILE_MAX_POINTS 24        // Maximum lift points per run
+#define LIFT_PROFILE_DEFAULT_POINTS 12
+#define LIFT_PROFILE_NAME_LENGTH 16
+#define LIFT_PROFILE_BLOB_VERSION 1
+#define LIFT_PROFILE_BLOB_HEADER (4 + LIFT_PROFILE_NAME_LENGTH)
+#define LIFT_PROFILE_BLOB_SIZE (LIFT_PROFILE_BLOB_HEADER + LIFT_PROFILE_MAX_POINTS * 4)
+
+// Config / settings / calibration / pins blobs
+#define BLOB_STORE_MAX_SIZE 2048          // Largest encoded blob (settings with long WiFi strings)
+#define CONFIG_SCHEMA_VERSION 1           // Bump when fields are added / removed / retyped
+#define SETTINGS_SCHEMA_VERSION 1
+#define CALIBRATION_SCHEMA_VERSION 1
+#define PINS_SCHEMA_VERSION 1
+
+// Deferred persistence
+#define PERSIST_DEBOUNCE_MS 750           // Write once a record has been left alone this long
+#define PERSIST_MAX_DEFER_MS 5000         // Write regardless once a record has been dirty this long
+
+// JSON files
+#define JSON_FILE_SIZE 6000               // Largest file loadJSONFile() will parse without a filter
+#define JSON_STREAM_BUFFER_SIZE 256       // File read buffer for streamed JSON
+#define JSON_STREAM_KEY_LENGTH 32         // Longest member key passed to a JsonStream callback
+#define JSON_STREAM_VALUE_LENGTH 256      // Longest single member / element JsonStream will parse
+
+// User MAF data table
+#define MAF_DATA_FILE "/mafData.json"
+#define MAF_TABLE_MAX_ROWS 512            // 6 bytes RAM per row once loaded
 
 /***********************************************************
 * WEBUI SETTINGS
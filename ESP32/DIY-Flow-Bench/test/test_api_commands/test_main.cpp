@@ -0,0 +1,392 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file test_main.cpp
+ *
+ * @brief Host tests for the serial API command registry
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * Every single character command is run through ParseMessage() against fixed sensor and status
+ * values, and its response checked. The '?' listing is read back to make sure no registered command
+ * is missed here.
+ *
+ *   pio test -e native -f test_api_commands
+ *
+ ***/
+#include <gtest/gtest.h>
+#include <set>
+#include <stdlib.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <FS.h>
+
+#include "constants.h"
+#include "system.h"
+#include "structs.h"
+
+#include "API.h"
+#include "calculations.h"
+#include "storage.h"
+
+
+#define VAC_BANK_PIN 26
+
+
+extern struct BenchSettings settings;
+extern struct DeviceStatus status;
+extern struct SensorData sensorVal;
+extern struct Pins pins;
+
+static const std::string version = std::string(MAJOR_VERSION) + "." + MINOR_VERSION + "." + BUILD_NUMBER;
+
+
+// Collects handler output so ParseMessage() can be run without the serial task
+class CapturePrint : public Print {
+
+  public:
+
+    std::string text;
+
+    size_t write(uint8_t value) override {
+      text += (char)value;
+      return 1;
+    }
+
+};
+
+
+class APICommandsEnvironment : public ::testing::Environment {
+
+  public:
+
+    void SetUp() override {
+      char directory[] = "/tmp/diyfb_test_XXXXXX";
+      ASSERT_NE(mkdtemp(directory), (char *)NULL);
+      ASSERT_EQ(chdir(directory), 0);
+      HAL::serialCapture(true);
+      ASSERT_EQ(mkdir("native_fs", 0755), 0);
+      ASSERT_EQ(mkdir("native_fs/littlefs", 0755), 0);
+      ASSERT_TRUE(Storage::begin());
+
+      File file = Storage::fs().open("/settings.json", FILE_WRITE);
+      file.print("{\"hostname\":\"diyfb\"}");
+      file.close();
+      Storage::indexFile("/settings.json");
+
+      pins.VAC_BANK_1 = VAC_BANK_PIN;
+
+      sensorVal.VCC_3V3_BUS = 3.28;
+      sensorVal.VCC_5V_BUS = 5.02;
+      sensorVal.FlowCFM = 142.5;
+      sensorVal.PRefKPA = -6.9;
+      sensorVal.PDiffKPA = -1.25;
+      sensorVal.PitotKPA = 0.25;
+      sensorVal.Swirl = 3.5;
+      sensorVal.TempDegC = 21.5;
+      sensorVal.RelH = 45.0;
+      sensorVal.BaroKPA = 101.325;
+      sensorVal.BaroHPA = 1013.25;
+      sensorVal.MafLookup = 1234;
+
+      status.local_ip_address = "192.168.1.50";
+      status.activeOrifice = "2";
+      status.activeOrificeFlowRate = 100.0;
+      status.boot_time = millis();
+    }
+
+};
+
+
+static std::string runRaw(char command) {
+
+  API _api;
+  CapturePrint capture;
+
+  _api.ParseMessage(command, capture);
+  return capture.text;
+
+}
+
+
+static std::string run(char command, std::string *output = NULL) {
+
+  // The response is the last line, anything printed by the handler comes before it
+  std::string text = runRaw(command);
+  size_t lineStart = text.rfind('\n', text.size() - 2);
+  lineStart = (lineStart == std::string::npos) ? 0 : lineStart + 1;
+  if (output != NULL) *output = text.substr(0, lineStart);
+  return text.substr(lineStart, text.size() - lineStart - 1);
+
+}
+
+
+static std::string format(const char *pattern, double value) {
+
+  char text[64];
+  snprintf(text, sizeof(text), pattern, value);
+  return text;
+
+}
+
+
+static int fieldCount(const std::string &response) {
+
+  return std::count(response.begin(), response.end(), ':') + 1;
+
+}
+
+
+// Single character commands listed by '?' in the current mode
+static std::set<char> listedCommands() {
+
+  std::string output;
+  run('?', &output);
+
+  std::set<char> commands;
+  size_t start = 0;
+  size_t end;
+  while ((end = output.find('\n', start)) != std::string::npos) {
+    std::string line = output.substr(start, end - start);
+    if (line.size() > 21 && line.compare(0, 2, "  ") == 0 && line.compare(3, 2, "  ") == 0 && line[20] == ':' && line[2] != ' ') commands.insert(line[2]);
+    start = end + 1;
+  }
+  return commands;
+
+}
+
+
+// Commands covered below, in registry order
+static const std::string testedCommands = "0135AaBCDEeFfGHIJjklNOoPRSTtUuVWXx?</~$!+=#^&%\\";
+
+
+
+
+TEST(APICommands, EveryListedCommandIsCovered) {
+
+  std::set<char> listed = listedCommands();
+  EXPECT_GT(listed.size(), 40u);
+
+  settings.function_mode = true;
+  std::set<char> function = listedCommands();
+  settings.function_mode = false;
+  EXPECT_EQ(function.count('&'), 1u);
+  EXPECT_EQ(function.count('%'), 1u);
+  listed.insert(function.begin(), function.end());
+
+  for (char command : listed) {
+    EXPECT_NE(testedCommands.find(command), std::string::npos) << "'" << command << "' has no test";
+  }
+
+}
+
+TEST(APICommands, UnknownCharactersAreInvalid) {
+
+  for (int command = 1; command < 128; command++) {
+    if (testedCommands.find((char)command) != std::string::npos) continue;
+    EXPECT_EQ(run((char)command), "Invalid Response") << "'" << (char)command << "'";
+  }
+
+}
+
+TEST(APICommands, BenchControl) {
+
+  EXPECT_EQ(run('1'), "1:Bench On");
+  EXPECT_EQ(HAL::pinLevel(VAC_BANK_PIN), HIGH);
+
+  EXPECT_EQ(run('0'), "0:Bench Off");
+  EXPECT_EQ(HAL::pinLevel(VAC_BANK_PIN), LOW);
+
+}
+
+TEST(APICommands, SensorValues) {
+
+  Calculations _calculations;
+
+  EXPECT_EQ(run('3'), "3:3.280000");
+  EXPECT_EQ(run('5'), "5:5.020000");
+  EXPECT_EQ(run('B'), "B:1013.250000");
+  EXPECT_EQ(run('F'), "F:142.500000");
+  EXPECT_EQ(run('H'), "H:45.000000");
+  EXPECT_EQ(run('T'), "T:21.500000");
+  EXPECT_EQ(run('e'), "e:0.250000:3.500000");
+  EXPECT_EQ(run('k'), "k: MAF DATA Lookup value: 1234 ");
+  EXPECT_EQ(run('O'), "O:100.000000");
+  EXPECT_EQ(run('o'), "o:2");
+
+  EXPECT_EQ(run('D'), format("D:%f", _calculations.convertPressure(-1.25, INH2O)));
+  EXPECT_EQ(run('P'), format("P:%f", _calculations.convertPressure(0.25, INH2O)));
+  EXPECT_EQ(run('R'), format("R:%f", _calculations.convertPressure(-6.9, INH2O)));
+  EXPECT_EQ(run('t'), format("t:%f", _calculations.convertTemperature(21.5, DEGF)));
+  EXPECT_NEAR(atof(run('t').c_str() + 2), 70.7, 1e-3);
+
+  std::string enum1 = run('E');
+  EXPECT_EQ(enum1.compare(0, 13, "E:142.500000:"), 0) << enum1;
+  EXPECT_EQ(fieldCount(enum1), 6);
+  EXPECT_EQ(enum1.substr(enum1.rfind(':')), ":101.325000");
+
+  std::string mass = run('f');
+  EXPECT_EQ(mass.compare(0, 2, "f:"), 0);
+  EXPECT_EQ(fieldCount(mass), 2);
+
+  EXPECT_EQ(run('A').compare(0, 2, "A:"), 0);
+  EXPECT_EQ(fieldCount(run('A')), 5);
+  EXPECT_EQ(run('a').compare(0, 2, "a:"), 0);
+  EXPECT_EQ(fieldCount(run('a')), 5);
+
+  std::string coefficients = run('C');
+  EXPECT_EQ(coefficients.compare(0, 2, "C:"), 0);
+  EXPECT_EQ(std::count(coefficients.begin(), coefficients.end(), ','), 5);
+
+}
+
+TEST(APICommands, DeviceInformation) {
+
+  EXPECT_EQ(run('V'), "V:" + version);
+  EXPECT_EQ(run('I'), "I:192.168.1.50");
+  EXPECT_EQ(run('N'), "N:" + std::string(settings.hostname.c_str()));
+  EXPECT_EQ(run('W'), "W:" + std::string(settings.wifi_ssid.c_str()));
+  EXPECT_EQ(run('u'), "u:0");
+  EXPECT_EQ(run('U').compare(0, 2, "U:"), 0);
+  EXPECT_EQ(run('<'), "No error in buffer");
+  EXPECT_EQ(run('X').compare(0, 21, "X:Stack Free Memory E"), 0);
+  EXPECT_EQ(runRaw('x').compare(0, 11, "EnviroTask="), 0);
+  EXPECT_NE(runRaw('x').find("\nAPITask="), std::string::npos);
+
+  status.apMode = true;
+  EXPECT_EQ(run('W'), "W:" + std::string(settings.wifi_ap_ssid.c_str()));
+  status.apMode = false;
+
+}
+
+TEST(APICommands, LongOutputIsPrintedBeforeTheResponse) {
+
+  std::string output;
+
+  EXPECT_EQ(run('S', &output), " ");
+  EXPECT_NE(output.find("local_ip_address = 192.168.1.50\n"), std::string::npos);
+  EXPECT_NE(output.find("activeOrifice =  2\n"), std::string::npos);
+
+  EXPECT_EQ(run('/', &output), " ");
+  EXPECT_NE(output.find("\nsettings.json  "), std::string::npos) << output;
+
+  EXPECT_EQ(run('?', &output), " ");
+  EXPECT_NE(output.find("DIYFB API Commands"), std::string::npos);
+  EXPECT_NE(output.find("  F  FLOW           : Flow Value in CFM\n"), std::string::npos);
+  EXPECT_NE(output.find("     PING           : Echo arguments\n"), std::string::npos);
+
+  // JSON dumps parse, the response follows on the same line
+  const char jsonCommands[] = {'G', 'J', 'j', 'l'};
+  for (char command : jsonCommands) {
+    JsonDocument document;
+    output = runRaw(command);
+    ASSERT_GT(output.size(), 2u);
+    EXPECT_EQ(output.substr(output.size() - 3), "} \n");
+    EXPECT_FALSE(deserializeJson(document, output.substr(0, output.size() - 2).c_str())) << "'" << command << "' " << output;
+  }
+
+}
+
+TEST(APICommands, ModeTogglesFlipAndReport) {
+
+  struct {
+    char command;
+    bool *flag;
+    const char *name;
+  } toggles[] = {
+    {'!', &settings.debug_mode, "!:Debug Mode "},
+    {'+', &settings.verbose_print_mode, "!:Verbose Print Mode "},
+    {'=', &settings.status_print_mode, "!:Status Print Mode "},
+    {'#', &settings.dev_mode, "#:Developer Mode "},
+    {'^', &settings.function_mode, "#:Function Mode "}
+  };
+
+  for (auto &toggle : toggles) {
+    bool initial = *toggle.flag;
+    EXPECT_EQ(run(toggle.command), std::string(toggle.name) + (initial ? "Off" : "On"));
+    EXPECT_NE(*toggle.flag, initial);
+    EXPECT_EQ(run(toggle.command), std::string(toggle.name) + (initial ? "On" : "Off"));
+    EXPECT_EQ(*toggle.flag, initial);
+  }
+
+  char initial = settings.AB_test;
+  settings.AB_test = 'A';
+  EXPECT_EQ(run('\\'), "#:A/B test B");
+  EXPECT_EQ(run('\\'), "#:A/B test C");
+  EXPECT_EQ(run('\\'), "#:A/B test A");
+  settings.AB_test = initial;
+
+}
+
+TEST(APICommands, FunctionModeCommandsNeedFunctionMode) {
+
+  settings.wifi_ap_ssid = "CHANGED";
+
+  EXPECT_EQ(run('%'), "Invalid Response");
+  EXPECT_EQ(run('&'), "Invalid Response");
+  EXPECT_STREQ(settings.wifi_ap_ssid.c_str(), "CHANGED");
+
+  settings.function_mode = true;
+  EXPECT_EQ(run('%'), "Attempting to reset WiFi passwords");
+  EXPECT_STREQ(settings.wifi_ap_ssid.c_str(), "DIYFB");
+  EXPECT_FALSE(settings.function_mode);
+
+  settings.function_mode = true;
+  EXPECT_EQ(run('&'), "#:Pins Reset");
+  EXPECT_FALSE(settings.function_mode);
+
+  pins.VAC_BANK_1 = VAC_BANK_PIN;
+
+}
+
+TEST(APICommands, BootLoopOnlyAllowsBootCommands) {
+
+  status.doBootLoop = true;
+
+  std::set<char> listed = listedCommands();
+  EXPECT_EQ(run('F'), "Invalid Response");
+  EXPECT_EQ(run('V'), "V:" + version);
+  EXPECT_EQ(run('I'), "I:192.168.1.50");
+
+  status.doBootLoop = false;
+
+  EXPECT_EQ(listed.count('F'), 0u);
+  EXPECT_EQ(listed.count('V'), 1u);
+  EXPECT_EQ(listed.count('~'), 1u);
+
+}
+
+TEST(APICommands, WiFiRecoveryAndRestart) {
+
+  std::string output;
+  EXPECT_EQ(run('$', &output), "$:WiFi reconnect done");
+  EXPECT_EQ(output, "Attempting to recover WiFi Connection\n");
+
+  ::testing::FLAGS_gtest_death_test_style = "threadsafe";
+  EXPECT_EXIT(run('~'), ::testing::ExitedWithCode(0), "");
+
+}
+
+
+
+
+int main(int argc, char **argv) {
+
+  ::testing::InitGoogleTest(&argc, argv);
+  ::testing::AddGlobalTestEnvironment(new APICommandsEnvironment());
+
+  return RUN_ALL_TESTS();
+
+}
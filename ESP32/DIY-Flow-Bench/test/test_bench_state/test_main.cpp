@@ -0,0 +1,310 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file test_main.cpp
+ *
+ * @brief Host tests for the bench state machine
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * Flow and reference pressure traces shaped like a bench run (first order spool up with motor noise,
+ * a hold, then run down) are fed through BenchState::update() at the acquisition rate. Checks the
+ * order and timing of the transitions, the hysteresis around the start / stop thresholds, the pRef
+ * gate and that status messages are only raised on a transition.
+ *
+ *   pio test -e native -f test_bench_state
+ *
+ ***/
+#include <gtest/gtest.h>
+#include <cmath>
+#include <functional>
+#include <vector>
+
+#include <Arduino.h>
+
+#include "constants.h"
+#include "system.h"
+#include "structs.h"
+
+#include "benchstate.h"
+
+
+#define SAMPLE_MS 10
+#define START_FLOW 5.0          // settings.min_flow_rate
+#define START_PREF 2.0          // settings.min_bench_pressure
+#define RUN_FLOW 180.0
+#define RUN_PREF 28.0
+#define SPOOL_TAU_MS 400.0
+
+
+extern struct BenchSettings settings;
+extern struct Configuration config;
+extern struct DeviceStatus status;
+
+
+struct Transition {
+  uint32_t time;
+  uint8_t state;
+};
+
+typedef std::function<double(uint32_t)> Trace;  // value at ms since the start of the trace
+
+
+class BenchStateTest : public ::testing::Test {
+
+  protected:
+
+    static uint32_t now;
+    uint32_t transitionsBefore;
+    std::vector<Transition> seen;
+
+    void SetUp() override {
+      settings.min_flow_rate = START_FLOW;
+      settings.min_bench_pressure = START_PREF;
+      config.iPREF_SENS_TYP = MPXV7007;
+      now += 10000;
+      ASSERT_EQ(BenchState::state(), BENCH_STATE_IDLE);
+      transitionsBefore = BenchState::transitions();
+    }
+
+    void TearDown() override {
+      // Leave the bench idle for the next test
+      play([](uint32_t) { return 0.0; }, [](uint32_t) { return 0.0; }, BENCH_STOP_TIME_MS + 100);
+    }
+
+    // Feed flow / pRef traces for a duration, recording each change of state as a consumer would see it
+    void play(const Trace &flow, const Trace &pRef, uint32_t durationMs) {
+      uint8_t last = BenchState::state();
+      for (uint32_t t = 0; t < durationMs; t += SAMPLE_MS) {
+        now += SAMPLE_MS;
+        BenchState::update(flow(t), -pRef(t), now);
+        if (BenchState::state() != last) {
+          last = BenchState::state();
+          seen.push_back({now, last});
+        }
+      }
+    }
+
+    std::vector<uint8_t> states() {
+      std::vector<uint8_t> list;
+      for (const Transition &transition : seen) list.push_back(transition.state);
+      return list;
+    }
+
+};
+
+uint32_t BenchStateTest::now = 0;
+
+
+// Repeatable motor / turbulence noise, +-amplitude as a fraction of the value
+static double noise(uint32_t t, double amplitude) {
+
+  uint32_t x = t * 2654435761u;
+  x ^= x >> 15;
+  return amplitude * (((x & 0xFFFF) / 32767.5) - 1.0);
+
+}
+
+static Trace spoolUp(double target, double noiseFraction) {
+
+  return [=](uint32_t t) { return target * (1.0 - exp(-(double)t / SPOOL_TAU_MS)) * (1.0 + noise(t, noiseFraction)); };
+
+}
+
+static Trace runDown(double from) {
+
+  return [=](uint32_t t) { return from * exp(-(double)t / SPOOL_TAU_MS); };
+
+}
+
+static Trace constant(double value) {
+
+  return [=](uint32_t) { return value; };
+
+}
+
+
+
+
+TEST_F(BenchStateTest, FullRunPassesThroughEveryState) {
+
+  play(spoolUp(RUN_FLOW, 0.004), spoolUp(RUN_PREF, 0.004), 4000);
+  play(runDown(RUN_FLOW), runDown(RUN_PREF), 3000);
+
+  // The run down leaves the stable band before it drops below the stop threshold
+  std::vector<uint8_t> expected = {BENCH_STATE_SPOOLING, BENCH_STATE_RUNNING, BENCH_STATE_STABLE, BENCH_STATE_RUNNING, BENCH_STATE_STOPPING, BENCH_STATE_IDLE};
+  ASSERT_EQ(states(), expected);
+  EXPECT_EQ(BenchState::transitions() - transitionsBefore, expected.size());
+
+  EXPECT_EQ(seen[1].time - seen[0].time, (uint32_t)BENCH_SPOOL_TIME_MS);
+  EXPECT_GE(seen[2].time - seen[1].time, (uint32_t)BENCH_STABLE_TIME_MS);
+  EXPECT_LT(seen[2].time, now - 3000);
+  EXPECT_GE(seen[3].time, now - 3000);
+  EXPECT_EQ(seen[5].time - seen[4].time, (uint32_t)BENCH_STOP_TIME_MS);
+
+  // Spooling starts at the first sample with both flow and pRef above the start threshold
+  Trace flow = spoolUp(RUN_FLOW, 0.004);
+  Trace pRef = spoolUp(RUN_PREF, 0.004);
+  uint32_t start = seen[0].time - (now - 7000) - SAMPLE_MS;
+  EXPECT_TRUE(flow(start) > START_FLOW && pRef(start) > START_PREF);
+  EXPECT_FALSE(flow(start - SAMPLE_MS) > START_FLOW && pRef(start - SAMPLE_MS) > START_PREF);
+
+}
+
+TEST_F(BenchStateTest, ConsumersSeeTheCurrentState) {
+
+  EXPECT_FALSE(BenchState::isRunning());
+  EXPECT_STREQ(BenchState::stateName(BenchState::state()), "IDLE");
+
+  play(constant(RUN_FLOW), constant(RUN_PREF), BENCH_SPOOL_TIME_MS / 2);
+  EXPECT_EQ(BenchState::state(), BENCH_STATE_SPOOLING);
+  EXPECT_FALSE(BenchState::isRunning());
+
+  play(constant(RUN_FLOW), constant(RUN_PREF), BENCH_SPOOL_TIME_MS);
+  EXPECT_EQ(BenchState::state(), BENCH_STATE_RUNNING);
+  EXPECT_TRUE(BenchState::isRunning());
+  EXPECT_EQ(BenchState::stateTime(now), now - seen.back().time);
+
+  play(constant(RUN_FLOW), constant(RUN_PREF), BENCH_STABLE_TIME_MS + 100);
+  EXPECT_EQ(BenchState::state(), BENCH_STATE_STABLE);
+  EXPECT_TRUE(BenchState::isRunning());
+  EXPECT_STREQ(BenchState::stateName(BENCH_STATE_STABLE), "STABLE");
+  EXPECT_STREQ(BenchState::stateName(BENCH_STATE_COUNT), "UNKNOWN");
+
+  play(constant(0.0), constant(0.0), SAMPLE_MS);
+  EXPECT_EQ(BenchState::state(), BENCH_STATE_STOPPING);
+  EXPECT_FALSE(BenchState::isRunning());
+
+}
+
+TEST_F(BenchStateTest, FlowChatterAtTheThresholdDoesNotToggle) {
+
+  // +-10% around the start flow sits above the stop threshold, so one start and no stop
+  play([](uint32_t t) { return START_FLOW * ((t / SAMPLE_MS) % 2 ? 1.1 : 0.9); }, constant(RUN_PREF), 3000);
+
+  ASSERT_GE(seen.size(), 2u);
+  EXPECT_EQ(seen[0].state, BENCH_STATE_SPOOLING);
+  EXPECT_EQ(seen[1].state, BENCH_STATE_RUNNING);
+  for (const Transition &transition : seen) {
+    EXPECT_NE(transition.state, BENCH_STATE_STOPPING);
+    EXPECT_NE(transition.state, BENCH_STATE_IDLE);
+  }
+
+  // Between the thresholds a running bench stays running
+  play(constant(START_FLOW * 0.85), constant(RUN_PREF), 2000);
+  EXPECT_TRUE(BenchState::isRunning());
+
+}
+
+TEST_F(BenchStateTest, ShortDropoutsRecoverWithoutStopping) {
+
+  play(constant(RUN_FLOW), constant(RUN_PREF), 2000);
+  ASSERT_TRUE(BenchState::isRunning());
+
+  status.statusMessage = "marker";
+  seen.clear();
+
+  // A valve snapping shut for less than the stop time
+  for (int dropout = 0; dropout < 5; dropout++) {
+    play(constant(0.5), constant(RUN_PREF), BENCH_STOP_TIME_MS - 100);
+    play(constant(RUN_FLOW), constant(RUN_PREF), 300);
+  }
+
+  for (const Transition &transition : seen) EXPECT_NE(transition.state, BENCH_STATE_IDLE);
+  EXPECT_TRUE(BenchState::isRunning());
+  EXPECT_STREQ(status.statusMessage.c_str(), "marker");
+
+}
+
+TEST_F(BenchStateTest, SpoolingNeedsToBeHeld) {
+
+  // Blips above the start threshold shorter than the spool time never reach running
+  for (int blip = 0; blip < 10; blip++) {
+    play(constant(RUN_FLOW), constant(RUN_PREF), BENCH_SPOOL_TIME_MS - 2 * SAMPLE_MS);
+    play(constant(0.0), constant(0.0), 200);
+  }
+
+  for (const Transition &transition : seen) {
+    EXPECT_TRUE(transition.state == BENCH_STATE_SPOOLING || transition.state == BENCH_STATE_IDLE) << BenchState::stateName(transition.state);
+  }
+  EXPECT_EQ(seen.size(), 20u);
+  EXPECT_FALSE(BenchState::isRunning());
+
+}
+
+TEST_F(BenchStateTest, ReferencePressureGatesTheStart) {
+
+  // Flow with no depression - a sensor fault or the bench motor off with a fan blowing through
+  play(constant(RUN_FLOW), constant(START_PREF * 0.5), 2000);
+  EXPECT_TRUE(seen.empty());
+
+  // Losing depression while running stops the bench even with flow
+  play(constant(RUN_FLOW), constant(RUN_PREF), 1000);
+  ASSERT_TRUE(BenchState::isRunning());
+  play(constant(RUN_FLOW), constant(START_PREF * 0.5), BENCH_STOP_TIME_MS + SAMPLE_MS);
+  EXPECT_EQ(BenchState::state(), BENCH_STATE_IDLE);
+
+  // With no pRef sensor fitted only the flow counts
+  config.iPREF_SENS_TYP = SENSOR_DISABLED;
+  seen.clear();
+  play(constant(RUN_FLOW), constant(0.0), 1000);
+  EXPECT_TRUE(BenchState::isRunning());
+  play(constant(0.0), constant(0.0), BENCH_STOP_TIME_MS + 100);
+  config.iPREF_SENS_TYP = MPXV7007;
+
+}
+
+TEST_F(BenchStateTest, StableBandHasHysteresis) {
+
+  play(constant(RUN_FLOW), constant(RUN_PREF), 2000);
+  ASSERT_EQ(BenchState::state(), BENCH_STATE_STABLE);
+  seen.clear();
+
+  // Noise inside the band keeps it stable
+  play([](uint32_t t) { return RUN_FLOW * (1.0 + noise(t, BENCH_STABLE_BAND_PCT / 100.0 * 0.9)); }, constant(RUN_PREF), 3000);
+  EXPECT_TRUE(seen.empty());
+
+  // A step change in flow (a valve opened) drops back to running, then settles at the new flow
+  play(constant(RUN_FLOW * 1.3), constant(RUN_PREF), 3000);
+  std::vector<uint8_t> expected = {BENCH_STATE_RUNNING, BENCH_STATE_STABLE};
+  EXPECT_EQ(states(), expected);
+
+}
+
+TEST_F(BenchStateTest, MessagesOnlyOnTransitions) {
+
+  extern struct Language language;
+
+  play(constant(RUN_FLOW), constant(RUN_PREF), BENCH_SPOOL_TIME_MS + SAMPLE_MS);
+  ASSERT_TRUE(BenchState::isRunning());
+  EXPECT_STREQ(status.statusMessage.c_str(), language.LANG_BENCH_RUNNING);
+
+  // Nothing is assigned while the state holds, including stable <-> running
+  status.statusMessage = "marker";
+  play(constant(RUN_FLOW), constant(RUN_PREF), 2000);
+  play(constant(RUN_FLOW * 1.3), constant(RUN_PREF), 500);
+  EXPECT_STREQ(status.statusMessage.c_str(), "marker");
+
+  play(constant(0.0), constant(0.0), BENCH_STOP_TIME_MS + SAMPLE_MS);
+  EXPECT_STREQ(status.statusMessage.c_str(), language.LANG_BENCH_STOPPED);
+
+}
+
+
+
+
+int main(int argc, char **argv) {
+
+  ::testing::InitGoogleTest(&argc, argv);
+
+  return RUN_ALL_TESTS();
+
+}
@@ -0,0 +1,373 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file test_main.cpp
+ *
+ * @brief Host tests for the single key NVS blob store
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * Structs saved and loaded through the (in-memory) NVS, hand built blobs from other schema versions,
+ * corrupt blobs, and the original one key per field layout migrated into a blob.
+ *
+ *   pio test -e native -f test_blob_store
+ *
+ ***/
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include <esp32/rom/crc.h>
+
+#include "constants.h"
+#include "system.h"
+#include "structs.h"
+
+#include "blobstore.h"
+
+
+extern struct Configuration config;
+extern struct BenchSettings settings;
+extern struct CalibrationData calVal;
+extern struct Pins pins;
+
+
+// Builds a blob record by record, the way an older or newer firmware would have written it
+class BlobBuilder {
+
+  private:
+
+    std::vector<uint8_t> payload;
+    uint16_t records = 0;
+
+    void add(const char *key, uint8_t type, const void *value, uint8_t length) {
+      payload.push_back(strlen(key));
+      payload.insert(payload.end(), key, key + strlen(key));
+      payload.push_back(type);
+      payload.push_back(length);
+      payload.insert(payload.end(), (const uint8_t *)value, (const uint8_t *)value + length);
+      records++;
+    }
+
+  public:
+
+    void addInt(const char *key, int32_t value) { add(key, BLOB_FIELD_INT, &value, 4); }
+    void addDouble(const char *key, double value) { add(key, BLOB_FIELD_DOUBLE, &value, 8); }
+    void addBool(const char *key, bool value) { uint8_t flag = value; add(key, BLOB_FIELD_BOOL, &flag, 1); }
+    void addString(const char *key, const char *value) { add(key, BLOB_FIELD_STRING, value, strlen(value)); }
+
+    std::vector<uint8_t> build(uint16_t schemaVersion) {
+      BlobHeader header;
+      header.magic = BLOB_STORE_MAGIC;
+      header.schemaVersion = schemaVersion;
+      header.fieldCount = records;
+      header.payloadLength = payload.size();
+      header.crc = crc32_le(0, payload.data(), payload.size());
+      std::vector<uint8_t> blob((const uint8_t *)&header, (const uint8_t *)&header + sizeof(header));
+      blob.insert(blob.end(), payload.begin(), payload.end());
+      return blob;
+    }
+
+};
+
+
+static void putBlob(const char *nameSpace, const std::vector<uint8_t> &blob) {
+
+  Preferences prefs;
+  prefs.begin(nameSpace);
+  prefs.putBytes(BLOB_STORE_KEY, blob.data(), blob.size());
+  prefs.end();
+
+}
+
+
+static std::vector<uint8_t> getBlob(const char *nameSpace) {
+
+  Preferences prefs;
+  prefs.begin(nameSpace, true);
+  std::vector<uint8_t> blob(prefs.getBytesLength(BLOB_STORE_KEY));
+  if (blob.size()) prefs.getBytes(BLOB_STORE_KEY, blob.data(), blob.size());
+  prefs.end();
+  return blob;
+
+}
+
+
+// Value of a string record, read straight from the blob
+static std::string stringRecord(const std::vector<uint8_t> &blob, const char *key) {
+
+  size_t offset = sizeof(BlobHeader);
+
+  while (offset + 1 < blob.size()) {
+    uint8_t keyLength = blob[offset++];
+    std::string name((const char *)&blob[offset], keyLength);
+    offset += keyLength + 1;
+    uint8_t valueLength = blob[offset++];
+    if (name == key) return std::string((const char *)&blob[offset], valueLength);
+    offset += valueLength;
+  }
+
+  return "";
+
+}
+
+
+class BlobStoreTest : public ::testing::Test {
+
+  protected:
+
+    void SetUp() override {
+      HAL::serialCapture(true);
+      HAL::nvsClear();
+      config = Configuration();
+      settings = BenchSettings();
+      calVal = CalibrationData();
+      pins = Pins();
+    }
+
+};
+
+
+
+
+TEST_F(BlobStoreTest, EveryFieldTypeRoundTrips) {
+
+  settings.wifi_ssid = "Workshop network";
+  settings.wifi_timeout = 4000000000UL;
+  settings.refresh_rate = -250;
+  settings.valveLiftInterval = 0.0254;
+  settings.ota_allow_unverified = true;
+  settings.show_alarms = false;
+
+  ASSERT_TRUE(BlobStore::save(BLOB_STORE_SETTINGS));
+
+  settings = BenchSettings();
+  ASSERT_TRUE(BlobStore::load(BLOB_STORE_SETTINGS));
+
+  EXPECT_STREQ(settings.wifi_ssid.c_str(), "Workshop network");
+  EXPECT_EQ(settings.wifi_timeout, 4000000000UL);
+  EXPECT_EQ(settings.refresh_rate, -250);
+  EXPECT_EQ(settings.valveLiftInterval, 0.0254);
+  EXPECT_TRUE(settings.ota_allow_unverified);
+  EXPECT_FALSE(settings.show_alarms);
+
+}
+
+TEST_F(BlobStoreTest, EachStoreIsIndependent) {
+
+  config.iMAF_SENS_TYP = 7;
+  pins.VCC_5V = 36;
+  ASSERT_TRUE(BlobStore::save(BLOB_STORE_CONFIG));
+  ASSERT_TRUE(BlobStore::save(BLOB_STORE_PINS));
+
+  config = Configuration();
+  pins = Pins();
+  ASSERT_TRUE(BlobStore::load(BLOB_STORE_PINS));
+
+  EXPECT_EQ(pins.VCC_5V, 36);
+  EXPECT_EQ(config.iMAF_SENS_TYP, 0);
+
+  ASSERT_TRUE(BlobStore::load(BLOB_STORE_CONFIG));
+  EXPECT_EQ(config.iMAF_SENS_TYP, 7);
+
+}
+
+TEST_F(BlobStoreTest, LongStringsAreCappedAtOneRecord) {
+
+  settings.hostname = String();
+  for (int i = 0; i < 300; i++) settings.hostname += (char)('a' + i % 26);
+
+  ASSERT_TRUE(BlobStore::save(BLOB_STORE_SETTINGS));
+  settings = BenchSettings();
+  ASSERT_TRUE(BlobStore::load(BLOB_STORE_SETTINGS));
+
+  EXPECT_EQ(settings.hostname.length(), 255u);
+  EXPECT_EQ(settings.hostname[254], (char)('a' + 254 % 26));
+
+}
+
+TEST_F(BlobStoreTest, OtherSchemaVersionsKeepKnownFields) {
+
+  BlobBuilder builder;
+  builder.addString("sWIFI_SSID", "Older firmware");
+  builder.addInt("iRETIRED_FIELD", 99);
+  builder.addInt("iMIN_PRESSURE", 4);               // written as an int before it became a double
+  builder.addString("iREFRESH_RATE", "750");        // converted from text
+  builder.addDouble("iMAF_DIAMETER", 76.9);         // truncated to int
+  builder.addBool("bOTA_UNVERIFIED", true);
+  putBlob("settings", builder.build(SETTINGS_SCHEMA_VERSION + 1));
+
+  ASSERT_TRUE(BlobStore::load(BLOB_STORE_SETTINGS));
+
+  EXPECT_STREQ(settings.wifi_ssid.c_str(), "Older firmware");
+  EXPECT_EQ(settings.min_bench_pressure, 4.0);
+  EXPECT_EQ(settings.refresh_rate, 750);
+  EXPECT_EQ(settings.maf_housing_diameter, 76);
+  EXPECT_TRUE(settings.ota_allow_unverified);
+
+  // Fields missing from the blob keep their structs.h defaults
+  BenchSettings defaults;
+  EXPECT_STREQ(settings.hostname.c_str(), defaults.hostname.c_str());
+  EXPECT_EQ(settings.wifi_timeout, defaults.wifi_timeout);
+  EXPECT_EQ(settings.valveLiftInterval, defaults.valveLiftInterval);
+
+}
+
+TEST_F(BlobStoreTest, CorruptBlobIsRejectedAndRewritten) {
+
+  settings.wifi_ssid = "Saved";
+  ASSERT_TRUE(BlobStore::save(BLOB_STORE_SETTINGS));
+
+  std::vector<uint8_t> blob = getBlob("settings");
+  ASSERT_GT(blob.size(), sizeof(BlobHeader));
+  blob[sizeof(BlobHeader) + 3] ^= 0x40;
+  putBlob("settings", blob);
+
+  settings.wifi_ssid = "Changed in memory";
+  EXPECT_FALSE(BlobStore::load(BLOB_STORE_SETTINGS));
+  EXPECT_STREQ(settings.wifi_ssid.c_str(), "Changed in memory");
+
+  // The current values are written back as a valid blob
+  settings = BenchSettings();
+  EXPECT_TRUE(BlobStore::load(BLOB_STORE_SETTINGS));
+  EXPECT_STREQ(settings.wifi_ssid.c_str(), "Changed in memory");
+
+}
+
+TEST_F(BlobStoreTest, MalformedBlobsAreRejected) {
+
+  BlobBuilder builder;
+  builder.addString("sWIFI_SSID", "Truncated");
+  std::vector<uint8_t> good = builder.build(SETTINGS_SCHEMA_VERSION);
+
+  std::vector<uint8_t> shortBlob(good.begin(), good.end() - 1);
+  putBlob("settings", shortBlob);
+  EXPECT_FALSE(BlobStore::load(BLOB_STORE_SETTINGS));
+
+  std::vector<uint8_t> badMagic = good;
+  badMagic[0] ^= 0xFF;
+  putBlob("settings", badMagic);
+  EXPECT_FALSE(BlobStore::load(BLOB_STORE_SETTINGS));
+
+  std::vector<uint8_t> stub(good.begin(), good.begin() + sizeof(BlobHeader) - 1);
+  putBlob("settings", stub);
+  EXPECT_FALSE(BlobStore::load(BLOB_STORE_SETTINGS));
+
+  EXPECT_STRNE(settings.wifi_ssid.c_str(), "Truncated");
+
+}
+
+TEST_F(BlobStoreTest, LegacyKeysAreMigratedAndRemoved) {
+
+  Preferences prefs;
+  prefs.begin("settings");
+  prefs.putString("sWIFI_SSID", "Legacy network");
+  prefs.putUInt("iWIFI_TIMEOUT", 12000);
+  prefs.putInt("iREFRESH_RATE", 300);
+  prefs.putDouble("iMIN_PRESSURE", 2.5);
+  prefs.putInt("iMIN_FLOW_RATE", 3);                // form saves used the key prefix
+  prefs.putUChar("iSHOW_ALARMS", 0);
+  prefs.putUChar("iTEMP_UNIT", 0);                  // bool against an int field was never readable
+  prefs.end();
+
+  ASSERT_TRUE(BlobStore::load(BLOB_STORE_SETTINGS));
+
+  EXPECT_STREQ(settings.wifi_ssid.c_str(), "Legacy network");
+  EXPECT_EQ(settings.wifi_timeout, 12000UL);
+  EXPECT_EQ(settings.refresh_rate, 300);
+  EXPECT_EQ(settings.min_bench_pressure, 2.5);
+  EXPECT_EQ(settings.min_flow_rate, 3.0);
+  EXPECT_FALSE(settings.show_alarms);
+  EXPECT_EQ(settings.temp_unit, BenchSettings().temp_unit);
+
+  prefs.begin("settings", true);
+  EXPECT_FALSE(prefs.isKey("sWIFI_SSID"));
+  EXPECT_FALSE(prefs.isKey("iMIN_PRESSURE"));
+  EXPECT_FALSE(prefs.isKey("iTEMP_UNIT"));
+  EXPECT_TRUE(prefs.isKey(BLOB_STORE_KEY));
+  prefs.end();
+
+  // The next boot reads the blob
+  settings = BenchSettings();
+  ASSERT_TRUE(BlobStore::load(BLOB_STORE_SETTINGS));
+  EXPECT_STREQ(settings.wifi_ssid.c_str(), "Legacy network");
+  EXPECT_EQ(settings.min_bench_pressure, 2.5);
+
+}
+
+TEST_F(BlobStoreTest, FirstBootStoresDefaults) {
+
+  ASSERT_TRUE(BlobStore::load(BLOB_STORE_CALIBRATION));
+  EXPECT_FALSE(getBlob("calibration").empty());
+
+  BlobStore::erase(BLOB_STORE_CALIBRATION);
+  EXPECT_TRUE(getBlob("calibration").empty());
+
+}
+
+TEST_F(BlobStoreTest, SetFieldConvertsFormText) {
+
+  EXPECT_TRUE(BlobStore::setField(BLOB_STORE_SETTINGS, "iREFRESH_RATE", "420"));
+  EXPECT_TRUE(BlobStore::setField(BLOB_STORE_SETTINGS, "dLIFT_INTERVAL", "0.75"));
+  EXPECT_TRUE(BlobStore::setField(BLOB_STORE_SETTINGS, "bOTA_UNVERIFIED", "1"));
+  EXPECT_TRUE(BlobStore::setField(BLOB_STORE_SETTINGS, "sHOSTNAME", "bench2"));
+  EXPECT_FALSE(BlobStore::setField(BLOB_STORE_SETTINGS, "iNOT_A_FIELD", "1"));
+
+  EXPECT_EQ(settings.refresh_rate, 420);
+  EXPECT_EQ(settings.valveLiftInterval, 0.75);
+  EXPECT_TRUE(settings.ota_allow_unverified);
+  EXPECT_STREQ(settings.hostname.c_str(), "bench2");
+
+}
+
+TEST_F(BlobStoreTest, FormPostsDuringSaveNeverTearARecord) {
+
+  // One short and one long hostname, so every assignment reallocates the string being encoded
+  String shortName = "bench";
+  String longName;
+  for (int i = 0; i < 200; i++) longName += (char)('a' + i % 26);
+
+  settings.hostname = shortName;
+  std::atomic<bool> stop(false);
+
+  // async_tcp applying form posts while the PERSIST task saves
+  std::thread poster([&]() {
+    for (int i = 0; !stop; i++) BlobStore::setField(BLOB_STORE_SETTINGS, "sHOSTNAME", (i % 2) ? longName : shortName);
+  });
+
+  // Every record written holds one of the two values, never a mix
+  for (int saves = 0; saves < 2000; saves++) {
+    bool saved = BlobStore::save(BLOB_STORE_SETTINGS);
+    std::string hostname = stringRecord(getBlob("settings"), "sHOSTNAME");
+    bool whole = (hostname == shortName.c_str() || hostname == longName.c_str());
+    EXPECT_TRUE(saved && whole) << "save " << saves << ": " << hostname;
+    if (!saved || !whole) break;
+  }
+
+  stop = true;
+  poster.join();
+
+}
+
+
+
+
+int main(int argc, char **argv) {
+
+  ::testing::InitGoogleTest(&argc, argv);
+
+  return RUN_ALL_TESTS();
+
+}
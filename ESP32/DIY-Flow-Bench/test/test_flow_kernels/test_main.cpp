@@ -0,0 +1,235 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file test_main.cpp
+ *
+ * @brief Host tests for the batch flow conversion kernels
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * Each block kernel is run over a recorded style block and compared sample by sample with the scalar
+ * function fed the same environment. The kernels work in single precision so results agree to float
+ * rounding. Also covers in place conversion, empty blocks and the zero / negative input handling.
+ *
+ *   pio test -e native -f test_flow_kernels
+ *
+ ***/
+#include <gtest/gtest.h>
+#include <cmath>
+#include <vector>
+
+#include <Arduino.h>
+
+#include "constants.h"
+#include "system.h"
+#include "structs.h"
+
+#include "benchstate.h"
+#include "calculations.h"
+
+
+#define BLOCK_SIZE 1003   // not a multiple of any vector width
+
+
+extern struct SensorData sensorVal;
+
+static Calculations _calculations;
+
+
+// Agreement to single precision rounding
+#define EXPECT_FLOAT_NEAR(actual, expected) EXPECT_NEAR(actual, expected, 2e-6 * std::max(1.0, std::fabs((double)(expected))))
+
+
+static EnvBlock benchEnv(double tempDegC, double baroPA, double pRefKPA, double relH) {
+
+  EnvBlock env;
+  env.TempDegC = tempDegC;
+  env.BaroPA = baroPA;
+  env.PRefKPA = pRefKPA;
+  env.RelH = relH;
+
+  // The scalar functions read the live sensor values
+  sensorVal.TempDegC = tempDegC;
+  sensorVal.BaroPA = baroPA;
+  sensorVal.PRefKPA = pRefKPA;
+  sensorVal.RelH = relH;
+
+  return env;
+
+}
+
+
+// A ramp up through the working range with some zero and negative readings mixed in
+static std::vector<float> flowBlock() {
+
+  std::vector<float> block(BLOCK_SIZE);
+  for (size_t i = 0; i < block.size(); i++) {
+    block[i] = (i % 97 == 0) ? 0.0f : (i % 89 == 0) ? -1.5f : 0.35f * i + 0.125f;
+  }
+  return block;
+
+}
+
+
+
+
+TEST(FlowKernels, ConvertFlowMatchesScalar) {
+
+  const EnvBlock envs[] = {
+    benchEnv(20.0, 101325.0, -6.97, 50.0),
+    benchEnv(35.5, 98200.0, -12.4, 85.0),
+    benchEnv(-5.0, 103100.0, -1.2, 10.0)
+  };
+
+  std::vector<float> massFlow = flowBlock();
+  std::vector<float> flowCFM(massFlow.size(), -99.0f);
+
+  for (const EnvBlock &env : envs) {
+    benchEnv(env.TempDegC, env.BaroPA, env.PRefKPA, env.RelH);
+    _calculations.convertFlow(massFlow.data(), flowCFM.data(), massFlow.size(), env);
+
+    for (size_t i = 0; i < massFlow.size(); i++) {
+      EXPECT_FLOAT_NEAR(flowCFM[i], _calculations.convertFlow((double)massFlow[i])) << "sample " << i << " temp " << env.TempDegC;
+    }
+  }
+
+  EXPECT_EQ(flowCFM[0], 0.0f);
+  EXPECT_EQ(flowCFM[89], 0.0f);
+
+}
+
+TEST(FlowKernels, ConvertToSCFMMatchesScalarForEveryStandard) {
+
+  EnvBlock env = benchEnv(28.0, 99800.0, -7.2, 60.0);
+  std::vector<float> flowCFM = flowBlock();
+  std::vector<float> flowSCFM(flowCFM.size());
+
+  const int standards[] = {ISO_1585, ISO_5011, ISA, ISO_13443, ISO_2533, 0};
+
+  for (int standard : standards) {
+    _calculations.convertToSCFM(flowCFM.data(), flowSCFM.data(), flowCFM.size(), env, standard);
+    for (size_t i = 0; i < flowCFM.size(); i++) {
+      EXPECT_FLOAT_NEAR(flowSCFM[i], _calculations.convertToSCFM((double)flowCFM[i], standard)) << "sample " << i << " standard " << standard;
+    }
+  }
+
+}
+
+TEST(FlowKernels, ConvertFlowDepressionMatchesScalar) {
+
+  std::vector<float> flowCFM = flowBlock();
+  std::vector<float> oldPressure(flowCFM.size());
+  std::vector<float> output(flowCFM.size());
+
+  // Recorded depression wanders either side of 28", with the odd missing reading
+  for (size_t i = 0; i < oldPressure.size(); i++) {
+    oldPressure[i] = (i % 101 == 0) ? 0.0f : (i % 2 ? -28.0f : -27.5f + 0.01f * (i % 50));
+  }
+
+  // The scalar version only converts while the bench is running
+  BenchState::update(250.0, 28.0, 1000);
+  BenchState::update(250.0, 28.0, 1000 + BENCH_SPOOL_TIME_MS);
+  ASSERT_TRUE(BenchState::isRunning());
+
+  const double targets[] = {-28.0, -25.0, -10.0, 10.0};
+  for (double target : targets) {
+    _calculations.convertFlowDepression(oldPressure.data(), target, flowCFM.data(), output.data(), flowCFM.size());
+    for (size_t i = 0; i < flowCFM.size(); i++) {
+      if (oldPressure[i] == 0.0f) {
+        EXPECT_EQ(output[i], 0.0f) << "sample " << i;
+      } else {
+        EXPECT_FLOAT_NEAR(output[i], _calculations.convertFlowDepression((double)oldPressure[i], target, (double)flowCFM[i])) << "sample " << i << " target " << target;
+      }
+    }
+  }
+
+  // Same depression is a copy
+  _calculations.convertFlowDepression(oldPressure.data(), -28.0, flowCFM.data(), output.data(), flowCFM.size());
+  EXPECT_EQ(output[1], flowCFM[1]);
+
+  BenchState::update(0.0, 0.0, 2000 + BENCH_SPOOL_TIME_MS);
+  BenchState::update(0.0, 0.0, 2000 + BENCH_SPOOL_TIME_MS + BENCH_STOP_TIME_MS);
+  EXPECT_FALSE(BenchState::isRunning());
+
+}
+
+TEST(FlowKernels, ConvertPressureMatchesScalarForEveryUnitPair) {
+
+  const int units[] = {INH2O, KPA, PSIA, BAR, HPA, ATM, PASCALS};
+
+  std::vector<float> pressure(BLOCK_SIZE);
+  for (size_t i = 0; i < pressure.size(); i++) pressure[i] = -50.0f + 0.1f * i;
+  std::vector<float> output(pressure.size());
+
+  for (int unitsIn : units) {
+    for (int unitsOut : units) {
+      _calculations.convertPressure(pressure.data(), output.data(), pressure.size(), unitsOut, unitsIn);
+      for (size_t i = 0; i < pressure.size(); i++) {
+        double expected = _calculations.convertPressure((double)pressure[i], unitsOut, unitsIn);
+        EXPECT_NEAR(output[i], expected, 2e-6 * std::max(1.0, std::fabs(expected))) << "in " << unitsIn << " out " << unitsOut << " sample " << i;
+      }
+    }
+  }
+
+  // Default units, kPa to inH2O
+  _calculations.convertPressure(pressure.data(), output.data(), pressure.size(), INH2O);
+  EXPECT_FLOAT_NEAR(output[500], _calculations.convertPressure((double)pressure[500], INH2O));
+
+}
+
+TEST(FlowKernels, BlocksConvertInPlace) {
+
+  EnvBlock env = benchEnv(20.0, 101325.0, -6.97, 50.0);
+
+  std::vector<float> input = flowBlock();
+  std::vector<float> flowCFM(input.size());
+  std::vector<float> flowSCFM(input.size());
+  _calculations.convertFlow(input.data(), flowCFM.data(), input.size(), env);
+  _calculations.convertToSCFM(flowCFM.data(), flowSCFM.data(), flowCFM.size(), env, ISO_5011);
+
+  std::vector<float> block = flowBlock();
+  _calculations.convertFlow(block.data(), block.data(), block.size(), env);
+  EXPECT_EQ(block, flowCFM);
+  _calculations.convertToSCFM(block.data(), block.data(), block.size(), env, ISO_5011);
+  EXPECT_EQ(block, flowSCFM);
+
+}
+
+TEST(FlowKernels, EmptyAndShortBlocks) {
+
+  EnvBlock env = benchEnv(20.0, 101325.0, -6.97, 50.0);
+
+  float guard[4] = {-1.0f, -1.0f, -1.0f, -1.0f};
+  const float input[3] = {10.0f, 20.0f, 30.0f};
+
+  _calculations.convertFlow(input, guard, 0, env);
+  _calculations.convertPressure(input, guard, 0, INH2O);
+  EXPECT_EQ(guard[0], -1.0f);
+
+  // Lengths short of a vector still convert every sample and stop at count
+  for (size_t count = 1; count <= 3; count++) {
+    _calculations.convertFlow(input, guard, count, env);
+    for (size_t i = 0; i < count; i++) EXPECT_FLOAT_NEAR(guard[i], _calculations.convertFlow((double)input[i]));
+    EXPECT_EQ(guard[3], -1.0f);
+  }
+
+}
+
+
+
+
+int main(int argc, char **argv) {
+
+  ::testing::InitGoogleTest(&argc, argv);
+
+  return RUN_ALL_TESTS();
+
+}
@@ -0,0 +1,525 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file test_main.cpp
+ *
+ * @brief Host tests for the sample history and windowed averaging
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * Samples are fed the way the sensor task does (BenchState::update() then SampleHistory::push()) on the
+ * manual clock at the uneven 400 / 800 ms cycle of the real sensor loop. Window statistics are checked
+ * against a direct recompute, including across a millis() wrap and once the ring has been lapped. The
+ * bench is then stopped part way through a window to check that calibration and /api/history/stats
+ * reject it.
+ *
+ *   pio test -e native -f test_history
+ *
+ ***/
+#include <gtest/gtest.h>
+#include <cmath>
+#include <stdlib.h>
+#include <unistd.h>
+#include <vector>
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <ESPAsyncWebServer.h>
+
+#include "constants.h"
+#include "system.h"
+#include "structs.h"
+
+#include "benchstate.h"
+#include "calibration.h"
+#include "history.h"
+#include "webserver.h"
+
+
+#define RUN_FLOW 182.0
+#define RUN_PREF 28.0
+
+
+extern struct SensorData sensorVal;
+extern struct BenchSettings settings;
+extern struct Configuration config;
+extern struct CalibrationData calVal;
+
+extern Webserver _webserver;
+
+
+struct Sample {
+  uint32_t time;
+  double flow;
+};
+
+
+class HistoryEnvironment : public ::testing::Environment {
+
+  public:
+
+    void SetUp() override {
+      char directory[] = "/tmp/diyfb_test_XXXXXX";
+      ASSERT_NE(mkdtemp(directory), (char *)NULL);
+      ASSERT_EQ(chdir(directory), 0);
+      HAL::serialCapture(true);
+      HAL::setClock(100000);
+      _webserver.begin();
+    }
+
+};
+
+
+class HistoryTest : public ::testing::Test {
+
+  protected:
+
+    std::vector<Sample> samples;
+    uint32_t step = 0;
+
+    void SetUp() override {
+      settings.min_flow_rate = 5.0;
+      settings.min_bench_pressure = 2.0;
+      config.iPREF_SENS_TYP = MPXV7007;
+      // Stop the bench, then leave a gap so each test starts on a clean stretch of history
+      sample(0.0, 0.0, 1000);
+      sample(0.0, 0.0, BENCH_STOP_TIME_MS + 10);
+      HAL::advanceClock(HISTORY_CAL_WINDOW_MS * 4);
+      samples.clear();
+    }
+
+    // Alternate 400 / 800 ms like the sensor loop
+    uint32_t nextStep() {
+      return (step++ % 2) ? 800 : 400;
+    }
+
+    void sample(double flow, double pRef, uint32_t stepMs) {
+      HAL::advanceClock(stepMs);
+      sensorVal.FlowCFM = flow;
+      sensorVal.FlowSCFM = flow * 0.93;
+      sensorVal.FlowADJ = flow * 1.05;
+      sensorVal.FlowADJSCFM = flow * 0.98;
+      sensorVal.FlowKGH = flow * 0.0173;
+      sensorVal.PRefH2O = pRef;
+      sensorVal.PDiffH2O = 0.02 * flow;
+      sensorVal.PitotKPA = 0.001 * flow;
+      BenchState::update(flow, pRef, millis());
+      SampleHistory::push(millis());
+      samples.push_back({millis(), flow});
+    }
+
+    void sample(double flow) {
+      sample(flow, flow > 0.0 ? RUN_PREF : 0.0, nextStep());
+    }
+
+    // Spool up and run until the bench reports running
+    void startBench() {
+      while (!BenchState::isRunning()) sample(RUN_FLOW);
+    }
+
+    // Steady flow with some noise on it
+    void run(uint32_t durationMs) {
+      uint32_t end = millis() + durationMs;
+      while ((int32_t)(millis() - end) < 0) sample(RUN_FLOW + 1.5 * sin(samples.size() * 1.7));
+    }
+
+    WindowStats expected(uint32_t fromTime, uint32_t windowMs) {
+      WindowStats stats;
+      double sum = 0.0;
+      uint32_t firstTime = 0;
+      std::vector<double> values;
+      for (const Sample &entry : samples) {
+        int32_t offset = (int32_t)(entry.time - fromTime);
+        if (offset < 0 || (uint32_t)offset > windowMs) continue;
+        if (values.empty()) firstTime = entry.time;
+        stats.spanMs = entry.time - firstTime;
+        values.push_back(entry.flow);
+        sum += entry.flow;
+      }
+      stats.count = values.size();
+      if (values.empty()) return stats;
+      double mean = sum / values.size();
+      double squares = 0.0;
+      for (double value : values) squares += (value - mean) * (value - mean);
+      stats.mean = mean;
+      stats.stdDev = values.size() > 1 ? sqrt(squares / (values.size() - 1)) : 0.0;
+      return stats;
+    }
+
+    void expectMatches(const WindowStats &stats, uint32_t fromTime, uint32_t windowMs) {
+      WindowStats reference = expected(fromTime, windowMs);
+      EXPECT_EQ(stats.count, reference.count) << "from " << fromTime << " ms " << windowMs;
+      EXPECT_EQ(stats.spanMs, reference.spanMs) << "from " << fromTime << " ms " << windowMs;
+      EXPECT_NEAR(stats.mean, reference.mean, 1e-4) << "from " << fromTime << " ms " << windowMs;
+      EXPECT_NEAR(stats.stdDev, reference.stdDev, 1e-4) << "from " << fromTime << " ms " << windowMs;
+    }
+
+};
+
+
+static AsyncWebServerResponse *getStats(AsyncWebServerRequest &request) {
+
+  AsyncWebServer *server = AsyncWebServer::find(80);
+  return server ? server->handle(&request) : NULL;
+
+}
+
+
+static JsonDocument statsJSON(AsyncWebServerResponse *response) {
+
+  JsonDocument json;
+  deserializeJson(json, response->body());
+  return json;
+
+}
+
+
+
+
+TEST_F(HistoryTest, WindowStatsMatchDirectRecompute) {
+
+  startBench();
+  run(20000);
+
+  uint32_t newest = samples.back().time;
+
+  for (uint32_t windowMs : {400u, 1000u, 2000u, 3000u, 7500u, 15000u}) {
+    WindowStats stats = SampleHistory::last(HISTORY_FLOW_CFM, windowMs);
+    expectMatches(stats, newest - windowMs, windowMs);
+    EXPECT_TRUE(stats.ended) << windowMs;
+    EXPECT_FALSE(stats.benchStopped) << windowMs;
+  }
+
+  // Windows part way back, with the edges on and between sample times
+  for (uint32_t back : {5000u, 5200u, 9999u}) {
+    uint32_t fromTime = newest - back;
+    WindowStats stats = SampleHistory::window(HISTORY_FLOW_CFM, fromTime, 2400);
+    expectMatches(stats, fromTime, 2400);
+    EXPECT_TRUE(stats.complete) << back;
+  }
+
+  // Each channel carries its own value
+  WindowStats scfm = SampleHistory::last(HISTORY_FLOW_SCFM, 3000);
+  WindowStats cfm = SampleHistory::last(HISTORY_FLOW_CFM, 3000);
+  EXPECT_NEAR(scfm.mean, cfm.mean * 0.93, 1e-3);
+  EXPECT_EQ(scfm.count, cfm.count);
+
+  // Out of range channels return an empty window
+  EXPECT_EQ(SampleHistory::last(-1, 3000).count, 0u);
+  EXPECT_FALSE(SampleHistory::window(HISTORY_CHANNEL_COUNT, newest - 3000, 3000).ended);
+
+}
+
+TEST_F(HistoryTest, LastIsRelativeToNewestSample) {
+
+  startBench();
+  run(6000);
+
+  WindowStats before = SampleHistory::last(HISTORY_FLOW_CFM, HISTORY_CAL_WINDOW_MS);
+
+  // A stalled sensor task must not shift the window past the data
+  HAL::advanceClock(5000);
+  WindowStats after = SampleHistory::last(HISTORY_FLOW_CFM, HISTORY_CAL_WINDOW_MS);
+
+  EXPECT_EQ(after.count, before.count);
+  EXPECT_EQ(after.mean, before.mean);
+  EXPECT_TRUE(after.complete);
+
+}
+
+TEST_F(HistoryTest, NextWindowEndsOnceCovered) {
+
+  startBench();
+  run(2000);
+
+  uint32_t fromTime = millis();
+  uint32_t windowMs = HISTORY_LIFT_WINDOW_MS;
+
+  // Only the sample taken at the request instant is in it so far
+  WindowStats stats = SampleHistory::window(HISTORY_FLOW_CFM, fromTime, windowMs);
+  EXPECT_EQ(stats.count, 1u);
+  EXPECT_FALSE(stats.ended);
+
+  // Not ended until a sample lands on or after the end of the window
+  while ((int32_t)(millis() - (fromTime + windowMs)) < 0) {
+    stats = SampleHistory::window(HISTORY_FLOW_CFM, fromTime, windowMs);
+    EXPECT_FALSE(stats.ended) << "at " << millis() - fromTime;
+    EXPECT_FALSE(stats.complete);
+    sample(RUN_FLOW + 1.5 * sin(samples.size() * 1.7));
+  }
+
+  stats = SampleHistory::window(HISTORY_FLOW_CFM, fromTime, windowMs);
+  EXPECT_TRUE(stats.ended);
+  EXPECT_TRUE(stats.complete);
+  expectMatches(stats, fromTime, windowMs);
+
+  // Later samples do not change a window that has ended
+  run(3000);
+  WindowStats later = SampleHistory::window(HISTORY_FLOW_CFM, fromTime, windowMs);
+  EXPECT_EQ(later.count, stats.count);
+  EXPECT_EQ(later.mean, stats.mean);
+
+}
+
+TEST_F(HistoryTest, ShortWindowIsNotComplete) {
+
+  startBench();
+  run(4000);
+
+  uint32_t newest = samples.back().time;
+
+  // Two or three samples at the 2 Hz rate, no better than an instantaneous reading
+  WindowStats stats = SampleHistory::last(HISTORY_FLOW_CFM, 1000);
+  EXPECT_TRUE(stats.ended);
+  EXPECT_LT(stats.count, (uint32_t)HISTORY_MIN_SAMPLES);
+  EXPECT_FALSE(stats.complete);
+
+  // The threshold is inclusive
+  uint32_t windowMs = newest - samples[samples.size() - HISTORY_MIN_SAMPLES].time;
+  stats = SampleHistory::last(HISTORY_FLOW_CFM, windowMs);
+  EXPECT_EQ(stats.count, (uint32_t)HISTORY_MIN_SAMPLES);
+  EXPECT_TRUE(stats.complete);
+
+}
+
+TEST_F(HistoryTest, WindowMustBeInHistory) {
+
+  startBench();
+
+  uint32_t firstTime = samples.front().time;
+
+  // Overwrite the whole ring
+  while (samples.size() < HISTORY_SAMPLES + 20) sample(RUN_FLOW + (samples.size() % 7));
+
+  uint32_t oldest = samples[samples.size() - HISTORY_SAMPLES].time;
+
+  // The start of the window has been overwritten, so it never ends
+  WindowStats stats = SampleHistory::window(HISTORY_FLOW_CFM, firstTime, 3000);
+  EXPECT_FALSE(stats.ended);
+  EXPECT_FALSE(stats.complete);
+
+  stats = SampleHistory::window(HISTORY_FLOW_CFM, oldest - 1, 3000);
+  EXPECT_FALSE(stats.ended);
+
+  // Just inside the ring is fine
+  stats = SampleHistory::window(HISTORY_FLOW_CFM, samples[samples.size() - HISTORY_SAMPLES + 1].time, 3000);
+  EXPECT_TRUE(stats.complete);
+  expectMatches(stats, samples[samples.size() - HISTORY_SAMPLES + 1].time, 3000);
+
+  // Whole history in one window
+  EXPECT_FALSE(SampleHistory::last(HISTORY_FLOW_CFM, samples.back().time - oldest + 100).ended);
+
+}
+
+TEST_F(HistoryTest, WindowSpansMillisWrap) {
+
+  HAL::setClock(UINT32_MAX - 4000);
+
+  startBench();
+  run(8000);
+
+  uint32_t newest = samples.back().time;
+  ASSERT_LT(newest, 10000u);
+
+  for (uint32_t windowMs : {3000u, 6000u, 8000u}) {
+    WindowStats stats = SampleHistory::last(HISTORY_FLOW_CFM, windowMs);
+    expectMatches(stats, newest - windowMs, windowMs);
+    EXPECT_TRUE(stats.complete) << windowMs;
+    EXPECT_FALSE(stats.benchStopped) << windowMs;
+  }
+
+}
+
+TEST_F(HistoryTest, BenchStopsMidWindow) {
+
+  startBench();
+  run(4000);
+
+  uint32_t fromTime = millis();
+
+  run(1200);
+  sample(0.0);
+  run(HISTORY_CAL_WINDOW_MS);
+
+  // The window has ended with enough samples, but the bench stopped in it
+  WindowStats stats = SampleHistory::window(HISTORY_FLOW_CFM, fromTime, HISTORY_CAL_WINDOW_MS);
+  EXPECT_TRUE(stats.complete);
+  EXPECT_TRUE(stats.benchStopped);
+
+  // A dropout is enough to reject the window even when the bench comes back
+  EXPECT_TRUE(SampleHistory::last(HISTORY_FLOW_CFM, HISTORY_CAL_WINDOW_MS + 1000).benchStopped);
+
+  // Once the bench is back up for a full window it is clean again
+  startBench();
+  run(HISTORY_CAL_WINDOW_MS + 500);
+  stats = SampleHistory::last(HISTORY_FLOW_CFM, HISTORY_CAL_WINDOW_MS);
+  EXPECT_TRUE(stats.complete);
+  EXPECT_FALSE(stats.benchStopped);
+
+}
+
+TEST_F(HistoryTest, CalibrationRejectsStoppedWindow) {
+
+  Calibration _calibration;
+
+  sensorVal.flowtile = ACFM_TILE;
+  calVal.cal_flow_rate = 180.0;
+  calVal.flow_offset = 1.25;
+  calVal.leak_cal_offset = 0.5;
+
+  // Not long enough to fill the window
+  startBench();
+  sample(RUN_FLOW);
+  EXPECT_FALSE(_calibration.setFlowOffset());
+  EXPECT_FALSE(_calibration.setLeakOffset());
+
+  // Bench stops part way through the averaging window
+  run(HISTORY_CAL_WINDOW_MS);
+  sample(0.0);
+  sample(0.0);
+  EXPECT_FALSE(_calibration.setFlowOffset());
+  EXPECT_FALSE(_calibration.setLeakOffset());
+  EXPECT_EQ(calVal.flow_offset, 1.25);
+  EXPECT_EQ(calVal.leak_cal_offset, 0.5);
+
+  // Clean run, the offset comes from the window mean rather than the last reading
+  startBench();
+  run(HISTORY_CAL_WINDOW_MS + 1000);
+  sample(RUN_FLOW + 20.0);
+
+  WindowStats window = SampleHistory::last(HISTORY_FLOW_CFM, HISTORY_CAL_WINDOW_MS);
+  ASSERT_TRUE(window.complete);
+  ASSERT_FALSE(window.benchStopped);
+
+  EXPECT_TRUE(_calibration.setFlowOffset());
+  EXPECT_NEAR(calVal.flow_offset, window.mean - 180.0, 1e-4);
+  EXPECT_LT(calVal.flow_offset, RUN_FLOW + 20.0 - 180.0 - 1.0);
+
+  EXPECT_TRUE(_calibration.setLeakOffset());
+  EXPECT_NEAR(calVal.leak_cal_offset, window.mean, 1e-4);
+
+  // The visible tile picks the channel
+  sensorVal.flowtile = SCFM_TILE;
+  EXPECT_TRUE(_calibration.setFlowOffset());
+  EXPECT_NEAR(calVal.flow_offset, SampleHistory::last(HISTORY_FLOW_SCFM, HISTORY_CAL_WINDOW_MS).mean - 180.0, 1e-4);
+
+}
+
+TEST_F(HistoryTest, StatsEndpoint) {
+
+  startBench();
+  run(6000);
+
+  // Unknown channel
+  AsyncWebServerRequest unknown(HTTP_GET, "/api/history/stats");
+  unknown.addParam("channel", "FLOW_BOGUS");
+  AsyncWebServerResponse *response = getStats(unknown);
+  ASSERT_NE(response, (AsyncWebServerResponse *)NULL);
+  EXPECT_EQ(response->code(), 400);
+
+  // last=ms is relative to millis(), which is the newest sample here
+  AsyncWebServerRequest last(HTTP_GET, "/api/history/stats");
+  last.addParam("channel", "PDIFF_H2O");
+  last.addParam("last", "3000");
+  response = getStats(last);
+  ASSERT_NE(response, (AsyncWebServerResponse *)NULL);
+  EXPECT_EQ(response->code(), 200);
+  EXPECT_EQ(response->contentType(), "application/json");
+
+  JsonDocument json = statsJSON(response);
+  WindowStats stats = SampleHistory::last(HISTORY_PDIFF_H2O, 3000);
+  EXPECT_EQ(json["CHANNEL"].as<String>(), "PDIFF_H2O");
+  EXPECT_EQ(json["FROM"].as<uint32_t>(), millis() - 3000);
+  EXPECT_EQ(json["MS"].as<uint32_t>(), 3000u);
+  EXPECT_NEAR(json["MEAN"].as<double>(), stats.mean, 1e-4);
+  EXPECT_NEAR(json["SD"].as<double>(), stats.stdDev, 1e-4);
+  EXPECT_EQ(json["COUNT"].as<uint32_t>(), stats.count);
+  EXPECT_EQ(json["SPAN_MS"].as<uint32_t>(), stats.spanMs);
+  EXPECT_EQ(json["MIN_COUNT"].as<int>(), HISTORY_MIN_SAMPLES);
+  EXPECT_TRUE(json["ENDED"].as<bool>());
+  EXPECT_TRUE(json["COMPLETE"].as<bool>());
+  EXPECT_FALSE(json["BENCH_STOPPED"].as<bool>());
+
+  // Ended with too few samples
+  AsyncWebServerRequest shortWindow(HTTP_GET, "/api/history/stats");
+  shortWindow.addParam("last", "800");
+  response = getStats(shortWindow);
+  ASSERT_NE(response, (AsyncWebServerResponse *)NULL);
+  EXPECT_EQ(response->code(), 409);
+  EXPECT_FALSE(statsJSON(response)["COMPLETE"].as<bool>());
+
+  // next=ms returns the start of the window to poll with
+  AsyncWebServerRequest next(HTTP_GET, "/api/history/stats");
+  next.addParam("next", "3000");
+  response = getStats(next);
+  ASSERT_NE(response, (AsyncWebServerResponse *)NULL);
+  EXPECT_EQ(response->code(), 200);
+  json = statsJSON(response);
+  EXPECT_FALSE(json["ENDED"].as<bool>());
+  EXPECT_EQ(json["COUNT"].as<uint32_t>(), 1u);
+  String fromTime = json["FROM"].as<String>();
+
+  // The bench stops part way through the polled window
+  run(1500);
+  sample(0.0);
+  run(2000);
+
+  AsyncWebServerRequest poll(HTTP_GET, "/api/history/stats");
+  poll.addParam("from", fromTime);
+  poll.addParam("ms", "3000");
+  response = getStats(poll);
+  ASSERT_NE(response, (AsyncWebServerResponse *)NULL);
+  EXPECT_EQ(response->code(), 200);
+  json = statsJSON(response);
+  EXPECT_EQ(json["FROM"].as<String>(), fromTime);
+  EXPECT_TRUE(json["ENDED"].as<bool>());
+  EXPECT_TRUE(json["COMPLETE"].as<bool>());
+  EXPECT_TRUE(json["BENCH_STOPPED"].as<bool>());
+  expectMatches(SampleHistory::window(HISTORY_FLOW_CFM, strtoul(fromTime.c_str(), NULL, 10), 3000), strtoul(fromTime.c_str(), NULL, 10), 3000);
+  EXPECT_EQ(json["COUNT"].as<uint32_t>(), expected(strtoul(fromTime.c_str(), NULL, 10), 3000).count);
+
+}
+
+TEST(History, ChannelNames) {
+
+  const char *names[] = {"FLOW_CFM", "FLOW_SCFM", "FLOW_ADJ", "FLOW_ADJ_SCFM", "FLOW_KGH", "PREF_H2O", "PDIFF_H2O", "PITOT_KPA"};
+
+  for (int i = 0; i < HISTORY_CHANNEL_COUNT; i++) {
+    EXPECT_EQ(SampleHistory::channel(names[i]), i) << names[i];
+    JsonDocument json;
+    deserializeJson(json, SampleHistory::getStatsJSON(WindowStats(), i, 0, 1000));
+    EXPECT_EQ(json["CHANNEL"].as<String>(), names[i]);
+  }
+
+  EXPECT_EQ(SampleHistory::channel("flow_cfm"), -1);
+  EXPECT_EQ(SampleHistory::channel(""), -1);
+
+  // Lift data capture reads the channel that matches the capture datatype
+  EXPECT_EQ(SampleHistory::captureChannel(ACFM), HISTORY_FLOW_CFM);
+  EXPECT_EQ(SampleHistory::captureChannel(STD_ACFM), HISTORY_FLOW_SCFM);
+  EXPECT_EQ(SampleHistory::captureChannel(ADJ_ACFM), HISTORY_FLOW_ADJ);
+  EXPECT_EQ(SampleHistory::captureChannel(ADJ_STD_ACFM), HISTORY_FLOW_ADJ_SCFM);
+  EXPECT_EQ(SampleHistory::captureChannel(RAW_MASS), HISTORY_FLOW_KGH);
+  EXPECT_EQ(SampleHistory::captureChannel(-1), HISTORY_FLOW_CFM);
+
+}
+
+
+
+
+int main(int argc, char **argv) {
+
+  ::testing::InitGoogleTest(&argc, argv);
+  ::testing::AddGlobalTestEnvironment(new HistoryEnvironment);
+
+  return RUN_ALL_TESTS();
+
+}
@@ -0,0 +1,300 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file test_main.cpp
+ *
+ * @brief Host tests for the acquisition, SSE, template and API paths
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * The four paths benchmarked in bench/bench.cpp, checked for the right answer rather than for speed.
+ *
+ *   pio test -e native -f test_hot_paths
+ *
+ ***/
+#include <gtest/gtest.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include <esp32/rom/crc.h>
+
+#include "constants.h"
+#include "system.h"
+#include "structs.h"
+
+#include "API.h"
+#include "calculations.h"
+#include "history.h"
+#include "publisher.h"
+#include "sensors.h"
+#include "webserver.h"
+
+
+extern struct BenchSettings settings;
+extern struct DeviceStatus status;
+extern struct SensorData sensorVal;
+extern struct Configuration config;
+extern Sensors _sensors;
+extern Webserver _webserver;
+extern Publisher _publisher;
+
+static AsyncWebServer *server = NULL;
+
+static const std::string version = std::string(MAJOR_VERSION) + "." + MINOR_VERSION + "." + BUILD_NUMBER;
+
+
+// MAF input in ADC counts (ADS1115 at gain 0 is 187.51 uV per count)
+static void setMafCounts(int16_t counts) {
+  HAL::i2cWriteRegister16(config.iADC_I2C_ADDR, 0x00, (uint16_t)counts);
+}
+
+
+class HotPaths : public ::testing::Environment {
+
+  public:
+
+    void SetUp() override {
+
+      char directory[] = "/tmp/diyfb_test_XXXXXX";
+      ASSERT_NE(mkdtemp(directory), (char *)NULL);
+      ASSERT_EQ(chdir(directory), 0);
+
+      HAL::serialCapture(true);
+      HAL::i2cAttach(config.iADC_I2C_ADDR);
+
+      // MAF transfer function from the built in coefficients
+      settings.AB_test = 'B';
+      settings.data_filter_type = NONE;
+
+      // Environment as the enviro task would leave it
+      sensorVal.TempDegC = 20.0;
+      sensorVal.BaroPA = 101325.0;
+      sensorVal.BaroKPA = 101.325;
+      sensorVal.RelH = 50.0;
+
+      _webserver.begin();
+      server = AsyncWebServer::find(80);
+      ASSERT_NE(server, (AsyncWebServer *)NULL);
+
+      API::begin();
+
+    }
+
+};
+
+
+
+
+/***********************************************************
+ * Acquisition cycle
+ ***/
+TEST(AcquisitionCycle, ConvertsTheMafReadingThroughToStandardFlow) {
+
+  setMafCounts(16000);
+  _sensors.acquire();
+  int scans = status.adcScanCount;
+
+  // Second cycle so the reference pressure the conversions used is the one left in sensorVal
+  _sensors.acquire();
+
+  Calculations _calculations;
+
+  EXPECT_EQ(status.adcScanCount, scans + 1);
+  EXPECT_NEAR(sensorVal.MafVolts, 16000 * 0.00018751 + config.dMAF_MV_TRIM, 1e-4);
+  EXPECT_GT(sensorVal.FlowKGH, 0.0);
+  EXPECT_DOUBLE_EQ(sensorVal.FlowCFMraw, _calculations.convertFlow(sensorVal.FlowKGH));
+  EXPECT_DOUBLE_EQ(sensorVal.FlowSCFM, _calculations.convertToSCFM(sensorVal.FlowCFM, settings.standardReference));
+
+}
+
+TEST(AcquisitionCycle, FlowRisesWithMafVoltage) {
+
+  double previous = -1.0;
+
+  for (int16_t counts = 4000; counts <= 24000; counts += 4000) {
+    setMafCounts(counts);
+    _sensors.acquire();
+    EXPECT_GT(sensorVal.FlowKGH, previous) << counts << " counts";
+    previous = sensorVal.FlowKGH;
+  }
+
+}
+
+TEST(AcquisitionCycle, FeedsTheSampleHistory) {
+
+  // Settle cycle, the first conversion still uses the reference pressure left by the previous test
+  setMafCounts(12000);
+  _sensors.acquire();
+  delay(2);
+
+  uint32_t start = millis();
+
+  for (int i = 0; i < 20; i++) {
+    _sensors.acquire();
+    delay(2);
+  }
+
+  WindowStats stats = SampleHistory::window(HISTORY_FLOW_CFM, start, millis() - start);
+
+  EXPECT_GE(stats.count, 20u);
+  EXPECT_NEAR(stats.mean, sensorVal.FlowCFM, 1e-3);
+  EXPECT_NEAR(stats.stdDev, 0.0, 1e-3);
+
+}
+
+
+
+
+/***********************************************************
+ * SSE frame build
+ ***/
+TEST(SSEFrame, FlowTopicCarriesTheCurrentReadings) {
+
+  AsyncEventSource *source = server->eventSource(_publisher.topicPath(SSE_TOPIC_FLOW));
+  ASSERT_NE(source, (AsyncEventSource *)NULL);
+
+  AsyncEventSourceClient *client = source->connect();
+  ASSERT_EQ(_publisher.subscriberCount(SSE_TOPIC_FLOW), 1u);
+
+  sensorVal.FlowCFM = 123.25;
+  sensorVal.PRefH2O = -28.0;
+  settings.rounding_type = NONE;
+
+  _publisher.publish();
+  ASSERT_EQ(client->deliver(), 1u);
+
+  std::string message = client->received();
+
+  EXPECT_EQ(message.compare(0, 4, "id: "), 0);
+  EXPECT_NE(message.find("\nevent: JSON_DATA\ndata: {"), std::string::npos);
+  EXPECT_NE(message.find("\"FLOW\":123.25"), std::string::npos) << message;
+  EXPECT_EQ(message.substr(message.size() - 3), "}\n\n");
+
+  client->close();
+  EXPECT_EQ(_publisher.subscriberCount(SSE_TOPIC_FLOW), 0u);
+
+}
+
+TEST(SSEFrame, TopicsWithoutSubscribersAreNotSent) {
+
+  AsyncEventSourceClient *client = server->eventSource(_publisher.topicPath(SSE_TOPIC_MIMIC))->connect();
+
+  _publisher.publish();
+  client->deliver();
+
+  EXPECT_EQ(client->received().find("\"FLOW\""), std::string::npos);
+
+  client->close();
+
+}
+
+
+
+
+/***********************************************************
+ * Template rendering
+ ***/
+TEST(TemplateRendering, SettingsPageHasEveryPlaceholderExpanded) {
+
+  settings.wifi_ssid = "bench-ssid";
+
+  AsyncWebServerRequest request(HTTP_GET, "/settings");
+
+  AsyncWebServerResponse *response = server->handle(&request);
+  ASSERT_NE(response, (AsyncWebServerResponse *)NULL);
+  EXPECT_EQ(response->code(), 200);
+
+  String page = response->body();
+
+  EXPECT_GT(page.length(), 1000u);
+  EXPECT_NE(page.indexOf("value=\"bench-ssid\""), -1);
+
+  // Anything still between two placeholders within a name's length was not expanded
+  int start = page.indexOf(TEMPLATE_PLACEHOLDER);
+  while (start != -1) {
+    int end = page.indexOf(TEMPLATE_PLACEHOLDER, start + 1);
+    if (end == -1) break;
+    String name = page.substring(start + 1, end);
+    EXPECT_FALSE(end - start - 1 <= TEMPLATE_PARAM_NAME_LENGTH && name.length() > 0 && name.indexOf(' ') == -1 && name.indexOf('\n') == -1) << "unexpanded " << name.c_str();
+    start = page.indexOf(TEMPLATE_PLACEHOLDER, end + 1);
+  }
+
+}
+
+
+
+
+/***********************************************************
+ * API parsing
+ ***/
+static std::string apiRequest(const char *request) {
+
+  HAL::serialOutput();
+  HAL::serialInput(request);
+
+  std::string output;
+  for (int i = 0; i < 200 && output.find('\n') == std::string::npos; i++) {
+    delay(5);
+    output += HAL::serialOutput();
+  }
+
+  return output;
+
+}
+
+TEST(APIParsing, FramedRequestIsAnsweredWithItsId) {
+
+  EXPECT_EQ(apiRequest("#42 V\n"), "#42 V:" + version + "\n");
+
+}
+
+TEST(APIParsing, FramedRequestWithCRCIsChecked) {
+
+  const char *frame = "#7 V";
+  char request[32];
+  snprintf(request, sizeof(request), "%s*%08X\n", frame, crc32_le(0, (const uint8_t *)frame, strlen(frame)));
+
+  std::string response = apiRequest(request);
+
+  ASSERT_GT(response.size(), 10u);
+  EXPECT_EQ(response.compare(0, 5 + version.size(), "#7 V:" + version), 0) << response;
+  EXPECT_EQ(response[5 + version.size()], '*');
+  EXPECT_EQ(apiRequest("#8 V*00000000\n").compare(0, 11, "#8 ERR:CRC*"), 0);
+
+}
+
+TEST(APIParsing, UnknownCommandsAreRejected) {
+
+  EXPECT_EQ(apiRequest("#9 NOSUCHCOMMAND\n"), "#9 ERR:UNKNOWN\n");
+
+}
+
+TEST(APIParsing, LegacySingleCharacterCommand) {
+
+  std::string response = apiRequest("V");
+
+  EXPECT_EQ(response, "V:" + version + "\n");
+
+}
+
+
+
+
+int main(int argc, char **argv) {
+
+  ::testing::InitGoogleTest(&argc, argv);
+  ::testing::AddGlobalTestEnvironment(new HotPaths());
+
+  return RUN_ALL_TESTS();
+
+}
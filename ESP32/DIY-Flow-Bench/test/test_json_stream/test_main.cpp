@@ -0,0 +1,406 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file test_main.cpp
+ *
+ * @brief Host tests for bounded memory JSON file loading
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * Synthetic files many times larger than the ESP32 heap are walked with JsonStream::forEach() and
+ * loaded through a filter. Peak heap is measured by wrapping the C allocator, which needs glibc; on
+ * other hosts the memory checks are skipped and only the parse results are tested.
+ *
+ *   pio test -e native -f test_json_stream
+ *
+ ***/
+#include <gtest/gtest.h>
+#include <atomic>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+#include "constants.h"
+#include "system.h"
+#include "structs.h"
+
+#include "jsonstream.h"
+#include "storage.h"
+
+
+/***********************************************************
+ * Heap tracking - bytes in use while a measurement is running, and the peak
+ ***/
+#if defined(__GLIBC__)
+
+#include <malloc.h>
+
+#define HEAP_TRACKING
+
+extern "C" {
+  void *__libc_malloc(size_t size);
+  void *__libc_calloc(size_t count, size_t size);
+  void *__libc_realloc(void *pointer, size_t size);
+  void __libc_free(void *pointer);
+}
+
+static std::atomic<bool> tracking(false);
+static std::atomic<long> heapInUse(0);
+static std::atomic<long> heapPeak(0);
+
+static void trackAllocation(void *pointer) {
+  if (!tracking || pointer == NULL) return;
+  long inUse = heapInUse += malloc_usable_size(pointer);
+  long peak = heapPeak;
+  while (inUse > peak && !heapPeak.compare_exchange_weak(peak, inUse)) {}
+}
+
+static void trackRelease(void *pointer) {
+  if (tracking && pointer != NULL) heapInUse -= malloc_usable_size(pointer);
+}
+
+extern "C" {
+
+  void *malloc(size_t size) {
+    void *pointer = __libc_malloc(size);
+    trackAllocation(pointer);
+    return pointer;
+  }
+
+  void *calloc(size_t count, size_t size) {
+    void *pointer = __libc_calloc(count, size);
+    trackAllocation(pointer);
+    return pointer;
+  }
+
+  void *realloc(void *pointer, size_t size) {
+    trackRelease(pointer);
+    void *resized = __libc_realloc(pointer, size);
+    trackAllocation(resized != NULL ? resized : (size ? pointer : NULL));
+    return resized;
+  }
+
+  void free(void *pointer) {
+    trackRelease(pointer);
+    __libc_free(pointer);
+  }
+
+}
+
+#endif
+
+
+class HeapMeasurement {
+
+  public:
+
+    HeapMeasurement() {
+      #ifdef HEAP_TRACKING
+        heapInUse = 0;
+        heapPeak = 0;
+        tracking = true;
+      #endif
+    }
+
+    ~HeapMeasurement() { stop(); }
+
+    void stop() {
+      #ifdef HEAP_TRACKING
+        tracking = false;
+      #endif
+    }
+
+    long peak() {
+      #ifdef HEAP_TRACKING
+        return heapPeak;
+      #else
+        return 0;
+      #endif
+    }
+
+};
+
+
+// Well above the reader buffer, one member and the host File, far below the file sizes used
+#define STREAM_PEAK_LIMIT (16 * 1024)
+
+
+
+
+class JsonStreamEnvironment : public ::testing::Environment {
+
+  public:
+
+    void SetUp() override {
+      char directory[] = "/tmp/diyfb_test_XXXXXX";
+      ASSERT_NE(mkdtemp(directory), (char *)NULL);
+      ASSERT_EQ(chdir(directory), 0);
+      HAL::serialCapture(true);
+      ASSERT_EQ(mkdir("native_fs", 0755), 0);
+      ASSERT_EQ(mkdir("native_fs/littlefs", 0755), 0);
+      ASSERT_TRUE(Storage::begin());
+    }
+
+};
+
+
+static void writeFile(const char *path, const String &content) {
+
+  File file = Storage::fs().open(path, FILE_WRITE);
+  ASSERT_TRUE(file);
+  file.print(content);
+  file.close();
+  Storage::indexFile(path);
+
+}
+
+
+// MAF style table: {"units":"KG_H","0":0.00,"1":0.25,...}, written in pieces so the text is never held whole
+static size_t writeTable(const char *path, int rows) {
+
+  File file = Storage::fs().open(path, FILE_WRITE);
+  file.print("{\n  \"units\": \"KG_H\"");
+  char member[48];
+  for (int row = 0; row < rows; row++) {
+    snprintf(member, sizeof(member), ",\n  \"%d\": %.2f", row, row * 0.25);
+    file.print(member);
+  }
+  file.print("\n}\n");
+  size_t size = file.size();
+  file.close();
+  Storage::indexFile(path);
+  return size;
+
+}
+
+
+struct TableSum {
+  int rows;
+  double flow;
+  String units;
+};
+
+
+static bool sumTable(const char *key, JsonVariantConst value, void *context) {
+
+  TableSum *sum = (TableSum *)context;
+  if (strcmp(key, "units") == 0) {
+    sum->units = value.as<const char *>();
+  } else {
+    sum->rows++;
+    sum->flow += value.as<double>();
+  }
+  return true;
+
+}
+
+
+
+
+TEST(JsonStream, ForEachWalksLargeTablesInBoundedMemory) {
+
+  const int smallRows = 1000;
+  const int largeRows = 200000;
+
+  writeTable("/small.json", smallRows);
+  size_t largeSize = writeTable("/large.json", largeRows);
+  ASSERT_GT(largeSize, (size_t)ESP.getFreeHeap() * 10);
+
+  TableSum small = {0, 0.0, ""};
+  HeapMeasurement smallHeap;
+  EXPECT_EQ(JsonStream::forEach("/small.json", NULL, sumTable, &small), smallRows + 1);
+  smallHeap.stop();
+
+  TableSum large = {0, 0.0, ""};
+  HeapMeasurement largeHeap;
+  EXPECT_EQ(JsonStream::forEach("/large.json", NULL, sumTable, &large), largeRows + 1);
+  largeHeap.stop();
+
+  EXPECT_EQ(large.rows, largeRows);
+  EXPECT_STREQ(large.units.c_str(), "KG_H");
+  EXPECT_NEAR(large.flow, 0.25 * largeRows * (largeRows - 1) / 2.0, 1.0);
+
+  #ifdef HEAP_TRACKING
+    EXPECT_LT(largeHeap.peak(), STREAM_PEAK_LIMIT);
+    // Memory does not grow with the file
+    EXPECT_LT(largeHeap.peak() - smallHeap.peak(), 1024);
+  #endif
+
+}
+
+TEST(JsonStream, FilteredLoadKeepsOnlyWantedKeys) {
+
+  File file = Storage::fs().open("/language.json", FILE_WRITE);
+  file.print("{\"language\":\"English\",\"version\":3,\"strings\":{");
+  for (int i = 0; i < 20000; i++) {
+    if (i) file.print(",");
+    file.printf("\"LANG_%05d\":\"Translated text for string number %d\"", i, i);
+  }
+  file.print("}}");
+  file.close();
+  Storage::indexFile("/language.json");
+
+  JsonDocument doc;
+  EXPECT_EQ(JsonStream::load("/language.json", doc), DeserializationError::NoMemory);
+
+  JsonDocument filter;
+  filter["language"] = true;
+  filter["version"] = true;
+
+  HeapMeasurement heap;
+  DeserializationError error = JsonStream::load("/language.json", doc, &filter);
+  heap.stop();
+
+  ASSERT_EQ(error, DeserializationError::Ok);
+  EXPECT_STREQ(doc["language"].as<const char *>(), "English");
+  EXPECT_EQ(doc["version"].as<int>(), 3);
+  EXPECT_TRUE(doc["strings"].isNull());
+
+  #ifdef HEAP_TRACKING
+    EXPECT_LT(heap.peak(), STREAM_PEAK_LIMIT);
+  #endif
+
+}
+
+TEST(JsonStream, SmallFilesLoadWithoutFilter) {
+
+  writeFile("/pins.json", "{\"MAF\": 36, \"SDA\": 21, \"NAME\": \"ESP32DEVKITC\"}");
+
+  JsonDocument doc;
+  ASSERT_EQ(JsonStream::load("/pins.json", doc), DeserializationError::Ok);
+  EXPECT_EQ(doc["MAF"].as<int>(), 36);
+  EXPECT_STREQ(doc["NAME"].as<const char *>(), "ESP32DEVKITC");
+
+  EXPECT_EQ(JsonStream::load("/missing.json", doc), DeserializationError::EmptyInput);
+
+}
+
+
+struct Collected {
+  int count;
+  String keys;
+  String values;
+};
+
+
+static bool collect(const char *key, JsonVariantConst value, void *context) {
+
+  Collected *collected = (Collected *)context;
+  collected->count++;
+  if (key != NULL) collected->keys += String(key) + "|";
+  String text;
+  serializeJson(value, text);
+  collected->values += text + "|";
+  return true;
+
+}
+
+
+static bool stopAfterTwo(const char *key, JsonVariantConst value, void *context) {
+
+  return ++((Collected *)context)->count < 2;
+
+}
+
+
+
+
+TEST(JsonStream, ForEachHandlesEveryValueShape) {
+
+  writeFile("/shapes.json",
+    "{ \"skipped\" : {\"a\": [1, {\"b\": \"}]\"}]},\n"
+    "  \"values\" :\t{\n"
+    "    \"neg\": -1.5e-3,\n"
+    "    \"quote\\\"d\": \"brace } and \\\" quote\",\n"
+    "    \"flag\": true, \"none\": null,\n"
+    "    \"list\": [1, [2, 3], {\"x\": \"]\"}],\n"
+    "    \"last\":0}\n"
+    "}");
+
+  Collected collected = {0, "", ""};
+  EXPECT_EQ(JsonStream::forEach("/shapes.json", "values", collect, &collected), 6);
+
+  EXPECT_STREQ(collected.keys.c_str(), "neg|quote\"d|flag|none|list|last|");
+  EXPECT_STREQ(collected.values.c_str(), "-0.0015|\"brace } and \\\" quote\"|true|null|[1,[2,3],{\"x\":\"]\"}]|0|");
+
+}
+
+TEST(JsonStream, ForEachWalksArraysWithAMemberFilter) {
+
+  writeFile("/runs.json",
+    "{\"runs\": ["
+    "{\"name\": \"Stock\", \"notes\": \"long text that is not wanted\", \"flow\": [1, 2]},"
+    "{\"name\": \"Ported\", \"notes\": \"more unwanted text\", \"flow\": [3, 4]}"
+    "]}");
+
+  JsonDocument filter;
+  filter["name"] = true;
+
+  Collected collected = {0, "", ""};
+  EXPECT_EQ(JsonStream::forEach("/runs.json", "runs", collect, &collected, &filter), 2);
+
+  EXPECT_STREQ(collected.keys.c_str(), "");
+  EXPECT_STREQ(collected.values.c_str(), "{\"name\":\"Stock\"}|{\"name\":\"Ported\"}|");
+
+}
+
+TEST(JsonStream, CallbackCanStopEarly) {
+
+  writeFile("/list.json", "[10, 20, 30, 40]");
+
+  Collected collected = {0, "", ""};
+  EXPECT_EQ(JsonStream::forEach("/list.json", NULL, stopAfterTwo, &collected), 2);
+  EXPECT_EQ(collected.count, 2);
+
+}
+
+TEST(JsonStream, MalformedFilesAreReported) {
+
+  Collected collected = {0, "", ""};
+
+  writeFile("/empty.json", "{ }");
+  EXPECT_EQ(JsonStream::forEach("/empty.json", NULL, collect, &collected), 0);
+
+  EXPECT_EQ(JsonStream::forEach("/missing.json", NULL, collect, &collected), -1);
+  EXPECT_EQ(JsonStream::forEach("/empty.json", "absent", collect, &collected), -1);
+
+  writeFile("/truncated.json", "{\"a\": 1, \"b\": [2, 3");
+  EXPECT_EQ(JsonStream::forEach("/truncated.json", NULL, collect, &collected), -1);
+
+  writeFile("/nodelimiter.json", "{\"a\": 1 \"b\": 2}");
+  EXPECT_EQ(JsonStream::forEach("/nodelimiter.json", NULL, collect, &collected), -1);
+
+  // A single member larger than the value buffer is refused rather than truncated
+  String oversized = "{\"a\": \"";
+  for (int i = 0; i < JSON_STREAM_VALUE_LENGTH; i++) oversized += 'x';
+  oversized += "\"}";
+  writeFile("/oversized.json", oversized);
+  EXPECT_EQ(JsonStream::forEach("/oversized.json", NULL, collect, &collected), -1);
+
+  // Members before the fault have already been passed on
+  EXPECT_EQ(collected.count, 2);
+
+}
+
+
+
+
+int main(int argc, char **argv) {
+
+  ::testing::InitGoogleTest(&argc, argv);
+  ::testing::AddGlobalTestEnvironment(new JsonStreamEnvironment());
+
+  return RUN_ALL_TESTS();
+
+}
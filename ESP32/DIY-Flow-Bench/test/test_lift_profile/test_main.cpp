@@ -0,0 +1,233 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file test_main.cpp
+ *
+ * @brief Host tests for the N-point, multi-run lift profile store
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * Profile blobs round tripped directly and through the (in-memory) NVS, and the 12 point LIFTDATA keys
+ * migrated into run 1.
+ *
+ *   pio test -e native -f test_lift_profile
+ *
+ ***/
+#include <gtest/gtest.h>
+
+#include <Arduino.h>
+#include <Preferences.h>
+
+#include "constants.h"
+#include "system.h"
+#include "structs.h"
+
+#include "datahandler.h"
+
+
+extern struct ValveLiftData valveData;
+
+
+static LiftProfile makeProfile(const char *name, uint8_t port, uint8_t points) {
+
+  LiftProfile profile;
+  strlcpy(profile.name, name, sizeof(profile.name));
+  profile.port = port;
+  profile.pointCount = points;
+  for (int i = 0; i < points; i++) profile.flow[i] = 12.5f * (i + 1) + 0.125f;
+  return profile;
+
+}
+
+
+static void expectSameProfile(const LiftProfile &actual, const LiftProfile &expected) {
+
+  EXPECT_STREQ(actual.name, expected.name);
+  EXPECT_EQ(actual.port, expected.port);
+  ASSERT_EQ(actual.pointCount, expected.pointCount);
+  for (int i = 0; i < LIFT_PROFILE_MAX_POINTS; i++) {
+    EXPECT_EQ(actual.flow[i], i < expected.pointCount ? expected.flow[i] : 0.0f) << "point " << i;
+  }
+
+}
+
+
+class LiftProfileStore : public ::testing::Test {
+
+  protected:
+
+    DataHandler data;
+    uint8_t blob[LIFT_PROFILE_BLOB_SIZE + 8];
+
+    void SetUp() override {
+      HAL::serialCapture(true);
+      HAL::nvsClear();
+      valveData = ValveLiftData();
+    }
+
+};
+
+
+
+
+TEST_F(LiftProfileStore, BlobRoundTripsForEveryPointCount) {
+
+  for (uint8_t points = 1; points <= LIFT_PROFILE_MAX_POINTS; points++) {
+
+    LiftProfile profile = makeProfile("Ported exhaust", LIFT_PORT_EXHAUST, points);
+    size_t length = data.serialiseLiftProfile(profile, blob, sizeof(blob));
+
+    // Only the points in use are stored
+    ASSERT_EQ(length, LIFT_PROFILE_BLOB_HEADER + points * sizeof(float));
+
+    LiftProfile loaded;
+    ASSERT_TRUE(data.deserialiseLiftProfile(blob, length, loaded));
+    expectSameProfile(loaded, profile);
+  }
+
+}
+
+TEST_F(LiftProfileStore, FullLengthNameIsTerminated) {
+
+  LiftProfile profile = makeProfile("", LIFT_PORT_INTAKE, 12);
+  memset(profile.name, 'x', sizeof(profile.name));
+
+  size_t length = data.serialiseLiftProfile(profile, blob, sizeof(blob));
+
+  LiftProfile loaded;
+  ASSERT_TRUE(data.deserialiseLiftProfile(blob, length, loaded));
+  EXPECT_EQ(strlen(loaded.name), (size_t)LIFT_PROFILE_NAME_LENGTH - 1);
+
+}
+
+TEST_F(LiftProfileStore, SmallBufferIsRefused) {
+
+  LiftProfile profile = makeProfile("Run", LIFT_PORT_INTAKE, 12);
+
+  EXPECT_EQ(data.serialiseLiftProfile(profile, blob, LIFT_PROFILE_BLOB_HEADER + 11 * sizeof(float)), 0u);
+
+}
+
+TEST_F(LiftProfileStore, InvalidBlobsAreRejected) {
+
+  LiftProfile profile = makeProfile("Run", LIFT_PORT_INTAKE, 12);
+  size_t length = data.serialiseLiftProfile(profile, blob, sizeof(blob));
+  LiftProfile loaded = makeProfile("Untouched", LIFT_PORT_EXHAUST, 3);
+
+  EXPECT_FALSE(data.deserialiseLiftProfile(blob, length - 1, loaded));
+  EXPECT_FALSE(data.deserialiseLiftProfile(blob, length + 4, loaded));
+  EXPECT_FALSE(data.deserialiseLiftProfile(blob, LIFT_PROFILE_BLOB_HEADER - 1, loaded));
+
+  blob[0] = LIFT_PROFILE_BLOB_VERSION + 1;
+  EXPECT_FALSE(data.deserialiseLiftProfile(blob, length, loaded));
+  blob[0] = LIFT_PROFILE_BLOB_VERSION;
+
+  blob[2] = 0;
+  EXPECT_FALSE(data.deserialiseLiftProfile(blob, LIFT_PROFILE_BLOB_HEADER, loaded));
+  blob[2] = LIFT_PROFILE_MAX_POINTS + 1;
+  EXPECT_FALSE(data.deserialiseLiftProfile(blob, LIFT_PROFILE_BLOB_HEADER + (LIFT_PROFILE_MAX_POINTS + 1) * sizeof(float), loaded));
+
+  // A rejected blob leaves the profile alone
+  EXPECT_STREQ(loaded.name, "Untouched");
+
+}
+
+TEST_F(LiftProfileStore, RunsRoundTripThroughNVS) {
+
+  LiftProfile runs[LIFT_PROFILE_MAX_RUNS];
+  for (int run = 0; run < LIFT_PROFILE_MAX_RUNS; run++) {
+    char name[16];
+    snprintf(name, sizeof(name), "Head %d", run);
+    runs[run] = makeProfile(name, run % 2, 6 + run * 6);
+    valveData.run[run] = runs[run];
+  }
+  valveData.activeRun = 2;
+
+  for (int run = 0; run < LIFT_PROFILE_MAX_RUNS; run++) data.saveLiftProfile(run);
+
+  valveData = ValveLiftData();
+  data.loadLiftData();
+
+  EXPECT_EQ(valveData.activeRun, 2);
+  for (int run = 0; run < LIFT_PROFILE_MAX_RUNS; run++) {
+    SCOPED_TRACE(run);
+    expectSameProfile(valveData.run[run], runs[run]);
+  }
+
+}
+
+TEST_F(LiftProfileStore, MissingOrCorruptRunsLoadAsDefaults) {
+
+  valveData.run[0] = makeProfile("Stock", LIFT_PORT_INTAKE, 12);
+  data.saveLiftProfile(0);
+
+  Preferences prefs;
+  prefs.begin("liftData");
+  uint8_t junk[7] = {LIFT_PROFILE_BLOB_VERSION, 0, 12, 0, 'x', 'y', 'z'};
+  prefs.putBytes("RUN1", junk, sizeof(junk));
+  prefs.end();
+
+  valveData = ValveLiftData();
+  data.loadLiftData();
+
+  EXPECT_STREQ(valveData.run[0].name, "Stock");
+  EXPECT_STREQ(valveData.run[1].name, "Run 2");
+  EXPECT_EQ(valveData.run[1].pointCount, LIFT_PROFILE_DEFAULT_POINTS);
+  EXPECT_EQ(valveData.run[1].flow[0], 0.0f);
+  EXPECT_STREQ(valveData.run[3].name, "Run 4");
+
+}
+
+TEST_F(LiftProfileStore, LegacyKeysAreMigratedIntoRunOne) {
+
+  Preferences prefs;
+  prefs.begin("liftData");
+  char key[16];
+  for (int point = 1; point <= 12; point++) {
+    snprintf(key, sizeof(key), "LIFTDATA%d", point);
+    prefs.putDouble(key, point * 10.0 + 0.5);
+  }
+  prefs.end();
+
+  data.initialiseLiftData();
+  data.loadLiftData();
+
+  EXPECT_STREQ(valveData.run[0].name, "Run 1");
+  ASSERT_EQ(valveData.run[0].pointCount, 12);
+  for (int point = 0; point < 12; point++) {
+    EXPECT_EQ(valveData.run[0].flow[point], (float)((point + 1) * 10.0 + 0.5));
+  }
+
+  prefs.begin("liftData", true);
+  EXPECT_TRUE(prefs.isKey("RUN0"));
+  EXPECT_FALSE(prefs.isKey("LIFTDATA1"));
+  EXPECT_FALSE(prefs.isKey("LIFTDATA12"));
+  prefs.end();
+
+  // Running it again does not overwrite the migrated run
+  valveData.run[0].flow[0] = 99.0f;
+  data.saveLiftProfile(0);
+  data.initialiseLiftData();
+  data.loadLiftData();
+  EXPECT_EQ(valveData.run[0].flow[0], 99.0f);
+
+}
+
+
+
+
+int main(int argc, char **argv) {
+
+  ::testing::InitGoogleTest(&argc, argv);
+
+  return RUN_ALL_TESTS();
+
+}
@@ -0,0 +1,312 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file test_main.cpp
+ *
+ * @brief Host tests for the deferred log pipeline
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * Deferred formatting is checked against vsnprintf() for each argument class. Several threads then
+ * log at once into the small ring, and every line that reaches the UART must be whole and in order
+ * for its producer, with the rest accounted for as dropped.
+ *
+ *   pio test -e native -f test_logger
+ *
+ ***/
+#include <gtest/gtest.h>
+#include <chrono>
+#include <stdarg.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+#include "constants.h"
+#include "system.h"
+#include "structs.h"
+
+#include "logger.h"
+#include "messages.h"
+
+
+#define PRODUCER_COUNT 4
+#define PRODUCER_MESSAGES 3000
+
+
+static bool logf(uint8_t level, const char *format, ...) {
+
+  va_list args;
+  va_start(args, format);
+  bool queued = Logger::write(level, format, args);
+  va_end(args);
+  return queued;
+
+}
+
+
+static std::string drained() {
+
+  EXPECT_TRUE(Logger::flush(2000));
+  return HAL::serialOutput();
+
+}
+
+
+static std::vector<std::string> splitLines(const std::string &text) {
+
+  std::vector<std::string> lines;
+  size_t start = 0;
+  size_t end;
+  while ((end = text.find('\n', start)) != std::string::npos) {
+    lines.push_back(text.substr(start, end - start));
+    start = end + 1;
+  }
+  return lines;
+
+}
+
+
+// Queue a message and compare what the drain task writes with vsnprintf() of the same arguments
+#define EXPECT_LOGGED(...) do { \
+    char expected[LOG_LINE_LENGTH]; \
+    snprintf(expected, sizeof(expected), __VA_ARGS__); \
+    HAL::serialOutput(); \
+    EXPECT_TRUE(logf(LOG_LEVEL_SERIAL, __VA_ARGS__)); \
+    EXPECT_EQ(drained(), std::string(expected)) << #__VA_ARGS__; \
+  } while (0)
+
+
+class LoggerTest : public ::testing::Test {
+
+  protected:
+
+    static void SetUpTestSuite() {
+      Logger::begin();
+    }
+
+    void SetUp() override {
+      drained();
+    }
+
+};
+
+
+
+
+// Runs first - before begin() there is no drain task and messages are written in the caller
+TEST(LoggerBoot, WritesDirectlyBeforeBegin) {
+
+  HAL::serialCapture(true);
+  HAL::serialOutput();
+
+  EXPECT_TRUE(logf(LOG_LEVEL_SERIAL, "boot %d %s\n", 1, "early"));
+  EXPECT_EQ(HAL::serialOutput(), "boot 1 early\n");
+
+  const char blob[] = "{\"blob\":true}\n";
+  EXPECT_EQ(Logger::writeDirect((const uint8_t *)blob, strlen(blob)), strlen(blob));
+  EXPECT_EQ(HAL::serialOutput(), blob);
+
+}
+
+TEST_F(LoggerTest, DeferredFormattingMatchesPrintf) {
+
+  int count;
+  long double pressure = 101.325L;
+
+  EXPECT_LOGGED("plain text\n");
+  EXPECT_LOGGED("%d %i %u %x %X %o %c|\n", -42, 7, 4000000000u, 0xbeef, 0xBEEF, 8, 'Z');
+  EXPECT_LOGGED("%hd %hhu %ld %lu %lld %llu\n", (short)-3, (unsigned char)250, -123456789L, 123456789UL, -9000000000LL, 18000000000ULL);
+  EXPECT_LOGGED("%zu %td %jd\n", (size_t)123456, (ptrdiff_t)-5, (intmax_t)-77);
+  EXPECT_LOGGED("%f %.2f %e %g %10.3f|%-8.1f|\n", 3.14159, -28.456, 1.5e-7, 0.0001, 2.5, 9.75);
+  EXPECT_LOGGED("%Lf %.1Lf\n", pressure, pressure);
+  EXPECT_LOGGED("%p %s %%\n", (void *)&count, "pointer");
+  EXPECT_LOGGED("%*d|%-*d|%.*f|%.*s|\n", 6, 42, 5, 7, 3, 1.23456, 4, "truncated");
+  EXPECT_LOGGED("%.3s|%10s|%-6s|%s\n", "abcdef", "right", "left", (const char *)"");
+  EXPECT_LOGGED("%+05d % d %#x %#o\n", 12, 34, 255, 8);
+  EXPECT_LOGGED("%.*s|\n", -1, "negative precision");
+
+  // %n consumes its argument and prints nothing
+  HAL::serialOutput();
+  logf(LOG_LEVEL_SERIAL, "%d%n|%s\n", 5, &count, "after");
+  EXPECT_EQ(drained(), "5|after\n");
+
+  HAL::serialOutput();
+  logf(LOG_LEVEL_SERIAL, "null %s\n", (const char *)NULL);
+  EXPECT_EQ(drained(), "null (null)\n");
+
+}
+
+TEST_F(LoggerTest, StringsAreCopiedWhenQueued) {
+
+  char buffer[32];
+  strcpy(buffer, "from the stack");
+
+  HAL::serialOutput();
+  EXPECT_TRUE(logf(LOG_LEVEL_DEBUG, "%s %d\n", buffer, 1));
+  strcpy(buffer, "overwritten");
+
+  EXPECT_EQ(drained(), "from the stack 1\n");
+
+}
+
+TEST_F(LoggerTest, ArgumentsThatDoNotFitAreCut) {
+
+  std::string text(LOG_RECORD_SIZE * 2, 'x');
+
+  HAL::serialOutput();
+  logf(LOG_LEVEL_SERIAL, "long %s end %d\n", text.c_str(), 99);
+
+  std::string line = drained();
+  ASSERT_GT(line.size(), 10u);
+  EXPECT_EQ(line.compare(0, 5, "long "), 0);
+  EXPECT_EQ(line.substr(line.size() - 4), "...\n");
+  EXPECT_LT(line.size(), (size_t)LOG_RECORD_SIZE);
+  EXPECT_EQ(line.find("99"), std::string::npos);
+
+  // Numbers after a string that fits are kept
+  EXPECT_LOGGED("%s %d %f\n", std::string(40, 'y').c_str(), 7, 2.5);
+
+}
+
+TEST_F(LoggerTest, ConcurrentProducersKeepTheirOrder) {
+
+  uint32_t droppedBefore = Logger::dropped();
+  HAL::serialOutput();
+
+  std::vector<std::thread> producers;
+  for (int producer = 0; producer < PRODUCER_COUNT; producer++) {
+    producers.push_back(std::thread([producer]() {
+      for (int message = 0; message < PRODUCER_MESSAGES; message++) {
+        logf(LOG_LEVEL_VERBOSE, "P%d M%05d %s\n", producer, message, "0123456789abcdef");
+        if (message % 100 == 99) std::this_thread::yield();
+      }
+    }));
+  }
+  for (auto &thread : producers) thread.join();
+
+  std::string output = drained();
+  uint32_t dropped = Logger::dropped() - droppedBefore;
+
+  // The drop report follows the drain pass that finds the count changed
+  uint32_t reported = 0;
+  for (int wait = 0; wait < 100; wait++) {
+    std::vector<std::string> lines = splitLines(output);
+    reported = 0;
+    for (const std::string &line : lines) {
+      unsigned count;
+      if (sscanf(line.c_str(), "!! %u log messages dropped !!", &count) == 1) reported += count;
+    }
+    if (reported == dropped) break;
+    delay(LOG_DRAIN_INTERVAL_MS);
+    output += HAL::serialOutput();
+  }
+  EXPECT_EQ(reported, dropped);
+
+  int received[PRODUCER_COUNT] = {0};
+  int next[PRODUCER_COUNT] = {0};
+
+  for (const std::string &line : splitLines(output)) {
+    if (line.compare(0, 3, "!! ") == 0) continue;
+    int producer;
+    int message;
+    char suffix[32];
+    ASSERT_EQ(sscanf(line.c_str(), "P%d M%d %31s", &producer, &message, suffix), 3) << line;
+    ASSERT_GE(producer, 0);
+    ASSERT_LT(producer, PRODUCER_COUNT);
+    EXPECT_STREQ(suffix, "0123456789abcdef") << line;
+    EXPECT_GE(message, next[producer]) << line;
+    next[producer] = message + 1;
+    received[producer]++;
+  }
+
+  int total = 0;
+  for (int producer = 0; producer < PRODUCER_COUNT; producer++) total += received[producer];
+
+  EXPECT_EQ(total + dropped, (uint32_t)(PRODUCER_COUNT * PRODUCER_MESSAGES));
+  EXPECT_GE(total, LOG_RING_SIZE);
+
+}
+
+TEST_F(LoggerTest, DirectWritesFollowQueuedMessages) {
+
+  HAL::serialOutput();
+
+  for (int i = 0; i < 20; i++) logf(LOG_LEVEL_STATUS, "queued %d\n", i);
+  const char reply[] = "V:reply\n";
+  Logger::writeDirect((const uint8_t *)reply, strlen(reply));
+
+  std::vector<std::string> lines = splitLines(HAL::serialOutput());
+  ASSERT_EQ(lines.size(), 21u);
+  for (int i = 0; i < 20; i++) EXPECT_EQ(lines[i], "queued " + std::to_string(i));
+  EXPECT_EQ(lines[20], "V:reply");
+
+}
+
+TEST_F(LoggerTest, TailKeepsTheLastLines) {
+
+  const char *levelName[LOG_LEVEL_COUNT] = {"INFO", "DEBUG", "VERBOSE", "STATUS"};
+
+  for (int i = 0; i < LOG_TAIL_LINES + 5; i++) logf(i % LOG_LEVEL_COUNT, "tail %d\r\n", i);
+  drained();
+
+  JsonDocument tail;
+  ASSERT_FALSE(deserializeJson(tail, Logger::getTailJSON()));
+
+  EXPECT_EQ(tail["DROPPED"].as<uint32_t>(), Logger::dropped());
+  ASSERT_EQ(tail["LINES"].size(), (size_t)LOG_TAIL_LINES);
+
+  uint32_t previous = 0;
+  for (int i = 0; i < LOG_TAIL_LINES; i++) {
+    JsonObject line = tail["LINES"][i];
+    int message = i + 5;
+    EXPECT_STREQ(line["TEXT"].as<String>().c_str(), ("tail " + std::to_string(message)).c_str());
+    EXPECT_STREQ(line["LEVEL"].as<String>().c_str(), levelName[message % LOG_LEVEL_COUNT]);
+    EXPECT_GT(line["SEQ"].as<uint32_t>(), previous);
+    EXPECT_LE(line["TIME"].as<uint32_t>(), millis());
+    previous = line["SEQ"].as<uint32_t>();
+  }
+
+}
+
+TEST_F(LoggerTest, MessagesPrintfLevelsFollowTheSettings) {
+
+  extern struct BenchSettings settings;
+  Messages _message;
+
+  settings.debug_mode = false;
+  settings.verbose_print_mode = true;
+  settings.status_print_mode = false;
+
+  HAL::serialOutput();
+  _message.serialPrintf("serial %d\n", 1);
+  _message.debugPrintf("debug %d\n", 2);
+  _message.verbosePrintf("verbose %d\n", 3);
+  _message.statusPrintf("status %d\n", 4);
+
+  EXPECT_EQ(drained(), "serial 1\nverbose 3\n");
+
+  settings.verbose_print_mode = false;
+
+}
+
+
+
+
+int main(int argc, char **argv) {
+
+  ::testing::InitGoogleTest(&argc, argv);
+
+  return RUN_ALL_TESTS();
+
+}
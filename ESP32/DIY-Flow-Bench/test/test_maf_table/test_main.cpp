@@ -0,0 +1,262 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file test_main.cpp
+ *
+ * @brief Host tests for the user MAF transfer table
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * The shipped tools/mafData.json is loaded and checked point by point and between points, and a
+ * table sampled from a known smooth curve checks interpolation accuracy. Unit variants, unsorted and
+ * invalid files are covered too.
+ *
+ *   pio test -e native -f test_maf_table
+ *
+ ***/
+#include <gtest/gtest.h>
+#include <map>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <Arduino.h>
+
+#include "constants.h"
+#include "system.h"
+#include "structs.h"
+
+#include "maftable.h"
+#include "storage.h"
+
+
+// tools/mafData.json as read before the tests change directory
+static String shippedTable;
+
+
+class MafTableEnvironment : public ::testing::Environment {
+
+  public:
+
+    void SetUp() override {
+
+      String path = String(__FILE__);
+      path = path.substring(0, path.lastIndexOf('/')) + "/../../tools/mafData.json";
+      FILE *file = fopen(path.c_str(), "rb");
+      ASSERT_NE(file, (FILE *)NULL) << path.c_str();
+      int value;
+      while ((value = fgetc(file)) != EOF) shippedTable += (char)value;
+      fclose(file);
+
+      char directory[] = "/tmp/diyfb_test_XXXXXX";
+      ASSERT_NE(mkdtemp(directory), (char *)NULL);
+      ASSERT_EQ(chdir(directory), 0);
+      HAL::serialCapture(true);
+      ASSERT_EQ(mkdir("native_fs", 0755), 0);
+      ASSERT_EQ(mkdir("native_fs/littlefs", 0755), 0);
+      ASSERT_TRUE(Storage::begin());
+    }
+
+};
+
+
+static void writeFile(const char *path, const String &content) {
+
+  File file = Storage::fs().open(path, FILE_WRITE);
+  ASSERT_TRUE(file);
+  file.print(content);
+  file.close();
+  Storage::indexFile(path);
+
+}
+
+
+// Smooth, monotone reference curve (King's law shape) in kg/h
+static double referenceFlow(double milliVolts) {
+
+  double volts = milliVolts / 1000.0;
+  return 4.0 * pow(volts * volts - 1.0, 2);
+
+}
+
+
+class MafTableTest : public ::testing::Test {
+
+  protected:
+
+    void TearDown() override {
+      MafTable::clear();
+    }
+
+    // Points as the firmware stores them, keys rounded to whole millivolts
+    std::map<uint16_t, float> shippedPoints() {
+      std::map<uint16_t, float> points;
+      const char *text = shippedTable.c_str();
+      while ((text = strchr(text, '"')) != NULL) {
+        char *end;
+        double milliVolts = strtod(text + 1, &end);
+        text = strchr(end, ':') + 1;
+        points[(uint16_t)(milliVolts + 0.5)] = strtod(text, NULL);
+      }
+      return points;
+    }
+
+};
+
+
+
+
+TEST_F(MafTableTest, ShippedTableHitsEveryPoint) {
+
+  writeFile("/mafdata.json", shippedTable);
+
+  std::map<uint16_t, float> points = shippedPoints();
+  ASSERT_EQ(MafTable::load("/mafdata.json"), (int)points.size());
+
+  EXPECT_TRUE(MafTable::isLoaded());
+  EXPECT_EQ(MafTable::maxMilliVolts(), points.rbegin()->first);
+
+  for (auto &point : points) {
+    EXPECT_NEAR(MafTable::getFlow(point.first), point.second, point.second * 1e-5) << point.first << " mV";
+  }
+
+}
+
+TEST_F(MafTableTest, ShippedTableIsMonotoneWithoutOvershoot) {
+
+  writeFile("/mafdata.json", shippedTable);
+  ASSERT_GT(MafTable::load("/mafdata.json"), 0);
+
+  std::map<uint16_t, float> points = shippedPoints();
+  auto low = points.begin();
+  auto high = std::next(low);
+  float previous = MafTable::getFlow(low->first);
+
+  for (float milliVolts = low->first; high != points.end(); milliVolts += 0.5f) {
+    if (milliVolts >= high->first) {
+      low = high++;
+      if (high == points.end()) break;
+    }
+    float flow = MafTable::getFlow(milliVolts);
+    EXPECT_GE(flow, previous) << milliVolts << " mV";
+    EXPECT_GE(flow, low->second - 1e-3f) << milliVolts << " mV";
+    EXPECT_LE(flow, high->second + 1e-3f) << milliVolts << " mV";
+    previous = flow;
+  }
+
+}
+
+TEST_F(MafTableTest, InterpolationTracksASmoothCurve) {
+
+  // 17 points, 250 mV apart
+  String table = "{";
+  for (int milliVolts = 1000; milliVolts <= 5000; milliVolts += 250) {
+    if (milliVolts > 1000) table += ",";
+    table += "\"" + String(milliVolts) + "\":" + String(referenceFlow(milliVolts), 4);
+  }
+  table += "}";
+  writeFile("/smooth.json", table);
+  ASSERT_EQ(MafTable::load("/smooth.json"), 17);
+
+  double worst = 0.0;
+  for (int milliVolts = 1500; milliVolts <= 5000; milliVolts += 7) {
+    double expected = referenceFlow(milliVolts);
+    worst = std::max(worst, fabs(MafTable::getFlow(milliVolts) - expected) / expected);
+  }
+
+  EXPECT_LT(worst, 0.01);
+
+}
+
+TEST_F(MafTableTest, MilligramsPerSecondAreConvertedToKilogramsPerHour) {
+
+  writeFile("/kgh.json", "{\"units\":\"KG_H\",\"1000\":36,\"2000\":72,\"3000\":144}");
+  writeFile("/mgs.json", "{\"units\":\"MG_S\",\"1000\":10000,\"2000\":20000,\"3000\":40000}");
+
+  ASSERT_EQ(MafTable::load("/kgh.json"), 3);
+  float kilograms = MafTable::getFlow(2500);
+  EXPECT_FLOAT_EQ(MafTable::getFlow(2000), 72.0f);
+
+  ASSERT_EQ(MafTable::load("/mgs.json"), 3);
+  EXPECT_FLOAT_EQ(MafTable::getFlow(2000), 72.0f);
+  EXPECT_NEAR(MafTable::getFlow(2500), kilograms, 1e-3);
+
+}
+
+TEST_F(MafTableTest, UnsortedKeysAndDuplicatesAreResolved) {
+
+  writeFile("/unsorted.json", "{\"3000\":300,\"1000\":100,\"note\":\"ignored\",\"2000\":150,\"2000.2\":200}");
+
+  ASSERT_EQ(MafTable::load("/unsorted.json"), 3);
+  EXPECT_EQ(MafTable::maxMilliVolts(), 3000);
+  EXPECT_FLOAT_EQ(MafTable::getFlow(1000), 100.0f);
+  EXPECT_FLOAT_EQ(MafTable::getFlow(2000), 200.0f);
+  EXPECT_FLOAT_EQ(MafTable::getFlow(3000), 300.0f);
+
+}
+
+TEST_F(MafTableTest, EndsAreExtendedAndFlooredAtZero) {
+
+  writeFile("/linear.json", "{\"1000\":10,\"2000\":20,\"3000\":30}");
+  ASSERT_EQ(MafTable::load("/linear.json"), 3);
+
+  EXPECT_NEAR(MafTable::getFlow(3500), 35.0f, 1e-3);
+  EXPECT_NEAR(MafTable::getFlow(500), 5.0f, 1e-3);
+  EXPECT_EQ(MafTable::getFlow(0), 0.0f);
+
+}
+
+TEST_F(MafTableTest, InvalidFilesKeepTheCurrentTable) {
+
+  writeFile("/good.json", "{\"1000\":10,\"2000\":20}");
+  ASSERT_EQ(MafTable::load("/good.json"), 2);
+
+  writeFile("/single.json", "{\"1000\":10}");
+  writeFile("/text.json", "{\"1000\":10,\"2000\":\"twenty\"}");
+  writeFile("/negative.json", "{\"-5\":10,\"2000\":20}");
+  writeFile("/broken.json", "{\"1000\":10,\"2000\":");
+
+  String oversized = "{";
+  for (int row = 0; row <= MAF_TABLE_MAX_ROWS; row++) {
+    if (row) oversized += ",";
+    oversized += "\"" + String(row * 10) + "\":" + String(row);
+  }
+  oversized += "}";
+  writeFile("/oversized.json", oversized);
+
+  EXPECT_EQ(MafTable::load("/single.json"), -1);
+  EXPECT_EQ(MafTable::load("/text.json"), -1);
+  EXPECT_EQ(MafTable::load("/negative.json"), -1);
+  EXPECT_EQ(MafTable::load("/broken.json"), -1);
+  EXPECT_EQ(MafTable::load("/oversized.json"), -1);
+  EXPECT_EQ(MafTable::load("/missing.json"), -1);
+
+  EXPECT_EQ(MafTable::rows(), 2);
+  EXPECT_FLOAT_EQ(MafTable::getFlow(1500), 15.0f);
+
+  MafTable::clear();
+  EXPECT_FALSE(MafTable::isLoaded());
+  EXPECT_EQ(MafTable::getFlow(1500), 0.0f);
+  EXPECT_EQ(MafTable::maxMilliVolts(), 0);
+
+}
+
+
+
+
+int main(int argc, char **argv) {
+
+  ::testing::InitGoogleTest(&argc, argv);
+  ::testing::AddGlobalTestEnvironment(new MafTableEnvironment());
+
+  return RUN_ALL_TESTS();
+
+}
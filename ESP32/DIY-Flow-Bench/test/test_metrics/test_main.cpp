@@ -0,0 +1,235 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file test_main.cpp
+ *
+ * @brief Host tests for the Prometheus /metrics exposition
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * Histogram bucketing and the text format (0.0.4) line by line, plus the endpoint served by the web server.
+ *
+ *   pio test -e native -f test_metrics
+ *
+ ***/
+#include <gtest/gtest.h>
+#include <regex>
+#include <set>
+#include <sstream>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+
+#include "constants.h"
+#include "system.h"
+#include "structs.h"
+
+#include "metrics.h"
+#include "webserver.h"
+
+
+extern Webserver _webserver;
+
+
+static std::string sampleLine(const std::string &exposition, const std::string &name) {
+
+  std::istringstream lines(exposition);
+  std::string line;
+
+  while (std::getline(lines, line)) {
+    if (line.compare(0, name.size() + 1, name + " ") == 0) return line;
+  }
+
+  return "";
+
+}
+
+
+
+
+TEST(Metrics, HistogramBucketsAreCumulativeInSeconds) {
+
+  Metrics metrics;
+
+  for (uint32_t micros : {50u, 100u, 300u, 300u, 2000u, 200000u}) metrics.observeAcquisitionCycle(micros);
+
+  std::string exposition = metrics.buildExposition();
+
+  // 100us is on the boundary and belongs to le="0.0001"
+  EXPECT_EQ(sampleLine(exposition, "diyfb_acquisition_cycle_seconds_bucket{le=\"0.0001\"}"), "diyfb_acquisition_cycle_seconds_bucket{le=\"0.0001\"} 2");
+  EXPECT_EQ(sampleLine(exposition, "diyfb_acquisition_cycle_seconds_bucket{le=\"0.00025\"}"), "diyfb_acquisition_cycle_seconds_bucket{le=\"0.00025\"} 2");
+  EXPECT_EQ(sampleLine(exposition, "diyfb_acquisition_cycle_seconds_bucket{le=\"0.0005\"}"), "diyfb_acquisition_cycle_seconds_bucket{le=\"0.0005\"} 4");
+  EXPECT_EQ(sampleLine(exposition, "diyfb_acquisition_cycle_seconds_bucket{le=\"0.0025\"}"), "diyfb_acquisition_cycle_seconds_bucket{le=\"0.0025\"} 5");
+  EXPECT_EQ(sampleLine(exposition, "diyfb_acquisition_cycle_seconds_bucket{le=\"0.1\"}"), "diyfb_acquisition_cycle_seconds_bucket{le=\"0.1\"} 5");
+  EXPECT_EQ(sampleLine(exposition, "diyfb_acquisition_cycle_seconds_bucket{le=\"+Inf\"}"), "diyfb_acquisition_cycle_seconds_bucket{le=\"+Inf\"} 6");
+  EXPECT_EQ(sampleLine(exposition, "diyfb_acquisition_cycle_seconds_sum"), "diyfb_acquisition_cycle_seconds_sum 0.202750");
+  EXPECT_EQ(sampleLine(exposition, "diyfb_acquisition_cycle_seconds_count"), "diyfb_acquisition_cycle_seconds_count 6");
+
+}
+
+TEST(Metrics, EveryLineIsValidTextFormat) {
+
+  Metrics metrics;
+
+  metrics.observeI2C(120, true);
+  metrics.observeSSEBuild(800);
+  metrics.observeRequest("/api/data", 1500);
+  metrics.countCoalescedWrite();
+
+  std::string exposition = metrics.buildExposition();
+  ASSERT_EQ(exposition.size(), metrics.expositionSize());
+  ASSERT_EQ(exposition.back(), '\n');
+
+  const std::regex help("# HELP ([a-z0-9_]+) .+");
+  const std::regex type("# TYPE ([a-z0-9_]+) (counter|gauge|histogram|summary)");
+  const std::regex sample("([a-z0-9_]+)(\\{[a-z]+=\"[^\"]*\"\\})? (-?[0-9]+(\\.[0-9]+)?)");
+
+  std::set<std::string> described;
+  std::set<std::string> typed;
+  std::string family;
+  std::istringstream lines(exposition);
+  std::string line;
+  std::smatch match;
+
+  while (std::getline(lines, line)) {
+    if (std::regex_match(line, match, help)) {
+      EXPECT_TRUE(described.insert(match[1]).second) << "second HELP for " << match[1];
+      family = match[1];
+    } else if (std::regex_match(line, match, type)) {
+      EXPECT_EQ(match[1], family) << "TYPE without HELP";
+      EXPECT_TRUE(typed.insert(match[1]).second);
+    } else {
+      ASSERT_TRUE(std::regex_match(line, match, sample)) << "bad line: " << line;
+      EXPECT_EQ(std::string(match[1]).compare(0, family.size(), family), 0) << line << " is outside " << family;
+    }
+  }
+
+  EXPECT_EQ(sampleLine(exposition, "diyfb_i2c_errors_total"), "diyfb_i2c_errors_total 1");
+  EXPECT_EQ(sampleLine(exposition, "diyfb_flash_writes_coalesced_total"), "diyfb_flash_writes_coalesced_total 1");
+
+}
+
+TEST(Metrics, EndpointTableIsBounded) {
+
+  Metrics metrics;
+  char path[64];
+
+  for (int i = 0; i < METRICS_MAX_ENDPOINTS + 3; i++) {
+    snprintf(path, sizeof(path), "/path/%d", i);
+    metrics.observeRequest(path, 1000 + i);
+  }
+  metrics.observeRequest("/path/0", 5000);
+
+  std::string exposition = metrics.buildExposition();
+
+  EXPECT_EQ(sampleLine(exposition, "diyfb_http_request_duration_seconds_count{path=\"/path/0\"}"), "diyfb_http_request_duration_seconds_count{path=\"/path/0\"} 2");
+  EXPECT_EQ(sampleLine(exposition, "diyfb_http_request_duration_seconds_sum{path=\"/path/0\"}"), "diyfb_http_request_duration_seconds_sum{path=\"/path/0\"} 0.006000");
+  EXPECT_EQ(sampleLine(exposition, "diyfb_http_request_max_seconds{path=\"/path/0\"}"), "diyfb_http_request_max_seconds{path=\"/path/0\"} 0.005000");
+  EXPECT_EQ(exposition.find("path=\"/path/16\""), std::string::npos);
+  EXPECT_EQ(sampleLine(exposition, "diyfb_http_untracked_requests_total"), "diyfb_http_untracked_requests_total 3");
+
+}
+
+TEST(Metrics, LongPathsAreTruncatedNotOverrun) {
+
+  Metrics metrics;
+  std::string longPath = "/" + std::string(100, 'x');
+
+  metrics.observeRequest(longPath.c_str(), 100);
+  metrics.observeRequest(longPath.c_str(), 100);
+
+  std::string exposition = metrics.buildExposition();
+  std::string label = "path=\"" + longPath.substr(0, sizeof(MetricEndpoint().path) - 1) + "\"";
+
+  EXPECT_NE(exposition.find("diyfb_http_request_duration_seconds_count{" + label + "} 2"), std::string::npos);
+
+}
+
+TEST(Metrics, LabelValuesAreEscaped) {
+
+  Metrics metrics;
+
+  metrics.observeRequest("/a\"b\\c\nd", 100);
+
+  std::string exposition = metrics.buildExposition();
+
+  EXPECT_EQ(sampleLine(exposition, "diyfb_http_request_duration_seconds_count{path=\"/a\\\"b\\\\c\\nd\"}"), "diyfb_http_request_duration_seconds_count{path=\"/a\\\"b\\\\c\\nd\"} 1");
+  EXPECT_EQ(sampleLine(exposition, "diyfb_http_request_max_seconds{path=\"/a\\\"b\\\\c\\nd\"}"), "diyfb_http_request_max_seconds{path=\"/a\\\"b\\\\c\\nd\"} 0.000100");
+
+  // A label made up of characters that all need escaping still fits and is not cut mid escape
+  std::string quotes(31, '"');
+  metrics.observeRequest(quotes.c_str(), 100);
+  exposition = metrics.buildExposition();
+  std::string escaped;
+  for (int i = 0; i < 31; i++) escaped += "\\\"";
+  EXPECT_NE(exposition.find("{path=\"" + escaped + "\"} 1\n"), std::string::npos);
+
+}
+
+TEST(Metrics, EndpointIsServedWithTheTextFormatContentType) {
+
+  char directory[] = "/tmp/diyfb_test_XXXXXX";
+  ASSERT_NE(mkdtemp(directory), (char *)NULL);
+  ASSERT_EQ(chdir(directory), 0);
+  HAL::serialCapture(true);
+
+  _webserver.begin();
+  AsyncWebServer *server = AsyncWebServer::find(80);
+  ASSERT_NE(server, (AsyncWebServer *)NULL);
+
+  AsyncWebServerRequest first(HTTP_GET, "/metrics");
+  server->handle(&first);
+
+  // The first request is timed by the middleware and shows up in the second
+  AsyncWebServerRequest second(HTTP_GET, "/metrics");
+  AsyncWebServerResponse *response = server->handle(&second);
+
+  ASSERT_NE(response, (AsyncWebServerResponse *)NULL);
+  EXPECT_EQ(response->code(), 200);
+  EXPECT_EQ(response->contentType(), "text/plain; version=0.0.4");
+
+  String body = response->body();
+  EXPECT_TRUE(body.startsWith("# HELP diyfb_acquisition_cycle_seconds "));
+  EXPECT_NE(body.indexOf("diyfb_http_request_duration_seconds_count{path=\"/metrics\"} 1\n"), -1);
+
+  // Paths with no handler are counted, but do not take endpoint slots
+  char path[32];
+  for (int i = 0; i < METRICS_MAX_ENDPOINTS + 4; i++) {
+    snprintf(path, sizeof(path), "/probe/%d", i);
+    AsyncWebServerRequest probe(HTTP_GET, path);
+    AsyncWebServerResponse *notFound = server->handle(&probe);
+    ASSERT_NE(notFound, (AsyncWebServerResponse *)NULL);
+    EXPECT_EQ(notFound->code(), 404);
+  }
+
+  AsyncWebServerRequest third(HTTP_GET, "/metrics");
+  String exposition = server->handle(&third)->body();
+  EXPECT_EQ(exposition.indexOf("/probe/"), -1);
+  EXPECT_NE(exposition.indexOf("diyfb_http_unmatched_requests_total " + String(METRICS_MAX_ENDPOINTS + 4) + "\n"), -1);
+  EXPECT_NE(exposition.indexOf("diyfb_http_untracked_requests_total 0\n"), -1);
+
+  // A later scrape does not change a response that is still being sent
+  EXPECT_EQ(response->body(), body);
+
+}
+
+
+
+
+int main(int argc, char **argv) {
+
+  ::testing::InitGoogleTest(&argc, argv);
+
+  return RUN_ALL_TESTS();
+
+}
@@ -0,0 +1,407 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file test_main.cpp
+ *
+ * @brief Host tests for the Modbus TCP / RTU register server
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * A Modbus client stand-in connects to the TCP server over the in-process loopback and checks the
+ * register map decoded from the wire, MBAP framing and the exception responses. RTU frames are built
+ * around the same PDUs and checked against published CRC vectors.
+ *
+ *   pio test -e native -f test_modbus
+ *
+ ***/
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+#include <Arduino.h>
+#include <AsyncTCP.h>
+
+#include "constants.h"
+#include "system.h"
+#include "structs.h"
+
+#include "modbus.h"
+
+
+#define VAC_BANK_PIN 26
+
+
+extern struct SensorData sensorVal;
+extern struct DeviceStatus status;
+extern struct Pins pins;
+
+typedef std::vector<uint8_t> Bytes;
+
+
+class ModbusEnvironment : public ::testing::Environment {
+
+  public:
+
+    void SetUp() override {
+      HAL::serialCapture(true);
+      pins.VAC_BANK_1 = VAC_BANK_PIN;
+      Modbus::begin();
+    }
+
+};
+
+
+// Minimal Modbus TCP master over the loopback connection
+class ModbusClient {
+
+  public:
+
+    AsyncClient *connection;
+    uint16_t transaction = 0x1200;
+
+    ModbusClient() : connection(AsyncServer::connect(MODBUS_TCP_PORT)) {}
+
+    ~ModbusClient() {
+      if (AsyncClient::exists(connection)) connection->close();
+    }
+
+    bool open() {
+      return connection != NULL && AsyncClient::exists(connection) && connection->connected();
+    }
+
+    static Bytes adu(uint16_t transaction, uint8_t unit, const Bytes &pdu) {
+      Bytes frame = {(uint8_t)(transaction >> 8), (uint8_t)transaction, 0, 0, (uint8_t)((pdu.size() + 1) >> 8), (uint8_t)(pdu.size() + 1), unit};
+      frame.insert(frame.end(), pdu.begin(), pdu.end());
+      return frame;
+    }
+
+    void send(const Bytes &data) {
+      connection->receive(data.data(), data.size());
+    }
+
+    Bytes received() {
+      std::string sent = connection->sent();
+      return Bytes(sent.begin(), sent.end());
+    }
+
+    // Request PDU in, response PDU out, with the MBAP header checked on the way
+    Bytes request(const Bytes &pdu, uint8_t unit = 7) {
+      transaction++;
+      send(adu(transaction, unit, pdu));
+      Bytes response = received();
+      EXPECT_GE(response.size(), 9u);
+      if (response.size() < 9) return Bytes();
+      EXPECT_EQ((response[0] << 8) | response[1], transaction);
+      EXPECT_EQ((response[2] << 8) | response[3], 0);
+      EXPECT_EQ((size_t)((response[4] << 8) | response[5]), response.size() - 6);
+      EXPECT_EQ(response[6], unit);
+      return Bytes(response.begin() + 7, response.end());
+    }
+
+    // Register values from a read registers response
+    std::vector<uint16_t> readRegisters(uint8_t function, uint16_t address, uint16_t count) {
+      Bytes response = request({function, (uint8_t)(address >> 8), (uint8_t)address, (uint8_t)(count >> 8), (uint8_t)count});
+      std::vector<uint16_t> registers;
+      EXPECT_EQ(response.size(), 2u + count * 2);
+      if (response.size() != 2u + count * 2) return registers;
+      EXPECT_EQ(response[0], function);
+      EXPECT_EQ(response[1], count * 2);
+      for (uint16_t i = 0; i < count; i++) registers.push_back((response[2 + i * 2] << 8) | response[3 + i * 2]);
+      return registers;
+    }
+
+};
+
+
+static float registerFloat(const std::vector<uint16_t> &registers, int address) {
+
+  uint32_t bits = ((uint32_t)registers[address] << 16) | registers[address + 1];
+  float value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+
+}
+
+
+static void setBenchValues() {
+
+  sensorVal.FlowCFM = 152.25;
+  sensorVal.FlowSCFM = 148.5;
+  sensorVal.FlowADJ = 160.125;
+  sensorVal.FlowADJSCFM = 156.75;
+  sensorVal.FlowKGH = 281.5;
+  sensorVal.PRefKPA = -6.975;
+  sensorVal.PRefH2O = -28.0;
+  sensorVal.PDiffKPA = -0.5;
+  sensorVal.PDiffH2O = -2.0;
+  sensorVal.PitotKPA = 0.125;
+  sensorVal.PitotH2O = 0.5;
+  sensorVal.TempDegC = 21.5;
+  sensorVal.RelH = 45.25;
+  sensorVal.BaroHPA = 1013.25;
+  sensorVal.Swirl = 3.5;
+  sensorVal.MafVolts = 2.375;
+
+}
+
+
+static Bytes rtuFrame(uint8_t unit, const Bytes &pdu) {
+
+  Bytes frame = {unit};
+  frame.insert(frame.end(), pdu.begin(), pdu.end());
+  uint16_t crc = Modbus::crc16(frame.data(), frame.size());
+  frame.push_back(crc & 0xFF);
+  frame.push_back(crc >> 8);
+  return frame;
+
+}
+
+
+static Bytes processPDU(const Bytes &pdu) {
+
+  uint8_t response[260];
+  size_t length = Modbus::processPDU(pdu.data(), pdu.size(), response);
+  return Bytes(response, response + length);
+
+}
+
+
+
+
+TEST(Modbus, RegisterMapDecodesFromTheWire) {
+
+  setBenchValues();
+  HAL::setClock(3723000);
+  Modbus::publish();
+
+  ModbusClient client;
+  ASSERT_TRUE(client.open());
+
+  std::vector<uint16_t> registers = client.readRegisters(0x03, 0, MODBUS_REGISTER_COUNT);
+  ASSERT_EQ(registers.size(), (size_t)MODBUS_REGISTER_COUNT);
+
+  const double expected[] = {152.25, 148.5, 160.125, 156.75, 281.5, -6.975, -28.0, -0.5, -2.0, 0.125, 0.5, 21.5, 45.25, 1013.25, 3.5, 2.375};
+  for (int i = 0; i < 16; i++) {
+    EXPECT_FLOAT_EQ(registerFloat(registers, i * 2), (float)expected[i]) << "register " << i * 2;
+  }
+
+  // ABCD - high word first, big endian bytes
+  EXPECT_EQ(registers[0], 0x4318);
+  EXPECT_EQ(registers[1], 0x4000);
+
+  uint32_t uptime = ((uint32_t)registers[34] << 16) | registers[35];
+  EXPECT_EQ(uptime, 3723u);
+
+  // Input registers carry the same image
+  EXPECT_EQ(client.readRegisters(0x04, 0, MODBUS_REGISTER_COUNT), registers);
+
+  HAL::useRealClock();
+
+}
+
+TEST(Modbus, SampleCounterAndStatusBits) {
+
+  ModbusClient client;
+  ASSERT_TRUE(client.open());
+
+  digitalWrite(VAC_BANK_PIN, LOW);
+  status.apMode = false;
+  status.doBootLoop = false;
+  Modbus::publish();
+  std::vector<uint16_t> before = client.readRegisters(0x03, 32, 2);
+  ASSERT_EQ(before.size(), 2u);
+  EXPECT_EQ(before[0], 0);
+
+  digitalWrite(VAC_BANK_PIN, HIGH);
+  status.apMode = true;
+  Modbus::publish();
+  Modbus::publish();
+  std::vector<uint16_t> after = client.readRegisters(0x04, 32, 2);
+  ASSERT_EQ(after.size(), 2u);
+  EXPECT_EQ(after[0], (1 << MODBUS_STATUS_BENCH_ON) | (1 << MODBUS_STATUS_AP_MODE));
+  EXPECT_EQ((uint16_t)(after[1] - before[1]), 2);
+
+  // The same bits as discrete inputs, LSB first
+  EXPECT_EQ(client.request({0x02, 0x00, 0x00, 0x00, 0x10}), Bytes({0x02, 0x02, 0x03, 0x00}));
+  EXPECT_EQ(client.request({0x02, 0x00, 0x01, 0x00, 0x03}), Bytes({0x02, 0x01, 0x01}));
+  EXPECT_EQ(client.request({0x02, 0x00, MODBUS_STATUS_BOOT_LOOP, 0x00, 0x01}), Bytes({0x02, 0x01, 0x00}));
+
+  digitalWrite(VAC_BANK_PIN, LOW);
+  status.apMode = false;
+  Modbus::publish();
+
+}
+
+TEST(Modbus, PartialReadsStartAnywhere) {
+
+  setBenchValues();
+  Modbus::publish();
+
+  ModbusClient client;
+  std::vector<uint16_t> all = client.readRegisters(0x03, 0, MODBUS_REGISTER_COUNT);
+  ASSERT_EQ(all.size(), (size_t)MODBUS_REGISTER_COUNT);
+
+  // Starting half way through a float is allowed, it is just a copy of the range
+  std::vector<uint16_t> part = client.readRegisters(0x03, 11, 5);
+  EXPECT_EQ(part, std::vector<uint16_t>(all.begin() + 11, all.begin() + 16));
+
+  std::vector<uint16_t> last = client.readRegisters(0x04, MODBUS_REGISTER_COUNT - 1, 1);
+  EXPECT_EQ(last, std::vector<uint16_t>(1, all.back()));
+
+}
+
+TEST(Modbus, ExceptionResponses) {
+
+  ModbusClient client;
+  ASSERT_TRUE(client.open());
+
+  // Write single register / unknown function - illegal function
+  EXPECT_EQ(client.request({0x06, 0x00, 0x00, 0x12, 0x34}), Bytes({0x86, 0x01}));
+  EXPECT_EQ(client.request({0x2B, 0x0E, 0x01, 0x00}), Bytes({0xAB, 0x01}));
+
+  // Quantity out of range - illegal data value
+  EXPECT_EQ(client.request({0x03, 0x00, 0x00, 0x00, 0x00}), Bytes({0x83, 0x03}));
+  EXPECT_EQ(client.request({0x04, 0x00, 0x00, 0x00, 0x7E}), Bytes({0x84, 0x03}));
+  EXPECT_EQ(client.request({0x02, 0x00, 0x00, 0x00, 0x00}), Bytes({0x82, 0x03}));
+  EXPECT_EQ(client.request({0x03, 0x00, 0x00}), Bytes({0x83, 0x03}));
+
+  // Past the end of the map - illegal data address
+  EXPECT_EQ(client.request({0x03, 0x00, MODBUS_REGISTER_COUNT, 0x00, 0x01}), Bytes({0x83, 0x02}));
+  EXPECT_EQ(client.request({0x04, 0x00, 0x20, 0x00, 0x05}), Bytes({0x84, 0x02}));
+  EXPECT_EQ(client.request({0x02, 0x00, 0x0F, 0x00, 0x02}), Bytes({0x82, 0x02}));
+  EXPECT_EQ(client.request({0x03, 0xFF, 0xFF, 0x00, 0x7D}), Bytes({0x83, 0x02}));
+
+  // The connection is still good
+  EXPECT_TRUE(client.open());
+  EXPECT_EQ(client.readRegisters(0x03, 0, 1).size(), 1u);
+
+}
+
+TEST(Modbus, SplitAndBackToBackRequests) {
+
+  ModbusClient client;
+  ASSERT_TRUE(client.open());
+
+  Bytes request = ModbusClient::adu(0x0101, 1, {0x03, 0x00, 0x00, 0x00, 0x02});
+  for (uint8_t byte : request) {
+    EXPECT_TRUE(client.received().empty());
+    client.send(Bytes(1, byte));
+  }
+  Bytes response = client.received();
+  ASSERT_EQ(response.size(), 13u);
+  EXPECT_EQ(response[0], 0x01);
+  EXPECT_EQ(response[1], 0x01);
+
+  // Three requests in one segment, the last one split into the next
+  Bytes burst;
+  for (uint16_t transaction = 1; transaction <= 3; transaction++) {
+    Bytes frame = ModbusClient::adu(transaction, 1, {0x04, 0x00, 0x00, 0x00, (uint8_t)transaction});
+    burst.insert(burst.end(), frame.begin(), frame.end());
+  }
+  client.send(Bytes(burst.begin(), burst.end() - 4));
+  client.send(Bytes(burst.end() - 4, burst.end()));
+
+  response = client.received();
+  ASSERT_EQ(response.size(), 3 * 9u + 2 * (1 + 2 + 3));
+  size_t offset = 0;
+  for (uint16_t transaction = 1; transaction <= 3; transaction++) {
+    EXPECT_EQ((response[offset] << 8) | response[offset + 1], transaction);
+    EXPECT_EQ(response[offset + 8], transaction * 2);
+    offset += 9 + transaction * 2;
+  }
+
+}
+
+TEST(Modbus, NonModbusTrafficDropsTheConnection) {
+
+  ModbusClient wrongProtocol;
+  ASSERT_TRUE(wrongProtocol.open());
+  wrongProtocol.send({0x00, 0x01, 0x00, 0x01, 0x00, 0x06, 0x01, 0x03, 0x00, 0x00, 0x00, 0x01});
+  EXPECT_FALSE(AsyncClient::exists(wrongProtocol.connection));
+
+  ModbusClient tooLong;
+  ASSERT_TRUE(tooLong.open());
+  tooLong.send({0x00, 0x01, 0x00, 0x00, 0x01, 0x00, 0x01});
+  EXPECT_FALSE(AsyncClient::exists(tooLong.connection));
+
+  ModbusClient noFunction;
+  ASSERT_TRUE(noFunction.open());
+  noFunction.send({0x00, 0x01, 0x00, 0x00, 0x00, 0x01, 0x01});
+  EXPECT_FALSE(AsyncClient::exists(noFunction.connection));
+
+  // HTTP on the Modbus port
+  ModbusClient http;
+  ASSERT_TRUE(http.open());
+  const char get[] = "GET / HTTP/1.1\r\n\r\n";
+  http.send(Bytes(get, get + strlen(get)));
+  EXPECT_FALSE(AsyncClient::exists(http.connection));
+
+}
+
+TEST(Modbus, ClientLimitIsEnforced) {
+
+  std::vector<ModbusClient *> clients;
+  for (int i = 0; i < MODBUS_TCP_MAX_CLIENTS; i++) {
+    clients.push_back(new ModbusClient());
+    EXPECT_TRUE(clients.back()->open()) << "client " << i;
+  }
+
+  ModbusClient refused;
+  EXPECT_EQ(refused.connection, (AsyncClient *)NULL);
+
+  // A closed connection frees its slot
+  delete clients.back();
+  clients.pop_back();
+  ModbusClient accepted;
+  EXPECT_TRUE(accepted.open());
+
+  for (ModbusClient *client : clients) delete client;
+
+}
+
+TEST(Modbus, RTUFramesAndCRC) {
+
+  // Published vectors - read 10 holding registers from unit 1, and the spec example
+  EXPECT_EQ(rtuFrame(0x01, {0x03, 0x00, 0x00, 0x00, 0x0A}), Bytes({0x01, 0x03, 0x00, 0x00, 0x00, 0x0A, 0xC5, 0xCD}));
+  EXPECT_EQ(rtuFrame(0x11, {0x03, 0x00, 0x6B, 0x00, 0x03}), Bytes({0x11, 0x03, 0x00, 0x6B, 0x00, 0x03, 0x76, 0x87}));
+
+  // A whole frame including its CRC checks to zero
+  Bytes frame = rtuFrame(MODBUS_UNIT_ID, {0x04, 0x00, 0x00, 0x00, 0x02});
+  EXPECT_EQ(Modbus::crc16(frame.data(), frame.size()), 0);
+
+  // The RTU response is the same PDU as TCP
+  setBenchValues();
+  Modbus::publish();
+  Bytes response = processPDU(Bytes(frame.begin() + 1, frame.end() - 2));
+  ASSERT_EQ(response.size(), 6u);
+  EXPECT_EQ(response[0], 0x04);
+  EXPECT_EQ(response[1], 4);
+
+  ModbusClient client;
+  EXPECT_EQ(client.request({0x04, 0x00, 0x00, 0x00, 0x02}), response);
+
+  Bytes reply = rtuFrame(MODBUS_UNIT_ID, response);
+  EXPECT_EQ(Modbus::crc16(reply.data(), reply.size()), 0);
+  EXPECT_EQ(processPDU({0x05, 0x00, 0x01, 0xFF, 0x00}), Bytes({0x85, 0x01}));
+
+}
+
+
+
+
+int main(int argc, char **argv) {
+
+  ::testing::InitGoogleTest(&argc, argv);
+  ::testing::AddGlobalTestEnvironment(new ModbusEnvironment());
+
+  return RUN_ALL_TESTS();
+
+}
@@ -0,0 +1,300 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file test_main.cpp
+ *
+ * @brief Host tests for compressed, SHA-256 verified OTA updates
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * Raw, gzip and zlib images fed in upload sized chunks. The host Update keeps the flashed image in memory
+ * so it can be compared with the original.
+ *
+ *   pio test -e native -f test_ota_update
+ *
+ ***/
+#include <gtest/gtest.h>
+#include <string>
+#include <unistd.h>
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include <Update.h>
+#include <mbedtls/sha256.h>
+
+#include "constants.h"
+#include "system.h"
+#include "structs.h"
+
+#include "miniz.h"
+#include "otaupdate.h"
+#include "webserver.h"
+
+
+extern struct BenchSettings settings;
+
+extern Webserver _webserver;
+
+
+// Firmware sized image with the app image magic byte, compressible but not trivially so
+static std::string makeImage(size_t size) {
+
+  std::string image(size, 0);
+  uint32_t seed = 12345;
+
+  image[0] = (char)0xE9;
+  for (size_t i = 1; i < size; i++) {
+    seed = seed * 1103515245 + 12345;
+    image[i] = (i % 64 < 48) ? (char)("DIY-Flow-Bench"[i % 14]) : (char)(seed >> 24);
+  }
+
+  return image;
+
+}
+
+
+static String sha256Hex(const std::string &data) {
+
+  mbedtls_sha256_context context;
+  uint8_t digest[32];
+  char hex[65];
+
+  mbedtls_sha256_init(&context);
+  mbedtls_sha256_starts(&context, 0);
+  mbedtls_sha256_update(&context, (const unsigned char *)data.data(), data.size());
+  mbedtls_sha256_finish(&context, digest);
+  mbedtls_sha256_free(&context);
+
+  for (int i = 0; i < 32; i++) snprintf(hex + (i * 2), 3, "%02x", digest[i]);
+
+  return String(hex);
+
+}
+
+
+static std::string deflate(const std::string &data, bool zlibHeader) {
+
+  size_t length = 0;
+  int flags = tdefl_create_comp_flags_from_zip_params(6, zlibHeader ? 15 : -15, MZ_DEFAULT_STRATEGY);
+  void *compressed = tdefl_compress_mem_to_heap(data.data(), data.size(), &length, flags);
+  std::string result((const char *)compressed, length);
+  free(compressed);
+
+  return result;
+
+}
+
+
+// gzip member with a file name field, as gzip(1) writes it
+static std::string gzip(const std::string &data) {
+
+  static const uint8_t header[] = {0x1F, 0x8B, 0x08, 0x08, 0, 0, 0, 0, 0x00, 0x03};
+  std::string result((const char *)header, sizeof(header));
+  result.append("firmware.bin", 13);
+  result += deflate(data, false);
+
+  uint32_t crc = mz_crc32(MZ_CRC32_INIT, (const unsigned char *)data.data(), data.size());
+  uint32_t size = data.size();
+  for (int i = 0; i < 4; i++) result += (char)((crc >> (i * 8)) & 0xFF);
+  for (int i = 0; i < 4; i++) result += (char)((size >> (i * 8)) & 0xFF);
+
+  return result;
+
+}
+
+
+class OTA : public ::testing::Test {
+
+  protected:
+
+    OTAUpdate ota;
+
+    void SetUp() override {
+      HAL::serialCapture(true);
+      settings.ota_allow_unverified = false;
+    }
+
+    // Upload the file as the web server hands it over, a few small chunks first so headers are split
+    bool upload(const std::string &file, size_t length = std::string::npos) {
+      length = std::min(length, file.size());
+      size_t index = 0;
+      while (index < length) {
+        size_t chunk = std::min(index < 16 ? (size_t)3 : (size_t)1460, length - index);
+        if (!ota.write((const uint8_t *)file.data() + index, chunk, index + chunk == length)) return false;
+        index += chunk;
+      }
+      return true;
+    }
+
+};
+
+
+
+
+TEST_F(OTA, RawImageIsWrittenAndVerified) {
+
+  std::string image = makeImage(100000);
+
+  ASSERT_TRUE(ota.begin(sha256Hex(image)));
+  EXPECT_TRUE(upload(image));
+  ASSERT_TRUE(ota.end()) << ota.getError().c_str();
+
+  EXPECT_EQ(Update.image(), image);
+
+}
+
+TEST_F(OTA, GzipImageIsInflatedAcrossChunks) {
+
+  std::string image = makeImage(100000);
+  std::string file = gzip(image);
+  ASSERT_LT(file.size(), image.size() / 2);
+
+  ASSERT_TRUE(ota.begin(sha256Hex(image)));
+  EXPECT_TRUE(upload(file)) << ota.getError().c_str();
+  ASSERT_TRUE(ota.end()) << ota.getError().c_str();
+
+  EXPECT_EQ(ota.imageSize(), image.size());
+  EXPECT_TRUE(Update.image() == image);
+
+}
+
+TEST_F(OTA, ZlibImageIsInflated) {
+
+  std::string image = makeImage(60000);
+
+  // The digest is accepted in upper case as well
+  String digest = sha256Hex(image);
+  digest.toUpperCase();
+
+  ASSERT_TRUE(ota.begin(digest));
+  EXPECT_TRUE(upload(deflate(image, true))) << ota.getError().c_str();
+  ASSERT_TRUE(ota.end()) << ota.getError().c_str();
+
+  EXPECT_TRUE(Update.image() == image);
+
+}
+
+TEST_F(OTA, DigestMismatchIsNotFlashed) {
+
+  std::string image = makeImage(50000);
+  std::string other = image;
+  other[25000] ^= 0x01;
+
+  ASSERT_TRUE(ota.begin(sha256Hex(other)));
+  EXPECT_TRUE(upload(gzip(image)));
+
+  EXPECT_FALSE(ota.end());
+  EXPECT_STREQ(ota.getError().c_str(), "SHA-256 mismatch");
+  EXPECT_FALSE(Update.isRunning());
+  EXPECT_TRUE(Update.image().empty());
+
+}
+
+TEST_F(OTA, TruncatedCompressedImageIsRejected) {
+
+  std::string image = makeImage(50000);
+  std::string file = gzip(image);
+
+  ASSERT_TRUE(ota.begin(sha256Hex(image)));
+  EXPECT_FALSE(upload(file, file.size() / 2));
+
+  EXPECT_FALSE(ota.end());
+  EXPECT_STREQ(ota.getError().c_str(), "Compressed image is truncated");
+
+}
+
+TEST_F(OTA, CorruptDeflateStreamIsRejected) {
+
+  std::string image = makeImage(50000);
+  std::string file = gzip(image);
+  for (size_t i = 200; i < 260; i++) file[i] = (char)0xFF;
+
+  ASSERT_TRUE(ota.begin(sha256Hex(image)));
+  upload(file);
+
+  EXPECT_FALSE(ota.end());
+  EXPECT_TRUE(ota.hasError());
+
+}
+
+TEST_F(OTA, DigestIsRequiredUnlessUnverifiedUpdatesAreAllowed) {
+
+  EXPECT_FALSE(ota.begin(""));
+  EXPECT_STREQ(ota.getError().c_str(), "No SHA-256 supplied for image");
+
+  EXPECT_FALSE(ota.begin("abc123"));
+  EXPECT_STREQ(ota.getError().c_str(), "Invalid SHA-256");
+
+  settings.ota_allow_unverified = true;
+  std::string image = makeImage(10000);
+
+  ASSERT_TRUE(ota.begin(""));
+  EXPECT_TRUE(upload(image));
+  EXPECT_TRUE(ota.end());
+
+}
+
+TEST_F(OTA, DroppedUploadReleasesTheUpdate) {
+
+  std::string image = makeImage(50000);
+
+  ASSERT_TRUE(ota.begin(sha256Hex(image)));
+  uint32_t session = ota.session();
+  upload(image, 20000);
+
+  ota.abortSession(session);
+
+  EXPECT_STREQ(ota.getError().c_str(), "Upload interrupted");
+  EXPECT_FALSE(Update.isRunning());
+
+  // A later upload starts cleanly
+  ASSERT_TRUE(ota.begin(sha256Hex(image)));
+  EXPECT_TRUE(upload(image));
+  EXPECT_TRUE(ota.end());
+
+}
+
+TEST_F(OTA, FallbackUpdateFormSendsDigest) {
+
+  char directory[] = "/tmp/diyfb_test_XXXXXX";
+  ASSERT_NE(mkdtemp(directory), (char *)NULL);
+  ASSERT_EQ(chdir(directory), 0);
+
+  _webserver.begin();
+  AsyncWebServer *server = AsyncWebServer::find(80);
+  ASSERT_NE(server, (AsyncWebServer *)NULL);
+
+  AsyncWebServerRequest request(HTTP_GET, "/update");
+  AsyncWebServerResponse *response = server->handle(&request);
+
+  ASSERT_NE(response, (AsyncWebServerResponse *)NULL);
+  EXPECT_EQ(response->code(), 200);
+
+  // The digest has to be parsed before the upload starts, so it comes first in the form
+  String body = response->body();
+  int digest = body.indexOf("name='sha256'");
+  int file = body.indexOf("name='update'");
+  EXPECT_NE(digest, -1);
+  EXPECT_NE(file, -1);
+  EXPECT_LT(digest, file);
+
+}
+
+
+
+
+int main(int argc, char **argv) {
+
+  ::testing::InitGoogleTest(&argc, argv);
+
+  return RUN_ALL_TESTS();
+
+}
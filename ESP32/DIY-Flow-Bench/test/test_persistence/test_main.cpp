@@ -0,0 +1,230 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file test_main.cpp
+ *
+ * @brief Host tests for the write-behind NVM persistence
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * Bursts of requests against the running flush task. The manual clock drives the debounce and
+ * deferral timers; writes are counted from the flash write histogram in the metrics exposition.
+ *
+ *   pio test -e native -f test_persistence
+ *
+ ***/
+#include <gtest/gtest.h>
+#include <chrono>
+#include <functional>
+#include <thread>
+
+#include <Arduino.h>
+#include <Preferences.h>
+
+#include "constants.h"
+#include "system.h"
+#include "structs.h"
+
+#include "blobstore.h"
+#include "metrics.h"
+#include "persistence.h"
+
+
+extern struct BenchSettings settings;
+extern struct Configuration config;
+extern struct Pins pins;
+extern Metrics _metrics;
+extern Persistence _persistence;
+
+
+class PersistenceEnvironment : public ::testing::Environment {
+
+  public:
+
+    void SetUp() override {
+      HAL::serialCapture(true);
+      _persistence.begin();
+    }
+
+};
+
+
+static bool waitFor(std::function<bool()> condition, uint32_t timeoutMs) {
+
+  for (uint32_t waited = 0; waited < timeoutMs; waited += 10) {
+    if (condition()) return true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  return condition();
+
+}
+
+
+// Give the flush task a chance to run after a request
+static void letTaskRun() {
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+}
+
+
+static unsigned long metricValue(const char *name) {
+
+  String exposition = _metrics.buildExposition();
+  String prefix = String("\n") + name + " ";
+  int start = exposition.indexOf(prefix);
+  if (start < 0) return 0;
+  return strtoul(exposition.c_str() + start + prefix.length(), NULL, 10);
+
+}
+
+
+static unsigned long flashWrites() { return metricValue("diyfb_flash_write_seconds_count"); }
+static unsigned long coalescedWrites() { return metricValue("diyfb_flash_writes_coalesced_total"); }
+
+
+class PersistenceTest : public ::testing::Test {
+
+  protected:
+
+    unsigned long writesBefore;
+    unsigned long coalescedBefore;
+
+    void SetUp() override {
+      Persistence::flush();
+      HAL::nvsClear();
+      HAL::setClock(1000);
+      settings = BenchSettings();
+      config = Configuration();
+      pins = Pins();
+      writesBefore = flashWrites();
+      coalescedBefore = coalescedWrites();
+    }
+
+    void TearDown() override {
+      HAL::useRealClock();
+    }
+
+};
+
+
+
+
+TEST_F(PersistenceTest, BurstIsWrittenOnceAfterDebounce) {
+
+  for (int step = 1; step <= 10; step++) {
+    settings.refresh_rate = step * 100;
+    Persistence::request(PERSIST_SETTINGS);
+    letTaskRun();
+    HAL::advanceClock(PERSIST_DEBOUNCE_MS / 5);
+  }
+
+  EXPECT_TRUE(Persistence::isPending());
+  EXPECT_EQ(flashWrites() - writesBefore, 0u);
+  EXPECT_EQ(coalescedWrites() - coalescedBefore, 9u);
+
+  HAL::advanceClock(PERSIST_DEBOUNCE_MS);
+  ASSERT_TRUE(waitFor([]() { return !Persistence::isPending(); }, PERSIST_DEBOUNCE_MS * 3));
+  letTaskRun();
+
+  EXPECT_EQ(flashWrites() - writesBefore, 1u);
+
+  // The write carries the last value
+  settings = BenchSettings();
+  ASSERT_TRUE(BlobStore::load(BLOB_STORE_SETTINGS));
+  EXPECT_EQ(settings.refresh_rate, 1000);
+
+}
+
+TEST_F(PersistenceTest, ContinuousRequestsAreWrittenByTheDeadline) {
+
+  uint32_t start = millis();
+  unsigned long writesAtDeadline = 0;
+
+  // Requests closer together than the debounce never let it expire
+  while (millis() - start < PERSIST_MAX_DEFER_MS + PERSIST_DEBOUNCE_MS) {
+    if (millis() - start < PERSIST_MAX_DEFER_MS) EXPECT_EQ(flashWrites() - writesBefore, 0u) << "at " << millis() - start;
+    config.iMAF_SENS_TYP = millis() - start;
+    Persistence::request(PERSIST_CONFIG);
+    letTaskRun();
+    if (millis() - start >= PERSIST_MAX_DEFER_MS && writesAtDeadline == 0) writesAtDeadline = flashWrites() - writesBefore;
+    HAL::advanceClock(PERSIST_DEBOUNCE_MS / 2);
+  }
+
+  EXPECT_EQ(writesAtDeadline, 1u);
+
+}
+
+TEST_F(PersistenceTest, RecordsAreWrittenIndependently) {
+
+  config.iMAF_SENS_TYP = 3;
+  pins.VCC_5V = 39;
+  Persistence::request(PERSIST_CONFIG);
+  Persistence::request(PERSIST_PINS);
+  Persistence::request(PERSIST_CONFIG);
+  letTaskRun();
+
+  HAL::advanceClock(PERSIST_DEBOUNCE_MS);
+  ASSERT_TRUE(waitFor([]() { return !Persistence::isPending(); }, PERSIST_DEBOUNCE_MS * 3));
+  letTaskRun();
+
+  EXPECT_EQ(flashWrites() - writesBefore, 2u);
+  EXPECT_EQ(coalescedWrites() - coalescedBefore, 1u);
+
+  config = Configuration();
+  pins = Pins();
+  ASSERT_TRUE(BlobStore::load(BLOB_STORE_CONFIG));
+  ASSERT_TRUE(BlobStore::load(BLOB_STORE_PINS));
+  EXPECT_EQ(config.iMAF_SENS_TYP, 3);
+  EXPECT_EQ(pins.VCC_5V, 39);
+
+}
+
+TEST_F(PersistenceTest, FlushWritesEverythingPendingNow) {
+
+  Persistence::request(PERSIST_SETTINGS);
+  Persistence::request(PERSIST_LIFT_RUN + 1);
+  letTaskRun();
+  EXPECT_TRUE(Persistence::isPending());
+
+  Persistence::flush();
+
+  EXPECT_FALSE(Persistence::isPending());
+  EXPECT_EQ(flashWrites() - writesBefore, 2u);
+
+  Preferences prefs;
+  prefs.begin("liftData", true);
+  EXPECT_TRUE(prefs.isKey("RUN1"));
+  EXPECT_FALSE(prefs.isKey("RUN0"));
+  prefs.end();
+
+}
+
+TEST_F(PersistenceTest, UnknownRecordsAreIgnored) {
+
+  Persistence::request(PERSIST_RECORD_COUNT);
+  Persistence::request(255);
+
+  EXPECT_FALSE(Persistence::isPending());
+
+}
+
+
+
+
+int main(int argc, char **argv) {
+
+  ::testing::InitGoogleTest(&argc, argv);
+  ::testing::AddGlobalTestEnvironment(new PersistenceEnvironment());
+
+  return RUN_ALL_TESTS();
+
+}
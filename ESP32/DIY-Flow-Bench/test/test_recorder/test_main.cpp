@@ -0,0 +1,313 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file test_main.cpp
+ *
+ * @brief Host tests for the session recorder log format
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * Sessions are recorded to the host data partition by the real writer task, then the log and its index
+ * are read back, damaged and verified.
+ *
+ *   pio test -e native -f test_recorder
+ *
+ ***/
+#include <gtest/gtest.h>
+#include <chrono>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <esp32/rom/crc.h>
+
+#include "constants.h"
+#include "system.h"
+#include "structs.h"
+
+#include "recorder.h"
+#include "storage.h"
+
+
+extern struct SensorData sensorVal;
+extern Recorder _recorder;
+
+
+class RecorderEnvironment : public ::testing::Environment {
+
+  public:
+
+    void SetUp() override {
+      char directory[] = "/tmp/diyfb_test_XXXXXX";
+      ASSERT_NE(mkdtemp(directory), (char *)NULL);
+      ASSERT_EQ(chdir(directory), 0);
+      HAL::serialCapture(true);
+      ASSERT_EQ(mkdir("native_fs", 0755), 0);
+      ASSERT_EQ(mkdir("native_fs/littlefs", 0755), 0);
+      ASSERT_TRUE(Storage::begin());
+      _recorder.begin();
+    }
+
+};
+
+
+static std::string hostPath(const String &path) {
+
+  return std::string("native_fs/littlefs") + path.c_str();
+
+}
+
+
+static std::vector<uint8_t> readFile(const std::string &path) {
+
+  std::vector<uint8_t> data;
+  FILE *file = fopen(path.c_str(), "rb");
+  if (file == NULL) return data;
+  int value;
+  while ((value = fgetc(file)) != EOF) data.push_back((uint8_t)value);
+  fclose(file);
+  return data;
+
+}
+
+
+static void writeFile(const std::string &path, const std::vector<uint8_t> &data) {
+
+  FILE *file = fopen(path.c_str(), "wb");
+  ASSERT_NE(file, (FILE *)NULL);
+  fwrite(data.data(), 1, data.size(), file);
+  fclose(file);
+
+}
+
+
+static String recorderStatus(const char *key) {
+
+  JsonDocument status;
+  deserializeJson(status, _recorder.getStatusJSON());
+  return status[key].as<String>();
+
+}
+
+
+// Feed samples faster than the sensor task, pausing so the ring does not overflow, FlowCFM carries the sample number
+static void recordSamples(uint32_t first, uint32_t count) {
+
+  for (uint32_t i = first; i < first + count; i++) {
+    sensorVal.FlowCFM = i;
+    Recorder::push();
+    if (i % 64 == 63) std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+
+}
+
+
+static bool waitFor(std::function<bool()> condition, uint32_t timeoutMs) {
+
+  for (uint32_t waited = 0; waited < timeoutMs; waited += 10) {
+    if (condition()) return true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  return condition();
+
+}
+
+
+static void stopAndWait() {
+
+  _recorder.stop();
+  ASSERT_TRUE(waitFor([]() { return !_recorder.isRecording(); }, 2000));
+
+}
+
+
+static RecorderChunkHeader chunkHeader(const std::vector<uint8_t> &log, int chunk) {
+
+  RecorderChunkHeader header;
+  memcpy(&header, log.data() + RECORDER_FILE_HEADER_SIZE + chunk * RECORDER_CHUNK_SIZE, sizeof(header));
+  return header;
+
+}
+
+
+static RecorderSample chunkSample(const std::vector<uint8_t> &log, int chunk, int sample) {
+
+  RecorderSample value;
+  memcpy(&value, log.data() + RECORDER_FILE_HEADER_SIZE + chunk * RECORDER_CHUNK_SIZE + sizeof(RecorderChunkHeader) + sample * sizeof(RecorderSample), sizeof(value));
+  return value;
+
+}
+
+
+
+
+TEST(Recorder, ChunksCarryTheirSequenceAndCRC) {
+
+  const uint32_t total = RECORDER_CHUNK_SAMPLES * 3 + 50;
+
+  ASSERT_TRUE(_recorder.start());
+  String path = recorderStatus("FILE");
+  recordSamples(0, total);
+  stopAndWait();
+
+  EXPECT_EQ(recorderStatus("DROPPED"), "0");
+  EXPECT_EQ(_recorder.verifyLog(path.c_str()), 4);
+
+  std::vector<uint8_t> log = readFile(hostPath(path));
+  ASSERT_EQ(log.size(), (size_t)(RECORDER_FILE_HEADER_SIZE + 4 * RECORDER_CHUNK_SIZE));
+
+  RecorderFileHeader fileHeader;
+  memcpy(&fileHeader, log.data(), sizeof(fileHeader));
+  EXPECT_EQ(fileHeader.magic, (uint32_t)RECORDER_MAGIC);
+  EXPECT_EQ(fileHeader.version, RECORDER_VERSION);
+  EXPECT_EQ(fileHeader.sampleSize, sizeof(RecorderSample));
+  EXPECT_EQ(fileHeader.chunkSamples, RECORDER_CHUNK_SAMPLES);
+
+  for (int chunk = 0; chunk < 4; chunk++) {
+    RecorderChunkHeader header = chunkHeader(log, chunk);
+    EXPECT_EQ(header.magic, (uint32_t)RECORDER_CHUNK_MAGIC);
+    EXPECT_EQ(header.sequence, (uint32_t)chunk);
+    EXPECT_EQ(header.sampleCount, chunk < 3 ? RECORDER_CHUNK_SAMPLES : 50u);
+    EXPECT_EQ(chunkSample(log, chunk, 0).FlowCFM, (float)(chunk * RECORDER_CHUNK_SAMPLES));
+    EXPECT_EQ(chunkSample(log, chunk, header.sampleCount - 1).FlowCFM, (float)(chunk * RECORDER_CHUNK_SAMPLES + header.sampleCount - 1));
+  }
+
+  // The index has one entry per chunk pointing at it
+  String indexPath = path.substring(0, path.lastIndexOf('.')) + ".idx";
+  std::vector<uint8_t> index = readFile(hostPath(indexPath));
+  ASSERT_EQ(index.size(), 4 * sizeof(RecorderIndexEntry));
+
+  for (int chunk = 0; chunk < 4; chunk++) {
+    RecorderIndexEntry entry;
+    memcpy(&entry, index.data() + chunk * sizeof(entry), sizeof(entry));
+    RecorderChunkHeader header = chunkHeader(log, chunk);
+    EXPECT_EQ(entry.offset, (uint32_t)(RECORDER_FILE_HEADER_SIZE + chunk * RECORDER_CHUNK_SIZE));
+    EXPECT_EQ(entry.sequence, (uint32_t)chunk);
+    EXPECT_EQ(entry.crc, header.crc);
+    EXPECT_EQ(entry.firstTimestamp, header.firstTimestamp);
+    EXPECT_EQ(entry.lastTimestamp, header.lastTimestamp);
+  }
+
+}
+
+TEST(Recorder, CorruptChunkEndsTheValidLog) {
+
+  ASSERT_TRUE(_recorder.start());
+  String path = recorderStatus("FILE");
+  recordSamples(0, RECORDER_CHUNK_SAMPLES * 4);
+  stopAndWait();
+
+  ASSERT_EQ(_recorder.verifyLog(path.c_str()), 4);
+
+  std::vector<uint8_t> log = readFile(hostPath(path));
+
+  // A single flipped bit in a sample of chunk 2
+  std::vector<uint8_t> damaged = log;
+  damaged[RECORDER_FILE_HEADER_SIZE + 2 * RECORDER_CHUNK_SIZE + 100] ^= 0x04;
+  writeFile(hostPath(path), damaged);
+  EXPECT_EQ(_recorder.verifyLog(path.c_str()), 2);
+
+  // Chunks out of sequence (a stale chunk left behind) are not accepted either
+  damaged = log;
+  memcpy(damaged.data() + RECORDER_FILE_HEADER_SIZE + 3 * RECORDER_CHUNK_SIZE, log.data() + RECORDER_FILE_HEADER_SIZE + RECORDER_CHUNK_SIZE, RECORDER_CHUNK_SIZE);
+  writeFile(hostPath(path), damaged);
+  EXPECT_EQ(_recorder.verifyLog(path.c_str()), 3);
+
+}
+
+TEST(Recorder, TornWriteLosesOnlyTheLastChunk) {
+
+  ASSERT_TRUE(_recorder.start());
+  String path = recorderStatus("FILE");
+  recordSamples(0, RECORDER_CHUNK_SAMPLES * 3);
+  stopAndWait();
+
+  // Power lost part way through writing chunk 2
+  std::vector<uint8_t> log = readFile(hostPath(path));
+  log.resize(RECORDER_FILE_HEADER_SIZE + 2 * RECORDER_CHUNK_SIZE + 1000);
+  writeFile(hostPath(path), log);
+
+  EXPECT_EQ(_recorder.verifyLog(path.c_str()), 2);
+
+  // A header that is not a session log is refused outright
+  log[0] ^= 0xFF;
+  writeFile(hostPath(path), log);
+  EXPECT_EQ(_recorder.verifyLog(path.c_str()), -1);
+  EXPECT_EQ(_recorder.verifyLog("/no_such_session.dfbl"), -1);
+
+}
+
+TEST(Recorder, PartialChunkIsWrittenOnTimerAndRewrittenInPlace) {
+
+  HAL::setClock(100000);
+
+  ASSERT_TRUE(_recorder.start());
+  String path = recorderStatus("FILE");
+  std::string logPath = hostPath(path);
+
+  recordSamples(0, 10);
+  HAL::advanceClock(RECORDER_PARTIAL_FLUSH_MS);
+
+  // The writer wakes at least every RECORDER_FLUSH_TIMEOUT_MS of real time
+  ASSERT_TRUE(waitFor([&]() { return readFile(logPath).size() == RECORDER_FILE_HEADER_SIZE + RECORDER_CHUNK_SIZE; }, RECORDER_FLUSH_TIMEOUT_MS * 3));
+  EXPECT_EQ(_recorder.verifyLog(path.c_str()), 1);
+  EXPECT_EQ(chunkHeader(readFile(logPath), 0).sampleCount, 10);
+
+  recordSamples(10, 5);
+  HAL::advanceClock(RECORDER_PARTIAL_FLUSH_MS);
+
+  ASSERT_TRUE(waitFor([&]() { return chunkHeader(readFile(logPath), 0).sampleCount == 15; }, RECORDER_FLUSH_TIMEOUT_MS * 3));
+
+  std::vector<uint8_t> log = readFile(logPath);
+  EXPECT_EQ(log.size(), (size_t)(RECORDER_FILE_HEADER_SIZE + RECORDER_CHUNK_SIZE));
+  EXPECT_EQ(chunkHeader(log, 0).sequence, 0u);
+  EXPECT_EQ(chunkSample(log, 0, 14).FlowCFM, 14.0f);
+  EXPECT_EQ(_recorder.verifyLog(path.c_str()), 1);
+
+  String indexPath = path.substring(0, path.lastIndexOf('.')) + ".idx";
+  EXPECT_EQ(readFile(hostPath(indexPath)).size(), sizeof(RecorderIndexEntry));
+
+  stopAndWait();
+  HAL::useRealClock();
+
+}
+
+TEST(Recorder, SessionsTakeTheNextFreeNumber) {
+
+  ASSERT_TRUE(_recorder.start());
+  String first = recorderStatus("FILE");
+  EXPECT_FALSE(_recorder.start());
+  stopAndWait();
+
+  ASSERT_TRUE(_recorder.start());
+  String second = recorderStatus("FILE");
+  stopAndWait();
+
+  EXPECT_NE(first, second);
+  EXPECT_EQ(second.substring(9, 12).toInt(), first.substring(9, 12).toInt() + 1);
+
+}
+
+
+
+
+int main(int argc, char **argv) {
+
+  ::testing::InitGoogleTest(&argc, argv);
+  ::testing::AddGlobalTestEnvironment(new RecorderEnvironment());
+
+  return RUN_ALL_TESTS();
+
+}
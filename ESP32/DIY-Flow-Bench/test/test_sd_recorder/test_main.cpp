@@ -0,0 +1,370 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file test_main.cpp
+ *
+ * @brief Host tests for session recording to the SD card
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * The card is the native SD file system (a host directory, present once native_fs/sd exists). Covers
+ * mounting, pre-allocation and truncation of the log, sector aligned chunk layout, the sensor side ring
+ * that lets push() return without waiting for the writer task, session numbers shared with the flash
+ * sessions, and rejection of stale chunks an earlier session left in the preallocated space.
+ *
+ *   pio test -e native -f test_sd_recorder
+ *
+ ***/
+#include <gtest/gtest.h>
+#include <chrono>
+#include <functional>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <ESPAsyncWebServer.h>
+
+#include "constants.h"
+#include "system.h"
+#include "structs.h"
+
+#include "recorder.h"
+#include "sdcard.h"
+#include "storage.h"
+
+
+#define SD_SECTOR_SIZE 512
+
+
+extern struct Configuration config;
+extern struct Pins pins;
+extern struct SensorData sensorVal;
+extern Recorder _recorder;
+
+static String flashSession;
+
+
+class SDRecorderEnvironment : public ::testing::Environment {
+
+  public:
+
+    void SetUp() override {
+      char directory[] = "/tmp/diyfb_test_XXXXXX";
+      ASSERT_NE(mkdtemp(directory), (char *)NULL);
+      ASSERT_EQ(chdir(directory), 0);
+      HAL::serialCapture(true);
+      ASSERT_EQ(mkdir("native_fs", 0755), 0);
+      ASSERT_EQ(mkdir("native_fs/littlefs", 0755), 0);
+      ASSERT_TRUE(Storage::begin());
+      _recorder.begin();
+    }
+
+};
+
+
+static bool waitFor(std::function<bool()> condition, uint32_t timeoutMs) {
+
+  for (uint32_t waited = 0; waited < timeoutMs; waited += 10) {
+    if (condition()) return true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  return condition();
+
+}
+
+
+static void stopAndWait() {
+
+  _recorder.stop();
+  ASSERT_TRUE(waitFor([]() { return !_recorder.isRecording(); }, 2000));
+
+}
+
+
+static String recorderStatus(const char *key) {
+
+  JsonDocument status;
+  deserializeJson(status, _recorder.getStatusJSON());
+  return status[key].as<String>();
+
+}
+
+
+static std::string sdPath(const String &path) {
+
+  return std::string(SD_MOUNT_POINT) + path.c_str();
+
+}
+
+
+static off_t hostSize(const std::string &path) {
+
+  struct stat info;
+  return stat(path.c_str(), &info) == 0 ? info.st_size : -1;
+
+}
+
+
+// FlowCFM carries the sample number, pausing so the writer keeps up
+static void recordSamples(uint32_t first, uint32_t count) {
+
+  for (uint32_t i = first; i < first + count; i++) {
+    sensorVal.FlowCFM = i;
+    Recorder::push();
+    if (i % 64 == 63) std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+
+}
+
+
+static void enableSD() {
+
+  config.bSD_ENABLED = true;
+  pins.SD_CS = 5;
+  pins.SD_SCK = 18;
+  pins.SD_MISO = 19;
+  pins.SD_MOSI = 23;
+
+}
+
+
+
+
+// Runs first - nothing is mounted until the card directory is created
+TEST(SDRecorder, WithoutACardSessionsGoToFlash) {
+
+  EXPECT_FALSE(SDCard::begin());
+
+  enableSD();
+  pins.SD_MOSI = -1;
+  EXPECT_FALSE(SDCard::begin());
+
+  enableSD();
+  EXPECT_FALSE(SDCard::begin());
+  EXPECT_FALSE(SDCard::isMounted());
+  EXPECT_EQ(SDCard::totalBytes(), 0u);
+
+  ASSERT_TRUE(_recorder.start());
+  String path = recorderStatus("FILE");
+  EXPECT_STREQ(recorderStatus("MEDIA").c_str(), "FLASH");
+  recordSamples(0, 10);
+  stopAndWait();
+
+  EXPECT_TRUE(Storage::exists(path.c_str()));
+  EXPECT_EQ(_recorder.verifyLog(path.c_str()), 1);
+
+  // Kept, the SD sessions below must not reuse its number
+  flashSession = path;
+
+}
+
+TEST(SDRecorder, CardMountsWhenPresent) {
+
+  enableSD();
+  ASSERT_EQ(mkdir(SD_MOUNT_POINT, 0755), 0);
+
+  ASSERT_TRUE(SDCard::begin());
+  EXPECT_TRUE(SDCard::isMounted());
+  EXPECT_GT(SDCard::totalBytes(), 0u);
+
+}
+
+TEST(SDRecorder, SessionNumbersAreFreeOnBothMedia) {
+
+  ASSERT_TRUE(SDCard::isMounted());
+  ASSERT_TRUE(Storage::exists(flashSession.c_str()));
+
+  ASSERT_TRUE(_recorder.start());
+  String path = recorderStatus("FILE");
+  EXPECT_STREQ(recorderStatus("MEDIA").c_str(), "SD");
+  EXPECT_STRNE(path.c_str(), flashSession.c_str());
+  recordSamples(0, RECORDER_CHUNK_SAMPLES + 5);
+  stopAndWait();
+
+  // Both sessions can still be read back by name
+  EXPECT_EQ(_recorder.verifyLog(path.c_str()), 2);
+  EXPECT_EQ(_recorder.verifyLog(flashSession.c_str()), 1);
+
+}
+
+TEST(SDRecorder, LogIsPreallocatedThenTruncated) {
+
+  ASSERT_TRUE(SDCard::isMounted());
+
+  ASSERT_TRUE(_recorder.start());
+  String path = recorderStatus("FILE");
+  EXPECT_STREQ(recorderStatus("MEDIA").c_str(), "SD");
+  EXPECT_FALSE(Storage::exists(path.c_str()));
+
+  // Clusters are reserved up front so appends never extend the FAT chain
+  EXPECT_EQ(hostSize(sdPath(path)), (off_t)RECORDER_SD_PREALLOCATE);
+
+  recordSamples(0, RECORDER_CHUNK_SAMPLES * 3 + 20);
+  EXPECT_EQ(hostSize(sdPath(path)), (off_t)RECORDER_SD_PREALLOCATE);
+
+  stopAndWait();
+
+  EXPECT_EQ(hostSize(sdPath(path)), (off_t)(RECORDER_FILE_HEADER_SIZE + 4 * RECORDER_CHUNK_SIZE));
+  EXPECT_EQ(_recorder.verifyLog(path.c_str()), 4);
+  EXPECT_STREQ(recorderStatus("DROPPED").c_str(), "0");
+
+}
+
+TEST(SDRecorder, ChunksAreWholeAlignedSectors) {
+
+  EXPECT_EQ(RECORDER_FILE_HEADER_SIZE % SD_SECTOR_SIZE, 0);
+  EXPECT_EQ(RECORDER_CHUNK_SIZE % SD_SECTOR_SIZE, 0);
+  EXPECT_GE(RECORDER_FILE_HEADER_SIZE, (int)sizeof(RecorderFileHeader));
+
+  ASSERT_TRUE(_recorder.start());
+  String path = recorderStatus("FILE");
+  recordSamples(0, RECORDER_CHUNK_SAMPLES * 2 + 1);
+  stopAndWait();
+
+  String indexPath = path.substring(0, path.lastIndexOf('.')) + ".idx";
+  FILE *index = fopen(sdPath(indexPath).c_str(), "rb");
+  ASSERT_NE(index, (FILE *)NULL);
+
+  RecorderIndexEntry entry;
+  int chunks = 0;
+  while (fread(&entry, sizeof(entry), 1, index) == 1) {
+    EXPECT_EQ(entry.offset % SD_SECTOR_SIZE, 0u) << "chunk " << chunks;
+    EXPECT_EQ(entry.offset, (uint32_t)(RECORDER_FILE_HEADER_SIZE + chunks * RECORDER_CHUNK_SIZE));
+    chunks++;
+  }
+  fclose(index);
+
+  EXPECT_EQ(chunks, 3);
+
+}
+
+TEST(SDRecorder, PushNeverWaitsForTheWriter) {
+
+  ASSERT_TRUE(_recorder.start());
+  String path = recorderStatus("FILE");
+
+  // A full ring back to back, and then twice as many again with no pause at all
+  const uint32_t pushed = RECORDER_RING_SAMPLES - 1 + RECORDER_RING_SAMPLES * 2;
+  uint32_t slowest = 0;
+
+  for (uint32_t i = 0; i < pushed; i++) {
+    sensorVal.FlowCFM = i;
+    uint32_t start = micros();
+    Recorder::push();
+    slowest = max(slowest, (uint32_t)(micros() - start));
+  }
+
+  stopAndWait();
+
+  EXPECT_LT(slowest, 1000u);
+
+  // Every sample is either in the log or counted as dropped
+  uint32_t recorded = recorderStatus("SAMPLES").toInt();
+  uint32_t dropped = recorderStatus("DROPPED").toInt();
+  EXPECT_EQ(recorded + dropped, pushed);
+  EXPECT_GE(recorded, (uint32_t)RECORDER_RING_SAMPLES - 1);
+
+  // What was kept is in order
+  FILE *log = fopen(sdPath(path).c_str(), "rb");
+  ASSERT_NE(log, (FILE *)NULL);
+  fseek(log, RECORDER_FILE_HEADER_SIZE, SEEK_SET);
+
+  std::vector<uint8_t> chunk(RECORDER_CHUNK_SIZE);
+  float previous = -1.0f;
+  uint32_t samples = 0;
+  while (fread(chunk.data(), 1, chunk.size(), log) == chunk.size()) {
+    RecorderChunkHeader header;
+    memcpy(&header, chunk.data(), sizeof(header));
+    for (int i = 0; i < header.sampleCount; i++) {
+      RecorderSample sample;
+      memcpy(&sample, chunk.data() + sizeof(header) + i * sizeof(sample), sizeof(sample));
+      EXPECT_GT(sample.FlowCFM, previous);
+      previous = sample.FlowCFM;
+      samples++;
+    }
+  }
+  fclose(log);
+
+  EXPECT_EQ(samples, recorded);
+
+}
+
+
+TEST(SDRecorder, StaleChunksOfAnEarlierSessionAreRejected) {
+
+  // An earlier session, deleted, so the next one reuses its number and (on a real card) its clusters
+  ASSERT_TRUE(_recorder.start());
+  String path = recorderStatus("FILE");
+  recordSamples(1000, RECORDER_CHUNK_SAMPLES * 4);
+  stopAndWait();
+  ASSERT_EQ(_recorder.verifyLog(path.c_str()), 4);
+
+  std::vector<uint8_t> stale(RECORDER_CHUNK_SIZE * 3);
+  FILE *log = fopen(sdPath(path).c_str(), "rb");
+  ASSERT_NE(log, (FILE *)NULL);
+  fseek(log, RECORDER_FILE_HEADER_SIZE + RECORDER_CHUNK_SIZE, SEEK_SET);
+  ASSERT_EQ(fread(stale.data(), 1, stale.size(), log), stale.size());
+  fclose(log);
+
+  String indexPath = path.substring(0, path.lastIndexOf('.')) + ".idx";
+  ASSERT_TRUE(SDCard::fs().remove(path));
+  ASSERT_TRUE(SDCard::fs().remove(indexPath));
+
+  ASSERT_TRUE(_recorder.start());
+  ASSERT_STREQ(recorderStatus("FILE").c_str(), path.c_str());
+
+  // The host file system zeroes the preallocated space, a FAT card leaves the old chunks there
+  log = fopen(sdPath(path).c_str(), "r+b");
+  ASSERT_NE(log, (FILE *)NULL);
+  fseek(log, RECORDER_FILE_HEADER_SIZE + RECORDER_CHUNK_SIZE, SEEK_SET);
+  ASSERT_EQ(fwrite(stale.data(), 1, stale.size(), log), stale.size());
+  fclose(log);
+
+  // One whole chunk of this session, read back while still recording (or after a power loss)
+  recordSamples(0, RECORDER_CHUNK_SAMPLES);
+  EXPECT_TRUE(waitFor([]() { return recorderStatus("SAMPLES").toInt() == RECORDER_CHUNK_SAMPLES; }, 2000));
+
+  EXPECT_EQ(_recorder.verifyLog(path.c_str()), 1);
+
+  AsyncWebServerRequest request(HTTP_GET, "/api/recorder/export");
+  request.addParam("file", path);
+  request.addParam("channels", "FlowCFM");
+  request.addParam("gzip", "0");
+  AsyncWebServerResponse *response = _recorder.exportSession(&request);
+  String body = response->body();
+  delete response;
+
+  int lines = 0;
+  for (unsigned int i = 0; i < body.length(); i++) {
+    if (body[i] == '\n') lines++;
+  }
+  EXPECT_EQ(lines, (int)RECORDER_CHUNK_SAMPLES + 1);
+  EXPECT_LT(body.indexOf(",1000.000"), 0);
+
+  stopAndWait();
+
+}
+
+
+
+
+int main(int argc, char **argv) {
+
+  ::testing::InitGoogleTest(&argc, argv);
+  ::testing::AddGlobalTestEnvironment(new SDRecorderEnvironment());
+
+  return RUN_ALL_TESTS();
+
+}
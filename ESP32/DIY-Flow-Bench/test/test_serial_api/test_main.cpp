@@ -0,0 +1,273 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file test_main.cpp
+ *
+ * @brief Host tests for serial API framing
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * Requests are fed to the native UART, which wakes the command task the same way the UART event does
+ * on the ESP32. Covers multi character commands with arguments, pipelined requests, frames split across
+ * reads, legacy commands mixed into the stream (including the lone '#' command), CRC and the error
+ * responses.
+ *
+ *   pio test -e native -f test_serial_api
+ *
+ ***/
+#include <gtest/gtest.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <Arduino.h>
+#include <esp32/rom/crc.h>
+
+#include "constants.h"
+#include "system.h"
+#include "structs.h"
+
+#include "API.h"
+
+
+extern struct BenchSettings settings;
+extern struct DeviceStatus status;
+extern struct SensorData sensorVal;
+
+static const std::string version = std::string(MAJOR_VERSION) + "." + MINOR_VERSION + "." + BUILD_NUMBER;
+
+
+class SerialAPIEnvironment : public ::testing::Environment {
+
+  public:
+
+    void SetUp() override {
+      HAL::serialCapture(true);
+      API::begin();
+    }
+
+};
+
+
+// Serial output once the given number of lines have arrived, or whatever came before the timeout
+static std::string readLines(size_t lines, uint32_t timeoutMs = 2000) {
+
+  std::string output;
+  for (uint32_t waited = 0; waited < timeoutMs; waited += 2) {
+    output += HAL::serialOutput();
+    if ((size_t)std::count(output.begin(), output.end(), '\n') >= lines) break;
+    delay(2);
+  }
+  return output;
+
+}
+
+
+static std::string apiRequest(const char *request, size_t lines = 1) {
+
+  HAL::serialOutput();
+  HAL::serialInput(request);
+  return readLines(lines);
+
+}
+
+
+static std::vector<std::string> splitLines(const std::string &text) {
+
+  std::vector<std::string> lines;
+  size_t start = 0;
+  size_t end;
+  while ((end = text.find('\n', start)) != std::string::npos) {
+    lines.push_back(text.substr(start, end - start));
+    start = end + 1;
+  }
+  return lines;
+
+}
+
+
+static std::string withCRC(const std::string &frame) {
+
+  char crc[16];
+  snprintf(crc, sizeof(crc), "*%08X", crc32_le(0, (const uint8_t *)frame.c_str(), frame.length()));
+  return frame + crc;
+
+}
+
+
+
+
+TEST(SerialAPI, NamedCommandsTakeArguments) {
+
+  EXPECT_EQ(apiRequest("#1 PING hello bench\n"), "#1 PING:hello bench\n");
+  EXPECT_EQ(apiRequest("#2 version\n"), "#2 V:" + version + "\n");
+
+  sensorVal.FlowCFM = 123.5;
+  sensorVal.PRefH2O = -28.25;
+  EXPECT_EQ(apiRequest("#3 GET FlowCFM,pRefH2O,Nothing\n"), "#3 GET:123.500000:-28.250000:?\n");
+
+  EXPECT_EQ(apiRequest("#4 BENCH SIDEWAYS\n"), "#4 ERR:ARGUMENT\n");
+  EXPECT_EQ(apiRequest("#5 RECORD\n"), "#5 ERR:ARGUMENT\n");
+
+  // A single character is the legacy command, with arguments it has to be a name
+  EXPECT_EQ(apiRequest("#6 V\n"), "#6 V:" + version + "\n");
+  EXPECT_EQ(apiRequest("#7 V now\n"), "#7 ERR:UNKNOWN\n");
+
+}
+
+TEST(SerialAPI, PipelinedRequestsAreAnsweredInOrder) {
+
+  const int requests = 200;
+  std::string stream;
+  for (int i = 0; i < requests; i++) stream += "#p" + std::to_string(i) + " PING " + std::to_string(i * 3) + "\n";
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::vector<std::string> lines = splitLines(apiRequest(stream.c_str(), requests));
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  ASSERT_EQ(lines.size(), (size_t)requests);
+  for (int i = 0; i < requests; i++) {
+    EXPECT_EQ(lines[i], "#p" + std::to_string(i) + " PING:" + std::to_string(i * 3));
+  }
+
+  // Polling one byte every 250 ms managed four commands a second
+  EXPECT_GT(requests / seconds, 100.0);
+
+}
+
+TEST(SerialAPI, FramesSplitAcrossReadsAreJoined) {
+
+  HAL::serialOutput();
+
+  const char *pieces[] = {"#sp", "lit PI", "NG a", "b\r", "\n#s2", " VERS", "ION\r\n"};
+  for (const char *piece : pieces) {
+    HAL::serialInput(piece);
+    delay(5);
+  }
+
+  EXPECT_EQ(readLines(2), "#split PING:ab\n#s2 V:" + version + "\n");
+
+}
+
+TEST(SerialAPI, LegacyCommandsMixWithFrames) {
+
+  // Legacy characters are run as they arrive, including between framed requests
+  std::vector<std::string> lines = splitLines(apiRequest("V#m1 PING x\nV\r\n#m2 V\n", 4));
+
+  ASSERT_EQ(lines.size(), 4u);
+  EXPECT_EQ(lines[0], "V:" + version);
+  EXPECT_EQ(lines[1], "#m1 PING:x");
+  EXPECT_EQ(lines[2], "V:" + version);
+  EXPECT_EQ(lines[3], "#m2 V:" + version);
+
+  // A stray line ending on its own is not a command
+  HAL::serialInput("\r\n");
+  EXPECT_EQ(readLines(1, 200), "");
+
+}
+
+TEST(SerialAPI, LoneHashIsTheDevModeCommand) {
+
+  bool devMode = settings.dev_mode;
+
+  // As a terminal sends it, and with nothing at all after it
+  EXPECT_EQ(apiRequest("#\r\n"), std::string("#:Developer Mode ") + (devMode ? "Off" : "On") + "\n");
+  EXPECT_EQ(apiRequest("#"), std::string("#:Developer Mode ") + (devMode ? "On" : "Off") + "\n");
+  EXPECT_EQ(settings.dev_mode, devMode);
+
+  // An id arriving in the next read still makes it a frame
+  HAL::serialOutput();
+  HAL::serialInput("#");
+  delay(5);
+  HAL::serialInput("x1 PING late\n");
+  EXPECT_EQ(readLines(1), "#x1 PING:late\n");
+
+}
+
+TEST(SerialAPI, MultiLineResponsesStayOnOneLine) {
+
+  std::string response = apiRequest("#h HELP\n");
+
+  ASSERT_EQ(std::count(response.begin(), response.end(), '\n'), 1) << response;
+  EXPECT_EQ(response.compare(0, 3, "#h "), 0);
+  EXPECT_NE(response.find("\\n"), std::string::npos);
+  EXPECT_NE(response.find("Echo arguments"), std::string::npos);
+
+  // Backslashes in the payload are escaped too
+  EXPECT_EQ(apiRequest("#b PING a\\nb\n"), "#b PING:a\\\\nb\n");
+
+}
+
+TEST(SerialAPI, CRCIsCheckedAndReturned) {
+
+  std::string response = apiRequest((withCRC("#c1 PING crc") + "\n").c_str());
+  EXPECT_EQ(response, withCRC("#c1 PING:crc") + "\n");
+
+  // Lower case hex is accepted
+  std::string request = withCRC("#c2 PING lower");
+  for (size_t i = request.find('*'); i < request.size(); i++) request[i] = tolower(request[i]);
+  EXPECT_EQ(apiRequest((request + "\n").c_str()), withCRC("#c2 PING:lower") + "\n");
+
+  EXPECT_EQ(apiRequest("#c3 PING crc*00000000\n"), withCRC("#c3 ERR:CRC") + "\n");
+  EXPECT_EQ(apiRequest("#c4 PING crc*1234\n"), withCRC("#c4 ERR:CRC") + "\n");
+
+}
+
+TEST(SerialAPI, MalformedFramesGetAnError) {
+
+  EXPECT_EQ(apiRequest("#e1\n"), "#e1 ERR:COMMAND\n");
+  EXPECT_EQ(apiRequest("# PING\n"), "# ERR:ID\n");
+  EXPECT_EQ(apiRequest("#12345678901 PING\n"), "#1234567890 ERR:ID\n");
+  EXPECT_EQ(apiRequest("#e2 NOSUCHCOMMAND\n"), "#e2 ERR:UNKNOWN\n");
+
+  std::string longRequest = "#e3 PING " + std::string(API_REQUEST_LENGTH, 'z') + "\n";
+  EXPECT_EQ(apiRequest(longRequest.c_str()), "#e3 ERR:LENGTH\n");
+
+  // The stream is back in step afterwards
+  EXPECT_EQ(apiRequest("#e4 PING ok\n"), "#e4 PING:ok\n");
+
+}
+
+TEST(SerialAPI, BootLoopOnlyRunsBootCommands) {
+
+  status.doBootLoop = true;
+  std::string refused = apiRequest("#l1 FLOW\n");
+  std::string allowed = apiRequest("#l2 PING boot\n");
+  status.doBootLoop = false;
+
+  EXPECT_EQ(refused, "#l1 Invalid Response\n");
+  EXPECT_EQ(allowed, "#l2 PING:boot\n");
+
+}
+
+TEST(SerialAPI, DisabledAPIIgnoresInput) {
+
+  settings.api_enabled = false;
+  HAL::serialInput("#d1 PING\nV");
+  std::string ignored = readLines(1, 200);
+  settings.api_enabled = true;
+
+  EXPECT_EQ(ignored, "");
+  EXPECT_EQ(apiRequest("#d2 PING on\n"), "#d2 PING:on\n");
+
+}
+
+
+
+
+int main(int argc, char **argv) {
+
+  ::testing::InitGoogleTest(&argc, argv);
+  ::testing::AddGlobalTestEnvironment(new SerialAPIEnvironment());
+
+  return RUN_ALL_TESTS();
+
+}
@@ -0,0 +1,333 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file test_main.cpp
+ *
+ * @brief Host tests for streamed CSV / NDJSON session export
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * One session is recorded with known values on the manual clock (a sample every 10ms), then exported
+ * through /api/recorder/export. Exports are checked line by line against the recorded values, and the
+ * gzip stream is decoded with miniz and its CRC and length trailer checked.
+ *
+ *   pio test -e native -f test_session_export
+ *
+ ***/
+#include <gtest/gtest.h>
+#include <chrono>
+#include <functional>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <ESPAsyncWebServer.h>
+#include <esp32/rom/crc.h>
+
+#include "constants.h"
+#include "system.h"
+#include "structs.h"
+
+#include "miniz.h"
+#include "recorder.h"
+#include "storage.h"
+
+
+#define SESSION_SAMPLES (RECORDER_CHUNK_SAMPLES * 3 + 17)
+#define SAMPLE_INTERVAL_MS 10
+
+
+extern struct SensorData sensorVal;
+extern Recorder _recorder;
+
+static String sessionPath;
+static uint32_t sessionStart;
+
+
+static bool waitFor(std::function<bool()> condition, uint32_t timeoutMs) {
+
+  for (uint32_t waited = 0; waited < timeoutMs; waited += 10) {
+    if (condition()) return true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  return condition();
+
+}
+
+
+// Bench-like values derived from the sample number so any line can be checked. Pressures and flow wander
+// around a test point, the environment channels drift slowly
+static float channelValue(int sample, int channel) {
+
+  static const float base[8] = {150.0f, 280.0f, -28.0f, -3.5f, 0.0f, 21.5f, 1013.25f, 45.0f};
+
+  if (channel < 5) return base[channel] + ((sample * 7) % 32) * 0.125f;
+  return base[channel] + ((sample / 200) % 4) * 0.25f;
+
+}
+
+
+class SessionExportEnvironment : public ::testing::Environment {
+
+  public:
+
+    void SetUp() override {
+      char directory[] = "/tmp/diyfb_test_XXXXXX";
+      ASSERT_NE(mkdtemp(directory), (char *)NULL);
+      ASSERT_EQ(chdir(directory), 0);
+      HAL::serialCapture(true);
+      ASSERT_EQ(mkdir("native_fs", 0755), 0);
+      ASSERT_EQ(mkdir("native_fs/littlefs", 0755), 0);
+      ASSERT_TRUE(Storage::begin());
+      _recorder.begin();
+
+      HAL::setClock(50000);
+      sessionStart = millis();
+      ASSERT_TRUE(_recorder.start());
+
+      JsonDocument status;
+      deserializeJson(status, _recorder.getStatusJSON());
+      sessionPath = status["FILE"].as<String>();
+
+      for (int sample = 0; sample < SESSION_SAMPLES; sample++) {
+        HAL::advanceClock(SAMPLE_INTERVAL_MS);
+        sensorVal.FlowCFM = channelValue(sample, 0);
+        sensorVal.FlowKGH = channelValue(sample, 1);
+        sensorVal.PRefKPA = channelValue(sample, 2);
+        sensorVal.PDiffKPA = channelValue(sample, 3);
+        sensorVal.PitotKPA = channelValue(sample, 4);
+        sensorVal.TempDegC = channelValue(sample, 5);
+        sensorVal.BaroHPA = channelValue(sample, 6);
+        sensorVal.RelH = channelValue(sample, 7);
+        Recorder::push();
+        if (sample % 64 == 63) std::this_thread::sleep_for(std::chrono::milliseconds(5));
+      }
+
+      _recorder.stop();
+      ASSERT_TRUE(waitFor([]() { return !_recorder.isRecording(); }, 2000));
+      ASSERT_EQ(_recorder.verifyLog(sessionPath.c_str()), 4);
+    }
+
+};
+
+
+static std::vector<String> splitLines(const String &text) {
+
+  std::vector<String> lines;
+  int start = 0;
+  int end;
+  while ((end = text.indexOf('\n', start)) >= 0) {
+    lines.push_back(text.substring(start, end));
+    start = end + 1;
+  }
+  if (start < (int)text.length()) lines.push_back(text.substring(start));
+  return lines;
+
+}
+
+
+// Decode a gzip member: header, raw deflate, then CRC32 and length of the data
+static bool gunzip(const String &member, String &output) {
+
+  const uint8_t *data = (const uint8_t *)member.c_str();
+  size_t length = member.length();
+
+  if (length < 18 || data[0] != 0x1F || data[1] != 0x8B || data[2] != 8) return false;
+
+  size_t offset = 10;
+  uint8_t flags = data[3];
+  if (flags & 0x04) offset += 2 + (data[10] | (data[11] << 8));
+  if (flags & 0x08) while (offset < length && data[offset++] != 0) {}
+  if (flags & 0x10) while (offset < length && data[offset++] != 0) {}
+  if (flags & 0x02) offset += 2;
+  if (offset + 8 > length) return false;
+
+  size_t inflatedLength = 0;
+  void *inflated = tinfl_decompress_mem_to_heap(data + offset, length - offset - 8, &inflatedLength, 0);
+  if (inflated == NULL) return false;
+
+  uint32_t crc;
+  uint32_t size;
+  memcpy(&crc, data + length - 8, 4);
+  memcpy(&size, data + length - 4, 4);
+
+  bool valid = (crc == crc32_le(0, (const uint8_t *)inflated, inflatedLength) && size == inflatedLength);
+  output = String((const char *)inflated, inflatedLength);
+  free(inflated);
+
+  return valid;
+
+}
+
+
+class SessionExportTest : public ::testing::Test {
+
+  protected:
+
+    AsyncWebServerResponse *response = NULL;
+
+    void TearDown() override {
+      delete response;
+    }
+
+    String get(const String &query, const char *acceptEncoding = NULL) {
+      AsyncWebServerRequest request(HTTP_GET, "/api/recorder/export");
+      request.addParam("file", sessionPath);
+      int start = 0;
+      while (start < (int)query.length()) {
+        int end = query.indexOf('&', start);
+        if (end < 0) end = query.length();
+        String pair = query.substring(start, end);
+        int equals = pair.indexOf('=');
+        request.addParam(pair.substring(0, equals), pair.substring(equals + 1));
+        start = end + 1;
+      }
+      if (acceptEncoding != NULL) request.addHeader("Accept-Encoding", acceptEncoding);
+      delete response;
+      response = _recorder.exportSession(&request);
+      return response->body();
+    }
+
+    String header(const char *name) {
+      const AsyncWebHeader *found = response->getHeader(name);
+      return found != NULL ? found->value() : String("(none)");
+    }
+
+};
+
+
+
+
+TEST_F(SessionExportTest, CsvHasEverySampleAndChannel) {
+
+  String body = get("format=csv");
+
+  EXPECT_EQ(response->code(), 200);
+  EXPECT_STREQ(response->contentType().c_str(), "text/csv");
+  EXPECT_STREQ(header("Content-Encoding").c_str(), "(none)");
+  EXPECT_STREQ(header("Content-Disposition").c_str(), "attachment; filename=\"session_001.csv\"");
+
+  std::vector<String> lines = splitLines(body);
+  ASSERT_EQ(lines.size(), (size_t)SESSION_SAMPLES + 1);
+  EXPECT_STREQ(lines[0].c_str(), "timestamp,FlowCFM,FlowKGH,PRefKPA,PDiffKPA,PitotKPA,TempDegC,BaroHPA,RelH");
+
+  char expected[160];
+  for (int sample = 0; sample < SESSION_SAMPLES; sample++) {
+    int length = snprintf(expected, sizeof(expected), "%u", sessionStart + (sample + 1) * SAMPLE_INTERVAL_MS);
+    for (int channel = 0; channel < 8; channel++) {
+      length += snprintf(expected + length, sizeof(expected) - length, ",%.3f", channelValue(sample, channel));
+    }
+    ASSERT_STREQ(lines[sample + 1].c_str(), expected) << "sample " << sample;
+  }
+
+}
+
+TEST_F(SessionExportTest, NdjsonCarriesOnlySelectedChannels) {
+
+  String body = get("format=ndjson&channels=TempDegC,FlowCFM,NotAChannel");
+
+  EXPECT_STREQ(response->contentType().c_str(), "application/x-ndjson");
+  EXPECT_STREQ(header("Content-Disposition").c_str(), "attachment; filename=\"session_001.ndjson\"");
+
+  std::vector<String> lines = splitLines(body);
+  ASSERT_EQ(lines.size(), (size_t)SESSION_SAMPLES);
+
+  for (int sample = 0; sample < SESSION_SAMPLES; sample++) {
+    JsonDocument line;
+    ASSERT_EQ(deserializeJson(line, lines[sample]), DeserializationError::Ok) << lines[sample].c_str();
+    JsonObject object = line.as<JsonObject>();
+    ASSERT_EQ(object.size(), 3u) << lines[sample].c_str();
+    EXPECT_EQ(line["timestamp"].as<uint32_t>(), sessionStart + (sample + 1) * SAMPLE_INTERVAL_MS);
+    EXPECT_NEAR(line["FlowCFM"].as<double>(), channelValue(sample, 0), 5e-4);
+    EXPECT_NEAR(line["TempDegC"].as<double>(), channelValue(sample, 5), 5e-4);
+  }
+
+}
+
+TEST_F(SessionExportTest, GzipDecodesToThePlainExport) {
+
+  String plain = get("format=csv");
+  String compressed = get("format=csv", "gzip, deflate");
+
+  EXPECT_STREQ(header("Content-Encoding").c_str(), "gzip");
+
+  String decoded;
+  ASSERT_TRUE(gunzip(compressed, decoded));
+  EXPECT_EQ(decoded.length(), plain.length());
+  EXPECT_TRUE(decoded == plain);
+
+  // Several fold smaller on the wire
+  EXPECT_LT(compressed.length() * 3, plain.length());
+
+  // gzip=0 overrides the client
+  String forcedPlain = get("format=ndjson&gzip=0", "gzip");
+  EXPECT_STREQ(header("Content-Encoding").c_str(), "(none)");
+  String ndjson = get("format=ndjson&gzip=1");
+  EXPECT_STREQ(header("Content-Encoding").c_str(), "gzip");
+  ASSERT_TRUE(gunzip(ndjson, decoded));
+  EXPECT_TRUE(decoded == forcedPlain);
+
+}
+
+TEST_F(SessionExportTest, TimeRangeSelectsSamples) {
+
+  // Samples 100..200 (from and to are ms since the session started)
+  const uint32_t from = 101 * SAMPLE_INTERVAL_MS;
+  const uint32_t to = 201 * SAMPLE_INTERVAL_MS;
+
+  std::vector<String> lines = splitLines(get("format=csv&channels=FlowCFM&from=" + String(from) + "&to=" + String(to)));
+
+  ASSERT_EQ(lines.size(), 102u);
+  EXPECT_STREQ(lines[0].c_str(), "timestamp,FlowCFM");
+  for (int i = 1; i < (int)lines.size(); i++) {
+    int sample = 99 + i;
+    EXPECT_EQ((uint32_t)lines[i].toInt(), sessionStart + (sample + 1) * SAMPLE_INTERVAL_MS);
+  }
+
+  // A range starting in the last chunk uses the index to skip ahead
+  uint32_t lastChunkStart = (RECORDER_CHUNK_SAMPLES * 3 + 1) * SAMPLE_INTERVAL_MS;
+  String decoded;
+  ASSERT_TRUE(gunzip(get("format=csv&channels=RelH&from=" + String(lastChunkStart), "gzip"), decoded));
+  lines = splitLines(decoded);
+  EXPECT_EQ(lines.size(), 18u);
+
+}
+
+TEST_F(SessionExportTest, BadRequestsAreRefused) {
+
+  AsyncWebServerRequest noFile(HTTP_GET, "/api/recorder/export");
+  delete response;
+  response = _recorder.exportSession(&noFile);
+  EXPECT_EQ(response->code(), 400);
+
+  AsyncWebServerRequest missing(HTTP_GET, "/api/recorder/export");
+  missing.addParam("file", "/session_999.dfbl");
+  delete response;
+  response = _recorder.exportSession(&missing);
+  EXPECT_EQ(response->code(), 404);
+
+}
+
+
+
+
+int main(int argc, char **argv) {
+
+  ::testing::InitGoogleTest(&argc, argv);
+  ::testing::AddGlobalTestEnvironment(new SessionExportEnvironment());
+
+  return RUN_ALL_TESTS();
+
+}
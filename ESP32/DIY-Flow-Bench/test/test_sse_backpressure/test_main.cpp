@@ -0,0 +1,145 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file test_main.cpp
+ *
+ * @brief Host tests for SSE backpressure and rate adaptation
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * A stalled client next to one that keeps up. The host event source only hands messages to the client
+ * when the test calls deliver(), so a client that is not delivered is a client whose network has stalled.
+ *
+ *   pio test -e native -f test_sse_backpressure
+ *
+ ***/
+#include <gtest/gtest.h>
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <ESPAsyncWebServer.h>
+
+#include "constants.h"
+#include "system.h"
+#include "structs.h"
+
+#include "publisher.h"
+
+
+extern struct BenchSettings settings;
+extern struct SensorData sensorVal;
+
+
+class SSEBackpressure : public ::testing::Test {
+
+  protected:
+
+    AsyncWebServer server{8080};
+    Publisher publisher;
+    AsyncEventSourceClient *fast = NULL;
+    AsyncEventSourceClient *slow = NULL;
+    JsonDocument stats;
+
+    void SetUp() override {
+      HAL::serialCapture(true);
+      settings.rounding_type = NONE;
+      sensorVal.PRefH2O = -28.0;
+      publisher.begin(&server);
+      AsyncEventSource *source = server.eventSource(publisher.topicPath(SSE_TOPIC_FLOW));
+      fast = source->connect();
+      slow = source->connect();
+    }
+
+    void TearDown() override {
+      fast->close();
+      slow->close();
+    }
+
+    // One publish tick, the fast client's network keeps up and the slow client's only when it is draining
+    void tick(bool slowDraining) {
+      sensorVal.FlowCFM += 1.0;
+      publisher.publish();
+      fast->deliver();
+      fast->received();
+      if (slowDraining) slow->deliver();
+    }
+
+    // Statistics for a client, in connection order
+    JsonObject clientStats(int index) {
+      deserializeJson(stats, publisher.getClientStatsJSON());
+      return stats["CLIENTS"][index];
+    }
+
+};
+
+
+
+
+TEST_F(SSEBackpressure, StalledClientQueueIsBounded) {
+
+  for (int i = 0; i < 50; i++) tick(false);
+
+  EXPECT_EQ(slow->packetsWaiting(), (size_t)SSE_CLIENT_MAX_QUEUED);
+
+  JsonObject slowStats = clientStats(1);
+  EXPECT_EQ(slowStats["SENT"].as<int>(), SSE_CLIENT_MAX_QUEUED);
+  EXPECT_GT(slowStats["DROPPED"].as<int>(), 0);
+  EXPECT_GT(slowStats["MAX_QUEUED_BYTES"].as<int>(), 0);
+
+}
+
+TEST_F(SSEBackpressure, StalledClientIsSlowedToTheMinimumRate) {
+
+  for (int i = 0; i < 50; i++) tick(false);
+
+  EXPECT_EQ(clientStats(1)["UPDATE_RATE"].as<int>(), SSE_UPDATE_RATE * SSE_CLIENT_MAX_RATE_DIVIDER);
+
+}
+
+TEST_F(SSEBackpressure, ClientThatKeepsUpIsNotAffected) {
+
+  for (int i = 0; i < 50; i++) tick(false);
+
+  JsonObject fastStats = clientStats(0);
+  EXPECT_EQ(fastStats["SENT"].as<int>(), 50);
+  EXPECT_EQ(fastStats["DROPPED"].as<int>(), 0);
+  EXPECT_EQ(fastStats["UPDATE_RATE"].as<int>(), SSE_UPDATE_RATE);
+
+}
+
+TEST_F(SSEBackpressure, RecoveredClientStepsBackUpAndGetsTheLatestFrame) {
+
+  for (int i = 0; i < 50; i++) tick(false);
+
+  // The queue drains and the divider steps down one for each clean send, 8 + 7 + ... + 2 ticks
+  for (int i = 0; i < 40; i++) tick(true);
+  slow->received();
+
+  EXPECT_EQ(clientStats(1)["UPDATE_RATE"].as<int>(), SSE_UPDATE_RATE);
+
+  tick(true);
+
+  char latest[32];
+  snprintf(latest, sizeof(latest), "\"FLOW\":%g", sensorVal.FlowCFM);
+  EXPECT_NE(slow->received().find(latest), std::string::npos);
+
+}
+
+
+
+
+int main(int argc, char **argv) {
+
+  ::testing::InitGoogleTest(&argc, argv);
+
+  return RUN_ALL_TESTS();
+
+}
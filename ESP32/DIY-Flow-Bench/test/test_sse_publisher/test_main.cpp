@@ -0,0 +1,204 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file test_main.cpp
+ *
+ * @brief Host tests for the topic based SSE publisher
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * Index and mimic pages subscribed at the same time under load, the client limit and on-change topics.
+ *
+ *   pio test -e native -f test_sse_publisher
+ *
+ ***/
+#include <gtest/gtest.h>
+#include <vector>
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+
+#include "constants.h"
+#include "system.h"
+#include "structs.h"
+
+#include "publisher.h"
+
+
+extern struct BenchSettings settings;
+extern struct DeviceStatus status;
+extern struct SensorData sensorVal;
+
+
+// Number of SSE messages in a client's received stream
+static size_t messageCount(const std::string &stream) {
+
+  size_t count = 0;
+  for (size_t at = stream.find("event: JSON_DATA"); at != std::string::npos; at = stream.find("event: JSON_DATA", at + 1)) count++;
+  return count;
+
+}
+
+
+class SSEPublisher : public ::testing::Test {
+
+  protected:
+
+    AsyncWebServer server{8080};
+    Publisher publisher;
+    std::vector<AsyncEventSourceClient *> clients;
+
+    void SetUp() override {
+      HAL::serialCapture(true);
+      settings.rounding_type = NONE;
+      // Flow is only shown above the minimum bench pressure
+      sensorVal.PRefH2O = -28.0;
+      publisher.begin(&server);
+    }
+
+    void TearDown() override {
+      for (AsyncEventSourceClient *client : clients) client->close();
+    }
+
+    AsyncEventSourceClient * subscribe(int topic) {
+      AsyncEventSourceClient *client = server.eventSource(publisher.topicPath(topic))->connect();
+      clients.push_back(client);
+      return client;
+    }
+
+};
+
+
+
+
+TEST_F(SSEPublisher, IndexAndMimicClientsAreServedTogether) {
+
+  std::vector<AsyncEventSourceClient *> index;
+  std::vector<AsyncEventSourceClient *> mimic;
+
+  for (int i = 0; i < SSE_MAX_CLIENTS / 2; i++) {
+    index.push_back(subscribe(SSE_TOPIC_FLOW));
+    mimic.push_back(subscribe(SSE_TOPIC_MIMIC));
+  }
+
+  EXPECT_EQ(publisher.subscriberCount(SSE_TOPIC_FLOW), (size_t)SSE_MAX_CLIENTS / 2);
+  EXPECT_EQ(publisher.subscriberCount(SSE_TOPIC_MIMIC), (size_t)SSE_MAX_CLIENTS / 2);
+  EXPECT_EQ(publisher.subscriberCount(), (size_t)SSE_MAX_CLIENTS);
+
+  sensorVal.FlowCFM = 150.5;
+  publisher.publish();
+
+  std::string indexFrame;
+  for (AsyncEventSourceClient *client : index) {
+    ASSERT_EQ(client->deliver(), 1u);
+    std::string frame = client->received();
+    EXPECT_NE(frame.find("\"FLOW\":150.5"), std::string::npos) << frame;
+    if (indexFrame.empty()) indexFrame = frame;
+    EXPECT_EQ(frame, indexFrame);
+  }
+
+  for (AsyncEventSourceClient *client : mimic) {
+    ASSERT_EQ(client->deliver(), 1u);
+    std::string frame = client->received();
+    EXPECT_NE(frame.find("\"MAF_ADC\""), std::string::npos) << frame;
+    EXPECT_EQ(frame.find("\"FLOW\":"), std::string::npos);
+  }
+
+}
+
+TEST_F(SSEPublisher, EveryTickReachesEveryClientThatKeepsUp) {
+
+  const int ticks = 500;
+
+  for (int i = 0; i < SSE_MAX_CLIENTS; i++) subscribe(i % 2 ? SSE_TOPIC_MIMIC : SSE_TOPIC_FLOW);
+
+  std::vector<std::string> streams(clients.size());
+
+  for (int tick = 0; tick < ticks; tick++) {
+    sensorVal.FlowCFM = tick;
+    publisher.publish();
+    for (size_t i = 0; i < clients.size(); i++) {
+      clients[i]->deliver();
+      streams[i] += clients[i]->received();
+    }
+  }
+
+  for (size_t i = 0; i < clients.size(); i++) {
+    EXPECT_EQ(messageCount(streams[i]), (size_t)ticks) << "client " << i;
+  }
+
+  // The last index frame carries the last value
+  EXPECT_NE(streams[0].rfind("\"FLOW\":499"), std::string::npos);
+
+}
+
+TEST_F(SSEPublisher, SubscribersBeyondTheLimitAreClosed) {
+
+  for (int i = 0; i < SSE_MAX_CLIENTS; i++) {
+    EXPECT_TRUE(subscribe(SSE_TOPIC_FLOW)->connected());
+  }
+
+  AsyncEventSourceClient *extra = subscribe(SSE_TOPIC_MIMIC);
+
+  EXPECT_FALSE(extra->connected());
+  EXPECT_EQ(publisher.subscriberCount(), (size_t)SSE_MAX_CLIENTS);
+  EXPECT_NE(publisher.getClientStatsJSON().indexOf("\"SSE_REJECTED\":1"), -1);
+
+  // A slot freed by a disconnect is reused
+  clients[0]->close();
+  EXPECT_TRUE(subscribe(SSE_TOPIC_MIMIC)->connected());
+
+}
+
+TEST_F(SSEPublisher, TopicsWithoutSubscribersAreNotSent) {
+
+  AsyncEventSourceClient *mimic = subscribe(SSE_TOPIC_MIMIC);
+
+  publisher.publish();
+  mimic->deliver();
+
+  EXPECT_EQ(messageCount(mimic->received()), 1u);
+  EXPECT_EQ(publisher.subscriberCount(SSE_TOPIC_FLOW), 0u);
+
+}
+
+TEST_F(SSEPublisher, OnChangeTopicsAreOnlyResentWhenTheyChange) {
+
+  status.alarmMessage = "";
+  AsyncEventSourceClient *alarms = subscribe(SSE_TOPIC_ALARMS);
+
+  // A new subscriber gets the current state once
+  publisher.publish();
+  publisher.publish();
+  alarms->deliver();
+  EXPECT_EQ(messageCount(alarms->received()), 1u);
+
+  status.alarmMessage = "Low reference pressure";
+  publisher.publish();
+  publisher.publish();
+  alarms->deliver();
+
+  std::string stream = alarms->received();
+  EXPECT_EQ(messageCount(stream), 1u);
+  EXPECT_NE(stream.find("Low reference pressure"), std::string::npos) << stream;
+
+}
+
+
+
+
+int main(int argc, char **argv) {
+
+  ::testing::InitGoogleTest(&argc, argv);
+
+  return RUN_ALL_TESTS();
+
+}
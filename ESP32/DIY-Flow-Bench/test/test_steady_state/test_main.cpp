@@ -0,0 +1,369 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file test_main.cpp
+ *
+ * @brief Host tests for the steady state detector and lift point auto capture
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * Samples are fed the way the sensor task does (BenchState::update() then SteadyState::push()) at the
+ * uneven 400 / 800 ms cycle of the real sensor loop. The sliding window stats are checked against a
+ * direct recompute, then settle curves (first order, and underdamped with overshoot) are run through
+ * auto capture and the time to capture is compared with a fixed wait.
+ *
+ *   pio test -e native -f test_steady_state
+ *
+ ***/
+#include <gtest/gtest.h>
+#include <cmath>
+#include <deque>
+#include <functional>
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+#include "constants.h"
+#include "system.h"
+#include "structs.h"
+
+#include "benchstate.h"
+#include "steadystate.h"
+
+
+#define SETTLED_FLOW 182.0
+#define SETTLED_PREF 28.0
+#define SETTLE_TAU_MS 800.0
+#define FIXED_WAIT_MS 10000       // Fixed wait before reading a point by eye
+
+
+extern struct SensorData sensorVal;
+extern struct BenchSettings settings;
+extern struct Configuration config;
+extern struct ValveLiftData valveData;
+
+typedef std::function<double(uint32_t)> Trace;  // value at ms since the start of the trace
+
+
+struct Sample {
+  uint32_t time;
+  double flow;
+};
+
+
+class SteadyStateTest : public ::testing::Test {
+
+  protected:
+
+    static uint32_t now;
+    std::deque<Sample> window;
+
+    void SetUp() override {
+      settings.data_capture_datatype = ACFM;
+      settings.steady_flow_tolerance = 0.5;
+      settings.steady_pref_tolerance = 1.0;
+      settings.min_flow_rate = 5.0;
+      settings.min_bench_pressure = 2.0;
+      config.iPREF_SENS_TYP = MPXV7007;
+      SteadyState::disarm();
+      // Bench off long enough for the window to empty
+      now += STEADY_WINDOW_MS + BENCH_STOP_TIME_MS + 1000;
+      sample(0.0, 0.0, 0);
+      sample(0.0, 0.0, BENCH_STOP_TIME_MS + 10);
+      ASSERT_FALSE(BenchState::isRunning());
+    }
+
+    // One sensor task cycle, intervalMs after the last
+    void sample(double flow, double pRef, uint32_t intervalMs) {
+      now += intervalMs;
+      HAL::setClock(now);
+      sensorVal.FlowCFM = flow;
+      sensorVal.PRefH2O = -pRef;
+      BenchState::update(flow, -pRef, now);
+      SteadyState::push(now);
+
+      window.push_back({now, flow});
+      while (window.size() > STEADY_WINDOW_SAMPLES || now - window.front().time > STEADY_WINDOW_MS) window.pop_front();
+    }
+
+    // Play traces at the real sensor loop spacing (the BME slot makes every other cycle longer)
+    uint32_t play(const Trace &flow, const Trace &pRef, uint32_t durationMs, std::function<bool()> until = nullptr) {
+      uint32_t t = 0;
+      for (int cycle = 0; t < durationMs; cycle++) {
+        sample(flow(t), pRef(t), cycle ? ((cycle % 2) ? 400 : 800) : 400);
+        if (until && until()) return t;
+        t += (cycle % 2) ? 800 : 400;
+      }
+      return t;
+    }
+
+};
+
+uint32_t SteadyStateTest::now = 1000;
+
+
+// Repeatable noise, +-amplitude as a fraction of the value
+static double noise(uint32_t t, double amplitude) {
+
+  uint32_t x = (t + 17) * 2654435761u;
+  x ^= x >> 13;
+  x *= 0x5bd1e995;
+  x ^= x >> 15;
+  return amplitude * (((x & 0xFFFF) / 32767.5) - 1.0);
+
+}
+
+static Trace firstOrder(double from, double to, double noiseFraction) {
+
+  return [=](uint32_t t) { return (from + (to - from) * (1.0 - exp(-(double)t / SETTLE_TAU_MS))) * (1.0 + noise(t, noiseFraction)); };
+
+}
+
+// Valve step with overshoot and ringing
+static Trace underdamped(double from, double to, double noiseFraction) {
+
+  return [=](uint32_t t) { return (from + (to - from) * (1.0 - exp(-(double)t / 1500.0) * cos(t / 700.0))) * (1.0 + noise(t, noiseFraction)); };
+
+}
+
+static Trace constant(double value) {
+
+  return [=](uint32_t) { return value; };
+
+}
+
+
+static JsonDocument status() {
+
+  JsonDocument json;
+  EXPECT_FALSE(deserializeJson(json, SteadyState::getStatusJSON()));
+  return json;
+
+}
+
+
+// Point of the last auto capture if it was in this run, else 0
+static int capturedPoint(int run) {
+
+  JsonDocument json = status();
+  return (json["LAST_CAPTURE"]["RUN"].as<int>() == run) ? json["LAST_CAPTURE"]["POINT"].as<int>() : 0;
+
+}
+
+
+
+
+TEST_F(SteadyStateTest, WindowMustSpanItsTimeBeforeSteady) {
+
+  // A perfectly flat reading is not steady until a sample has aged out, however many samples arrive
+  uint32_t start = window.front().time;
+  for (int i = 0; i < 100; i++) {
+    sample(SETTLED_FLOW, SETTLED_PREF, 50);
+    if (now - start <= STEADY_WINDOW_MS) {
+      EXPECT_FALSE(SteadyState::windowFull()) << "sample " << i;
+      EXPECT_FALSE(SteadyState::isSteady()) << "sample " << i;
+    }
+  }
+  EXPECT_TRUE(SteadyState::windowFull());
+  EXPECT_TRUE(SteadyState::isSteady());
+
+  // After the bench stands idle the window starts again from empty
+  now += STEADY_WINDOW_MS * 3;
+  for (int i = 0; i < STEADY_MIN_SAMPLES + 2; i++) sample(SETTLED_FLOW, SETTLED_PREF, 100);
+  EXPECT_FALSE(SteadyState::windowFull());
+  EXPECT_FALSE(SteadyState::isSteady());
+
+}
+
+TEST_F(SteadyStateTest, SlidingStatsMatchDirectRecompute) {
+
+  // Uneven spacing across several ring laps, with a drift so the slope is not zero
+  uint32_t t = 0;
+  for (int i = 0; i < STEADY_WINDOW_SAMPLES * 6; i++) {
+    uint32_t interval = 20 + (uint32_t)(fabs(noise(i, 1.0)) * 600);
+    t += interval;
+    sample(SETTLED_FLOW * (1.0 + noise(t, 0.02)) + 0.004 * t, SETTLED_PREF, interval);
+
+    if (window.size() < 2) continue;
+
+    double n = window.size();
+    double sum = 0.0;
+    double sumT = 0.0;
+    for (const Sample &s : window) {
+      sum += s.flow;
+      sumT += (s.time - window.front().time) / 1000.0;
+    }
+    double mean = sum / n;
+    double tMean = sumT / n;
+    double m2 = 0.0;
+    double stt = 0.0;
+    double stv = 0.0;
+    for (const Sample &s : window) {
+      double dt = (s.time - window.front().time) / 1000.0 - tMean;
+      m2 += (s.flow - mean) * (s.flow - mean);
+      stt += dt * dt;
+      stv += dt * (s.flow - mean);
+    }
+    double stdDev = sqrt(m2 / (n - 1.0));
+
+    SteadyStats stats = SteadyState::flowStats();
+    ASSERT_NEAR(stats.mean, mean, 1e-4 * fabs(mean)) << "sample " << i;
+    ASSERT_NEAR(stats.stdDev, stdDev, 1e-3 * stdDev + 1e-4) << "sample " << i;
+    ASSERT_NEAR(stats.slope, stv / stt, 1e-3 * fabs(stv / stt) + 1e-3) << "sample " << i;
+    ASSERT_NEAR(stats.ci95, STEADY_CI_Z * stdDev / sqrt(n), 1e-3 * stdDev + 1e-4) << "sample " << i;
+    EXPECT_EQ(status()["WINDOW_SAMPLES"].as<uint32_t>(), window.size());
+  }
+
+}
+
+TEST_F(SteadyStateTest, DriftAndNoiseAreNotSteady) {
+
+  // A slow creep of 1% across the window, with almost no noise
+  play([](uint32_t t) { return SETTLED_FLOW * (1.0 + 0.01 * t / STEADY_WINDOW_MS) * (1.0 + noise(t, 0.0005)); }, constant(SETTLED_PREF), 12000);
+  EXPECT_TRUE(SteadyState::windowFull());
+  EXPECT_FALSE(SteadyState::flowStats().steady);
+  EXPECT_NEAR(SteadyState::flowStats().slope, SETTLED_FLOW * 0.01 / (STEADY_WINDOW_MS / 1000.0), SETTLED_FLOW * 0.001);
+
+  // Flat but noisy beyond the tolerance
+  play([](uint32_t t) { return SETTLED_FLOW * (1.0 + noise(t, 0.02)); }, constant(SETTLED_PREF), 12000);
+  EXPECT_FALSE(SteadyState::flowStats().steady);
+  EXPECT_GT(SteadyState::flowStats().stdDev, SETTLED_FLOW * 0.005);
+
+  // Flow settled but pRef still moving
+  play(constant(SETTLED_FLOW), [](uint32_t t) { return SETTLED_PREF * (1.0 + noise(t, 0.05)); }, 12000);
+  EXPECT_TRUE(SteadyState::flowStats().steady);
+  EXPECT_FALSE(SteadyState::pRefStats().steady);
+  EXPECT_FALSE(SteadyState::isSteady());
+
+  // No pRef sensor fitted, pRef is not waited on
+  config.iPREF_SENS_TYP = SENSOR_DISABLED;
+  play(constant(SETTLED_FLOW), [](uint32_t t) { return SETTLED_PREF * (1.0 + noise(t, 0.05)); }, 2000);
+  EXPECT_TRUE(SteadyState::isSteady());
+  config.iPREF_SENS_TYP = MPXV7007;
+
+}
+
+TEST_F(SteadyStateTest, BenchMustBeRunning) {
+
+  // Below the start threshold the readings are flat but the bench is off
+  play(constant(1.0), constant(1.0), 8000);
+  EXPECT_TRUE(SteadyState::flowStats().steady);
+  EXPECT_FALSE(BenchState::isRunning());
+  EXPECT_FALSE(SteadyState::isSteady());
+
+}
+
+TEST_F(SteadyStateTest, AutoCaptureOnFirstOrderSettle) {
+
+  valveData.run[0].pointCount = 3;
+  ASSERT_TRUE(SteadyState::arm(0, 1));
+
+  uint32_t captured = play(firstOrder(0.0, SETTLED_FLOW, 0.0025), firstOrder(0.0, SETTLED_PREF, 0.0025), 30000, []() { return capturedPoint(0) == 1; });
+  ASSERT_LT(captured, 30000u);
+
+  JsonDocument json = status();
+  double flow = json["LAST_CAPTURE"]["FLOW"].as<double>();
+  double ci95 = json["LAST_CAPTURE"]["FLOW_CI95"].as<double>();
+  uint32_t settle = json["LAST_CAPTURE"]["SETTLE_MS"].as<uint32_t>();
+
+  EXPECT_EQ(json["LAST_CAPTURE"]["POINT"].as<int>(), 1);
+  EXPECT_EQ(json["POINT"].as<int>(), 2);
+  EXPECT_NEAR(valveData.run[0].flow[0], flow, 1e-3);
+  EXPECT_NEAR(flow, SETTLED_FLOW, SETTLED_FLOW * settings.steady_flow_tolerance / 100.0);
+  EXPECT_NEAR(json["LAST_CAPTURE"]["PREF"].as<double>(), SETTLED_PREF, SETTLED_PREF * settings.steady_pref_tolerance / 100.0);
+  EXPECT_GT(ci95, 0.0);
+  EXPECT_LT(ci95, SETTLED_FLOW * 0.005);
+
+  // Quicker than a fixed wait, and not so quick that it caught the tail of the rise
+  EXPECT_LT(settle, (uint32_t)FIXED_WAIT_MS);
+  EXPECT_GT(settle, (uint32_t)STEADY_WINDOW_MS);
+  RecordProperty("time_to_capture_ms", settle);
+  RecordProperty("fixed_wait_ms", FIXED_WAIT_MS);
+  printf("First order settle: captured after %u ms (fixed wait %d ms)\n", settle, FIXED_WAIT_MS);
+
+  SteadyState::disarm();
+
+}
+
+TEST_F(SteadyStateTest, AutoCaptureWaitsOutOvershoot) {
+
+  // Settle from the previous point with overshoot - an instantaneous read at the first peak is well off
+  play(constant(120.0), constant(SETTLED_PREF), 6000);
+  valveData.run[1].pointCount = 2;
+
+  Trace flow = underdamped(120.0, SETTLED_FLOW, 0.002);
+  EXPECT_GT(flow(2100), SETTLED_FLOW * 1.01);
+
+  // Armed as the valve is moved (arming while already steady captures straight away)
+  bool armed = false;
+  std::function<bool()> until = [&armed]() {
+    if (!armed) armed = SteadyState::arm(1, 1);
+    return capturedPoint(1) == 1;
+  };
+
+  uint32_t captured = play(flow, constant(SETTLED_PREF), 30000, until);
+  ASSERT_LT(captured, 30000u);
+
+  JsonDocument json = status();
+  uint32_t settle = json["LAST_CAPTURE"]["SETTLE_MS"].as<uint32_t>();
+  EXPECT_NEAR(json["LAST_CAPTURE"]["FLOW"].as<double>(), SETTLED_FLOW, SETTLED_FLOW * settings.steady_flow_tolerance / 100.0);
+  EXPECT_GT(captured, 2100u);
+  EXPECT_LT(settle, (uint32_t)FIXED_WAIT_MS);
+  RecordProperty("time_to_capture_ms", settle);
+  printf("Underdamped settle: captured after %u ms (fixed wait %d ms)\n", settle, FIXED_WAIT_MS);
+
+  SteadyState::disarm();
+
+}
+
+TEST_F(SteadyStateTest, AutoCaptureStepsThroughTheRun) {
+
+  const double levels[] = {40.0, 95.0, 150.0};
+  valveData.run[2].pointCount = 3;
+
+  play(constant(levels[0]), constant(SETTLED_PREF), 500);
+  ASSERT_TRUE(SteadyState::arm(2, 1));
+
+  double previous = levels[0];
+  for (int point = 0; point < 3; point++) {
+    if (point > 0) {
+      // Holding the same valve position does not capture the next point
+      play(constant(previous), constant(SETTLED_PREF), 6000);
+      EXPECT_EQ(status()["POINT"].as<int>(), point + 1);
+      EXPECT_EQ(capturedPoint(2), point);
+    }
+    play(firstOrder(previous, levels[point], 0.002), constant(SETTLED_PREF), 15000, [point]() { return capturedPoint(2) == point + 1; });
+    EXPECT_NEAR(valveData.run[2].flow[point], levels[point], levels[point] * settings.steady_flow_tolerance / 100.0) << "point " << point + 1;
+    previous = levels[point];
+  }
+
+  // Run complete
+  EXPECT_FALSE(status()["ARMED"].as<bool>());
+  EXPECT_EQ(valveData.activeRun, 2);
+
+  // Out of range
+  EXPECT_FALSE(SteadyState::arm(-1, 1));
+  EXPECT_FALSE(SteadyState::arm(LIFT_PROFILE_MAX_RUNS, 1));
+  EXPECT_FALSE(SteadyState::arm(2, 0));
+  EXPECT_FALSE(SteadyState::arm(2, 4));
+
+}
+
+
+
+
+int main(int argc, char **argv) {
+
+  ::testing::InitGoogleTest(&argc, argv);
+
+  return RUN_ALL_TESTS();
+
+}
@@ -0,0 +1,257 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file test_main.cpp
+ *
+ * @brief Host tests for the data partition storage and its in-RAM file index
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * Each test mounts a fresh filesystem root in a temporary directory. Files are seeded directly on the
+ * host so the index can be checked against what is really on 'flash', and a SPIFFS partition is
+ * migrated into LittleFS.
+ *
+ *   pio test -e native -f test_storage
+ *
+ ***/
+#include <gtest/gtest.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <Arduino.h>
+#include <FS.h>
+
+#include "constants.h"
+#include "system.h"
+#include "structs.h"
+
+#include "storage.h"
+
+
+static String readHostFile(const String &path) {
+
+  String content;
+  FILE *file = fopen(path.c_str(), "rb");
+  if (file == NULL) return content;
+  int value;
+  while ((value = fgetc(file)) != EOF) content += (char)value;
+  fclose(file);
+  return content;
+
+}
+
+
+static void writeHostFile(const String &path, const String &content) {
+
+  FILE *file = fopen(path.c_str(), "wb");
+  ASSERT_NE(file, (FILE *)NULL) << path.c_str();
+  fwrite(content.c_str(), 1, content.length(), file);
+  fclose(file);
+
+}
+
+
+class StorageTest : public ::testing::Test {
+
+  protected:
+
+    String root;
+
+    void SetUp() override {
+      HAL::serialCapture(true);
+      char directory[] = "/tmp/diyfb_test_XXXXXX";
+      ASSERT_NE(mkdtemp(directory), (char *)NULL);
+      root = String(directory) + "/native_fs";
+      ASSERT_EQ(mkdir(root.c_str(), 0755), 0);
+      HAL::setFilesystemRoot(root.c_str());
+    }
+
+    String hostPath(const char *partition, const char *path) {
+      return root + "/" + partition + path;
+    }
+
+    void seed(const char *partition, const char *path, const String &content) {
+      mkdir((root + "/" + partition).c_str(), 0755);
+      writeHostFile(hostPath(partition, path), content);
+    }
+
+    int indexSize(const char *path) {
+      StorageIndexEntry entry;
+      for (int i = 0; Storage::getEntry(i, entry); i++) {
+        if (strcmp(entry.path, path) == 0) return entry.size;
+      }
+      return -1;
+    }
+
+};
+
+
+
+
+TEST_F(StorageTest, IndexMatchesFilesystemAtBoot) {
+
+  seed("littlefs", "/pins.json", "{\"MAF\":36}");
+  seed("littlefs", "/index.html", String("<html></html>"));
+  mkdir(hostPath("littlefs", "/logs").c_str(), 0755);
+  seed("littlefs", "/logs/session1.bin", String("0123456789"));
+
+  ASSERT_TRUE(Storage::begin());
+
+  EXPECT_STREQ(Storage::type(), "LittleFS");
+  EXPECT_EQ(Storage::fileCount(), 3);
+  EXPECT_EQ(indexSize("/pins.json"), 10);
+  EXPECT_EQ(indexSize("/index.html"), 13);
+  EXPECT_EQ(indexSize("/logs/session1.bin"), 10);
+
+  EXPECT_TRUE(Storage::exists("/logs/session1.bin"));
+  EXPECT_FALSE(Storage::exists("/logs"));
+  EXPECT_FALSE(Storage::exists("/missing.json"));
+
+  StorageIndexEntry entry;
+  EXPECT_FALSE(Storage::getEntry(3, entry));
+  EXPECT_FALSE(Storage::getEntry(-1, entry));
+
+}
+
+TEST_F(StorageTest, IndexFollowsWritesAndRemoves) {
+
+  seed("littlefs", "/config.json", "{}");
+  ASSERT_TRUE(Storage::begin());
+
+  File file = Storage::fs().open("/upload.csv", FILE_WRITE);
+  ASSERT_TRUE(file);
+  file.print("a,b\n");
+  file.close();
+  EXPECT_FALSE(Storage::exists("/upload.csv"));
+
+  Storage::indexFile("/upload.csv");
+  EXPECT_TRUE(Storage::exists("/upload.csv"));
+  EXPECT_EQ(indexSize("/upload.csv"), 4);
+
+  file = Storage::fs().open("/upload.csv", FILE_APPEND);
+  file.print("1,2\n3,4\n");
+  file.close();
+  Storage::indexFile("/upload.csv");
+  EXPECT_EQ(indexSize("/upload.csv"), 12);
+  EXPECT_EQ(Storage::fileCount(), 2);
+
+  EXPECT_TRUE(Storage::remove("/upload.csv"));
+  EXPECT_FALSE(Storage::exists("/upload.csv"));
+  EXPECT_FALSE(Storage::fs().exists("/upload.csv"));
+  EXPECT_EQ(Storage::fileCount(), 1);
+
+  // Unknown paths are not touched
+  EXPECT_FALSE(Storage::remove("/upload.csv"));
+  Storage::indexFile("/never-written.json");
+  EXPECT_EQ(Storage::fileCount(), 1);
+
+}
+
+TEST_F(StorageTest, LookupsDoNotTouchTheFilesystem) {
+
+  seed("littlefs", "/mafdata.json", "[]");
+  ASSERT_TRUE(Storage::begin());
+
+  // Changed behind Storage's back - the index is only refreshed on request
+  unlink(hostPath("littlefs", "/mafdata.json").c_str());
+  seed("littlefs", "/stray.json", "{}");
+
+  EXPECT_TRUE(Storage::exists("/mafdata.json"));
+  EXPECT_FALSE(Storage::exists("/stray.json"));
+
+  Storage::rebuildIndex();
+
+  EXPECT_FALSE(Storage::exists("/mafdata.json"));
+  EXPECT_TRUE(Storage::exists("/stray.json"));
+
+}
+
+TEST_F(StorageTest, SpiffsPartitionIsMigrated) {
+
+  String binary;
+  for (int i = 0; i < 300; i++) binary += (char)(i % 251 + 1);
+
+  seed("spiffs", "/pins.json", "{\"SDA\":21}");
+  seed("spiffs", "/cal.json", binary);
+  seed("spiffs", "/empty.txt", "");
+
+  ASSERT_TRUE(Storage::begin());
+
+  EXPECT_STREQ(Storage::type(), "LittleFS");
+  EXPECT_EQ(readHostFile(hostPath("littlefs", "/pins.json")), "{\"SDA\":21}");
+  EXPECT_EQ(readHostFile(hostPath("littlefs", "/cal.json")), binary);
+  EXPECT_EQ(Storage::fileCount(), 3);
+  EXPECT_EQ(indexSize("/empty.txt"), 0);
+  EXPECT_EQ(indexSize("/cal.json"), 300);
+
+  // Already LittleFS on the next boot
+  ASSERT_TRUE(Storage::begin());
+  EXPECT_STREQ(Storage::type(), "LittleFS");
+  EXPECT_EQ(Storage::fileCount(), 3);
+
+}
+
+TEST_F(StorageTest, SpiffsThatDoesNotFitIsLeftInPlace) {
+
+  char path[STORAGE_PATH_LENGTH];
+  for (int i = 0; i <= STORAGE_MAX_FILES; i++) {
+    snprintf(path, sizeof(path), "/session%d.log", i);
+    seed("spiffs", path, "x");
+  }
+
+  ASSERT_TRUE(Storage::begin());
+
+  EXPECT_STREQ(Storage::type(), "SPIFFS");
+  EXPECT_TRUE(Storage::fs().exists("/session0.log"));
+  EXPECT_EQ(Storage::fileCount(), STORAGE_MAX_FILES);
+
+  struct stat info;
+  EXPECT_NE(stat(hostPath("littlefs", "").c_str(), &info), 0);
+
+}
+
+TEST_F(StorageTest, FullIndexRefusesNewEntries) {
+
+  char path[STORAGE_PATH_LENGTH];
+  for (int i = 0; i < STORAGE_MAX_FILES; i++) {
+    snprintf(path, sizeof(path), "/run%d.csv", i);
+    seed("littlefs", path, "1");
+  }
+
+  ASSERT_TRUE(Storage::begin());
+  ASSERT_EQ(Storage::fileCount(), STORAGE_MAX_FILES);
+
+  File file = Storage::fs().open("/overflow.csv", FILE_WRITE);
+  file.print("2");
+  file.close();
+  Storage::indexFile("/overflow.csv");
+
+  EXPECT_FALSE(Storage::exists("/overflow.csv"));
+  EXPECT_EQ(Storage::fileCount(), STORAGE_MAX_FILES);
+
+  // Removing a file frees its slot
+  EXPECT_TRUE(Storage::remove("/run0.csv"));
+  Storage::indexFile("/overflow.csv");
+  EXPECT_TRUE(Storage::exists("/overflow.csv"));
+
+}
+
+
+
+
+int main(int argc, char **argv) {
+
+  ::testing::InitGoogleTest(&argc, argv);
+
+  return RUN_ALL_TESTS();
+
+}
@@ -0,0 +1,381 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file test_main.cpp
+ *
+ * @brief Host tests for the tiered time series history and its range queries
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * Twenty five minutes of 10 Hz samples, with a few gaps, are pushed once on the manual clock. Every
+ * rollup tier is then checked against min / max / mean worked out directly from the pushed samples,
+ * and the query API is read back as JSON.
+ *
+ *   pio test -e native -f test_timeseries
+ *
+ ***/
+#include <gtest/gtest.h>
+#include <map>
+#include <stdlib.h>
+#include <vector>
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <ESPAsyncWebServer.h>
+
+#include "constants.h"
+#include "system.h"
+#include "structs.h"
+
+#include "timeseries.h"
+
+
+#define SERIES_START 3600000
+#define SAMPLE_INTERVAL_MS 100
+#define SERIES_MINUTES 25
+
+
+extern struct SensorData sensorVal;
+
+
+struct ReferenceBucket {
+  uint32_t count = 0;
+  double min[TIMESERIES_CHANNEL_COUNT];
+  double max[TIMESERIES_CHANNEL_COUNT];
+  double sum[TIMESERIES_CHANNEL_COUNT];
+};
+
+static std::vector<RecorderSample> pushed;
+
+
+// Uneven values so a mean of means would not match the true mean
+static float channelValue(int sample, int channel) {
+
+  static const float base[TIMESERIES_CHANNEL_COUNT] = {150.0f, 280.0f, -28.0f, -3.5f, 0.0f, 21.5f, 1013.25f, 45.0f};
+
+  return base[channel] + ((sample * 7 + channel * 3) % 23) * 0.5f;
+
+}
+
+
+// Skipped stretches - whole seconds with no samples, and a part second that leaves a short bucket
+static bool inGap(uint32_t offset) {
+
+  if (offset >= 1470000 && offset < 1473000) return true;
+  if (offset >= 1475000 && offset < 1475500) return true;
+  if (offset >= 600000 && offset < 612000) return true;
+  return false;
+
+}
+
+
+class TimeSeriesEnvironment : public ::testing::Environment {
+
+  public:
+
+    void SetUp() override {
+      HAL::serialCapture(true);
+      ASSERT_TRUE(TimeSeries::begin());
+
+      // A bucket closes once the tier below closes one in the next period. Ending on the first sample
+      // of 25:11 closes 25:10 (1s), 25:00 (10s) and 24:00 (1m), leaving one bucket open in each tier
+      int sample = 0;
+      for (uint32_t offset = 0; offset <= SERIES_MINUTES * 60000 + 11000; offset += SAMPLE_INTERVAL_MS, sample++) {
+        if (inGap(offset)) continue;
+        HAL::setClock(SERIES_START + offset);
+        sensorVal.FlowCFM = channelValue(sample, 0);
+        sensorVal.FlowKGH = channelValue(sample, 1);
+        sensorVal.PRefKPA = channelValue(sample, 2);
+        sensorVal.PDiffKPA = channelValue(sample, 3);
+        sensorVal.PitotKPA = channelValue(sample, 4);
+        sensorVal.TempDegC = channelValue(sample, 5);
+        sensorVal.BaroHPA = channelValue(sample, 6);
+        sensorVal.RelH = channelValue(sample, 7);
+        TimeSeries::push();
+
+        RecorderSample record;
+        record.timestamp = millis();
+        float *value = &record.FlowCFM;
+        for (int channel = 0; channel < TIMESERIES_CHANNEL_COUNT; channel++) value[channel] = channelValue(sample, channel);
+        pushed.push_back(record);
+      }
+    }
+
+};
+
+
+// Buckets of a tier worked out from scratch, keyed by start time. The bucket holding the last sample is still open
+static std::map<uint32_t, ReferenceBucket> referenceBuckets(int tier) {
+
+  std::map<uint32_t, ReferenceBucket> buckets;
+  uint32_t period = TimeSeries::period(tier);
+
+  for (size_t i = 0; i < pushed.size(); i++) {
+    ReferenceBucket &bucket = buckets[pushed[i].timestamp - pushed[i].timestamp % period];
+    const float *value = &pushed[i].FlowCFM;
+    for (int channel = 0; channel < TIMESERIES_CHANNEL_COUNT; channel++) {
+      if (bucket.count == 0 || value[channel] < bucket.min[channel]) bucket.min[channel] = value[channel];
+      if (bucket.count == 0 || value[channel] > bucket.max[channel]) bucket.max[channel] = value[channel];
+      bucket.sum[channel] = (bucket.count == 0 ? 0.0 : bucket.sum[channel]) + value[channel];
+    }
+    bucket.count++;
+  }
+
+  buckets.erase(std::prev(buckets.end()));
+  return buckets;
+
+}
+
+
+static void expectTierMatchesReference(int tier, uint32_t capacity) {
+
+  std::map<uint32_t, ReferenceBucket> reference = referenceBuckets(tier);
+  ASSERT_GT(reference.size(), capacity);
+
+  std::vector<TimeSeriesBucket> buckets(capacity + 10);
+  uint32_t copied = TimeSeries::getBuckets(tier, 0, UINT32_MAX, buckets.data(), buckets.size());
+  ASSERT_EQ(copied, capacity);
+
+  // The ring holds the newest closed buckets, oldest first
+  auto expected = std::prev(reference.end(), capacity);
+  for (uint32_t i = 0; i < copied; i++, expected++) {
+    const TimeSeriesBucket &bucket = buckets[i];
+    ASSERT_EQ(bucket.timestamp, expected->first) << "bucket " << i;
+    EXPECT_EQ(bucket.count, expected->second.count) << bucket.timestamp;
+    for (int channel = 0; channel < TIMESERIES_CHANNEL_COUNT; channel++) {
+      EXPECT_FLOAT_EQ(bucket.min[channel], expected->second.min[channel]) << bucket.timestamp << " channel " << channel;
+      EXPECT_FLOAT_EQ(bucket.max[channel], expected->second.max[channel]) << bucket.timestamp << " channel " << channel;
+      EXPECT_NEAR(bucket.mean[channel], expected->second.sum[channel] / expected->second.count, 0.005) << bucket.timestamp << " channel " << channel;
+    }
+  }
+
+}
+
+
+class TimeSeriesQueryTest : public ::testing::Test {
+
+  protected:
+
+    AsyncWebServerResponse *response = NULL;
+    JsonDocument result;
+
+    void TearDown() override {
+      delete response;
+    }
+
+    bool get(const String &query) {
+      AsyncWebServerRequest request(HTTP_GET, "/api/timeseries");
+      int start = 0;
+      while (start < (int)query.length()) {
+        int end = query.indexOf('&', start);
+        if (end < 0) end = query.length();
+        String pair = query.substring(start, end);
+        int equals = pair.indexOf('=');
+        request.addParam(pair.substring(0, equals), pair.substring(equals + 1));
+        start = end + 1;
+      }
+      delete response;
+      response = TimeSeries::query(&request);
+      result.clear();
+      return response->code() == 200 && !deserializeJson(result, response->body());
+    }
+
+};
+
+
+
+
+TEST(TimeSeries, RawRingKeepsTheNewestSamples) {
+
+  std::vector<RecorderSample> samples(TIMESERIES_RAW_SAMPLES * 2);
+  ASSERT_EQ(TimeSeries::getSamples(0, UINT32_MAX, samples.data(), samples.size()), (uint32_t)TIMESERIES_RAW_SAMPLES);
+
+  size_t first = pushed.size() - TIMESERIES_RAW_SAMPLES;
+  for (int i = 0; i < TIMESERIES_RAW_SAMPLES; i++) {
+    EXPECT_EQ(memcmp(&samples[i], &pushed[first + i], sizeof(RecorderSample)), 0) << "sample " << i;
+  }
+
+  // Both ends of the range are inclusive
+  uint32_t from = pushed[first + 10].timestamp;
+  uint32_t to = pushed[first + 19].timestamp;
+  ASSERT_EQ(TimeSeries::getSamples(from, to, samples.data(), samples.size()), 10u);
+  EXPECT_EQ(samples[0].timestamp, from);
+  EXPECT_EQ(samples[9].timestamp, to);
+
+  EXPECT_EQ(TimeSeries::getSamples(from, to, samples.data(), 4), 4u);
+  EXPECT_EQ(TimeSeries::getSamples(0, pushed[first].timestamp - 1, samples.data(), samples.size()), 0u);
+
+}
+
+TEST(TimeSeries, SecondBucketsMatchTheSamples) {
+
+  expectTierMatchesReference(TIMESERIES_1S, TIMESERIES_1S_BUCKETS);
+
+  // Seconds with no samples leave no bucket, a part second is a short one
+  TimeSeriesBucket buckets[TIMESERIES_1S_BUCKETS];
+  uint32_t copied = TimeSeries::getBuckets(TIMESERIES_1S, SERIES_START + 1469000, SERIES_START + 1476000, buckets, TIMESERIES_1S_BUCKETS);
+  ASSERT_EQ(copied, 5u);
+  EXPECT_EQ(buckets[0].timestamp, (uint32_t)SERIES_START + 1469000);
+  EXPECT_EQ(buckets[1].timestamp, (uint32_t)SERIES_START + 1473000);
+  EXPECT_EQ(buckets[3].timestamp, (uint32_t)SERIES_START + 1475000);
+  EXPECT_EQ(buckets[3].count, 5);
+  EXPECT_EQ(buckets[4].count, 10);
+
+}
+
+TEST(TimeSeries, TenSecondRollupsMatchTheSamples) {
+
+  expectTierMatchesReference(TIMESERIES_10S, TIMESERIES_10S_BUCKETS);
+
+}
+
+TEST(TimeSeries, MinuteRollupsMatchTheSamples) {
+
+  std::map<uint32_t, ReferenceBucket> reference = referenceBuckets(TIMESERIES_1M);
+  ASSERT_EQ(reference.size(), (size_t)SERIES_MINUTES);
+
+  TimeSeriesBucket buckets[TIMESERIES_1M_BUCKETS];
+  ASSERT_EQ(TimeSeries::getBuckets(TIMESERIES_1M, 0, UINT32_MAX, buckets, TIMESERIES_1M_BUCKETS), (uint32_t)SERIES_MINUTES);
+
+  int minute = 0;
+  for (auto &expected : reference) {
+    const TimeSeriesBucket &bucket = buckets[minute++];
+    ASSERT_EQ(bucket.timestamp, expected.first);
+    EXPECT_EQ(bucket.count, expected.second.count) << bucket.timestamp;
+    for (int channel = 0; channel < TIMESERIES_CHANNEL_COUNT; channel++) {
+      EXPECT_FLOAT_EQ(bucket.min[channel], expected.second.min[channel]) << bucket.timestamp << " channel " << channel;
+      EXPECT_FLOAT_EQ(bucket.max[channel], expected.second.max[channel]) << bucket.timestamp << " channel " << channel;
+      EXPECT_NEAR(bucket.mean[channel], expected.second.sum[channel] / expected.second.count, 0.005) << bucket.timestamp << " channel " << channel;
+    }
+  }
+
+  // The gap minute is short by twelve seconds
+  EXPECT_EQ(buckets[10].count, 480);
+  EXPECT_EQ(buckets[0].count, 600);
+
+}
+
+TEST(TimeSeries, OutOfRangeTiersReturnNothing) {
+
+  TimeSeriesBucket bucket;
+
+  EXPECT_EQ(TimeSeries::getBuckets(TIMESERIES_RAW, 0, UINT32_MAX, &bucket, 1), 0u);
+  EXPECT_EQ(TimeSeries::getBuckets(TIMESERIES_TIER_COUNT, 0, UINT32_MAX, &bucket, 1), 0u);
+  EXPECT_EQ(TimeSeries::getBuckets(-1, 0, UINT32_MAX, &bucket, 1), 0u);
+  EXPECT_EQ(TimeSeries::period(TIMESERIES_10S), 10000u);
+  EXPECT_EQ(TimeSeries::period(TIMESERIES_TIER_COUNT), 0u);
+
+}
+
+TEST_F(TimeSeriesQueryTest, DefaultIsEverySecondBucketAndChannel) {
+
+  ASSERT_TRUE(get(""));
+
+  EXPECT_STREQ(response->contentType().c_str(), "application/json");
+  EXPECT_STREQ(result["resolution"].as<String>().c_str(), "1s");
+  EXPECT_EQ(result["period"].as<uint32_t>(), 1000u);
+  EXPECT_EQ(result["now"].as<uint32_t>(), millis());
+  EXPECT_EQ(result["fields"].size(), 3u);
+  EXPECT_EQ(result["channels"].size(), (size_t)TIMESERIES_CHANNEL_COUNT);
+  EXPECT_STREQ(result["channels"][0].as<String>().c_str(), "FlowCFM");
+  EXPECT_STREQ(result["channels"][7].as<String>().c_str(), "RelH");
+
+  TimeSeriesBucket buckets[TIMESERIES_1S_BUCKETS];
+  ASSERT_EQ(TimeSeries::getBuckets(TIMESERIES_1S, 0, UINT32_MAX, buckets, TIMESERIES_1S_BUCKETS), (uint32_t)TIMESERIES_1S_BUCKETS);
+  ASSERT_EQ(result["data"].size(), (size_t)TIMESERIES_1S_BUCKETS);
+
+  for (int row = 0; row < TIMESERIES_1S_BUCKETS; row++) {
+    JsonArray values = result["data"][row];
+    ASSERT_EQ(values.size(), 1u + 3 * TIMESERIES_CHANNEL_COUNT);
+    EXPECT_EQ(values[0].as<uint32_t>(), buckets[row].timestamp);
+    for (int channel = 0; channel < TIMESERIES_CHANNEL_COUNT; channel++) {
+      EXPECT_NEAR(values[1 + channel * 3].as<float>(), buckets[row].min[channel], 0.001);
+      EXPECT_NEAR(values[2 + channel * 3].as<float>(), buckets[row].max[channel], 0.001);
+      EXPECT_NEAR(values[3 + channel * 3].as<float>(), buckets[row].mean[channel], 0.001);
+    }
+  }
+
+  // The open bucket is not served
+  EXPECT_LT(result["data"][TIMESERIES_1S_BUCKETS - 1][0].as<uint32_t>(), millis() - millis() % 1000);
+
+}
+
+TEST_F(TimeSeriesQueryTest, RangeAndChannelsAreSelected) {
+
+  uint32_t from = SERIES_START + 5 * 60000;
+  uint32_t to = SERIES_START + 9 * 60000;
+  ASSERT_TRUE(get("resolution=1m&channels=PRefKPA,FlowCFM,Bogus&from=" + String(from) + "&to=" + String(to)));
+
+  EXPECT_STREQ(result["resolution"].as<String>().c_str(), "1m");
+  ASSERT_EQ(result["channels"].size(), 2u);
+  EXPECT_STREQ(result["channels"][0].as<String>().c_str(), "FlowCFM");
+  EXPECT_STREQ(result["channels"][1].as<String>().c_str(), "PRefKPA");
+
+  TimeSeriesBucket buckets[5];
+  ASSERT_EQ(TimeSeries::getBuckets(TIMESERIES_1M, from, to, buckets, 5), 5u);
+  ASSERT_EQ(result["data"].size(), 5u);
+
+  for (int row = 0; row < 5; row++) {
+    JsonArray values = result["data"][row];
+    ASSERT_EQ(values.size(), 7u);
+    EXPECT_EQ(values[0].as<uint32_t>(), from + row * 60000);
+    EXPECT_NEAR(values[1].as<float>(), buckets[row].min[0], 0.001);
+    EXPECT_NEAR(values[3].as<float>(), buckets[row].mean[0], 0.001);
+    EXPECT_NEAR(values[4].as<float>(), buckets[row].min[2], 0.001);
+    EXPECT_NEAR(values[6].as<float>(), buckets[row].mean[2], 0.001);
+  }
+
+}
+
+TEST_F(TimeSeriesQueryTest, RawRowsCoverTheLastWindow) {
+
+  ASSERT_TRUE(get("resolution=raw&last=2000&channels=RelH"));
+
+  EXPECT_STREQ(result["resolution"].as<String>().c_str(), "raw");
+  EXPECT_EQ(result["period"].as<uint32_t>(), 0u);
+  ASSERT_EQ(result["fields"].size(), 1u);
+  EXPECT_STREQ(result["fields"][0].as<String>().c_str(), "value");
+
+  // 25:09.0 to 25:11.0 inclusive, every 100 ms
+  size_t rows = result["data"].size();
+  ASSERT_EQ(rows, 21u);
+  for (size_t row = 0; row < rows; row++) {
+    const RecorderSample &expected = pushed[pushed.size() - rows + row];
+    JsonArray values = result["data"][row];
+    ASSERT_EQ(values.size(), 2u);
+    EXPECT_EQ(values[0].as<uint32_t>(), expected.timestamp);
+    EXPECT_NEAR(values[1].as<float>(), expected.RelH, 0.001);
+  }
+
+}
+
+TEST_F(TimeSeriesQueryTest, UnknownResolutionIsRefused) {
+
+  EXPECT_FALSE(get("resolution=5s"));
+  EXPECT_EQ(response->code(), 400);
+
+  // A range with nothing in it is still a complete document
+  ASSERT_TRUE(get("resolution=10s&from=1&to=2"));
+  EXPECT_EQ(result["data"].size(), 0u);
+
+}
+
+
+
+
+int main(int argc, char **argv) {
+
+  ::testing::InitGoogleTest(&argc, argv);
+  ::testing::AddGlobalTestEnvironment(new TimeSeriesEnvironment());
+
+  return RUN_ALL_TESTS();
+
+}
@@ -0,0 +1,260 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file test_main.cpp
+ *
+ * @brief Host tests for the trace ring and Chrome trace export
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * Runs on the manual clock. The host cycle counter is micros() * getCpuFreqMHz(), so exported timestamps
+ * should land exactly on the times the records were made. Each test fills the rings so earlier tests
+ * do not show through.
+ *
+ *   pio test -e native -f test_trace
+ *
+ ***/
+#include <gtest/gtest.h>
+#include <vector>
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <ESPAsyncWebServer.h>
+
+#include "constants.h"
+#include "system.h"
+#include "structs.h"
+
+#include "trace.h"
+
+
+struct TraceEvent {
+  std::string name;
+  char phase;
+  double ts;
+  int tid;
+};
+
+
+// Export through the chunked response and return the trace events (metadata events skipped)
+static std::vector<TraceEvent> exportEvents() {
+
+  AsyncWebServerRequest request(HTTP_GET, "/api/trace");
+  AsyncWebServerResponse *response = Trace::exportChromeTrace(&request);
+
+  EXPECT_EQ(response->code(), 200);
+  EXPECT_EQ(response->contentType(), "application/json");
+
+  String body = response->body();
+  delete response;
+
+  JsonDocument trace;
+  DeserializationError error = deserializeJson(trace, body);
+  EXPECT_FALSE(error) << body.substring(0, 200).c_str();
+
+  std::vector<TraceEvent> events;
+  JsonArray traceEvents = trace["traceEvents"];
+  for (size_t i = 0; i < traceEvents.size(); i++) {
+    JsonObject event = traceEvents[i];
+    std::string phase = event["ph"].as<String>().c_str();
+    if (phase == "M") continue;
+    events.push_back({event["name"].as<String>().c_str(), phase[0], event["ts"].as<double>(), event["tid"].as<int>()});
+  }
+
+  return events;
+
+}
+
+
+static std::vector<TraceEvent> coreEvents(const std::vector<TraceEvent> &events, int core) {
+
+  std::vector<TraceEvent> selected;
+  for (const TraceEvent &event : events) if (event.tid == core) selected.push_back(event);
+  return selected;
+
+}
+
+
+// Fill the calling core's ring with ADC cycles, one begin / end pair every 100us lasting 40us
+static uint32_t fillRing(uint32_t startMs) {
+
+  HAL::setClock(startMs);
+
+  for (int i = 0; i < TRACE_RING_SIZE / 2; i++) {
+    TRACE_BEGIN(TRACE_ADC_CYCLE);
+    delayMicroseconds(40);
+    TRACE_END(TRACE_ADC_CYCLE);
+    delayMicroseconds(60);
+  }
+
+  return startMs * 1000;
+
+}
+
+
+
+
+TEST(Trace, ExportIsValidChromeTraceJson) {
+
+  AsyncWebServerRequest request(HTTP_GET, "/api/trace");
+  AsyncWebServerResponse *response = Trace::exportChromeTrace(&request);
+
+  const AsyncWebHeader *disposition = response->getHeader("Content-Disposition");
+  ASSERT_NE(disposition, (const AsyncWebHeader *)NULL);
+  EXPECT_EQ(disposition->value(), "attachment; filename=\"trace.json\"");
+
+  JsonDocument trace;
+  ASSERT_FALSE(deserializeJson(trace, response->body()));
+  delete response;
+
+  EXPECT_EQ(trace["displayTimeUnit"].as<String>(), "ms");
+
+  // One thread name per core
+  JsonArray events = trace["traceEvents"];
+  ASSERT_GE(events.size(), (size_t)portNUM_PROCESSORS);
+  for (int core = 0; core < portNUM_PROCESSORS; core++) {
+    EXPECT_EQ(events[core]["ph"].as<String>(), "M");
+    EXPECT_EQ(events[core]["tid"].as<int>(), core);
+  }
+
+}
+
+TEST(Trace, SmallChunksCarryLinesOver) {
+
+  fillRing(40000);
+
+  AsyncWebServerRequest request(HTTP_GET, "/api/trace");
+  AsyncWebServerResponse *response = Trace::exportChromeTrace(&request);
+  String whole = response->body();
+  delete response;
+
+  // Chunks shorter than the header line and than an event line, as a congested connection hands out
+  for (size_t chunkSize : {1u, 7u, 64u}) {
+    response = Trace::exportChromeTrace(&request);
+    String body = response->body(chunkSize);
+    delete response;
+    EXPECT_EQ(body, whole) << "chunk size " << chunkSize;
+  }
+
+  JsonDocument trace;
+  ASSERT_FALSE(deserializeJson(trace, whole));
+  EXPECT_GT(trace["traceEvents"].size(), (size_t)TRACE_RING_SIZE / 2);
+
+}
+
+TEST(Trace, TimestampsFollowTheClock) {
+
+  uint32_t startUs = fillRing(5000);
+
+  std::vector<TraceEvent> events = coreEvents(exportEvents(), xPortGetCoreID());
+  ASSERT_EQ(events.size(), (size_t)TRACE_RING_SIZE);
+
+  for (size_t i = 0; i < events.size(); i++) {
+    double expected = startUs + (i / 2) * 100 + (i % 2) * 40;
+    ASSERT_EQ(events[i].name, "ADC cycle");
+    ASSERT_EQ(events[i].phase, (i % 2) ? 'E' : 'B');
+    ASSERT_NEAR(events[i].ts, expected, 0.001) << "record " << i;
+  }
+
+}
+
+TEST(Trace, RingKeepsTheNewestRecords) {
+
+  fillRing(10000);
+
+  // Another quarter ring of loop scans pushes out the oldest ADC cycles
+  for (int i = 0; i < TRACE_RING_SIZE / 8; i++) {
+    TRACE_SCOPE(TRACE_LOOP);
+    delayMicroseconds(10);
+  }
+
+  std::vector<TraceEvent> events = coreEvents(exportEvents(), xPortGetCoreID());
+  ASSERT_EQ(events.size(), (size_t)TRACE_RING_SIZE);
+
+  EXPECT_EQ(events.front().name, "ADC cycle");
+  EXPECT_EQ(events[TRACE_RING_SIZE * 3 / 4 - 1].name, "ADC cycle");
+  EXPECT_EQ(events[TRACE_RING_SIZE * 3 / 4].name, "Loop");
+  EXPECT_EQ(events.back().name, "Loop");
+  EXPECT_EQ(events.back().phase, 'E');
+
+  for (size_t i = 1; i < events.size(); i++) {
+    ASSERT_GE(events[i].ts, events[i - 1].ts) << "record " << i;
+  }
+
+}
+
+TEST(Trace, CycleCounterWrapDoesNotBreakTheTimeline) {
+
+  // 240MHz wraps the 32 bit counter every 17.9s, straddle the wrap
+  uint32_t wrapMs = (uint32_t)(4294967296.0 / ESP.getCpuFreqMHz() / 1000.0);
+  uint32_t startUs = fillRing(wrapMs - 20);
+
+  std::vector<TraceEvent> events = coreEvents(exportEvents(), xPortGetCoreID());
+  ASSERT_EQ(events.size(), (size_t)TRACE_RING_SIZE);
+
+  EXPECT_NEAR(events.front().ts, startUs, 0.001);
+  EXPECT_NEAR(events.back().ts, startUs + (TRACE_RING_SIZE / 2 - 1) * 100 + 40, 0.001);
+
+}
+
+TEST(Trace, PausedRecordsAreDropped) {
+
+  fillRing(20000);
+
+  Trace::pause(true);
+  TRACE_BEGIN(TRACE_API_PARSE);
+  TRACE_END(TRACE_API_PARSE);
+  Trace::pause(false);
+
+  for (const TraceEvent &event : exportEvents()) {
+    EXPECT_NE(event.name, "API parse");
+  }
+
+}
+
+TEST(Trace, EachCoreHasItsOwnTrack) {
+
+  fillRing(30000);
+
+  SemaphoreHandle_t done = xSemaphoreCreateBinary();
+  int otherCore = (xPortGetCoreID() == 0) ? 1 : 0;
+
+  xTaskCreatePinnedToCore([](void *parameter) {
+    for (int i = 0; i < TRACE_RING_SIZE / 2; i++) {
+      TRACE_SCOPE(TRACE_SSE_PUBLISH);
+    }
+    xSemaphoreGive((SemaphoreHandle_t)parameter);
+    vTaskDelete(NULL);
+  }, "TRACE_TEST", 4096, done, 1, NULL, otherCore);
+
+  ASSERT_EQ(xSemaphoreTake(done, portMAX_DELAY), pdTRUE);
+
+  std::vector<TraceEvent> events = exportEvents();
+  std::vector<TraceEvent> own = coreEvents(events, xPortGetCoreID());
+  std::vector<TraceEvent> other = coreEvents(events, otherCore);
+
+  ASSERT_EQ(own.size(), (size_t)TRACE_RING_SIZE);
+  ASSERT_EQ(other.size(), (size_t)TRACE_RING_SIZE);
+  for (const TraceEvent &event : own) EXPECT_EQ(event.name, "ADC cycle");
+  for (const TraceEvent &event : other) EXPECT_EQ(event.name, "SSE publish");
+
+}
+
+
+
+
+int main(int argc, char **argv) {
+
+  ::testing::InitGoogleTest(&argc, argv);
+
+  return RUN_ALL_TESTS();
+
+}
@@ -0,0 +1,340 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file test_main.cpp
+ *
+ * @brief Host tests for unit conversions
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * The factor table conversions are checked against the switch() implementations they replaced for
+ * every pair of unit codes, including codes that are not valid for the quantity. The compile time
+ * Units::convert<From, To>() is checked against the runtime path for every pair of typed units, and
+ * Quantity<Unit> only combines with quantities of its own unit.
+ *
+ *   pio test -e native -f test_units
+ *
+ ***/
+#include <gtest/gtest.h>
+#include <cmath>
+#include <functional>
+#include <type_traits>
+#include <utility>
+
+#include <Arduino.h>
+
+#include "constants.h"
+#include "system.h"
+#include "structs.h"
+
+#include "calculations.h"
+#include "units.h"
+
+
+typedef std::function<double(double, int, int)> Converter;  // value, unitsIn, unitsOut
+
+static const double samples[] = {-40.0, -0.5, 0.0, 1.0, 28.0, 101.325, 1234.5};
+static const int invalidCodes[] = {-1, 13, 255};
+
+
+/***********************************************************
+ * Previous switch() implementations, ATM output as fixed by the factor tables
+ ***/
+static double referencePressure(double inputPressure, int unitsOut, int unitsIn) {
+
+  double kpa;
+
+  switch (unitsIn) {
+    case PASCALS: kpa = inputPressure * 0.001; break;
+    case HPA: kpa = inputPressure * 0.1; break;
+    case BAR: kpa = inputPressure * 100; break;
+    case PSIA: kpa = inputPressure * 6.89476; break;
+    case INH2O: kpa = inputPressure * 0.24884; break;
+    case ATM: kpa = inputPressure * 101.325; break;
+    case KPA:
+    default: kpa = inputPressure; break;
+  }
+
+  switch (unitsOut) {
+    case PASCALS: return kpa * 1000;
+    case HPA: return kpa * 10;
+    case BAR: return kpa * 0.01;
+    case PSIA: return kpa * 0.145037738;
+    case KPA: return kpa;
+    case ATM: return kpa * 0.00986923;
+    case INH2O:
+    default: return kpa * 4.01463;
+  }
+
+}
+
+
+static double referenceTemperature(double refTemp, int unitsOut, int unitsIn) {
+
+  double degC;
+
+  switch (unitsIn) {
+    case DEGF: degC = (refTemp - 32) * 0.5556; break;
+    case RANKINE: degC = (refTemp - 491.67) * 0.5556; break;
+    case KELVIN: degC = refTemp - 273.15; break;
+    default: degC = refTemp; break;
+  }
+
+  switch (unitsOut) {
+    case DEGF: return (degC * 1.8) + 32;
+    case RANKINE: return (degC + 273.15) * 1.8;
+    case KELVIN: return degC + 273.15;
+    case DEGC:
+    default: return degC;
+  }
+
+}
+
+
+static double referenceMassFlow(double refFlow, int unitsIn, int unitsOut) {
+
+  double kgh;
+
+  switch (unitsIn) {
+    case MG_S: kgh = refFlow * 0.0036; break;
+    case GM_M: kgh = refFlow * 0.06; break;
+    case KG_H:
+    default: kgh = refFlow; break;
+  }
+
+  switch (unitsOut) {
+    case MG_S: return kgh * 277.778;
+    case GM_M: return kgh * 16.6667;
+    case KG_H:
+    default: return kgh;
+  }
+
+}
+
+
+static double referenceVolumetricFlow(double refFlow, int unitsIn, int unitsOut) {
+
+  double m3h;
+
+  switch (unitsIn) {
+    case CFM: m3h = refFlow * 1.699; break;
+    case LPM: m3h = refFlow * 0.06; break;
+    case M3H:
+    default: m3h = refFlow; break;
+  }
+
+  switch (unitsOut) {
+    case CFM: return m3h * 0.589;
+    case LPM: return m3h * 16.667;
+    case M3H:
+    default: return m3h;
+  }
+
+}
+
+
+// Offsets are folded differently (a * s + b rather than (a + c) * s), so allow for rounding
+static double tolerance(double expected) {
+
+  return 1e-12 * std::max(1.0, std::fabs(expected)) + 1e-12;
+
+}
+
+
+// Every code pair in [first, last] plus the invalid codes, against the reference
+static int expectEveryCodePair(const Converter &converted, const Converter &reference, int first, int last) {
+
+  std::vector<int> codes;
+  for (int code = first; code <= last; code++) codes.push_back(code);
+  for (int code : invalidCodes) codes.push_back(code);
+
+  int pairs = 0;
+  for (int unitsIn : codes) {
+    for (int unitsOut : codes) {
+      for (double value : samples) {
+        double expected = reference(value, unitsIn, unitsOut);
+        EXPECT_NEAR(converted(value, unitsIn, unitsOut), expected, tolerance(expected)) << "in " << unitsIn << " out " << unitsOut << " value " << value;
+      }
+      pairs++;
+    }
+  }
+  return pairs;
+
+}
+
+
+/***********************************************************
+ * Typed conversions against the runtime tables
+ ***/
+template <typename From, typename To>
+static void expectTypedPair(const Converter &runtime) {
+
+  for (double value : samples) {
+    double expected = runtime(value, From::code, To::code);
+    double typed = Units::convert<From, To>(value);
+    EXPECT_NEAR(typed, expected, tolerance(expected)) << "in " << From::code << " out " << To::code << " value " << value;
+  }
+
+}
+
+template <typename From, typename... To>
+static int expectFromUnit(const Converter &runtime) {
+
+  int pairs[] = {0, (expectTypedPair<From, To>(runtime), 1)...};
+  return sizeof(pairs) / sizeof(pairs[0]) - 1;
+
+}
+
+template <typename... All>
+static int expectEveryTypedPair(const Converter &runtime) {
+
+  int pairs[] = {0, expectFromUnit<All, All...>(runtime)...};
+  int total = 0;
+  for (int count : pairs) total += count;
+  return total;
+
+}
+
+
+// Conversions between known units are constant expressions
+static_assert(Units::convert<Units::KiloPascal, Units::InchWater>(1.0) == 4.01463, "kPa -> inH2O does not fold");
+static_assert(Units::convert<Units::KiloPascal, Units::Pascal>(2.5) == 2500.0, "kPa -> Pa does not fold");
+static_assert(Units::convert<Units::Celsius, Units::Fahrenheit>(100.0) == 212.0, "degC -> degF does not fold");
+static_assert(Units::convert<Units::Celsius, Units::Kelvin>(0.0) == 273.15, "degC -> K does not fold");
+static_assert(Units::Quantity<Units::KiloPascal>(1.0).as<Units::InchWater>().value() == 4.01463, "Quantity kPa -> inH2O does not fold");
+static_assert(Units::Quantity<Units::Celsius>(100.0).as<Units::Fahrenheit>().value() == 212.0, "Quantity degC -> degF does not fold");
+
+
+// True when A < B compiles
+template <typename A, typename B, typename = void>
+struct Comparable : std::false_type {};
+
+template <typename A, typename B>
+struct Comparable<A, B, decltype(void(std::declval<A>() < std::declval<B>()))> : std::true_type {};
+
+
+static Calculations _calculations;
+
+
+
+
+TEST(Units, PressureMatchesPreviousImplementation) {
+
+  Converter converted = [](double value, int unitsIn, int unitsOut) { return _calculations.convertPressure(value, unitsOut, unitsIn); };
+  Converter reference = [](double value, int unitsIn, int unitsOut) { return referencePressure(value, unitsOut, unitsIn); };
+
+  EXPECT_EQ(expectEveryCodePair(converted, reference, DECI, PASCALS), 16 * 16);
+
+  // Defaults are kPa in, inH2O out
+  EXPECT_DOUBLE_EQ(_calculations.convertPressure(10.0, INH2O), 40.1463);
+  EXPECT_DOUBLE_EQ(_calculations.convertPressure(10.0, PERCENT, PERCENT), 40.1463);
+
+  // ATM output used to fall through to the 0.00001 placeholder
+  EXPECT_NEAR(_calculations.convertPressure(101.325, ATM), 1.0, 1e-6);
+  EXPECT_NEAR(_calculations.convertPressure(1.0, KPA, ATM), 101.325, 1e-12);
+
+}
+
+TEST(Units, TemperatureMatchesPreviousImplementation) {
+
+  Converter converted = [](double value, int unitsIn, int unitsOut) { return _calculations.convertTemperature(value, unitsOut, unitsIn); };
+  Converter reference = [](double value, int unitsIn, int unitsOut) { return referenceTemperature(value, unitsOut, unitsIn); };
+
+  EXPECT_EQ(expectEveryCodePair(converted, reference, DECI, PASCALS), 16 * 16);
+
+  EXPECT_DOUBLE_EQ(_calculations.convertTemperature(100.0, DEGF), 212.0);
+  EXPECT_DOUBLE_EQ(_calculations.convertTemperature(0.0, KELVIN), 273.15);
+  EXPECT_NEAR(_calculations.convertTemperature(491.67, DEGC, RANKINE), 0.0, 1e-12);
+
+}
+
+TEST(Units, MassFlowMatchesPreviousImplementation) {
+
+  Converter converted = [](double value, int unitsIn, int unitsOut) { return _calculations.convertMassFlowUnits(value, unitsIn, unitsOut); };
+
+  EXPECT_EQ(expectEveryCodePair(converted, referenceMassFlow, 0, GM_M), 7 * 7);
+  EXPECT_DOUBLE_EQ(_calculations.convertMassFlowUnits(1.0), 277.778);
+
+}
+
+TEST(Units, VolumetricFlowMatchesPreviousImplementation) {
+
+  Converter converted = [](double value, int unitsIn, int unitsOut) { return _calculations.convertVolumetricFlowUnits(value, unitsIn, unitsOut); };
+
+  EXPECT_EQ(expectEveryCodePair(converted, referenceVolumetricFlow, CFM, M3H), 6 * 6);
+
+}
+
+TEST(Units, TypedConversionsMatchRuntimeTables) {
+
+  using namespace Units;
+
+  Converter pressure = [](double value, int unitsIn, int unitsOut) { return _calculations.convertPressure(value, unitsOut, unitsIn); };
+  Converter temperature = [](double value, int unitsIn, int unitsOut) { return _calculations.convertTemperature(value, unitsOut, unitsIn); };
+  Converter massFlow = [](double value, int unitsIn, int unitsOut) { return _calculations.convertMassFlowUnits(value, unitsIn, unitsOut); };
+  Converter volumetricFlow = [](double value, int unitsIn, int unitsOut) { return _calculations.convertVolumetricFlowUnits(value, unitsIn, unitsOut); };
+
+  EXPECT_EQ((expectEveryTypedPair<KiloPascal, Pascal, HectoPascal, Bar, Psi, InchWater, Atmosphere>(pressure)), 7 * 7);
+  EXPECT_EQ((expectEveryTypedPair<Celsius, Fahrenheit, Rankine, Kelvin>(temperature)), 4 * 4);
+  EXPECT_EQ((expectEveryTypedPair<KgPerHour, MgPerSecond, GramPerMinute>(massFlow)), 3 * 3);
+  EXPECT_EQ((expectEveryTypedPair<CubicMetrePerHour, CubicFeetPerMinute, LitrePerMinute>(volumetricFlow)), 3 * 3);
+
+}
+
+TEST(Units, TypedUnitsAreGroupedByDimension) {
+
+  using namespace Units;
+
+  EXPECT_TRUE((std::is_same<Pascal::Dimension, Atmosphere::Dimension>::value));
+  EXPECT_TRUE((std::is_same<Rankine::Dimension, Kelvin::Dimension>::value));
+  EXPECT_FALSE((std::is_same<KiloPascal::Dimension, Celsius::Dimension>::value));
+  EXPECT_FALSE((std::is_same<KgPerHour::Dimension, CubicMetrePerHour::Dimension>::value));
+  EXPECT_FALSE((std::is_same<MgPerSecond::Dimension, LitrePerMinute::Dimension>::value));
+
+}
+
+
+TEST(Units, QuantitiesOnlyMixWithTheSameUnit) {
+
+  using namespace Units;
+
+  typedef Quantity<KiloPascal> Kpa;
+  typedef Quantity<InchWater> InH2O;
+
+  EXPECT_TRUE((Comparable<InH2O, InH2O>::value));
+  EXPECT_FALSE((Comparable<Kpa, InH2O>::value));
+  EXPECT_FALSE((Comparable<Quantity<Celsius>, Quantity<Fahrenheit>>::value));
+  EXPECT_FALSE((Comparable<InH2O, double>::value));
+  EXPECT_FALSE((std::is_convertible<double, InH2O>::value));
+
+  // The pressure checks: a kPa reading against an inH2O limit
+  InH2O limit(4.0);
+  EXPECT_TRUE(Kpa(1.0).as<InchWater>() > limit);
+  EXPECT_FALSE(Kpa(0.99).as<InchWater>() > limit);
+  EXPECT_TRUE(Kpa(0.49).as<InchWater>() < limit * 0.5);
+  EXPECT_FALSE(Kpa(0.5).as<InchWater>() < limit * 0.5);
+
+  EXPECT_DOUBLE_EQ((Kpa(2.0).as<InchWater>() - InH2O(0.5)).value(), 2.0 * 4.01463 - 0.5);
+  EXPECT_DOUBLE_EQ((InH2O(1.0) + InH2O(2.0)).value(), 3.0);
+  EXPECT_DOUBLE_EQ(Quantity<Celsius>(-40.0).as<Fahrenheit>().value(), -40.0);
+
+}
+
+
+
+
+int main(int argc, char **argv) {
+
+  ::testing::InitGoogleTest(&argc, argv);
+
+  return RUN_ALL_TESTS();
+
+}
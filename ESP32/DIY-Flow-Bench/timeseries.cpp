@@ -0,0 +1,479 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file timeseries.cpp
+ *
+ * @brief TimeSeries class - tiered in-RAM trend history with range queries
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * Only the sensor task writes. Open buckets are accumulated in private state and only copied into a
+ * ring when they close, so the spinlock is held for one entry copy at a time by either side. A reader
+ * that falls behind the writer simply skips forward to the oldest entry still in the ring.
+ *
+ ***/
+#include "Arduino.h"
+#include <memory>
+
+#include "system.h"
+#include "constants.h"
+#include "structs.h"
+
+#include "timeseries.h"
+#include "messages.h"
+
+
+#define TIMESERIES_QUERY_HEADER 0
+#define TIMESERIES_QUERY_ROWS 1
+#define TIMESERIES_QUERY_FOOTER 2
+#define TIMESERIES_QUERY_DONE 3
+
+struct TimeSeriesAccumulator {
+  uint32_t timestamp;
+  uint32_t count;
+  float min[TIMESERIES_CHANNEL_COUNT];
+  float max[TIMESERIES_CHANNEL_COUNT];
+  float sum[TIMESERIES_CHANNEL_COUNT];
+};
+
+struct TimeSeriesQuery {
+  int tier = TIMESERIES_1S;
+  uint8_t channels = 0xFF;
+  uint32_t fromTime = 0;
+  uint32_t toTime = UINT32_MAX;
+  uint32_t now = 0;
+  uint32_t sequence = 0;
+  uint32_t last = 0;
+  bool firstRow = true;
+  int stage = TIMESERIES_QUERY_HEADER;
+  char line[TIMESERIES_LINE_LENGTH];
+  int lineLength = 0;
+  int lineOffset = 0;
+};
+
+// Order matches the float members of RecorderSample following the timestamp
+static const char *channelName[TIMESERIES_CHANNEL_COUNT] = {"FlowCFM", "FlowKGH", "PRefKPA", "PDiffKPA", "PitotKPA", "TempDegC", "BaroHPA", "RelH"};
+static const char *tierName[TIMESERIES_TIER_COUNT] = {"raw", "1s", "10s", "1m"};
+static const uint32_t tierPeriod[TIMESERIES_TIER_COUNT] = {0, 1000, 10000, 60000};
+static const uint32_t tierCapacity[TIMESERIES_TIER_COUNT] = {TIMESERIES_RAW_SAMPLES, TIMESERIES_1S_BUCKETS, TIMESERIES_10S_BUCKETS, TIMESERIES_1M_BUCKETS};
+
+static portMUX_TYPE seriesMux = portMUX_INITIALIZER_UNLOCKED;
+static RecorderSample *rawRing = NULL;
+static TimeSeriesBucket *bucketRing[TIMESERIES_TIER_COUNT] = {NULL, NULL, NULL, NULL};
+static volatile uint32_t seriesCount[TIMESERIES_TIER_COUNT] = {0, 0, 0, 0};
+
+// Open buckets - sensor task only
+static TimeSeriesAccumulator accumulator[TIMESERIES_TIER_COUNT];
+
+
+
+
+/***********************************************************
+ * @brief accumulate
+ * @details Fold a sample (count 1) or a closed bucket into an open bucket
+ ***/
+static void accumulate(TimeSeriesAccumulator &open, uint32_t timestamp, const float *minimum, const float *maximum, const float *sum, uint32_t count) {
+
+  if (open.count == 0) {
+    open.timestamp = timestamp;
+    memcpy(open.min, minimum, sizeof(open.min));
+    memcpy(open.max, maximum, sizeof(open.max));
+    memcpy(open.sum, sum, sizeof(open.sum));
+    open.count = count;
+    return;
+  }
+
+  for (int channel = 0; channel < TIMESERIES_CHANNEL_COUNT; channel++) {
+    if (minimum[channel] < open.min[channel]) open.min[channel] = minimum[channel];
+    if (maximum[channel] > open.max[channel]) open.max[channel] = maximum[channel];
+    open.sum[channel] += sum[channel];
+  }
+  open.count += count;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief Class constructor
+ ***/
+TimeSeries::TimeSeries() {
+}
+
+
+
+
+/***********************************************************
+ * @brief begin
+ * @details Allocate the rings. Called from setup() before the sensor task starts
+ * @returns false if out of memory (push() is then a no-op)
+ ***/
+bool TimeSeries::begin() {
+
+  Messages _message;
+
+  if (rawRing != NULL) return true;
+
+  rawRing = (RecorderSample *)malloc(TIMESERIES_RAW_SAMPLES * sizeof(RecorderSample));
+  for (int tier = TIMESERIES_1S; tier < TIMESERIES_TIER_COUNT; tier++) {
+    bucketRing[tier] = (TimeSeriesBucket *)malloc(tierCapacity[tier] * sizeof(TimeSeriesBucket));
+  }
+
+  if (rawRing == NULL || bucketRing[TIMESERIES_1S] == NULL || bucketRing[TIMESERIES_10S] == NULL || bucketRing[TIMESERIES_1M] == NULL) {
+    _message.serialPrintf("Time series history - not enough memory \n");
+    for (int tier = TIMESERIES_1S; tier < TIMESERIES_TIER_COUNT; tier++) {
+      free(bucketRing[tier]);
+      bucketRing[tier] = NULL;
+    }
+    free(rawRing);
+    rawRing = NULL;
+    return false;
+  }
+
+  memset(accumulator, 0, sizeof(accumulator));
+
+  return true;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief push
+ * @details Add the current sensor values to the history (called from the sensor task)
+ ***/
+void TimeSeries::push() {
+
+  extern struct SensorData sensorVal;
+
+  if (rawRing == NULL) return;
+
+  RecorderSample sample;
+  sample.timestamp = millis();
+  sample.FlowCFM = sensorVal.FlowCFM;
+  sample.FlowKGH = sensorVal.FlowKGH;
+  sample.PRefKPA = sensorVal.PRefKPA;
+  sample.PDiffKPA = sensorVal.PDiffKPA;
+  sample.PitotKPA = sensorVal.PitotKPA;
+  sample.TempDegC = sensorVal.TempDegC;
+  sample.BaroHPA = sensorVal.BaroHPA;
+  sample.RelH = sensorVal.RelH;
+
+  addSample(sample);
+
+}
+
+
+
+
+/***********************************************************
+ * @brief addSample
+ * @details Store a full rate sample and add it to the open 1 second bucket
+ ***/
+void TimeSeries::addSample(const RecorderSample &sample) {
+
+  const float *value = &sample.FlowCFM;
+  uint32_t start = sample.timestamp - sample.timestamp % tierPeriod[TIMESERIES_1S];
+
+  portENTER_CRITICAL(&seriesMux);
+  rawRing[seriesCount[TIMESERIES_RAW] & (TIMESERIES_RAW_SAMPLES - 1)] = sample;
+  seriesCount[TIMESERIES_RAW]++;
+  portEXIT_CRITICAL(&seriesMux);
+
+  if (accumulator[TIMESERIES_1S].count > 0 && accumulator[TIMESERIES_1S].timestamp != start) closeBucket(TIMESERIES_1S);
+
+  accumulate(accumulator[TIMESERIES_1S], start, value, value, value, 1);
+
+}
+
+
+
+
+/***********************************************************
+ * @brief closeBucket
+ * @details Move an open bucket into its ring and roll it up into the next tier
+ ***/
+void TimeSeries::closeBucket(int tier) {
+
+  TimeSeriesAccumulator &open = accumulator[tier];
+  TimeSeriesBucket bucket;
+
+  bucket.timestamp = open.timestamp;
+  bucket.count = (open.count > UINT16_MAX) ? UINT16_MAX : open.count;
+  bucket.reserved = 0;
+  for (int channel = 0; channel < TIMESERIES_CHANNEL_COUNT; channel++) {
+    bucket.min[channel] = open.min[channel];
+    bucket.max[channel] = open.max[channel];
+    bucket.mean[channel] = open.sum[channel] / open.count;
+  }
+
+  portENTER_CRITICAL(&seriesMux);
+  bucketRing[tier][seriesCount[tier] % tierCapacity[tier]] = bucket;
+  seriesCount[tier]++;
+  portEXIT_CRITICAL(&seriesMux);
+
+  if (tier + 1 < TIMESERIES_TIER_COUNT) {
+    uint32_t start = open.timestamp - open.timestamp % tierPeriod[tier + 1];
+    if (accumulator[tier + 1].count > 0 && accumulator[tier + 1].timestamp != start) closeBucket(tier + 1);
+    accumulate(accumulator[tier + 1], start, open.min, open.max, open.sum, open.count);
+  }
+
+  open.count = 0;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief readEntry
+ * @details Copy one ring entry
+ * @param sequence entry number, advanced to the oldest entry still held if it has been overwritten
+ * @returns false once sequence reaches the newest entry
+ ***/
+bool TimeSeries::readEntry(int tier, uint32_t &sequence, void *entry) {
+
+  bool found = false;
+
+  portENTER_CRITICAL(&seriesMux);
+
+  uint32_t count = seriesCount[tier];
+
+  if (sequence < count) {
+    if (count - sequence > tierCapacity[tier]) sequence = count - tierCapacity[tier];
+    if (tier == TIMESERIES_RAW) {
+      *(RecorderSample *)entry = rawRing[sequence & (TIMESERIES_RAW_SAMPLES - 1)];
+    } else {
+      *(TimeSeriesBucket *)entry = bucketRing[tier][sequence % tierCapacity[tier]];
+    }
+    found = true;
+  }
+
+  portEXIT_CRITICAL(&seriesMux);
+
+  return found;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief copyRange
+ * @details Copy the entries of a tier with fromTime <= timestamp <= toTime, oldest first
+ * @note Entries are RecorderSample for TIMESERIES_RAW and TimeSeriesBucket for the rollup tiers
+ ***/
+uint32_t TimeSeries::copyRange(int tier, uint32_t fromTime, uint32_t toTime, uint8_t *entries, uint32_t maxEntries) {
+
+  if (tier < TIMESERIES_RAW || tier >= TIMESERIES_TIER_COUNT || rawRing == NULL) return 0;
+
+  size_t entrySize = (tier == TIMESERIES_RAW) ? sizeof(RecorderSample) : sizeof(TimeSeriesBucket);
+  uint32_t last = seriesCount[tier];
+  uint32_t copied = 0;
+
+  // Timestamp is the first member of both entry types
+  for (uint32_t sequence = 0; copied < maxEntries && sequence < last; sequence++) {
+    uint8_t *entry = entries + copied * entrySize;
+    if (!readEntry(tier, sequence, entry)) break;
+    uint32_t timestamp = *(uint32_t *)entry;
+    if (timestamp < fromTime) continue;
+    if (timestamp > toTime) break;
+    copied++;
+  }
+
+  return copied;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief period
+ * @returns bucket length of a tier in ms (0 for full rate samples)
+ ***/
+uint32_t TimeSeries::period(int tier) {
+
+  return (tier >= TIMESERIES_RAW && tier < TIMESERIES_TIER_COUNT) ? tierPeriod[tier] : 0;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief getSamples
+ * @details Copy full rate samples between two millis() timestamps
+ * @returns number of samples copied
+ ***/
+uint32_t TimeSeries::getSamples(uint32_t fromTime, uint32_t toTime, RecorderSample *samples, uint32_t maxSamples) {
+
+  return copyRange(TIMESERIES_RAW, fromTime, toTime, (uint8_t *)samples, maxSamples);
+
+}
+
+
+
+
+/***********************************************************
+ * @brief getBuckets
+ * @details Copy closed rollup buckets starting between two millis() timestamps
+ * @returns number of buckets copied
+ ***/
+uint32_t TimeSeries::getBuckets(int tier, uint32_t fromTime, uint32_t toTime, TimeSeriesBucket *buckets, uint32_t maxBuckets) {
+
+  if (tier == TIMESERIES_RAW) return 0;
+
+  return copyRange(tier, fromTime, toTime, (uint8_t *)buckets, maxBuckets);
+
+}
+
+
+
+
+/***********************************************************
+ * @brief fillQuery
+ * @details Chunked response callback - emit as many whole or partial JSON rows as fit
+ ***/
+size_t TimeSeries::fillQuery(TimeSeriesQuery &query, uint8_t *buffer, size_t maxLen) {
+
+  size_t length = 0;
+
+  while (length < maxLen) {
+
+    // Finish any row left over from the last chunk first
+    if (query.lineOffset < query.lineLength) {
+      size_t piece = min((size_t)(query.lineLength - query.lineOffset), maxLen - length);
+      memcpy(buffer + length, query.line + query.lineOffset, piece);
+      query.lineOffset += piece;
+      length += piece;
+      continue;
+    }
+
+    if (query.stage == TIMESERIES_QUERY_DONE) break;
+
+    char *line = query.line;
+    int lineLimit = sizeof(query.line) - 3;
+    int lineLength = 0;
+
+    switch (query.stage) {
+
+      case TIMESERIES_QUERY_HEADER:
+        lineLength = snprintf(line, sizeof(query.line), "{\"resolution\":\"%s\",\"period\":%u,\"now\":%u,\"fields\":%s,\"channels\":[", tierName[query.tier], tierPeriod[query.tier], query.now, (query.tier == TIMESERIES_RAW) ? "[\"value\"]" : "[\"min\",\"max\",\"mean\"]");
+        for (int channel = 0, count = 0; channel < TIMESERIES_CHANNEL_COUNT; channel++) {
+          if (query.channels & (1 << channel)) lineLength += snprintf(line + lineLength, sizeof(query.line) - lineLength, count++ ? ",\"%s\"" : "\"%s\"", channelName[channel]);
+        }
+        lineLength += snprintf(line + lineLength, sizeof(query.line) - lineLength, "],\"data\":[");
+        query.stage = TIMESERIES_QUERY_ROWS;
+      break;
+
+      case TIMESERIES_QUERY_ROWS: {
+        RecorderSample sample;
+        TimeSeriesBucket bucket;
+        bool raw = (query.tier == TIMESERIES_RAW);
+
+        if (query.sequence >= query.last || !readEntry(query.tier, query.sequence, raw ? (void *)&sample : (void *)&bucket)) {
+          query.stage = TIMESERIES_QUERY_FOOTER;
+          continue;
+        }
+        query.sequence++;
+
+        uint32_t timestamp = raw ? sample.timestamp : bucket.timestamp;
+        if (timestamp < query.fromTime) continue;
+        if (timestamp > query.toTime) {
+          query.stage = TIMESERIES_QUERY_FOOTER;
+          continue;
+        }
+
+        // Channels that would overflow the line are dropped rather than overrunning it
+        lineLength = snprintf(line, sizeof(query.line), query.firstRow ? "\n[%u" : ",\n[%u", timestamp);
+        const float *value = &sample.FlowCFM;
+        for (int channel = 0; channel < TIMESERIES_CHANNEL_COUNT && lineLength < lineLimit; channel++) {
+          if (!(query.channels & (1 << channel))) continue;
+          if (raw) {
+            lineLength += snprintf(line + lineLength, sizeof(query.line) - lineLength, ",%.3f", value[channel]);
+          } else {
+            lineLength += snprintf(line + lineLength, sizeof(query.line) - lineLength, ",%.3f,%.3f,%.3f", bucket.min[channel], bucket.max[channel], bucket.mean[channel]);
+          }
+        }
+        lineLength = min(lineLength, lineLimit);
+        lineLength += snprintf(line + lineLength, sizeof(query.line) - lineLength, "]");
+        query.firstRow = false;
+      break; }
+
+      case TIMESERIES_QUERY_FOOTER:
+        lineLength = snprintf(line, sizeof(query.line), "\n]}");
+        query.stage = TIMESERIES_QUERY_DONE;
+      break;
+    }
+
+    query.lineLength = lineLength;
+    query.lineOffset = 0;
+  }
+
+  return length;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief query
+ * @details Stream one tier as JSON rows of [timestamp, values...] for trend charts
+ * @note Parameters: resolution=raw|1s|10s|1m (default 1s), channels=FlowCFM,PRefKPA,... from / to
+ * (millis() timestamps) or last=ms before now. Buckets still open are not included
+ ***/
+AsyncWebServerResponse * TimeSeries::query(AsyncWebServerRequest *request) {
+
+  if (rawRing == NULL) return request->beginResponse(503, "text/plain", "Time series history not available");
+
+  std::shared_ptr<TimeSeriesQuery> queryState(new (std::nothrow) TimeSeriesQuery());
+  if (!queryState) return request->beginResponse(503, "text/plain", "Not enough memory for query");
+
+  if (request->hasParam("resolution")) {
+    String resolution = request->getParam("resolution")->value();
+    queryState->tier = -1;
+    for (int tier = TIMESERIES_RAW; tier < TIMESERIES_TIER_COUNT; tier++) {
+      if (resolution == tierName[tier]) queryState->tier = tier;
+    }
+    if (queryState->tier < 0) return request->beginResponse(400, "text/plain", "Unknown resolution (raw, 1s, 10s, 1m)");
+  }
+
+  if (request->hasParam("channels")) {
+    String channels = "," + request->getParam("channels")->value() + ",";
+    queryState->channels = 0;
+    for (int channel = 0; channel < TIMESERIES_CHANNEL_COUNT; channel++) {
+      if (channels.indexOf("," + String(channelName[channel]) + ",") >= 0) queryState->channels |= (1 << channel);
+    }
+  }
+
+  queryState->now = millis();
+  if (request->hasParam("from")) queryState->fromTime = request->getParam("from")->value().toInt();
+  if (request->hasParam("to")) queryState->toTime = request->getParam("to")->value().toInt();
+  if (request->hasParam("last")) {
+    uint32_t last = request->getParam("last")->value().toInt();
+    queryState->fromTime = (last < queryState->now) ? queryState->now - last : 0;
+  }
+
+  // Rows added after this point are left for the next poll so the response always ends
+  queryState->last = seriesCount[queryState->tier];
+
+  AsyncWebServerResponse *response = request->beginChunkedResponse("application/json", [queryState](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+    return fillQuery(*queryState, buffer, maxLen);
+  });
+  response->addHeader("Cache-Control", "no-store");
+
+  return response;
+
+}
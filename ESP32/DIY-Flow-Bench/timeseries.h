@@ -0,0 +1,81 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file timeseries.h
+ *
+ * @brief TimeSeries class header file
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * In-RAM trend history fed by the sensor task. Four fixed size rings:
+ *
+ *   TIMESERIES_RAW   - every acquisition sample      (TIMESERIES_RAW_SAMPLES)
+ *   TIMESERIES_1S    - 1 second min / max / mean     (TIMESERIES_1S_BUCKETS)
+ *   TIMESERIES_10S   - 10 second min / max / mean    (TIMESERIES_10S_BUCKETS)
+ *   TIMESERIES_1M    - 1 minute min / max / mean     (TIMESERIES_1M_BUCKETS)
+ *
+ * Each tier is rolled up from the one below when a bucket closes, so the per sample cost is one copy
+ * and a min / max / add per channel. Nothing is ever read back from flash.
+ *
+ ***/
+#pragma once
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+
+#include "system.h"
+#include "constants.h"
+#include "recorder.h"
+
+#define TIMESERIES_CHANNEL_COUNT 8
+
+
+/***********************************************************
+ * @brief Rollup bucket - 104 bytes
+ * @note Channel order matches the float members of RecorderSample
+ ***/
+struct TimeSeriesBucket {
+	uint32_t timestamp;       // Bucket start, millis()
+	uint16_t count;           // Samples in bucket
+	uint16_t reserved;
+	float min[TIMESERIES_CHANNEL_COUNT];
+	float max[TIMESERIES_CHANNEL_COUNT];
+	float mean[TIMESERIES_CHANNEL_COUNT];
+};
+
+
+struct TimeSeriesQuery;
+
+
+class TimeSeries {
+
+	private:
+
+		static void addSample(const RecorderSample &sample);
+		static void closeBucket(int tier);
+		static bool readEntry(int tier, uint32_t &sequence, void *entry);
+		static uint32_t copyRange(int tier, uint32_t fromTime, uint32_t toTime, uint8_t *entries, uint32_t maxEntries);
+		static size_t fillQuery(TimeSeriesQuery &query, uint8_t *buffer, size_t maxLen);
+
+	public:
+
+		TimeSeries();
+
+		static bool begin();
+		static void push();
+
+		static uint32_t period(int tier);
+		static uint32_t getSamples(uint32_t fromTime, uint32_t toTime, RecorderSample *samples, uint32_t maxSamples);
+		static uint32_t getBuckets(int tier, uint32_t fromTime, uint32_t toTime, TimeSeriesBucket *buckets, uint32_t maxBuckets);
+
+		static AsyncWebServerResponse * query(AsyncWebServerRequest *request);
+
+};
@@ -0,0 +1,123 @@
+# Measure DIY Flow Bench serial API throughput and round trip latency
+#
+# Usage: python3 apiSerialBench.py <port> [count] [pipeline depth] [command] [--crc] [--legacy]
+#
+#   python3 apiSerialBench.py /dev/ttyUSB0 1000 8 F
+#   python3 apiSerialBench.py /dev/pts/3 1000 1 "GET FlowCFM,PRefH2O" --crc
+#   python3 apiSerialBench.py /dev/ttyUSB0 100 1 F --legacy
+#
+# Works with any tty, so a pty bridged to the board (e.g. socat / ser2net) can be used as well.
+# Framed requests are '#<id> <command>[*<crc32>]', see API.h for the protocol. With --legacy single
+# character commands are sent one at a time and each newline terminated response is timed.
+
+import os
+import select
+import sys
+import termios
+import time
+import tty
+import zlib
+
+BAUD = termios.B115200
+TIMEOUT = 2.0
+
+args = [a for a in sys.argv[1:] if not a.startswith('--')]
+flags = [a for a in sys.argv[1:] if a.startswith('--')]
+
+if len(args) < 1:
+    sys.exit('Usage: apiSerialBench.py <port> [count] [pipeline depth] [command] [--crc] [--legacy]')
+
+port = args[0]
+count = int(args[1]) if len(args) > 1 else 200
+depth = int(args[2]) if len(args) > 2 else 1
+command = args[3] if len(args) > 3 else 'F'
+use_crc = '--crc' in flags
+legacy = '--legacy' in flags
+
+fd = os.open(port, os.O_RDWR | os.O_NOCTTY)
+tty.setraw(fd)
+attrs = termios.tcgetattr(fd)
+attrs[4] = attrs[5] = BAUD
+termios.tcsetattr(fd, termios.TCSANOW, attrs)
+termios.tcflush(fd, termios.TCIOFLUSH)
+
+pending = b''
+
+
+def read_line(deadline):
+    global pending
+    while b'\n' not in pending:
+        remaining = deadline - time.monotonic()
+        if remaining <= 0:
+            return None
+        ready, _, _ = select.select([fd], [], [], remaining)
+        if ready:
+            pending += os.read(fd, 4096)
+    line, pending = pending.split(b'\n', 1)
+    return line.decode('latin-1')
+
+
+def frame(request_id):
+    text = '#%d %s' % (request_id, command)
+    if use_crc:
+        text += '*%08X' % zlib.crc32(text.encode())
+    return (text + '\n').encode()
+
+
+latency = []
+sent = {}
+errors = 0
+next_id = 1
+start = time.monotonic()
+
+if legacy:
+    for _ in range(count):
+        t = time.monotonic()
+        os.write(fd, command[0].encode())
+        line = read_line(t + TIMEOUT)
+        if line is None:
+            errors += 1
+            continue
+        latency.append(time.monotonic() - t)
+else:
+    while len(latency) + errors < count:
+        while len(sent) < depth and next_id <= count:
+            sent[next_id] = time.monotonic()
+            os.write(fd, frame(next_id))
+            next_id += 1
+        line = read_line(time.monotonic() + TIMEOUT)
+        if line is None:
+            errors += len(sent)
+            sent.clear()
+            continue
+        if not line.startswith('#'):
+            continue  # debug / status output
+        request_id = line[1:].split(' ', 1)[0]
+        if not request_id.isdigit() or int(request_id) not in sent:
+            continue
+        t = sent.pop(int(request_id))
+        if use_crc:
+            body, _, crc = line.rpartition('*')
+            if zlib.crc32(body.encode('latin-1')) != int(crc or '0', 16):
+                errors += 1
+                continue
+        if ' ERR:' in line:
+            errors += 1
+            continue
+        latency.append(time.monotonic() - t)
+
+elapsed = time.monotonic() - start
+os.close(fd)
+
+if not latency:
+    sys.exit('No responses (%d errors)' % errors)
+
+latency.sort()
+print('Command:       %s (%s)' % (command, 'legacy' if legacy else 'framed, depth %d%s' % (depth, ', crc' if use_crc else '')))
+print('Responses:     %d ok, %d errors' % (len(latency), errors))
+print('Throughput:    %.1f commands/s' % (len(latency) / elapsed))
+print('Latency (ms):  min %.2f  median %.2f  p95 %.2f  max %.2f' % (
+    latency[0] * 1000,
+    latency[len(latency) // 2] * 1000,
+    latency[int(len(latency) * 0.95)] * 1000,
+    latency[-1] * 1000))
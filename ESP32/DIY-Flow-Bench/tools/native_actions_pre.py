@@ -0,0 +1,26 @@
+# native_actions_pre.py
+# This file is part of the DIY FLow Bench Project. https//github.com/DeeEmm/DIY-Flow-Bench
+# Author: DeeEmm
+#
+# Pre-build script for [env:native]. Adds the version.json values to the build like
+# user_actions_pre.py, but does not bump the build number, rebuild htmldata.h or touch
+# the release folder, as a host build is not a release.
+import json
+from SCons.Script import Import
+
+Import("env")
+
+# stop the current script execution if called from external script
+if env.IsIntegrationDump():
+    Return()
+
+print("Native pre-build tasks")
+
+file_path = env.subst("$PROJECT_DIR/ESP32/DIY-Flow-Bench/version.json")
+with open(file_path) as file_data:
+    json_data = json.load(file_data)
+
+print("Adding version data to build environment...")
+for key, value in json_data.items():
+    env.Append(CPPDEFINES=[f'{key}=\\"{value}\\"'])
+    print(f'{key}="{value}"')
@@ -0,0 +1,50 @@
+# Decode a DIY Flow Bench session log (session_NNN.dfbl) to CSV
+#
+# Usage: python3 sessionLogDecode.py session_001.dfbl [output.csv]
+#
+# Chunks are checked in order. Decoding stops at the first chunk with a bad magic, sequence or CRC,
+# which is what a power loss during a chunk write leaves behind, or where the chunks of an earlier session
+# start in preallocated space (version 3 seeds each CRC with the session id). See recorder.h for the layout.
+
+import struct
+import sys
+import zlib
+
+FILE_HEADER = struct.Struct('<IHHHHIII8s')
+CHUNK_HEADER = struct.Struct('<IIIIHHI')
+SAMPLE = struct.Struct('<Iffffffff')
+
+RECORDER_MAGIC = 0x4C424644
+RECORDER_CHUNK_MAGIC = 0x4B4E4843
+FIELDS = ['timestamp', 'FlowCFM', 'FlowKGH', 'PRefKPA', 'PDiffKPA', 'PitotKPA', 'TempDegC', 'BaroHPA', 'RelH']
+
+if len(sys.argv) < 2:
+    sys.exit('Usage: sessionLogDecode.py <session.dfbl> [output.csv]')
+
+with open(sys.argv[1], 'rb') as f:
+    data = f.read()
+
+magic, version, sample_size, chunk_size, chunk_samples, start, session, session_id, _ = FILE_HEADER.unpack_from(data, 0)
+if magic != RECORDER_MAGIC or sample_size != SAMPLE.size:
+    sys.exit('Not a session log (or unsupported version)')
+
+out = open(sys.argv[2], 'w') if len(sys.argv) > 2 else sys.stdout
+out.write(','.join(FIELDS) + '\n')
+
+offset = 32 if version < 2 else 512  # version 2 pads the header to one SD sector
+crc_seed = session_id if version >= 3 else 0
+sequence = 0
+while offset + chunk_size <= len(data):
+    chunk = bytearray(data[offset:offset + chunk_size])
+    chunk_magic, chunk_sequence, first, last, count, _, crc = CHUNK_HEADER.unpack_from(chunk, 0)
+    struct.pack_into('<I', chunk, 20, 0)
+    if chunk_magic != RECORDER_CHUNK_MAGIC or chunk_sequence != sequence or zlib.crc32(chunk, crc_seed) != crc:
+        sys.stderr.write('Chunk %d invalid, stopping (torn write?)\n' % sequence)
+        break
+    for i in range(count):
+        values = SAMPLE.unpack_from(chunk, CHUNK_HEADER.size + i * SAMPLE.size)
+        out.write(str(values[0]) + ',' + ','.join('%.4f' % v for v in values[1:]) + '\n')
+    offset += chunk_size
+    sequence += 1
+
+sys.stderr.write('Session %d: %d valid chunks\n' % (session, sequence))
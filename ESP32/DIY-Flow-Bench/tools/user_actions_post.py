@@ -7,6 +7,8 @@ import os
 import datetime
 import re
 import shutil
+import gzip
+import hashlib
 from SCons.Script import Import
 
 Import("env")
@@ -63,6 +65,38 @@ def extract_json_val(jsonKey):
     
 
 
+def create_compressed_update(update_file, release, build):
+
+    print("Creating compressed update and manifest...")
+
+    with open(update_file, "rb") as file:
+        image = file.read()
+
+    compressed_file = update_file + ".gz"
+    manifest_file = update_file.replace("_update.bin", "_manifest.json")
+
+    # mtime=0 keeps the compressed image reproducible for the same firmware
+    with open(compressed_file, "wb") as file:
+        file.write(gzip.compress(image, compresslevel=9, mtime=0))
+
+    manifest = {
+        "RELEASE": release,
+        "BUILD_NUMBER": build,
+        "FILE": os.path.basename(compressed_file),
+        "ENCODING": "gzip",
+        "IMAGE_SIZE": len(image),
+        "COMPRESSED_SIZE": os.path.getsize(compressed_file),
+        "SHA256": hashlib.sha256(image).hexdigest()
+    }
+
+    with open(manifest_file, "w") as file:
+        json.dump(manifest, file, indent=4)
+
+    print(f"Update image {len(image)}B compressed to {manifest['COMPRESSED_SIZE']}B")
+    print(f"SHA-256: {manifest['SHA256']}")
+
+
+
 def after_build(source, target, env):
     
     print("Post-Build tasks")
@@ -114,4 +148,7 @@ def after_build(source, target, env):
     # Create the update.bin file
     shutil.copy(".pio/build/esp32dev/firmware.bin", update_file)
 
+    # Create the compressed update file and manifest for verified OTA updates
+    create_compressed_update(update_file, release, build)
+
 env.AddPostAction(APP_BIN , after_build)
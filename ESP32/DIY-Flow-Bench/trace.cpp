@@ -0,0 +1,294 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file trace.cpp
+ *
+ * @brief Trace class - cycle counter trace recorder with Chrome trace-event export
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * Each core has its own ring of TRACE_RING_SIZE records. Writers reserve a slot with an atomic increment
+ * so tasks on the same core can interleave without locks. The oldest records are overwritten.
+ *
+ * Records hold the raw CPU cycle counter which is per core and wraps every ~17s at 240MHz.
+ * Every TRACE_ANCHOR_INTERVAL records the ring also stores an esp_timer anchor so that both cores
+ * can be placed on a common timeline when exported.
+ *
+ * Load the /api/trace download in chrome://tracing or https://ui.perfetto.dev
+ *
+ ***/
+#include "Arduino.h"
+#include <atomic>
+#include <memory>
+#include "esp_timer.h"
+
+#include "system.h"
+#include "constants.h"
+#include "structs.h"
+
+#include <ESPAsyncWebServer.h>
+#include "trace.h"
+
+
+static const char *traceEventName[TRACE_EVENT_COUNT] = {
+  "ADC cycle",
+  "BME cycle",
+  "I2C read",
+  "Loop",
+  "SSE publish",
+  "HTTP request",
+  "API parse"
+};
+
+
+struct TraceRing {
+  TraceRecord record[TRACE_RING_SIZE];
+  std::atomic<uint32_t> head;
+  volatile uint32_t anchorSequence;
+  volatile uint32_t anchorCycles;
+  volatile int64_t anchorMicros;
+};
+
+
+struct TraceSnapshot {
+  TraceRecord record[portNUM_PROCESSORS][TRACE_RING_SIZE];
+  uint32_t head[portNUM_PROCESSORS];
+  uint32_t anchorSequence[portNUM_PROCESSORS];
+  int64_t anchorMicros[portNUM_PROCESSORS];
+  double cyclesPerMicro;
+  // export position
+  int core;
+  uint32_t sequence;
+  int64_t elapsedCycles;
+  uint32_t lastCycles;
+  double offsetMicros;
+  int stage;
+  char line[256];
+  int lineLength;
+  int lineOffset;
+};
+
+
+static TraceRing traceRing[portNUM_PROCESSORS];
+static volatile bool tracePaused = false;
+
+
+// Export stages
+#define TRACE_EXPORT_HEADER 0
+#define TRACE_EXPORT_RECORDS 1
+#define TRACE_EXPORT_FOOTER 2
+#define TRACE_EXPORT_DONE 3
+
+
+
+
+/***********************************************************
+ * @brief Class constructor
+ ***/
+Trace::Trace() {
+}
+
+
+
+
+/***********************************************************
+ * @brief record
+ * @details Write a trace record into the ring for the current core
+ * @note Kept in IRAM and lock free so it can be left compiled in on the acquisition path
+ ***/
+void IRAM_ATTR Trace::record(uint16_t event, uint8_t phase) {
+
+  if (tracePaused) return;
+
+  uint32_t cycles = ESP.getCycleCount();
+  uint8_t core = xPortGetCoreID();
+  TraceRing &ring = traceRing[core];
+
+  uint32_t sequence = ring.head.fetch_add(1, std::memory_order_relaxed);
+  TraceRecord &slot = ring.record[sequence & (TRACE_RING_SIZE - 1)];
+
+  slot.cycles = cycles;
+  slot.event = event;
+  slot.phase = phase;
+  slot.core = core;
+
+  if ((sequence & (TRACE_ANCHOR_INTERVAL - 1)) == 0) {
+    ring.anchorSequence = sequence;
+    ring.anchorCycles = cycles;
+    ring.anchorMicros = esp_timer_get_time();
+  }
+
+}
+
+
+
+
+/***********************************************************
+ * @brief pause
+ * @details Stop / restart recording
+ ***/
+void Trace::pause(bool paused) {
+
+  tracePaused = paused;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief startCore
+ * @details Position the export at the oldest record for a core and work out its timeline offset
+ * @note Cycle deltas are treated as signed so a record reordered by preemption does not look like a wrap
+ ***/
+static void startCore(TraceSnapshot &snapshot, int core) {
+
+  uint32_t count = min(snapshot.head[core], (uint32_t)TRACE_RING_SIZE);
+  uint32_t first = snapshot.head[core] - count;
+
+  snapshot.core = core;
+  snapshot.sequence = first;
+  snapshot.elapsedCycles = 0;
+  snapshot.offsetMicros = 0;
+
+  if (count == 0) return;
+
+  snapshot.lastCycles = snapshot.record[core][first & (TRACE_RING_SIZE - 1)].cycles;
+
+  // Walk forward to the anchor to find the cycle count to timer offset
+  uint32_t anchor = snapshot.anchorSequence[core];
+  if (anchor - first < count) {
+    int64_t anchorCycles = 0;
+    uint32_t lastCycles = snapshot.lastCycles;
+    for (uint32_t seq = first + 1; seq != anchor + 1; seq++) {
+      uint32_t cycles = snapshot.record[core][seq & (TRACE_RING_SIZE - 1)].cycles;
+      anchorCycles += (int32_t)(cycles - lastCycles);
+      lastCycles = cycles;
+    }
+    snapshot.offsetMicros = snapshot.anchorMicros[core] - (anchorCycles / snapshot.cyclesPerMicro);
+  }
+
+}
+
+
+
+
+/***********************************************************
+ * @brief fillTraceChunk
+ * @details Write as much of the Chrome trace JSON as fits into the response buffer
+ * @note Lines that do not fit are carried over to the next chunk. Returning 0 ends the response, so a
+ * small maxLen must still make progress
+ ***/
+static size_t fillTraceChunk(TraceSnapshot &snapshot, uint8_t *buffer, size_t maxLen) {
+
+  size_t length = 0;
+
+  while (length < maxLen) {
+
+    // Finish any line left over from the last chunk first
+    if (snapshot.lineOffset < snapshot.lineLength) {
+      size_t piece = min((size_t)(snapshot.lineLength - snapshot.lineOffset), maxLen - length);
+      memcpy(buffer + length, snapshot.line + snapshot.lineOffset, piece);
+      snapshot.lineOffset += piece;
+      length += piece;
+      continue;
+    }
+
+    if (snapshot.stage == TRACE_EXPORT_DONE) break;
+
+    char *line = snapshot.line;
+    int lineLength = 0;
+
+    switch (snapshot.stage) {
+
+      case TRACE_EXPORT_HEADER:
+        lineLength = snprintf(line, sizeof(snapshot.line), "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        for (int core = 0; core < portNUM_PROCESSORS; core++) {
+          lineLength += snprintf(line + lineLength, sizeof(snapshot.line) - lineLength, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"args\":{\"name\":\"Core %d\"}}", (core == 0) ? "" : ",\n", core, core);
+        }
+        startCore(snapshot, 0);
+        snapshot.stage = TRACE_EXPORT_RECORDS;
+      break;
+
+      case TRACE_EXPORT_RECORDS: {
+        if (snapshot.sequence == snapshot.head[snapshot.core]) {
+          if (snapshot.core + 1 < portNUM_PROCESSORS) {
+            startCore(snapshot, snapshot.core + 1);
+          } else {
+            snapshot.stage = TRACE_EXPORT_FOOTER;
+          }
+          continue;
+        }
+
+        TraceRecord &record = snapshot.record[snapshot.core][snapshot.sequence & (TRACE_RING_SIZE - 1)];
+        int64_t elapsedCycles = snapshot.elapsedCycles + (int32_t)(record.cycles - snapshot.lastCycles);
+        double timestamp = snapshot.offsetMicros + (elapsedCycles / snapshot.cyclesPerMicro);
+        const char *name = (record.event < TRACE_EVENT_COUNT) ? traceEventName[record.event] : "unknown";
+
+        lineLength = snprintf(line, sizeof(snapshot.line), ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":0,\"tid\":%u}", name, record.phase, timestamp, record.core);
+
+        snapshot.elapsedCycles = elapsedCycles;
+        snapshot.lastCycles = record.cycles;
+        snapshot.sequence++;
+      break; }
+
+      case TRACE_EXPORT_FOOTER:
+        lineLength = snprintf(line, sizeof(snapshot.line), "\n]}\n");
+        snapshot.stage = TRACE_EXPORT_DONE;
+      break;
+    }
+
+    snapshot.lineLength = min(lineLength, (int)sizeof(snapshot.line) - 1);
+    snapshot.lineOffset = 0;
+  }
+
+  return length;
+
+}
+
+
+
+
+/***********************************************************
+ * @brief exportChromeTrace
+ * @details Snapshot both rings and stream them as Chrome trace-event JSON
+ * @note Recording is paused only for the duration of the copy
+ ***/
+AsyncWebServerResponse * Trace::exportChromeTrace(AsyncWebServerRequest *request) {
+
+  std::shared_ptr<TraceSnapshot> snapshot(new (std::nothrow) TraceSnapshot());
+
+  if (!snapshot) {
+    return request->beginResponse(503, "text/plain", "Not enough memory for trace export");
+  }
+
+  tracePaused = true;
+  for (int core = 0; core < portNUM_PROCESSORS; core++) {
+    memcpy(snapshot->record[core], traceRing[core].record, sizeof(traceRing[core].record));
+    snapshot->head[core] = traceRing[core].head.load();
+    snapshot->anchorSequence[core] = traceRing[core].anchorSequence;
+    snapshot->anchorMicros[core] = traceRing[core].anchorMicros;
+  }
+  tracePaused = false;
+
+  snapshot->cyclesPerMicro = ESP.getCpuFreqMHz();
+  snapshot->stage = TRACE_EXPORT_HEADER;
+  snapshot->lineLength = 0;
+  snapshot->lineOffset = 0;
+
+  AsyncWebServerResponse *response = request->beginChunkedResponse("application/json", [snapshot](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+    return fillTraceChunk(*snapshot, buffer, maxLen);
+  });
+  response->addHeader("Content-Disposition", "attachment; filename=\"trace.json\"");
+
+  return response;
+
+}
@@ -0,0 +1,107 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file trace.h
+ *
+ * @brief Trace class header file
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * Usage:
+ *   TRACE_SCOPE(TRACE_ADC_CYCLE);     // records begin now and end when the enclosing scope exits
+ *   TRACE_BEGIN(TRACE_LOOP); ... TRACE_END(TRACE_LOOP);
+ *
+ * Macros compile to nothing when TRACE_ENABLED is not defined in system.h
+ *
+ ***/
+#pragma once
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+
+#include "system.h"
+
+
+/***********************************************************
+ * Trace event ids (names are in trace.cpp)
+ ***/
+#define TRACE_ADC_CYCLE 0
+#define TRACE_BME_CYCLE 1
+#define TRACE_I2C_READ 2
+#define TRACE_LOOP 3
+#define TRACE_SSE_PUBLISH 4
+#define TRACE_HTTP_REQUEST 5
+#define TRACE_API_PARSE 6
+#define TRACE_EVENT_COUNT 7
+
+#define TRACE_PHASE_BEGIN 'B'
+#define TRACE_PHASE_END 'E'
+
+
+/***********************************************************
+ * @brief Trace record - 8 bytes
+ ***/
+struct TraceRecord {
+	uint32_t cycles;
+	uint16_t event;
+	uint8_t phase;
+	uint8_t core;
+};
+
+
+class Trace {
+
+	friend class Webserver;
+
+	public:
+
+		Trace();
+
+		static void record(uint16_t event, uint8_t phase);
+		static void pause(bool paused);
+		static AsyncWebServerResponse * exportChromeTrace(AsyncWebServerRequest *request);
+
+};
+
+
+/***********************************************************
+ * @brief Scoped trace helper - begin on construction, end on destruction
+ ***/
+class TraceScope {
+
+	private:
+
+		uint16_t scopeEvent;
+
+	public:
+
+		TraceScope(uint16_t event) : scopeEvent(event) {
+			Trace::record(scopeEvent, TRACE_PHASE_BEGIN);
+		}
+
+		~TraceScope() {
+			Trace::record(scopeEvent, TRACE_PHASE_END);
+		}
+
+};
+
+
+#ifdef TRACE_ENABLED
+	#define TRACE_CONCAT_(a, b) a##b
+	#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+	#define TRACE_SCOPE(event) TraceScope TRACE_CONCAT(traceScope, __LINE__)(event)
+	#define TRACE_BEGIN(event) Trace::record(event, TRACE_PHASE_BEGIN)
+	#define TRACE_END(event) Trace::record(event, TRACE_PHASE_END)
+#else
+	#define TRACE_SCOPE(event)
+	#define TRACE_BEGIN(event)
+	#define TRACE_END(event)
+#endif
@@ -0,0 +1,133 @@
+/***********************************************************
+ * @name The DIY Flow Bench project
+ * @details Measure and display volumetric air flow using an ESP32 & Automotive MAF sensor
+ * @link https://diyflowbench.com
+ * @author DeeEmm aka Mick Percy deeemm@deeemm.com
+ *
+ * @file units.h
+ *
+ * @brief Compile time unit definitions for pressure, temperature and flow
+ *
+ * @remarks For more information please visit the WIKI on our GitHub project page: https://github.com/DeeEmm/DIY-Flow-Bench/wiki
+ * Or join our support forums: https://github.com/DeeEmm/DIY-Flow-Bench/discussions
+ * You can also visit our Facebook community: https://www.facebook.com/groups/diyflowbench/
+ *
+ * @license This project and all associated files are provided for use under the GNU GPL3 license:
+ * https://github.com/DeeEmm/DIY-Flow-Bench/blob/master/LICENSE
+ *
+ * Each unit describes how to get to and from the base unit of its dimension (kPa, degC, kg/h, m3/h):
+ *
+ *   base = value * toScale + toOffset
+ *   out  = base * fromScale + fromOffset
+ *
+ * The to / from factors are kept separately (rather than one being the inverse of the other) so that
+ * results match the original Calculations::convertXxx() switch statements exactly.
+ *
+ * Where both units are known at compile time use Units::convert<From, To>(value) or Quantity<Unit>.
+ * The two factors fold into a single constant so a conversion costs one multiply (plus one add for
+ * temperature). Converting between units of different dimensions will not compile, and a Quantity can
+ * only be compared or added to a Quantity of the same unit (a kPa reading against an inH2O limit will
+ * not compile).
+ *
+ * Where the unit is only known at runtime (settings, API) the Calculations::convertXxx() methods use
+ * factor tables built from these same definitions.
+ *
+ ***/
+#pragma once
+
+#include <type_traits>
+
+#include "constants.h"
+
+
+namespace Units {
+
+	// Dimensions
+	struct Pressure {};
+	struct Temperature {};
+	struct MassFlow {};
+	struct VolumetricFlow {};
+
+	// Pressure (base kPa)
+	struct KiloPascal { typedef Pressure Dimension; static constexpr int code = KPA; static constexpr double toScale = 1.0; static constexpr double toOffset = 0.0; static constexpr double fromScale = 1.0; static constexpr double fromOffset = 0.0; };
+	struct Pascal { typedef Pressure Dimension; static constexpr int code = PASCALS; static constexpr double toScale = 0.001; static constexpr double toOffset = 0.0; static constexpr double fromScale = 1000.0; static constexpr double fromOffset = 0.0; };
+	struct HectoPascal { typedef Pressure Dimension; static constexpr int code = HPA; static constexpr double toScale = 0.1; static constexpr double toOffset = 0.0; static constexpr double fromScale = 10.0; static constexpr double fromOffset = 0.0; };
+	struct Bar { typedef Pressure Dimension; static constexpr int code = BAR; static constexpr double toScale = 100.0; static constexpr double toOffset = 0.0; static constexpr double fromScale = 0.01; static constexpr double fromOffset = 0.0; };
+	struct Psi { typedef Pressure Dimension; static constexpr int code = PSIA; static constexpr double toScale = 6.89476; static constexpr double toOffset = 0.0; static constexpr double fromScale = 0.145037738; static constexpr double fromOffset = 0.0; };
+	struct InchWater { typedef Pressure Dimension; static constexpr int code = INH2O; static constexpr double toScale = 0.24884; static constexpr double toOffset = 0.0; static constexpr double fromScale = 4.01463; static constexpr double fromOffset = 0.0; };
+	struct Atmosphere { typedef Pressure Dimension; static constexpr int code = ATM; static constexpr double toScale = 101.325; static constexpr double toOffset = 0.0; static constexpr double fromScale = 0.00986923; static constexpr double fromOffset = 0.0; };
+
+	// Temperature (base degC)
+	struct Celsius { typedef Temperature Dimension; static constexpr int code = DEGC; static constexpr double toScale = 1.0; static constexpr double toOffset = 0.0; static constexpr double fromScale = 1.0; static constexpr double fromOffset = 0.0; };
+	struct Fahrenheit { typedef Temperature Dimension; static constexpr int code = DEGF; static constexpr double toScale = 0.5556; static constexpr double toOffset = -32.0 * 0.5556; static constexpr double fromScale = 1.8; static constexpr double fromOffset = 32.0; };
+	struct Rankine { typedef Temperature Dimension; static constexpr int code = RANKINE; static constexpr double toScale = 0.5556; static constexpr double toOffset = -491.67 * 0.5556; static constexpr double fromScale = 1.8; static constexpr double fromOffset = 273.15 * 1.8; };
+	struct Kelvin { typedef Temperature Dimension; static constexpr int code = KELVIN; static constexpr double toScale = 1.0; static constexpr double toOffset = -273.15; static constexpr double fromScale = 1.0; static constexpr double fromOffset = 273.15; };
+
+	// Mass flow (base kg/h)
+	struct KgPerHour { typedef MassFlow Dimension; static constexpr int code = KG_H; static constexpr double toScale = 1.0; static constexpr double toOffset = 0.0; static constexpr double fromScale = 1.0; static constexpr double fromOffset = 0.0; };
+	struct MgPerSecond { typedef MassFlow Dimension; static constexpr int code = MG_S; static constexpr double toScale = 0.0036; static constexpr double toOffset = 0.0; static constexpr double fromScale = 277.778; static constexpr double fromOffset = 0.0; };
+	struct GramPerMinute { typedef MassFlow Dimension; static constexpr int code = GM_M; static constexpr double toScale = 0.06; static constexpr double toOffset = 0.0; static constexpr double fromScale = 16.6667; static constexpr double fromOffset = 0.0; };
+
+	// Volumetric flow (base m3/h)
+	struct CubicMetrePerHour { typedef VolumetricFlow Dimension; static constexpr int code = M3H; static constexpr double toScale = 1.0; static constexpr double toOffset = 0.0; static constexpr double fromScale = 1.0; static constexpr double fromOffset = 0.0; };
+	struct CubicFeetPerMinute { typedef VolumetricFlow Dimension; static constexpr int code = CFM; static constexpr double toScale = 1.699; static constexpr double toOffset = 0.0; static constexpr double fromScale = 0.589; static constexpr double fromOffset = 0.0; };
+	struct LitrePerMinute { typedef VolumetricFlow Dimension; static constexpr int code = LPM; static constexpr double toScale = 0.06; static constexpr double toOffset = 0.0; static constexpr double fromScale = 16.667; static constexpr double fromOffset = 0.0; };
+
+
+	// Runtime table entry, precomputed from a unit definition
+	struct Factor {
+		double toScale;
+		double toOffset;
+		double fromScale;
+		double fromOffset;
+	};
+
+	template <typename Unit>
+	constexpr Factor factor() {
+		return Factor{ Unit::toScale, Unit::toOffset, Unit::fromScale, Unit::fromOffset };
+	}
+
+
+	// Combined From -> To factor, evaluated by the compiler
+	template <typename From, typename To>
+	struct Conversion {
+		static_assert(std::is_same<typename From::Dimension, typename To::Dimension>::value, "Units::convert between units of different dimensions");
+		static constexpr double scale = From::toScale * To::fromScale;
+		static constexpr double offset = From::toOffset * To::fromScale + To::fromOffset;
+	};
+
+	template <typename From, typename To>
+	constexpr double convert(double value) {
+		return (Conversion<From, To>::offset == 0.0) ? value * Conversion<From, To>::scale : value * Conversion<From, To>::scale + Conversion<From, To>::offset;
+	}
+
+
+	// Value tagged with its unit. Only same unit arithmetic is defined, anything else has to go through as<>()
+	template <typename Unit>
+	class Quantity {
+
+		public:
+
+			typedef Unit UnitType;
+			typedef typename Unit::Dimension Dimension;
+
+			constexpr explicit Quantity(double value) : _value(value) {}
+
+			constexpr double value() const { return _value; }
+
+			template <typename To>
+			constexpr Quantity<To> as() const { return Quantity<To>(convert<Unit, To>(_value)); }
+
+			constexpr Quantity operator+(Quantity other) const { return Quantity(_value + other._value); }
+			constexpr Quantity operator-(Quantity other) const { return Quantity(_value - other._value); }
+			constexpr Quantity operator*(double scale) const { return Quantity(_value * scale); }
+			constexpr bool operator<(Quantity other) const { return _value < other._value; }
+			constexpr bool operator>(Quantity other) const { return _value > other._value; }
+
+		private:
+
+			double _value;
+
+	};
+
+}
@@ -33,7 +33,6 @@
 
 // #include <AsyncTCP.h>
 #include <ESPAsyncWebServer.h>
-#include <SPIFFS.h>
 #include <ArduinoJson.h>
 #include "AsyncJson.h"
 #include "webserver.h"
@@ -42,6 +41,7 @@
 #include "sensors.h"
 
 #include "hardware.h"
+#include "logger.h"
 #include "messages.h"
 #include "calculations.h"
 #include "mafdata.h"
@@ -49,6 +49,17 @@
 #include <sstream>
 
 #include "publichtml.h"
+#include "publisher.h"
+#include "otaupdate.h"
+#include "metrics.h"
+#include "recorder.h"
+#include "trace.h"
+#include "timeseries.h"
+#include "blobstore.h"
+#include "persistence.h"
+#include "steadystate.h"
+#include "history.h"
+#include "storage.h"
 #include "htmldata.h"
 
 using namespace std;
@@ -57,6 +68,9 @@ using namespace std;
 
 // RTC_DATA_ATTR int bootCount; // flash mem
 
+// Cleared by the not found handler so the metrics middleware only tracks registered routes (async_tcp only)
+static bool requestRouted = false;
+
 
 /***********************************************************
  * @brief Webserver begin
@@ -67,17 +81,38 @@ void Webserver::begin()
   extern struct BenchSettings settings;
   extern struct Language language;
   extern struct DeviceStatus status;
+  extern Publisher _publisher;
   
   int wifiStatusCode;
 
   server = new AsyncWebServer(80);
-  events = new AsyncEventSource("/events");
 
   Messages _message;
   Calibration _calibration;
   DataHandler _data;
   PublicHTML _public_html;
 
+  // Time every request handler for the /metrics endpoint
+  // Requests that fall through to the not found handler are only counted, so arbitrary paths cannot take endpoint slots
+  server->addMiddleware([](AsyncWebServerRequest *request, ArMiddlewareNext next) {
+    extern Metrics _metrics;
+    TRACE_BEGIN(TRACE_HTTP_REQUEST);
+    uint32_t requestStartTime = micros();
+    requestRouted = true;
+    next();
+    if (requestRouted) {
+      _metrics.observeRequest(request->url().c_str(), micros() - requestStartTime);
+    } else {
+      _metrics.countUnmatchedRequest();
+    }
+    TRACE_END(TRACE_HTTP_REQUEST);
+  });
+
+  server->onNotFound([](AsyncWebServerRequest *request){
+    requestRouted = false;
+    request->send(404);
+  });
+
 
 
   // API request handlers [JSON confirmation response]
@@ -139,6 +174,7 @@ void Webserver::begin()
   server->on("/api/clear-message", HTTP_GET, [](AsyncWebServerRequest *request) {
       Messages _message;
       status.statusMessage = "";
+      status.alarmMessage = "";
       _message.Handler(language.LANG_NO_ERROR);
       _message.debugPrintf("Clearing messages...\n");
        });
@@ -156,6 +192,8 @@ void Webserver::begin()
       Messages _message;
       _message.Handler(language.LANG_SYSTEM_REBOOTING);
       request->send(200, asyncsrv::T_text_html, "{\"reboot\":\"true\"}");
+      Persistence::flush();
+      Logger::flush(LOG_FLUSH_TIMEOUT_MS);
       ESP.restart(); 
       request->redirect("/"); });
 
@@ -167,8 +205,13 @@ void Webserver::begin()
       if (_hardware.benchIsRunning()) {
         _message.Handler(language.LANG_CALIBRATING);
         _message.debugPrintf("Calibrating Flow...\n");
-        _calibrate.setFlowOffset();         
-        request->send(200, asyncsrv::T_text_html, "{\"calibrate\":\"true\"}");
+        if (_calibrate.setFlowOffset()) {
+          request->send(200, asyncsrv::T_text_html, "{\"calibrate\":\"true\"}");
+        } else {
+          // Bench stopped inside the averaging window, or too few samples in it yet
+          _message.Handler(language.LANG_RUN_BENCH_TO_CALIBRATE);
+          request->send(409, asyncsrv::T_text_html, "{\"calibrate\":\"false\"}");
+        }
       } else {
         _message.Handler(language.LANG_RUN_BENCH_TO_CALIBRATE);
         request->send(200, asyncsrv::T_text_html, "{\"calibrate\":\"false\"}");
@@ -184,8 +227,12 @@ void Webserver::begin()
       if (_hardware.benchIsRunning()) {
         _message.Handler(language.LANG_LEAK_CALIBRATING);
         _message.debugPrintf("Calibrating Leak Test...\n");
-        _calibrate.setLeakOffset();
-        request->send(200, asyncsrv::T_text_html, "{\"leakcal\":\"true\"}");
+        if (_calibrate.setLeakOffset()) {
+          request->send(200, asyncsrv::T_text_html, "{\"leakcal\":\"true\"}");
+        } else {
+          _message.Handler(language.LANG_RUN_BENCH_TO_CALIBRATE);
+          request->send(409, asyncsrv::T_text_html, "{\"leakcal\":\"false\"}");
+        }
       } else {
         _message.Handler(language.LANG_RUN_BENCH_TO_CALIBRATE);
         request->send(200, asyncsrv::T_text_html, "{\"leakcal\":\"false\"}");
@@ -217,40 +264,18 @@ void Webserver::begin()
       String downloadFilename = request->url();
       downloadFilename.remove(0,18); // Strip the file path (first 18 chars)
       _message.debugPrintf("Request Download File: %s \n", downloadFilename);
-      request->send(SPIFFS, downloadFilename, String(), true); });
+      request->send(Storage::fs(), downloadFilename, String(), true); });
 
   // Firmware update handler
+  // Accepts raw, gzip or zlib images. The 'sha256' field (from the release manifest) verifies the image and is
+  // required unless unverified updates are enabled in settings
   server->on("/api/update", HTTP_POST, [](AsyncWebServerRequest *request){
-    status.shouldReboot = !Update.hasError();
-    AsyncWebServerResponse *response = request->beginResponse(200, asyncsrv::T_text_html, status.shouldReboot?"<meta http-equiv=\"refresh\" content=\"3; url=/\" />Rebooting... If the page does not automatically refresh, please click <a href=\"/\">HERE</a>":"FIRMWARE UPDATE FAILED!");
+    OTAUpdate _ota;
+    status.shouldReboot = !_ota.hasError() && !Update.hasError();
+    AsyncWebServerResponse *response = request->beginResponse(200, asyncsrv::T_text_html, status.shouldReboot ? String("<meta http-equiv=\"refresh\" content=\"3; url=/\" />Rebooting... If the page does not automatically refresh, please click <a href=\"/\">HERE</a>") : String("FIRMWARE UPDATE FAILED! ") + _ota.getError());
     response->addHeader("Connection", "close");
     request->send(response);
-  },[](AsyncWebServerRequest *request, String filename, size_t index, uint8_t *data, size_t len, bool final){
-    Messages _message;
-    if(!index){
-      _message.debugPrintf("Update Start: %s\n", filename.c_str());
-      // Update.runAsync(true);
-      if(!Update.begin((ESP.getFreeSketchSpace() - 0x1000) & 0xFFFFF000)){
-        _message.debugPrintf("Not Rnough Room: \n");
-        Update.printError(Serial);
-      }
-    }
-
-    if(!Update.hasError()){
-      if(Update.write(data, len) != len){
-        _message.debugPrintf("Write error: \n");
-        Update.printError(Serial);
-      }
-    }
-
-    if(final){
-      if(Update.end(true)){
-        Serial.printf("Update Success: %uB\n", index+len);
-      } else {
-        Update.printError(Serial);
-      }
-    }
-  });
+  }, processUpdate);
 
   // Delete request handler
   server->on("/api/file/delete", HTTP_POST, [](AsyncWebServerRequest *request){              
@@ -259,9 +284,10 @@ void Webserver::begin()
       DataHandler _data;
       const AsyncWebParameter *p = request->getParam("filename", true);
       fileToDelete = p->value();      
-        if(SPIFFS.exists(fileToDelete)){
+        if(Storage::exists(fileToDelete.c_str())){
           _message.debugPrintf("Deleting File: %s\n", fileToDelete.c_str());  
-          SPIFFS.remove(fileToDelete);
+          Storage::remove(fileToDelete.c_str());
+          if (fileToDelete == MAF_DATA_FILE) _data.loadMAFData();
         }  else {
           _message.debugPrintf("Delete Failed: %s\n", fileToDelete.c_str());  
           _message.Handler(language.LANG_DELETE_FAILED);    
@@ -320,8 +346,7 @@ void Webserver::begin()
     Messages _message;
     Calibration _cal;
     _message.debugPrintf("/api/fdiff/zero \n");
-    _cal.setPdiffCalOffset();
-    request->send(200);
+    request->send(_cal.setPdiffCalOffset() ? 200 : 409);
     // request->send(200, asyncsrv::T_text_html, "{\"fdiff\":\"changed\"}"); 
   });
 
@@ -330,8 +355,7 @@ void Webserver::begin()
     Messages _message;
     Calibration _cal;
     _message.debugPrintf("/api/pitot/zero \n");
-    _cal.setPitotCalOffset();
-    request->send(200);
+    request->send(_cal.setPitotCalOffset() ? 200 : 409);
     // request->send(200, asyncsrv::T_text_html, "{\"fdiff\":\"changed\"}"); 
   });
 
@@ -341,6 +365,66 @@ void Webserver::begin()
     request->send(200, asyncsrv::T_text_html, String(_data.buildIndexSSEJsonData()).c_str());
   });
 
+  // Prometheus metrics
+  server->on("/metrics", HTTP_GET, [](AsyncWebServerRequest *request){
+    extern Metrics _metrics;
+    // Copied into the response, the buffer is rebuilt by the next scrape while this one may still be sending
+    request->send(200, "text/plain; version=0.0.4", String(_metrics.buildExposition()));
+  });
+
+  // Chrome trace-event download of the trace recorder rings
+  #ifdef TRACE_ENABLED
+    server->on("/api/trace", HTTP_GET, [](AsyncWebServerRequest *request){
+      request->send(Trace::exportChromeTrace(request));
+    });
+  #endif
+
+  // Session recorder
+  server->on("/api/recorder/start", HTTP_GET, [](AsyncWebServerRequest *request){
+    extern Recorder _recorder;
+    _recorder.start();
+    request->send(200, "application/json", _recorder.getStatusJSON());
+  });
+
+  server->on("/api/recorder/stop", HTTP_GET, [](AsyncWebServerRequest *request){
+    extern Recorder _recorder;
+    _recorder.stop();
+    request->send(200, "application/json", _recorder.getStatusJSON());
+  });
+
+  server->on("/api/recorder/status", HTTP_GET, [](AsyncWebServerRequest *request){
+    extern Recorder _recorder;
+    request->send(200, "application/json", _recorder.getStatusJSON());
+  });
+
+  // Count valid chunks in a session log e.g. /api/recorder/verify?file=/session_001.dfbl
+  server->on("/api/recorder/verify", HTTP_GET, [](AsyncWebServerRequest *request){
+    extern Recorder _recorder;
+    if (!request->hasParam("file")) {
+      request->send(400, "text/plain", "Missing file parameter");
+      return;
+    }
+    String filename = request->getParam("file")->value();
+    request->send(200, "application/json", "{\"FILE\":\"" + filename + "\",\"VALID_CHUNKS\":" + String(_recorder.verifyLog(filename.c_str())) + "}");
+  });
+
+  // Stream a session log as CSV / NDJSON e.g. /api/recorder/export?file=/session_001.dfbl&format=csv&channels=FlowCFM,PRefKPA&from=0&to=60000
+  server->on("/api/recorder/export", HTTP_GET, [](AsyncWebServerRequest *request){
+    extern Recorder _recorder;
+    request->send(_recorder.exportSession(request));
+  });
+
+  // Trend history e.g. /api/timeseries?resolution=1s&last=60000&channels=FlowCFM,PRefKPA
+  server->on("/api/timeseries", HTTP_GET, [](AsyncWebServerRequest *request){
+    request->send(TimeSeries::query(request));
+  });
+
+  // SSE client delivery stats
+  server->on("/api/sse/stats", HTTP_GET, [](AsyncWebServerRequest *request){
+    extern Publisher _publisher;
+    request->send(200, "application/json", _publisher.getClientStatsJSON());
+  });
+
   // Save user Flow Diff target
   server->on("/api/saveflowtarget", HTTP_POST, parseUserFlowTargetForm);
   
@@ -364,6 +448,43 @@ void Webserver::begin()
 
   // Clear Lift Data
   server->on("/api/clearLiftData", HTTP_POST,  clearLiftData);
+
+  // Configure lift profile run
+  server->on("/api/liftprofile/configure", HTTP_POST, configureLiftProfile);
+
+  // Arm / disarm lift point auto capture
+  server->on("/api/liftdata/autocapture", HTTP_POST, autoCaptureForm);
+
+  // Steady state detector status
+  server->on("/api/steadystate", HTTP_GET, [](AsyncWebServerRequest *request){
+    request->send(200, "application/json", SteadyState::getStatusJSON());
+  });
+
+  // Windowed statistics from the sample history
+  // channel=FLOW_CFM.. and one of last=ms | next=ms (returns FROM, poll again with from=FROM&ms=ms) | from=millis&ms=ms
+  // 409 once the window has ended with fewer than HISTORY_MIN_SAMPLES samples in it
+  server->on("/api/history/stats", HTTP_GET, [](AsyncWebServerRequest *request){
+    int channel = HISTORY_FLOW_CFM;
+    uint32_t windowMs = HISTORY_LIFT_WINDOW_MS;
+    uint32_t fromTime = millis() - windowMs;
+    if (request->hasParam("channel")) channel = SampleHistory::channel(request->getParam("channel")->value().c_str());
+    if (channel < 0) {
+      request->send(400, "text/plain", "Unknown channel");
+      return;
+    }
+    if (request->hasParam("last")) {
+      windowMs = request->getParam("last")->value().toInt();
+      fromTime = millis() - windowMs;
+    } else if (request->hasParam("next")) {
+      windowMs = request->getParam("next")->value().toInt();
+      fromTime = millis();
+    } else if (request->hasParam("from")) {
+      fromTime = strtoul(request->getParam("from")->value().c_str(), NULL, 10);
+      if (request->hasParam("ms")) windowMs = request->getParam("ms")->value().toInt();
+    }
+    WindowStats stats = SampleHistory::window(channel, fromTime, windowMs);
+    request->send((stats.ended && !stats.complete) ? 409 : 200, "application/json", SampleHistory::getStatsJSON(stats, channel, fromTime, windowMs));
+  });
   
 
 
@@ -384,8 +505,8 @@ void Webserver::begin()
 
   // Simple Firmware Update Form - does not require working GUI)
   server->on("/update", HTTP_GET, [](AsyncWebServerRequest *request){
-    request->send(200, asyncsrv::T_text_html, language.LANG_INDEX_HTML, processLandingPageTemplate); 
-    request->send(200, asyncsrv::T_text_html, "<form method='POST' action='/api/update' enctype='multipart/form-data'><input type='file' name='update'><input type='submit' value='Update'></form>");
+    // sha256 must precede the file so it has been parsed when the upload starts (see processUpdate)
+    request->send(200, asyncsrv::T_text_html, "<form method='POST' action='/api/update' enctype='multipart/form-data'><input type='text' name='sha256' placeholder='SHA-256 (from manifest)'><input type='file' name='update'><input type='submit' value='Update'></form>");
   });
 
 
@@ -514,7 +635,7 @@ void Webserver::begin()
       });
 
   server->onFileUpload(fileUpload);
-  server->addHandler(events);
+  _publisher.begin(server);
   server->begin();
 
   _message.Handler(language.LANG_SERVER_RUNNING);
@@ -527,6 +648,55 @@ void Webserver::begin()
 
 
 
+
+/***********************************************************
+ * @brief processUpdate
+ * @details Stream firmware upload chunks through OTAUpdate
+ * @note The expected SHA-256 is read from the 'sha256' query / form field, which must precede the file in the form
+ * @note If the client drops mid upload the final chunk never arrives, the disconnect handler frees the update instead
+ ***/
+void Webserver::processUpdate(AsyncWebServerRequest *request, const String& filename, size_t index, uint8_t *data, size_t len, bool final) {
+
+  Messages _message;
+  OTAUpdate _ota;
+
+  if (!index) {
+
+    String expectedSHA256;
+
+    if (request->hasParam("sha256", true)) {
+      expectedSHA256 = request->getParam("sha256", true)->value();
+    } else if (request->hasParam("sha256")) {
+      expectedSHA256 = request->getParam("sha256")->value();
+    }
+
+    _message.debugPrintf("Update Start: %s\n", filename.c_str());
+
+    if (!_ota.begin(expectedSHA256)) {
+      _message.debugPrintf("Update Failed: %s\n", _ota.getError().c_str());
+      return;
+    }
+
+    uint32_t session = _ota.session();
+    request->onDisconnect([session]() {
+      OTAUpdate _ota;
+      _ota.abortSession(session);
+    });
+  }
+
+  _ota.write(data, len, final);
+
+  // end() releases the update buffers and reports any failure
+  if (final) {
+    _ota.end();
+  }
+
+}
+
+
+
+
+
 /***********************************************************
  * @brief Process File Upload
  * @note Redirects browser back to Upload modal unless upload is index file
@@ -546,13 +716,13 @@ void Webserver::fileUpload(AsyncWebServerRequest *request, String filename, size
 
   if (!filename.startsWith("/")) filename = "/" + filename;
 
-  uint32_t freespace = SPIFFS.totalBytes() - SPIFFS.usedBytes();
+  uint32_t freespace = Storage::totalBytes() - Storage::usedBytes();
 
 //  if (!index && !upload_error)  {
   if (!index)  {
     // _message.debugPrintf("UploadStart: %s \n", filename.c_str());
     // open the file on first call and store the file handle in the request object
-    request->_tempFile = SPIFFS.open(filename, "w");
+    request->_tempFile = Storage::fs().open(filename, "w");
   }
 
   if (len)  {
@@ -571,6 +741,8 @@ void Webserver::fileUpload(AsyncWebServerRequest *request, String filename, size
   if (final)  {
     // _message.debugPrintf("Upload Complete: %s, %u bytes\n", filename.c_str(), file_size);
     request->_tempFile.close();
+    Storage::indexFile(filename.c_str());
+    if (filename == MAF_DATA_FILE) _data.loadMAFData();
   }
 
 
@@ -597,13 +769,9 @@ void Webserver::saveConfigurationForm(AsyncWebServerRequest *request)
 {
 
   Messages _message;
-  DataHandler _data;
-  Preferences _prefs;
 
   const AsyncWebParameter* p;
 
-  _prefs.begin("config");
-
   int params = request->params();
 
   _message.debugPrintf("Saving Configuration... \n");
@@ -611,22 +779,12 @@ void Webserver::saveConfigurationForm(AsyncWebServerRequest *request)
   // Update Config Vars
   for(int i=0;i<params;i++){
     p = request->getParam(i);
-      if (p->name().startsWith("i")) {
-        _prefs.putInt(p->name().c_str(), p->value().toInt());
-      } else if (p->name().startsWith("b")) {
-        _prefs.putBool(p->name().c_str(), p->value().toInt());
-      } else if (p->name().startsWith("d")) {
-        _prefs.putDouble(p->name().c_str(), p->value().toDouble());
-      } else if (p->name().startsWith("f")) {
-        _prefs.putFloat(p->name().c_str(), p->value().toFloat());
-      } else if (p->name().startsWith("s")) {
-        _prefs.putString(p->name().c_str(), p->value().c_str());
-      }
+    if (BlobStore::setField(BLOB_STORE_CONFIG, p->name().c_str(), p->value())) {
       _message.verbosePrintf("Writing Configuration: Key: %s  Value: %s \n", p->name().c_str(), p->value().c_str());
+    }
   }
 
-  _prefs.end();
-  _data.loadConfig();
+  Persistence::request(PERSIST_CONFIG);
   request->redirect("/");
 }
 
@@ -642,13 +800,9 @@ void Webserver::saveSettingsForm(AsyncWebServerRequest *request)
 {
 
   Messages _message;
-  DataHandler _data;
-  Preferences _prefs;
 
   const AsyncWebParameter* p;
 
-  _prefs.begin("settings");
-
   int params = request->params();
 
   _message.debugPrintf("Saving Settings to NVM... \n");
@@ -656,23 +810,12 @@ void Webserver::saveSettingsForm(AsyncWebServerRequest *request)
   // Update Settings Vars
   for(int i=0;i<params;i++){
     p = request->getParam(i);
-      if (p->name().startsWith("i")) {
-        _prefs.putInt(p->name().c_str(), p->value().toInt());
-      } else if (p->name().startsWith("b")) {
-        _prefs.putBool(p->name().c_str(), p->value().toInt());
-      } else if (p->name().startsWith("d")) {
-        _prefs.putDouble(p->name().c_str(), p->value().toDouble());
-      } else if (p->name().startsWith("f")) {
-        _prefs.putFloat(p->name().c_str(), p->value().toFloat());
-      } else if (p->name().startsWith("s")) {
-        _prefs.putString(p->name().c_str(), p->value().c_str());
-      }
-
+    if (BlobStore::setField(BLOB_STORE_SETTINGS, p->name().c_str(), p->value())) {
       _message.verbosePrintf("Writing Setting: Key: %s  Value: %s \n", p->name().c_str(), p->value().c_str());
+    }
   }
 
-  _prefs.end();
-  _data.loadSettings();
+  Persistence::request(PERSIST_SETTINGS);
   request->redirect("/");
 }
 
@@ -692,14 +835,9 @@ void Webserver::savePinsForm(AsyncWebServerRequest *request)
 {
 
   Messages _message;
-  DataHandler _data;
-  Hardware _hardware;
-  Preferences _prefs;
 
   const AsyncWebParameter* p;
 
-  _prefs.begin("pins");
-
   int params = request->params();
 
   _message.debugPrintf("Saving Pins data to NVM... \n");
@@ -707,12 +845,12 @@ void Webserver::savePinsForm(AsyncWebServerRequest *request)
   // Update pins
   for(int i=0;i<params;i++){
     p = request->getParam(i);
-    _prefs.putInt(p->name().c_str(), p->value().toInt());
-    _message.verbosePrintf("Writing Pins data: Pin: %s  Value: %u \n", p->name().c_str(), p->value().toInt());
+    if (BlobStore::setField(BLOB_STORE_PINS, p->name().c_str(), p->value())) {
+      _message.verbosePrintf("Writing Pins data: Pin: %s  Value: %u \n", p->name().c_str(), p->value().toInt());
+    }
   }
 
-  _prefs.end();
-  _hardware.loadPinsData();
+  Persistence::request(PERSIST_PINS);
   request->redirect("/");
 }
 
@@ -732,27 +870,20 @@ void Webserver::savePinsForm(AsyncWebServerRequest *request)
 void Webserver::saveCalibrationForm(AsyncWebServerRequest *request)
 {
 
-  Calibration _calibrate;
   Messages _message;
-  Preferences _prefs;
 
   const AsyncWebParameter* p;
 
-  extern struct CalibrationData calVal;
-
-  _prefs.begin("calibration");
-
   int params = request->params();
 
   _message.debugPrintf("Parsing Calibration Form Data... \n");
 
   for(int i=0;i<params;i++){
     p = request->getParam(i);
-    _prefs.putDouble(p->name().c_str(), p->value().toDouble());
+    BlobStore::setField(BLOB_STORE_CALIBRATION, p->name().c_str(), p->value());
   }
 
-  _prefs.end();
-  _calibrate.loadCalibrationData();
+  Persistence::request(PERSIST_CALIBRATION);
   request->redirect("/calibration");
 
 }
@@ -858,153 +989,143 @@ void Webserver::toggleFlowDiffTile () {
 
 
 /***********************************************************
- * @brief captureLiftData
- * @details captures lift data to working memory
- * 
+ * @brief saveLiftDataForm
+ * @details Captures current flow into a lift point of a run and saves that run
+ * @note Stores the steady state window mean when the readings have settled (see steadystate.h), otherwise
+ * the mean of the last HISTORY_LIFT_WINDOW_MS of samples (see history.h)
+ * @note POST vars: lift-data (point, 1 based), lift-run (optional, defaults to active run)
  ***/
 void Webserver::saveLiftDataForm(AsyncWebServerRequest *request){
 
   Messages _message;
   DataHandler _data;
-  Webserver _webserver;
-  Preferences _prefs;
 
-  // StaticJsonDocument<LIFT_DATA_JSON_SIZE> liftData;
-  extern struct SensorData sensorVal;
-  extern struct ValveLiftData valveData;
   extern struct BenchSettings settings;
+  extern struct ValveLiftData valveData;
   
-  // String jsonString;
-  String liftPoint;
-  int switchval;
-  char *end;
-  int params = request->params();
-  const char* PARAM_INPUT = "lift-data";
-  double flowValue;
-
-  const AsyncWebParameter* p;
+  int liftPoint = 0;
+  int run = valveData.activeRun;
+  double flowValue = 0.0;
 
   _message.debugPrintf("Saving Lift Data....\n");
 
-  // TEST - Print POST vars to serial
-  // for(int i=0;i<params;i++){
-  //   const AsyncWebParameter* p = request->getParam(i);
-  //   if(p->isFile()){ //p->isPost() is also true
-  //     Serial.printf("FILE[%s]: %s, size: %u\n", p->name().c_str(), p->value().c_str(), p->size());
-  //   } else if(p->isPost()){
-  //     Serial.printf("POST[%s]: %s\n", p->name().c_str(), p->value().c_str());
-  //   } else {
-  //     Serial.printf("GET[%s]: %s\n", p->name().c_str(), p->value().c_str());
-  //   }
-  // }
+  if (request->hasParam("lift-data", true)) liftPoint = request->getParam("lift-data", true)->value().toInt();
+  if (request->hasParam("lift-run", true)) run = request->getParam("lift-run", true)->value().toInt();
 
-  // Convert POST vars to JSON 
-  for(int i=0;i<params;i++){
-    p = request->getParam(i);
-        // get selected radio button and store it (radio button example from https://www.electrorules.com/esp32-web-server-control-stepper-motor-html-form/)
-        if (p->name() == PARAM_INPUT) {
-          liftPoint = p->value();
-        }
+  if (run < 0 || run >= LIFT_PROFILE_MAX_RUNS || liftPoint < 1 || liftPoint > valveData.run[run].pointCount) {
+    request->send(400, "text/plain", "Invalid lift point");
+    return;
   }
 
-  // Get flow value based on capture Datatype
-  switch (settings.data_capture_datatype) {
+  // Use the steady window mean if the readings have settled, otherwise average the last HISTORY_LIFT_WINDOW_MS
+  if (SteadyState::isSteady()) {
+    flowValue = SteadyState::flowStats().mean;
+  } else {
+    WindowStats flowWindow = SampleHistory::last(SampleHistory::captureChannel(settings.data_capture_datatype), HISTORY_LIFT_WINDOW_MS);
+    if (!flowWindow.complete) {
+      request->send(409, "text/plain", "Not enough samples yet");
+      return;
+    }
+    flowValue = flowWindow.mean;
+  }
 
-    case ACFM:
-      flowValue = sensorVal.FlowCFM;
-    break;
-    
-    case STD_ACFM:
-      flowValue = sensorVal.FlowSCFM;
-    break;
-    
-    case ADJ_ACFM:
-      flowValue = sensorVal.FlowADJ;
-    break;
-    
-    case ADJ_STD_ACFM:
-      flowValue = sensorVal.FlowADJSCFM;
-    break;
+  // Update lift point data
+  valveData.activeRun = run;
+  valveData.run[run].flow[liftPoint - 1] = flowValue;
+
+  Persistence::request(PERSIST_LIFT_RUN + run);
     
-    case RAW_MASS:
-      flowValue = sensorVal.FlowKGH;
-    break;
-        
+  request->send(200);
+
+}
+
+
+
+/***********************************************************
+ * @brief autoCaptureForm
+ * @details Arm lift point auto capture, each point is captured once flow and pRef settle
+ * @note POST vars: lift-data (first point, 1 based, default 1), lift-run (optional, defaults to active run), 
+ * enable (0 to stop)
+ ***/
+void Webserver::autoCaptureForm(AsyncWebServerRequest *request){
+
+  extern struct ValveLiftData valveData;
+
+  int liftPoint = 1;
+  int run = valveData.activeRun;
+
+  if (request->hasParam("enable", true) && request->getParam("enable", true)->value().toInt() == 0) {
+    SteadyState::disarm();
+    request->send(200, "application/json", SteadyState::getStatusJSON());
+    return;
   }
 
-  // Update lift point data
-  switchval = stoi(liftPoint.c_str()); // convert std::str to int
+  if (request->hasParam("lift-data", true)) liftPoint = request->getParam("lift-data", true)->value().toInt();
+  if (request->hasParam("lift-run", true)) run = request->getParam("lift-run", true)->value().toInt();
 
-  switch (switchval) {
+  if (!SteadyState::arm(run, liftPoint)) {
+    request->send(400, "text/plain", "Invalid lift point");
+    return;
+  }
 
-    case 1:
-      valveData.LiftData1 = flowValue;
-      break;
+  request->send(200, "application/json", SteadyState::getStatusJSON());
 
-    case 2:
-      valveData.LiftData2 = flowValue;
-      break;
+}
 
-    case 3:
-      valveData.LiftData3 = flowValue;
-      break;
 
-    case 4:
-      valveData.LiftData4 = flowValue;
-      break;
 
-    case 5:
-      valveData.LiftData5 = flowValue;
-      break;
+/***********************************************************
+ * @brief configureLiftProfile
+ * @details Set name / port / number of points for a run and make it the active run
+ * @note POST vars: lift-run, name, port (0 intake / 1 exhaust), points
+ ***/
+void Webserver::configureLiftProfile(AsyncWebServerRequest *request){
 
-    case 6:
-      valveData.LiftData6 = flowValue;
-      break;
+  DataHandler _data;
 
-    case 7:
-      valveData.LiftData7 = flowValue;
-      break;
+  extern struct ValveLiftData valveData;
 
-    case 8:
-      valveData.LiftData8 = flowValue;
-      break;
+  if (!request->hasParam("lift-run", true)) {
+    request->send(400, "text/plain", "Missing run");
+    return;
+  }
 
-    case 9:
-      valveData.LiftData9 = flowValue;
-      break;
+  int run = request->getParam("lift-run", true)->value().toInt();
+  if (run < 0 || run >= LIFT_PROFILE_MAX_RUNS) {
+    request->send(400, "text/plain", "Invalid run");
+    return;
+  }
 
-    case 10:
-      valveData.LiftData10 = flowValue;
-      break;
+  LiftProfile &profile = valveData.run[run];
 
-    case 11:
-      valveData.LiftData11 = flowValue;
-      break;
+  if (request->hasParam("name", true)) strlcpy(profile.name, request->getParam("name", true)->value().c_str(), LIFT_PROFILE_NAME_LENGTH);
+  if (request->hasParam("port", true)) profile.port = (request->getParam("port", true)->value().toInt() == LIFT_PORT_EXHAUST) ? LIFT_PORT_EXHAUST : LIFT_PORT_INTAKE;
+  if (request->hasParam("points", true)) profile.pointCount = constrain(request->getParam("points", true)->value().toInt(), 1, LIFT_PROFILE_MAX_POINTS);
 
-    case 12:
-      valveData.LiftData12 = flowValue;
-      break;
+  valveData.activeRun = run;
+
+  Persistence::request(PERSIST_LIFT_RUN + run);
+
+  request->redirect("/data");
+
+}
+
+
+
+/***********************************************************
+ * @brief formatLiftValue
+ * @details Lift for a point, shown without decimals if the lift interval is a whole number
+ ***/
+String Webserver::formatLiftValue(int point) {
+
+  extern struct BenchSettings settings;
+
+  if (floor(settings.valveLiftInterval) == settings.valveLiftInterval) {
+    // it's an integer so lets truncate fractional part
+    return String(point * (int)settings.valveLiftInterval);
   }
 
-  
-  _prefs.begin("liftData");
-
-  _prefs.putDouble("LIFTDATA1", valveData.LiftData1);
-  _prefs.putDouble("LIFTDATA2", valveData.LiftData2);
-  _prefs.putDouble("LIFTDATA3", valveData.LiftData3);
-  _prefs.putDouble("LIFTDATA4", valveData.LiftData4);
-  _prefs.putDouble("LIFTDATA5", valveData.LiftData5);
-  _prefs.putDouble("LIFTDATA6", valveData.LiftData6);
-  _prefs.putDouble("LIFTDATA7", valveData.LiftData7);
-  _prefs.putDouble("LIFTDATA8", valveData.LiftData8);
-  _prefs.putDouble("LIFTDATA9", valveData.LiftData9);
-  _prefs.putDouble("LIFTDATA10", valveData.LiftData10);
-  _prefs.putDouble("LIFTDATA11", valveData.LiftData11);
-  _prefs.putDouble("LIFTDATA12", valveData.LiftData12);
-
-  _prefs.end();
-    
-  request->send(200);
+  return String(point * settings.valveLiftInterval);
 
 }
 
@@ -1012,28 +1133,35 @@ void Webserver::saveLiftDataForm(AsyncWebServerRequest *request){
 
 /***********************************************************
  * @brief getLiftDataJSON
- * @details Package up current bench data into JSON string
+ * @details Package up all lift profile runs into JSON string
  ***/
 String Webserver::getLiftDataJSON()
 {
   extern struct ValveLiftData valveData;
+  extern struct BenchSettings settings;
 
   String jsonString;
 
   JsonDocument liftData;
 
-  liftData["LIFTDATA1"] = valveData.LiftData1;
-  liftData["LIFTDATA2"] = valveData.LiftData2;
-  liftData["LIFTDATA3"] = valveData.LiftData3;
-  liftData["LIFTDATA4"] = valveData.LiftData4;
-  liftData["LIFTDATA5"] = valveData.LiftData5;
-  liftData["LIFTDATA6"] = valveData.LiftData6;
-  liftData["LIFTDATA7"] = valveData.LiftData7;
-  liftData["LIFTDATA8"] = valveData.LiftData8;
-  liftData["LIFTDATA9"] = valveData.LiftData9;
-  liftData["LIFTDATA10"] = valveData.LiftData10;
-  liftData["LIFTDATA11"] = valveData.LiftData11;
-  liftData["LIFTDATA12"] = valveData.LiftData12;
+  liftData["ACTIVE_RUN"] = valveData.activeRun;
+  liftData["LIFT_INTERVAL"] = settings.valveLiftInterval;
+
+  JsonArray runs = liftData["RUNS"].to<JsonArray>();
+
+  for (int run = 0; run < LIFT_PROFILE_MAX_RUNS; run++) {
+
+    JsonObject runData = runs.add<JsonObject>();
+    runData["NAME"] = valveData.run[run].name;
+    runData["PORT"] = (valveData.run[run].port == LIFT_PORT_EXHAUST) ? "exhaust" : "intake";
+
+    JsonArray points = runData["POINTS"].to<JsonArray>();
+    for (int point = 0; point < valveData.run[run].pointCount; point++) {
+      JsonObject pointData = points.add<JsonObject>();
+      pointData["LIFT"] = (point + 1) * settings.valveLiftInterval;
+      pointData["FLOW"] = valveData.run[run].flow[point];
+    }
+  }
 
   // serializeJson(liftData, jsonString);
   serializeJsonPretty(liftData, jsonString);
@@ -1050,47 +1178,18 @@ String Webserver::getLiftDataJSON()
 
 
 /***********************************************************
-* @brief initialiseLiftData
-* @note - Initialise settings in NVM if they do not exist
-* @note Key must be 15 chars or shorter.
+* @brief clearLiftData
+* @details Zero lift data for the run in POST var 'lift-run', or for all runs if not supplied
 ***/ 
 void Webserver::clearLiftData (AsyncWebServerRequest *request) {
 
-  // Messages _message;
-  Preferences _prefs;
-  extern struct ValveLiftData valveData;
+  DataHandler _data;
 
-  // _message.serialPrintf("Clearing Lift Data \n");    
-  
-  _prefs.begin("liftData");
-
-  _prefs.putDouble("LIFTDATA1", 0.0);
-  _prefs.putDouble("LIFTDATA2", 0.0);
-  _prefs.putDouble("LIFTDATA3", 0.0);
-  _prefs.putDouble("LIFTDATA4", 0.0);
-  _prefs.putDouble("LIFTDATA5", 0.0);
-  _prefs.putDouble("LIFTDATA6", 0.0);
-  _prefs.putDouble("LIFTDATA7", 0.0);
-  _prefs.putDouble("LIFTDATA8", 0.0);
-  _prefs.putDouble("LIFTDATA9", 0.0);
-  _prefs.putDouble("LIFTDATA10", 0.0);
-  _prefs.putDouble("LIFTDATA11", 0.0);
-  _prefs.putDouble("LIFTDATA12", 0.0);
-
-  valveData.LiftData1 = 0.0;
-  valveData.LiftData2 = 0.0;
-  valveData.LiftData3 = 0.0;
-  valveData.LiftData4 = 0.0;
-  valveData.LiftData5 = 0.0;
-  valveData.LiftData6 = 0.0;
-  valveData.LiftData7 = 0.0;
-  valveData.LiftData8 = 0.0;
-  valveData.LiftData9 = 0.0;
-  valveData.LiftData10 = 0.0;
-  valveData.LiftData11 = 0.0;
-  valveData.LiftData12 = 0.0;
-
-  _prefs.end();
+  int run = -1;
+
+  if (request->hasParam("lift-run", true)) run = request->getParam("lift-run", true)->value().toInt();
+
+  _data.clearLiftProfile(run);
 
   request->send(200);
 
@@ -1231,6 +1330,9 @@ String Webserver::processLanguageTemplateVars(const String &var) {
   if (var == "LANG_GUI_MIN_PRESSURE") return language.LANG_GUI_MIN_PRESSURE;
   if (var == "LANG_GUI_MAF_MIN_VOLTS") return language.LANG_GUI_MAF_MIN_VOLTS;
   if (var == "LANG_GUI_CYCLIC_AVERAGE_BUFFER") return language.LANG_GUI_CYCLIC_AVERAGE_BUFFER;
+  if (var == "LANG_GUI_STEADY_FLOW_TOL") return language.LANG_GUI_STEADY_FLOW_TOL;
+  if (var == "LANG_GUI_STEADY_PREF_TOL") return language.LANG_GUI_STEADY_PREF_TOL;
+  if (var == "LANG_GUI_OTA_UNVERIFIED") return language.LANG_GUI_OTA_UNVERIFIED;
   if (var == "LANG_GUI_CONVERSION_SETTINGS") return language.LANG_GUI_CONVERSION_SETTINGS;
   if (var == "LANG_GUI_ADJ_FLOW_DEP") return language.LANG_GUI_ADJ_FLOW_DEP;
   if (var == "LANG_GUI_STANDARD_REF_CONDITIONS") return language.LANG_GUI_STANDARD_REF_CONDITIONS;
@@ -1357,38 +1459,24 @@ String Webserver::processIndexPageTemplate(const String &var) {
   if (var == "AFLOW_UNITS" && settings.std_adj_flow == 1) return String("ACFM");
   if (var == "AFLOW_UNITS" && settings.std_adj_flow == 2) return String("SCFM");
 
-  // Lift Profile
-  if (floor(settings.valveLiftInterval) == settings.valveLiftInterval) {
-
-    // it's an integer so lets truncate fractional part
-    int liftInterval = settings.valveLiftInterval;
-    if (var == "lift1") return String(1 * liftInterval);
-    if (var == "lift2") return String(2 * liftInterval);
-    if (var == "lift3") return String(3 * liftInterval);
-    if (var == "lift4") return String(4 * liftInterval);
-    if (var == "lift5") return String(5 * liftInterval);
-    if (var == "lift6") return String(6 * liftInterval);
-    if (var == "lift7") return String(7 * liftInterval);
-    if (var == "lift8") return String(8 * liftInterval);
-    if (var == "lift9") return String(9 * liftInterval);
-    if (var == "lift10") return String(10 * liftInterval);
-    if (var == "lift11") return String(11 * liftInterval);
-    if (var == "lift12") return String(12 * liftInterval);
+  // Lift Profile - capture modal run selector and one radio button per lift point of the active run
+  if (var == "LIFT_RUN_OPTIONS") {
+    extern struct ValveLiftData valveData;
+    String options;
+    for (int run = 0; run < LIFT_PROFILE_MAX_RUNS; run++) {
+      options += "<option value=\"" + String(run) + "\"" + ((run == valveData.activeRun) ? " selected" : "") + ">" + String(valveData.run[run].name) + "</option>";
+    }
+    return options;
+  }
 
-  } else {
-    // Display the double
-    if (var == "lift1") return String(1 * settings.valveLiftInterval);
-    if (var == "lift2") return String(2 * settings.valveLiftInterval);
-    if (var == "lift3") return String(3 * settings.valveLiftInterval);
-    if (var == "lift4") return String(4 * settings.valveLiftInterval);
-    if (var == "lift5") return String(5 * settings.valveLiftInterval);
-    if (var == "lift6") return String(6 * settings.valveLiftInterval);
-    if (var == "lift7") return String(7 * settings.valveLiftInterval);
-    if (var == "lift8") return String(8 * settings.valveLiftInterval);
-    if (var == "lift9") return String(9 * settings.valveLiftInterval);
-    if (var == "lift10") return String(10 * settings.valveLiftInterval);
-    if (var == "lift11") return String(11 * settings.valveLiftInterval);
-    if (var == "lift12") return String(12 * settings.valveLiftInterval);
+  if (var == "LIFT_POINT_OPTIONS") {
+    extern struct ValveLiftData valveData;
+    String options;
+    for (int point = 1; point <= valveData.run[valveData.activeRun].pointCount; point++) {
+      options += "<input type=\"radio\" id=\"lift-" + String(point) + "\" name=\"lift-data\" value=\"" + String(point) + "\"/>";
+      options += "<label for=\"lift-" + String(point) + "\">" + formatLiftValue(point) + "</label>";
+    }
+    return options;
   }
 
   // User flow target value
@@ -1430,7 +1518,7 @@ String Webserver::processLandingPageTemplate(const String &var) {
   }
 
   if (var == "CONFIGURATION_STATUS") {
-    if (!SPIFFS.exists("/configuration.json")) return String("<a href='https://github.com/DeeEmm/DIY-Flow-Bench/tree/master/ESP32/DIY-Flow-Bench/' target='_BLANK'>configuration.json</a>");
+    if (!Storage::exists("/configuration.json")) return String("<a href='https://github.com/DeeEmm/DIY-Flow-Bench/tree/master/ESP32/DIY-Flow-Bench/' target='_BLANK'>configuration.json</a>");
   }
 
   return "";
@@ -1678,10 +1766,14 @@ String Webserver::processSettingsPageTemplate(const String &var) {
   if (var == "iMIN_PRESSURE") return String(settings.min_bench_pressure);
   // if (var == "iMAF_MIN_VOLTS") return String(settings.maf_min_volts);
   if (var == "iCYC_AV_BUFF") return String(settings.cyc_av_buffer);
+  if (var == "dSTEADY_FLOW") return String(settings.steady_flow_tolerance);
+  if (var == "dSTEADY_PREF") return String(settings.steady_pref_tolerance);
 
   // Bench Settings
   if (var == "iMAF_DIAMETER") return String(settings.maf_housing_diameter);
   if (var == "iREFRESH_RATE") return String(settings.refresh_rate);
+  if (var == "bOTA_UNVERIFIED_0" && settings.ota_allow_unverified == false) return String("selected");
+  if (var == "bOTA_UNVERIFIED_1" && settings.ota_allow_unverified == true) return String("selected");
   if (var == "iADJ_FLOW_DEP") return String(settings.adj_flow_depression);
 
   // Temperature
@@ -1746,17 +1838,13 @@ String Webserver::processSettingsPageTemplate(const String &var) {
     String fileList;
     String fileName;
     String fileSize;
+    StorageIndexEntry entry;
 
-    FILESYSTEM.begin();
-    File root = FILESYSTEM.open("/");
-    File file = root.openNextFile();
-    while (file)  {
-      fileName = file.name();
-      fileSize = file.size();
+    for (int i = 0; Storage::getEntry(i, entry); i++)  {
+      fileName = entry.path + 1;
+      fileSize = String(entry.size);
       fileList += "<div class='fileListRow'><span class='column left'><a href='/api/file/download/" + fileName + "' download class='file-link'>" + fileName + "</a></span><span class='column middle'><span class='fileSizeTxt'>" + fileSize + " bytes</span></span><span class='column right'><form method='POST' action='/api/file/delete'><input type='hidden' name='filename' value='/" + fileName + "'><input id='delete-button'  class='button-sml' type='submit' value='Delete'></form></span></div>";
-      file = root.openNextFile();
     }
-    // FILESYSTEM.end();
 
     if (fileList.isEmpty()) {
       return "<div class='fileListRow'><span class='column left'>No Files Found</span></div>";
@@ -2039,94 +2127,61 @@ String Webserver::processDatagraphPageTemplate(const String &var) {
   if (var == "flow9") return String(maxval / 10 * 9);
   if (var == "flow10") return String(maxval );
 
-  // scale the datapoint values to fit the flow axis scale
-  // NOTE: surface is 500 units high with zero at the bottom
-  if (var == "LINE_DATA1") return String(500 - (valveData.LiftData1 * scaleFactor));
-  if (var == "LINE_DATA2") return String(500 - (valveData.LiftData2 * scaleFactor));
-  if (var == "LINE_DATA3") return String(500 - (valveData.LiftData3 * scaleFactor));
-  if (var == "LINE_DATA4") return String(500 - (valveData.LiftData4 * scaleFactor));
-  if (var == "LINE_DATA5") return String(500 - (valveData.LiftData5 * scaleFactor));
-  if (var == "LINE_DATA6") return String(500 - (valveData.LiftData6 * scaleFactor));
-  if (var == "LINE_DATA7") return String(500 - (valveData.LiftData7 * scaleFactor));
-  if (var == "LINE_DATA8") return String(500 - (valveData.LiftData8 * scaleFactor));
-  if (var == "LINE_DATA9") return String(500 - (valveData.LiftData9 * scaleFactor));
-  if (var == "LINE_DATA10") return String(500 - (valveData.LiftData10 * scaleFactor));
-  if (var == "LINE_DATA11") return String(500 - (valveData.LiftData11 * scaleFactor));
-  if (var == "LINE_DATA12") return String(500 - (valveData.LiftData12 * scaleFactor));
-
-
+  // Lift profile run selector (shared with capture modal)
+  if (var == "LIFT_RUN_OPTIONS") return processIndexPageTemplate(var);
 
-  // if (var == "LINE_DATA") {
-
-  //   extern struct ValveLiftData valveData;
-  //   String attribs;
-  //   char* lineData;
-
-  //   attribs =  R"END(
-  //     fill="none" stroke="#000" stroke-width="1" stroke-dasharray="4,1" opacity="0.5"
-  //   )END" ;
-
-  //   int point1 = 350-valveData.LiftData1;
-  //   int point2 = 350-valveData.LiftData2;
-  //   int point3 = 350-valveData.LiftData3;
-  //   int point4 = 350-valveData.LiftData4;
-  //   int point5 = 350-valveData.LiftData5;
-  //   int point6 = 350-valveData.LiftData6;
-  //   int point7 = 350-valveData.LiftData7;
-  //   int point8 = 350-valveData.LiftData8;
-  //   int point9 = 350-valveData.LiftData9;
-  //   int point10 = 350-valveData.LiftData10;
-  //   int point11 = 350-valveData.LiftData11;
-  //   int point12 = 350-valveData.LiftData12;
-
-
-  //   // sprintf (lineData, "<polyline %s points=\"100,0 150, %d 200,%d 250,%d 300,%d 350,%d 400,%d 450,%d 500,%d 550,%d 600,%d 650,%d 700,%d\"  />", attribs, point1,  point2,  point3,  point4,  point5,  point6,  point7,  point8,  point9,  point10,  point11,  point12 );
-  //   sprintf (lineData, "<polyline %s points=\"100,0 150,%d 200,%d \"  />", attribs, point1, point2);
-
-
-  //   return '<polyline fill="none" stroke="#000" stroke-width="1" stroke-dasharray="4, 1" points="100,350 150,340 200,315 250,301 300,280 350,249 400,245 450,242 500,238 550,230 600,222 650,220 700,218" />';
-
-
-  //   // return String(lineData).c_str();
-  // }
-
-
-  // Lift Profile
-  if (floor(settings.valveLiftInterval) == settings.valveLiftInterval) {
-
-    // it's an integer so lets truncate fractional part
-    int liftInterval = settings.valveLiftInterval;
-    if (var == "lift1") return String(1 * liftInterval);
-    if (var == "lift2") return String(2 * liftInterval);
-    if (var == "lift3") return String(3 * liftInterval);
-    if (var == "lift4") return String(4 * liftInterval);
-    if (var == "lift5") return String(5 * liftInterval);
-    if (var == "lift6") return String(6 * liftInterval);
-    if (var == "lift7") return String(7 * liftInterval);
-    if (var == "lift8") return String(8 * liftInterval);
-    if (var == "lift9") return String(9 * liftInterval);
-    if (var == "lift10") return String(10 * liftInterval);
-    if (var == "lift11") return String(11 * liftInterval);
-    if (var == "lift12") return String(12 * liftInterval);
-
-  } else {
-    // Display the double
-    if (var == "lift1") return String(1 * settings.valveLiftInterval);
-    if (var == "lift2") return String(2 * settings.valveLiftInterval);
-    if (var == "lift3") return String(3 * settings.valveLiftInterval);
-    if (var == "lift4") return String(4 * settings.valveLiftInterval);
-    if (var == "lift5") return String(5 * settings.valveLiftInterval);
-    if (var == "lift6") return String(6 * settings.valveLiftInterval);
-    if (var == "lift7") return String(7 * settings.valveLiftInterval);
-    if (var == "lift8") return String(8 * settings.valveLiftInterval);
-    if (var == "lift9") return String(9 * settings.valveLiftInterval);
-    if (var == "lift10") return String(10 * settings.valveLiftInterval);
-    if (var == "lift11") return String(11 * settings.valveLiftInterval);
-    if (var == "lift12") return String(12 * settings.valveLiftInterval);
+  // Lift profile graph - x axis spans 100 - 700 and is divided by the active run's point count
+  // NOTE: surface is 500 units high with zero at the bottom
+  int pointCount = valveData.run[valveData.activeRun].pointCount;
+  double pointSpacing = 600.0 / pointCount;
+
+  if (var == "LIFT_GRID") {
+    String grid;
+    for (int point = 0; point <= pointCount; point++) {
+      int x = 100 + point * pointSpacing;
+      grid += "<line x1=\"" + String(x) + "\" x2=\"" + String(x) + "\" y1=\"0\" y2=\"510\"></line>";
+    }
+    return grid;
   }
 
+  if (var == "LIFT_LABELS") {
+    String labels = "<text x=\"100\" y=\"550\">Lift:</text>";
+    for (int point = 1; point <= pointCount; point++) {
+      labels += "<text x=\"" + String((int)(100 + point * pointSpacing)) + "\" y=\"550\">" + formatLiftValue(point) + "</text>";
+    }
+    return labels;
+  }
 
-
+  // One polyline per run that has data. Intake black, exhaust red, active run solid
+  if (var == "LINE_DATA" || var == "GRAPH_KEY") {
+    String output;
+    int keyRow = 0;
+    for (int run = 0; run < LIFT_PROFILE_MAX_RUNS; run++) {
+
+      LiftProfile &profile = valveData.run[run];
+      bool hasData = false;
+      for (int point = 0; point < profile.pointCount; point++) hasData |= (profile.flow[point] != 0.0f);
+      if (!hasData) continue;
+
+      String style = String("stroke:") + ((profile.port == LIFT_PORT_EXHAUST) ? "#f50808" : "#000") + ";stroke-width:1;" + ((run == valveData.activeRun) ? "" : "stroke-dasharray:4,1;opacity:0.5;");
+
+      if (var == "LINE_DATA") {
+        output += "<polyline fill=\"none\" style=\"" + style + "\" points=\"100,500";
+        for (int point = 0; point < profile.pointCount && point < LIFT_PROFILE_MAX_POINTS; point++) {
+          double x = 100 + (point + 1) * pointSpacing;
+          if (x > 700.5) break;
+          output += " " + String(x, 1) + "," + String(500 - (profile.flow[point] * scaleFactor), 1);
+        }
+        output += "\"/>";
+      } else {
+        int y = 20 + keyRow * 15;
+        output += "<line x1=\"550\" y1=\"" + String(y) + "\" x2=\"620\" y2=\"" + String(y) + "\" style=\"" + style + "\"/>";
+        output += "<text x=\"625\" y=\"" + String(y + 5) + "\">" + String(profile.name) + "</text>";
+        keyRow++;
+      }
+    }
+    return output;
+  }
 
   return "";
 
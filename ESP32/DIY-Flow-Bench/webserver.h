@@ -22,7 +22,7 @@
 #include <Arduino.h>
 #include <ArduinoJson.h>
 #include <ESPAsyncWebServer.h>
-#include <SPIFFS.h>
+#include <FS.h>
 
 class Webserver {
 
@@ -71,11 +71,8 @@ class Webserver {
 	
 		Webserver() {
 			server = NULL;
-			events = NULL;
 		}
 		
-		AsyncEventSource *events;
-		
 		void begin();
 		void sendWebSocketMessage(String jsonValues);
 		void createSettingsFile ();
@@ -99,9 +96,12 @@ class Webserver {
 		
 
 		static void saveLiftDataForm(AsyncWebServerRequest *request);
+		static void autoCaptureForm(AsyncWebServerRequest *request);
 		static void parseUserFlowTargetForm(AsyncWebServerRequest *request);
 
 		static void clearLiftData(AsyncWebServerRequest *request);
+		static void configureLiftProfile(AsyncWebServerRequest *request);
+		static String formatLiftValue(int point);
 
 		static void toggleFlowDiffTile (); 
 		static void fileUpload(AsyncWebServerRequest *request, String filename, size_t index, uint8_t *data, size_t len, bool final);